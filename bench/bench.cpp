@@ -0,0 +1,214 @@
+#include "bench.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../src/arena.hpp"
+#include "../src/catalog.hpp"
+
+#define BENCH_MAX_RESULTS 64
+
+bench_options bench_config = {.scale = 1, .samples = BENCH_DEFAULT_SAMPLES, .filter = nullptr};
+
+static bench_result results[BENCH_MAX_RESULTS];
+static uint32_t		result_count;
+
+bool
+bench_selected(const char *name)
+{
+	return !bench_config.filter || strstr(name, bench_config.filter);
+}
+
+void
+bench_record(const char *name, uint64_t ops, double *sample_ns, uint32_t samples)
+{
+	if (result_count == BENCH_MAX_RESULTS || ops == 0)
+	{
+		return;
+	}
+
+	std::sort(sample_ns, sample_ns + samples);
+	double total = 0;
+	for (uint32_t i = 0; i < samples; i++)
+	{
+		total += sample_ns[i];
+	}
+
+	bench_result *result = &results[result_count++];
+	result->name = name;
+	result->samples = samples;
+	result->ops = ops;
+	result->p50 = sample_ns[samples / 2] / ops;
+	result->p99 = sample_ns[std::min(samples - 1, (uint32_t)(samples * 0.99))] / ops;
+	result->mean = total / samples / ops;
+
+	printf("%-24s %12.1f %12.1f %12.1f %10llu\n", name, result->p50, result->p99, result->mean,
+		   (unsigned long long)ops);
+	fflush(stdout);
+}
+
+/*
+ * One benchmark to a line, so a baseline can be read back with sscanf
+ */
+static bool
+write_results(const char *path)
+{
+	FILE *file = fopen(path, "w");
+	if (!file)
+	{
+		fprintf(stderr, "bench: can't write %s\n", path);
+		return false;
+	}
+
+	fprintf(file, "{\n  \"scale\": %u,\n  \"samples\": %u,\n  \"unit\": \"ns/op\",\n  \"benchmarks\": [\n",
+			bench_config.scale, bench_config.samples);
+	for (uint32_t i = 0; i < result_count; i++)
+	{
+		bench_result *result = &results[i];
+		fprintf(file,
+				"    {\"name\": \"%s\", \"ops\": %llu, \"samples\": %u, \"p50\": %.1f, \"p99\": %.1f, \"mean\": "
+				"%.1f}%s\n",
+				result->name, (unsigned long long)result->ops, result->samples, result->p50, result->p99,
+				result->mean, i + 1 < result_count ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+	fclose(file);
+	return true;
+}
+
+/*
+ * Compares each result's p50 against the baseline's, false if any is slower
+ * by more than tolerance, a fraction
+ */
+static bool
+compare_baseline(const char *path, double tolerance)
+{
+	FILE *file = fopen(path, "r");
+	if (!file)
+	{
+		fprintf(stderr, "bench: can't read baseline %s\n", path);
+		return false;
+	}
+
+	bool	 passed = true;
+	uint32_t compared = 0;
+	char	 line[512];
+	printf("\n%-24s %12s %12s %8s\n", "vs baseline", "p50", "was", "change");
+	while (fgets(line, sizeof(line), file))
+	{
+		uint32_t scale;
+		if (sscanf(line, " \"scale\": %u", &scale) == 1 && scale != bench_config.scale)
+		{
+			printf("baseline was run at --scale %u, the SQL times won't compare\n", scale);
+			continue;
+		}
+
+		char   name[128];
+		double p50;
+		if (sscanf(line, " {\"name\": \"%127[^\"]\", \"ops\": %*llu, \"samples\": %*u, \"p50\": %lf", name, &p50) !=
+			2)
+		{
+			continue;
+		}
+
+		for (uint32_t i = 0; i < result_count; i++)
+		{
+			if (strcmp(results[i].name, name) != 0)
+			{
+				continue;
+			}
+
+			double change = results[i].p50 / p50 - 1;
+			bool   regressed = change > tolerance;
+			printf("%-24s %12.1f %12.1f %+7.0f%%%s\n", name, results[i].p50, p50, change * 100,
+				   regressed ? "  REGRESSED" : "");
+			passed = passed && !regressed;
+			compared++;
+		}
+	}
+	fclose(file);
+
+	if (compared == 0)
+	{
+		printf("nothing in the baseline matched\n");
+	}
+	return passed;
+}
+
+static void
+print_usage(const char *program)
+{
+	printf("Usage: %s [--scale n] [--samples n] [--filter text] [--out results.json]\n"
+		   "          [--baseline baseline.json] [--tolerance 0.25]\n",
+		   program);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *out = nullptr;
+	const char *baseline = nullptr;
+	double		tolerance = 0.25;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (!value)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		if (strcmp(argv[i], "--scale") == 0)
+		{
+			bench_config.scale = std::max(1, atoi(value));
+		}
+		else if (strcmp(argv[i], "--samples") == 0)
+		{
+			bench_config.samples = std::max(1, atoi(value));
+		}
+		else if (strcmp(argv[i], "--filter") == 0)
+		{
+			bench_config.filter = value;
+		}
+		else if (strcmp(argv[i], "--out") == 0)
+		{
+			out = value;
+		}
+		else if (strcmp(argv[i], "--baseline") == 0)
+		{
+			baseline = value;
+		}
+		else if (strcmp(argv[i], "--tolerance") == 0)
+		{
+			tolerance = atof(value);
+		}
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+		i++;
+	}
+
+	arena<global_arena>::init();
+	arena<query_arena>::init();
+	arena<catalog_arena>::init();
+
+	printf("%-24s %12s %12s %12s %10s\n", "ns/op", "p50", "p99", "mean", "ops");
+	bench_micro();
+	bench_sql();
+
+	if (out && !write_results(out))
+	{
+		return 1;
+	}
+	if (baseline && !compare_baseline(baseline, tolerance))
+	{
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * SQL From Scratch
+ *
+ * Benchmarks
+ *
+ * A separate executable from the tests, see the 'bench' target:
+ *
+ *   ./bench [--scale n] [--samples n] [--filter text] [--out results.json]
+ *           [--baseline baseline.json] [--tolerance 0.25]
+ *
+ * Every benchmark is run for a number of samples after a warm up, each
+ * sample timed on its own. A sample does a batch of operations, a thousand
+ * seeks or one query, and its time is divided between them, so the results
+ * are the 50th and 99th percentile of the per operation time over the
+ * samples, in nanoseconds.
+ *
+ * The workloads are seeded, so every run does the same work:
+ *   micro.cpp  the storage structures on their own, btree, ephemeral tree,
+ *              type comparisons, arena, hash_map and the pager's cache
+ *   sql.cpp    statements end to end against the users, products and
+ *              orders tables of fetch_data.py, generated at --scale times
+ *              their base sizes
+ *
+ * Given a baseline, a previous run's --out, each benchmark's p50 is
+ * compared with it, and the run fails if any is slower by more than the
+ * tolerance. Times only compare on the same machine and build, so the
+ * baseline in bench/, from a Release build, is for spotting large
+ * regressions, a branch is best compared against a baseline made on master
+ * beforehand.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#define BENCH_DEFAULT_SAMPLES 30
+#define BENCH_WARMUP_SAMPLES  3
+
+struct bench_result
+{
+	const char *name;
+	uint32_t	samples;
+	uint64_t	ops; // Per sample
+	double		p50; // Nanoseconds per op
+	double		p99;
+	double		mean;
+};
+
+struct bench_options
+{
+	uint32_t	scale;
+	uint32_t	samples;
+	const char *filter; // Only benchmarks whose names contain it, nullptr for all
+};
+
+extern bench_options bench_config;
+
+/*
+ * Whether the benchmark should be run, see --filter
+ */
+bool
+bench_selected(const char *name);
+
+/*
+ * Records a benchmark's sample times, ops per sample
+ */
+void
+bench_record(const char *name, uint64_t ops, double *sample_ns, uint32_t samples);
+
+/*
+ * Runs setup, body and teardown once per sample, timing only body, which
+ * returns how many operations it did
+ */
+template <typename Setup, typename Body, typename Teardown>
+void
+bench_case(const char *name, Setup setup, Body body, Teardown teardown)
+{
+	if (!bench_selected(name))
+	{
+		return;
+	}
+
+	uint32_t samples = bench_config.samples;
+	double	 sample_ns[samples];
+	uint64_t ops = 0;
+	for (uint32_t i = 0; i < BENCH_WARMUP_SAMPLES + samples; i++)
+	{
+		setup();
+		auto start = std::chrono::steady_clock::now();
+		ops = body();
+		auto end = std::chrono::steady_clock::now();
+		teardown();
+
+		if (i >= BENCH_WARMUP_SAMPLES)
+		{
+			sample_ns[i - BENCH_WARMUP_SAMPLES] = std::chrono::duration<double, std::nano>(end - start).count();
+		}
+	}
+	bench_record(name, ops, sample_ns, samples);
+}
+
+template <typename Body>
+void
+bench_case(const char *name, Body body)
+{
+	bench_case(name, [] {}, body, [] {});
+}
+
+/*
+ * A deterministic generator, the same sequence on every run and platform
+ */
+struct bench_random
+{
+	uint64_t state;
+
+	uint32_t
+	next()
+	{
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		return (uint32_t)(state >> 33);
+	}
+
+	uint32_t
+	below(uint32_t bound)
+	{
+		return next() % bound;
+	}
+};
+
+void
+bench_micro();
+
+void
+bench_sql();
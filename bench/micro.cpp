@@ -0,0 +1,270 @@
+#include "bench.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#include "../src/arena.hpp"
+#include "../src/btree.hpp"
+#include "../src/ephemeral.hpp"
+#include "../src/os_layer.hpp"
+#include "../src/pager.hpp"
+#include "../src/types.hpp"
+
+#define BENCH_MICRO_DB "bench_micro.db"
+
+#define TREE_KEYS	   100000
+#define BATCH		   10000
+#define PAGER_PAGES	   4096
+#define PAGER_CACHE	   64
+#define PAGER_HOT_SET  32
+#define COMPARE_VALUES 4096
+
+struct bench_arena
+{
+};
+
+/*
+ * Keys 0 to count - 1 in a seeded order
+ */
+static uint32_t *
+shuffled_keys(uint32_t count, uint64_t seed)
+{
+	uint32_t *keys = (uint32_t *)arena<global_arena>::alloc(sizeof(uint32_t) * count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		keys[i] = i;
+	}
+
+	bench_random random = {seed};
+	for (uint32_t i = count - 1; i > 0; i--)
+	{
+		uint32_t j = random.below(i + 1);
+		uint32_t swap = keys[i];
+		keys[i] = keys[j];
+		keys[j] = swap;
+	}
+	return keys;
+}
+
+static void
+bench_btree()
+{
+	uint32_t *keys = shuffled_keys(TREE_KEYS, 1);
+	uint32_t  record = 0;
+
+	// A fresh tree per sample, rolled back after
+	btree	  scratch;
+	bt_cursor scratch_cursor;
+	bench_case(
+		"bt_cursor_insert",
+		[&] {
+			pager_begin_transaction();
+			scratch = bt_create(TYPE_U32, sizeof(uint32_t), true);
+			scratch_cursor = {.tree = &scratch};
+		},
+		[&] {
+			for (uint32_t i = 0; i < BATCH; i++)
+			{
+				bt_cursor_insert(&scratch_cursor, &keys[i], &record);
+			}
+			return (uint64_t)BATCH;
+		},
+		[] { pager_rollback(); });
+
+	pager_begin_transaction();
+	btree	  tree = bt_create(TYPE_U32, sizeof(uint32_t), true);
+	bt_cursor cursor = {.tree = &tree};
+	for (uint32_t i = 0; i < TREE_KEYS; i++)
+	{
+		bt_cursor_insert(&cursor, &keys[i], &record);
+	}
+	pager_commit();
+
+	bench_random random = {2};
+	bench_case("bt_cursor_seek", [&] {
+		for (uint32_t i = 0; i < BATCH; i++)
+		{
+			uint32_t key = random.below(TREE_KEYS);
+			bt_cursor_seek(&cursor, &key);
+		}
+		return (uint64_t)BATCH;
+	});
+
+	bench_case("bt_cursor_scan", [&] {
+		uint64_t rows = 0;
+		for (bool more = bt_cursor_first(&cursor); more; more = bt_cursor_next(&cursor))
+		{
+			rows++;
+		}
+		return rows;
+	});
+
+	pager_begin_transaction();
+	bt_clear(&tree);
+	pager_commit();
+}
+
+static void
+bench_ephemeral()
+{
+	uint32_t *keys = shuffled_keys(BATCH, 3);
+	uint32_t  record = 0;
+
+	// Inserting then reading back in order is how ORDER BY used it
+	bench_case(
+		"et_insert_sort", [] {},
+		[&] {
+			et_cursor cursor = {.tree = et_create(TYPE_U32, sizeof(uint32_t), false)};
+			for (uint32_t i = 0; i < BATCH; i++)
+			{
+				et_insert(&cursor.tree, &keys[i], &record);
+			}
+			uint64_t rows = 0;
+			for (bool more = et_cursor_first(&cursor); more; more = et_cursor_next(&cursor))
+			{
+				rows++;
+			}
+			return rows;
+		},
+		[] { arena<query_arena>::reset(); });
+}
+
+static void
+bench_types()
+{
+	bench_random random = {4};
+	uint32_t	*numbers = (uint32_t *)arena<global_arena>::alloc(sizeof(uint32_t) * COMPARE_VALUES);
+	char		*strings = (char *)arena<global_arena>::alloc(32 * COMPARE_VALUES);
+	memset(strings, 0, 32 * COMPARE_VALUES);
+	for (uint32_t i = 0; i < COMPARE_VALUES; i++)
+	{
+		numbers[i] = random.next();
+		// A shared prefix, as column values often have
+		snprintf(strings + i * 32, 32, "user_%08u", random.below(1000000));
+	}
+
+	bench_case("type_compare_u32", [&] {
+		int32_t sum = 0;
+		for (uint32_t i = 0; i + 1 < COMPARE_VALUES; i++)
+		{
+			sum += type_compare(TYPE_U32, &numbers[i], &numbers[i + 1]);
+		}
+		asm volatile("" : : "r"(sum));
+		return (uint64_t)(COMPARE_VALUES - 1);
+	});
+
+	bench_case("type_compare_char32", [&] {
+		int32_t sum = 0;
+		for (uint32_t i = 0; i + 1 < COMPARE_VALUES; i++)
+		{
+			sum += type_compare(TYPE_CHAR32, strings + i * 32, strings + (i + 1) * 32);
+		}
+		asm volatile("" : : "r"(sum));
+		return (uint64_t)(COMPARE_VALUES - 1);
+	});
+}
+
+static void
+bench_arena_and_hash_map()
+{
+	arena<bench_arena>::init();
+
+	bench_case(
+		"arena_alloc_reset", [] {},
+		[] {
+			bench_random random = {5};
+			for (uint32_t i = 0; i < BATCH; i++)
+			{
+				void *memory = arena<bench_arena>::alloc(8 + random.below(120));
+				asm volatile("" : : "r"(memory));
+			}
+			arena<bench_arena>::reset();
+			return (uint64_t)BATCH;
+		},
+		[] {});
+
+	uint32_t *keys = shuffled_keys(BATCH, 6);
+	bench_case(
+		"hash_map_insert", [] {},
+		[&] {
+			hash_map<uint32_t, uint32_t, bench_arena> map;
+			for (uint32_t i = 0; i < BATCH; i++)
+			{
+				map.insert(keys[i], i);
+			}
+			return (uint64_t)BATCH;
+		},
+		[] { arena<bench_arena>::reset(); });
+
+	hash_map<uint32_t, uint32_t, bench_arena> map;
+	for (uint32_t i = 0; i < BATCH; i++)
+	{
+		map.insert(keys[i], i);
+	}
+	bench_random random = {7};
+	bench_case("hash_map_get", [&] {
+		uint32_t found = 0;
+		for (uint32_t i = 0; i < BATCH; i++)
+		{
+			// Half miss
+			found += map.get(random.below(BATCH * 2)) != nullptr;
+		}
+		asm volatile("" : : "r"(found));
+		return (uint64_t)BATCH;
+	});
+
+	arena<bench_arena>::shutdown();
+}
+
+/*
+ * Reopened with a small cache, so a hot set of pages stays in it and
+ * random pages across the file mostly miss
+ */
+static void
+bench_pager()
+{
+	uint32_t *pages = (uint32_t *)arena<global_arena>::alloc(sizeof(uint32_t) * PAGER_PAGES);
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < PAGER_PAGES; i++)
+	{
+		pages[i] = pager_new();
+	}
+	pager_commit();
+	pager_close();
+	pager_open(BENCH_MICRO_DB, PAGER_CACHE);
+
+	bench_random random = {8};
+	bench_case("pager_hit", [&] {
+		for (uint32_t i = 0; i < BATCH; i++)
+		{
+			base_page *page = pager_get(pages[random.below(PAGER_HOT_SET)]);
+			asm volatile("" : : "r"(page));
+		}
+		return (uint64_t)BATCH;
+	});
+
+	bench_case("pager_miss", [&] {
+		for (uint32_t i = 0; i < BATCH / 10; i++)
+		{
+			base_page *page = pager_get(pages[random.below(PAGER_PAGES)]);
+			asm volatile("" : : "r"(page));
+		}
+		return (uint64_t)(BATCH / 10);
+	});
+}
+
+void
+bench_micro()
+{
+	os_file_delete(BENCH_MICRO_DB);
+	pager_open(BENCH_MICRO_DB);
+
+	bench_btree();
+	bench_ephemeral();
+	bench_types();
+	bench_arena_and_hash_map();
+	bench_pager();
+
+	pager_close();
+	os_file_delete(BENCH_MICRO_DB);
+}
@@ -0,0 +1,252 @@
+#include "bench.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../src/arena.hpp"
+#include "../src/catalog.hpp"
+#include "../src/os_layer.hpp"
+#include "../src/pager.hpp"
+#include "../src/prepared.hpp"
+#include "../src/repl.hpp"
+
+#define BENCH_SQL_DB "bench_sql.db"
+
+/* Rows per unit of --scale */
+#define USERS_PER_SCALE	   10000
+#define PRODUCTS_PER_SCALE 2000
+#define ORDERS_PER_SCALE   50000
+
+#define POINT_LOOKUPS 1000
+#define INSERT_BATCH  1000
+
+static const char *cities[] = {"Phoenix", "Houston", "Chicago", "Seattle", "Denver", "Austin", "Boston", "Miami"};
+static const char *categories[] = {"toys", "electronics", "books", "garden", "sports", "beauty", "grocery", "home"};
+static const char *brands[] = {"BookWorld", "SportsPro", "HomeBase", "TechNova", "GreenLeaf", "PlayTime"};
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+static uint64_t rows_seen;
+
+static void
+count_rows(typed_value *values, size_t count)
+{
+	rows_seen++;
+}
+
+static void
+run(const char *sql)
+{
+	if (!execute_sql_statements(sql, count_rows))
+	{
+		fprintf(stderr, "bench: failed: %s\n", sql);
+		exit(1);
+	}
+}
+
+static uint32_t counted;
+
+static void
+count_value(typed_value *values, size_t count)
+{
+	counted = values[0].as_u32();
+}
+
+/* The single value a COUNT(*) query returns */
+static uint32_t
+count(const char *sql)
+{
+	counted = 0;
+	if (!execute_sql_statements(sql, count_value))
+	{
+		fprintf(stderr, "bench: failed: %s\n", sql);
+		exit(1);
+	}
+	return counted;
+}
+
+/*
+ * Generated the same on every run, and in key order so COPY bulk loads them
+ */
+static void
+write_tables(uint32_t users, uint32_t products, uint32_t orders)
+{
+	bench_random random = {11};
+
+	FILE *file = fopen("bench_users.csv", "w");
+	fprintf(file, "user_id,username,email,age,city\n");
+	for (uint32_t id = 1; id <= users; id++)
+	{
+		fprintf(file, "%u,user%u,user%u@example.com,%u,%s\n", id, id, id, 18 + random.below(60),
+				cities[random.below(COUNT_OF(cities))]);
+	}
+	fclose(file);
+
+	file = fopen("bench_products.csv", "w");
+	fprintf(file, "product_id,title,category,price,stock,brand\n");
+	for (uint32_t id = 1; id <= products; id++)
+	{
+		fprintf(file, "%u,Product %u,%s,%u,%u,%s\n", id, id, categories[random.below(COUNT_OF(categories))],
+				1 + random.below(1000), random.below(500), brands[random.below(COUNT_OF(brands))]);
+	}
+	fclose(file);
+
+	file = fopen("bench_orders.csv", "w");
+	fprintf(file, "order_id,user_id,total,total_quantity,discount\n");
+	for (uint32_t id = 1; id <= orders; id++)
+	{
+		uint32_t total = 100 + random.below(100000);
+		fprintf(file, "%u,%u,%u,%u,%u\n", id, 1 + random.below(users), total, 1 + random.below(20),
+				total - random.below(total / 10 + 1));
+	}
+	fclose(file);
+}
+
+static void
+load_tables()
+{
+	uint32_t users = USERS_PER_SCALE * bench_config.scale;
+	uint32_t products = PRODUCTS_PER_SCALE * bench_config.scale;
+	uint32_t orders = ORDERS_PER_SCALE * bench_config.scale;
+	write_tables(users, products, orders);
+
+	run("CREATE TABLE users (user_id INT, username TEXT, email TEXT, age INT, city TEXT);");
+	run("CREATE TABLE products (product_id INT, title TEXT, category TEXT, price INT, stock INT, brand TEXT);");
+	run("CREATE TABLE orders (order_id INT, user_id INT, total INT, total_quantity INT, discount INT);");
+	run("COPY users FROM 'bench_users.csv';");
+	run("COPY products FROM 'bench_products.csv';");
+	run("COPY orders FROM 'bench_orders.csv';");
+	run("CREATE INDEX orders_user ON orders (user_id);");
+	run("ANALYZE;");
+	arena<query_arena>::reset();
+
+	os_file_delete("bench_users.csv");
+	os_file_delete("bench_products.csv");
+	os_file_delete("bench_orders.csv");
+}
+
+/*
+ * A query timed as one op, its rows discarded
+ */
+static void
+bench_query(const char *name, const char *sql)
+{
+	bench_case(
+		name, [] {},
+		[sql] {
+			run(sql);
+			return (uint64_t)1;
+		},
+		[] { arena<query_arena>::reset(); });
+}
+
+/*
+ * A statement timed inside a transaction that's rolled back after, so every
+ * sample starts from the same tables. affected counts the rows it's to
+ * change, checked to be none once it's run and all of them again after the
+ * rollback, so no sample times a statement left with nothing to do.
+ */
+static void
+bench_write(const char *name, const char *sql, const char *affected)
+{
+	uint32_t expected = count(affected);
+	bench_case(
+		name, [] { run("BEGIN;"); },
+		[sql] {
+			run(sql);
+			return (uint64_t)1;
+		},
+		[=] {
+			uint32_t left = count(affected);
+			run("ROLLBACK;");
+			uint32_t restored = count(affected);
+			if (expected == 0 || left != 0 || restored != expected)
+			{
+				fprintf(stderr, "bench: %s changed %u of %u rows, %u after the rollback\n", name,
+						expected - left, expected, restored);
+				exit(1);
+			}
+			arena<query_arena>::reset();
+		});
+}
+
+static void
+bench_prepared()
+{
+	uint32_t			users = USERS_PER_SCALE * bench_config.scale;
+	prepared_statement *lookup = sql_prepare("SELECT * FROM users WHERE user_id = ?;");
+	bench_random		random = {12};
+	bench_case(
+		"sql_point_lookup", [] {},
+		[&] {
+			for (uint32_t i = 0; i < POINT_LOOKUPS; i++)
+			{
+				sql_bind_int(lookup, 0, 1 + random.below(users));
+				sql_step(lookup, count_rows);
+				sql_reset(lookup);
+			}
+			return (uint64_t)POINT_LOOKUPS;
+		},
+		[] { arena<query_arena>::reset(); });
+	sql_finalize(lookup);
+
+	prepared_statement *insert = sql_prepare("INSERT INTO orders VALUES (?, ?, ?, ?, ?);");
+	uint32_t			first = ORDERS_PER_SCALE * bench_config.scale + 1;
+	bench_case(
+		"sql_insert_batch", [] { run("BEGIN;"); },
+		[&] {
+			for (uint32_t i = 0; i < INSERT_BATCH; i++)
+			{
+				sql_bind_int(insert, 0, first + i);
+				sql_bind_int(insert, 1, 1 + random.below(users));
+				sql_bind_int(insert, 2, random.below(100000));
+				sql_bind_int(insert, 3, 1 + random.below(20));
+				sql_bind_int(insert, 4, 0);
+				if (sql_step(insert) != OK)
+				{
+					fprintf(stderr, "bench: sql_insert_batch failed, the last batch wasn't rolled back\n");
+					exit(1);
+				}
+				sql_reset(insert);
+			}
+			return (uint64_t)INSERT_BATCH;
+		},
+		[] {
+			run("ROLLBACK;");
+			arena<query_arena>::reset();
+		});
+	sql_finalize(insert);
+}
+
+void
+bench_sql()
+{
+	// Loading the tables is most of the run, skipped unless a filter could match
+	if (bench_config.filter && !strstr(bench_config.filter, "sql"))
+	{
+		return;
+	}
+
+	os_file_delete(BENCH_SQL_DB);
+	pager_open(BENCH_SQL_DB);
+	bootstrap_master(true);
+	load_tables();
+
+	bench_prepared();
+	bench_query("sql_range_scan", "SELECT * FROM orders WHERE order_id > 1000 AND order_id < 3000;");
+	bench_query("sql_index_lookup", "SELECT order_id, total FROM orders WHERE user_id = 42;");
+	bench_query("sql_filter_scan", "SELECT * FROM users WHERE age > 60 AND city = 'Denver';");
+	bench_query("sql_group_by", "SELECT city, COUNT(*), AVG(age) FROM users GROUP BY city;");
+	bench_query("sql_order_by_limit", "SELECT * FROM products ORDER BY price DESC LIMIT 10;");
+	bench_query("sql_join", "SELECT users.username, orders.total FROM users JOIN orders ON users.user_id = "
+							"orders.user_id WHERE users.city = 'Boston' AND users.age < 25;");
+	bench_write("sql_update", "UPDATE products SET stock = 0 WHERE category = 'toys';",
+				"SELECT COUNT(*) FROM products WHERE category = 'toys' AND stock > 0;");
+	bench_write("sql_delete", "DELETE FROM orders WHERE total < 5000;",
+				"SELECT COUNT(*) FROM orders WHERE total < 5000;");
+
+	pager_close();
+	os_file_delete(BENCH_SQL_DB);
+}
@@ -15,6 +15,16 @@
  * 3. Containers can reclaim() memory when growing
  * 4. reset() nukes everything but keeps pages committed
  * 4. reset_and_decommit() nukes everything and give's back pages
+ *
+ * An arena that zeroes on reset only zeroes what was used since the last one,
+ * so a small query after a large one doesn't pay for the large one's pages.
+ * Those pages stay committed, unless a decommit policy is set, in which case
+ * after a run of resets that each stayed under a watermark, what's committed
+ * above it is given back. stats() has the counters, for .arena in the REPL.
+ *
+ * An arena belongs to one thread, unless it's shared for a while through
+ * arena_share, when allocating and reclaiming take a latch. Some tags are
+ * per thread instead, see arena_per_thread.
  */
 
 #pragma once
@@ -24,8 +34,10 @@
 #include <cstdlib>
 #include "common.hpp"
 #include <cstdint>
+#include <mutex>
 #include <string_view>
 #include <typeinfo>
+#include <utility>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -34,6 +46,12 @@
 #include <unistd.h>
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 /* Cross-platform virtual memory operations for the custom allocators*/
 struct virtual_memory
 {
@@ -109,43 +127,104 @@ struct global_arena
 {
 };
 
+/* Up to this much is zeroed in place on reset, more is handed back to the OS to zero lazily */
+#define ARENA_MEMSET_LIMIT (256 * 1024)
+
+struct arena_stats
+{
+	size_t	 used;
+	size_t	 peak; // The most used between two resets, since init
+	size_t	 committed;
+	uint64_t commits; // Times more pages were committed
+	uint64_t decommits;
+	uint64_t resets;
+};
+
+/*
+ * An arena is process wide unless its tag is marked per thread, in which case
+ * every thread has an arena of its own under the same tag, to init before it
+ * allocates. A session's arenas are per thread, so statements on different
+ * threads never allocate from each other's (see session.hpp).
+ */
+template <typename Tag> inline constexpr bool arena_per_thread = false;
+template <> inline constexpr bool arena_per_thread<global_arena> = true;
+template <> inline constexpr bool arena_per_thread<query_arena> = true;
+
 template <typename Tag = global_arena, bool zero_on_reset = true, size_t Align = 8> struct arena
 {
 	static_assert((Align & (Align - 1)) == 0, "Alignment must be power of 2");
 	static_assert(Align >= sizeof(void *), "Alignment must be at least pointer size");
 
-	static inline uint8_t *base = nullptr;
-	static inline uint8_t *current = nullptr;
-	static inline size_t   reserved_capacity = 0;
-	static inline size_t   committed_capacity = 0;
-	static inline size_t   max_capacity = 0;
-	static inline size_t   initial_commit = 0;
-
 	struct free_block
 	{
 		free_block *next;
 		size_t		size;
 	};
 
-	/*
-	 * Freelist buckets organized by power-of-2 size classes.
-	 * freelists[4] = blocks of size [16, 32]
-	 * freelists[5] = blocks of size [32, 64]
-	 * etc.
-	 */
-	static inline free_block *freelists[32] = {};
-	static inline uint32_t	  occupied_buckets = 0; // Bitmask: which buckets have blocks
+	struct arena_state
+	{
+		uint8_t *base;
+		uint8_t *current;
+		size_t	 reserved_capacity;
+		size_t	 committed_capacity;
+		size_t	 max_capacity;
+		size_t	 initial_commit;
+
+		/* Past current once it's been rewound, the end of what reset must zero */
+		uint8_t *high_water;
+
+		/* See set_decommit_policy, off while decommit_after is 0 */
+		size_t	 watermark;
+		uint32_t decommit_after;
+		uint32_t small_resets;
+
+		size_t	 peak;
+		uint64_t commits;
+		uint64_t decommits;
+		uint64_t resets;
+
+		/*
+		 * Freelist buckets organized by power-of-2 size classes.
+		 * freelists[4] = blocks of size [16, 32]
+		 * freelists[5] = blocks of size [32, 64]
+		 * etc.
+		 */
+		free_block *freelists[32];
+		uint32_t	occupied_buckets; // Bitmask: which buckets have blocks
+
+		/* Set while the arena is shared between threads, see arena_share */
+		std::mutex *latch;
+	};
+
+	static inline arena_state					process_state = {};
+	static inline thread_local arena_state	thread_state = {};
+	static inline thread_local arena_state *joined = nullptr; /* See arena_share */
+
+	/* The arena the calling thread allocates from */
+	static arena_state &
+	state()
+	{
+		if constexpr (arena_per_thread<Tag>)
+		{
+			return joined ? *joined : thread_state;
+		}
+		else
+		{
+			return process_state;
+		}
+	}
 
 	static bool
 	init(size_t initial = PAGE_SIZE, size_t maximum = 0)
 	{
-		if (base)
+		arena_state &s = state();
+		if (s.base)
 		{
 			return true;
 		}
 
-		initial_commit = virtual_memory::round_to_pages(initial);
-		max_capacity = maximum;
+		s.initial_commit = virtual_memory::round_to_pages(initial);
+		s.max_capacity = maximum;
 
 		/*
 		 * Reserve a huge virtual address range upfront.
@@ -155,57 +234,67 @@ template <typename Tag = global_arena, bool zero_on_reset = true, size_t Align =
 		 * This means that each arena can have it's own address space giving it a
 		 * contiguous view of memory
 		 */
-		reserved_capacity = max_capacity ? max_capacity : (1ULL << 33); // 8GB
+		s.reserved_capacity = s.max_capacity ? s.max_capacity : (1ULL << 33); // 8GB
 
-		base = (uint8_t *)virtual_memory::reserve(reserved_capacity);
-		if (!base)
+		s.base = (uint8_t *)virtual_memory::reserve(s.reserved_capacity);
+		if (!s.base)
 		{
 			fprintf(stderr, "Failed to reserve virtual memory\n");
 			return false;
 		}
 
-		current = base;
-		committed_capacity = 0;
+		s.current = s.base;
+		s.high_water = s.base;
+		s.committed_capacity = 0;
+		s.watermark = 0;
+		s.decommit_after = 0;
+		s.small_resets = 0;
+		s.peak = 0;
+		s.commits = 0;
+		s.decommits = 0;
+		s.resets = 0;
 
-		if (initial_commit > 0)
+		if (s.initial_commit > 0)
 		{
-			if (!virtual_memory::commit(base, initial_commit))
+			if (!virtual_memory::commit(s.base, s.initial_commit))
 			{
-				fprintf(stderr, "Failed to commit initial memory: %zu bytes\n", initial_commit);
-				virtual_memory::release(base, reserved_capacity);
-				base = nullptr;
+				fprintf(stderr, "Failed to commit initial memory: %zu bytes\n", s.initial_commit);
+				virtual_memory::release(s.base, s.reserved_capacity);
+				s.base = nullptr;
 				return false;
 			}
-			committed_capacity = initial_commit;
+			s.committed_capacity = s.initial_commit;
 		}
 
 		for (int i = 0; i < 32; i++)
 		{
-			freelists[i] = nullptr;
+			s.freelists[i] = nullptr;
 		}
-		occupied_buckets = 0;
+		s.occupied_buckets = 0;
 		return true;
 	}
 
 	static void
 	shutdown()
 	{
-		if (!base)
+		arena_state &s = state();
+		if (!s.base)
 		{
 			return;
 		}
-		virtual_memory::release(base, reserved_capacity);
-		base = nullptr;
-		current = nullptr;
-		reserved_capacity = 0;
-		committed_capacity = 0;
-		max_capacity = 0;
+		virtual_memory::release(s.base, s.reserved_capacity);
+		s.base = nullptr;
+		s.current = nullptr;
+		s.high_water = nullptr;
+		s.reserved_capacity = 0;
+		s.committed_capacity = 0;
+		s.max_capacity = 0;
 
 		for (int i = 0; i < 32; i++)
 		{
-			freelists[i] = nullptr;
+			s.freelists[i] = nullptr;
 		}
-		occupied_buckets = 0;
+		s.occupied_buckets = 0;
 	}
 
 	/*
@@ -238,14 +327,21 @@ template <typename Tag = global_arena, bool zero_on_reset = true, size_t Align =
 	static void
 	reclaim(void *ptr, size_t size)
 	{
-		if (!ptr || !base || size < sizeof(free_block))
+		arena_state &s = state();
+		std::unique_lock<std::mutex> guard;
+		if (s.latch)
+		{
+			guard = std::unique_lock<std::mutex>(*s.latch);
+		}
+
+		if (!ptr || !s.base || size < sizeof(free_block))
 		{
 			return;
 		}
 
 		uint8_t *addr = (uint8_t *)ptr;
 
-		if (addr < base || addr >= base + reserved_capacity || addr >= current)
+		if (addr < s.base || addr >= s.base + s.reserved_capacity || addr >= s.current)
 		{
 			return;
 		}
@@ -254,10 +350,10 @@ template <typename Tag = global_arena, bool zero_on_reset = true, size_t Align =
 
 		free_block *block = (free_block *)ptr;
 		block->size = size;
-		block->next = freelists[size_class];
-		freelists[size_class] = block;
+		block->next = s.freelists[size_class];
+		s.freelists[size_class] = block;
 
-		occupied_buckets |= (1u << size_class);
+		s.occupied_buckets |= (1u << size_class);
 	}
 
 	/*
@@ -268,7 +364,7 @@ template <typename Tag = global_arena, bool zero_on_reset = true, size_t Align =
 	 * bucket that can satisfy our request.
 	 */
 	static void *
-	try_alloc_from_freelist(size_t size)
+	try_alloc_from_freelist(arena_state &s, size_t size)
 	{
 		int size_class = get_size_class(size);
 
@@ -286,7 +382,7 @@ template <typename Tag = global_arena, bool zero_on_reset = true, size_t Align =
 		 * Then AND with occupied_buckets to find available buckets.
 		 */
 		uint32_t mask = ~((1u << size_class) - 1);
-		uint32_t candidates = occupied_buckets & mask;
+		uint32_t candidates = s.occupied_buckets & mask;
 
 		if (!candidates)
 		{
@@ -301,12 +397,12 @@ template <typename Tag = global_arena, bool zero_on_reset = true, size_t Align =
 		int cls = __builtin_ctz(candidates);
 #endif
 
-		free_block *block = freelists[cls];
-		freelists[cls] = block->next;
+		free_block *block = s.freelists[cls];
+		s.freelists[cls] = block->next;
 
-		if (!freelists[cls])
+		if (!s.freelists[cls])
 		{
-			occupied_buckets &= ~(1u << cls); // Bucket now empty
+			s.occupied_buckets &= ~(1u << cls); // Bucket now empty
 		}
 
 		return block;
@@ -315,70 +411,78 @@ template <typename Tag = global_arena, bool zero_on_reset = true, size_t Align =
 	static void *
 	alloc(size_t size)
 	{
-		if (!base || size == 0 || size >= reserved_capacity)
+		arena_state &s = state();
+		std::unique_lock<std::mutex> guard;
+		if (s.latch)
+		{
+			guard = std::unique_lock<std::mutex>(*s.latch);
+		}
+
+		if (!s.base || size == 0 || size >= s.reserved_capacity)
 		{
 			return nullptr;
 		}
 
-		void *recycled = try_alloc_from_freelist(size);
+		void *recycled = try_alloc_from_freelist(s, size);
 		if (recycled)
 		{
 			return recycled;
 		}
 
-		uint8_t *aligned = (uint8_t *)(((uintptr_t)current + (Align - 1)) & ~(Align - 1));
+		uint8_t *aligned = (uint8_t *)(((uintptr_t)s.current + (Align - 1)) & ~(Align - 1));
 		uint8_t *next = aligned + size;
 
-		if (!ensure_committed(next))
+		if (!ensure_committed(s, next))
 		{
 			return nullptr;
 		}
 
-		current = next;
+		s.current = next;
 		return aligned;
 	}
 
 	static bool
-	ensure_committed(uint8_t *next)
+	ensure_committed(arena_state &s, uint8_t *next)
 	{
-		if (next <= base + committed_capacity)
+		if (next <= s.base + s.committed_capacity)
 		{
 			return true;
 		}
-		size_t needed = next - base;
+		size_t needed = next - s.base;
 
-		if (max_capacity > 0 && needed > max_capacity)
+		if (s.max_capacity > 0 && needed > s.max_capacity)
 		{
-			fprintf(stderr, "Arena exhausted: requested %zu, max %zu\n", needed, max_capacity);
+			fprintf(stderr, "Arena exhausted: requested %zu, max %zu\n", needed, s.max_capacity);
 			return false;
 		}
 
-		if (needed > reserved_capacity)
+		if (needed > s.reserved_capacity)
 		{
-			fprintf(stderr, "Arena exhausted: requested %zu, reserved %zu\n", needed, reserved_capacity);
+			fprintf(stderr, "Arena exhausted: requested %zu, reserved %zu\n", needed, s.reserved_capacity);
 			return false;
 		}
 
 		size_t new_committed = virtual_memory::round_to_pages(needed);
 
-		if (max_capacity > 0 && new_committed > max_capacity)
+		if (s.max_capacity > 0 && new_committed > s.max_capacity)
 		{
-			new_committed = max_capacity;
+			new_committed = s.max_capacity;
 		}
 
-		if (new_committed > reserved_capacity)
+		if (new_committed > s.reserved_capacity)
 		{
-			new_committed = reserved_capacity;
+			new_committed = s.reserved_capacity;
 		}
 
-		size_t commit_size = new_committed - committed_capacity;
-		if (!virtual_memory::commit(base + committed_capacity, commit_size))
+		size_t commit_size = new_committed - s.committed_capacity;
+		if (!virtual_memory::commit(s.base + s.committed_capacity, commit_size))
 		{
 			fprintf(stderr, "Failed to commit memory: %zu bytes\n", commit_size);
 			return false;
 		}
 
-		committed_capacity = new_committed;
+		s.committed_capacity = new_committed;
+		s.commits++;
 		return true;
 	}
 
@@ -389,20 +493,27 @@ template <typename Tag = global_arena, bool zero_on_reset = true, size_t Align =
 	static void *
 	bump_alloc(size_t size)
 	{
-		if (!base || size == 0 || size >= reserved_capacity)
+		arena_state &s = state();
+		std::unique_lock<std::mutex> guard;
+		if (s.latch)
+		{
+			guard = std::unique_lock<std::mutex>(*s.latch);
+		}
+
+		if (!s.base || size == 0 || size >= s.reserved_capacity)
 		{
 			return nullptr;
 		}
 
-		uint8_t *result = current;
-		uint8_t *next = current + size;
+		uint8_t *result = s.current;
+		uint8_t *next = s.current + size;
 
-		if (!ensure_committed(next))
+		if (!ensure_committed(s, next))
 		{
 			return nullptr;
 		}
 
-		current = next;
+		s.current = next;
 		return result;
 	}
 
@@ -422,73 +533,256 @@ template <typename Tag = global_arena, bool zero_on_reset = true, size_t Align =
 #endif
 	}
 
+	/*
+	 * Nothing past current has been handed out since the last reset, so it's
+	 * still zero, and only [base, current) needs zeroing. A little is cheaper
+	 * to memset than to fault back in, a lot is cheaper to give to the OS.
+	 */
 	static void
-	reset()
+	zero_used(arena_state &s, size_t used)
 	{
-		current = base;
-
 		if constexpr (zero_on_reset)
 		{
-			if (base && committed_capacity > 0)
+			used = used < s.committed_capacity ? used : s.committed_capacity;
+			if (used <= ARENA_MEMSET_LIMIT)
+			{
+				memset(s.base, 0, used);
+			}
+			else
 			{
-				zero_pages_lazy(base, committed_capacity);
+				size_t pages = virtual_memory::round_to_pages(used);
+				zero_pages_lazy(s.base, pages < s.committed_capacity ? pages : s.committed_capacity);
 			}
 		}
+	}
+
+	/*
+	 * Moves current back to an earlier point, giving up what was allocated
+	 * after it
+	 */
+	static void
+	rewind(uint8_t *to)
+	{
+		arena_state &s = state();
+		s.high_water = s.current > s.high_water ? s.current : s.high_water;
+		s.current = to;
+	}
+
+	/*
+	 * Gives back what's committed above size, which must be whole pages and
+	 * at least the initial commit
+	 */
+	static void
+	decommit_to(arena_state &s, size_t size)
+	{
+		if (s.committed_capacity > size)
+		{
+			virtual_memory::decommit(s.base + size, s.committed_capacity - size);
+			s.committed_capacity = size;
+			s.decommits++;
+		}
+	}
+
+	/*
+	 * Begins the arena anew, and returns what was used since the last reset,
+	 * once nothing is freelisted and the counters are updated
+	 */
+	static size_t
+	begin_reset(arena_state &s)
+	{
+		uint8_t *end = s.current > s.high_water ? s.current : s.high_water;
+		size_t	 used = s.base ? end - s.base : 0;
+		s.current = s.base;
+		s.high_water = s.base;
+		s.peak = used > s.peak ? used : s.peak;
+		s.resets++;
 
 		for (int i = 0; i < 32; i++)
 		{
-			freelists[i] = nullptr;
+			s.freelists[i] = nullptr;
 		}
-		occupied_buckets = 0;
+		s.occupied_buckets = 0;
+		return used;
 	}
 
 	static void
-	reset_and_decommit()
+	reset()
 	{
-		current = base;
-
-		if (committed_capacity > initial_commit)
+		arena_state &s = state();
+		size_t		 used = begin_reset(s);
+		if (!s.base)
 		{
-			virtual_memory::decommit(base + initial_commit, committed_capacity - initial_commit);
-			committed_capacity = initial_commit;
+			return;
 		}
 
-		if constexpr (zero_on_reset)
+		if (s.decommit_after && s.committed_capacity > s.watermark)
 		{
-			if (base && committed_capacity > 0)
+			s.small_resets = used <= s.watermark ? s.small_resets + 1 : 0;
+			if (s.small_resets >= s.decommit_after)
 			{
-				zero_pages_lazy(base, committed_capacity);
+				decommit_to(s, s.watermark);
+				s.small_resets = 0;
 			}
 		}
 
-		for (int i = 0; i < 32; i++)
+		zero_used(s, used);
+	}
+
+	static void
+	reset_and_decommit()
+	{
+		arena_state &s = state();
+		size_t		 used = begin_reset(s);
+		if (!s.base)
 		{
-			freelists[i] = nullptr;
+			return;
 		}
-		occupied_buckets = 0;
+
+		decommit_to(s, s.initial_commit);
+		s.small_resets = 0;
+		zero_used(s, used);
+	}
+
+	/*
+	 * Once decommit_after resets in a row have each used no more than
+	 * watermark, reset gives back what's committed above it. A single large
+	 * query then keeps its pages for the ones like it that follow, but not
+	 * for good. 0 turns it off, the default.
+	 */
+	static void
+	set_decommit_policy(size_t watermark, uint32_t decommit_after)
+	{
+		arena_state &s = state();
+		watermark = virtual_memory::round_to_pages(watermark);
+		s.watermark = watermark > s.initial_commit ? watermark : s.initial_commit;
+		s.decommit_after = decommit_after;
+		s.small_resets = 0;
+	}
+
+	static arena_stats
+	stats()
+	{
+		arena_state &s = state();
+		size_t		 in_use = used();
+		return {.used = in_use,
+				.peak = in_use > s.peak ? in_use : s.peak,
+				.committed = s.committed_capacity,
+				.commits = s.commits,
+				.decommits = s.decommits,
+				.resets = s.resets};
 	}
 
 	static size_t
 	used()
 	{
-		return base ? current - base : 0;
+		arena_state &s = state();
+		return s.base ? s.current - s.base : 0;
 	}
 	static size_t
 	committed()
 	{
-		return committed_capacity;
+		return state().committed_capacity;
 	}
 	static size_t
 	reserved()
 	{
-		return reserved_capacity;
+		return state().reserved_capacity;
 	}
 
 	static void
 	print_info()
 	{
-		printf("Arena<%s>: [%p - %p] using %zu KB of %zu KB reserved\n", typeid(Tag).name(), base,
-			   base + reserved_capacity, used() / (1024), reserved_capacity / (1024));
+		arena_state &s = state();
+		printf("Arena<%s>: [%p - %p] using %zu KB of %zu KB reserved\n", typeid(Tag).name(), s.base,
+			   s.base + s.reserved_capacity, used() / (1024), s.reserved_capacity / (1024));
+	}
+
+	/*
+	 * Trades memory, freelists included, with another arena. Until they're
+	 * swapped back, allocating from one takes from the other's pages.
+	 */
+	template <typename OtherTag>
+	static void
+	swap_with()
+	{
+		using other = arena<OtherTag, zero_on_reset, Align>;
+		arena_state &s = state();
+		auto		&o = other::state();
+
+		std::swap(s.base, o.base);
+		std::swap(s.current, o.current);
+		std::swap(s.high_water, o.high_water);
+		std::swap(s.reserved_capacity, o.reserved_capacity);
+		std::swap(s.committed_capacity, o.committed_capacity);
+		std::swap(s.max_capacity, o.max_capacity);
+		std::swap(s.initial_commit, o.initial_commit);
+		std::swap(s.occupied_buckets, o.occupied_buckets);
+
+		for (int i = 0; i < 32; i++)
+		{
+			free_block *block = s.freelists[i];
+			s.freelists[i] = (free_block *)o.freelists[i];
+			o.freelists[i] = (typename other::free_block *)block;
+		}
+	}
+};
+
+/*
+ * For its lifetime, whatever is allocated from arena<From> comes from
+ * arena<To>, so code written against one arena can build things that
+ * outlive it. Both must have been init'd.
+ */
+template <typename From, typename To> struct arena_redirect
+{
+	arena_redirect()
+	{
+		arena<From>::template swap_with<To>();
+	}
+	~arena_redirect()
+	{
+		arena<From>::template swap_with<To>();
+	}
+};
+
+/*
+ * For its lifetime, threads can allocate from arena<Tag> at once, the one
+ * that made it holds. A per thread arena is only shared with the threads that
+ * join it. Resets and swaps still belong to the thread that made it, and must
+ * wait until after.
+ */
+template <typename Tag> struct arena_share
+{
+	using shared = arena<Tag>;
+
+	std::mutex					   latch;
+	typename shared::arena_state *owner;
+
+	arena_share()
+	{
+		owner = &shared::state();
+		owner->latch = &latch;
+	}
+	~arena_share()
+	{
+		owner->latch = nullptr;
+	}
+
+	/* Called by each thread allocating from it, until its leave */
+	void
+	join()
+	{
+		if constexpr (arena_per_thread<Tag>)
+		{
+			shared::joined = owner;
+		}
+	}
+	void
+	leave()
+	{
+		if constexpr (arena_per_thread<Tag>)
+		{
+			shared::joined = nullptr;
+		}
 	}
 };
 
@@ -525,11 +819,11 @@ template <typename Tag = global_arena> struct stream_writer
 	static stream_writer
 	begin()
 	{
-		if (!arena<Tag>::base)
+		if (!arena<Tag>::state().base)
 		{
 			arena<Tag>::init();
 		}
-		return {arena<Tag>::current, 0};
+		return {arena<Tag>::state().current, 0};
 	}
 
 	bool
@@ -551,7 +845,7 @@ template <typename Tag = global_arena> struct stream_writer
 			fprintf(stderr, "  Gap of %zu bytes - something else allocated from arena\n", gap);
 
 			// Roll back the allocation and fail
-			arena<Tag>::current = dest;
+			arena<Tag>::rewind(dest);
 			return false;
 		}
 
@@ -596,7 +890,7 @@ template <typename Tag = global_arena> struct stream_writer
 			fprintf(stderr, "  Actually allocated at: %p\n", null_pos);
 			fprintf(stderr, "  Gap of %zu bytes - something else allocated from arena\n", gap);
 
-			arena<Tag>::current = null_pos;
+			arena<Tag>::rewind(null_pos);
 			return {nullptr, 0, 0};
 		}
 
@@ -607,7 +901,7 @@ template <typename Tag = global_arena> struct stream_writer
 	void
 	abandon()
 	{
-		arena<Tag>::current = start;
+		arena<Tag>::rewind(start);
 		written = 0;
 	}
 };
@@ -1172,6 +1466,130 @@ template <typename T, typename arena_tag = global_arena> struct queue
 	}
 };
 
+/*
+ * The control bytes of one group of slots, compared all at once. A slot's
+ * control byte is CONTROL_EMPTY, the only value with its high bit set, or
+ * the top 7 bits of its key's hash, so a group is searched for a key by
+ * comparing them with the hash's in a single instruction, and only slots
+ * that match compare keys.
+ *
+ * A match is a bit mask over the group with 1 << shift bits per slot, one
+ * on SSE2 and the scalar fallback, four on NEON, which has no movemask.
+ */
+#define CONTROL_EMPTY 0x80
+
+struct control_group
+{
+	static constexpr uint32_t width = 16;
+
+#if defined(__SSE2__) || defined(_M_X64)
+	static constexpr uint32_t shift = 0;
+	__m128i					  bytes;
+
+	control_group(const uint8_t *control) : bytes(_mm_loadu_si128((const __m128i *)control))
+	{
+	}
+
+	uint64_t
+	match(uint8_t tag) const
+	{
+		return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)tag)));
+	}
+
+	uint64_t
+	match_empty() const
+	{
+		return (uint32_t)_mm_movemask_epi8(bytes);
+	}
+#elif defined(__ARM_NEON)
+	static constexpr uint32_t shift = 2;
+	uint8x16_t				  bytes;
+
+	control_group(const uint8_t *control) : bytes(vld1q_u8(control))
+	{
+	}
+
+	static uint64_t
+	to_mask(uint8x16_t lanes)
+	{
+		uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(lanes), 4);
+		return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0) & 0x8888888888888888ULL;
+	}
+
+	uint64_t
+	match(uint8_t tag) const
+	{
+		return to_mask(vceqq_u8(bytes, vdupq_n_u8(tag)));
+	}
+
+	uint64_t
+	match_empty() const
+	{
+		return to_mask(vcltzq_s8(vreinterpretq_s8_u8(bytes)));
+	}
+#else
+	static constexpr uint32_t shift = 0;
+	uint8_t					  bytes[width];
+
+	control_group(const uint8_t *control)
+	{
+		memcpy(bytes, control, width);
+	}
+
+	uint64_t
+	match(uint8_t tag) const
+	{
+		uint64_t mask = 0;
+		for (uint32_t i = 0; i < width; i++)
+		{
+			mask |= (uint64_t)(bytes[i] == tag) << i;
+		}
+		return mask;
+	}
+
+	uint64_t
+	match_empty() const
+	{
+		uint64_t mask = 0;
+		for (uint32_t i = 0; i < width; i++)
+		{
+			mask |= (uint64_t)(bytes[i] >> 7) << i;
+		}
+		return mask;
+	}
+#endif
+
+	/* The slot in the group of the lowest match */
+	static uint32_t
+	first(uint64_t mask)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, mask);
+		return (uint32_t)index >> shift;
+#else
+		return (uint32_t)__builtin_ctzll(mask) >> shift;
+#endif
+	}
+};
+
+/*
+ * Open addressing with linear probing, the probe scanning a group of slots
+ * at a time from the key's home slot, hash & (capacity - 1), see
+ * control_group. The control bytes follow the slots in the same allocation,
+ * with the first group's repeated after the last so a group starting near
+ * the end reads past it into the start without a wrap.
+ *
+ * A key is in the first group from its home that either holds it or has an
+ * empty slot, since nothing is placed past an empty slot. Removing keeps it
+ * that way without tombstones: the entries after the removed one that would
+ * rather be nearer their home are shifted back into the hole, see
+ * remove_slot. So entries can move on a remove, and a loop removing while it
+ * iterates should use remove_if instead.
+ *
+ * Maps keyed by fixed_string are looked up by string_view or const char *
+ * too, without building a key.
+ */
 template <typename K, typename V, typename arena_tag = global_arena> struct hash_map
 {
 	struct entry
@@ -1179,7 +1597,6 @@ template <typename K, typename V, typename arena_tag = global_arena> struct hash
 		K		 key;
 		V		 value;
 		uint32_t hash;
-		uint8_t	 state;
 	};
 
   public:
@@ -1198,9 +1615,9 @@ template <typename K, typename V, typename arena_tag = global_arena> struct hash
 
   private:
 	entry	*m_data = nullptr;
+	uint8_t *m_control = nullptr; // m_capacity + control_group::width bytes
 	uint32_t m_capacity = 0;
 	uint32_t m_size = 0;
-	uint32_t m_tombstones = 0;
 
 	template <typename T, typename = void> struct has_c_str : std::false_type
 	{
@@ -1210,6 +1627,11 @@ template <typename K, typename V, typename arena_tag = global_arena> struct hash
 	{
 	};
 
+	/* Lookups by a string_view, or anything that converts to one, for keys that are strings */
+	template <typename Q>
+	static constexpr bool is_string_lookup =
+		has_c_str<K>::value && !std::is_same_v<Q, K> && std::is_convertible_v<const Q &, std::string_view>;
+
 	uint32_t
 	hash_key(const K &key) const
 	{
@@ -1237,63 +1659,129 @@ template <typename K, typename V, typename arena_tag = global_arena> struct hash
 		}
 	}
 
-	V *
-	insert_into(const K &key, uint32_t hash, const V &value)
+	/* As a fixed_string key holds it, cut to fit */
+	static std::string_view
+	as_key_text(std::string_view text)
 	{
-		uint32_t mask = m_capacity - 1;
-		uint32_t idx = hash & mask;
-		uint32_t first_deleted = -1;
+		return text.substr(0, sizeof(K) - 1);
+	}
 
-		while (true)
+	static uint8_t
+	control_tag(uint32_t hash)
+	{
+		return (uint8_t)(hash >> 25);
+	}
+
+	void
+	set_control(uint32_t slot, uint8_t control)
+	{
+		m_control[slot] = control;
+		if (slot < control_group::width)
 		{
-			entry &e = m_data[idx];
+			m_control[m_capacity + slot] = control;
+		}
+	}
 
-			if (e.state == 0)
-			{
-				entry *target = (first_deleted != -1) ? &m_data[first_deleted] : &e;
-				target->key = key;
-				target->value = value;
-				target->hash = hash;
-				target->state = 1;
+	/* The key's slot, or -1 */
+	template <typename Q>
+	int64_t
+	find_slot(const Q &key, uint32_t hash) const
+	{
+		if (m_size == 0)
+		{
+			return -1;
+		}
 
-				if (first_deleted != -1)
+		uint32_t mask = m_capacity - 1;
+		uint8_t	 tag = control_tag(hash);
+		for (uint32_t position = hash & mask;; position = (position + control_group::width) & mask)
+		{
+			control_group group(m_control + position);
+			for (uint64_t matches = group.match(tag); matches; matches &= matches - 1)
+			{
+				uint32_t slot = (position + control_group::first(matches)) & mask;
+				if (m_data[slot].hash == hash && m_data[slot].key == key)
 				{
-					m_tombstones--;
+					return slot;
 				}
-				m_size++;
-				return &target->value;
 			}
 
-			if (e.state == 2 && first_deleted == -1)
+			if (group.match_empty())
 			{
-				first_deleted = idx;
+				return -1;
 			}
-			else if (e.state == 1 && e.hash == hash && e.key == key)
+		}
+	}
+
+	/* The first empty slot from the hash's home, there's always one */
+	uint32_t
+	find_empty(uint32_t hash) const
+	{
+		uint32_t mask = m_capacity - 1;
+		for (uint32_t position = hash & mask;; position = (position + control_group::width) & mask)
+		{
+			uint64_t empty = control_group(m_control + position).match_empty();
+			if (empty)
 			{
-				e.value = value;
-				return &e.value;
+				return (position + control_group::first(empty)) & mask;
 			}
+		}
+	}
 
-			idx = (idx + 1) & mask;
+	V *
+	insert_new(const K &key, uint32_t hash, const V &value)
+	{
+		uint32_t slot = find_empty(hash);
+		entry	&e = m_data[slot];
+		e.key = key;
+		e.value = value;
+		e.hash = hash;
+		set_control(slot, control_tag(hash));
+		m_size++;
+		return &e.value;
+	}
+
+	/*
+	 * Backward shift: each following entry up to the next empty slot moves
+	 * into the hole if the hole is between its home and where it is, and its
+	 * old slot becomes the hole
+	 */
+	void
+	remove_slot(uint32_t hole)
+	{
+		uint32_t mask = m_capacity - 1;
+		for (uint32_t slot = (hole + 1) & mask; m_control[slot] != CONTROL_EMPTY; slot = (slot + 1) & mask)
+		{
+			uint32_t home = m_data[slot].hash & mask;
+			if (((slot - home) & mask) >= ((slot - hole) & mask))
+			{
+				m_data[hole] = m_data[slot];
+				set_control(hole, m_control[slot]);
+				hole = slot;
+			}
 		}
+		set_control(hole, CONTROL_EMPTY);
+		m_size--;
 	}
 
 	struct map_iterator
 	{
-		entry	*entries;
-		uint32_t capacity;
-		uint32_t index;
+		entry		  *entries;
+		const uint8_t *control;
+		uint32_t	   capacity;
+		uint32_t	   index;
 
 		void
 		advance_to_next_valid()
 		{
-			while (index < capacity && entries && entries[index].state != 1)
+			while (index < capacity && control[index] == CONTROL_EMPTY)
 			{
 				++index;
 			}
 		}
 
-		map_iterator(entry *e, uint32_t cap, uint32_t idx) : entries(e), capacity(cap), index(idx)
+		map_iterator(entry *e, const uint8_t *c, uint32_t cap, uint32_t idx)
+			: entries(e), control(c), capacity(cap), index(idx)
 		{
 			advance_to_next_valid();
 		}
@@ -1340,59 +1828,50 @@ template <typename K, typename V, typename arena_tag = global_arena> struct hash
 	reserve(uint32_t min_capacity = 16)
 	{
 		min_capacity = round_up_power_of_2(min_capacity);
-
-		if (m_capacity >= min_capacity)
+		if (min_capacity < control_group::width)
 		{
-			return true;
+			min_capacity = control_group::width;
 		}
 
-		if (!m_data)
+		if (m_capacity >= min_capacity)
 		{
-			m_data = (entry *)arena<arena_tag>::alloc(min_capacity * sizeof(entry));
-			if (!m_data)
-			{
-				return false;
-			}
-			memset(m_data, 0, min_capacity * sizeof(entry));
-			m_capacity = min_capacity;
-			m_size = 0;
-			m_tombstones = 0;
 			return true;
 		}
 
-		uint32_t old_capacity = m_capacity;
-		entry	*old_data = m_data;
-
 		uint32_t new_capacity = m_capacity * 2;
 		if (new_capacity < min_capacity)
 		{
 			new_capacity = min_capacity;
 		}
 
-		entry *new_data = (entry *)arena<arena_tag>::alloc(new_capacity * sizeof(entry));
+		size_t	 control_size = new_capacity + control_group::width;
+		entry	*new_data = (entry *)arena<arena_tag>::alloc(new_capacity * sizeof(entry) + control_size);
 		if (!new_data)
 		{
 			return false;
 		}
-		memset(new_data, 0, new_capacity * sizeof(entry));
+
+		entry	*old_data = m_data;
+		uint8_t *old_control = m_control;
+		uint32_t old_capacity = m_capacity;
+
 		m_data = new_data;
+		m_control = (uint8_t *)(new_data + new_capacity);
 		m_capacity = new_capacity;
-
-		uint32_t old_size = m_size;
 		m_size = 0;
-		m_tombstones = 0;
+		memset(m_control, CONTROL_EMPTY, control_size);
 
 		for (uint32_t i = 0; i < old_capacity; i++)
 		{
-			if (old_data[i].state == 1)
+			if (old_control[i] != CONTROL_EMPTY)
 			{
-				insert_into(old_data[i].key, old_data[i].hash, old_data[i].value);
+				insert_new(old_data[i].key, old_data[i].hash, old_data[i].value);
 			}
 		}
 
 		if (old_data)
 		{
-			arena<arena_tag>::reclaim(old_data, old_capacity * sizeof(entry));
+			arena<arena_tag>::reclaim(old_data, old_capacity * sizeof(entry) + old_capacity + control_group::width);
 		}
 		return true;
 	}
@@ -1400,81 +1879,88 @@ template <typename K, typename V, typename arena_tag = global_arena> struct hash
 	V *
 	get(const K &key)
 	{
-		if (!m_data || m_size == 0)
-		{
-			return nullptr;
-		}
-
-		uint32_t hash = hash_key(key);
-		uint32_t mask = m_capacity - 1;
-		uint32_t idx = hash & mask;
+		int64_t slot = find_slot(key, hash_key(key));
+		return slot < 0 ? nullptr : &m_data[slot].value;
+	}
 
-		while (true)
-		{
-			entry &e = m_data[idx];
-			if (e.state == 0)
-			{
-				return nullptr;
-			}
-			if (e.state == 1 && e.hash == hash && e.key == key)
-			{
-				return &e.value;
-			}
-			idx = (idx + 1) & mask;
-		}
+	template <typename Q, typename = std::enable_if_t<is_string_lookup<Q>>>
+	V *
+	get(const Q &key)
+	{
+		std::string_view text = as_key_text(key);
+		int64_t			 slot = find_slot(text, hash_bytes(text.data(), text.size()));
+		return slot < 0 ? nullptr : &m_data[slot].value;
 	}
 
 	V *
 	insert(const K &key, const V &value)
 	{
-		if (!m_data)
+		uint32_t hash = hash_key(key);
+		int64_t	 slot = find_slot(key, hash);
+		if (slot >= 0)
 		{
-			if (!reserve(16))
-			{
-				return nullptr;
-			}
+			m_data[slot].value = value;
+			return &m_data[slot].value;
 		}
 
-		if ((m_size + m_tombstones) * 4 >= m_capacity * 3)
+		// At most 3/4 full, so a probe meets an empty slot within a group or two
+		if ((m_size + 1) * 4 > m_capacity * 3)
 		{
-			if (!reserve(m_capacity * 2))
+			if (!reserve(m_capacity ? m_capacity * 2 : 16))
 			{
 				return nullptr;
 			}
 		}
-
-		uint32_t hash = hash_key(key);
-		return insert_into(key, hash, value);
+		return insert_new(key, hash, value);
 	}
 
 	bool
 	remove(const K &key)
 	{
-		if (!m_data || m_size == 0)
+		int64_t slot = find_slot(key, hash_key(key));
+		if (slot < 0)
 		{
 			return false;
 		}
+		remove_slot(slot);
+		return true;
+	}
 
-		uint32_t hash = hash_key(key);
-		uint32_t mask = m_capacity - 1;
-		uint32_t idx = hash & mask;
+	template <typename Q, typename = std::enable_if_t<is_string_lookup<Q>>>
+	bool
+	remove(const Q &key)
+	{
+		std::string_view text = as_key_text(key);
+		int64_t			 slot = find_slot(text, hash_bytes(text.data(), text.size()));
+		if (slot < 0)
+		{
+			return false;
+		}
+		remove_slot(slot);
+		return true;
+	}
 
-		while (true)
+	/*
+	 * Removes every entry pred(key, value) is true for, returning how many.
+	 * A slot is looked at again after a remove, as the entry shifted into it
+	 * hasn't been, one shifted from the start to the end may be seen twice.
+	 */
+	template <typename Pred>
+	uint32_t
+	remove_if(Pred pred)
+	{
+		uint32_t removed = 0;
+		for (uint32_t slot = 0; slot < m_capacity;)
 		{
-			entry &e = m_data[idx];
-			if (e.state == 0)
-			{
-				return false;
-			}
-			if (e.state == 1 && e.hash == hash && e.key == key)
+			if (m_control[slot] != CONTROL_EMPTY && pred(m_data[slot].key, m_data[slot].value))
 			{
-				e.state = 2;
-				m_size--;
-				m_tombstones++;
-				return true;
+				remove_slot(slot);
+				removed++;
+				continue;
 			}
-			idx = (idx + 1) & mask;
+			slot++;
 		}
+		return removed;
 	}
 
 	void
@@ -1482,12 +1968,12 @@ template <typename K, typename V, typename arena_tag = global_arena> struct hash
 	{
 		if (m_data && m_capacity > 0)
 		{
-			arena<arena_tag>::reclaim(m_data, m_capacity * sizeof(entry));
+			arena<arena_tag>::reclaim(m_data, m_capacity * sizeof(entry) + m_capacity + control_group::width);
 		}
 		m_data = nullptr;
+		m_control = nullptr;
 		m_capacity = 0;
 		m_size = 0;
-		m_tombstones = 0;
 	}
 
 	map_iterator
@@ -1495,13 +1981,13 @@ template <typename K, typename V, typename arena_tag = global_arena> struct hash
 	{
 		if (!m_data)
 			return end();
-		return map_iterator(m_data, m_capacity, 0);
+		return map_iterator(m_data, m_control, m_capacity, 0);
 	}
 
 	map_iterator
 	end()
 	{
-		return map_iterator(m_data, m_capacity, m_capacity);
+		return map_iterator(m_data, m_control, m_capacity, m_capacity);
 	}
 
 	bool
@@ -1524,6 +2010,12 @@ template <typename K, typename V, typename arena_tag = global_arena> struct hash
 	{
 		return get(key) != nullptr;
 	}
+	template <typename Q, typename = std::enable_if_t<is_string_lookup<Q>>>
+	bool
+	contains(const Q &key)
+	{
+		return get(key) != nullptr;
+	}
 	entry *
 	data()
 	{
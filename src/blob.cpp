@@ -12,12 +12,20 @@
  *
  * Note that both B+tree and blob's can use the pager, because the pager is completely agnostic to the
  * actual format of the data.
+ *
+ * A blob that's compressed or shared starts with a blob_info in its first page's data, ahead of what
+ * was written, and its first node's flags say which. A compressed blob holds the LZ coded bytes (see
+ * compress.hpp), and is decoded whole when it's read. A shared blob counts its owners, and is found
+ * through the dedup index by a hash of its content, so a blob identical to one that's already stored
+ * only adds a reference.
  */
 
 #include "blob.hpp"
 #include "common.hpp"
+#include "compress.hpp"
 #include "pager.hpp"
 #include "arena.hpp"
+#include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
@@ -25,88 +33,328 @@
 
 #define BLOB_HEADER_SIZE 12
 #define BLOB_DATA_SIZE	 (PAGE_SIZE - BLOB_HEADER_SIZE)
+#define BLOB_MAX_EXTENT	 UINT8_MAX
+
+/* Compression is only kept if it saves at least 1 / BLOB_MIN_SAVING of the size */
+#define BLOB_MIN_SAVING 8
+
+/* First node flags */
+#define BLOB_COMPRESSED 0x01
+#define BLOB_SHARED		0x02
 
 
 struct blob_node
 {
-	uint32_t index; // Page index of this node
-	uint32_t next;	// Next page in chain (0 if last)
-	uint32_t size;	// Size of data in this node
+	uint32_t index;	 // Page index of this node
+	uint32_t next;	 // Next page in chain (0 if last)
+	uint16_t size;	 // Size of data in this node
+	uint8_t	 extent; // Pages at consecutive indexes from this one, including it (0 is 1)
+	uint8_t	 flags;	 // On the first node, BLOB_COMPRESSED and BLOB_SHARED
 	uint8_t	 data[BLOB_DATA_SIZE];
 };
 static_assert(sizeof(blob_node) == PAGE_SIZE);
 
-#define GET_BLOB_NODE(index) (reinterpret_cast<blob_node *>(pager_get(index)))
+/*
+ * Leads a compressed or shared blob's data
+ */
+struct blob_info
+{
+	uint32_t refs; // Owners of a shared blob
+	uint32_t size; // As written, before compression
+	uint64_t hash; // Of the content, its key in the dedup index
+};
+
+#define GET_BLOB_NODE(index)	  (reinterpret_cast<blob_node *>(pager_get(index)))
+#define GET_SCAN_BLOB_NODE(index) (reinterpret_cast<blob_node *>(pager_get_sequential(index)))
+
+inline static uint32_t
+node_extent(blob_node *node)
+{
+	return node->extent ? node->extent : 1;
+}
+
+/*
+ * The page skip pages into the chain from page, or 0 if the chain is shorter.
+ * Whole extents are jumped over, only their first and last pages are read.
+ */
+static uint32_t
+blob_seek(uint32_t page, uint32_t skip)
+{
+	while (page)
+	{
+		blob_node *node = GET_SCAN_BLOB_NODE(page);
+		uint32_t   extent = node_extent(node);
+		if (skip < extent)
+		{
+			return page + skip;
+		}
+
+		if (extent > 1)
+		{
+			node = GET_SCAN_BLOB_NODE(page + extent - 1);
+		}
+		skip -= extent;
+		page = node->next;
+	}
+
+	return 0;
+}
+
+/*
+ * Total bytes held in the chain, an extent at a time, every page in one is
+ * full except the blob's last.
+ */
+static uint32_t
+chain_size(uint32_t first_page)
+{
+	uint32_t total_size = 0;
+	uint32_t current = first_page;
+
+	while (current)
+	{
+		blob_node *node = GET_BLOB_NODE(current);
+		if (!node)
+		{
+			break;
+		}
+
+		uint32_t extent = node_extent(node);
+		if (extent > 1)
+		{
+			node = GET_BLOB_NODE(current + extent - 1);
+		}
+
+		total_size += (extent - 1) * BLOB_DATA_SIZE + node->size;
+		current = node->next;
+	}
+
+	return total_size;
+}
+
+/*
+ * Positions a cursor offset bytes into the chain, past the blob_info of one
+ * that has it, see blob_cursor_open
+ */
+static bool
+chain_cursor_open(blob_cursor *cursor, uint32_t first_page, uint32_t offset)
+{
+	cursor->page = blob_seek(first_page, offset / BLOB_DATA_SIZE);
+	cursor->offset = offset % BLOB_DATA_SIZE;
+
+	if (cursor->page && cursor->offset >= GET_SCAN_BLOB_NODE(cursor->page)->size)
+	{
+		cursor->page = 0;
+	}
+
+	return cursor->page != 0;
+}
+
+static uint32_t
+chain_read(blob_cursor *cursor, void *buffer, uint32_t size)
+{
+	const uint8_t *data;
+	uint32_t	   available;
+	uint32_t	   copied = 0;
+
+	while (copied < size && blob_cursor_next(cursor, &data, &available))
+	{
+		uint32_t count = available < size - copied ? available : size - copied;
+		memcpy((uint8_t *)buffer + copied, data, count);
+		copied += count;
+	}
+
+	return copied;
+}
+
+inline static uint8_t
+blob_flags(uint32_t first_page)
+{
+	return first_page ? GET_BLOB_NODE(first_page)->flags : 0;
+}
+
+/*
+ * Copied in and out, a blob_info in the page's data isn't 8 byte aligned
+ */
+inline static blob_info
+get_info(uint32_t first_page)
+{
+	blob_info info;
+	memcpy(&info, GET_BLOB_NODE(first_page)->data, sizeof(blob_info));
+	return info;
+}
+
+inline static void
+set_info(uint32_t first_page, const blob_info &info)
+{
+	memcpy(GET_BLOB_NODE(first_page)->data, &info, sizeof(blob_info));
+}
+
+/*
+ * 64 bit FNV-1a, wide enough that blobs that aren't identical rarely share a
+ * key in the dedup index
+ */
+static uint64_t
+content_hash(const uint8_t *data, uint32_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (uint32_t i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
 
-inline static blob_node *
-allocate_blob_node()
+static bool
+content_equals(uint32_t first_page, const uint8_t *data, uint32_t size)
 {
-	uint32_t   page_index = pager_new();
-	blob_node *node = GET_BLOB_NODE(page_index);
+	if (blob_get_size(first_page) != size)
+	{
+		return false;
+	}
+
+	blob_cursor	   cursor;
+	const uint8_t *piece;
+	uint32_t	   piece_size;
+	uint32_t	   compared = 0;
 
-	node->index = page_index;
-	node->next = 0;
-	node->size = 0;
+	blob_cursor_open(&cursor, first_page);
+	while (blob_cursor_next(&cursor, &piece, &piece_size))
+	{
+		if (memcmp(piece, data + compared, piece_size) != 0)
+		{
+			return false;
+		}
+		compared += piece_size;
+	}
 
-	pager_ensure_journaled(page_index);
-	return node;
+	return compared == size;
+}
+
+btree
+blob_dedup_create()
+{
+	return bt_create(TYPE_U64, sizeof(uint32_t), true);
+}
+
+btree
+blob_dedup_open()
+{
+	uint32_t root = pager_get_root_slot(PAGER_SLOT_BLOB_DEDUP);
+	if (!root)
+	{
+		btree dedup = blob_dedup_create();
+		pager_set_root_slot(PAGER_SLOT_BLOB_DEDUP, dedup.root_page_index);
+		return dedup;
+	}
+
+	btree dedup = bt_create(TYPE_U64, sizeof(uint32_t), false);
+	dedup.root_page_index = root;
+	return dedup;
 }
 
 /*
  * Splits data across multiple pages as needed, creating a linked chain.
  * Each page holds up to BLOB_DATA_SIZE bytes.
  *
+ * With compress, it's stored LZ coded if that saves enough to be worth
+ * decoding. With a dedup index, it's shared with an identical blob if there's
+ * one, otherwise it's indexed for the next to share.
+ *
  * returns First page index of blob chain, or 0 on failure
  */
 uint32_t
-blob_create(void *data, uint32_t size)
+blob_create(void *data, uint32_t size, bool compress, btree *dedup)
 {
 	if (!data || size == 0)
 	{
 		return 0;
 	}
 
-	// how many pages do we need?
-	int nodes_required = (size + BLOB_DATA_SIZE - 1) / BLOB_DATA_SIZE;
-
-	uint32_t first_page = 0;
-	uint32_t prev_page = 0;
-	uint32_t remaining = size;
-	uint8_t *current_data = (uint8_t *)data;
+	blob_info info = {1, size, 0};
+	uint8_t	  flags = 0;
 
-	for (int i = 0; i < nodes_required; i++)
+	bt_cursor cursor = {.tree = dedup};
+	bool	  indexed = false;
+	if (dedup)
 	{
-		blob_node *node = allocate_blob_node();
-		node->size = remaining < (uint32_t)BLOB_DATA_SIZE ? remaining : BLOB_DATA_SIZE;
-
-		memcpy(node->data, current_data, node->size);
+		flags |= BLOB_SHARED;
+		info.hash = content_hash((const uint8_t *)data, size);
 
-		if (i == 0)
+		indexed = bt_cursor_seek(&cursor, &info.hash);
+		uint32_t existing = indexed ? *(uint32_t *)bt_cursor_record(&cursor) : 0;
+		if (existing && content_equals(existing, (const uint8_t *)data, size))
 		{
-			first_page = node->index;
+			pager_ensure_journaled(existing);
+			blob_info shared = get_info(existing);
+			shared.refs++;
+			set_info(existing, shared);
+			return existing;
 		}
-		else
+	}
+
+	const void *payload = data;
+	uint32_t	payload_size = size;
+	if (compress)
+	{
+		uint8_t *coded = (uint8_t *)arena<query_arena>::alloc(size);
+		uint32_t coded_size = lz_compress((const uint8_t *)data, size, coded, size - size / BLOB_MIN_SAVING);
+		if (coded_size)
 		{
-			blob_node *prev = GET_BLOB_NODE(prev_page);
-			prev->next = node->index;
+			flags |= BLOB_COMPRESSED;
+			payload = coded;
+			payload_size = coded_size;
 		}
+	}
 
-		current_data += node->size;
-		remaining -= node->size;
-		prev_page = node->index;
+	blob_writer writer = blob_write_begin();
+	if (flags)
+	{
+		blob_write(&writer, &info, sizeof(info));
 	}
+	blob_write(&writer, payload, payload_size);
+
+	pager_ensure_journaled(writer.first_page);
+	GET_BLOB_NODE(writer.first_page)->flags = flags;
 
-	return first_page;
+	// A different blob with the same hash keeps the key, this one isn't shared
+	if (dedup && !indexed)
+	{
+		bt_cursor_insert(&cursor, &info.hash, &writer.first_page);
+	}
+
+	return writer.first_page;
 }
 
 /*
- * Delete an entire blob chain.
+ * Delete an entire blob chain, or for a shared blob, drop a reference and
+ * delete it with the last one, along with its dedup entry.
  *
  * Walks the linked list and deallocates each page.
  */
 void
-blob_delete(uint32_t first_page)
+blob_delete(uint32_t first_page, btree *dedup)
 {
+	if (blob_flags(first_page) & BLOB_SHARED)
+	{
+		assert(dedup && "A shared blob is deleted through its dedup index");
+		pager_ensure_journaled(first_page);
+		blob_info info = get_info(first_page);
+		info.refs--;
+		set_info(first_page, info);
+		if (info.refs > 0)
+		{
+			return;
+		}
+
+		uint64_t  hash = info.hash;
+		bt_cursor cursor = {.tree = dedup};
+		if (bt_cursor_seek(&cursor, &hash) && *(uint32_t *)bt_cursor_record(&cursor) == first_page)
+		{
+			bt_cursor_delete(&cursor);
+		}
+	}
+
 	uint32_t current = first_page;
 
 	while (current)
@@ -123,56 +371,199 @@ blob_delete(uint32_t first_page)
 	}
 }
 
-
 /*
- * Walks entire chain summing page sizes.
+ * A compressed or shared blob's size is in its blob_info, otherwise the chain
+ * is summed.
  */
 uint32_t
 blob_get_size(uint32_t first_page)
 {
-	uint32_t total_size = 0;
-	uint32_t current = first_page;
-
-	while (current)
+	if (blob_flags(first_page))
 	{
-		blob_node *node = GET_BLOB_NODE(current);
-		if (!node)
-		{
-			break;
-		}
-
-		total_size += node->size;
-		current = node->next;
+		return get_info(first_page).size;
 	}
 
-	return total_size;
+	return chain_size(first_page);
 }
 
 /*
  * Read entire blob into contiguous memory.
  *
- * Allocates buffer from query_arena and copies all pages.
+ * Allocates buffer from query_arena and copies all pages, a compressed blob
+ * is decoded into it.
  */
 uint8_t *
 blob_read_full(uint32_t first_page, size_t *size)
 {
-	auto stream = stream_writer<query_arena>::begin();
+	uint8_t flags = blob_flags(first_page);
+	*size = blob_get_size(first_page);
+	uint8_t *buffer = (uint8_t *)arena<query_arena>::alloc(*size ? *size : 1);
+
+	if (!(flags & BLOB_COMPRESSED))
+	{
+		return blob_read_range(first_page, 0, buffer, *size) == *size ? buffer : nullptr;
+	}
+
+	uint32_t	coded_size = chain_size(first_page) - sizeof(blob_info);
+	uint8_t	   *coded = (uint8_t *)arena<query_arena>::alloc(coded_size);
+	blob_cursor cursor = {};
+	chain_cursor_open(&cursor, first_page, sizeof(blob_info));
+	if (chain_read(&cursor, coded, coded_size) != coded_size)
+	{
+		return nullptr;
+	}
+
+	return lz_decompress(coded, coded_size, buffer, *size) == *size ? buffer : nullptr;
+}
+
+uint32_t
+blob_read_range(uint32_t first_page, uint32_t offset, void *buffer, uint32_t size)
+{
+	blob_cursor cursor;
+	blob_cursor_open(&cursor, first_page, offset);
+	return chain_read(&cursor, buffer, size);
+}
+
+/*
+ * Positions the writer after the blob's last page, found without reading the
+ * pages within each extent. A compressed or shared blob can't be appended to.
+ */
+blob_writer
+blob_write_begin(uint32_t first_page)
+{
+	blob_writer writer = {first_page, 0, blob_flags(first_page) != 0};
 
 	uint32_t current = first_page;
-	*size = 0;
 	while (current)
 	{
-		blob_node *node = GET_BLOB_NODE(current);
-		if (!node)
+		uint32_t extent = node_extent(GET_BLOB_NODE(current));
+		writer.last_page = current + extent - 1;
+		current = GET_BLOB_NODE(writer.last_page)->next;
+	}
+
+	return writer;
+}
+
+/*
+ * Fills what's left of the last page, then the rest goes into new extents of
+ * consecutive pages, each allocated just after the last page where there's
+ * room, so the chain stays sequential.
+ */
+bool
+blob_write(blob_writer *writer, const void *data, uint32_t size)
+{
+	if (writer->sealed)
+	{
+		return false;
+	}
+	if (!data)
+	{
+		return size == 0;
+	}
+
+	const uint8_t *current_data = (const uint8_t *)data;
+	uint32_t	   remaining = size;
+
+	if (writer->last_page)
+	{
+		blob_node *last = GET_BLOB_NODE(writer->last_page);
+		uint32_t   room = BLOB_DATA_SIZE - last->size;
+		uint32_t   count = remaining < room ? remaining : room;
+		if (count)
 		{
-			stream.abandon();
-			return nullptr;
+			pager_ensure_journaled(writer->last_page);
+			memcpy(last->data + last->size, current_data, count);
+			last->size += count;
+			current_data += count;
+			remaining -= count;
 		}
+	}
 
-		*size += node->size;
-		stream.write(node->data, node->size);
-		current = node->next;
+	while (remaining)
+	{
+		uint32_t extent = (remaining + BLOB_DATA_SIZE - 1) / BLOB_DATA_SIZE;
+		extent = extent < BLOB_MAX_EXTENT ? extent : BLOB_MAX_EXTENT;
+
+		uint32_t first = pager_new_extent(extent, writer->last_page);
+		if (writer->last_page)
+		{
+			pager_ensure_journaled(writer->last_page);
+			GET_BLOB_NODE(writer->last_page)->next = first;
+		}
+		else
+		{
+			writer->first_page = first;
+		}
+
+		for (uint32_t i = 0; i < extent; i++)
+		{
+			blob_node *node = GET_BLOB_NODE(first + i);
+			pager_ensure_journaled(first + i);
+
+			node->size = remaining < (uint32_t)BLOB_DATA_SIZE ? remaining : BLOB_DATA_SIZE;
+			node->extent = extent - i;
+			node->next = i + 1 < extent ? first + i + 1 : 0;
+			memcpy(node->data, current_data, node->size);
+
+			current_data += node->size;
+			remaining -= node->size;
+		}
+
+		writer->last_page = first + extent - 1;
 	}
 
-	return (uint8_t *)stream.start;
+	return true;
+}
+
+/*
+ * False if there's nothing at offset, the blob is shorter. A compressed blob
+ * is decoded whole into the query arena, and the cursor steps through that.
+ */
+bool
+blob_cursor_open(blob_cursor *cursor, uint32_t first_page, uint32_t offset)
+{
+	uint8_t flags = blob_flags(first_page);
+	cursor->buffer = nullptr;
+	cursor->buffer_size = 0;
+
+	if (flags & BLOB_COMPRESSED)
+	{
+		size_t	 size;
+		uint8_t *data = blob_read_full(first_page, &size);
+
+		cursor->page = 0;
+		if (data && offset < size)
+		{
+			cursor->buffer = data + offset;
+			cursor->buffer_size = size - offset;
+		}
+		return cursor->buffer != nullptr;
+	}
+
+	return chain_cursor_open(cursor, first_page, flags ? offset + sizeof(blob_info) : offset);
+}
+
+bool
+blob_cursor_next(blob_cursor *cursor, const uint8_t **data, uint32_t *size)
+{
+	if (cursor->buffer)
+	{
+		*data = cursor->buffer;
+		*size = cursor->buffer_size;
+		cursor->buffer = nullptr;
+		return true;
+	}
+
+	if (!cursor->page)
+	{
+		return false;
+	}
+
+	blob_node *node = GET_SCAN_BLOB_NODE(cursor->page);
+	*data = node->data + cursor->offset;
+	*size = node->size - cursor->offset;
+
+	cursor->page = node->next;
+	cursor->offset = 0;
+	return true;
 }
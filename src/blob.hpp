@@ -5,14 +5,42 @@
  */
 
 #pragma once
+#include "btree.hpp"
 #include <cstddef>
 #include <cstdint>
 
+/*
+ * An index of shared blobs by a hash of their content, for blob_create to
+ * find one identical to what it's storing. The caller keeps its root, like any
+ * other tree's.
+ */
+btree
+blob_dedup_create();
+
+/*
+ * The database's own dedup index, its root kept in PAGER_SLOT_BLOB_DEDUP so
+ * it outlives the pager, and moved with the tables by catalog_vacuum. Created
+ * the first time, which must be inside a transaction.
+ */
+btree
+blob_dedup_open();
+
+/*
+ * Stores size bytes, returning the first page, 0 for an empty blob. With
+ * compress, the bytes are stored LZ coded if that makes them enough smaller.
+ * With a dedup index, an identical blob already in it is shared, taking a
+ * reference, and otherwise the new one is added to it.
+ */
 uint32_t
-blob_create(void *data, uint32_t size);
+blob_create(void *data, uint32_t size, bool compress = false, btree *dedup = nullptr);
 
+/*
+ * Frees the blob, or drops one reference to a shared blob, which is freed
+ * with the last, along with its entry in dedup. A shared blob must be given
+ * the index it was created with, or the entry would outlive its pages.
+ */
 void
-blob_delete(uint32_t first_page);
+blob_delete(uint32_t first_page, btree *dedup = nullptr);
 
 uint32_t
 blob_get_size(uint32_t first_page);
@@ -20,6 +48,53 @@ blob_get_size(uint32_t first_page);
 uint8_t *
 blob_read_full(uint32_t first_page, size_t *size);
 
+/*
+ * Copies up to size bytes of the blob, starting offset bytes in, into buffer,
+ * returning how many there were. Only the pages holding the range are read.
+ */
+uint32_t
+blob_read_range(uint32_t first_page, uint32_t offset, void *buffer, uint32_t size);
+
+/*
+ * Writes a blob a piece at a time, so a large one never has to be in memory
+ * all at once. Begin with 0 for a new blob, which the first write creates, or
+ * with a blob's first page to append to it. A compressed or shared blob is
+ * sealed, writes to it fail.
+ */
+struct blob_writer
+{
+	uint32_t first_page;
+	uint32_t last_page;
+	bool	 sealed;
+};
+
+blob_writer
+blob_write_begin(uint32_t first_page = 0);
+
+bool
+blob_write(blob_writer *writer, const void *data, uint32_t size);
+
+/*
+ * Steps through a blob a page at a time without copying it, each step gives
+ * the data held by the next page, from offset on in the first. The data is
+ * only valid until the next pager call, and is read at scan priority, so a
+ * large blob doesn't push the working set out of the cache. A compressed blob
+ * is decoded on open, and comes out in one step.
+ */
+struct blob_cursor
+{
+	uint32_t	   page;
+	uint32_t	   offset;
+	const uint8_t *buffer; /* Decoded data still to come */
+	uint32_t	   buffer_size;
+};
+
+bool
+blob_cursor_open(blob_cursor *cursor, uint32_t first_page, uint32_t offset = 0);
+
+bool
+blob_cursor_next(blob_cursor *cursor, const uint8_t **data, uint32_t *size);
+
 /*
 4096 byte page example
 
@@ -36,7 +111,8 @@ blob_read_full(uint32_t first_page, size_t *size);
 				   │ index: 42   (4 bytes)                │
 				   │ next:  0    (4 bytes) [terminates]   │
 				   │ size:  1500 (2 bytes)                │
-				   │ flags: 0    (2 bytes)                │
+				   │ extent: 1   (1 byte)                 │
+				   │ flags: 0    (1 byte)                 │
 				   ├──────────────────────────────────────┤
 				   │ data: [1500 bytes of actual content] │
 				   │       [............................] │
@@ -53,12 +129,12 @@ blob_read_full(uint32_t first_page, size_t *size);
 	 │ page: 42 │ ──────┐
 	 └──────────┘       │
 						▼
-				   Page #42                    Page #57                    Page #89
+				   Page #42                    Page #43                    Page #44
 	 ┌─────────────────────────┐  ┌─────────────────────────┐  ┌─────────────────────────┐
-	 │ index: 42               │  │ index: 57               │  │ index: 89               │
-	 │ next:  57 ──────────────┼─▶  next:  89   ────────────┼──▶ next:  0  [end]         │
+	 │ index: 42               │  │ index: 43               │  │ index: 44               │
+	 │ next:  43 ──────────────┼─▶  next:  44   ────────────┼──▶ next:  0  [end]         │
 	 │ size:  4084             │  │ size:  4084             │  │ size:  2000             │
-	 │ flags: 0                │  │ flags: 0                │  │ flags: 0                │
+	 │ extent: 3  flags: 0     │  │ extent: 2  flags: 0     │  │ extent: 1  flags: 0     │
 	 ├─────────────────────────┤  ├─────────────────────────┤  ├─────────────────────────┤
 	 │ data: [4084 bytes full] │  │ data: [4084 bytes full] │  │ data: [2000 bytes]      │
 	 │       [████████████████]│  │       [████████████████]│  │       [████████]        │
@@ -66,4 +142,37 @@ blob_read_full(uint32_t first_page, size_t *size);
 	 └─────────────────────────┘  └─────────────────────────┘  └─────────────────────────┘
 		  Total: 10,168 bytes of user data across 3 pages
 
+	 The pages a write needs are allocated as one extent (pager_new_extent), so
+	 they're consecutive, and each records how many pages of the extent start
+	 from it. Every page but the last is full, so the page holding an offset is
+	 found by jumping over whole extents, reading two pages per extent rather
+	 than every page. An append fills the last page, then links a new extent,
+	 right after the last page if it's free:
+
+	   [42 e:3][43 e:2][44 e:1] ──▶ [45 e:2][46 e:1]       appended in place
+	   [42 e:3][43 e:2][44 e:1] ──▶ [90 e:2][91 e:1]       elsewhere
+
+	 An extent is at most 255 pages, a longer write is several extents, one
+	 after the other.
+
+
+ 3. COMPRESSED OR SHARED BLOB
+ ----------------------------
+
+	 The first node's flags has BLOB_COMPRESSED and/or BLOB_SHARED, and its
+	 data starts with a blob_info, then what was written, LZ coded if it's
+	 compressed:
+
+				   Page #42
+				   ┌──────────────────────────────────────┐
+				   │ index: 42  next: 0  size: 1016       │
+				   │ extent: 1  flags: 3                  │
+				   ├──────────────────────────────────────┤
+				   │ refs: 2  size: 6000  hash: 9f..c1    │ ← blob_info, 16 bytes
+				   │ data: [1000 bytes of LZ coded data]  │
+				   └──────────────────────────────────────┘
+
+	 The dedup index maps the hash to page 42. Two rows hold page 42, and the
+	 blob is freed when both have deleted it.
+
  */
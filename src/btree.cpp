@@ -86,8 +86,9 @@
  * A simplification is that we hardcode the space a record can occupy from the types.
  * So if we have a record [u32, char16], and we populate it with: [23, "markymark"]
  * in memory/disk that will be [u32 data, "markymark\0\0\0\0\0\0\0"] such that there is wasted
- * space. A real database would have additional metadata in the header do pack and unpack rows
- * as tightly as possible.
+ * space. Tables with VARCHAR columns pack their rows instead, see record_pack, and their trees
+ * are created with variable_records, where each record takes only the space it needs, see
+ * put_record.
  *
  * B+tree visualisation - https://www.cs.usfca.edu/~galles/visualization/BPlusTree.html
  *
@@ -98,6 +99,7 @@
 #include "common.hpp"
 #include "types.hpp"
 #include "pager.hpp"
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <cstring>
@@ -110,6 +112,10 @@
 #define NODE_DATA_SIZE	 (PAGE_SIZE - NODE_HEADER_SIZE)
 #define MIN_ENTRY_COUNT	 3
 
+/* Sequential scan read-ahead, see cursor_readahead */
+#define BT_READAHEAD_TRIGGER 2
+#define BT_READAHEAD_LEAVES	 8
+
 /*
  * B+Tree Node Structure
  *
@@ -135,14 +141,31 @@ struct btree_node
 	uint32_t parent;   /* Parent node's page index (0 if root) */
 	uint32_t next;	   /* Next sibling in leaf chain (leaf only) */
 	uint32_t previous; /* Previous sibling in leaf chain (leaf only) */
-	uint32_t num_keys; /* Number of valid keys currently stored */
-	uint32_t is_leaf;  /* Node type: 1 for leaf, 0 for internal */
+	uint32_t num_keys;	 /* Number of valid keys currently stored */
+	uint16_t is_leaf;	 /* Node type: 1 for leaf, 0 for internal */
+	uint16_t heap_start; /* Lowest record byte, variable records only, 0 when unused */
 
 	uint8_t data[NODE_DATA_SIZE];
 };
 
 static_assert(sizeof(btree_node) == PAGE_SIZE, "btree_node must be exactly PAGE_SIZE");
 
+/* Where a variable record is in its leaf, see put_record */
+struct record_slot
+{
+	uint16_t offset; /* From the start of data */
+	uint16_t size;
+};
+
+static_assert(NODE_DATA_SIZE <= UINT16_MAX, "Record slots address the node's data with 16 bits");
+
+/*
+ * Variable leaves size their slot array for records this fraction of the
+ * tree's largest, but no smaller than VARIABLE_MIN_EXPECTED, see bt_create
+ */
+#define VARIABLE_EXPECTED_DIVISOR 8
+#define VARIABLE_MIN_EXPECTED	  8
+
 /*NOCOVER_START*/
 
 /* Node type predicates */
@@ -160,18 +183,27 @@ static_assert(sizeof(btree_node) == PAGE_SIZE, "btree_node must be exactly PAGE_
 #define GET_ROOT()		 GET_NODE(tree->root_page_index)
 #define GET_PARENT(node) GET_NODE((node)->parent)
 
+/*
+ * Leaves reached by cursor movement are fetched as scan pages, see
+ * pager_get_sequential. A hit doesn't raise a page's priority, so a leaf found
+ * by a seek keeps it, and a leaf only stepped through stays cheap to evict.
+ */
+#define GET_SCAN_NODE(index) (0 == index ? nullptr : reinterpret_cast<btree_node *>(pager_get_sequential(index)))
+
 /* Leaf chain navigation */
 #define GET_NEXT(node) GET_NODE((node)->next)
 #define GET_PREV(node) GET_NODE((node)->previous)
 
-#define GET_KEY_AT(node, idx) ((node)->data + (idx) * tree->node_key_size)
+/* Internal nodes hold separators, which can be narrower than keys, see make_separator */
+#define KEY_SIZE(node)		  ((node)->is_leaf ? tree->node_key_size : tree->separator_size)
+#define GET_KEY_AT(node, idx) ((node)->data + (idx) * KEY_SIZE(node))
 
 /*
  * Children array access (internal nodes only)
- * Children stored after all keys: data + (max_keys * key_size)
+ * Children stored after all keys: data + (max_keys * separator_size)
  * Array contains (num_keys + 1) valid entries
  */
-#define GET_CHILDREN(node)	 (reinterpret_cast<uint32_t *>((node)->data + tree->internal_max_keys * tree->node_key_size))
+#define GET_CHILDREN(node)	 (reinterpret_cast<uint32_t *>((node)->data + tree->internal_max_keys * tree->separator_size))
 #define GET_CHILD(node, idx) GET_NODE(GET_CHILDREN(node)[idx])
 
 /*
@@ -182,6 +214,14 @@ static_assert(sizeof(btree_node) == PAGE_SIZE, "btree_node must be exactly PAGE_
 #define GET_RECORD_DATA(node)	 ((node)->data + tree->leaf_max_keys * tree->node_key_size)
 #define GET_RECORD_AT(node, idx) (GET_RECORD_DATA(node) + (idx) * tree->record_size)
 
+/*
+ * With variable records the records area holds slots into the heap instead,
+ * see put_record, and shifting entries moves their slots
+ */
+#define GET_SLOTS(node)	 (reinterpret_cast<record_slot *>(GET_RECORD_DATA(node)))
+#define RECORD_STRIDE	 (tree->variable_records ? (uint32_t)sizeof(record_slot) : tree->record_size)
+#define HEAP_START(node) ((node)->heap_start ? (uint32_t)(node)->heap_start : (uint32_t)NODE_DATA_SIZE)
+
 /*
  * B+tree split invariants
  */
@@ -192,21 +232,29 @@ static_assert(sizeof(btree_node) == PAGE_SIZE, "btree_node must be exactly PAGE_
 
 #define ENSURE_SAVED(node) pager_ensure_journaled((node)->index)
 
+/*
+ * A node pointer is only valid until the pager next loads a page, which can
+ * evict it. Nodes held while other nodes are fetched (split/merge/borrow) are
+ * pinned for the duration.
+ */
+#define PIN(node)	pager_pin((node)->index)
+#define UNPIN(node) pager_unpin((node)->index)
+
 /* Shift keys right by 1 position to make room for insertion */
 #define SHIFT_KEYS_RIGHT(node, from_idx, count)                                                                        \
-	memcpy(GET_KEY_AT(node, (from_idx) + 1), GET_KEY_AT(node, from_idx), (count) * tree->node_key_size)
+	memcpy(GET_KEY_AT(node, (from_idx) + 1), GET_KEY_AT(node, from_idx), (count) * KEY_SIZE(node))
 
 /* Shift keys left by 1 position to remove deleted key */
 #define SHIFT_KEYS_LEFT(node, from_idx, count)                                                                         \
-	memcpy(GET_KEY_AT(node, from_idx), GET_KEY_AT(node, (from_idx) + 1), (count) * tree->node_key_size)
+	memcpy(GET_KEY_AT(node, from_idx), GET_KEY_AT(node, (from_idx) + 1), (count) * KEY_SIZE(node))
 
 /* Shift records right (leaf nodes only) */
 #define SHIFT_RECORDS_RIGHT(node, from_idx, count)                                                                     \
 	do                                                                                                                 \
 	{                                                                                                                  \
 		uint8_t *_base = GET_RECORD_DATA(node);                                                                        \
-		memcpy(_base + ((from_idx) + 1) * tree->record_size, _base + (from_idx) * tree->record_size,                   \
-			   (count) * tree->record_size);                                                                           \
+		memcpy(_base + ((from_idx) + 1) * RECORD_STRIDE, _base + (from_idx) * RECORD_STRIDE,                           \
+			   (count) * RECORD_STRIDE);                                                                               \
 	} while (0)
 
 /* Shift records left (leaf nodes only) */
@@ -214,8 +262,8 @@ static_assert(sizeof(btree_node) == PAGE_SIZE, "btree_node must be exactly PAGE_
 	do                                                                                                                 \
 	{                                                                                                                  \
 		uint8_t *_base = GET_RECORD_DATA(node);                                                                        \
-		memcpy(_base + (from_idx) * tree->record_size, _base + ((from_idx) + 1) * tree->record_size,                   \
-			   (count) * tree->record_size);                                                                           \
+		memcpy(_base + (from_idx) * RECORD_STRIDE, _base + ((from_idx) + 1) * RECORD_STRIDE,                           \
+			   (count) * RECORD_STRIDE);                                                                               \
 	} while (0)
 
 /* Shift children right (internal nodes only) */
@@ -236,7 +284,7 @@ static_assert(sizeof(btree_node) == PAGE_SIZE, "btree_node must be exactly PAGE_
 
 /* Copy multiple keys between nodes */
 #define COPY_KEYS(src, src_idx, dst, dst_idx, count)                                                                   \
-	memcpy(GET_KEY_AT(dst, dst_idx), GET_KEY_AT(src, src_idx), (count) * tree->node_key_size)
+	memcpy(GET_KEY_AT(dst, dst_idx), GET_KEY_AT(src, src_idx), (count) * KEY_SIZE(src))
 
 /* Copy multiple records between nodes */
 #define COPY_RECORDS(src, src_idx, dst, dst_idx, count)                                                                \
@@ -252,8 +300,180 @@ static_assert(sizeof(btree_node) == PAGE_SIZE, "btree_node must be exactly PAGE_
 #define COPY_KEY(dst, src)	  memcpy(dst, src, tree->node_key_size)
 #define COPY_RECORD(dst, src) memcpy(dst, src, tree->record_size)
 
+/* Separators between internal nodes, a leaf key becomes one through make_separator */
+#define COPY_SEPARATOR(dst, src) memcpy(dst, src, tree->separator_size)
+
 /*NOCOVER_END*/
 
+/*
+ * Variable records
+ *
+ * A tree created with variable_records keeps its leaf keys as usual, but the
+ * records area holds a slot per entry, {offset, size}, pointing into a heap
+ * that grows down from the end of the node towards the slots, see the
+ * layout in btree.hpp. Records are written below heap_start, and shifting
+ * entries around only moves their slots, so a deleted or moved record leaves
+ * a gap. The gaps are reclaimed by compacting the heap, which is only done
+ * when a record doesn't fit in the space below heap_start but does with them.
+ *
+ * A leaf is full when either its slots or its heap are. No record is bigger
+ * than a third of the heap (the tree's record_size), so a split always
+ * leaves room for the one being inserted, and variable leaves are split
+ * where their record bytes are halved rather than their entries. They only
+ * count as underflowing once they're empty, leaf_min_keys being 1, so a
+ * record borrowed into one, or merged with a sibling's last, always fits.
+ */
+
+/* The end of the slot array, the lowest the heap can grow to */
+static uint32_t
+heap_floor(btree *tree)
+{
+	return tree->leaf_max_keys * (tree->node_key_size + sizeof(record_slot));
+}
+
+static uint8_t *
+leaf_record(btree *tree, btree_node *node, uint32_t idx)
+{
+	if (!tree->variable_records)
+	{
+		return GET_RECORD_AT(node, idx);
+	}
+	return node->data + GET_SLOTS(node)[idx].offset;
+}
+
+static uint32_t
+leaf_record_size(btree *tree, btree_node *node, uint32_t idx)
+{
+	return tree->variable_records ? GET_SLOTS(node)[idx].size : tree->record_size;
+}
+
+/*
+ * The record bytes of the leaf's entries in [0, count), leaving out skip, an
+ * entry that's being written
+ */
+static uint32_t
+heap_live_bytes(btree *tree, btree_node *node, uint32_t count, uint32_t skip)
+{
+	record_slot *slots = GET_SLOTS(node);
+	uint32_t	 live = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		live += i == skip ? 0 : slots[i].size;
+	}
+	return live;
+}
+
+/* Packs the live records against the end of the node, see heap_live_bytes */
+static void
+compact_heap(btree *tree, btree_node *node, uint32_t count, uint32_t skip)
+{
+	uint8_t		 packed[NODE_DATA_SIZE];
+	record_slot *slots = GET_SLOTS(node);
+	uint32_t	 top = NODE_DATA_SIZE;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (i == skip)
+		{
+			continue;
+		}
+		top -= slots[i].size;
+		memcpy(packed + top, node->data + slots[i].offset, slots[i].size);
+		slots[i].offset = (uint16_t)top;
+	}
+
+	memcpy(node->data + top, packed + top, NODE_DATA_SIZE - top);
+	node->heap_start = (uint16_t)top;
+}
+
+/* Whether a record of size fits alongside the entries, see heap_live_bytes */
+static bool
+heap_fits(btree *tree, btree_node *node, uint32_t count, uint32_t skip, uint32_t size)
+{
+	if (size <= HEAP_START(node) - heap_floor(tree))
+	{
+		return true;
+	}
+	return heap_live_bytes(tree, node, count, skip) + size <= NODE_DATA_SIZE - heap_floor(tree);
+}
+
+/* Whether an entry with a record of size can go into the leaf without a split */
+static bool
+leaf_has_room(btree *tree, btree_node *node, uint32_t size)
+{
+	if (node->num_keys >= tree->leaf_max_keys)
+	{
+		return false;
+	}
+	return !tree->variable_records || heap_fits(tree, node, node->num_keys, UINT32_MAX, size);
+}
+
+/*
+ * Writes the record of entry idx, the leaf's other entries being those in
+ * [0, count). With variable records it goes below heap_start, the heap
+ * being compacted first if it only fits in the gaps, which the caller has
+ * checked it does, see heap_fits.
+ */
+static void
+put_record(btree *tree, btree_node *node, uint32_t idx, uint32_t count, const void *record, uint32_t size)
+{
+	if (!tree->variable_records)
+	{
+		COPY_RECORD(GET_RECORD_AT(node, idx), record);
+		return;
+	}
+
+	if (HEAP_START(node) - heap_floor(tree) < size)
+	{
+		compact_heap(tree, node, count, idx);
+	}
+	assert(HEAP_START(node) - heap_floor(tree) >= size && "Variable record doesn't fit in its leaf");
+
+	uint32_t offset = HEAP_START(node) - size;
+	memcpy(node->data + offset, record, size);
+	node->heap_start = (uint16_t)offset;
+	GET_SLOTS(node)[idx] = {(uint16_t)offset, (uint16_t)size};
+}
+
+/*
+ * Copies count records from src, starting at src_idx, into dst from dst_idx
+ * on, dst keeping its entries before dst_idx
+ */
+static void
+copy_records(btree *tree, btree_node *src, uint32_t src_idx, btree_node *dst, uint32_t dst_idx, uint32_t count)
+{
+	if (!tree->variable_records)
+	{
+		COPY_RECORDS(src, src_idx, dst, dst_idx, count);
+		return;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		put_record(tree, dst, dst_idx + i, dst_idx + i + 1, leaf_record(tree, src, src_idx + i),
+				   leaf_record_size(tree, src, src_idx + i));
+	}
+}
+
+/*
+ * Where a variable leaf's record bytes are halved, keeping at least one
+ * entry on each side
+ */
+static uint32_t
+variable_split_index(btree *tree, btree_node *node)
+{
+	uint32_t half = heap_live_bytes(tree, node, node->num_keys, UINT32_MAX) / 2;
+	uint32_t bytes = 0;
+	uint32_t index = 0;
+
+	while (index + 1 < node->num_keys && bytes + leaf_record_size(tree, node, index) <= half)
+	{
+		bytes += leaf_record_size(tree, node, index);
+		index++;
+	}
+	return std::max(index, 1u);
+}
+
 /*
  * Find a child's position within its parent's children array.
  *
@@ -279,45 +499,283 @@ find_child_index(btree *tree, btree_node *parent, btree_node *child)
 }
 
 /*
- * Binary search within a node to find key position.
+ * In-node key search
  *
- * Returns the index where the key either exists or should be inserted.
- * For leaf nodes, returns exact match position or insertion point.
- * For internal nodes, returns the child index to follow.
+ * Every descent runs a search in each node it passes, so rather than
+ * type_compare decoding the data_type and switching on it at every probe,
+ * bt_create picks a search specialised for the key type, see
+ * select_key_search.
+ *
+ * A search returns how many keys sort before key, where for an internal node
+ * an equal key counts as before (after_equal), so the index is the child to
+ * follow, and for a leaf it's the position of the key or where it would go.
  *
+ * Numeric keys narrow the range with a branchless binary search, each step
+ * keeping the answer within [base, base + n), down to a run short enough to
+ * count through, which the compiler can vectorise:
+ *
+ *   keys:   [ 3 | 8 | 12 | 15 | 21 | 30 | 41 | 56 ]   key = 22
+ *   step:   base[4] = 21 < 22, base += 4, n = 4
+ *   count:  [ 21 | 30 | 41 | 56 ] -> one before, result 4 + 1 = 5
  */
+#define BT_LINEAR_SEARCH_KEYS 16
+
+template <typename T, bool after_equal>
+static inline bool
+key_before(T candidate, T key)
+{
+	return after_equal ? candidate <= key : candidate < key;
+}
+
+template <typename T, bool after_equal>
 static uint32_t
-binary_search(btree *tree, btree_node *node, void *key)
+count_keys_before(const T *keys, uint32_t count, T key)
+{
+	const T *base = keys;
+	uint32_t n = count;
+
+	while (n > BT_LINEAR_SEARCH_KEYS)
+	{
+		uint32_t half = n / 2;
+		base += key_before<T, after_equal>(base[half], key) ? half : 0;
+		n -= half;
+	}
+
+	uint32_t before = 0;
+	for (uint32_t i = 0; i < n; i++)
+	{
+		before += key_before<T, after_equal>(base[i], key);
+	}
+	return (uint32_t)(base - keys) + before;
+}
+
+template <typename T>
+static uint32_t
+search_numeric(btree *tree, const uint8_t *keys, uint32_t count, const void *key, bool after_equal)
+{
+	T target;
+	memcpy(&target, key, sizeof(T));
+
+	const T *typed_keys = reinterpret_cast<const T *>(keys);
+	return after_equal ? count_keys_before<T, true>(typed_keys, count, target)
+					   : count_keys_before<T, false>(typed_keys, count, target);
+}
+
+/* CHAR and VARCHAR keys, nul padded to the key size */
+static uint32_t
+search_string(btree *tree, const uint8_t *keys, uint32_t count, const void *key, bool after_equal)
 {
 	uint32_t left = 0;
-	uint32_t right = node->num_keys;
+	uint32_t right = count;
+	uint32_t size = tree->node_key_size;
 
 	while (left < right)
 	{
 		uint32_t mid = left + (right - left) / 2;
-		void	*mid_key = GET_KEY_AT(node, mid);
+		int		 cmp = strncmp((const char *)keys + mid * size, (const char *)key, size);
 
-		if (type_less_than(tree->node_key_type, mid_key, key))
+		if (cmp < 0 || (after_equal && cmp == 0))
 		{
 			left = mid + 1;
 		}
-		else if (type_equals(tree->node_key_type, mid_key, key))
+		else
 		{
-			if (IS_LEAF(node))
-			{
-				return mid;
-			}
-			return mid + 1;
+			right = mid;
+		}
+	}
+	return left;
+}
+
+/* Duals and anything else, through type_compare */
+static uint32_t
+search_generic(btree *tree, const uint8_t *keys, uint32_t count, const void *key, bool after_equal)
+{
+	uint32_t left = 0;
+	uint32_t right = count;
+	uint32_t size = tree->node_key_size;
+
+	while (left < right)
+	{
+		uint32_t mid = left + (right - left) / 2;
+		int		 cmp = type_compare(tree->node_key_type, keys + mid * size, key);
+
+		if (cmp < 0 || (after_equal && cmp == 0))
+		{
+			left = mid + 1;
 		}
 		else
 		{
 			right = mid;
 		}
 	}
+	return left;
+}
+
+static bt_key_search
+select_key_search(data_type key)
+{
+	switch (type_id(key))
+	{
+	case TYPE_ID_U8:
+		return search_numeric<uint8_t>;
+	case TYPE_ID_U16:
+		return search_numeric<uint16_t>;
+	case TYPE_ID_U32:
+		return search_numeric<uint32_t>;
+	case TYPE_ID_U64:
+		return search_numeric<uint64_t>;
+	case TYPE_ID_I8:
+		return search_numeric<int8_t>;
+	case TYPE_ID_I16:
+		return search_numeric<int16_t>;
+	case TYPE_ID_I32:
+		return search_numeric<int32_t>;
+	case TYPE_ID_I64:
+		return search_numeric<int64_t>;
+	case TYPE_ID_F32:
+		return search_numeric<float>;
+	case TYPE_ID_F64:
+		return search_numeric<double>;
+	case TYPE_ID_CHAR:
+	case TYPE_ID_VARCHAR:
+		return search_string;
+	default:
+		return search_generic;
+	}
+}
+
+/*
+ * Separators
+ *
+ * Internal nodes only route searches, so their keys don't need to be copies
+ * of the leaf keys, see BT_SEPARATOR_FORMAT:
+ *
+ *   BT_SEPARATOR_KEY         A copy of the key, numeric keys are already small
+ *                            and compare in one instruction.
+ *   BT_SEPARATOR_NORMALIZED  Dual keys, each component encoded so the pair
+ *                            sorts with memcmp: unsigned big endian, signed
+ *                            with the sign bit flipped, floats with the sign
+ *                            bit flipped or every bit flipped when negative,
+ *                            strings nul padded.
+ *   BT_SEPARATOR_PREFIX      String keys, cut to the first
+ *                            BT_SEPARATOR_PREFIX_SIZE bytes. A CHAR32 tree fits
+ *                            203 separators in a node rather than 113, so a
+ *                            tree of strings is a level or two shallower.
+ *
+ * A prefix can't tell apart keys that share it, so the separator invariant is
+ * relaxed to prefix(left keys) <= separator <= prefix(right keys), and a
+ * search follows the leftmost child that can hold its prefix. A key that
+ * shares its prefix with a separator to its right may be in a following
+ * leaf, which find_leaf_for_key walks to along the leaf chain. That only
+ * happens when a run of keys with a common prefix spans leaves.
+ */
+
+static void
+normalize_component(data_type type, uint8_t *dst, const uint8_t *src, uint32_t size)
+{
+	uint8_t id = type_id(type);
+
+	if (id == TYPE_ID_CHAR || id == TYPE_ID_VARCHAR)
+	{
+		uint32_t length = strnlen((const char *)src, size);
+		memcpy(dst, src, length);
+		memset(dst + length, 0, size - length);
+		return;
+	}
+
+	uint64_t bits = 0;
+	memcpy(&bits, src, size);
+	uint64_t sign = 1ull << (size * 8 - 1);
+
+	if (id == TYPE_ID_F32 || id == TYPE_ID_F64)
+	{
+		bits = (bits & sign) ? ~bits : bits | sign;
+	}
+	else if (id >= TYPE_ID_I8 && id <= TYPE_ID_I64)
+	{
+		bits ^= sign;
+	}
+
+	for (uint32_t i = 0; i < size; i++)
+	{
+		dst[i] = (uint8_t)(bits >> ((size - 1 - i) * 8));
+	}
+}
+
+/* The separator for a leaf key, in the tree's separator format */
+static void
+make_separator(btree *tree, uint8_t *dst, const void *key)
+{
+	const uint8_t *src = (const uint8_t *)key;
+
+	switch (tree->separator_format)
+	{
+	case BT_SEPARATOR_KEY:
+		memcpy(dst, src, tree->node_key_size);
+		break;
+
+	case BT_SEPARATOR_PREFIX:
+		normalize_component(tree->node_key_type, dst, src, tree->separator_size);
+		break;
+
+	case BT_SEPARATOR_NORMALIZED: {
+		data_type first = dual_component_type(tree->node_key_type, 0);
+		data_type second = dual_component_type(tree->node_key_type, 1);
+		uint32_t  offset = type_size(first);
+		normalize_component(first, dst, src, offset);
+		normalize_component(second, dst + offset, src + offset, type_size(second));
+		break;
+	}
+	}
+}
+
+/* Normalized separators, compared as bytes */
+static uint32_t
+search_separators(btree *tree, const uint8_t *separators, uint32_t count, const void *separator, bool after_equal)
+{
+	uint32_t left = 0;
+	uint32_t right = count;
+	uint32_t size = tree->separator_size;
+
+	while (left < right)
+	{
+		uint32_t mid = left + (right - left) / 2;
+		int		 cmp = memcmp(separators + mid * size, separator, size);
 
+		if (cmp < 0 || (after_equal && cmp == 0))
+		{
+			left = mid + 1;
+		}
+		else
+		{
+			right = mid;
+		}
+	}
 	return left;
 }
 
+/*
+ * Search within a node to find key position.
+ *
+ * Returns the index where the key either exists or should be inserted.
+ * For leaf nodes, returns exact match position or insertion point.
+ * For internal nodes, returns the child index to follow, key being in the
+ * tree's separator format.
+ *
+ */
+static uint32_t
+binary_search(btree *tree, btree_node *node, void *key)
+{
+	if (IS_LEAF(node) || tree->separator_format == BT_SEPARATOR_KEY)
+	{
+		return tree->key_search(tree, node->data, node->num_keys, key, IS_INTERNAL(node));
+	}
+
+	// A prefix equal to the separator can belong on either side, take the leftmost
+	bool after_equal = tree->separator_format == BT_SEPARATOR_NORMALIZED;
+	return search_separators(tree, node->data, node->num_keys, key, after_equal);
+}
+
 /*
  * Navigate from root to the appropriate leaf for a given key.
  *
@@ -331,12 +789,40 @@ find_leaf_for_key(btree *tree, void *key)
 {
 	btree_node *node = GET_ROOT();
 
+	void   *search_key = key;
+	uint8_t separator[256];
+	if (tree->separator_format != BT_SEPARATOR_KEY)
+	{
+		make_separator(tree, separator, key);
+		search_key = separator;
+	}
+
+	// Whether the nearest separator to the right is the key's own prefix
+	bool shares_bound = false;
+
 	while (IS_INTERNAL(node))
 	{
-		uint32_t idx = binary_search(tree, node, key);
+		uint32_t idx = binary_search(tree, node, search_key);
+		if (tree->separator_format == BT_SEPARATOR_PREFIX && idx < node->num_keys)
+		{
+			shares_bound = 0 == memcmp(GET_KEY_AT(node, idx), separator, tree->separator_size);
+		}
 		node = GET_CHILD(node, idx);
 	}
 
+	// The leftmost leaf for the prefix, the key can be further along the run.
+	// An empty neighbour is the right half of an append split, see split
+	while (shares_bound && node->next && node->num_keys &&
+		   type_less_than(tree->node_key_type, GET_KEY_AT(node, node->num_keys - 1), key))
+	{
+		btree_node *next = GET_NEXT(node);
+		if (next->num_keys && type_greater_than(tree->node_key_type, GET_KEY_AT(next, 0), key))
+		{
+			break;
+		}
+		node = next;
+	}
+
 	return node;
 }
 
@@ -380,17 +866,24 @@ unlink_leaf_node(btree_node *node)
 
 	btree_node *prev_node = nullptr;
 	btree_node *next_node = nullptr;
+	uint32_t	next_index = node->next;
 
 	if (node->previous != 0)
 	{
 		prev_node = GET_PREV(node);
+		PIN(prev_node);
 	}
-	if (node->next != 0)
+	if (next_index != 0)
 	{
-		next_node = GET_NEXT(node);
+		next_node = GET_NODE(next_index);
 	}
 
 	link_leaf_nodes(prev_node, next_node);
+
+	if (prev_node)
+	{
+		UNPIN(prev_node);
+	}
 }
 
 /*
@@ -407,19 +900,25 @@ set_child(btree *tree, btree_node *node, uint32_t child_index, uint32_t node_ind
 
 	if (node_index != 0)
 	{
+		// Fetching the child can evict an unpinned node, read the index first
+		uint32_t	parent_index = node->index;
 		btree_node *child_node = GET_NODE(node_index);
 		if (child_node)
 		{
 			ENSURE_SAVED(child_node);
-			child_node->parent = node->index;
+			child_node->parent = parent_index;
 		}
 	}
 }
 
+/*
+ * near_page is an allocation hint, a split passes the node being split so
+ * the new sibling is placed next to it if there's space.
+ */
 static btree_node *
-create_node(btree *tree, bool is_leaf)
+create_node(btree *tree, bool is_leaf, uint32_t near_page = 0)
 {
-	uint32_t page_index = pager_new();
+	uint32_t page_index = pager_new(near_page);
 	assert(PAGE_INVALID != page_index && "Failed to allocate new page from pager for btree node");
 	btree_node *node = GET_NODE(page_index);
 
@@ -429,6 +928,7 @@ create_node(btree *tree, bool is_leaf)
 	node->previous = 0;
 	node->num_keys = 0;
 	node->is_leaf = is_leaf ? 1 : 0;
+	node->heap_start = 0;
 
 	ENSURE_SAVED(node);
 	return node;
@@ -447,6 +947,8 @@ create_node(btree *tree, bool is_leaf)
 static void
 swap_with_root(btree *tree, btree_node *root, btree_node *other)
 {
+	PIN(root);
+	PIN(other);
 	ENSURE_SAVED(root);
 	ENSURE_SAVED(other);
 	// Verify root is actually the root
@@ -494,6 +996,9 @@ swap_with_root(btree *tree, btree_node *root, btree_node *other)
 			}
 		}
 	}
+
+	UNPIN(other);
+	UNPIN(root);
 }
 
 /*
@@ -515,21 +1020,49 @@ swap_with_root(btree *tree, btree_node *root, btree_node *other)
  * Special case: Splitting the root
  *   When the root splits, we need a new root above it.
  *
+ * Special case: Appending past the end of the tree
+ *   Auto-increment keys always land after the last key of the rightmost
+ *   leaf, so a mid-point split would leave every leaf behind it half empty
+ *   for good. When append_key is given the leaf is the rightmost and the key
+ *   is past its end: the leaf stays full, and a new empty leaf is started
+ *   with append_key as the separator, like SQLite's quickbalance. The parents
+ *   this splits in turn are on the right spine, and keep all but their last
+ *   key and last 2 children, which move to the new node. So only the nodes
+ *   on the right spine are ever below the minimum fill, see
+ *   validate_node_recursive, and deletes repair them like any other.
+ *
  * Returns: Parent node (which may now be full and need splitting)
  */
 static btree_node *
-split(btree *tree, btree_node *node)
+split(btree *tree, btree_node *node, void *append_key = nullptr)
 {
 	// === PREPARATION ===
-	uint32_t	split_point = GET_SPLIT_INDEX(node);
-	btree_node *new_right = create_node(tree, IS_LEAF(node));
+	uint32_t split_point = GET_SPLIT_INDEX(node);
+	if (IS_LEAF(node) && tree->variable_records)
+	{
+		split_point = variable_split_index(tree, node);
+	}
+	if (append_key)
+	{
+		split_point = IS_LEAF(node) ? node->num_keys : node->num_keys - 2;
+	}
+	PIN(node);
+	btree_node *new_right = create_node(tree, IS_LEAF(node), node->index);
+	PIN(new_right);
 
 	// Save the key that will be promoted to parent
 	// (for leaves, this is a copy; for internals, it moves up)
 	assert(tree->node_key_size <= 256 && "No handling for keys 256 bytes or greater");
 	uint8_t promoted_key[256];
 
-	COPY_KEY(promoted_key, GET_KEY_AT(node, split_point));
+	if (IS_LEAF(node))
+	{
+		make_separator(tree, promoted_key, split_point < node->num_keys ? GET_KEY_AT(node, split_point) : append_key);
+	}
+	else
+	{
+		COPY_SEPARATOR(promoted_key, GET_KEY_AT(node, split_point));
+	}
 
 	ENSURE_SAVED(node);
 	ENSURE_SAVED(new_right);
@@ -541,8 +1074,9 @@ split(btree *tree, btree_node *node)
 	{
 		// Special case: splitting root requires creating new root above it
 		// 1. Create new node for the internal
-		btree_node *new_node = create_node(tree, false);
-		// 2. Get current root
+		btree_node *new_node = create_node(tree, false, node->index);
+		PIN(new_node);
+		// 2. Get current root (already pinned, it's the node being split)
 		btree_node *root = GET_NODE(tree->root_page_index);
 		// 3. Swap contents: root becomes empty, new_node gets old root data
 		swap_with_root(tree, root, new_node);
@@ -555,6 +1089,7 @@ split(btree *tree, btree_node *node)
 	}
 	else
 	{
+		PIN(parent);
 		ENSURE_SAVED(parent);
 		// Normal case: find our position in existing parent
 		position_in_parent = find_child_index(tree, parent, node);
@@ -566,7 +1101,7 @@ split(btree *tree, btree_node *node)
 
 	// === INSERT PROMOTED KEY INTO PARENT ===
 
-	COPY_KEY(GET_KEY_AT(parent, position_in_parent), promoted_key);
+	COPY_SEPARATOR(GET_KEY_AT(parent, position_in_parent), promoted_key);
 	set_child(tree, parent, position_in_parent + 1, new_right->index);
 	parent->num_keys++;
 
@@ -577,7 +1112,7 @@ split(btree *tree, btree_node *node)
 		// Right gets everything from split_point onwards
 		new_right->num_keys = node->num_keys - split_point;
 		COPY_KEYS(node, split_point, new_right, 0, new_right->num_keys);
-		COPY_RECORDS(node, split_point, new_right, 0, new_right->num_keys);
+		copy_records(tree, node, split_point, new_right, 0, new_right->num_keys);
 
 		// Maintain leaf chain
 		link_leaf_nodes(new_right, GET_NEXT(node));
@@ -609,9 +1144,28 @@ split(btree *tree, btree_node *node)
 		node->num_keys = split_point;
 	}
 
+	// Root case: node is the relocated new_node and parent the root page that
+	// was pinned on entry, so this balances the pins either way
+	UNPIN(new_right);
+	UNPIN(node);
+	UNPIN(parent);
+
 	return parent; // Parent might now be full and need splitting
 }
 
+static void
+insert_in_leaf(btree *tree, btree_node *leaf, uint32_t pos, void *key, void *data, uint32_t size)
+{
+	ENSURE_SAVED(leaf);
+
+	SHIFT_KEYS_RIGHT(leaf, pos, leaf->num_keys - pos);
+	SHIFT_RECORDS_RIGHT(leaf, pos, leaf->num_keys - pos);
+
+	COPY_KEY(GET_KEY_AT(leaf, pos), (void *)key);
+	put_record(tree, leaf, pos, leaf->num_keys + 1, data, size);
+	leaf->num_keys++;
+}
+
 /*
  * Insert a key-record pair into the B+tree.
  *
@@ -621,10 +1175,12 @@ split(btree *tree, btree_node *node)
  *   3. Node full: Split and retry
  *
  * After splits, we re-search for the leaf because the key's proper
- * location may have changed during the restructuring.
+ * location may have changed during the restructuring. A variable record can
+ * land in the half that's still short of room, which is split again. Returns
+ * the leaf the entry went into, with its position in *pos.
  */
-static void
-insert_element(btree *tree, void *key, void *data)
+static btree_node *
+insert_element(btree *tree, void *key, void *data, uint32_t size, uint32_t *pos)
 {
 	btree_node *root = GET_ROOT();
 
@@ -633,26 +1189,33 @@ insert_element(btree *tree, void *key, void *data)
 		// Direct insert into empty root
 		ENSURE_SAVED(root);
 		COPY_KEY(GET_KEY_AT(root, 0), (void *)key);
-		COPY_RECORD(GET_RECORD_AT(root, 0), (void *)data);
+		put_record(tree, root, 0, 1, data, size);
 		root->num_keys = 1;
-		return;
+		*pos = 0;
+		return root;
 	}
 
 	// Find leaf
 	btree_node *leaf = find_leaf_for_key(tree, (void *)key);
 
 	// Make room if needed
-	if (NODE_IS_FULL(leaf))
+	while (!leaf_has_room(tree, leaf, size))
 	{
+		// Appending to the end of the tree, see split
+		void *append_key = nullptr;
+		if (0 == leaf->next && type_greater_than(tree->node_key_type, key, GET_KEY_AT(leaf, leaf->num_keys - 1)))
+		{
+			append_key = key;
+		}
 
-		btree_node *node = leaf;
+		btree_node *node = split(tree, leaf, append_key);
 		while (node && NODE_IS_FULL(node))
 		{
 			// split might propagate to parent,
 			// stop when split doesn't return new parent of split node
 			// and research
 
-			node = split(tree, node);
+			node = split(tree, node, append_key);
 		}
 
 		// Re-find because splits may have moved our key
@@ -660,23 +1223,18 @@ insert_element(btree *tree, void *key, void *data)
 	}
 
 	// Now insert
-	uint32_t pos = binary_search(tree, leaf, (void *)key);
-	ENSURE_SAVED(leaf);
-
-	SHIFT_KEYS_RIGHT(leaf, pos, leaf->num_keys - pos);
-	SHIFT_RECORDS_RIGHT(leaf, pos, leaf->num_keys - pos);
-
-	COPY_KEY(GET_KEY_AT(leaf, pos), (void *)key);
-	COPY_RECORD(GET_RECORD_AT(leaf, pos), (void *)data);
-	leaf->num_keys++;
+	*pos = binary_search(tree, leaf, (void *)key);
+	insert_in_leaf(tree, leaf, *pos, key, data, size);
+	return leaf;
 }
 
 static void
 destroy_node(btree_node *node)
 {
+	uint32_t index = node->index;
 
 	unlink_leaf_node(node); // no-op if internal
-	pager_delete(node->index);
+	pager_delete(index);
 }
 /*
  * Handle the special case where the root becomes empty after deletion.
@@ -692,13 +1250,18 @@ collapse_empty_root(btree *tree, btree_node *root)
 	assert(IS_INTERNAL(root) && "collapse_empty_root requires internal node (leaf roots cannot be collapsed)");
 
 	// The root has only 1 child - make it the new root
+	PIN(root);
 	btree_node *only_child = GET_CHILD(root, 0);
+	PIN(only_child);
 
 	// Swap contents: only_child becomes root, root gets child's data
 	swap_with_root(tree, root, only_child);
 
 	// Delete the old root (now at only_child's position)
 	destroy_node(only_child);
+
+	UNPIN(only_child);
+	UNPIN(root);
 }
 
 /*
@@ -731,20 +1294,22 @@ borrow_from_left_sibling(btree *tree, btree_node *node, btree_node *left_sibling
 		SHIFT_RECORDS_RIGHT(node, 0, node->num_keys);
 
 		// Copy entry from left's end to node's beginning
-		COPY_KEY(GET_KEY_AT(node, 0), GET_KEY_AT(left_sibling, left_sibling->num_keys - 1));
-		COPY_RECORD(GET_RECORD_AT(node, 0), GET_RECORD_AT(left_sibling, left_sibling->num_keys - 1));
+		uint32_t last = left_sibling->num_keys - 1;
+		COPY_KEY(GET_KEY_AT(node, 0), GET_KEY_AT(left_sibling, last));
+		put_record(tree, node, 0, node->num_keys + 1, leaf_record(tree, left_sibling, last),
+				   leaf_record_size(tree, left_sibling, last));
 
 		// Update parent separator to be the new first key of node
-		COPY_KEY(GET_KEY_AT(parent, separator_index), GET_KEY_AT(node, 0));
+		make_separator(tree, GET_KEY_AT(parent, separator_index), GET_KEY_AT(node, 0));
 	}
 	else
 	{
 		// For internals: rotate through parent
 		// Parent separator moves down to node
-		COPY_KEY(GET_KEY_AT(node, 0), GET_KEY_AT(parent, separator_index));
+		COPY_SEPARATOR(GET_KEY_AT(node, 0), GET_KEY_AT(parent, separator_index));
 
 		// Left's last key moves up to parent
-		COPY_KEY(GET_KEY_AT(parent, separator_index), GET_KEY_AT(left_sibling, left_sibling->num_keys - 1));
+		COPY_SEPARATOR(GET_KEY_AT(parent, separator_index), GET_KEY_AT(left_sibling, left_sibling->num_keys - 1));
 
 		// Move corresponding child pointer
 		uint32_t *node_children = GET_CHILDREN(node);
@@ -781,23 +1346,24 @@ borrow_from_right_sibling(btree *tree, btree_node *node, btree_node *right_sibli
 	{
 		// For leaves: move first entry from right to end of node
 		COPY_KEY(GET_KEY_AT(node, node->num_keys), GET_KEY_AT(right_sibling, 0));
-		COPY_RECORD(GET_RECORD_AT(node, node->num_keys), GET_RECORD_AT(right_sibling, 0));
+		put_record(tree, node, node->num_keys, node->num_keys + 1, leaf_record(tree, right_sibling, 0),
+				   leaf_record_size(tree, right_sibling, 0));
 
 		// Shift right sibling's entries left
 		SHIFT_KEYS_LEFT(right_sibling, 0, right_sibling->num_keys - 1);
 		SHIFT_RECORDS_LEFT(right_sibling, 0, right_sibling->num_keys - 1);
 
 		// Update parent separator to be the new first key of right
-		COPY_KEY(GET_KEY_AT(parent, separator_index), GET_KEY_AT(right_sibling, 0));
+		make_separator(tree, GET_KEY_AT(parent, separator_index), GET_KEY_AT(right_sibling, 0));
 	}
 	else
 	{
 		// For internals: rotate through parent
 		// Parent separator moves down to node
-		COPY_KEY(GET_KEY_AT(node, node->num_keys), GET_KEY_AT(parent, separator_index));
+		COPY_SEPARATOR(GET_KEY_AT(node, node->num_keys), GET_KEY_AT(parent, separator_index));
 
 		// Right's first key moves up to parent
-		COPY_KEY(GET_KEY_AT(parent, separator_index), GET_KEY_AT(right_sibling, 0));
+		COPY_SEPARATOR(GET_KEY_AT(parent, separator_index), GET_KEY_AT(right_sibling, 0));
 
 		// Move corresponding child pointer
 		uint32_t *right_children = GET_CHILDREN(right_sibling);
@@ -829,6 +1395,9 @@ try_borrow_from_siblings(btree *tree, btree_node *node)
 {
 	btree_node *parent = GET_PARENT(node);
 	uint32_t	child_index = find_child_index(tree, parent, node);
+	bool		borrowed = false;
+
+	PIN(parent);
 
 	// Try left sibling first (consistent strategy)
 	if (child_index > 0)
@@ -836,23 +1405,28 @@ try_borrow_from_siblings(btree *tree, btree_node *node)
 		btree_node *left = GET_CHILD(parent, child_index - 1);
 		if (NODE_CAN_SPARE(left))
 		{
+			PIN(left);
 			borrow_from_left_sibling(tree, node, left, child_index - 1);
-			return true;
+			UNPIN(left);
+			borrowed = true;
 		}
 	}
 
 	// Try right sibling
-	if (child_index < parent->num_keys)
+	if (!borrowed && child_index < parent->num_keys)
 	{
 		btree_node *right = GET_CHILD(parent, child_index + 1);
 		if (NODE_CAN_SPARE(right))
 		{
+			PIN(right);
 			borrow_from_right_sibling(tree, node, right, child_index);
-			return true;
+			UNPIN(right);
+			borrowed = true;
 		}
 	}
 
-	return false;
+	UNPIN(parent);
+	return borrowed;
 }
 
 /*
@@ -876,6 +1450,8 @@ perform_merge_with_sibling(btree *tree, btree_node *node)
 	btree_node *left, *right;
 	uint32_t	separator_index;
 
+	PIN(parent);
+
 	// Decide which sibling to merge with
 	// Prefer merging with right sibling (consistent strategy)
 	if (child_index < parent->num_keys)
@@ -899,6 +1475,8 @@ perform_merge_with_sibling(btree *tree, btree_node *node)
 	assert(right->index == GET_CHILDREN(parent)[separator_index + 1] &&
 		   "Right node must be at separator_index+1 position in parent");
 
+	PIN(left);
+	PIN(right);
 	ENSURE_SAVED(left);
 	ENSURE_SAVED(parent);
 
@@ -906,7 +1484,7 @@ perform_merge_with_sibling(btree *tree, btree_node *node)
 	{
 		// For leaves: concatenate all entries
 		COPY_KEYS(right, 0, left, left->num_keys, right->num_keys);
-		COPY_RECORDS(right, 0, left, left->num_keys, right->num_keys);
+		copy_records(tree, right, 0, left, left->num_keys, right->num_keys);
 		left->num_keys += right->num_keys;
 
 		// Update leaf chain
@@ -916,7 +1494,7 @@ perform_merge_with_sibling(btree *tree, btree_node *node)
 	{
 		// For internals: bring down separator and concatenate
 		// Copy separator from parent into left
-		COPY_KEY(GET_KEY_AT(left, left->num_keys), GET_KEY_AT(parent, separator_index));
+		COPY_SEPARATOR(GET_KEY_AT(left, left->num_keys), GET_KEY_AT(parent, separator_index));
 
 		// Copy all keys from right
 		COPY_KEYS(right, 0, left, left->num_keys + 1, right->num_keys);
@@ -939,6 +1517,10 @@ perform_merge_with_sibling(btree *tree, btree_node *node)
 	// Delete the now-empty right node
 	destroy_node(right);
 
+	UNPIN(right);
+	UNPIN(left);
+	UNPIN(parent);
+
 	return parent;
 }
 
@@ -969,13 +1551,16 @@ repair_underflow(btree *tree, btree_node *node)
 	}
 
 	// Step 2: Try non-destructive fix (borrow from sibling)
+	PIN(node);
 	if (try_borrow_from_siblings(tree, node))
 	{
+		UNPIN(node);
 		return;
 	}
 
 	// Step 3: Destructive fix (merge with sibling)
 	btree_node *parent = perform_merge_with_sibling(tree, node);
+	UNPIN(node);
 
 	// Step 4: Check if parent needs repair (cascade)
 	if (parent && IS_UNDERFLOWING(parent))
@@ -1001,65 +1586,724 @@ repair_underflow(btree *tree, btree_node *node)
  * B+trees can leave deleted keys in internal nodes as they just act as guides to
  * the leaves.
  */
-static void
-delete_element(btree *tree, btree_node *node, void *key, uint32_t index)
+static void
+delete_element(btree *tree, btree_node *node, void *key, uint32_t index)
+{
+	assert(IS_LEAF(node) && "B+tree deletion only occurs in leaf nodes where data is stored");
+
+	if (IS_ROOT(node) && node->num_keys == 1)
+	{
+		ENSURE_SAVED(node);
+		node->num_keys = 0;
+		node->heap_start = 0;
+		return;
+	}
+
+	ENSURE_SAVED(node);
+
+	// Remove the entry by shifting remaining entries left
+	uint32_t entries_to_shift = node->num_keys - index - 1;
+	SHIFT_KEYS_LEFT(node, index, entries_to_shift);
+	SHIFT_RECORDS_LEFT(node, index, entries_to_shift);
+	node->num_keys--;
+
+	// Fix underflow if necessary
+	repair_underflow(tree, node);
+}
+/*
+ * Recursively delete all nodes in the tree.
+ */
+void
+clear_recurse(btree *tree, btree_node *node)
+{
+	if (IS_LEAF(node))
+	{
+		pager_delete(node->index);
+		return;
+	}
+
+	PIN(node);
+	for (uint32_t i = 0; i <= node->num_keys; i++)
+	{
+		clear_recurse(tree, GET_CHILD(node, i));
+	}
+	UNPIN(node);
+
+	pager_delete(node->index);
+}
+
+/*
+ * Post order dfs calling pager_delete to wipe entire tree
+ */
+bool
+bt_clear(btree *tree)
+{
+	if (0 == tree->root_page_index)
+	{
+		// uninitialised table
+		return true;
+	}
+
+	clear_recurse(tree, GET_NODE(tree->root_page_index));
+	return true;
+}
+
+/*
+ * Remove every entry while keeping the root page, which becomes an empty
+ * leaf, so whatever records the root's location stays valid
+ */
+bool
+bt_truncate(btree *tree)
+{
+	if (0 == tree->root_page_index)
+	{
+		return true;
+	}
+
+	btree_node *root = GET_NODE(tree->root_page_index);
+	if (IS_INTERNAL(root))
+	{
+		PIN(root);
+		for (uint32_t i = 0; i <= root->num_keys; i++)
+		{
+			clear_recurse(tree, GET_CHILD(root, i));
+		}
+		UNPIN(root);
+	}
+
+	root = GET_NODE(tree->root_page_index);
+	ENSURE_SAVED(root);
+	root->next = 0;
+	root->previous = 0;
+	root->num_keys = 0;
+	root->is_leaf = 1;
+	root->heap_start = 0;
+	return true;
+}
+
+struct vacuum_page
+{
+	uint32_t index;
+	btree	*tree;
+};
+
+/*
+ * Collect a subtree's pages. The tree is balanced, so knowing the height the
+ * leaves are listed from their parents without being read.
+ */
+static void
+vacuum_collect(btree *tree, uint32_t page_index, uint32_t height, array<vacuum_page, query_arena> *pages)
+{
+	pages->push({page_index, tree});
+	if (0 == height)
+	{
+		return;
+	}
+
+	btree_node *node = GET_NODE(page_index);
+	PIN(node);
+	uint32_t *children = GET_CHILDREN(node);
+	for (uint32_t i = 0; i <= node->num_keys; i++)
+	{
+		vacuum_collect(tree, children[i], height - 1, pages);
+	}
+	UNPIN(node);
+}
+
+/*
+ * Move a node into the lowest free page, then point its parent (the tree, for
+ * the root), its children and its leaf chain neighbours at the new page.
+ */
+static bool
+relocate_node(btree *tree, uint32_t page_index)
+{
+	uint32_t new_index = pager_relocate(page_index);
+	if (new_index == page_index)
+	{
+		return false;
+	}
+
+	btree_node *node = GET_NODE(new_index);
+	PIN(node);
+
+	if (IS_ROOT(node))
+	{
+		tree->root_page_index = new_index;
+	}
+	else
+	{
+		btree_node *parent = GET_PARENT(node);
+		PIN(parent);
+		uint32_t *siblings = GET_CHILDREN(parent);
+		uint32_t  position = 0;
+		while (siblings[position] != page_index)
+		{
+			position++;
+		}
+		set_child(tree, parent, position, new_index);
+		UNPIN(parent);
+	}
+
+	if (IS_INTERNAL(node))
+	{
+		uint32_t *children = GET_CHILDREN(node);
+		for (uint32_t i = 0; i <= node->num_keys; i++)
+		{
+			set_child(tree, node, i, children[i]);
+		}
+	}
+	else
+	{
+		if (node->previous)
+		{
+			link_leaf_nodes(GET_PREV(node), node);
+		}
+		if (node->next)
+		{
+			link_leaf_nodes(node, GET_NEXT(node));
+		}
+	}
+
+	UNPIN(node);
+	return true;
+}
+
+/*
+ * Compact the given trees towards the front of the file, for VACUUM.
+ *
+ * Every node is visited from the highest page down, and moved into the lowest
+ * free page while there is one below it. A moved root changes the tree's
+ * root_page_index, for the caller to record wherever it keeps it. The vacated
+ * pages are left free at the end of the file, for the commit to truncate.
+ *
+ * At most max_moves nodes are moved (0 for no limit), so compaction can be
+ * done a bit at a time. Returns the number moved.
+ */
+uint32_t
+bt_vacuum(btree **trees, uint32_t tree_count, uint32_t max_moves)
+{
+	array<vacuum_page, query_arena> pages;
+	for (uint32_t i = 0; i < tree_count; i++)
+	{
+		btree *tree = trees[i];
+		if (0 == tree->root_page_index)
+		{
+			continue;
+		}
+
+		uint32_t	height = 0;
+		btree_node *node = GET_ROOT();
+		while (IS_INTERNAL(node))
+		{
+			node = GET_CHILD(node, 0);
+			height++;
+		}
+
+		vacuum_collect(tree, tree->root_page_index, height, &pages);
+	}
+
+	std::sort(pages.begin(), pages.end(),
+			  [](const vacuum_page &a, const vacuum_page &b) { return a.index > b.index; });
+
+	uint32_t moved = 0;
+	for (vacuum_page &page : pages)
+	{
+		if (max_moves && moved == max_moves)
+		{
+			break;
+		}
+		/* Pages only get lower from here, so nothing further can move either */
+		if (!relocate_node(page.tree, page.index))
+		{
+			break;
+		}
+		moved++;
+	}
+
+	return moved;
+}
+
+/*
+ * Split points
+ *
+ * Keys that cut the tree into ranges of about the same size, for scanning
+ * them separately. The separators of the highest level that has enough of
+ * them are spread as evenly as each node's fill allows, so points are picked
+ * evenly from them, in order, and turned back into keys. A prefix separator
+ * becomes the shortest key with that prefix, which is just as good a place
+ * to cut.
+ */
+
+#define BT_SPLIT_MAX_DEPTH 3
+
+uint32_t
+bt_split_points(btree *tree, uint32_t max_points, uint8_t *keys)
+{
+	if (0 == max_points || tree->separator_format == BT_SEPARATOR_NORMALIZED)
+	{
+		return 0;
+	}
+
+	btree_node *root = GET_ROOT();
+	if (!root || IS_LEAF(root))
+	{
+		return 0;
+	}
+
+	array<uint32_t, query_arena> level;
+	array<uint32_t, query_arena> children;
+	array<uint8_t, query_arena>	 separators;
+	level.push(tree->root_page_index);
+
+	for (uint32_t depth = 1;; depth++)
+	{
+		separators.clear();
+		children.clear();
+		for (uint32_t page : level)
+		{
+			btree_node *node = GET_NODE(page);
+			for (uint32_t i = 0; i < node->num_keys * tree->separator_size; i++)
+			{
+				separators.push(node->data[i]);
+			}
+			for (uint32_t i = 0; i <= node->num_keys; i++)
+			{
+				children.push(GET_CHILDREN(node)[i]);
+			}
+		}
+
+		uint32_t count = separators.size() / tree->separator_size;
+		if (count >= max_points || depth == BT_SPLIT_MAX_DEPTH || IS_LEAF(GET_NODE(children[0])))
+		{
+			break;
+		}
+
+		level.clear();
+		for (uint32_t child : children)
+		{
+			level.push(child);
+		}
+	}
+
+	uint32_t count = separators.size() / tree->separator_size;
+	uint32_t points = std::min(count, max_points);
+	uint32_t written = 0;
+	for (uint32_t p = 0; p < points; p++)
+	{
+		uint8_t *separator = separators.data() + (uint64_t)(p + 1) * count / (points + 1) * tree->separator_size;
+		uint8_t *key = keys + written * tree->node_key_size;
+
+		memset(key, 0, tree->node_key_size);
+		memcpy(key, separator, std::min(tree->separator_size, tree->node_key_size));
+
+		if (written > 0 && 0 == memcmp(key, key - tree->node_key_size, tree->node_key_size))
+		{
+			continue;
+		}
+		written++;
+	}
+
+	return written;
+}
+
+/*
+ * Walks the internal levels a whole level at a time, as above, counting
+ * their pages, which leaves the lowest one's children as every leaf in key
+ * order. The sampled leaves are picked at an even stride through those.
+ */
+bool
+bt_sample(btree *tree, uint32_t max_leaves, bt_match visit, void *context, bt_sample_info *info)
+{
+	*info = {};
+	btree_node *root = GET_ROOT();
+	if (!root)
+	{
+		return false;
+	}
+
+	array<uint32_t, query_arena> level;
+	array<uint32_t, query_arena> children;
+	level.push(tree->root_page_index);
+	info->height = 1;
+
+	while (!IS_LEAF(GET_NODE(level[0])))
+	{
+		children.clear();
+		for (uint32_t page : level)
+		{
+			btree_node *node = GET_NODE(page);
+			for (uint32_t i = 0; i <= node->num_keys; i++)
+			{
+				children.push(GET_CHILDREN(node)[i]);
+			}
+		}
+
+		info->internal_pages += level.size();
+		info->height++;
+
+		level.clear();
+		for (uint32_t child : children)
+		{
+			level.push(child);
+		}
+	}
+
+	info->leaf_pages = level.size();
+	uint32_t sampled = std::min(max_leaves, info->leaf_pages);
+	for (uint32_t s = 0; s < sampled; s++)
+	{
+		uint32_t	page = level[(uint64_t)s * info->leaf_pages / sampled];
+		btree_node *node = (btree_node *)pager_pin(page);
+
+		// Visiting a variable record can read its overflow blobs, and with them evict the leaf
+		for (uint32_t i = 0; i < node->num_keys; i++)
+		{
+			visit(context, GET_KEY_AT(node, i), leaf_record(tree, node, i));
+		}
+
+		info->sampled_entries += node->num_keys;
+		info->sampled_leaves++;
+		pager_unpin(page);
+	}
+
+	return true;
+}
+
+/*
+ * Bulk loading
+ *
+ * Inserting sorted input one entry at a time descends from the root for every
+ * entry, and splits each leaf in half once it fills, so a load leaves the tree
+ * half empty after doing twice the writes. Knowing the input is in order, the
+ * builder only ever appends to the rightmost node of each level:
+ *
+ *   level 2                 [      50      ]
+ *                          /                \
+ *   level 1        [ 20 | 35 ]            [ 65 ]  <- open[1]
+ *                 /     |     \           /    \
+ *   level 0    [10..] [20..] [35..]   [50..]  [65..]  <- open[0]
+ *
+ * A leaf takes entries until it holds leaf_fill keys; the next entry starts a
+ * new leaf, and its key is appended to the open node above as the separator.
+ * When that node is also at its fill the separator is carried up a level
+ * instead, and a new node is started with the new child as its first, growing
+ * a level at the top when needed. Each page is written once, in key order.
+ *
+ * Every node but the last of each level holds its fill, the last ones are
+ * fixed up when the input ends, see bulk_fix_right_edge.
+ */
+
+static void
+bulk_push_up(bt_bulk_loader *loader, uint32_t level, uint8_t *separator, uint32_t left_index, uint32_t right_index)
+{
+	btree *tree = loader->tree;
+
+	if (level == loader->height)
+	{
+		assert(level < BT_BULK_MAX_HEIGHT && "Bulk load tree too deep");
+		btree_node *top = create_node(tree, false, left_index);
+		loader->open[level] = top->index;
+		loader->previous[level] = 0;
+		loader->height++;
+		set_child(tree, top, 0, left_index);
+	}
+
+	btree_node *node = GET_NODE(loader->open[level]);
+	if (node->num_keys < loader->internal_fill)
+	{
+		ENSURE_SAVED(node);
+		COPY_SEPARATOR(GET_KEY_AT(node, node->num_keys), separator);
+		node->num_keys++;
+		set_child(tree, node, node->num_keys, right_index);
+		return;
+	}
+
+	uint32_t	full_index = node->index;
+	btree_node *sibling = create_node(tree, false, full_index);
+	loader->previous[level] = full_index;
+	loader->open[level] = sibling->index;
+	set_child(tree, sibling, 0, right_index);
+
+	bulk_push_up(loader, level + 1, separator, full_index, loader->open[level]);
+}
+
+/*
+ * Drop the last node of a level, whose entries have been merged into its left
+ * neighbour. The separator between them goes from the lowest ancestor that has
+ * one, and a parent left with no children goes with it.
+ */
+static void
+bulk_remove_last(bt_bulk_loader *loader, uint32_t level)
+{
+	btree	   *tree = loader->tree;
+	btree_node *parent = GET_PARENT(GET_NODE(loader->open[level]));
+
+	if (parent->num_keys > 0)
+	{
+		ENSURE_SAVED(parent);
+		parent->num_keys--;
+	}
+	else
+	{
+		uint32_t parent_index = parent->index;
+		bulk_remove_last(loader, level + 1);
+		pager_delete(parent_index);
+	}
+
+	loader->open[level] = loader->previous[level];
+	loader->previous[level] = 0;
+}
+
+/*
+ * Bring the last node of a level up to the minimum key count, by taking
+ * entries from its left neighbour, or merging into it when both together
+ * wouldn't make two valid nodes. The levels are fixed bottom up, so a merge
+ * taking a key from the level above is repaired on the next pass.
+ *
+ * The two nodes are neighbours on the right spine, so their separator is the
+ * last key of the lowest ancestor with any keys.
+ */
+static void
+bulk_fix_right_edge(bt_bulk_loader *loader, uint32_t level)
+{
+	btree	*tree = loader->tree;
+	uint32_t right_index = loader->open[level];
+	uint32_t left_index = loader->previous[level];
+
+	btree_node *right = GET_NODE(right_index);
+	uint32_t	min_keys = GET_MIN_KEYS(right);
+	if (right->num_keys >= min_keys || 0 == left_index)
+	{
+		return;
+	}
+	PIN(right);
+	btree_node *left = GET_NODE(left_index);
+	PIN(left);
+
+	btree_node *ancestor = GET_PARENT(right);
+	while (0 == ancestor->num_keys)
+	{
+		ancestor = GET_PARENT(ancestor);
+	}
+	PIN(ancestor);
+	ENSURE_SAVED(ancestor);
+	ENSURE_SAVED(left);
+	ENSURE_SAVED(right);
+	uint8_t *separator = GET_KEY_AT(ancestor, ancestor->num_keys - 1);
+
+	uint32_t combined = left->num_keys + right->num_keys;
+	bool	 merge = combined < 2 * min_keys;
+
+	if (IS_LEAF(right))
+	{
+		if (merge)
+		{
+			COPY_KEYS(right, 0, left, left->num_keys, right->num_keys);
+			copy_records(tree, right, 0, left, left->num_keys, right->num_keys);
+			left->num_keys = combined;
+			link_leaf_nodes(left, nullptr);
+		}
+		else
+		{
+			// A variable leaf's minimum is 1, which the last leaf always has
+			assert(!tree->variable_records);
+			uint32_t moving = min_keys - right->num_keys;
+			uint32_t from = left->num_keys - moving;
+			uint8_t *records = GET_RECORD_DATA(right);
+			memmove(GET_KEY_AT(right, moving), GET_KEY_AT(right, 0), right->num_keys * tree->node_key_size);
+			memmove(records + moving * tree->record_size, records, right->num_keys * tree->record_size);
+			COPY_KEYS(left, from, right, 0, moving);
+			COPY_RECORDS(left, from, right, 0, moving);
+			left->num_keys = from;
+			right->num_keys += moving;
+			make_separator(tree, separator, GET_KEY_AT(right, 0));
+		}
+	}
+	else
+	{
+		uint32_t *left_children = GET_CHILDREN(left);
+		uint32_t *right_children = GET_CHILDREN(right);
+
+		if (merge)
+		{
+			/* The separator comes down between the two halves */
+			uint32_t first = left->num_keys + 1;
+			COPY_SEPARATOR(GET_KEY_AT(left, left->num_keys), separator);
+			COPY_KEYS(right, 0, left, first, right->num_keys);
+			memcpy(&left_children[first], right_children, (right->num_keys + 1) * sizeof(uint32_t));
+			left->num_keys = combined + 1;
+			for (uint32_t i = first; i <= left->num_keys; i++)
+			{
+				set_child(tree, left, i, left_children[i]);
+			}
+		}
+		else
+		{
+			/* Rotate through the separator, the last child moved keeps it */
+			uint32_t moving = min_keys - right->num_keys;
+			uint32_t from = left->num_keys - moving;
+			memmove(GET_KEY_AT(right, moving), GET_KEY_AT(right, 0), right->num_keys * tree->separator_size);
+			memmove(&right_children[moving], right_children, (right->num_keys + 1) * sizeof(uint32_t));
+			COPY_KEYS(left, from + 1, right, 0, moving - 1);
+			COPY_SEPARATOR(GET_KEY_AT(right, moving - 1), separator);
+			COPY_SEPARATOR(separator, GET_KEY_AT(left, from));
+			memcpy(right_children, &left_children[from + 1], moving * sizeof(uint32_t));
+			left->num_keys = from;
+			right->num_keys += moving;
+			for (uint32_t i = 0; i < moving; i++)
+			{
+				set_child(tree, right, i, right_children[i]);
+			}
+		}
+	}
+
+	UNPIN(ancestor);
+	UNPIN(left);
+	UNPIN(right);
+
+	if (merge)
+	{
+		bulk_remove_last(loader, level);
+		pager_delete(right_index);
+	}
+}
+
+/*
+ * Start a bulk load into an empty tree. fill_percent is how full to pack each
+ * node, below 100 leaves room for later inserts to land without splitting
+ * straight away. It's kept at or above the minimum a node must hold.
+ */
+bool
+bt_bulk_begin(bt_bulk_loader *loader, btree *tree, uint32_t fill_percent)
 {
-	assert(IS_LEAF(node) && "B+tree deletion only occurs in leaf nodes where data is stored");
-
-	if (IS_ROOT(node) && node->num_keys == 1)
+	if (0 == tree->root_page_index || 0 == fill_percent || fill_percent > 100)
 	{
-		ENSURE_SAVED(node);
-		node->num_keys = 0;
-		return;
+		return false;
 	}
 
-	ENSURE_SAVED(node);
+	btree_node *root = GET_ROOT();
+	if (!IS_LEAF(root) || root->num_keys != 0)
+	{
+		return false;
+	}
 
-	// Remove the entry by shifting remaining entries left
-	uint32_t entries_to_shift = node->num_keys - index - 1;
-	SHIFT_KEYS_LEFT(node, index, entries_to_shift);
-	SHIFT_RECORDS_LEFT(node, index, entries_to_shift);
-	node->num_keys--;
+	uint32_t leaf_fill = tree->leaf_max_keys * fill_percent / 100;
+	uint32_t internal_fill = tree->internal_max_keys * fill_percent / 100;
+	uint32_t heap_fill = tree->variable_records ? (NODE_DATA_SIZE - heap_floor(tree)) * fill_percent / 100 : 0;
 
-	// Fix underflow if necessary
-	repair_underflow(tree, node);
+	loader->tree = tree;
+	loader->leaf_fill = std::max({leaf_fill, tree->leaf_min_keys, 1u});
+	loader->heap_fill = std::max(heap_fill, tree->record_size);
+	loader->internal_fill = std::max({internal_fill, tree->internal_min_keys, 1u});
+	loader->height = 1;
+	loader->open[0] = tree->root_page_index;
+	loader->previous[0] = 0;
+	loader->count = 0;
+	return true;
 }
+
 /*
- * Recursively delete all nodes in the tree.
+ * Append an entry, keys must be strictly ascending. Returns false, adding
+ * nothing, for a key that's out of order. A variable leaf is also finished
+ * once its records reach heap_fill bytes, its heap holding no gaps here.
  */
-void
-clear_recurse(btree *tree, btree_node *node)
+bool
+bt_bulk_append(bt_bulk_loader *loader, void *key, void *record, uint32_t size)
 {
-	if (IS_LEAF(node))
+	btree	   *tree = loader->tree;
+	btree_node *leaf = GET_NODE(loader->open[0]);
+	size = tree->variable_records ? size : tree->record_size;
+
+	if (leaf->num_keys > 0 && !type_less_than(tree->node_key_type, GET_KEY_AT(leaf, leaf->num_keys - 1), key))
 	{
-		pager_delete(node->index);
-		return;
+		return false;
 	}
 
-	uint32_t	i = 0;
-	btree_node *child = GET_CHILD(node, i);
-	while (child != nullptr)
+	bool heap_full = tree->variable_records && leaf->num_keys > 0 &&
+					 NODE_DATA_SIZE - HEAP_START(leaf) + size > loader->heap_fill;
+
+	if (leaf->num_keys == loader->leaf_fill || heap_full)
 	{
-		clear_recurse(tree, child);
-		child = GET_CHILD(node, ++i);
+		/*
+		 * The root page has to end up holding the top of the tree, so the
+		 * first leaf moves out of it once there is going to be a second
+		 */
+		if (leaf->index == tree->root_page_index)
+		{
+			btree_node *moved = create_node(tree, true, tree->root_page_index);
+			PIN(moved);
+			btree_node *root = GET_ROOT();
+			ENSURE_SAVED(root);
+			memcpy(moved->data, root->data, NODE_DATA_SIZE);
+			moved->num_keys = root->num_keys;
+			moved->heap_start = root->heap_start;
+			root->num_keys = 0;
+			root->heap_start = 0;
+			loader->open[0] = moved->index;
+			UNPIN(moved);
+		}
+
+		uint32_t	left_index = loader->open[0];
+		btree_node *left = GET_NODE(left_index);
+		PIN(left);
+		leaf = create_node(tree, true, left_index);
+		link_leaf_nodes(left, leaf);
+		UNPIN(left);
+
+		loader->previous[0] = left_index;
+		loader->open[0] = leaf->index;
+		uint8_t separator[256];
+		make_separator(tree, separator, key);
+		bulk_push_up(loader, 1, separator, left_index, leaf->index);
+		leaf = GET_NODE(loader->open[0]);
 	}
 
-	pager_delete(node->index);
+	ENSURE_SAVED(leaf);
+	COPY_KEY(GET_KEY_AT(leaf, leaf->num_keys), key);
+	put_record(tree, leaf, leaf->num_keys, leaf->num_keys + 1, record, size);
+	leaf->num_keys++;
+	loader->count++;
+	return true;
 }
 
 /*
- * Post order dfs calling pager_delete to wipe entire tree
+ * Finish a bulk load. The right edge is brought up to the minimum fill, a top
+ * left with a single child is dropped, and the top is swapped into the root
+ * page so the tree keeps the root it was created with.
  */
 bool
-bt_clear(btree *tree)
+bt_bulk_finish(bt_bulk_loader *loader)
 {
-	if (0 == tree->root_page_index)
+	btree *tree = loader->tree;
+
+	for (uint32_t level = 0; level + 1 < loader->height; level++)
 	{
-		// uninitialised table
-		return true;
+		bulk_fix_right_edge(loader, level);
+	}
+
+	uint32_t top_index = loader->open[loader->height - 1];
+	while (loader->height > 1)
+	{
+		btree_node *top = GET_NODE(top_index);
+		if (top->num_keys > 0)
+		{
+			break;
+		}
+		uint32_t only_child = GET_CHILDREN(top)[0];
+		pager_delete(top_index);
+		top_index = only_child;
+		loader->height--;
+	}
+
+	if (top_index != tree->root_page_index)
+	{
+		btree_node *top = GET_NODE(top_index);
+		PIN(top);
+		swap_with_root(tree, GET_ROOT(), top);
+		UNPIN(top);
+		pager_delete(top_index);
 	}
 
-	clear_recurse(tree, GET_NODE(tree->root_page_index));
 	return true;
 }
 
@@ -1077,32 +2321,66 @@ bt_clear(btree *tree)
  * in memory/disk that will be [u32 data, "markymark0000000"] such that there is wasted
  * space. A real database would have additional metadata in the header do pack and unpack rows
  * as tightly as possible.
+ *
+ * Which is what variable_records is for. Its leaves can't know how big their
+ * records will be, so the slot array is sized for records an eighth of the
+ * largest, a VARCHAR(255) table of short strings fitting ~100 rows in a leaf
+ * rather than 15. Larger records fill the heap before the slots run out.
  */
 btree
-bt_create(data_type key, uint32_t record_size, bool allocate_node = false)
+bt_create(data_type key, uint32_t record_size, bool allocate_node, bool compress_keys, bool variable_records)
 {
 	btree tree = {0};
 
 	tree.node_key_type = key;
 	tree.node_key_size = type_size(key);
+	tree.key_search = select_key_search(key);
+
+	// See make_separator
+	tree.separator_format = BT_SEPARATOR_KEY;
+	tree.separator_size = tree.node_key_size;
+	if (compress_keys && type_is_dual(key))
+	{
+		tree.separator_format = BT_SEPARATOR_NORMALIZED;
+	}
+	else if (compress_keys && type_is_string(key) && tree.node_key_size > BT_SEPARATOR_PREFIX_SIZE)
+	{
+		tree.separator_format = BT_SEPARATOR_PREFIX;
+		tree.separator_size = BT_SEPARATOR_PREFIX_SIZE;
+	}
 
 	tree.record_size = record_size;
+	tree.variable_records = variable_records;
 
 	constexpr uint32_t USABLE_SPACE = PAGE_SIZE - NODE_HEADER_SIZE;
 
-	assert(record_size * MIN_ENTRY_COUNT <= USABLE_SPACE && "Record to large, btree node must be able to fit at least "
-															"3 records for merge and split operations to function");
+	if (variable_records)
+	{
+		uint32_t expected = std::max(record_size / VARIABLE_EXPECTED_DIVISOR, (uint32_t)VARIABLE_MIN_EXPECTED);
+		uint32_t leaf_max_entries = USABLE_SPACE / (tree.node_key_size + sizeof(record_slot) + expected);
+
+		tree.leaf_max_keys = std::max(leaf_max_entries, (uint32_t)MIN_ENTRY_COUNT);
+		tree.leaf_min_keys = 1;
+		tree.leaf_split_index = tree.leaf_max_keys / 2;
+		tree.record_size = std::min(record_size, (USABLE_SPACE - heap_floor(&tree)) / MIN_ENTRY_COUNT);
+	}
+	else
+	{
+		assert(record_size * MIN_ENTRY_COUNT <= USABLE_SPACE &&
+			   "Record to large, btree node must be able to fit at least "
+			   "3 records for merge and split operations to function");
 
-	uint32_t leaf_entry_size = tree.node_key_size + record_size;
-	uint32_t leaf_max_entries = USABLE_SPACE / leaf_entry_size;
+		uint32_t leaf_entry_size = tree.node_key_size + record_size;
+		uint32_t leaf_max_entries = USABLE_SPACE / leaf_entry_size;
 
-	tree.leaf_max_keys = MIN_ENTRY_COUNT > leaf_max_entries ? MIN_ENTRY_COUNT : leaf_max_entries;
-	tree.leaf_min_keys = tree.leaf_max_keys / 2;
-	tree.leaf_split_index = tree.leaf_max_keys / 2;
+		tree.leaf_max_keys = MIN_ENTRY_COUNT > leaf_max_entries ? MIN_ENTRY_COUNT : leaf_max_entries;
+		tree.leaf_min_keys = tree.leaf_max_keys / 2;
+		tree.leaf_split_index = tree.leaf_max_keys / 2;
+	}
 
 	uint32_t child_ptr_size = sizeof(uint32_t);
 
-	uint32_t internal_max_entries = (USABLE_SPACE - child_ptr_size) / (tree.node_key_size + child_ptr_size);
+	uint32_t internal_max_entries = (USABLE_SPACE - child_ptr_size) / (tree.separator_size + child_ptr_size);
 
 	// in split, there is one rising key, we need to ensure an even split
 	if (internal_max_entries % 2 == 0)
@@ -1151,6 +2429,57 @@ cursor_clear(bt_cursor *cursor)
 	cursor->leaf_page = 0;
 	cursor->leaf_index = 0;
 	cursor->state = BT_CURSOR_INVALID;
+	cursor->sequential_leaves = 0;
+}
+
+/*
+ * Read-ahead for sequential leaf scans.
+ *
+ * Following the leaf chain to find the leaves ahead would read them one at a
+ * time, which is the latency we're trying to hide. Their parent lists them
+ * though, and internal nodes are nearly always cached, so once a cursor has
+ * crossed BT_READAHEAD_TRIGGER leaves in one direction, the parent's children
+ * ahead of it are hinted to the pager. The window is filled when the scan is
+ * detected or reaches a new parent, and slides by one leaf per crossing after.
+ */
+static void
+cursor_readahead(bt_cursor *cursor, uint32_t leaf_index, uint32_t parent_index, bool forward)
+{
+	if (cursor->scan_forward != forward)
+	{
+		cursor->scan_forward = forward;
+		cursor->sequential_leaves = 0;
+	}
+
+	cursor->sequential_leaves++;
+	if (cursor->sequential_leaves < BT_READAHEAD_TRIGGER || parent_index == 0)
+	{
+		return;
+	}
+
+	btree	   *tree = cursor->tree;
+	btree_node *parent = GET_NODE(parent_index);
+	uint32_t   *children = GET_CHILDREN(parent);
+	uint32_t	count = parent->num_keys + 1;
+
+	uint32_t position = 0;
+	while (position < count && children[position] != leaf_index)
+	{
+		position++;
+	}
+	assert(position < count && "Leaf not found in its parent");
+
+	bool	 first_child = forward ? position == 0 : position == count - 1;
+	uint32_t from = cursor->sequential_leaves == BT_READAHEAD_TRIGGER || first_child ? 1 : BT_READAHEAD_LEAVES;
+
+	for (uint32_t ahead = from; ahead <= BT_READAHEAD_LEAVES; ahead++)
+	{
+		if (forward ? position + ahead >= count : ahead > position)
+		{
+			break;
+		}
+		pager_prefetch(children[forward ? position + ahead : position - ahead]);
+	}
 }
 
 static bool
@@ -1296,7 +2625,7 @@ bt_cursor_key(bt_cursor *cursor)
 		return nullptr;
 	}
 
-	btree_node *node = GET_NODE(cursor->leaf_page);
+	btree_node *node = GET_SCAN_NODE(cursor->leaf_page);
 	if (!node || cursor->leaf_index >= node->num_keys)
 	{
 		return nullptr;
@@ -1315,21 +2644,41 @@ bt_cursor_record(bt_cursor *cursor)
 		return nullptr;
 	}
 
-	btree_node *node = GET_NODE(cursor->leaf_page);
+	btree_node *node = GET_SCAN_NODE(cursor->leaf_page);
 	if (!node || cursor->leaf_index >= node->num_keys)
 	{
 		return nullptr;
 	}
 
-	return GET_RECORD_AT(node, cursor->leaf_index);
+	return leaf_record(tree, node, cursor->leaf_index);
+}
+
+/* The size of the record bt_cursor_record returns, 0 if there isn't one */
+uint32_t
+bt_cursor_record_size(bt_cursor *cursor)
+{
+	btree *tree = cursor->tree;
+	if (cursor->state != BT_CURSOR_VALID)
+	{
+		return 0;
+	}
+
+	btree_node *node = GET_SCAN_NODE(cursor->leaf_page);
+	if (!node || cursor->leaf_index >= node->num_keys)
+	{
+		return 0;
+	}
+
+	return leaf_record_size(tree, node, cursor->leaf_index);
 }
 
 /*
  * Delete entry at current cursor position.
  *
- * After deletion, cursor moves to the previous entry in the node
- * if at the last position, or stays at the same index (which now
- * contains the next entry due to shifting).
+ * After deletion the cursor is on the entry that followed the deleted one,
+ * or invalid if it was the last, so a scan can delete as it goes without
+ * starting over. If the leaf underflows its entries may be moved into a
+ * sibling, then the successor is found by seeking past the deleted key.
  */
 bool
 bt_cursor_delete(bt_cursor *cursor)
@@ -1339,54 +2688,117 @@ bt_cursor_delete(bt_cursor *cursor)
 		return false;
 	}
 
-	void *key = bt_cursor_key(cursor);
+	btree *tree = cursor->tree;
+	void  *key = bt_cursor_key(cursor);
 	if (!key)
 	{
 		return false;
 	}
 
-	auto	 node = GET_NODE(cursor->leaf_page);
-	uint32_t index = node->index;
+	auto node = GET_NODE(cursor->leaf_page);
+	bool repairs = !IS_ROOT(node) && node->num_keys - 1 < tree->leaf_min_keys;
+
+	if (repairs)
+	{
+		uint8_t deleted_key[256];
+		memcpy(deleted_key, key, tree->node_key_size);
+
+		delete_element(tree, node, key, cursor->leaf_index);
+
+		if (!bt_cursor_seek(cursor, deleted_key, GT))
+		{
+			cursor->state = BT_CURSOR_INVALID;
+		}
+		return true;
+	}
 
-	delete_element(cursor->tree, node, key, cursor->leaf_index);
+	delete_element(tree, node, key, cursor->leaf_index);
 
 	node = GET_NODE(cursor->leaf_page);
-	if (!node)
+	if (cursor->leaf_index < node->num_keys)
 	{
 		return true;
 	}
 
-	if (cursor->leaf_index >= node->num_keys)
+	// The deleted entry was the last in its leaf, the successor starts the next
+	if (node->num_keys == 0)
 	{
-		if (node->num_keys > 0)
-		{
-			cursor->leaf_index = node->num_keys - 1;
-		}
-		else
-		{
-			cursor->state = BT_CURSOR_INVALID;
-		}
+		cursor->state = BT_CURSOR_INVALID;
+		return true;
 	}
 
+	cursor->leaf_index = node->num_keys - 1;
+	if (!bt_cursor_next(cursor))
+	{
+		cursor->state = BT_CURSOR_INVALID;
+	}
 	return true;
 }
 
+/*
+ * Whether key belongs in the leaf the cursor is on, and fits without a split.
+ * A key between the leaf's first and last belongs there, as does one past
+ * either end when there's no leaf beyond it on that side.
+ */
+static bool
+cursor_leaf_holds(bt_cursor *cursor, void *key, uint32_t size)
+{
+	if (cursor->state != BT_CURSOR_VALID)
+	{
+		return false;
+	}
+
+	btree	   *tree = cursor->tree;
+	btree_node *leaf = GET_NODE(cursor->leaf_page);
+	if (!leaf || !IS_LEAF(leaf) || leaf->num_keys == 0 || !leaf_has_room(tree, leaf, size))
+	{
+		return false;
+	}
+
+	data_type type = tree->node_key_type;
+	bool	  after_first = !leaf->previous || type_greater_than(type, key, GET_KEY_AT(leaf, 0));
+	bool	  before_last = !leaf->next || type_less_than(type, key, GET_KEY_AT(leaf, leaf->num_keys - 1));
+	return after_first && before_last;
+}
+
 /*
  * Insert a new key-record pair.
  *
- * Returns false if key already exists (no duplicates allowed).
- * Cursor position becomes undefined after insertion.
+ * Returns false if key already exists (no duplicates allowed). The cursor is
+ * left on the new entry, and when the next key inserted through it lands in
+ * the same leaf, it goes straight in without a search from the root.
  */
 bool
-bt_cursor_insert(bt_cursor *cursor, void *key, void *record)
+bt_cursor_insert(bt_cursor *cursor, void *key, void *record, uint32_t size)
 {
+	btree *tree = cursor->tree;
+	size = tree->variable_records ? size : tree->record_size;
+	assert(size <= tree->record_size && "Record larger than the tree's record_size");
+
+	if (cursor_leaf_holds(cursor, key, size))
+	{
+		btree_node *leaf = GET_NODE(cursor->leaf_page);
+		uint32_t	pos = binary_search(tree, leaf, key);
+		if (pos < leaf->num_keys && type_equals(tree->node_key_type, GET_KEY_AT(leaf, pos), key))
+		{
+			return false;
+		}
+
+		insert_in_leaf(tree, leaf, pos, key, record, size);
+		cursor->leaf_index = pos;
+		return true;
+	}
 
 	if (bt_cursor_seek(cursor, key))
 	{
 		return false;
 	}
 
-	insert_element(cursor->tree, key, record);
+	uint32_t	pos;
+	btree_node *leaf = insert_element(tree, key, record, size, &pos);
+	cursor->leaf_page = leaf->index;
+	cursor->leaf_index = pos;
+	cursor->state = BT_CURSOR_VALID;
 	return true;
 }
 
@@ -1395,18 +2807,56 @@ bt_cursor_insert(bt_cursor *cursor, void *key, void *record)
  *
  * Only modifies the record data, not the key. The cursor
  * position remains valid after update.
+ *
+ * A variable record no bigger than the one it replaces is written over it,
+ * a bigger one goes into the heap if the leaf has room, otherwise the entry
+ * is deleted and inserted again, leaving the cursor on it wherever it lands.
  */
 bool
-bt_cursor_update(bt_cursor *cursor, void *record)
+bt_cursor_update(bt_cursor *cursor, void *record, uint32_t size)
 {
 	if (cursor->state != BT_CURSOR_VALID)
 	{
 		return false;
 	}
-	pager_ensure_journaled(cursor->leaf_page);
-	void *data = bt_cursor_record(cursor);
-	memcpy(data, record, cursor->tree->record_size);
-	return true;
+
+	btree *tree = cursor->tree;
+	if (!tree->variable_records)
+	{
+		pager_ensure_journaled(cursor->leaf_page);
+		void *data = bt_cursor_record(cursor);
+		memcpy(data, record, cursor->tree->record_size);
+		return true;
+	}
+
+	assert(size <= tree->record_size && "Record larger than the tree's record_size");
+	btree_node	*node = GET_NODE(cursor->leaf_page);
+	uint32_t	 index = cursor->leaf_index;
+	record_slot *slot = &GET_SLOTS(node)[index];
+	ENSURE_SAVED(node);
+
+	if (size <= slot->size)
+	{
+		memmove(node->data + slot->offset, record, size);
+		slot->size = (uint16_t)size;
+		return true;
+	}
+
+	// The record can be in this leaf, and compacting would move it
+	uint8_t copy[NODE_DATA_SIZE];
+	memcpy(copy, record, size);
+
+	if (heap_fits(tree, node, node->num_keys, index, size))
+	{
+		put_record(tree, node, index, node->num_keys, copy, size);
+		return true;
+	}
+
+	uint8_t key[256];
+	memcpy(key, GET_KEY_AT(node, index), tree->node_key_size);
+	bt_cursor_delete(cursor);
+	cursor->state = BT_CURSOR_INVALID;
+	return bt_cursor_insert(cursor, key, copy, size);
 }
 
 /*
@@ -1438,7 +2888,7 @@ bt_cursor_next(bt_cursor *cursor)
 		return false;
 	}
 
-	btree_node *node = GET_NODE(cursor->leaf_page);
+	btree_node *node = GET_SCAN_NODE(cursor->leaf_page);
 	if (!node)
 	{
 		cursor->state = BT_CURSOR_INVALID;
@@ -1451,11 +2901,12 @@ bt_cursor_next(bt_cursor *cursor)
 	{
 		if (node->next != 0)
 		{
-			btree_node *next_node = GET_NEXT(node);
+			btree_node *next_node = GET_SCAN_NODE(node->next);
 			if (next_node && next_node->num_keys > 0)
 			{
 				cursor->leaf_page = next_node->index;
 				cursor->leaf_index = 0;
+				cursor_readahead(cursor, next_node->index, next_node->parent, true);
 				return true;
 			}
 		}
@@ -1465,6 +2916,87 @@ bt_cursor_next(bt_cursor *cursor)
 	return true;
 }
 
+/*
+ * Move forward to the first entry that match accepts, testing the current
+ * entry first if from_current is set. The leaf's keys and records are handed
+ * to match where they lie, so rejected entries cost a call rather than a
+ * cursor step. The cursor is left invalid if no entry matches, or match
+ * ends the scan early.
+ */
+bool
+bt_cursor_scan(bt_cursor *cursor, bt_match match, void *context, bool from_current)
+{
+	if (cursor->state != BT_CURSOR_VALID)
+	{
+		return false;
+	}
+
+	btree	*tree = cursor->tree;
+	uint32_t page = cursor->leaf_page;
+	uint32_t index = cursor->leaf_index + (from_current ? 0 : 1);
+
+	while (page != 0)
+	{
+		btree_node *node = GET_SCAN_NODE(page);
+		if (!node)
+		{
+			break;
+		}
+
+		// Matching a variable record can read its overflow blobs, and with them evict the leaf
+		if (tree->variable_records)
+		{
+			node = (btree_node *)pager_pin(page);
+		}
+
+		const uint8_t *key = GET_KEY_AT(node, index);
+		const uint8_t *record = GET_RECORD_AT(node, index);
+		BT_MATCH_RESULT result = BT_MATCH_SKIP;
+		for (; index < node->num_keys; index++)
+		{
+			if (tree->variable_records)
+			{
+				record = leaf_record(tree, node, index);
+			}
+
+			result = match(context, key, record);
+			if (result != BT_MATCH_SKIP)
+			{
+				break;
+			}
+			key += tree->node_key_size;
+			record += tree->record_size;
+		}
+
+		if (tree->variable_records)
+		{
+			pager_unpin(page);
+		}
+		if (result == BT_MATCH_FOUND)
+		{
+			cursor->leaf_page = page;
+			cursor->leaf_index = index;
+			return true;
+		}
+		if (result == BT_MATCH_STOP)
+		{
+			cursor->state = BT_CURSOR_INVALID;
+			return false;
+		}
+
+		page = node->next;
+		index = 0;
+		if (page != 0)
+		{
+			btree_node *next_node = GET_SCAN_NODE(page);
+			cursor_readahead(cursor, page, next_node->parent, true);
+		}
+	}
+
+	cursor->state = BT_CURSOR_INVALID;
+	return false;
+}
+
 /*
  * Move cursor to previous entry.
  */
@@ -1476,7 +3008,7 @@ bt_cursor_previous(bt_cursor *cursor)
 		return false;
 	}
 
-	btree_node *node = GET_NODE(cursor->leaf_page);
+	btree_node *node = GET_SCAN_NODE(cursor->leaf_page);
 	if (!node)
 	{
 		cursor->state = BT_CURSOR_INVALID;
@@ -1491,11 +3023,12 @@ bt_cursor_previous(bt_cursor *cursor)
 
 	if (node->previous != 0)
 	{
-		btree_node *prev_node = GET_PREV(node);
+		btree_node *prev_node = GET_SCAN_NODE(node->previous);
 		if (prev_node && prev_node->num_keys > 0)
 		{
 			cursor->leaf_page = prev_node->index;
 			cursor->leaf_index = prev_node->num_keys - 1;
+			cursor_readahead(cursor, prev_node->index, prev_node->parent, false);
 			return true;
 		}
 	}
@@ -1603,7 +3136,30 @@ bt_validate(btree *tree)
 			}
 		}
 	}
+
+	for (auto [page_index, _] : visited)
+	{
+		pager_unpin(page_index);
+	}
+}
+/* Compare a key from a leaf, or a separator from an internal node, with a separator */
+static int
+compare_with_separator(btree *tree, bool is_leaf, void *key, void *separator)
+{
+	if (tree->separator_format == BT_SEPARATOR_KEY)
+	{
+		return type_compare(tree->node_key_type, key, separator);
+	}
+
+	uint8_t normalized[256];
+	if (is_leaf)
+	{
+		make_separator(tree, normalized, key);
+		key = normalized;
+	}
+	return memcmp(key, separator, tree->separator_size);
 }
+
 static validation_result
 validate_node_recursive(btree *tree, btree_node *node, uint32_t expected_parent, void *parent_min_bound,
 						void *parent_max_bound, hash_set<uint32_t> &visited)
@@ -1613,6 +3169,9 @@ validate_node_recursive(btree *tree, btree_node *node, uint32_t expected_parent,
 	ASSERT_PRINT(!visited.contains(node->index), tree);
 	visited.insert(node->index, 1);
 
+	// Results hold pointers into child nodes, so every node stays pinned until bt_validate returns
+	PIN(node);
+
 	ASSERT_PRINT(node->parent == expected_parent, tree);
 
 	uint32_t max_keys = GET_MAX_KEYS(node);
@@ -1620,10 +3179,15 @@ validate_node_recursive(btree *tree, btree_node *node, uint32_t expected_parent,
 
 	ASSERT_PRINT(node->num_keys <= max_keys, tree);
 
-	if (expected_parent != 0)
+	if (expected_parent != 0 && parent_max_bound)
 	{
 		ASSERT_PRINT(node->num_keys >= min_keys, tree);
 	}
+	else if (expected_parent != 0)
+	{
+		// The right spine has no upper bound, appends leave it below the minimum, see split
+		ASSERT_PRINT(node->num_keys >= 1, tree);
+	}
 	else
 	{
 
@@ -1637,6 +3201,9 @@ validate_node_recursive(btree *tree, btree_node *node, uint32_t expected_parent,
 	void *first_key = nullptr;
 	void *last_key = nullptr;
 
+	// Keys sharing a prefix can fall either side of a prefix separator, see make_separator
+	bool prefix_separators = tree->separator_format == BT_SEPARATOR_PREFIX;
+
 	for (uint32_t i = 0; i < node->num_keys; i++)
 	{
 		void *current_key = GET_KEY_AT(node, i);
@@ -1650,18 +3217,24 @@ validate_node_recursive(btree *tree, btree_node *node, uint32_t expected_parent,
 			last_key = current_key;
 		}
 
-		if (prev_key)
+		if (prev_key && IS_LEAF(node))
 		{
 			ASSERT_PRINT(type_less_than(tree->node_key_type, prev_key, current_key), tree);
 		}
+		else if (prev_key)
+		{
+			int order = compare_with_separator(tree, false, prev_key, current_key);
+			ASSERT_PRINT(order < 0 || (order == 0 && prefix_separators), tree);
+		}
 
 		if (parent_min_bound)
 		{
-			ASSERT_PRINT(type_greater_equal(tree->node_key_type, current_key, parent_min_bound), tree);
+			ASSERT_PRINT(compare_with_separator(tree, IS_LEAF(node), current_key, parent_min_bound) >= 0, tree);
 		}
 		if (parent_max_bound)
 		{
-			ASSERT_PRINT(type_less_than(tree->node_key_type, current_key, parent_max_bound), tree);
+			int order = compare_with_separator(tree, IS_LEAF(node), current_key, parent_max_bound);
+			ASSERT_PRINT(order < 0 || (order == 0 && prefix_separators), tree);
 		}
 		prev_key = current_key;
 	}
@@ -1679,6 +3252,22 @@ validate_node_recursive(btree *tree, btree_node *node, uint32_t expected_parent,
 		void *records = GET_RECORD_DATA(node);
 		ASSERT_PRINT(records != nullptr, tree);
 
+		// Every slot inside the heap, and its records no more than it holds
+		if (tree->variable_records)
+		{
+			record_slot *slots = GET_SLOTS(node);
+			uint32_t	 live = 0;
+			for (uint32_t i = 0; i < node->num_keys; i++)
+			{
+				ASSERT_PRINT(slots[i].offset >= HEAP_START(node), tree);
+				ASSERT_PRINT(slots[i].offset + slots[i].size <= NODE_DATA_SIZE, tree);
+				ASSERT_PRINT(slots[i].size <= tree->record_size, tree);
+				live += slots[i].size;
+			}
+			ASSERT_PRINT(HEAP_START(node) >= heap_floor(tree), tree);
+			ASSERT_PRINT(live <= NODE_DATA_SIZE - HEAP_START(node), tree);
+		}
+
 		if (node->next != 0)
 		{
 			ASSERT_PRINT(node->next != node->index, tree);
@@ -1734,13 +3323,15 @@ validate_node_recursive(btree *tree, btree_node *node, uint32_t expected_parent,
 			{
 
 				void *separator = GET_KEY_AT(node, i - 1);
-				ASSERT_PRINT(type_greater_equal(tree->node_key_type, child_result.min_key, separator), tree);
+				ASSERT_PRINT(compare_with_separator(tree, child_result.depth == 0, child_result.min_key, separator) >= 0,
+							 tree);
 			}
 			if (child_result.max_key && i < node->num_keys)
 			{
 
 				void *separator = GET_KEY_AT(node, i);
-				ASSERT_PRINT(type_less_equal(tree->node_key_type, child_result.max_key, separator), tree);
+				ASSERT_PRINT(compare_with_separator(tree, child_result.depth == 0, child_result.max_key, separator) <= 0,
+							 tree);
 			}
 		}
 
@@ -1755,13 +3346,26 @@ validate_node_recursive(btree *tree, btree_node *node, uint32_t expected_parent,
 	return result;
 }
 static void
-print_key(btree *tree, void *key)
+print_key(btree *tree, void *key, bool separator = false)
 {
 	if (!key)
 	{
 		printf("NULL");
 		return;
 	}
+	if (separator && tree->separator_format == BT_SEPARATOR_PREFIX)
+	{
+		printf("%.*s", (int)strnlen((char *)key, tree->separator_size), (char *)key);
+		return;
+	}
+	if (separator && tree->separator_format == BT_SEPARATOR_NORMALIZED)
+	{
+		for (uint32_t i = 0; i < tree->separator_size; i++)
+		{
+			printf("%02x", ((uint8_t *)key)[i]);
+		}
+		return;
+	}
 	// Use columns[0] type if schema provided, otherwise use tree's key type
 	data_type key_type =
 
@@ -1843,12 +3447,21 @@ bt_print(btree *tree, array<data_type, query_arena> *columns)
 			{
 				if (i > 0)
 					printf(", ");
-				print_key(tree, GET_KEY_AT(node, i));
+				print_key(tree, GET_KEY_AT(node, i), IS_INTERNAL(node));
 			}
 			printf("]\n");
 
 			// For leaf nodes with schema, show records
-			if (IS_LEAF(node) && tree->record_size > 0 && columns && columns->size() > 1)
+			if (IS_LEAF(node) && tree->variable_records)
+			{
+				printf("    Record bytes: [");
+				for (uint32_t i = 0; i < node->num_keys; i++)
+				{
+					printf(i > 0 ? ", %u" : "%u", leaf_record_size(tree, node, i));
+				}
+				printf("]\n");
+			}
+			else if (IS_LEAF(node) && tree->record_size > 0 && columns && columns->size() > 1)
 			{
 				printf("    Records:\n");
 				for (uint32_t i = 0; i < node->num_keys; i++)
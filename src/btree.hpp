@@ -11,6 +11,28 @@
 #include "types.hpp"
 #include <cstdint>
 
+struct btree;
+
+/*
+ * Counts the keys in a node's key array that sort before key, see
+ * select_key_search
+ */
+typedef uint32_t (*bt_key_search)(btree *tree, const uint8_t *keys, uint32_t count, const void *key,
+								  bool after_equal);
+
+/*
+ * How internal nodes store the keys that separate their children, picked by
+ * bt_create from the key type, see make_separator
+ */
+enum BT_SEPARATOR_FORMAT : uint8_t
+{
+	BT_SEPARATOR_KEY = 0,		 /* A copy of the key */
+	BT_SEPARATOR_NORMALIZED = 1, /* Dual keys, encoded to compare with memcmp */
+	BT_SEPARATOR_PREFIX = 2,	 /* String keys, cut to BT_SEPARATOR_PREFIX_SIZE */
+};
+
+#define BT_SEPARATOR_PREFIX_SIZE 16
+
 struct btree
 {
 	uint32_t root_page_index; /* Root node location */
@@ -26,15 +48,66 @@ struct btree
 	uint32_t leaf_split_index;	   /* Where to split leaf nodes */
 
 	/* Data configuration */
-	uint32_t  record_size;	 /* Size of value/record */
+	uint32_t  record_size;		/* Size of value/record, the largest for variable records */
+	bool	  variable_records; /* Leaves hold records of any size up to record_size */
 	uint32_t  node_key_size; /* Size of key */
 	data_type node_key_type; /* Key data type */
+
+	bt_key_search key_search; /* In-node search for the key type */
+
+	/* Internal node keys */
+	BT_SEPARATOR_FORMAT separator_format;
+	uint32_t			separator_size;
 };
 
+/*
+ * With variable_records, record_size is the largest record the caller will
+ * store, and leaves keep each record in only the space it needs, see the
+ * variable leaf layout below. A record is no bigger than a third of a leaf,
+ * so the tree's record_size can come out smaller than asked for.
+ */
 btree
-bt_create(data_type key, uint32_t record_size, bool allocate_node);
+bt_create(data_type key, uint32_t record_size, bool allocate_node, bool compress_keys = true,
+		  bool variable_records = false);
 bool
 bt_clear(btree *tree);
+bool
+bt_truncate(btree *tree);
+uint32_t
+bt_vacuum(btree **trees, uint32_t tree_count, uint32_t max_moves = 0);
+
+/*
+ * Up to max_points keys, ascending, into keys, that cut the tree into ranges
+ * of roughly equal size. Returns how many, 0 for a tree too small to cut.
+ */
+uint32_t
+bt_split_points(btree *tree, uint32_t max_points, uint8_t *keys);
+
+/*
+ * Builds a tree from entries given in ascending key order, packing the
+ * leaves and building the levels above as it goes, see bt_bulk_begin.
+ */
+#define BT_BULK_MAX_HEIGHT 32
+
+struct bt_bulk_loader
+{
+	btree	*tree;
+	uint32_t leaf_fill;		/* Keys per leaf before the next is started */
+	uint32_t heap_fill;		/* Record bytes per leaf before the next, variable records */
+	uint32_t internal_fill; /* Keys per internal node before the next is started */
+	uint32_t height;		/* Levels built so far, leaves are level 0 */
+
+	uint32_t open[BT_BULK_MAX_HEIGHT];	   /* Rightmost node of each level */
+	uint32_t previous[BT_BULK_MAX_HEIGHT]; /* Its left neighbour, 0 if none */
+	uint64_t count;						   /* Entries appended */
+};
+
+bool
+bt_bulk_begin(bt_bulk_loader *loader, btree *tree, uint32_t fill_percent = 100);
+bool
+bt_bulk_append(bt_bulk_loader *loader, void *key, void *record, uint32_t size = 0);
+bool
+bt_bulk_finish(bt_bulk_loader *loader);
 
 enum BT_CURSOR_STATE : uint8_t
 {
@@ -48,10 +121,51 @@ struct bt_cursor
 	uint32_t		leaf_page;	/* Current leaf page */
 	uint32_t		leaf_index; /* Position in leaf */
 	BT_CURSOR_STATE state;		/* Cursor validity */
+
+	/* Sequential scan detection, for read-ahead */
+	bool	 scan_forward;		/* Direction of the last leaf crossed */
+	uint32_t sequential_leaves; /* Leaves crossed in that direction */
 };
+
+/*
+ * Tests an entry in place for bt_cursor_scan
+ */
+enum BT_MATCH_RESULT : uint8_t
+{
+	BT_MATCH_SKIP = 0,
+	BT_MATCH_FOUND = 1,
+	BT_MATCH_STOP = 2, /* No later entry can match either */
+};
+
+typedef BT_MATCH_RESULT (*bt_match)(void *context, const uint8_t *key, const uint8_t *record);
+
+/*
+ * What bt_sample found. The page counts are the tree's, the entries only
+ * those of the sampled leaves.
+ */
+struct bt_sample_info
+{
+	uint32_t height; /* Levels, 1 for a tree that's only its root */
+	uint32_t internal_pages;
+	uint32_t leaf_pages;
+	uint32_t sampled_leaves;
+	uint64_t sampled_entries;
+};
+
+/*
+ * Visits every entry of up to max_leaves leaves spread evenly across the
+ * tree, or of every leaf when there are no more than that, to estimate what
+ * the tree holds without reading all of it, see stats.hpp. The visit's
+ * result is ignored.
+ */
+bool
+bt_sample(btree *tree, uint32_t max_leaves, bt_match visit, void *context, bt_sample_info *info);
+
 bool
 bt_cursor_seek(bt_cursor *cursor, void *key, COMPARISON_OP op = EQ);
 bool
+bt_cursor_scan(bt_cursor *cursor, bt_match match, void *context, bool from_current = false);
+bool
 bt_cursor_previous(bt_cursor *cursor);
 bool
 bt_cursor_next(bt_cursor *cursor);
@@ -59,16 +173,22 @@ bool
 bt_cursor_last(bt_cursor *cursor);
 bool
 bt_cursor_first(bt_cursor *cursor);
+/*
+ * Writes take the record's size for a tree with variable records, 0 or any
+ * size for another being its record_size
+ */
 bool
-bt_cursor_update(bt_cursor *cursor, void *record);
+bt_cursor_update(bt_cursor *cursor, void *record, uint32_t size = 0);
 bool
-bt_cursor_insert(bt_cursor *cursor, void *key, void *record);
+bt_cursor_insert(bt_cursor *cursor, void *key, void *record, uint32_t size = 0);
 bool
 bt_cursor_delete(bt_cursor *cursor);
 void *
 bt_cursor_key(bt_cursor *cursor);
 void *
 bt_cursor_record(bt_cursor *cursor);
+uint32_t
+bt_cursor_record_size(bt_cursor *cursor);
 bool
 bt_cursoris_valid(bt_cursor *cursor);
 bool
@@ -253,4 +373,32 @@ Final state:
 ────────────
 Keys:    [10] [20] [30] [××]  (last entry ignored)
 Records: [A]  [B]  [C]  [××]  (last entry ignored)
+
+
+
+6. VARIABLE LEAF MEMORY LAYOUT (variable_records)
+
+
+The records area holds a 4 byte slot per key, {offset, size}, and the
+records themselves go in a heap growing down from the end of the node:
+
+┌────────────────────────────────────────────────────────────────────────┐
+│ Header │ key[0] key[1] key[2] │ slot[0] slot[1] slot[2] │ free │ heap    │
+└────────────────────────────────────────────────────────────────────────┘
+															   ↑
+															   heap_start
+
+Heap:    [rec2][rec1][rec0]     up to data + NODE_DATA_SIZE
+Slots:   slot[i] = {offset of rec i from data, size of rec i}
+
+Shifts move the slots, so the records stay put, and a delete leaves a gap:
+
+Insert rec3 at 1:  slots [0] [3] [1] [2], rec3 written below heap_start
+Delete at 2:       slots [0] [3] [2], rec1's bytes are a gap
+
+When a record doesn't fit between the slots and heap_start, the live records
+are packed against the end again, and the gaps are reclaimed:
+
+BEFORE: [free      ][rec3][rec2][gap ][rec0]
+AFTER:  [free            ][rec3][rec2][rec0]
  */
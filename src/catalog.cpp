@@ -8,15 +8,63 @@
 #include "arena.hpp"
 #include "common.hpp"
 #include "arena.hpp"
+#include "blob.hpp"
 #include "pager.hpp"
 #include "semantic.hpp"
+#include "stats.hpp"
 #include "types.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstring>
+#include <mutex>
+#include <shared_mutex>
 #include <string_view>
 #include "compile.hpp"
 
 hash_map<fixed_string<RELATION_NAME_MAX_SIZE>, relation, catalog_arena> catalog;
+uint32_t catalog_version = 0;
+
+static std::shared_mutex catalog_latch;
+static thread_local bool catalog_exclusive; // This thread holds it exclusive
+
+
+void
+catalog_lock_shared()
+{
+	assert(!catalog_exclusive && "The writer reads the catalog it holds");
+	catalog_latch.lock_shared();
+}
+
+void
+catalog_unlock_shared()
+{
+	catalog_latch.unlock_shared();
+}
+
+void
+catalog_lock_exclusive()
+{
+	if (!catalog_exclusive)
+	{
+		catalog_latch.lock();
+		catalog_exclusive = true;
+	}
+}
+
+/*
+ * Called once the transaction has ended, a rollback having undone the log
+ */
+void
+catalog_unlock_exclusive()
+{
+	catalog_commit();
+	if (catalog_exclusive)
+	{
+		catalog_exclusive = false;
+		catalog_latch.unlock();
+	}
+}
 
 /*
  * Creates a format descriptor for tuples with the given column types.
@@ -61,9 +109,285 @@ tuple_format_from_relation(relation &schema)
 		column_types.push(col.type);
 	}
 
+	tuple_format format = tuple_format_from_types(column_types);
+
+	bool	 packed = false;
+	uint32_t packed_size = 0;
+	for (uint32_t i = 1; i < column_types.size(); i++)
+	{
+		bool is_varchar = type_id(column_types[i]) == TYPE_ID_VARCHAR;
+		packed |= is_varchar;
+		packed_size += type_size(column_types[i]) + (is_varchar ? sizeof(uint16_t) : 0);
+	}
+	format.packed_size = packed ? packed_size : 0;
+
+	return format;
+}
+
+/*
+ * Packed records
+ */
+
+static bool
+is_varchar_column(tuple_format &layout, uint32_t col)
+{
+	return type_id(layout.columns[col]) == TYPE_ID_VARCHAR;
+}
+
+uint32_t
+record_pack(tuple_format &layout, const uint8_t *image, uint8_t *out, uint32_t max_size)
+{
+	uint32_t column_count = layout.columns.size();
+	uint32_t lengths[column_count];
+	bool	 overflows[column_count];
+	uint32_t size = 0;
+
+	for (uint32_t col = 1; col < column_count; col++)
+	{
+		const uint8_t *value = image + layout.offsets[col - 1];
+		uint32_t	   value_size = type_size(layout.columns[col]);
+		overflows[col] = false;
+		if (is_varchar_column(layout, col))
+		{
+			lengths[col] = strnlen((const char *)value, value_size);
+			size += sizeof(uint16_t) + lengths[col];
+		}
+		else
+		{
+			lengths[col] = value_size;
+			size += value_size;
+		}
+	}
+
+	// The longest values go first, each leaving a page number in its place
+	while (size > max_size)
+	{
+		uint32_t longest = 0;
+		for (uint32_t col = 1; col < column_count; col++)
+		{
+			if (is_varchar_column(layout, col) && !overflows[col] && lengths[col] > sizeof(uint32_t) &&
+				(!longest || lengths[col] > lengths[longest]))
+			{
+				longest = col;
+			}
+		}
+		if (!longest)
+		{
+			return 0;
+		}
+		overflows[longest] = true;
+		size -= lengths[longest] - sizeof(uint32_t);
+	}
+
+	uint8_t *at = out;
+	for (uint32_t col = 1; col < column_count; col++)
+	{
+		const uint8_t *value = image + layout.offsets[col - 1];
+		if (!is_varchar_column(layout, col))
+		{
+			memcpy(at, value, lengths[col]);
+			at += lengths[col];
+			continue;
+		}
+
+		uint16_t length = overflows[col] ? RECORD_OVERFLOW : lengths[col];
+		memcpy(at, &length, sizeof(length));
+		at += sizeof(length);
+		if (overflows[col])
+		{
+			uint32_t first_page = blob_create((void *)value, lengths[col], true);
+			memcpy(at, &first_page, sizeof(first_page));
+			at += sizeof(first_page);
+		}
+		else
+		{
+			memcpy(at, value, length);
+			at += length;
+		}
+	}
+
+	return at - out;
+}
+
+/* The bytes a packed record takes, walking its lengths */
+static uint32_t
+packed_record_size(tuple_format &layout, const uint8_t *packed)
+{
+	const uint8_t *at = packed;
+	for (uint32_t col = 1; col < layout.columns.size(); col++)
+	{
+		if (!is_varchar_column(layout, col))
+		{
+			at += type_size(layout.columns[col]);
+			continue;
+		}
+
+		uint16_t length;
+		memcpy(&length, at, sizeof(length));
+		at += sizeof(length) + (length == RECORD_OVERFLOW ? sizeof(uint32_t) : length);
+	}
+	return at - packed;
+}
+
+/*
+ * Reading an overflowed value loads its blob's pages, which can evict the
+ * leaf the packed record lies in, so both of these work from a copy.
+ */
+
+void
+record_unpack(tuple_format &layout, const uint8_t *packed, uint8_t *image)
+{
+	memset(image, 0, layout.record_size);
+
+	uint32_t size = packed_record_size(layout, packed);
+	uint8_t	 copy[size];
+	memcpy(copy, packed, size);
+
+	const uint8_t *at = copy;
+	for (uint32_t col = 1; col < layout.columns.size(); col++)
+	{
+		uint8_t *value = image + layout.offsets[col - 1];
+		if (!is_varchar_column(layout, col))
+		{
+			uint32_t value_size = type_size(layout.columns[col]);
+			memcpy(value, at, value_size);
+			at += value_size;
+			continue;
+		}
+
+		uint16_t length;
+		memcpy(&length, at, sizeof(length));
+		at += sizeof(length);
+		if (length != RECORD_OVERFLOW)
+		{
+			memcpy(value, at, length);
+			at += length;
+			continue;
+		}
+
+		uint32_t first_page;
+		memcpy(&first_page, at, sizeof(first_page));
+		at += sizeof(first_page);
+
+		size_t	 blob_size;
+		uint8_t *bytes = blob_read_full(first_page, &blob_size);
+		if (bytes)
+		{
+			memcpy(value, bytes, std::min<size_t>(blob_size, type_size(layout.columns[col])));
+		}
+	}
+}
+
+void
+record_release(tuple_format &layout, const uint8_t *packed)
+{
+	uint32_t size = packed_record_size(layout, packed);
+	uint8_t	 copy[size];
+	memcpy(copy, packed, size);
+
+	const uint8_t *at = copy;
+	for (uint32_t col = 1; col < layout.columns.size(); col++)
+	{
+		if (!is_varchar_column(layout, col))
+		{
+			at += type_size(layout.columns[col]);
+			continue;
+		}
+
+		uint16_t length;
+		memcpy(&length, at, sizeof(length));
+		at += sizeof(length);
+		if (length != RECORD_OVERFLOW)
+		{
+			at += length;
+			continue;
+		}
+
+		uint32_t first_page;
+		memcpy(&first_page, at, sizeof(first_page));
+		at += sizeof(first_page);
+		blob_delete(first_page);
+	}
+}
+
+/*
+ * The layout of an index entry, the dual key as column 0 and the covered
+ * column, if any, as the record.
+ */
+tuple_format
+tuple_format_from_index(relation &schema, secondary_index &index)
+{
+	array<data_type, query_arena> column_types;
+
+	data_type leading = schema.columns[index.columns[0]].type;
+	column_types.push(make_dual(leading, schema.columns[0].type));
+
+	for (uint32_t i = 1; i < index.column_count; i++)
+	{
+		column_types.push(schema.columns[index.columns[i]].type);
+	}
+
 	return tuple_format_from_types(column_types);
 }
 
+/*
+ * An index entry for a table row, see secondary_index
+ */
+void
+build_index_entry(secondary_index &index, tuple_format &layout, uint8_t *key, uint8_t *record, uint8_t *entry_key,
+				  uint8_t *entry_record)
+{
+	auto column = [&](uint32_t col) { return col == 0 ? key : record + layout.offsets[col - 1]; };
+
+	uint32_t leading = index.columns[0];
+	pack_dual(entry_key, layout.columns[leading], column(leading), layout.key_type, key);
+
+	if (index.column_count > 1)
+	{
+		uint32_t covered = index.columns[1];
+		memcpy(entry_record, column(covered), type_size(layout.columns[covered]));
+	}
+}
+
+/*
+ * A table's sql is cleared with a release once its schema is filled in, so a
+ * thread whose acquire finds it cleared sees the columns and btrees too. Set
+ * only while no session can read the catalog.
+ */
+static bool
+schema_pending(relation *table)
+{
+	return std::atomic_ref<const char *>(table->sql).load(std::memory_order_acquire) != nullptr;
+}
+
+/*
+ * Index names share one namespace across tables
+ */
+secondary_index *
+find_index(string_view name, relation **table)
+{
+	for (auto [table_name, rel] : catalog)
+	{
+		for (auto &index : rel.indexes)
+		{
+			if (name.compare(index.name) == 0)
+			{
+				if (schema_pending(&rel))
+				{
+					catalog_get(rel.name);
+				}
+				if (table)
+				{
+					*table = &rel;
+				}
+				return &index;
+			}
+		}
+	}
+
+	return nullptr;
+}
+
 relation
 create_relation(string_view name, array<attribute, query_arena> columns)
 {
@@ -115,79 +439,742 @@ bootstrap_master(bool is_new_database)
 }
 
 /*
- * The output of the from the SELECT * FROM master_catalog is inserted into the
- * catalog
+ * Loading
+ */
+
+static std::mutex catalog_load_latch;
+
+static const char *
+copy_sql(const char *sql, size_t max_size)
+{
+	size_t length = strnlen(sql, max_size);
+	char  *copy = (char *)arena<catalog_arena>::alloc(length + 1);
+	memcpy(copy, sql, length);
+	copy[length] = '\0';
+	return copy;
+}
+
+static void
+open_table_btree(relation *table, uint32_t root_page)
+{
+	tuple_format format = tuple_format_from_relation(*table);
+	bool		 packed = format.packed_size != 0;
+	table->storage.btree =
+		bt_create(format.key_type, packed ? format.packed_size : format.record_size, false, true, packed);
+	table->storage.btree.root_page_index = root_page;
+}
+
+static void
+open_index_btree(relation *table, secondary_index *index, uint32_t root_page)
+{
+	tuple_format format = tuple_format_from_index(*table, *index);
+	index->btree = bt_create(format.key_type, format.record_size, false);
+	index->btree.root_page_index = root_page;
+}
+
+/*
+ * Parses a placeholder's CREATE TABLE, then its indexes' CREATE INDEX, the
+ * same as the master rows were before they were loaded lazily
+ */
+static void
+load_schema(relation *table)
+{
+	// 'CREATE TABLE users (INT user_id, TEXT username ...) -> attributes
+	stmt_node		  *stmt = parse_sql(table->sql).statements[0];
+	create_table_stmt &create_table = stmt->create_table_stmt;
+	table->columns.reserve(create_table.columns.size());
+	for (attribute_node &col_def : create_table.columns)
+	{
+		attribute col;
+		col.type = col_def.type;
+		sv_to_cstr(col_def.name, col.name, ATTRIBUTE_NAME_MAX_SIZE);
+		table->columns.push(col);
+	}
+	open_table_btree(table, table->storage.btree.root_page_index);
+
+	// 'CREATE INDEX users_email ON users (email)'
+	for (auto &index : table->indexes)
+	{
+		create_index_stmt &create_index = parse_sql(index.sql).statements[0]->create_index_stmt;
+		for (auto column_name : create_index.columns)
+		{
+			for (uint32_t i = 0; i < table->columns.size(); i++)
+			{
+				if (column_name.compare(table->columns[i].name) == 0)
+				{
+					index.columns[index.column_count++] = i;
+				}
+			}
+		}
+		open_index_btree(table, &index, index.btree.root_page_index);
+		index.sql = nullptr;
+	}
+
+	std::atomic_ref<const char *>(table->sql).store(nullptr, std::memory_order_release);
+}
+
+relation *
+catalog_get(string_view name)
+{
+	relation *table = catalog.get(name);
+	if (table && schema_pending(table))
+	{
+		std::lock_guard<std::mutex> guard(catalog_load_latch);
+		if (table->sql)
+		{
+			load_schema(table);
+		}
+	}
+	return table;
+}
+
+void
+catalog_load_all()
+{
+	for (auto [name, table] : catalog)
+	{
+		if (schema_pending(&table))
+		{
+			catalog_get(table.name);
+		}
+	}
+}
+
+/*
+ * Reads the master rows straight off its btree into placeholders, see
+ * relation::sql. Rows are in id order, so a table comes before its indexes.
+ */
+static void
+load_master_entries()
+{
+	relation	*master = catalog.get(MASTER_CATALOG);
+	tuple_format layout = tuple_format_from_relation(*master);
+	uint32_t	 name_offset = layout.offsets[0];
+	uint32_t	 tbl_name_offset = layout.offsets[1];
+	uint32_t	 rootpage_offset = layout.offsets[2];
+	uint32_t	 sql_offset = layout.offsets[3];
+	uint32_t	 sql_size = type_size(layout.columns[4]);
+
+	bt_cursor cursor = {.tree = &master->storage.btree};
+	if (!bt_cursor_first(&cursor))
+	{
+		return;
+	}
+
+	do
+	{
+		uint32_t	   key = *(uint32_t *)bt_cursor_key(&cursor);
+		const uint8_t *record = (const uint8_t *)bt_cursor_record(&cursor);
+
+		if (master->next_key.as_u32() <= key)
+		{
+			*(uint32_t *)(master->next_key.data) = key + 1;
+		}
+
+		char name[RELATION_NAME_MAX_SIZE + 1] = {};
+		char tbl_name[RELATION_NAME_MAX_SIZE + 1] = {};
+		memcpy(name, record + name_offset, RELATION_NAME_MAX_SIZE);
+		memcpy(tbl_name, record + tbl_name_offset, RELATION_NAME_MAX_SIZE);
+		uint32_t rootpage;
+		memcpy(&rootpage, record + rootpage_offset, sizeof(rootpage));
+		const char *sql = copy_sql((const char *)record + sql_offset, sql_size);
+
+		if (strcmp(name, tbl_name) != 0)
+		{
+			relation *table = catalog.get(tbl_name);
+			assert(table && "Index on a table that isn't in the catalog");
+
+			secondary_index index = {};
+			sv_to_cstr(name, index.name, RELATION_NAME_MAX_SIZE);
+			index.btree.root_page_index = rootpage;
+			index.sql = sql;
+			table->indexes.push(index);
+			continue;
+		}
+
+		relation table = {};
+		sv_to_cstr(name, table.name, RELATION_NAME_MAX_SIZE);
+		table.storage.btree.root_page_index = rootpage;
+		table.sql = sql;
+		catalog.insert(table.name, table);
+	} while (bt_cursor_next(&cursor));
+}
+
+/*
+ * Snapshot
+ *
+ * Every table but master_catalog, after a header:
+ *
+ *   [u32 magic][u32 master's next key][u32 tables]
+ *   table:  [u8 length][name][u32 root][u16 columns] column... [u8 indexes] index...
+ *           [u8 has stats] [u64 rows][u32 pages][u32 height][u32 columns][column_stats...]
+ *   column: [u8 length][name][u64 type]
+ *   index:  [u8 length][name][u32 root][u8 columns][u8 column]...
+ */
+
+#define CATALOG_SNAPSHOT_MAGIC 0x31544e53 /* "SNT1", changed with the layout */
+
+struct snapshot_writer
+{
+	array<uint8_t, query_arena> bytes;
+
+	void
+	put(const void *data, uint32_t size)
+	{
+		bytes.reserve(bytes.size() + size);
+		for (uint32_t i = 0; i < size; i++)
+		{
+			bytes.push(((const uint8_t *)data)[i]);
+		}
+	}
+
+	template <typename T>
+	void
+	put(T value)
+	{
+		put(&value, sizeof(T));
+	}
+
+	void
+	put_name(const char *name)
+	{
+		uint8_t length = strnlen(name, RELATION_NAME_MAX_SIZE);
+		put(length);
+		put(name, length);
+	}
+};
+
+struct snapshot_reader
+{
+	const uint8_t *at;
+	const uint8_t *end;
+
+	bool
+	get(void *data, uint32_t size)
+	{
+		if ((size_t)(end - at) < size)
+		{
+			return false;
+		}
+		memcpy(data, at, size);
+		at += size;
+		return true;
+	}
+
+	template <typename T>
+	bool
+	get(T *value)
+	{
+		return get(value, sizeof(T));
+	}
+
+	bool
+	get_name(char *name, uint32_t max_size)
+	{
+		uint8_t length;
+		if (!get(&length) || length >= max_size || !get(name, length))
+		{
+			return false;
+		}
+		name[length] = '\0';
+		return true;
+	}
+};
+
+static void
+write_table(snapshot_writer *out, relation &table)
+{
+	out->put_name(table.name);
+	out->put(table.storage.btree.root_page_index);
+
+	out->put((uint16_t)table.columns.size());
+	for (auto &col : table.columns)
+	{
+		out->put_name(col.name);
+		out->put(col.type);
+	}
+
+	out->put((uint8_t)table.indexes.size());
+	for (auto &index : table.indexes)
+	{
+		out->put_name(index.name);
+		out->put(index.btree.root_page_index);
+		out->put((uint8_t)index.column_count);
+		for (uint32_t i = 0; i < index.column_count; i++)
+		{
+			out->put((uint8_t)index.columns[i]);
+		}
+	}
+
+	table_stats *stats = table.stats;
+	out->put((uint8_t)(stats != nullptr));
+	if (stats)
+	{
+		out->put(stats->rows);
+		out->put(stats->pages);
+		out->put(stats->height);
+		out->put(stats->column_count);
+		out->put(stats->columns, sizeof(column_stats) * stats->column_count);
+	}
+}
+
+static bool
+read_table(snapshot_reader *in)
+{
+	relation table = {};
+	uint32_t root_page;
+	uint16_t column_count;
+	if (!in->get_name(table.name, RELATION_NAME_MAX_SIZE) || !in->get(&root_page) || !in->get(&column_count) ||
+		column_count == 0)
+	{
+		return false;
+	}
+
+	table.columns.reserve(column_count);
+	for (uint32_t i = 0; i < column_count; i++)
+	{
+		attribute col;
+		if (!in->get_name(col.name, ATTRIBUTE_NAME_MAX_SIZE) || !in->get(&col.type))
+		{
+			return false;
+		}
+		table.columns.push(col);
+	}
+	open_table_btree(&table, root_page);
+
+	uint8_t index_count;
+	if (!in->get(&index_count) || index_count > RELATION_MAX_INDEXES)
+	{
+		return false;
+	}
+	for (uint32_t i = 0; i < index_count; i++)
+	{
+		secondary_index index = {};
+		uint8_t			index_columns;
+		if (!in->get_name(index.name, RELATION_NAME_MAX_SIZE) || !in->get(&root_page) || !in->get(&index_columns) ||
+			index_columns == 0 || index_columns > INDEX_MAX_COLUMNS)
+		{
+			return false;
+		}
+		for (uint32_t c = 0; c < index_columns; c++)
+		{
+			uint8_t column;
+			if (!in->get(&column) || column >= column_count)
+			{
+				return false;
+			}
+			index.columns[index.column_count++] = column;
+		}
+		open_index_btree(&table, &index, root_page);
+		table.indexes.push(index);
+	}
+
+	uint8_t has_stats;
+	if (!in->get(&has_stats))
+	{
+		return false;
+	}
+	if (has_stats)
+	{
+		table_stats *stats = (table_stats *)arena<catalog_arena>::alloc(sizeof(table_stats));
+		if (!in->get(&stats->rows) || !in->get(&stats->pages) || !in->get(&stats->height) ||
+			!in->get(&stats->column_count) || stats->column_count != column_count)
+		{
+			return false;
+		}
+		stats->columns = (column_stats *)arena<catalog_arena>::alloc(sizeof(column_stats) * column_count);
+		if (!in->get(stats->columns, sizeof(column_stats) * column_count))
+		{
+			return false;
+		}
+		table.stats = stats;
+	}
+
+	catalog.insert(table.name, table);
+	return true;
+}
+
+/*
+ * Loads the snapshot into a catalog holding only master_catalog, false if
+ * there's none or it doesn't decode, leaving the catalog part loaded
  */
-void catalog_reload_callback(typed_value *result, size_t count) {
-  if (count != 5) {
-    return;
-  }
+static bool
+load_snapshot()
+{
+	uint32_t first_page = pager_get_root_slot(PAGER_SLOT_CATALOG_SNAPSHOT);
+	if (!first_page)
+	{
+		return false;
+	}
 
-  const uint32_t key = result[0].as_u32();
-  const char *name = result[1].as_char();
-  const char *tbl_name = result[2].as_char();
-  uint32_t rootpage = result[3].as_u32();
-  const char *sql = result[4].as_char();
+	size_t	 size;
+	uint8_t *bytes = blob_read_full(first_page, &size);
+	if (!bytes)
+	{
+		return false;
+	}
+
+	snapshot_reader in = {bytes, bytes + size};
+	uint32_t		magic, next_key, table_count;
+	if (!in.get(&magic) || magic != CATALOG_SNAPSHOT_MAGIC || !in.get(&next_key) || !in.get(&table_count))
+	{
+		return false;
+	}
 
-  if (strcmp(name, MASTER_CATALOG) == 0) {
-    return;
-  }
+	relation *master = catalog.get(MASTER_CATALOG);
+	*(uint32_t *)(master->next_key.data) = next_key;
+	for (uint32_t i = 0; i < table_count; i++)
+	{
+		if (!read_table(&in))
+		{
+			return false;
+		}
+	}
+	return in.at == in.end;
+}
 
-  auto master = catalog.get(MASTER_CATALOG);
-  if (master->next_key.as_u32() <= key) {
-    *(uint32_t *)(master->next_key.data) = key + 1;
-  }
+bool
+catalog_snapshot_save()
+{
+	if (pager_in_transaction())
+	{
+		return false;
+	}
+	if (pager_get_root_slot(PAGER_SLOT_CATALOG_SNAPSHOT))
+	{
+		return true;
+	}
 
-  // parse 'CREATE TABLE users (INT user_id, TEXT username ...) -> attributes
-  stmt_node *stmt = parse_sql(sql).statements[0];
-  array<attribute, query_arena> columns;
+	catalog_load_all();
 
-  if (strcmp(tbl_name, name) == 0) {
+	snapshot_writer out;
+	relation	   *master = catalog.get(MASTER_CATALOG);
+	out.put((uint32_t)CATALOG_SNAPSHOT_MAGIC);
+	out.put(master->next_key.as_u32());
+	out.put((uint32_t)(catalog.size() - 1));
+	for (auto [name, table] : catalog)
+	{
+		if (strcmp(table.name, MASTER_CATALOG) != 0)
+		{
+			write_table(&out, table);
+		}
+	}
 
-    create_table_stmt &create_stmt = stmt->create_table_stmt;
-    columns.reserve(create_stmt.columns.size());
+	if (!pager_begin_transaction())
+	{
+		return false;
+	}
+	uint32_t first_page = blob_create(out.bytes.data(), out.bytes.size(), true);
+	pager_set_root_slot(PAGER_SLOT_CATALOG_SNAPSHOT, first_page);
+	return pager_commit();
+}
 
-    for (uint32_t i = 0; i < create_stmt.columns.size(); i++) {
-      attribute_node &col_def = create_stmt.columns[i];
-      attribute col;
-      col.type = col_def.type;
-      sv_to_cstr(col_def.name, col.name, ATTRIBUTE_NAME_MAX_SIZE);
-      columns.push(col);
-    }
-  }
+void
+catalog_snapshot_invalidate()
+{
+	uint32_t first_page = pager_get_root_slot(PAGER_SLOT_CATALOG_SNAPSHOT);
+	if (first_page)
+	{
+		blob_delete(first_page);
+		pager_set_root_slot(PAGER_SLOT_CATALOG_SNAPSHOT, 0);
+	}
+}
 
-  relation structure = create_relation(name, columns);
-  tuple_format format = tuple_format_from_relation(structure);
+/*
+ * Undo log
+ */
 
-  structure.storage.btree =
-      bt_create(format.key_type, format.record_size, false);
-  structure.storage.btree.root_page_index = rootpage;
+enum CATALOG_CHANGE : uint8_t
+{
+	CATALOG_TABLE_ADDED,
+	CATALOG_TABLE_DROPPED, // table holds the relation as it was
+	CATALOG_INDEX_ADDED,
+	CATALOG_INDEX_DROPPED, // index as it was, at position in the table's indexes
+	CATALOG_STATS_SET,	   // stats as they were
+	CATALOG_ROOT_MOVED,	   // root as it was in position, of index when that's named
+};
 
-  catalog.insert(name, structure);
+struct catalog_change
+{
+	CATALOG_CHANGE	kind;
+	uint32_t		position;
+	relation		table;
+	secondary_index index;
+	table_stats	   *stats;
+};
+
+static array<catalog_change, catalog_arena> catalog_changes;
+
+static void
+log_change(CATALOG_CHANGE kind, relation &table, uint32_t position = 0, secondary_index *index = nullptr,
+		   table_stats *stats = nullptr)
+{
+	catalog_change change = {.kind = kind, .position = position, .table = table, .stats = stats};
+	if (index)
+	{
+		change.index = *index;
+	}
+	catalog_changes.push(change);
+	catalog_version++;
+}
+
+static void
+reclaim_stats(table_stats *stats)
+{
+	if (stats)
+	{
+		arena<catalog_arena>::reclaim(stats->columns, sizeof(column_stats) * stats->column_count);
+		arena<catalog_arena>::reclaim(stats, sizeof(table_stats));
+	}
 }
 
+/*
+ * What the committed changes replaced can go
+ */
+void
+catalog_commit()
+{
+	for (auto &change : catalog_changes)
+	{
+		if (change.kind == CATALOG_TABLE_DROPPED)
+		{
+			change.table.columns.clear();
+			change.table.indexes.clear();
+			reclaim_stats(change.table.stats);
+		}
+		else if (change.kind == CATALOG_STATS_SET)
+		{
+			reclaim_stats(change.stats);
+		}
+	}
+	catalog_changes.clear();
+}
+
+void
+catalog_add_table(relation &table)
+{
+	catalog.insert(table.name, table);
+	log_change(CATALOG_TABLE_ADDED, table);
+}
 
 void
-load_catalog_from_master()
+catalog_drop_table(const char *name)
 {
-	vm_set_result_callback(catalog_reload_callback);
+	relation *table = catalog.get(name);
+	log_change(CATALOG_TABLE_DROPPED, *table);
+	catalog.remove(name);
+}
 
-	parser_result result = parse_sql("SELECT * FROM master_catalog");
-	assert(result.success && result.statements.size() == 1);
-	semantic_analyze(result.statements[0], true);
+void
+catalog_add_index(relation *table, secondary_index &index)
+{
+	table->indexes.push(index);
+	log_change(CATALOG_INDEX_ADDED, *table);
+}
 
-	auto program = compile_program(result.statements[0]);
+void
+catalog_drop_index(relation *table, secondary_index *index)
+{
+	uint32_t position = index - table->indexes.data();
+	log_change(CATALOG_INDEX_DROPPED, *table, position, index);
+	*index = *table->indexes.back();
+	table->indexes.pop_back();
+}
 
-	vm_execute(program.front(), program.size());
+void
+catalog_set_stats(relation *table, table_stats *stats)
+{
+	log_change(CATALOG_STATS_SET, *table, 0, nullptr, table->stats);
+	table->stats = stats;
 }
 
+/*
+ * Undone newest first, so each change sees the catalog as it left it
+ */
 void
-catalog_reload()
+catalog_rollback()
+{
+	while (catalog_change *change = catalog_changes.pop_back())
+	{
+		relation *table = catalog.get(change->table.name);
+		switch (change->kind)
+		{
+		case CATALOG_TABLE_ADDED:
+			catalog.remove(change->table.name);
+			break;
+		case CATALOG_TABLE_DROPPED:
+			catalog.insert(change->table.name, change->table);
+			break;
+		case CATALOG_INDEX_ADDED:
+			table->indexes.pop_back();
+			break;
+		case CATALOG_INDEX_DROPPED:
+			if (change->position < table->indexes.size())
+			{
+				table->indexes.push(table->indexes[change->position]);
+				table->indexes[change->position] = change->index;
+			}
+			else
+			{
+				table->indexes.push(change->index);
+			}
+			break;
+		case CATALOG_STATS_SET:
+			table->stats = change->stats;
+			break;
+		case CATALOG_ROOT_MOVED:
+			if (!change->index.name[0])
+			{
+				table->storage.btree.root_page_index = change->position;
+			}
+			for (auto &index : table->indexes)
+			{
+				if (strcmp(index.name, change->index.name) == 0)
+				{
+					index.btree.root_page_index = change->position;
+				}
+			}
+			break;
+		}
+		catalog_version++;
+	}
+	catalog_changes.clear();
+}
+
+static void
+reset_catalog()
 {
 	arena<catalog_arena>::reset_and_decommit();
 	catalog.clear();
-
+	catalog_changes = {};
+	catalog_version++;
 	bootstrap_master(false);
+}
+
+void
+catalog_reload()
+{
+	bool held = catalog_exclusive;
+	catalog_lock_exclusive();
+
+	reset_catalog();
+	if (!load_snapshot())
+	{
+		reset_catalog();
+		load_master_entries();
+		stats_load();
+	}
+
+	if (!held)
+	{
+		catalog_unlock_exclusive();
+	}
+}
+
+struct vacuum_tree
+{
+	relation		*table;
+	secondary_index *index; // Or the table's own btree
+	uint32_t		 root;	// Before the vacuum
+};
+
+/*
+ * Points the master rows of the trees whose root moved at the new root
+ */
+static void
+update_master_roots(array<vacuum_tree, query_arena> &moved)
+{
+	relation	*master = catalog.get(MASTER_CATALOG);
+	tuple_format layout = tuple_format_from_relation(*master);
+	uint32_t	 name_offset = layout.offsets[0];
+	uint32_t	 tbl_name_offset = layout.offsets[1];
+	uint32_t	 rootpage_offset = layout.offsets[2];
+	uint8_t		*record = (uint8_t *)arena<query_arena>::alloc(layout.record_size);
+
+	bt_cursor cursor = {.tree = &master->storage.btree};
+	if (!bt_cursor_first(&cursor))
+	{
+		return;
+	}
+
+	do
+	{
+		memcpy(record, bt_cursor_record(&cursor), layout.record_size);
+		const char *name = (const char *)record + name_offset;
+		const char *tbl_name = (const char *)record + tbl_name_offset;
+
+		for (vacuum_tree &tree : moved)
+		{
+			const char *tree_name = tree.index ? tree.index->name : tree.table->name;
+			if (strncmp(tbl_name, tree.table->name, RELATION_NAME_MAX_SIZE) == 0 &&
+				strncmp(name, tree_name, RELATION_NAME_MAX_SIZE) == 0)
+			{
+				btree *moved_tree = tree.index ? &tree.index->btree : &tree.table->storage.btree;
+				memcpy(record + rootpage_offset, &moved_tree->root_page_index, sizeof(uint32_t));
+				bt_cursor_update(&cursor, record);
+			}
+		}
+	} while (bt_cursor_next(&cursor));
+}
+
+/*
+ * Compact every table towards the front of the file, moving at most
+ * max_moves pages (0 for no limit), see bt_vacuum. Runs inside the caller's
+ * transaction, whose commit truncates the file, and a root that moves is
+ * changed in the relation and its master row with it. The blob dedup index
+ * is compacted too, its root slot following it.
+ */
+uint32_t
+catalog_vacuum(uint32_t max_moves)
+{
+	// The snapshot's pages would hold the end of the file, it's saved again later
+	catalog_snapshot_invalidate();
+	catalog_load_all();
+
+	array<btree *, query_arena>		trees;
+	array<vacuum_tree, query_arena> owners;
+	for (auto [name, rel] : catalog)
+	{
+		trees.push(&rel.storage.btree);
+		owners.push({&rel, nullptr, rel.storage.btree.root_page_index});
+		for (auto &index : rel.indexes)
+		{
+			trees.push(&index.btree);
+			owners.push({&rel, &index, index.btree.root_page_index});
+		}
+	}
+
+	// The blob dedup index has no owner in the catalog, its root is in a root slot
+	btree dedup = {};
+	bool  has_dedup = pager_get_root_slot(PAGER_SLOT_BLOB_DEDUP) != 0;
+	if (has_dedup)
+	{
+		dedup = blob_dedup_open();
+		trees.push(&dedup);
+	}
+
+	uint32_t moved = bt_vacuum(trees.data(), trees.size(), max_moves);
+	assert(1 == catalog.get(MASTER_CATALOG)->storage.btree.root_page_index &&
+		   "Nothing is free below the master catalog's root");
+	if (has_dedup)
+	{
+		pager_set_root_slot(PAGER_SLOT_BLOB_DEDUP, dedup.root_page_index);
+	}
+
+	array<vacuum_tree, query_arena> moved_roots;
+	for (uint32_t i = 0; i < owners.size(); i++)
+	{
+		vacuum_tree &owner = owners[i];
+		if (trees[i]->root_page_index != owner.root)
+		{
+			log_change(CATALOG_ROOT_MOVED, *owner.table, owner.root, owner.index);
+			moved_roots.push(owner);
+		}
+	}
+	if (moved_roots.size())
+	{
+		update_master_roots(moved_roots);
+	}
 
-	load_catalog_from_master();
+	return moved;
 }
@@ -23,8 +23,25 @@
 *
 * Further alterations, like 'CREATE TABLE X' will directly update the catalog itself, but
 * will also need to insert into the master_catalog table within the same transaction.
-* On the event of a rollback for simplicity, we reload the catalog to avoid a more
-* complicated sync mechanism.
+* They go through catalog_add_table and friends, which keep an undo log of what changed,
+* so on a rollback catalog_rollback reverts just those changes rather than reloading
+* every table. The log is dropped when the transaction ends, with the latch below.
+*
+* Loading a table's schema means parsing its CREATE TABLE, so on start-up the master
+* rows are only read into placeholders holding the SQL, and a table is parsed the first
+* time it's looked up, see catalog_get. Even that is skipped after a clean shutdown:
+* catalog_snapshot_save stores the parsed catalog, stats included, as one blob whose
+* first page is kept in the pager's root, and the next start decodes it instead. Any
+* schema change or ANALYZE drops the snapshot inside its transaction, so a snapshot
+* that's there is always current.
+*
+* Indexes get a master_catalog row of their own, with their name in 'name' and the indexed
+* table's in 'tbl_name', so a row is a table exactly when the two are the same.
+*
+* Read sessions on other threads (see session.hpp) use the catalog while the writer's
+* thread carries on, so it has a latch. A session holds it shared for a statement, the
+* writer exclusive from its first schema change until the transaction ends, so a session
+* never sees a table that isn't committed, nor one that's half built.
 */
 
 #pragma once
@@ -49,7 +66,7 @@
 /*
  *
  * This arena holds all catalog data that survives across queries.
- * It is only reset when the catalog is reloaded (e.g., after rollback).
+ * It is only reset when the catalog is reloaded, see catalog_reload.
  */
 struct catalog_arena
 {
@@ -64,6 +81,33 @@ struct attribute
 	data_type type;
 };
 
+#define INDEX_MAX_COLUMNS 2
+#define INDEXED_COLUMN_MAX_SIZE 255 // A dual's component sizes are a byte each
+#define RELATION_MAX_INDEXES 8 // Writes open a cursor on each, see CURSORS
+
+/*
+ * A secondary index over a table
+ *
+ * The btree is keyed by dual(leading column, primary key), the primary key
+ * keeping entries unique when the column has duplicates. A second column is
+ * kept as the entry's record, so queries that only need those columns never
+ * touch the table.
+ *
+ * 'CREATE INDEX users_city ON users (city, age)':
+ *   key:    [char32 city][u32 user_id]
+ *   record: [u32 age]
+ */
+struct secondary_index
+{
+	char		name[RELATION_NAME_MAX_SIZE];
+	uint32_t	columns[INDEX_MAX_COLUMNS]; // Column indices in the table
+	uint32_t	column_count;
+	btree		btree;
+	const char *sql; // The CREATE INDEX while its table isn't loaded, see catalog_get
+};
+
+struct table_stats;
+
 /*
  * Relation aka schema definition for a table
  *
@@ -83,6 +127,15 @@ struct relation
 	} storage;
 
 	array<attribute, catalog_arena> columns;
+	array<secondary_index, catalog_arena> indexes;
+	table_stats *stats; // nullptr until the table is analyzed, see stats.hpp
+
+	/*
+	 * The CREATE TABLE until the schema is parsed, when only the name, the
+	 * btree's root page and the indexes' names and roots are filled in.
+	 * Cleared atomically, see catalog_get.
+	 */
+	const char *sql;
 };
 
 /*
@@ -99,6 +152,9 @@ struct relation
  *
  * Note: The key is stored separately in the btree, so offsets start
  * from the first non-key column.
+ *
+ * A table with VARCHAR columns stores its records packed, see record_pack,
+ * and the layout describes the unpacked image the VM works with.
  */
 struct tuple_format
 {
@@ -106,22 +162,156 @@ struct tuple_format
 	array<uint32_t, query_arena>  offsets;	   // Byte offsets (excluding key)
 	uint32_t					  record_size; // Size of record (excluding key)
 	data_type					  key_type;	   // Type of the key column
+	uint32_t					  packed_size; // Largest packed record, 0 if records aren't packed
 };
 
+/*
+ * A packed record has its columns in order, fixed size ones as they are and a
+ * VARCHAR as its length and bytes:
+ *
+ *   (id:u32 key, name:varchar(100), age:u32) with name 'Ann', age 40:
+ *   [u16 3]['Ann'][u32 40]             9 bytes rather than 104
+ *
+ * When a record won't fit in max_size, its longest values go into blobs,
+ * leaving [u16 RECORD_OVERFLOW][u32 first page] in their place.
+ */
+#define RECORD_OVERFLOW 0xFFFF
+
 
+/*
+ * Every table, loaded or not. Look tables up with catalog_get, and call
+ * catalog_load_all before walking it for anything past names.
+ */
 extern hash_map<fixed_string<RELATION_NAME_MAX_SIZE>, relation, catalog_arena> catalog;
 
+/*
+ * Bumped whenever a table or index is added or dropped, or the catalog is
+ * reloaded. Relations can move when that happens, so anything holding
+ * pointers into the catalog across statements, like a cached plan, checks it.
+ */
+extern uint32_t catalog_version;
+
+/*
+ * Rebuilds the catalog from the snapshot if there is one, otherwise from
+ * master_catalog with every table left to load on first reference
+ */
 void
 catalog_reload();
 
+/*
+ * The table, its schema loaded, nullptr if there isn't one. Safe on read
+ * sessions' threads, which load under a latch of their own, and that latch
+ * is also what makes their catalog_arena allocations safe: every other one
+ * is made while the writer holds the catalog exclusive, when no session
+ * reads.
+ */
+relation *
+catalog_get(string_view name);
+
+void
+catalog_load_all();
+
+/*
+ * Schema changes, each logged for catalog_rollback. They bump catalog_version.
+ */
+void
+catalog_add_table(relation &table);
+void
+catalog_drop_table(const char *name);
+void
+catalog_add_index(relation *table, secondary_index &index);
+void
+catalog_drop_index(relation *table, secondary_index *index);
+/* The old stats are reclaimed once the transaction commits */
+void
+catalog_set_stats(relation *table, table_stats *stats);
+
+/*
+ * Reverts the schema changes logged since the transaction began, newest
+ * first, after the pager has rolled back
+ */
+void
+catalog_rollback();
+
+/*
+ * Forgets the logged changes once they're committed, a group's soft commit
+ * included (see pager_commit_grouped), so a rollback after stops there
+ */
+void
+catalog_commit();
+
+/*
+ * Stores the catalog as a snapshot for the next start, in a transaction of
+ * its own, unless the current one is still there. false inside a transaction.
+ */
+bool
+catalog_snapshot_save();
+
+/*
+ * Drops the snapshot inside the caller's transaction, for a statement about
+ * to change the schema
+ */
+void
+catalog_snapshot_invalidate();
+
+/*
+ * See the notes above. The exclusive latch is held once however often it's
+ * taken, and released by the one unlock.
+ */
+void
+catalog_lock_shared();
+void
+catalog_unlock_shared();
+void
+catalog_lock_exclusive();
+void
+catalog_unlock_exclusive();
+
 tuple_format
 tuple_format_from_types(array<data_type, query_arena> &columns);
 
 tuple_format
 tuple_format_from_relation(relation &schema);
 
+tuple_format
+tuple_format_from_index(relation &schema, secondary_index &index);
+
+/*
+ * Fills in the index's entry for a table row laid out as layout, see
+ * tuple_format_from_index for the entry's layout
+ */
+void
+build_index_entry(secondary_index &index, tuple_format &layout, uint8_t *key, uint8_t *record, uint8_t *entry_key,
+				  uint8_t *entry_record);
+
+/*
+ * Packs the record image into out, returning its size, 0 if it can't be made
+ * to fit in max_size
+ */
+uint32_t
+record_pack(tuple_format &layout, const uint8_t *image, uint8_t *out, uint32_t max_size);
+
+/*
+ * The record's image, the zero-padded columns at layout's offsets
+ */
+void
+record_unpack(tuple_format &layout, const uint8_t *packed, uint8_t *image);
+
+/*
+ * Frees the blobs a packed record's values overflowed into, before it's
+ * deleted or overwritten
+ */
+void
+record_release(tuple_format &layout, const uint8_t *packed);
+
+secondary_index *
+find_index(string_view name, relation **table = nullptr);
+
 relation
 create_relation(string_view name, array<attribute, query_arena> columns);
 
 void
 bootstrap_master(bool is_new_database);
+
+uint32_t
+catalog_vacuum(uint32_t max_moves = 0);
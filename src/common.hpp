@@ -23,6 +23,14 @@ struct query_arena
 {
 };
 
+/*
+ * A query that commits more than the watermark keeps it for the queries
+ * after it, until this many in a row have used less, see
+ * arena::set_decommit_policy
+ */
+#define QUERY_ARENA_WATERMARK	   (4 * 1024 * 1024)
+#define QUERY_ARENA_DECOMMIT_AFTER 32
+
 enum ARITH_OP : uint8_t
 {
 	ARITH_ADD = 0,
@@ -22,15 +22,43 @@
  * our expression involves a primary key, we do a seek, and if the op is '='
  * then, because we know primary keys are unique, we exit immediately after the
  * op is finished.
+ *
+ * Failing that, a comparison on the leading column of an index scans the
+ * index from the first possible entry instead of the whole table, and when
+ * the index holds every column the query needs the table isn't read at all.
+ *
+ * A join seeks one table for each row of the other when it can, by primary
+ * key or index, and otherwise builds a hash table (see compile_join).
+ *
+ * GROUP BY is aggregated in a hash table too, unless the rows already come
+ * out one group after another (see group_state).
+ *
+ * With worker threads set, a full scan of one table is split between them
+ * (see compile_parallel_scan).
+ *
+ * Once a table has been analyzed (see stats.hpp) these are choices rather
+ * than rules: the primary key seek, each index and a full scan are costed
+ * from the table's stats and the cheapest is taken (see choose_access_path),
+ * and likewise a join's strategy and which side is the inner (see
+ * choose_join).
+ *
+ * Each choice is noted on the statement as it's made, which EXPLAIN prints
+ * ahead of the program (see plan_note).
  */
 #pragma once
 #include "compile.hpp"
 #include "arena.hpp"
 #include "catalog.hpp"
 #include "common.hpp"
+#include "copy.hpp"
+#include "pager.hpp"
+#include "parallel.hpp"
 #include "parser.hpp"
+#include "stats.hpp"
 #include "types.hpp"
 #include "vm.hpp"
+#include <algorithm>
+#include <cstdarg>
 #include <cstdint>
 #include <cstring>
 #include <string_view>
@@ -41,6 +69,18 @@ cursor_context *btree_cursor_from_relation(relation &structure) {
   cctx->storage.tree = &structure.storage.btree;
   cctx->type = BPLUS;
   cctx->layout = tuple_format_from_relation(structure);
+  cctx->filter = nullptr;
+  return cctx;
+}
+
+cursor_context *btree_cursor_from_index(relation &structure,
+                                        secondary_index &index) {
+  cursor_context *cctx =
+      (cursor_context *)arena<query_arena>::alloc(sizeof(cursor_context));
+  cctx->storage.tree = &index.btree;
+  cctx->type = BPLUS;
+  cctx->layout = tuple_format_from_index(structure, index);
+  cctx->filter = nullptr;
   return cctx;
 }
 
@@ -51,46 +91,149 @@ cursor_context *red_black_cursor_from_format(tuple_format &layout,
   cctx->type = RED_BLACK;
   cctx->layout = layout;
   cctx->flags = allow_duplicates;
+  cctx->filter = nullptr;
+  return cctx;
+}
+
+cursor_context *memtree_cursor_from_format(tuple_format &layout,
+                                           bool allow_duplicates) {
+  cursor_context *cctx =
+      (cursor_context *)arena<query_arena>::alloc(sizeof(cursor_context));
+  cctx->type = MEMTREE;
+  cctx->layout = layout;
+  cctx->flags = allow_duplicates;
+  cctx->filter = nullptr;
+  return cctx;
+}
+
+cursor_context *hash_cursor_from_format(tuple_format &layout,
+                                        aggregate_spec *aggregates) {
+  cursor_context *cctx =
+      (cursor_context *)arena<query_arena>::alloc(sizeof(cursor_context));
+  cctx->type = HASH;
+  cctx->layout = layout;
+  cctx->flags = 0;
+  cctx->filter = nullptr;
+  cctx->aggregates = aggregates;
+  return cctx;
+}
+
+cursor_context *sorter_cursor_from_format(tuple_format &layout, bool descending,
+                                          uint32_t keep) {
+  cursor_context *cctx =
+      (cursor_context *)arena<query_arena>::alloc(sizeof(cursor_context));
+  cctx->type = SORTER;
+  cctx->layout = layout;
+  cctx->flags = descending;
+  cctx->filter = nullptr;
+  cctx->keep = keep;
+  return cctx;
+}
+
+cursor_context *gather_cursor_from_plan(tuple_format &layout,
+                                        parallel_plan *plan) {
+  cursor_context *cctx =
+      (cursor_context *)arena<query_arena>::alloc(sizeof(cursor_context));
+  cctx->type = GATHER;
+  cctx->layout = layout;
+  cctx->storage.plan = plan;
+  cctx->filter = nullptr;
   return cctx;
 }
 
-static int compile_literal(program_builder *prog, expr_node *expr) {
+/*
+ * A parameter's buffer, made the first time it's compiled. The program reads
+ * it when it runs, so whatever is bound then is what's used
+ */
+static uint8_t *parameter_value(expr_node *expr) {
+  parameter_slot *slot = expr->parameter;
+  if (!slot->value) {
+    uint32_t size = type_size(slot->type);
+    slot->value = (uint8_t *)arena<query_arena>::alloc(size);
+    memset(slot->value, 0, size);
+  }
+  return slot->value;
+}
+
+static bool is_value(expr_node *expr) {
+  return expr->type == EXPR_LITERAL || expr->type == EXPR_PARAMETER;
+}
+
+static int compile_literal(program_builder *prog, expr_node *expr,
+                           int dest_reg = -1) {
+  if (expr->type == EXPR_PARAMETER) {
+    return prog->load_from(expr->sem.resolved_type, parameter_value(expr),
+                           dest_reg);
+  }
+
   switch (expr->lit_type) {
   case TYPE_U32:
-    return prog->load(expr->sem.resolved_type, expr->int_val);
+    return prog->load(expr->sem.resolved_type, expr->int_val, dest_reg);
   case TYPE_CHAR32:
     return prog->load_string(expr->sem.resolved_type, expr->str_val.data(),
-                             expr->str_val.size());
+                             expr->str_val.size(), dest_reg);
   }
 
   assert(false);
 }
 
-static int compile_expr(program_builder *prog, expr_node *expr, int cursor_id) {
+/*
+ * Where a joined table's columns are read from, by its sem.table_index. The
+ * build side of a hash join is read from the hash table, which holds the
+ * join key in front of the table's columns.
+ */
+struct join_source {
+  int cursor;
+  int column_offset;
+};
+
+/*
+ * column_regs, when given, maps column indices to registers that already hold
+ * them (-1 otherwise), e.g. columns read from an index entry
+ *
+ * sources, when given, is where each table of a join is read from instead
+ * of cursor_id
+ */
+static int compile_expr(program_builder *prog, expr_node *expr, int cursor_id,
+                        int *column_regs = nullptr,
+                        join_source *sources = nullptr) {
   switch (expr->type) {
   case EXPR_COLUMN:
+    if (sources) {
+      join_source &source = sources[expr->sem.table_index];
+      return prog->get_column(source.cursor,
+                              expr->sem.column_index + source.column_offset);
+    }
+    if (column_regs && column_regs[expr->sem.column_index] >= 0) {
+      return column_regs[expr->sem.column_index];
+    }
     return prog->get_column(cursor_id, expr->sem.column_index);
 
   case EXPR_LITERAL:
+  case EXPR_PARAMETER:
     return compile_literal(prog, expr);
 
   case EXPR_BINARY_OP: {
-    int left_reg = compile_expr(prog, expr->left, cursor_id);
-    int right_reg = compile_expr(prog, expr->right, cursor_id);
+    int left_reg =
+        compile_expr(prog, expr->left, cursor_id, column_regs, sources);
+    int right_reg =
+        compile_expr(prog, expr->right, cursor_id, column_regs, sources);
+    // Comparisons are of the left side's type, as in OP_Test
+    data_type type = expr->left->sem.resolved_type;
 
     switch (expr->op) {
     case OP_EQ:
-      return prog->eq(left_reg, right_reg);
+      return prog->typed_test(left_reg, right_reg, EQ, type);
     case OP_NE:
-      return prog->ne(left_reg, right_reg);
+      return prog->typed_test(left_reg, right_reg, NE, type);
     case OP_LT:
-      return prog->lt(left_reg, right_reg);
+      return prog->typed_test(left_reg, right_reg, LT, type);
     case OP_LE:
-      return prog->le(left_reg, right_reg);
+      return prog->typed_test(left_reg, right_reg, LE, type);
     case OP_GT:
-      return prog->gt(left_reg, right_reg);
+      return prog->typed_test(left_reg, right_reg, GT, type);
     case OP_GE:
-      return prog->ge(left_reg, right_reg);
+      return prog->typed_test(left_reg, right_reg, GE, type);
     case OP_AND:
       return prog->logic_and(left_reg, right_reg);
     case OP_OR:
@@ -101,11 +244,12 @@ static int compile_expr(program_builder *prog, expr_node *expr, int cursor_id) {
   }
 
   case EXPR_UNARY_OP: {
-    int operand_reg = compile_expr(prog, expr->operand, cursor_id);
+    int operand_reg =
+        compile_expr(prog, expr->operand, cursor_id, column_regs, sources);
     if (expr->unary_op == OP_NOT) {
 
       int one = prog->load(TYPE_U32, 1U);
-      return prog->sub(one, operand_reg);
+      return prog->typed_arithmetic(one, operand_reg, ARITH_SUB, TYPE_U32);
     }
     return operand_reg;
   }
@@ -126,12 +270,18 @@ static bool vmfunc_create_relation(typed_value *result, typed_value *args,
                                    uint32_t arg_count) {
   const char *table_name = args[0].as_char();
 
-  relation *rel = catalog.get(table_name);
+  relation *rel = catalog_get(table_name);
 
   assert(rel && "Relation should already be in the catalog");
 
+  // Every statement that changes the schema drops the snapshot, see catalog.hpp
+  catalog_snapshot_invalidate();
+
   tuple_format layout = tuple_format_from_relation(*rel);
-  rel->storage.btree = bt_create(layout.key_type, layout.record_size, true);
+  bool packed = layout.packed_size != 0;
+  rel->storage.btree =
+      bt_create(layout.key_type, packed ? layout.packed_size : layout.record_size,
+                true, true, packed);
 
   result->type = TYPE_U32;
   result->data = arena<query_arena>::alloc(sizeof(uint32_t));
@@ -148,14 +298,190 @@ static bool vmfunc_drop_relation(typed_value *result, typed_value *args,
   }
 
   const char *name = args[0].as_char();
-  relation *rel = catalog.get(name);
+  relation *rel = catalog_get(name);
 
   assert(rel &&
          "Relation should still be in the catalog until we remove it here");
+  catalog_snapshot_invalidate();
 
+  // Values that overflowed into blobs aren't pages of the tree
+  tuple_format layout = tuple_format_from_relation(*rel);
+  bt_cursor cursor = {.tree = &rel->storage.btree};
+  if (layout.packed_size && bt_cursor_first(&cursor)) {
+    do {
+      record_release(layout, (uint8_t *)bt_cursor_record(&cursor));
+    } while (bt_cursor_next(&cursor));
+  }
+
+  stats_drop(name);
   bt_clear(&rel->storage.btree);
+  for (auto &index : rel->indexes) {
+    bt_clear(&index.btree);
+  }
+
+  catalog_drop_table(name);
+
+  result->type = TYPE_U32;
+  result->data = arena<query_arena>::alloc(sizeof(uint32_t));
+  *(uint32_t *)result->data = 1;
+  return true;
+}
+
+/*
+ * DELETE without a WHERE, which empties the table and its indexes in place
+ * rather than removing the rows one at a time
+ */
+static bool vmfunc_truncate_relation(typed_value *result, typed_value *args,
+                                     uint32_t arg_count) {
+  if (arg_count != 1) {
+    return false;
+  }
+
+  relation *rel = catalog_get(args[0].as_char());
+
+  assert(rel && "Relation should be in the catalog");
+
+  bt_truncate(&rel->storage.btree);
+  for (auto &index : rel->indexes) {
+    bt_truncate(&index.btree);
+  }
+
+  result->type = TYPE_U32;
+  result->data = arena<query_arena>::alloc(sizeof(uint32_t));
+  *(uint32_t *)result->data = 1;
+  return true;
+}
+
+/*
+ * The index is already in the catalog (see semantic_resolve_create_index),
+ * create its btree and fill it from the table. The entries are sorted and
+ * bulk loaded rather than inserted one by one.
+ */
+static bool vmfunc_create_index(typed_value *result, typed_value *args,
+                                uint32_t arg_count) {
+  relation *table;
+  secondary_index *index = find_index(args[0].as_char(), &table);
+
+  assert(index && "Index should already be in the catalog");
+  catalog_snapshot_invalidate();
+
+  tuple_format table_layout = tuple_format_from_relation(*table);
+  tuple_format index_layout = tuple_format_from_index(*table, *index);
+  index->btree =
+      bt_create(index_layout.key_type, index_layout.record_size, true);
+
+  data_type key_type = index_layout.key_type;
+  uint32_t key_size = type_size(key_type);
+  array<uint8_t *, query_arena> entries;
+
+  uint8_t image[table_layout.record_size];
+  bt_cursor cursor = {.tree = &table->storage.btree};
+  if (bt_cursor_first(&cursor)) {
+    do {
+      uint8_t *entry = (uint8_t *)arena<query_arena>::alloc(
+          key_size + index_layout.record_size);
+      uint8_t *record = (uint8_t *)bt_cursor_record(&cursor);
+      if (table_layout.packed_size) {
+        record_unpack(table_layout, record, image);
+        record = image;
+      }
+      build_index_entry(*index, table_layout,
+                        (uint8_t *)bt_cursor_key(&cursor), record, entry,
+                        entry + key_size);
+      entries.push(entry);
+    } while (bt_cursor_next(&cursor));
+  }
+
+  std::sort(entries.begin(), entries.end(), [key_type](uint8_t *a, uint8_t *b) {
+    return type_less_than(key_type, a, b);
+  });
+
+  bt_bulk_loader loader;
+  bt_bulk_begin(&loader, &index->btree);
+  for (uint8_t *entry : entries) {
+    bt_bulk_append(&loader, entry, entry + key_size);
+  }
+  bt_bulk_finish(&loader);
+
+  result->type = TYPE_U32;
+  result->data = arena<query_arena>::alloc(sizeof(uint32_t));
+  *(uint32_t *)result->data = index->btree.root_page_index;
+  return true;
+}
+
+/*
+ * Loads a CSV file into a table, see copy.hpp. The result is the number of
+ * rows loaded.
+ */
+static bool vmfunc_copy(typed_value *result, typed_value *args,
+                        uint32_t arg_count) {
+  if (arg_count != 2) {
+    return false;
+  }
+
+  relation *table = catalog_get(args[0].as_char());
+
+  assert(table && "Relation should be in the catalog");
+
+  uint64_t rows;
+  if (!copy_from_csv(table, args[1].as_char(), &rows)) {
+    return false;
+  }
+
+  result->type = TYPE_U32;
+  result->data = arena<query_arena>::alloc(sizeof(uint32_t));
+  *(uint32_t *)result->data = (uint32_t)rows;
+  return true;
+}
+
+/*
+ * ANALYZE, see stats.hpp. An empty name is every table but the system ones.
+ */
+static bool vmfunc_analyze(typed_value *result, typed_value *args,
+                           uint32_t arg_count) {
+  if (arg_count != 1) {
+    return false;
+  }
+
+  catalog_snapshot_invalidate();
+
+  const char *name = args[0].as_char();
+  if (name[0]) {
+    relation *table = catalog_get(name);
+    assert(table && "Relation should be in the catalog");
+    if (!stats_analyze(table)) {
+      return false;
+    }
+  } else {
+    catalog_load_all();
+    for (auto [table_name, table] : catalog) {
+      if (strcmp(table.name, MASTER_CATALOG) == 0 ||
+          strcmp(table.name, STATS_TABLE) == 0) {
+        continue;
+      }
+      if (!stats_analyze(&table)) {
+        return false;
+      }
+    }
+  }
+
+  result->type = TYPE_U32;
+  result->data = arena<query_arena>::alloc(sizeof(uint32_t));
+  *(uint32_t *)result->data = 1;
+  return true;
+}
 
-  catalog.remove(name);
+static bool vmfunc_drop_index(typed_value *result, typed_value *args,
+                              uint32_t arg_count) {
+  relation *table;
+  secondary_index *index = find_index(args[0].as_char(), &table);
+
+  assert(index && "Index should still be in the catalog until we remove it");
+  catalog_snapshot_invalidate();
+
+  bt_clear(&index->btree);
+
+  catalog_drop_index(table, index);
 
   result->type = TYPE_U32;
   result->data = arena<query_arena>::alloc(sizeof(uint32_t));
@@ -163,278 +489,2073 @@ static bool vmfunc_drop_relation(typed_value *result, typed_value *args,
   return true;
 }
 
-enum SEEK_STRATEGY_TYPE : uint8_t {
-  STRATEGY_FULL_SCAN,    // full table scan
-  STRATEGY_SEEK_SCAN,    // seek to position, then scan
-  STRATEGY_DIRECT_LOOKUP // direct key lookup (for PK with EQ)
-};
+/*
+ * Keeping a table's indexes in step with its rows. Each index gets a cursor
+ * for the statement, and entries are written from the row's registers.
+ */
+static void open_index_cursors(program_builder *prog, relation *table,
+                               int *cursors) {
+  for (uint32_t i = 0; i < table->indexes.size(); i++) {
+    cursors[i] =
+        prog->open_cursor(btree_cursor_from_index(*table, table->indexes[i]));
+  }
+}
+
+static void close_index_cursors(program_builder *prog, relation *table,
+                                int *cursors) {
+  for (uint32_t i = 0; i < table->indexes.size(); i++) {
+    prog->close_cursor(cursors[i]);
+  }
+}
+
+static void insert_index_entry(program_builder *prog, int index_cursor,
+                               secondary_index &index, int row_start,
+                               int key_reg) {
+  prog->regs.push_scope();
+  int entry = prog->regs.allocate_range(index.column_count);
+  prog->pack2(row_start + index.columns[0], key_reg, entry);
+  if (index.column_count > 1) {
+    prog->move(row_start + index.columns[1], entry + 1);
+  }
+  prog->insert_record(index_cursor, entry, index.column_count);
+  prog->regs.pop_scope();
+}
+
+static void delete_index_entry(program_builder *prog, int index_cursor,
+                               int column_reg, int key_reg) {
+  prog->regs.push_scope();
+  int entry_key = prog->pack2(column_reg, key_reg);
+  int found = prog->seek(index_cursor, entry_key, EQ);
+  auto found_block = prog->begin_if(found);
+  { prog->delete_record(index_cursor); }
+  prog->end_if(found_block);
+  prog->regs.pop_scope();
+}
+
+/*
+ * Indexes whose columns an UPDATE changes
+ */
+static bool index_is_updated(secondary_index &index, update_stmt *stmt) {
+  for (int32_t column : stmt->sem.column_indices) {
+    for (uint32_t i = 0; i < index.column_count; i++) {
+      if (index.columns[i] == (uint32_t)column) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+enum SEEK_STRATEGY_TYPE : uint8_t {
+  STRATEGY_FULL_SCAN,    // full table scan
+  STRATEGY_SEEK_SCAN,    // scan between a lower and/or upper key bound
+  STRATEGY_DIRECT_LOOKUP // direct key lookups (for PK with EQ or IN)
+};
+
+struct seek_strategy {
+  SEEK_STRATEGY_TYPE type;
+  COMPARISON_OP lower_op; // GT or GE
+  expr_node *lower;       // nullptr to start from the first row
+  COMPARISON_OP upper_op; // LT or LE
+  expr_node *upper;       // nullptr to run to the last row
+  array<expr_node *, query_arena> keys; // lookups, in key order
+  array<expr_node *, query_arena> predicates; // the conjuncts the seeks satisfy
+};
+
+/*
+ * The AND'ed conditions of a WHERE clause, each of which must hold for a row
+ * to match
+ */
+static void collect_conjuncts(expr_node *expr,
+                              array<expr_node *, query_arena> &conjuncts) {
+  if (expr->type == EXPR_BINARY_OP && expr->op == OP_AND) {
+    collect_conjuncts(expr->left, conjuncts);
+    collect_conjuncts(expr->right, conjuncts);
+    return;
+  }
+  conjuncts.push(expr);
+}
+
+/*
+ * 'column op literal' or 'column op ?', leaving out != which no seek can serve
+ */
+static bool is_column_comparison(expr_node *expr, int32_t column) {
+  return expr->type == EXPR_BINARY_OP && expr->op <= OP_GE &&
+         expr->op != OP_NE && expr->left->type == EXPR_COLUMN &&
+         expr->left->sem.column_index == column &&
+         is_value(expr->right);
+}
+
+static COMPARISON_OP comparison_op(BINARY_OP op) {
+  switch (op) {
+  case OP_NE:
+    return NE;
+  case OP_LT:
+    return LT;
+  case OP_LE:
+    return LE;
+  case OP_GT:
+    return GT;
+  case OP_GE:
+    return GE;
+  default:
+    return EQ;
+  }
+}
+
+/*
+ * A predicate the access path already guarantees is replaced with true,
+ * fold_true_conjuncts then drops it from the tree
+ */
+static void remove_predicate(expr_node *expr) {
+  expr->type = EXPR_LITERAL;
+  expr->lit_type = TYPE_U32;
+  expr->int_val = 1;
+}
+
+static bool is_true_literal(expr_node *expr) {
+  return expr->type == EXPR_LITERAL && expr->lit_type == TYPE_U32 &&
+         expr->int_val == 1;
+}
+
+/*
+ * Returns nullptr if nothing is left to test
+ */
+static expr_node *fold_true_conjuncts(expr_node *expr) {
+  if (!expr) {
+    return nullptr;
+  }
+
+  if (expr->type == EXPR_BINARY_OP && expr->op == OP_AND) {
+    expr_node *left = fold_true_conjuncts(expr->left);
+    expr_node *right = fold_true_conjuncts(expr->right);
+    if (!left) {
+      return right;
+    }
+    if (!right) {
+      return left;
+    }
+    expr->left = left;
+    expr->right = right;
+    return expr;
+  }
+
+  return is_true_literal(expr) ? nullptr : expr;
+}
+
+/*
+ * 'id = 1 OR id = 5 OR ...', which is what 'id IN (1, 5, ...)' parses to
+ */
+static bool collect_key_list(expr_node *expr,
+                             array<expr_node *, query_arena> &keys) {
+  if (expr->type == EXPR_BINARY_OP && expr->op == OP_OR) {
+    return collect_key_list(expr->left, keys) &&
+           collect_key_list(expr->right, keys);
+  }
+
+  // The keys are sorted to seek in order, which parameters can't be
+  if (!is_column_comparison(expr, 0) || expr->op != OP_EQ ||
+      expr->right->type != EXPR_LITERAL) {
+    return false;
+  }
+  keys.push(expr->right);
+  return true;
+}
+
+static bool literal_less(expr_node *a, expr_node *b) {
+  if (a->lit_type == TYPE_CHAR32) {
+    return a->str_val < b->str_val;
+  }
+  return a->int_val < b->int_val;
+}
+
+static bool literal_equal(expr_node *a, expr_node *b) {
+  if (a->lit_type == TYPE_CHAR32) {
+    return a->str_val == b->str_val;
+  }
+  return a->int_val == b->int_val;
+}
+
+/*
+ * Look through the AND'ed conditions for primary key comparisons. Because the
+ * table is sorted on the primary key, we can use seeks to either:
+ * - Go to the only rows that could possibly satisfy it, for example, 'WHERE
+ * user_id = 4 AND age > 30' can only be satisfied by a row with user_id 4, so
+ * seek directly to it, THEN, test the other condition(s). 'user_id IN (4, 9)'
+ * is the same, once per key.
+ * - Seek to the the first row inside the bounds, then evaluate the other
+ * conditions until the cursor passes the upper bound. If there are users with
+ * id's 1-1000, then doing 'WHERE user_id >= 900 AND user_id < 950' reduces the
+ * rows processed down to 1/20th of the original.
+ *
+ * The predicates the seeks satisfy are kept in the strategy, and removed from
+ * the tree by claim_seek_predicates once it's chosen. A second bound on the
+ * same side stays behind as an ordinary test.
+ */
+static seek_strategy analyze_where_clause(expr_node *where_clause,
+                                          relation *table) {
+  seek_strategy strategy = {};
+  strategy.type = STRATEGY_FULL_SCAN;
+
+  if (!where_clause || !table) {
+    return strategy;
+  }
+
+  array<expr_node *, query_arena> conjuncts;
+  collect_conjuncts(where_clause, conjuncts);
+
+  for (expr_node *conjunct : conjuncts) {
+    if (is_column_comparison(conjunct, 0) && conjunct->op == OP_EQ) {
+      strategy.type = STRATEGY_DIRECT_LOOKUP;
+      strategy.keys.push(conjunct->right);
+      strategy.predicates.push(conjunct);
+      return strategy;
+    }
+  }
+
+  for (expr_node *conjunct : conjuncts) {
+    array<expr_node *, query_arena> keys;
+    if (conjunct->op != OP_OR || !collect_key_list(conjunct, keys)) {
+      continue;
+    }
+
+    std::sort(keys.begin(), keys.end(), literal_less);
+    for (uint32_t i = 0; i < keys.size(); i++) {
+      if (i == 0 || !literal_equal(keys[i - 1], keys[i])) {
+        strategy.keys.push(keys[i]);
+      }
+    }
+
+    strategy.type = STRATEGY_DIRECT_LOOKUP;
+    strategy.predicates.push(conjunct);
+    return strategy;
+  }
+
+  for (expr_node *conjunct : conjuncts) {
+    if (!is_column_comparison(conjunct, 0)) {
+      continue;
+    }
+
+    bool is_lower = conjunct->op == OP_GT || conjunct->op == OP_GE;
+    expr_node *&bound = is_lower ? strategy.lower : strategy.upper;
+    if (bound) {
+      continue;
+    }
+
+    bound = conjunct->right;
+    if (is_lower) {
+      strategy.lower_op = comparison_op(conjunct->op);
+    } else {
+      strategy.upper_op = comparison_op(conjunct->op);
+    }
+    strategy.type = STRATEGY_SEEK_SCAN;
+    strategy.predicates.push(conjunct);
+  }
+
+  return strategy;
+}
+
+static void claim_seek_predicates(seek_strategy &strategy) {
+  for (expr_node *predicate : strategy.predicates) {
+    remove_predicate(predicate);
+  }
+}
+
+/*
+ * A literal as the bytes of the column type it's compared with, for a
+ * parameter the buffer it's bound into
+ */
+static uint8_t *literal_value(expr_node *expr) {
+  if (expr->type == EXPR_PARAMETER) {
+    return parameter_value(expr);
+  }
+
+  data_type type = expr->sem.resolved_type;
+  uint32_t size = type_size(type);
+  uint8_t *value = (uint8_t *)arena<query_arena>::alloc(size);
+  memset(value, 0, size);
+
+  if (expr->lit_type == TYPE_CHAR32) {
+    memcpy(value, expr->str_val.data(),
+           std::min<size_t>(expr->str_val.size(), size));
+  } else {
+    assert(size == sizeof(uint32_t));
+    memcpy(value, &expr->int_val, sizeof(uint32_t));
+  }
+  return value;
+}
+
+/*
+ * Hands the 'column op literal' conditions of a scan's WHERE clause to its
+ * cursor, which tests them inside the leaves (see OP_Scan), so rows that fail
+ * never reach the program. Whatever else there is stays in the WHERE.
+ *
+ * In a join only the conditions on the scanned table, table_index, are taken.
+ */
+static scan_filter *push_down_filter(expr_node **where_clause,
+                                     uint32_t table_index = 0) {
+  if (!*where_clause) {
+    return nullptr;
+  }
+
+  array<expr_node *, query_arena> conjuncts;
+  collect_conjuncts(*where_clause, conjuncts);
+
+  scan_filter *filter = nullptr;
+  for (expr_node *conjunct : conjuncts) {
+    if (conjunct->type != EXPR_BINARY_OP || conjunct->op > OP_GE ||
+        conjunct->left->type != EXPR_COLUMN ||
+        conjunct->left->sem.table_index != table_index ||
+        !is_value(conjunct->right) ||
+        (conjunct->right->type == EXPR_LITERAL &&
+         conjunct->right->lit_type == TYPE_NULL)) {
+      continue;
+    }
+
+    if (!filter) {
+      filter = (scan_filter *)arena<query_arena>::alloc(sizeof(scan_filter));
+      filter->term_count = 0;
+      filter->has_stop = false;
+    }
+    if (filter->term_count == SCAN_FILTER_MAX_TERMS) {
+      break;
+    }
+
+    scan_term &term = filter->terms[filter->term_count++];
+    term.column = conjunct->left->sem.column_index;
+    term.op = comparison_op(conjunct->op);
+    term.value = literal_value(conjunct->right);
+    term.kernel =
+        type_test_kernel_for(term.op, conjunct->left->sem.resolved_type);
+    remove_predicate(conjunct);
+  }
+
+  *where_clause = fold_true_conjuncts(*where_clause);
+  return filter;
+}
+
+/*
+ * Where a scan is, for the row callback of compile_key_scan
+ */
+struct key_scan {
+  int cursor;
+  int at_end;    // the loop's register
+  bool filtered; // the cursor has a scan_filter, step with OP_Scan
+};
+
+static void step_key_scan(program_builder *prog, key_scan *scan) {
+  if (scan->filtered) {
+    prog->scan(scan->cursor, scan->at_end);
+  } else {
+    prog->next(scan->cursor, scan->at_end);
+  }
+}
+
+/*
+ * Visits the rows a seek_strategy selects, with the cursor on each in turn.
+ * For a scan, row gets the scan's state and must step the cursor itself,
+ * either with step_key_scan or by a delete leaving it on the successor. For
+ * each direct lookup it gets nullptr and there is nothing to step.
+ *
+ * filter is the cursor's scan_filter, if it has one, the upper bound then
+ * becomes its stop condition.
+ */
+template <typename row_body>
+static void compile_key_scan(program_builder *prog, int cursor,
+                             seek_strategy &strategy, scan_filter *filter,
+                             row_body row) {
+  if (strategy.type == STRATEGY_DIRECT_LOOKUP) {
+    assert(!filter && "Lookups don't step, so can't filter");
+    for (expr_node *key : strategy.keys) {
+      prog->regs.push_scope();
+
+      int key_reg = compile_literal(prog, key);
+      int found = prog->seek(cursor, key_reg, EQ);
+
+      auto found_block = prog->begin_if(found);
+      { row(nullptr); }
+      prog->end_if(found_block);
+
+      prog->regs.pop_scope();
+    }
+    return;
+  }
+
+  int at_end;
+  if (strategy.lower) {
+    int key_reg = compile_literal(prog, strategy.lower);
+    // seek returns 1 if found, 0 if not. For a range scan
+    // not found means we're at the end of the table
+    at_end = prog->seek(cursor, key_reg, strategy.lower_op);
+  } else {
+    // start from beginning
+    at_end = prog->first(cursor);
+  }
+
+  int upper_reg = -1;
+  if (filter) {
+    if (strategy.upper) {
+      filter->has_stop = true;
+      filter->stop = {0, strategy.upper_op, literal_value(strategy.upper),
+                      type_test_kernel_for(strategy.upper_op,
+                                           strategy.upper->sem.resolved_type)};
+    }
+    prog->scan(cursor, at_end, true);
+  } else if (strategy.upper) {
+    upper_reg = compile_literal(prog, strategy.upper);
+  }
+
+  key_scan scan = {cursor, at_end, filter != nullptr};
+
+  auto scan_loop = prog->begin_while(at_end);
+  {
+    prog->regs.push_scope();
+
+    // rows are in key order, so the first past the upper bound ends it
+    if (upper_reg >= 0) {
+      int key = prog->get_column(cursor, 0);
+      int in_range = prog->typed_test(key, upper_reg, strategy.upper_op,
+                                      strategy.upper->sem.resolved_type);
+      prog->jumpif(in_range, scan_loop.end_label, false);
+    }
+
+    row(&scan);
+
+    prog->regs.pop_scope();
+  }
+  prog->end_while(scan_loop);
+}
+
+struct index_strategy {
+  secondary_index *index; // nullptr for no usable index
+  COMPARISON_OP op;       // EQ, GT or GE, against key_expr
+  expr_node *key_expr;    // nullptr to start from the first entry
+  expr_node *predicate;
+  COMPARISON_OP upper_op; // LT or LE
+  expr_node *upper;       // nullptr to run to the last entry
+  expr_node *upper_predicate;
+};
+
+/*
+ * Without a primary key condition, look through the AND'ed conditions for a
+ * comparison of an index's leading column with a literal, an equality being
+ * the most selective. A range then takes the tightest bounds it can find on
+ * both sides. With only, that index is the only one looked at.
+ */
+static void find_index_predicate(expr_node *where_clause, relation *table,
+                                 index_strategy *best,
+                                 secondary_index *only = nullptr) {
+  if (!where_clause) {
+    return;
+  }
+
+  array<expr_node *, query_arena> conjuncts;
+  collect_conjuncts(where_clause, conjuncts);
+
+  expr_node *chosen = nullptr;
+  for (expr_node *conjunct : conjuncts) {
+    if (conjunct->type != EXPR_BINARY_OP ||
+        conjunct->left->type != EXPR_COLUMN ||
+        !is_column_comparison(conjunct, conjunct->left->sem.column_index)) {
+      continue;
+    }
+    if (chosen && (chosen->op == OP_EQ || conjunct->op != OP_EQ)) {
+      continue;
+    }
+
+    for (auto &index : table->indexes) {
+      if (index.columns[0] == (uint32_t)conjunct->left->sem.column_index &&
+          (!only || only == &index)) {
+        best->index = &index;
+        chosen = conjunct;
+        break;
+      }
+    }
+  }
+
+  if (!chosen) {
+    return;
+  }
+
+  if (chosen->op == OP_EQ) {
+    best->op = EQ;
+    best->key_expr = chosen->right;
+    best->predicate = chosen;
+    return;
+  }
+
+  int32_t column = chosen->left->sem.column_index;
+  for (expr_node *conjunct : conjuncts) {
+    if (!is_column_comparison(conjunct, column)) {
+      continue;
+    }
+
+    if (conjunct->op == OP_GT || conjunct->op == OP_GE) {
+      if (!best->key_expr) {
+        best->op = comparison_op(conjunct->op);
+        best->key_expr = conjunct->right;
+        best->predicate = conjunct;
+      }
+    } else if (!best->upper) {
+      best->upper_op = comparison_op(conjunct->op);
+      best->upper = conjunct->right;
+      best->upper_predicate = conjunct;
+    }
+  }
+}
+
+/*
+ * Costs, for a table with stats (see stats.hpp), in pages read. A scan reads
+ * each page it covers once, a seek a page per level of the tree, and each
+ * entry an index scan finds one more to look its row up in the table, whose
+ * upper levels are taken to be cached.
+ */
+
+/* nullptr for a value that isn't known until the statement runs */
+static const void *known_value(expr_node *expr) {
+  if (!expr || expr->type == EXPR_PARAMETER ||
+      (expr->type == EXPR_LITERAL && expr->lit_type == TYPE_NULL)) {
+    return nullptr;
+  }
+  return literal_value(expr);
+}
+
+/*
+ * The share of the table's rows whose column lies between lower and upper,
+ * either nullptr for no bound on that side
+ */
+static double range_selectivity(relation *table, int32_t column,
+                                expr_node *lower, expr_node *upper) {
+  double selectivity =
+      stats_range_selectivity(table->stats, column, table->columns[column].type,
+                              known_value(lower), known_value(upper));
+  if (lower && !known_value(lower)) {
+    selectivity *= STATS_DEFAULT_RANGE;
+  }
+  if (upper && !known_value(upper)) {
+    selectivity *= STATS_DEFAULT_RANGE;
+  }
+  return selectivity;
+}
+
+static double seek_cost(relation *table, seek_strategy &strategy) {
+  table_stats *stats = table->stats;
+  switch (strategy.type) {
+  case STRATEGY_DIRECT_LOOKUP:
+    return (double)strategy.keys.size() * stats->height;
+  case STRATEGY_SEEK_SCAN:
+    return stats->height + stats->pages * range_selectivity(table, 0,
+                                                            strategy.lower,
+                                                            strategy.upper);
+  default:
+    return stats->pages;
+  }
+}
+
+static double index_cost(relation *table, index_strategy &strategy) {
+  table_stats *stats = table->stats;
+  int32_t column = strategy.index->columns[0];
+  double selectivity =
+      strategy.key_expr && strategy.op == EQ
+          ? stats_equal_selectivity(stats, column)
+          : range_selectivity(table, column, strategy.key_expr, strategy.upper);
+  return stats->height + selectivity * stats->rows;
+}
+
+/*
+ * For an analyzed table, whichever of the primary key strategy, an index
+ * scan on each index the WHERE can use, or a full scan is cheapest. The
+ * primary key strategy is a full scan when it's beaten by an index. Returns
+ * the chosen path's cost.
+ */
+static double choose_access_path(expr_node *where_clause, relation *table,
+                                 seek_strategy &strategy,
+                                 index_strategy &best) {
+  double cost = seek_cost(table, strategy);
+  for (auto &index : table->indexes) {
+    index_strategy candidate = {};
+    find_index_predicate(where_clause, table, &candidate, &index);
+    if (!candidate.index) {
+      continue;
+    }
+
+    double candidate_cost = index_cost(table, candidate);
+    if (candidate_cost < cost) {
+      cost = candidate_cost;
+      best = candidate;
+    }
+  }
+
+  if (best.index) {
+    strategy = {};
+    strategy.type = STRATEGY_FULL_SCAN;
+  }
+  return cost;
+}
+
+/*
+ * Roughly how many of the table's rows pass the 'column op value' conditions
+ * on it, table_index in a join
+ */
+static double filtered_rows(relation *table, expr_node *where_clause,
+                            uint32_t table_index) {
+  table_stats *stats = table->stats;
+  double rows = stats->rows;
+  if (!where_clause) {
+    return rows;
+  }
+
+  array<expr_node *, query_arena> conjuncts;
+  collect_conjuncts(where_clause, conjuncts);
+  for (expr_node *conjunct : conjuncts) {
+    if (conjunct->type != EXPR_BINARY_OP || conjunct->op > OP_GE ||
+        conjunct->left->type != EXPR_COLUMN ||
+        conjunct->left->sem.table_index != table_index ||
+        !is_value(conjunct->right)) {
+      continue;
+    }
+
+    int32_t column = conjunct->left->sem.column_index;
+    switch (conjunct->op) {
+    case OP_EQ:
+      rows *= stats_equal_selectivity(stats, column);
+      break;
+    case OP_NE:
+      rows *= 1.0 - stats_equal_selectivity(stats, column);
+      break;
+    case OP_LT:
+    case OP_LE:
+      rows *= range_selectivity(table, column, nullptr, conjunct->right);
+      break;
+    default:
+      rows *= range_selectivity(table, column, conjunct->right, nullptr);
+      break;
+    }
+  }
+  return rows;
+}
+
+/*
+ * EXPLAIN's account of the plan, a line for each choice the compiler made,
+ * see stmt_node::plan
+ */
+static void plan_note(stmt_node *stmt, const char *format, ...) {
+  char line[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+
+  size_t length = strlen(line) + 1;
+  char *copy = (char *)arena<query_arena>::alloc(length);
+  memcpy(copy, line, length);
+  stmt->plan.push(copy);
+}
+
+static void value_text(char *out, size_t size, expr_node *expr) {
+  if (expr->type == EXPR_PARAMETER) {
+    snprintf(out, size, "?");
+  } else if (expr->type != EXPR_LITERAL) {
+    snprintf(out, size, "<expr>");
+  } else if (expr->lit_type == TYPE_U32) {
+    snprintf(out, size, "%u", expr->int_val);
+  } else if (expr->lit_type == TYPE_NULL) {
+    snprintf(out, size, "NULL");
+  } else {
+    snprintf(out, size, "'%.*s'", (int)expr->str_val.size(),
+             expr->str_val.data());
+  }
+}
+
+/*
+ * 'column > lower AND column <= upper', either bound nullptr for none
+ */
+static void range_text(char *out, size_t size, const char *column,
+                       COMPARISON_OP lower_op, expr_node *lower,
+                       COMPARISON_OP upper_op, expr_node *upper) {
+  const char *ops[] = {"=", "!=", "<", "<=", ">", ">="};
+  char lower_value[80], upper_value[80];
+  if (lower) {
+    value_text(lower_value, sizeof(lower_value), lower);
+  }
+  if (upper) {
+    value_text(upper_value, sizeof(upper_value), upper);
+  }
+
+  if (lower && upper) {
+    snprintf(out, size, "%s %s %s AND %s %s %s", column, ops[lower_op],
+             lower_value, column, ops[upper_op], upper_value);
+  } else if (lower) {
+    snprintf(out, size, "%s %s %s", column, ops[lower_op], lower_value);
+  } else if (upper) {
+    snprintf(out, size, "%s %s %s", column, ops[upper_op], upper_value);
+  } else {
+    snprintf(out, size, "%s", column);
+  }
+}
+
+static void plan_seek(stmt_node *stmt, relation *table,
+                      seek_strategy &strategy) {
+  const char *key = table->columns[0].name;
+  char range[256];
+  switch (strategy.type) {
+  case STRATEGY_DIRECT_LOOKUP:
+    if (strategy.keys.size() == 1) {
+      range_text(range, sizeof(range), key, EQ, strategy.keys[0], EQ,
+                 nullptr);
+    } else {
+      snprintf(range, sizeof(range), "%s IN %u keys", key,
+               strategy.keys.size());
+    }
+    plan_note(stmt, "SEARCH %s USING PRIMARY KEY (%s)", table->name, range);
+    break;
+  case STRATEGY_SEEK_SCAN:
+    range_text(range, sizeof(range), key, strategy.lower_op, strategy.lower,
+               strategy.upper_op, strategy.upper);
+    plan_note(stmt, "SEARCH %s USING PRIMARY KEY (%s)", table->name, range);
+    break;
+  default:
+    plan_note(stmt, "SCAN %s", table->name);
+    break;
+  }
+}
+
+static void plan_index(stmt_node *stmt, relation *table,
+                       index_strategy &strategy) {
+  char range[256];
+  range_text(range, sizeof(range),
+             table->columns[strategy.index->columns[0]].name, strategy.op,
+             strategy.key_expr, strategy.upper_op, strategy.upper);
+  plan_note(stmt, "SEARCH %s USING INDEX %s (%s)", table->name,
+            strategy.index->name, range);
+}
+
+static void plan_filter(stmt_node *stmt, relation *table,
+                        scan_filter *filter) {
+  if (filter && filter->term_count > 0) {
+    plan_note(stmt, "FILTER %s ON %u condition%s, tested in the leaves",
+              table->name, filter->term_count,
+              filter->term_count == 1 ? "" : "s");
+  }
+}
+
+/*
+ * Whether every column an expression reads has a register in column_regs
+ */
+static bool expr_columns_available(expr_node *expr, int *column_regs) {
+  if (!expr) {
+    return true;
+  }
+
+  switch (expr->type) {
+  case EXPR_COLUMN:
+    return column_regs[expr->sem.column_index] >= 0;
+  case EXPR_BINARY_OP:
+    return expr_columns_available(expr->left, column_regs) &&
+           expr_columns_available(expr->right, column_regs);
+  case EXPR_UNARY_OP:
+    return expr_columns_available(expr->operand, column_regs);
+  default:
+    return true;
+  }
+}
+
+static int load_column(program_builder *prog, int cursor_id, int *column_regs,
+                       int col_index, int dest_reg, bool by_reference = false) {
+  if (column_regs && column_regs[col_index] >= 0) {
+    return prog->move(column_regs[col_index], dest_reg);
+  }
+  return prog->get_column(cursor_id, col_index, dest_reg, by_reference);
+}
+
+static void load_select_column(program_builder *prog, int table_cursor,
+                               int *column_regs, join_source *sources,
+                               uint32_t table_index, int col_index,
+                               int dest_reg) {
+  if (sources) {
+    join_source &source = sources[table_index];
+    prog->get_column(source.cursor, col_index + source.column_offset,
+                     dest_reg, true);
+    return;
+  }
+  load_column(prog, table_cursor, column_regs, col_index, dest_reg, true);
+}
+
+/*
+ * LIMIT and OFFSET, counted down in registers as rows are output. Once the
+ * last row the LIMIT allows is out, the program jumps to done_label, which
+ * follows the loop the rows come from.
+ */
+struct row_limit {
+  int remaining_reg; // -1 without a LIMIT
+  int skip_reg;      // -1 without an OFFSET
+  int zero_reg;
+  int one_reg;
+  const char *done_label;
+};
+
+static row_limit load_row_limit(program_builder *prog, uint32_t count,
+                                uint32_t offset) {
+  row_limit limit = {-1, -1, -1, -1, nullptr};
+  limit.done_label = prog->unique_label();
+  limit.zero_reg = prog->load(TYPE_U32, 0U);
+  limit.one_reg = prog->load(TYPE_U32, 1U);
+  limit.remaining_reg = prog->load(TYPE_U32, count);
+  if (offset > 0) {
+    limit.skip_reg = prog->load(TYPE_U32, offset);
+  }
+
+  if (count == 0) {
+    prog->jump_to(limit.done_label);
+  }
+  return limit;
+}
+
+static row_limit compile_row_limit(program_builder *prog,
+                                   select_stmt *select_stmt) {
+  if (!select_stmt->has_limit) {
+    return {-1, -1, -1, -1, nullptr};
+  }
+  return load_row_limit(prog, select_stmt->limit, select_stmt->offset);
+}
+
+static void limited_result(program_builder *prog, row_limit *limit,
+                           int first_reg, int reg_count) {
+  if (!limit || limit->remaining_reg < 0) {
+    prog->result(first_reg, reg_count);
+    return;
+  }
+
+  conditional_context skip_ctx;
+  if (limit->skip_reg >= 0) {
+    int skipping = prog->typed_test(limit->skip_reg, limit->zero_reg, GT,
+                                    TYPE_U32);
+    skip_ctx = prog->begin_if(skipping);
+    prog->typed_arithmetic(limit->skip_reg, limit->one_reg, ARITH_SUB,
+                           TYPE_U32, limit->skip_reg);
+    prog->begin_else(skip_ctx);
+  }
+
+  prog->result(first_reg, reg_count);
+  prog->typed_arithmetic(limit->remaining_reg, limit->one_reg, ARITH_SUB,
+                         TYPE_U32, limit->remaining_reg);
+  int done = prog->typed_test(limit->remaining_reg, limit->zero_reg, EQ,
+                              TYPE_U32);
+  prog->jumpif(done, limit->done_label, true);
+
+  if (limit->skip_reg >= 0) {
+    prog->end_if(skip_ctx);
+  }
+}
+
+/*
+ * The smallest value of a key type, e.g. the primary key an index entry for
+ * a value sorts after
+ */
+static int load_lowest_key(program_builder *prog, data_type key_type) {
+  if (type_is_string(key_type)) {
+    return prog->load_string(key_type, "", 0);
+  }
+  return prog->load(key_type, 0U);
+}
+
+/*
+ * GROUP BY and aggregates. A group's state is a column per aggregate term,
+ * see aggregate_spec, an AVG being a SUM and a COUNT divided on the way out.
+ *
+ * Rows that arrive grouped, one group's after another, are folded into
+ * registers as they stream past, each group output once the first row of
+ * the next arrives. That's the case when there's no GROUP BY, one group of
+ * everything, when grouping by the primary key, every row a group of its
+ * own, and when an index on the GROUP BY column is being scanned.
+ *
+ * Otherwise the rows go through OP_AggStep into a hash table holding a row
+ * per group, which is read back once every row is in.
+ *
+ * A partial group is a parallel scan worker's, output as its key and raw
+ * state, and merged with the other workers' by the gathering program.
+ */
+struct group_state {
+  aggregate_spec *spec; // the hash cursor's, in the query arena
+  int32_t *first_term; // of each output column, -1 for the group key
+  uint32_t arg_count;  // row values OP_AggStep takes after the key
+  data_type key_type;
+  int hash_cursor; // -1 when streaming
+
+  // Streaming, the group being accumulated
+  int key_reg;
+  int state_reg; // a register per term
+  int started_reg;
+  int one_reg;
+
+  // Where the groups go
+  int rb_cursor;
+  row_limit *limit;
+  bool partial;
+};
+
+static group_state open_group(program_builder *prog, select_stmt *select_stmt,
+                              relation **tables, bool streamed, int rb_cursor,
+                              row_limit *limit, bool partial = false) {
+  group_state group = {};
+  group.partial = partial;
+  group.rb_cursor = rb_cursor;
+  group.limit = limit;
+  group.key_type = TYPE_U32;
+  if (select_stmt->sem.group_by_index >= 0) {
+    group.key_type = tables[select_stmt->sem.group_by_table]
+                         ->columns[select_stmt->sem.group_by_index]
+                         .type;
+  }
+
+  uint32_t column_count = select_stmt->columns.size();
+  group.first_term =
+      (int32_t *)arena<query_arena>::alloc(sizeof(int32_t) * column_count);
+  aggregate_spec *spec =
+      (aggregate_spec *)arena<query_arena>::alloc(sizeof(aggregate_spec));
+  spec->term_count = 0;
+  spec->terms = (aggregate_term *)arena<query_arena>::alloc(
+      sizeof(aggregate_term) * column_count * 2);
+  group.spec = spec;
+
+  auto add_term = [&](AGGREGATE_OP op, data_type type, int32_t arg) {
+    spec->terms[spec->term_count++] = {op, type, arg, 0};
+  };
+
+  for (uint32_t i = 0; i < column_count; i++) {
+    AGGREGATE_FUNCTION aggregate = select_stmt->column_aggregates[i];
+    group.first_term[i] = aggregate == AGG_NONE ? -1 : spec->term_count;
+
+    int32_t arg = -1;
+    if (aggregate != AGG_NONE && aggregate != AGG_COUNT) {
+      arg = group.arg_count++;
+    }
+
+    switch (aggregate) {
+    case AGG_NONE:
+      break;
+    case AGG_COUNT:
+      add_term(AGGREGATE_COUNT, TYPE_U32, -1);
+      break;
+    case AGG_SUM:
+      add_term(AGGREGATE_SUM, TYPE_U32, arg);
+      break;
+    case AGG_AVG:
+      add_term(AGGREGATE_SUM, TYPE_U32, arg);
+      add_term(AGGREGATE_COUNT, TYPE_U32, -1);
+      break;
+    case AGG_MIN:
+      add_term(AGGREGATE_MIN, select_stmt->sem.column_types[i], arg);
+      break;
+    case AGG_MAX:
+      add_term(AGGREGATE_MAX, select_stmt->sem.column_types[i], arg);
+      break;
+    }
+  }
+
+  if (!streamed) {
+    // [group key][state]
+    array<data_type, query_arena> state_types;
+    state_types.push(group.key_type);
+    for (uint32_t t = 0; t < spec->term_count; t++) {
+      state_types.push(spec->terms[t].type);
+    }
+    tuple_format layout = tuple_format_from_types(state_types);
+    for (uint32_t t = 0; t < spec->term_count; t++) {
+      spec->terms[t].offset = layout.offsets[t];
+    }
+
+    group.hash_cursor =
+        prog->open_cursor(hash_cursor_from_format(layout, spec));
+    return group;
+  }
+
+  group.hash_cursor = -1;
+  group.key_reg = load_lowest_key(prog, group.key_type);
+  group.state_reg = prog->regs.allocate_range(spec->term_count);
+  group.started_reg = prog->load(TYPE_U32, 0U);
+  group.one_reg = prog->load(TYPE_U32, 1U);
+  return group;
+}
+
+/*
+ * Outputs a group from its key and state registers, or adds it to the
+ * ORDER BY sort, keyed on the group key
+ */
+static void compile_group_result(program_builder *prog,
+                                 select_stmt *select_stmt, group_state *group,
+                                 int key_reg, int state_reg) {
+  if (group->partial) {
+    uint32_t term_count = group->spec->term_count;
+    int result_start = prog->regs.allocate_range(term_count + 1);
+    prog->move(key_reg, result_start);
+    for (uint32_t t = 0; t < term_count; t++) {
+      prog->move(state_reg + t, result_start + 1 + t);
+    }
+    prog->result(result_start, term_count + 1);
+    return;
+  }
+
+  bool has_order_by = group->rb_cursor >= 0;
+  uint32_t column_count = select_stmt->columns.size();
+  uint32_t offset = has_order_by ? 1 : 0;
+  int result_start = prog->regs.allocate_range(column_count + offset);
+
+  if (has_order_by) {
+    prog->move(key_reg, result_start);
+  }
+
+  for (uint32_t i = 0; i < column_count; i++) {
+    int dest = result_start + offset + i;
+    int32_t term = group->first_term[i];
+    if (term < 0) {
+      prog->move(key_reg, dest);
+    } else if (select_stmt->column_aggregates[i] == AGG_AVG) {
+      prog->typed_arithmetic(state_reg + term, state_reg + term + 1,
+                             ARITH_DIV, TYPE_U32, dest);
+    } else {
+      prog->move(state_reg + term, dest);
+    }
+  }
+
+  if (has_order_by) {
+    prog->insert_record(group->rb_cursor, result_start, column_count + 1);
+  } else {
+    limited_result(prog, group->limit, result_start, column_count);
+  }
+}
+
+/*
+ * Folds the row's values into the streamed group's state, or starts it with
+ * them
+ */
+static void compile_stream_step(program_builder *prog, group_state *group,
+                                int row_reg, bool starting) {
+  for (uint32_t t = 0; t < group->spec->term_count; t++) {
+    aggregate_term &term = group->spec->terms[t];
+    int state = group->state_reg + t;
+    int value = term.arg >= 0 ? row_reg + 1 + term.arg : group->one_reg;
+
+    if (starting) {
+      prog->move(value, state);
+      continue;
+    }
+
+    switch (term.op) {
+    case AGGREGATE_COUNT:
+    case AGGREGATE_SUM:
+      prog->typed_arithmetic(state, value, ARITH_ADD, TYPE_U32, state);
+      break;
+    case AGGREGATE_MIN:
+    case AGGREGATE_MAX: {
+      COMPARISON_OP op = term.op == AGGREGATE_MIN ? LT : GT;
+      int better = prog->typed_test(value, state, op, term.type);
+      auto replace = prog->begin_if(better);
+      prog->move(value, state);
+      prog->end_if(replace);
+      break;
+    }
+    }
+  }
+}
+
+static void compile_group_fold(program_builder *prog, select_stmt *select_stmt,
+                               group_state *group, int row);
+
+/*
+ * The per row part of an aggregate, after the filter: the group key then the
+ * aggregates' values are loaded as the [key][values] OP_AggStep takes
+ */
+static void compile_group_row(program_builder *prog, select_stmt *select_stmt,
+                              group_state *group, int table_cursor,
+                              int *column_regs, join_source *sources) {
+  int row = prog->regs.allocate_range(group->arg_count + 1);
+  bool grouped = select_stmt->sem.group_by_index >= 0;
+  if (grouped) {
+    load_select_column(prog, table_cursor, column_regs, sources,
+                       select_stmt->sem.group_by_table,
+                       select_stmt->sem.group_by_index, row);
+  }
+
+  for (uint32_t i = 0; i < select_stmt->columns.size(); i++) {
+    int32_t term = group->first_term[i];
+    if (term >= 0 && group->spec->terms[term].arg >= 0) {
+      load_select_column(prog, table_cursor, column_regs, sources,
+                         select_stmt->sem.column_tables[i],
+                         select_stmt->sem.column_indices[i],
+                         row + 1 + group->spec->terms[term].arg);
+    }
+  }
+
+  compile_group_fold(prog, select_stmt, group, row);
+}
+
+/*
+ * Folds a [key][values] row into its group, the key and values in registers
+ * from row on
+ */
+static void compile_group_fold(program_builder *prog, select_stmt *select_stmt,
+                               group_state *group, int row) {
+  if (group->hash_cursor >= 0) {
+    prog->aggregate_step(group->hash_cursor, row);
+    return;
+  }
+
+  // The group ends at the first row with another key
+  bool grouped = select_stmt->sem.group_by_index >= 0;
+  if (grouped) {
+    int other_key = prog->typed_test(row, group->key_reg, NE, group->key_type);
+    int ends = prog->logic_and(group->started_reg, other_key);
+    auto end_block = prog->begin_if(ends);
+    compile_group_result(prog, select_stmt, group, group->key_reg,
+                         group->state_reg);
+    prog->load(TYPE_U32, 0U, group->started_reg);
+    prog->end_if(end_block);
+  }
+
+  auto started = prog->begin_if(group->started_reg);
+  compile_stream_step(prog, group, row, false);
+  prog->begin_else(started);
+  compile_stream_step(prog, group, row, true);
+  if (grouped) {
+    prog->move(row, group->key_reg);
+  }
+  prog->load(TYPE_U32, 1U, group->started_reg);
+  prog->end_if(started);
+}
+
+/*
+ * Once every row has been through, the groups that haven't been output are.
+ * Without a GROUP BY there's a row even for no rows: counts and sums of
+ * nothing are 0, the rest NULL.
+ */
+static void compile_group_output(program_builder *prog,
+                                 select_stmt *select_stmt,
+                                 group_state *group) {
+  if (group->hash_cursor < 0) {
+    auto started = prog->begin_if(group->started_reg);
+    compile_group_result(prog, select_stmt, group, group->key_reg,
+                         group->state_reg);
+    if (select_stmt->sem.group_by_index < 0 && !group->partial) {
+      prog->begin_else(started);
+
+      uint32_t column_count = select_stmt->columns.size();
+      int result_start = prog->regs.allocate_range(column_count);
+      for (uint32_t i = 0; i < column_count; i++) {
+        AGGREGATE_FUNCTION aggregate = select_stmt->column_aggregates[i];
+        if (aggregate == AGG_COUNT || aggregate == AGG_SUM) {
+          prog->load(TYPE_U32, 0U, result_start + i);
+        } else {
+          prog->load_from(TYPE_NULL, nullptr, result_start + i);
+        }
+      }
+      limited_result(prog, group->limit, result_start, column_count);
+    }
+    prog->end_if(started);
+    return;
+  }
+
+  // A pass of groups at a time, see hashtable.hpp
+  int more = prog->first(group->hash_cursor);
+  auto pass_loop = prog->begin_while(more);
+  {
+    auto group_loop = prog->begin_while(more);
+    {
+      prog->regs.push_scope();
+      int key_reg = prog->get_column(group->hash_cursor, 0, -1, true);
+      int state_reg = prog->get_columns(group->hash_cursor, 1,
+                                        group->spec->term_count, -1, true);
+      compile_group_result(prog, select_stmt, group, key_reg, state_reg);
+      prog->next(group->hash_cursor, more);
+      prog->regs.pop_scope();
+    }
+    prog->end_while(group_loop);
+
+    prog->first(group->hash_cursor, more);
+  }
+  prog->end_while(pass_loop);
+}
+
+/*
+ * The per row part of a SELECT: filter, then either output the row or add it
+ * to the ORDER BY sort. Both copy the row out before anything can change it,
+ * so its columns are read by reference.
+ *
+ * For a join, sources says where each table's columns are. With a group, the
+ * row goes into it instead, the group having its own sort and limit. Keyed,
+ * the row is output as it would be sorted, the ORDER BY column first.
+ */
+static void compile_select_row(program_builder *prog, select_stmt *select_stmt,
+                               int table_cursor, int *column_regs,
+                               int rb_cursor, row_limit *limit,
+                               join_source *sources = nullptr,
+                               group_state *group = nullptr,
+                               bool keyed = false) {
+  bool has_order_by = rb_cursor >= 0 || keyed;
+  int result_count = select_stmt->sem.column_indices.size();
+  if (has_order_by) {
+    result_count++;
+  }
+
+  conditional_context where_ctx;
+  if (select_stmt->where_clause) {
+    int where_result = compile_expr(prog, select_stmt->where_clause,
+                                    table_cursor, column_regs, sources);
+    where_ctx = prog->begin_if(where_result);
+  }
+
+  if (group) {
+    compile_group_row(prog, select_stmt, group, table_cursor, column_regs,
+                      sources);
+    if (select_stmt->where_clause) {
+      prog->end_if(where_ctx);
+    }
+    return;
+  }
+
+  int result_start = prog->regs.allocate_range(result_count);
+
+  if (has_order_by) {
+    load_select_column(prog, table_cursor, column_regs, sources,
+                       select_stmt->sem.order_by_table,
+                       select_stmt->sem.order_by_index, result_start);
+  }
+
+  uint32_t offset = has_order_by ? 1 : 0;
+  for (uint32_t i = 0; i < result_count - offset; i++) {
+    load_select_column(prog, table_cursor, column_regs, sources,
+                       select_stmt->sem.column_tables[i],
+                       select_stmt->sem.column_indices[i],
+                       result_start + offset + i);
+  }
+
+  if (rb_cursor >= 0) {
+    prog->insert_record(rb_cursor, result_start, result_count);
+  } else {
+    limited_result(prog, limit, result_start, result_count);
+  }
+
+  if (select_stmt->where_clause) {
+    prog->end_if(where_ctx);
+  }
+}
+
+/*
+ * Scan an index from the first entry that can satisfy the condition, ending
+ * at the first that can't. Entries are ordered by (column, primary key), so
+ * seeking (value, smallest key) finds the first entry for a value.
+ *
+ * 'WHERE city = 'Paris'' on an index over (city):
+ *   seek >= ('Paris', 0), then step while city = 'Paris'
+ * 'WHERE age >= 30 AND age < 40' on an index over (age):
+ *   seek >= (30, 0), then step while age < 40
+ *
+ * The columns the entry holds are unpacked into registers. Only if the query
+ * needs any other column is the table row looked up by its primary key.
+ */
+static void compile_index_scan(program_builder *prog, select_stmt *select_stmt,
+                               relation *table, int table_cursor,
+                               index_strategy &strategy, int rb_cursor,
+                               row_limit *limit, group_state *group) {
+  secondary_index &index = *strategy.index;
+  int index_cursor =
+      prog->open_cursor(btree_cursor_from_index(*table, index));
+
+  int value_reg = -1;
+  int at_end;
+  if (strategy.key_expr) {
+    value_reg = compile_literal(prog, strategy.key_expr);
+    int lowest_key = load_lowest_key(prog, table->columns[0].type);
+    int seek_key = prog->pack2(value_reg, lowest_key);
+    at_end = prog->seek(index_cursor, seek_key, GE);
+  } else {
+    at_end = prog->first(index_cursor);
+  }
+
+  int upper_reg = -1;
+  if (strategy.upper) {
+    upper_reg = compile_literal(prog, strategy.upper);
+    remove_predicate(strategy.upper_predicate);
+  }
+
+  // The bounds of '<', '<=', '=' and '>=' are exact, '>' still needs testing
+  // for entries equal to the value
+  if (strategy.key_expr && strategy.op != GT) {
+    remove_predicate(strategy.predicate);
+  }
+  select_stmt->where_clause = fold_true_conjuncts(select_stmt->where_clause);
+
+  auto scan_loop = prog->begin_while(at_end);
+  {
+    prog->regs.push_scope();
+
+    int entry_key = prog->get_column(index_cursor, 0);
+    int fields = prog->regs.allocate_range(2);
+    prog->unpack2(entry_key, fields);
+
+    if (strategy.key_expr && strategy.op == EQ) {
+      int in_range = prog->typed_test(fields, value_reg, EQ,
+                                      strategy.key_expr->sem.resolved_type);
+      prog->jumpif(in_range, scan_loop.end_label, false);
+    }
+    if (strategy.upper) {
+      int in_range = prog->typed_test(fields, upper_reg, strategy.upper_op,
+                                      strategy.upper->sem.resolved_type);
+      prog->jumpif(in_range, scan_loop.end_label, false);
+    }
+
+    int *column_regs = (int *)arena<query_arena>::alloc(
+        sizeof(int) * table->columns.size());
+    for (uint32_t i = 0; i < table->columns.size(); i++) {
+      column_regs[i] = -1;
+    }
+    column_regs[index.columns[0]] = fields;
+    column_regs[0] = fields + 1;
+    if (index.column_count > 1) {
+      column_regs[index.columns[1]] = prog->get_column(index_cursor, 1);
+    }
+
+    bool index_only =
+        expr_columns_available(select_stmt->where_clause, column_regs);
+    for (int32_t column : select_stmt->sem.column_indices) {
+      index_only = index_only && (column < 0 || column_regs[column] >= 0);
+    }
+    if (rb_cursor >= 0) {
+      index_only =
+          index_only && column_regs[select_stmt->sem.order_by_index] >= 0;
+    }
+    if (select_stmt->sem.group_by_index >= 0) {
+      index_only =
+          index_only && column_regs[select_stmt->sem.group_by_index] >= 0;
+    }
+
+    if (!index_only) {
+      prog->seek(table_cursor, fields + 1, EQ);
+    }
+
+    compile_select_row(prog, select_stmt, table_cursor, column_regs,
+                       rb_cursor, limit, nullptr, group);
+
+    prog->next(index_cursor, at_end);
+    prog->regs.pop_scope();
+  }
+  prog->end_while(scan_loop);
+
+  prog->close_cursor(index_cursor);
+}
+
+/*
+ * A full scan split between worker threads, see parallel.hpp. The workers
+ * filter the rows and, for an aggregate, fold them into partial groups of
+ * their own. What they output is gathered here in key order, then output,
+ * sorted or merged into the final groups as a serial scan's rows would be.
+ *
+ * Returns the gather cursor, open on the program.
+ */
+static int compile_parallel_scan(program_builder *prog,
+                                 select_stmt *select_stmt, relation *table,
+                                 int rb_cursor, row_limit *limit,
+                                 group_state *group) {
+  program_builder worker;
+  cursor_context *table_ctx = btree_cursor_from_relation(*table);
+  int table_cursor = worker.open_cursor(table_ctx);
+
+  // Every range ends at the next one's first key, which is a stop condition
+  // on the filter
+  scan_filter *filter = push_down_filter(&select_stmt->where_clause);
+  if (!filter) {
+    filter = (scan_filter *)arena<query_arena>::alloc(sizeof(scan_filter));
+    filter->term_count = 0;
+    filter->has_stop = false;
+  }
+  table_ctx->filter = filter;
+
+  data_type key_type = table->columns[0].type;
+  uint8_t *lower = (uint8_t *)arena<query_arena>::alloc(type_size(key_type));
+  memset(lower, 0, type_size(key_type));
+  int key_reg = worker.load_from(key_type, lower);
+  int at_end = worker.seek(table_cursor, key_reg, GE);
+  worker.scan(table_cursor, at_end, true);
+
+  // Past LIMIT + OFFSET rows, none of a range's can be output
+  row_limit worker_limit = {-1, -1, -1, -1, nullptr};
+  if (!group && rb_cursor < 0 && select_stmt->has_limit) {
+    uint64_t read = (uint64_t)select_stmt->limit + select_stmt->offset;
+    worker_limit = load_row_limit(
+        &worker, (uint32_t)std::min<uint64_t>(read, UINT32_MAX), 0);
+  }
+
+  group_state partial;
+  if (group) {
+    partial = open_group(&worker, select_stmt, &table, group->hash_cursor < 0,
+                         -1, nullptr, true);
+  }
+
+  auto scan_loop = worker.begin_while(at_end);
+  {
+    worker.regs.push_scope();
+    compile_select_row(&worker, select_stmt, table_cursor, nullptr, -1,
+                       &worker_limit, nullptr, group ? &partial : nullptr,
+                       rb_cursor >= 0);
+    worker.scan(table_cursor, at_end);
+    worker.regs.pop_scope();
+  }
+  worker.end_while(scan_loop);
+
+  if (group) {
+    compile_group_output(&worker, select_stmt, &partial);
+  }
+  if (worker_limit.done_label) {
+    worker.label(worker_limit.done_label);
+  }
+  if (group && partial.hash_cursor >= 0) {
+    worker.close_cursor(partial.hash_cursor);
+  }
+  worker.close_cursor(table_cursor);
+  worker.halt();
+  worker.resolve_labels();
+
+  // [group key][state], [order key][columns] or the columns
+  tuple_format layout;
+  if (group) {
+    array<data_type, query_arena> types;
+    types.push(partial.key_type);
+    for (uint32_t t = 0; t < partial.spec->term_count; t++) {
+      types.push(partial.spec->terms[t].type);
+    }
+    layout = tuple_format_from_types(types);
+  } else if (rb_cursor >= 0) {
+    layout = select_stmt->sem.rb_format;
+  } else {
+    layout = tuple_format_from_types(select_stmt->sem.column_types);
+  }
+
+  parallel_plan *plan =
+      (parallel_plan *)arena<query_arena>::alloc(sizeof(parallel_plan));
+  *plan = {worker.instructions.data(), worker.instructions.size(), table_ctx,
+           lower};
+  int gather = prog->open_cursor(gather_cursor_from_plan(layout, plan));
+
+  // A partial state's terms are merged as a row's values are folded, except
+  // that counts add up
+  if (group) {
+    for (uint32_t t = 0; t < group->spec->term_count; t++) {
+      aggregate_term &term = group->spec->terms[t];
+      if (term.op == AGGREGATE_COUNT) {
+        term.op = AGGREGATE_SUM;
+      }
+      term.arg = t;
+    }
+    group->arg_count = group->spec->term_count;
+  }
+
+  int more = prog->first(gather);
+  auto gather_loop = prog->begin_while(more);
+  {
+    prog->regs.push_scope();
+
+    uint32_t count = layout.columns.size();
+    int row = prog->get_columns(gather, 0, count, -1, true);
+    if (group) {
+      compile_group_fold(prog, select_stmt, group, row);
+    } else if (rb_cursor >= 0) {
+      prog->insert_record(rb_cursor, row, count);
+    } else {
+      limited_result(prog, limit, row, count);
+    }
+
+    prog->next(gather, more);
+    prog->regs.pop_scope();
+  }
+  prog->end_while(gather_loop);
+  return gather;
+}
+
+/*
+ * With an ORDER BY the rows go into a sorter, which spills to disk past its
+ * memory budget, or with a LIMIT only keeps the rows that can be output
+ */
+static int open_select_sorter(program_builder *prog, select_stmt *select_stmt) {
+  uint64_t read = (uint64_t)select_stmt->limit + select_stmt->offset;
+  uint32_t keep =
+      select_stmt->has_limit && read <= UINT32_MAX ? (uint32_t)read : 0;
+
+  auto sort_ctx = sorter_cursor_from_format(select_stmt->sem.rb_format,
+                                            select_stmt->order_desc, keep);
+  return prog->open_cursor(sort_ctx);
+}
+
+/*
+ * Once every row is in the sorter, they're read back in order and output
+ */
+static void compile_sorted_output(program_builder *prog,
+                                  select_stmt *select_stmt, int rb_cursor,
+                                  row_limit *limit) {
+  int rb_at_end = prog->first(rb_cursor);
+
+  auto output_loop = prog->begin_while(rb_at_end);
+  {
+    prog->regs.push_scope();
+
+    int output_count = select_stmt->sem.column_indices.size();
+    int output_start = prog->get_columns(rb_cursor, 1, output_count, -1, true);
+    limited_result(prog, limit, output_start, output_count);
+
+    prog->next(rb_cursor, rb_at_end);
 
-struct seek_strategy {
-  SEEK_STRATEGY_TYPE type;
-  COMPARISON_OP op;
-  expr_node *key_expr;
-  bool scan_forward; // direction for scanning after seek
+    prog->regs.pop_scope();
+  }
+  prog->end_while(output_loop);
+
+  if (limit->done_label) {
+    prog->label(limit->done_label);
+  }
+  prog->close_cursor(rb_cursor);
+}
+
+enum JOIN_STRATEGY_TYPE : uint8_t {
+  JOIN_KEY_LOOKUP,   // seek the inner table by its primary key
+  JOIN_INDEX_LOOKUP, // seek an index on the inner table's join column
+  JOIN_HASH          // build a hash table of the inner table, probe it
 };
 
 /*
- * Recursively analysize the expression tree to see if there is a primary key
- * condition. If there is, then because the table is sorted on the primary key,
- * we can use a seek to either:
- * - Go to the only row that it could possibly satisfy, for example, 'WHERE
- * user_id = 4 AND age > 30' can only be satisfied by a row with user_id 4, so
- * seek directly to it, THEN, test the other condition(s) and exit.
- * - Seek to the the first row that satisfies the primary key condition, then
- * evaluate the other conditions until we reach the end of the table. This cuts
- * down the search space in proportion to the selectivity of the primary key
- * condition. If there are users with id's 1-1000, then doing 'WHERE user_id >=
- * 900' reduces the rows processed down to 1/10th of the original.
+ * The plan's notes after the access path, its estimated cost if the tables
+ * were analyzed (-1 otherwise), then how the rows are grouped and ordered
  */
-static seek_strategy analyze_where_clause(expr_node *where_clause,
-                                          relation *table) {
-  seek_strategy strategy;
-  strategy.type = STRATEGY_FULL_SCAN;
-  strategy.scan_forward = true;
-  strategy.op = EQ;
-  strategy.key_expr = nullptr;
-
-  if (!where_clause || !table) {
-    return strategy;
+static void plan_output(stmt_node *stmt, double cost, group_state *group,
+                        int rb_cursor) {
+  if (cost >= 0) {
+    plan_note(stmt, "ESTIMATED COST %.0f page reads", cost);
+  }
+  if (group) {
+    plan_note(stmt, group->hash_cursor >= 0 ? "GROUP IN A HASH TABLE"
+                                            : "GROUP AS THE ROWS ARRIVE");
   }
+  if (rb_cursor >= 0) {
+    plan_note(stmt, "SORT FOR ORDER BY");
+  }
+}
 
-  // check if this is a direct PK comparison
-  if (where_clause->type == EXPR_BINARY_OP &&
-      where_clause->left->type == EXPR_COLUMN &&
-      where_clause->left->sem.column_index == 0 &&
-      where_clause->right->type == EXPR_LITERAL) {
+/*
+ * The first of the ON's AND'ed conditions equating a column of each table,
+ * the semantic pass made sure there is one
+ */
+static expr_node *find_join_key(expr_node *join_condition) {
+  array<expr_node *, query_arena> conjuncts;
+  collect_conjuncts(join_condition, conjuncts);
+
+  for (expr_node *conjunct : conjuncts) {
+    if (conjunct->type == EXPR_BINARY_OP && conjunct->op == OP_EQ &&
+        conjunct->left->type == EXPR_COLUMN &&
+        conjunct->right->type == EXPR_COLUMN &&
+        conjunct->left->sem.table_index != conjunct->right->sem.table_index) {
+      return conjunct;
+    }
+  }
 
-    strategy.key_expr = where_clause->right;
+  assert(false && "A join needs an equality between its tables");
+  return nullptr;
+}
 
-    switch (where_clause->op) {
-    case OP_EQ:
-      strategy.op = EQ;
-      strategy.type = STRATEGY_DIRECT_LOOKUP;
-      break;
-    case OP_LT:
-      strategy.op = LT;
-      strategy.type = STRATEGY_SEEK_SCAN;
-      strategy.scan_forward = false;
-      break;
-    case OP_LE:
-      strategy.op = LE;
-      strategy.type = STRATEGY_SEEK_SCAN;
-      strategy.scan_forward = false;
-      break;
-    case OP_GT:
-      strategy.op = GT;
-      strategy.type = STRATEGY_SEEK_SCAN;
-      strategy.scan_forward = true;
-      break;
-    case OP_GE:
-      strategy.op = GE;
-      strategy.type = STRATEGY_SEEK_SCAN;
-      strategy.scan_forward = true;
-      break;
-    default:
-      return strategy;
+static secondary_index *index_on_column(relation *table, int32_t column) {
+  for (auto &index : table->indexes) {
+    if (index.columns[0] == (uint32_t)column) {
+      return &index;
     }
-
-    // remove this predicate from the tree it's now handled by seek
-    where_clause->type = EXPR_LITERAL;
-    where_clause->lit_type = TYPE_U32;
-    where_clause->int_val = 1; // replace with true
-    return strategy;
   }
+  return nullptr;
+}
 
-  /*
-   * Check for AND with PK comparison on one side
-   * if we find it, remove it from the expression tree and set it as expr_key
-   * which means we don't have to evaluate it after the seek
-   */
-  if (where_clause->type == EXPR_BINARY_OP && where_clause->op == OP_AND) {
-    seek_strategy left_strategy =
-        analyze_where_clause(where_clause->left, table);
-    if (left_strategy.type != STRATEGY_FULL_SCAN) {
+/*
+ * For two analyzed tables, the cheapest of seeking either side by primary
+ * key or index from each row of the other, and of hashing, which reads both
+ * tables once and hashes the side with fewer rows
+ */
+static JOIN_STRATEGY_TYPE choose_join(relation **tables, int32_t *key_columns,
+                                      expr_node *where_clause, uint32_t *inner,
+                                      secondary_index **index,
+                                      double *chosen_cost) {
+  double rows[2];
+  for (uint32_t i = 0; i < 2; i++) {
+    rows[i] = filtered_rows(tables[i], where_clause, i);
+  }
 
-      *where_clause = *where_clause->right;
-      return left_strategy;
+  JOIN_STRATEGY_TYPE strategy = JOIN_HASH;
+  *inner = rows[0] < rows[1] ? 0 : 1;
+  *index = nullptr;
+  double cost = tables[0]->stats->pages + tables[1]->stats->pages;
+
+  for (uint32_t i = 0; i < 2; i++) {
+    table_stats *seeked = tables[i]->stats;
+    double scan = tables[1 - i]->stats->pages;
+    double probes = rows[1 - i];
+
+    secondary_index *candidate = nullptr;
+    double lookup_cost;
+    if (key_columns[i] == 0) {
+      lookup_cost = scan + probes * seeked->height;
+    } else if ((candidate = index_on_column(tables[i], key_columns[i]))) {
+      double matches =
+          seeked->rows * stats_equal_selectivity(seeked, key_columns[i]);
+      lookup_cost = scan + probes * (seeked->height + matches);
+    } else {
+      continue;
     }
 
-    seek_strategy right_strategy =
-        analyze_where_clause(where_clause->right, table);
-    if (right_strategy.type != STRATEGY_FULL_SCAN) {
-
-      *where_clause = *where_clause->left;
-      return right_strategy;
+    if (lookup_cost < cost) {
+      cost = lookup_cost;
+      strategy = candidate ? JOIN_INDEX_LOOKUP : JOIN_KEY_LOOKUP;
+      *inner = i;
+      *index = candidate;
     }
   }
-
+  *chosen_cost = cost;
   return strategy;
 }
 
-array<vm_instruction, query_arena> compile_select(stmt_node *stmt) {
-  program_builder prog;
-  select_stmt *select_stmt = &stmt->select_stmt;
+/*
+ * The inner table's rows with the join column equal to value_reg, found
+ * through an index on it as in compile_index_scan, each then looked up in
+ * the table by its primary key
+ */
+static void compile_index_join(program_builder *prog, select_stmt *select_stmt,
+                               relation *inner, int inner_cursor,
+                               secondary_index &index, int value_reg,
+                               data_type value_type, join_source *sources,
+                               int rb_cursor, row_limit *limit,
+                               group_state *group) {
+  int index_cursor = prog->open_cursor(btree_cursor_from_index(*inner, index));
+
+  int lowest_key = load_lowest_key(prog, inner->columns[0].type);
+  int seek_key = prog->pack2(value_reg, lowest_key);
+  int at_end = prog->seek(index_cursor, seek_key, GE);
+
+  auto match_loop = prog->begin_while(at_end);
+  {
+    prog->regs.push_scope();
 
-  relation *table = catalog.get(select_stmt->table_name);
-  auto table_ctx = btree_cursor_from_relation(*table);
-  int table_cursor = prog.open_cursor(table_ctx);
+    int entry_key = prog->get_column(index_cursor, 0);
+    int fields = prog->regs.allocate_range(2);
+    prog->unpack2(entry_key, fields);
 
-  seek_strategy strategy =
-      analyze_where_clause(select_stmt->where_clause, table);
+    int matches = prog->typed_test(fields, value_reg, EQ, value_type);
+    prog->jumpif(matches, match_loop.end_label, false);
 
-  // handle direct lookup case separately (no ORDER BY needed)
-  if (strategy.type == STRATEGY_DIRECT_LOOKUP) {
-    int key_reg = compile_literal(&prog, strategy.key_expr);
+    prog->seek(inner_cursor, fields + 1, EQ);
+    compile_select_row(prog, select_stmt, -1, nullptr, rb_cursor, limit,
+                       sources, group);
 
-    int found = prog.seek(table_cursor, key_reg, EQ);
+    prog->next(index_cursor, at_end);
+    prog->regs.pop_scope();
+  }
+  prog->end_while(match_loop);
 
-    auto found_block = prog.begin_if(found);
-    {
+  prog->close_cursor(index_cursor);
+}
+
+/*
+ * SELECT ... FROM a JOIN b ON a.x = b.y
+ *
+ * Rows are matched up on the first equality of the ON between a column of
+ * each table. When one side, the inner, can be seeked on its column, it is
+ * for every row of the other, the outer:
+ * - its primary key, 'ON a.x = b.id', a lookup per outer row
+ * - the leading column of an index, seeking the entries for each outer value
+ *
+ * Otherwise it's a hash join. The JOIN table is scanned into a hash table
+ * keyed on its join column, then the FROM table is scanned, each row looking
+ * up its matches. With both tables analyzed, see choose_join, the cheapest
+ * of these is taken instead, and either side can be the inner. Past its memory budget the hash table partitions its rows
+ * to disk and is read back a pass at a time, the FROM table being scanned
+ * once per pass (see hashtable.hpp).
+ *
+ * The rest of the ON and the WHERE are tested on each joined row, except the
+ * 'column op literal' conditions on a scanned table, which its cursor tests.
+ */
+static array<vm_instruction, query_arena> compile_join(stmt_node *stmt) {
+  program_builder prog;
+  select_stmt *select_stmt = &stmt->select_stmt;
 
-      int result_count = select_stmt->sem.column_indices.size();
-      int result_start = prog.regs.allocate_range(result_count);
+  relation *tables[2] = {catalog_get(select_stmt->table_name),
+                         catalog_get(select_stmt->join_table)};
+
+  expr_node *join_key = find_join_key(select_stmt->join_condition);
+  int32_t key_columns[2];
+  key_columns[join_key->left->sem.table_index] =
+      join_key->left->sem.column_index;
+  key_columns[join_key->right->sem.table_index] =
+      join_key->right->sem.column_index;
+  data_type key_type = join_key->left->sem.resolved_type;
+  remove_predicate(join_key);
+
+  // An inner join's ON is no different from its WHERE
+  expr_node *condition = fold_true_conjuncts(select_stmt->join_condition);
+  if (condition && select_stmt->where_clause) {
+    expr_node *both = (expr_node *)arena<query_arena>::alloc(sizeof(expr_node));
+    both->type = EXPR_BINARY_OP;
+    both->op = OP_AND;
+    both->left = condition;
+    both->right = select_stmt->where_clause;
+    both->sem.resolved_type = TYPE_U32;
+    condition = both;
+  } else if (!condition) {
+    condition = select_stmt->where_clause;
+  }
+  select_stmt->where_clause = condition;
+
+  JOIN_STRATEGY_TYPE strategy = JOIN_HASH;
+  uint32_t inner = 1;
+  secondary_index *index = nullptr;
+  double cost = -1;
+  if (tables[0]->stats && tables[1]->stats) {
+    strategy = choose_join(tables, key_columns, select_stmt->where_clause,
+                           &inner, &index, &cost);
+  } else if (key_columns[1] == 0) {
+    strategy = JOIN_KEY_LOOKUP;
+  } else if (key_columns[0] == 0) {
+    strategy = JOIN_KEY_LOOKUP;
+    inner = 0;
+  } else if ((index = index_on_column(tables[1], key_columns[1]))) {
+    strategy = JOIN_INDEX_LOOKUP;
+  } else if ((index = index_on_column(tables[0], key_columns[0]))) {
+    strategy = JOIN_INDEX_LOOKUP;
+    inner = 0;
+  }
+  uint32_t outer = 1 - inner;
 
-      for (uint32_t i = 0; i < result_count; i++) {
-        prog.get_column(table_cursor, select_stmt->sem.column_indices[i],
-                        result_start + i);
-      }
+  int cursors[2];
+  cursor_context *contexts[2];
+  for (uint32_t i = 0; i < 2; i++) {
+    contexts[i] = btree_cursor_from_relation(*tables[i]);
+    cursors[i] = prog.open_cursor(contexts[i]);
+  }
 
-      prog.result(result_start, result_count);
-    }
-    prog.end_if(found_block);
+  scan_filter *outer_filter =
+      push_down_filter(&select_stmt->where_clause, outer);
+  contexts[outer]->filter = outer_filter;
 
-    prog.close_cursor(table_cursor);
-    prog.halt();
-    prog.resolve_labels();
-    return prog.instructions;
+  // The inner side is only scanned when building the hash table
+  scan_filter *inner_filter = nullptr;
+  if (strategy == JOIN_HASH) {
+    inner_filter = push_down_filter(&select_stmt->where_clause, inner);
+    contexts[inner]->filter = inner_filter;
+  }
+
+  plan_note(stmt, "SCAN %s", tables[outer]->name);
+  plan_filter(stmt, tables[outer], outer_filter);
+  const char *inner_key = tables[inner]->columns[key_columns[inner]].name;
+  const char *outer_key = tables[outer]->columns[key_columns[outer]].name;
+  switch (strategy) {
+  case JOIN_KEY_LOOKUP:
+    plan_note(stmt, "JOIN %s USING PRIMARY KEY (%s = %s.%s)",
+              tables[inner]->name, inner_key, tables[outer]->name, outer_key);
+    break;
+  case JOIN_INDEX_LOOKUP:
+    plan_note(stmt, "JOIN %s USING INDEX %s (%s = %s.%s)", tables[inner]->name,
+              index->name, inner_key, tables[outer]->name, outer_key);
+    break;
+  case JOIN_HASH:
+    plan_note(stmt, "JOIN %s BY HASHING IT ON %s", tables[inner]->name,
+              inner_key);
+    plan_filter(stmt, tables[inner], inner_filter);
+    break;
   }
 
-  // setup for ORDER BY if needed
   bool has_order_by = select_stmt->sem.rb_format.columns.size() > 0;
-  int result_count = select_stmt->sem.column_indices.size();
-  if (has_order_by) {
-    result_count++;
+  int rb_cursor = has_order_by ? open_select_sorter(&prog, select_stmt) : -1;
+
+  row_limit limit = compile_row_limit(&prog, select_stmt);
+  row_limit *scan_limit = rb_cursor >= 0 ? nullptr : &limit;
+
+  // Neither side's rows come out in groups, so a GROUP BY is hashed
+  group_state groups;
+  group_state *group = nullptr;
+  if (select_stmt->sem.is_aggregate) {
+    groups = open_group(&prog, select_stmt, tables,
+                        select_stmt->sem.group_by_index < 0, rb_cursor,
+                        scan_limit);
+    group = &groups;
   }
 
-  int rb_cursor = -1;
-  if (has_order_by) {
-    auto rb_ctx =
-        red_black_cursor_from_format(select_stmt->sem.rb_format, true);
-    rb_cursor = prog.open_cursor(rb_ctx);
+  seek_strategy full_scan = {};
+  full_scan.type = STRATEGY_FULL_SCAN;
+
+  join_source sources[2];
+  sources[outer] = {cursors[outer], 0};
+  sources[inner] = {cursors[inner], 0};
+  int hash_cursor = -1;
+
+  if (strategy != JOIN_HASH) {
+    compile_key_scan(&prog, cursors[outer], full_scan, outer_filter,
+                     [&](key_scan *scan) {
+                       int value_reg =
+                           prog.get_column(cursors[outer], key_columns[outer]);
+
+                       if (strategy == JOIN_KEY_LOOKUP) {
+                         int found = prog.seek(cursors[inner], value_reg, EQ);
+                         auto found_block = prog.begin_if(found);
+                         compile_select_row(&prog, select_stmt, -1, nullptr,
+                                            rb_cursor, scan_limit, sources,
+                                            group);
+                         prog.end_if(found_block);
+                       } else {
+                         compile_index_join(&prog, select_stmt, tables[inner],
+                                            cursors[inner], *index, value_reg,
+                                            key_type, sources, rb_cursor,
+                                            scan_limit, group);
+                       }
+
+                       step_key_scan(&prog, scan);
+                     });
+  } else {
+    // [join column][every column of the inner table]
+    array<data_type, query_arena> hash_types;
+    hash_types.push(key_type);
+    for (auto &column : tables[inner]->columns) {
+      hash_types.push(column.type);
+    }
+    tuple_format hash_layout = tuple_format_from_types(hash_types);
+    hash_cursor = prog.open_cursor(hash_cursor_from_format(hash_layout));
+    sources[inner] = {hash_cursor, 1};
+
+    uint32_t column_count = tables[inner]->columns.size();
+    compile_key_scan(&prog, cursors[inner], full_scan, inner_filter,
+                     [&](key_scan *scan) {
+                       int row = prog.regs.allocate_range(column_count + 1);
+                       prog.get_column(cursors[inner], key_columns[inner], row,
+                                       true);
+                       prog.get_columns(cursors[inner], 0, column_count,
+                                        row + 1, true);
+                       prog.insert_record(hash_cursor, row, column_count + 1);
+                       step_key_scan(&prog, scan);
+                     });
+
+    int more = prog.first(hash_cursor);
+    auto pass_loop = prog.begin_while(more);
+    {
+      compile_key_scan(
+          &prog, cursors[outer], full_scan, outer_filter, [&](key_scan *scan) {
+            int value_reg = prog.get_column(cursors[outer], key_columns[outer]);
+            int found = prog.seek(hash_cursor, value_reg, EQ);
+
+            auto match_loop = prog.begin_while(found);
+            {
+              prog.regs.push_scope();
+              compile_select_row(&prog, select_stmt, -1, nullptr, rb_cursor,
+                                 scan_limit, sources, group);
+              prog.next(hash_cursor, found);
+              prog.regs.pop_scope();
+            }
+            prog.end_while(match_loop);
+
+            step_key_scan(&prog, scan);
+          });
+
+      prog.first(hash_cursor, more);
+    }
+    prog.end_while(pass_loop);
   }
+  plan_output(stmt, cost, group, rb_cursor);
 
-  int at_end_register;
+  if (group) {
+    compile_group_output(&prog, select_stmt, group);
+  }
+  if (scan_limit && limit.done_label) {
+    prog.label(limit.done_label);
+  }
+  if (hash_cursor >= 0) {
+    prog.close_cursor(hash_cursor);
+  }
+  if (group && group->hash_cursor >= 0) {
+    prog.close_cursor(group->hash_cursor);
+  }
+  prog.close_cursor(cursors[0]);
+  prog.close_cursor(cursors[1]);
 
-  if (strategy.type == STRATEGY_SEEK_SCAN) {
-    int key_reg = compile_literal(&prog, strategy.key_expr);
-    // seek returns 1 if found, 0 if not. For a range scan
-    // not found means we're at the end of the table
-    at_end_register = prog.seek(table_cursor, key_reg, strategy.op);
-  } else {
-    // start from beginning
-    at_end_register = prog.first(table_cursor);
+  if (rb_cursor >= 0) {
+    compile_sorted_output(&prog, select_stmt, rb_cursor, &limit);
   }
 
-  auto scan_loop = prog.begin_while(at_end_register);
-  {
-    prog.regs.push_scope();
+  prog.halt();
+  prog.resolve_labels();
+  return prog.instructions;
+}
 
-    conditional_context where_ctx;
-    if (select_stmt->where_clause) {
-      int where_result =
-          compile_expr(&prog, select_stmt->where_clause, table_cursor);
-      where_ctx = prog.begin_if(where_result);
-    }
+array<vm_instruction, query_arena> compile_select(stmt_node *stmt) {
+  program_builder prog;
+  select_stmt *select_stmt = &stmt->select_stmt;
 
-    int result_start = prog.regs.allocate_range(result_count);
+  if (!select_stmt->join_table.empty()) {
+    return compile_join(stmt);
+  }
 
-    if (has_order_by) {
-      prog.get_column(table_cursor, select_stmt->sem.order_by_index,
-                      result_start);
-    }
+  relation *table = catalog_get(select_stmt->table_name);
 
-    uint32_t offset = has_order_by ? 1 : 0;
-    for (uint32_t i = 0; i < result_count - offset; i++) {
-      prog.get_column(table_cursor, select_stmt->sem.column_indices[i],
-                      result_start + offset + i);
-    }
+  seek_strategy strategy =
+      analyze_where_clause(select_stmt->where_clause, table);
 
-    if (has_order_by) {
-      prog.insert_record(rb_cursor, result_start, result_count);
-    } else {
-      prog.result(result_start, result_count);
-    }
+  index_strategy index_strategy = {};
+  double cost = -1;
+  if (table->stats) {
+    cost = choose_access_path(select_stmt->where_clause, table, strategy,
+                              index_strategy);
+  } else if (strategy.type == STRATEGY_FULL_SCAN) {
+    find_index_predicate(select_stmt->where_clause, table, &index_strategy);
+  }
+  claim_seek_predicates(strategy);
+  select_stmt->where_clause = fold_true_conjuncts(select_stmt->where_clause);
 
-    if (select_stmt->where_clause) {
-      prog.end_if(where_ctx);
-    }
+  // setup for ORDER BY if needed
+  bool has_order_by = select_stmt->sem.rb_format.columns.size() > 0;
 
-    if (strategy.type == STRATEGY_SEEK_SCAN && !strategy.scan_forward) {
-      prog.prev(table_cursor, at_end_register);
-    } else {
-      prog.next(table_cursor, at_end_register);
-    }
+  // A key scan already visits rows in key order, and a full scan can do so
+  // backwards, so ordering by the key needs no sort
+  bool key_order = has_order_by && select_stmt->sem.order_by_index == 0 &&
+                   !index_strategy.index &&
+                   (!select_stmt->order_desc ||
+                    strategy.type == STRATEGY_FULL_SCAN);
+
+  // A snapshot's pages are its thread's own, so a read session scans serially
+  bool parallel = par_workers() > 1 && !_debug && !pager_in_snapshot() &&
+                  strategy.type == STRATEGY_FULL_SCAN &&
+                  !index_strategy.index &&
+                  !(key_order && select_stmt->order_desc);
 
-    prog.regs.pop_scope();
+  auto table_ctx = btree_cursor_from_relation(*table);
+  int table_cursor = -1;
+  if (!parallel) {
+    table_cursor = prog.open_cursor(table_ctx);
   }
-  prog.end_while(scan_loop);
 
-  prog.close_cursor(table_cursor);
+  // Otherwise rows go into a sorter
+  int rb_cursor = -1;
+  if (has_order_by && !key_order) {
+    rb_cursor = open_select_sorter(&prog, select_stmt);
+  }
 
-  if (has_order_by) {
-    int rb_at_end =
-        select_stmt->order_desc ? prog.last(rb_cursor) : prog.first(rb_cursor);
+  row_limit limit = compile_row_limit(&prog, select_stmt);
+  row_limit *scan_limit = rb_cursor >= 0 ? nullptr : &limit;
+
+  // Rows come out grouped when every row is its own group, or the index
+  // being scanned is on the GROUP BY column, otherwise they're hashed
+  group_state groups;
+  group_state *group = nullptr;
+  if (select_stmt->sem.is_aggregate) {
+    int32_t group_by = select_stmt->sem.group_by_index;
+    bool streamed = group_by <= 0 || (index_strategy.index &&
+                                      index_strategy.index->columns[0] ==
+                                          (uint32_t)group_by);
+    groups = open_group(&prog, select_stmt, &table, streamed, rb_cursor,
+                        scan_limit);
+    group = &groups;
+  }
 
-    auto output_loop = prog.begin_while(rb_at_end);
+  if (parallel) {
+    plan_note(stmt, "SCAN %s IN PARALLEL, %u workers", table->name,
+              par_workers());
+    table_cursor = compile_parallel_scan(&prog, select_stmt, table, rb_cursor,
+                                         scan_limit, group);
+  } else if (index_strategy.index) {
+    plan_index(stmt, table, index_strategy);
+    compile_index_scan(&prog, select_stmt, table, table_cursor,
+                       index_strategy, rb_cursor, scan_limit, group);
+  } else if (key_order && select_stmt->order_desc) {
+    plan_note(stmt, "SCAN %s BACKWARD", table->name);
+
+    // OP_Scan only goes forward, so the WHERE is tested on the loaded row
+    int at_end = prog.last(table_cursor);
+    auto scan_loop = prog.begin_while(at_end);
     {
       prog.regs.push_scope();
-
-      int output_count = select_stmt->sem.column_indices.size();
-      int output_start = prog.get_columns(rb_cursor, 1, output_count);
-      prog.result(output_start, output_count);
-
-      if (select_stmt->order_desc) {
-        prog.prev(rb_cursor, rb_at_end);
-      } else {
-        prog.next(rb_cursor, rb_at_end);
-      }
-
+      compile_select_row(&prog, select_stmt, table_cursor, nullptr, -1,
+                         scan_limit, nullptr, group);
+      prog.prev(table_cursor, at_end);
       prog.regs.pop_scope();
     }
-    prog.end_while(output_loop);
+    prog.end_while(scan_loop);
+  } else {
+    scan_filter *filter = nullptr;
+    if (strategy.type != STRATEGY_DIRECT_LOOKUP) {
+      filter = push_down_filter(&select_stmt->where_clause);
+      table_ctx->filter = filter;
+    }
+    plan_seek(stmt, table, strategy);
+    plan_filter(stmt, table, filter);
+
+    compile_key_scan(&prog, table_cursor, strategy, filter,
+                     [&](key_scan *scan) {
+                       compile_select_row(&prog, select_stmt, table_cursor,
+                                          nullptr, rb_cursor, scan_limit,
+                                          nullptr, group);
+                       if (scan) {
+                         step_key_scan(&prog, scan);
+                       }
+                     });
+  }
+  plan_output(stmt, cost, group, rb_cursor);
+  if (key_order) {
+    plan_note(stmt, "ORDER BY FOLLOWS THE PRIMARY KEY, no sort");
+  }
+
+  if (group) {
+    compile_group_output(&prog, select_stmt, group);
+  }
+  if (scan_limit && limit.done_label) {
+    prog.label(limit.done_label);
+  }
+  if (group && group->hash_cursor >= 0) {
+    prog.close_cursor(group->hash_cursor);
+  }
+  prog.close_cursor(table_cursor);
 
-    prog.close_cursor(rb_cursor);
+  if (rb_cursor >= 0) {
+    compile_sorted_output(&prog, select_stmt, rb_cursor, &limit);
   }
 
   prog.halt();
   prog.resolve_labels();
   return prog.instructions;
 }
+/*
+ * Every row of the VALUES list is inserted by the one program, through the
+ * one set of cursors. Each row's values are loaded straight into the row's
+ * registers, which the rows share.
+ */
 array<vm_instruction, query_arena> compile_insert(stmt_node *stmt) {
   program_builder prog;
   insert_stmt *insert_stmt = &stmt->insert_stmt;
 
-  relation *table = catalog.get(insert_stmt->table_name);
+  relation *table = catalog_get(insert_stmt->table_name);
   auto table_ctx = btree_cursor_from_relation(*table);
   int cursor = prog.open_cursor(table_ctx);
 
+  int index_cursors[RELATION_MAX_INDEXES];
+  open_index_cursors(&prog, table, index_cursors);
+
   int row_size = table->columns.size();
   int row_start = prog.regs.allocate_range(row_size);
+  uint32_t row_width = insert_stmt->sem.column_indices.size();
 
-  for (uint32_t i = 0; i < insert_stmt->values.size(); i++) {
-    expr_node *expr = insert_stmt->values[i];
-    uint32_t col_idx = insert_stmt->sem.column_indices[i];
+  for (uint32_t row = 0; row < insert_stmt->row_count; row++) {
+    for (uint32_t i = 0; i < row_width; i++) {
+      expr_node *expr = insert_stmt->values[row * row_width + i];
+      uint32_t col_idx = insert_stmt->sem.column_indices[i];
 
-    int value_reg;
-    if (expr->type == EXPR_LITERAL) {
-      value_reg = compile_literal(&prog, expr);
+      if (is_value(expr)) {
+        compile_literal(&prog, expr, row_start + col_idx);
+      }
     }
 
-    prog.move(value_reg, row_start + col_idx);
-  }
+    prog.insert_record(cursor, row_start, row_size);
 
-  prog.insert_record(cursor, row_start, row_size);
+    for (uint32_t i = 0; i < table->indexes.size(); i++) {
+      insert_index_entry(&prog, index_cursors[i], table->indexes[i], row_start,
+                         row_start);
+    }
+  }
 
+  close_index_cursors(&prog, table, index_cursors);
   prog.close_cursor(cursor);
 
   prog.halt();
@@ -447,16 +2568,27 @@ array<vm_instruction, query_arena> compile_update(stmt_node *stmt) {
   program_builder prog;
   update_stmt *update_stmt = &stmt->update_stmt;
 
-  relation *table = catalog.get(update_stmt->table_name);
+  relation *table = catalog_get(update_stmt->table_name);
   auto table_ctx = btree_cursor_from_relation(*table);
   int cursor = prog.open_cursor(table_ctx);
 
-  int at_end = prog.first(cursor);
+  int index_cursors[RELATION_MAX_INDEXES];
+  open_index_cursors(&prog, table, index_cursors);
 
-  auto scan_loop = prog.begin_while(at_end);
-  {
-    prog.regs.push_scope();
+  seek_strategy strategy =
+      analyze_where_clause(update_stmt->where_clause, table);
+  claim_seek_predicates(strategy);
+  update_stmt->where_clause = fold_true_conjuncts(update_stmt->where_clause);
+
+  scan_filter *filter = nullptr;
+  if (strategy.type != STRATEGY_DIRECT_LOOKUP) {
+    filter = push_down_filter(&update_stmt->where_clause);
+    table_ctx->filter = filter;
+  }
+  plan_seek(stmt, table, strategy);
+  plan_filter(stmt, table, filter);
 
+  compile_key_scan(&prog, cursor, strategy, filter, [&](key_scan *scan) {
     conditional_context where_ctx;
     if (update_stmt->where_clause) {
       int where_result = compile_expr(&prog, update_stmt->where_clause, cursor);
@@ -465,12 +2597,23 @@ array<vm_instruction, query_arena> compile_update(stmt_node *stmt) {
 
     int row_start = prog.get_columns(cursor, 0, table->columns.size());
 
+    // The entries for the old values go before the row changes, the key
+    // is kept aside as only the record is updated
+    int key_reg = prog.move(row_start);
+    for (uint32_t i = 0; i < table->indexes.size(); i++) {
+      secondary_index &index = table->indexes[i];
+      if (index_is_updated(index, update_stmt)) {
+        delete_index_entry(&prog, index_cursors[i],
+                           row_start + index.columns[0], key_reg);
+      }
+    }
+
     for (uint32_t i = 0; i < update_stmt->columns.size(); i++) {
       uint32_t col_idx = update_stmt->sem.column_indices[i];
       expr_node *value_expr = update_stmt->values[i];
 
       int new_value;
-      if (value_expr->type == EXPR_LITERAL) {
+      if (is_value(value_expr)) {
         new_value = compile_literal(&prog, value_expr);
       }
 
@@ -479,15 +2622,23 @@ array<vm_instruction, query_arena> compile_update(stmt_node *stmt) {
 
     prog.update_record(cursor, row_start);
 
+    for (uint32_t i = 0; i < table->indexes.size(); i++) {
+      secondary_index &index = table->indexes[i];
+      if (index_is_updated(index, update_stmt)) {
+        insert_index_entry(&prog, index_cursors[i], index, row_start, key_reg);
+      }
+    }
+
     if (update_stmt->where_clause) {
       prog.end_if(where_ctx);
     }
 
-    prog.next(cursor, at_end);
-    prog.regs.pop_scope();
-  }
-  prog.end_while(scan_loop);
+    if (scan) {
+      step_key_scan(&prog, scan);
+    }
+  });
 
+  close_index_cursors(&prog, table, index_cursors);
   prog.close_cursor(cursor);
 
   prog.halt();
@@ -500,52 +2651,75 @@ array<vm_instruction, query_arena> compile_delete(stmt_node *stmt) {
   program_builder prog;
   delete_stmt *delete_stmt = &stmt->delete_stmt;
 
-  relation *table = catalog.get(delete_stmt->table_name);
+  relation *table = catalog_get(delete_stmt->table_name);
+
+  if (!delete_stmt->where_clause) {
+    plan_note(stmt, "TRUNCATE %s", table->name);
+    int name_reg =
+        prog.load_string(TYPE_CHAR32, delete_stmt->table_name.data(),
+                         delete_stmt->table_name.size());
+    prog.call_function(vmfunc_truncate_relation, name_reg, 1);
+
+    prog.halt();
+    prog.resolve_labels();
+    return prog.instructions;
+  }
+
   auto table_ctx = btree_cursor_from_relation(*table);
   int cursor = prog.open_cursor(table_ctx);
 
-  int at_end = prog.first(cursor);
+  int index_cursors[RELATION_MAX_INDEXES];
+  open_index_cursors(&prog, table, index_cursors);
 
-  auto scan_loop = prog.begin_while(at_end);
-  {
-    prog.regs.push_scope();
+  seek_strategy strategy =
+      analyze_where_clause(delete_stmt->where_clause, table);
+  claim_seek_predicates(strategy);
+  delete_stmt->where_clause = fold_true_conjuncts(delete_stmt->where_clause);
+
+  scan_filter *filter = nullptr;
+  if (strategy.type != STRATEGY_DIRECT_LOOKUP) {
+    filter = push_down_filter(&delete_stmt->where_clause);
+    table_ctx->filter = filter;
+  }
+  plan_seek(stmt, table, strategy);
+  plan_filter(stmt, table, filter);
 
-    int should_delete;
+  compile_key_scan(&prog, cursor, strategy, filter, [&](key_scan *scan) {
+    conditional_context delete_if;
     if (delete_stmt->where_clause) {
-      should_delete = compile_expr(&prog, delete_stmt->where_clause, cursor);
-    } else {
-      should_delete = prog.load(TYPE_U32, 1U);
+      int should_delete =
+          compile_expr(&prog, delete_stmt->where_clause, cursor);
+      delete_if = prog.begin_if(should_delete);
     }
 
-    auto delete_if = prog.begin_if(should_delete);
-    {
-      int deleted = prog.regs.allocate();
-      int still_valid = prog.regs.allocate();
-      prog.delete_record(cursor, deleted, still_valid);
-
-      auto if_valid = prog.begin_if(still_valid);
-      {
-
-        prog.move(still_valid, at_end);
-      }
-      prog.begin_else(if_valid);
-      {
-
-        prog.first(cursor, at_end);
+    if (table->indexes.size() > 0) {
+      int key_reg = prog.get_column(cursor, 0);
+      for (uint32_t i = 0; i < table->indexes.size(); i++) {
+        int column_reg = prog.get_column(cursor, table->indexes[i].columns[0]);
+        delete_index_entry(&prog, index_cursors[i], column_reg, key_reg);
       }
-      prog.end_if(if_valid);
     }
-    prog.begin_else(delete_if);
-    {
 
-      prog.next(cursor, at_end);
+    // the delete leaves the cursor on the next row, if there is one
+    int deleted = prog.regs.allocate();
+    int still_valid = prog.regs.allocate();
+    prog.delete_record(cursor, deleted, still_valid);
+    if (scan && scan->filtered) {
+      prog.scan(cursor, scan->at_end, true);
+    } else if (scan) {
+      prog.move(still_valid, scan->at_end);
     }
-    prog.end_if(delete_if);
 
-    prog.regs.pop_scope();
-  }
-  prog.end_while(scan_loop);
+    if (delete_stmt->where_clause) {
+      if (scan) {
+        prog.begin_else(delete_if);
+        step_key_scan(&prog, scan);
+      }
+      prog.end_if(delete_if);
+    }
+  });
 
+  close_index_cursors(&prog, table, index_cursors);
   prog.close_cursor(cursor);
 
   prog.halt();
@@ -554,6 +2728,78 @@ array<vm_instruction, query_arena> compile_delete(stmt_node *stmt) {
   return prog.instructions;
 }
 
+/*
+ * Add the master_catalog row for a table or index
+ */
+static void insert_master_entry(program_builder *prog, string_view name,
+                                string_view tbl_name, int root_page_reg,
+                                string_view sql) {
+  relation &master = *catalog_get(MASTER_CATALOG);
+  auto master_ctx = btree_cursor_from_relation(master);
+  int master_cursor = prog->open_cursor(master_ctx);
+
+  int row_start = prog->regs.allocate_range(5);
+
+  prog->load_ptr(master.next_key.data, row_start);
+
+  type_increment(master.next_key.type, master.next_key.data,
+                 master.next_key.data);
+
+  prog->load_string(TYPE_CHAR32, name.data(), name.size(), row_start + 1);
+
+  prog->load_string(TYPE_CHAR32, tbl_name.data(), tbl_name.size(),
+                    row_start + 2);
+
+  prog->move(root_page_reg, row_start + 3);
+
+  prog->load_string(TYPE_CHAR256, sql.data(), sql.size(), row_start + 4);
+
+  prog->insert_record(master_cursor, row_start, 5);
+
+  prog->close_cursor(master_cursor);
+}
+
+/*
+ * Remove the master_catalog rows whose column (name or tbl_name) matches,
+ * dropping a table takes its indexes' rows with it
+ */
+static void delete_master_entries(program_builder *prog, int name_reg,
+                                  uint32_t column) {
+  relation &master = *catalog_get(MASTER_CATALOG);
+  auto master_ctx = btree_cursor_from_relation(master);
+  int cursor = prog->open_cursor(master_ctx);
+
+  int at_end = prog->first(cursor);
+  auto scan_loop = prog->begin_while(at_end);
+  {
+    prog->regs.push_scope();
+
+    int entry_name = prog->get_column(cursor, column);
+    int matches = prog->eq(entry_name, name_reg);
+
+    auto delete_if = prog->begin_if(matches);
+    {
+      int deleted = prog->regs.allocate();
+      int still_valid = prog->regs.allocate();
+      prog->delete_record(cursor, deleted, still_valid);
+
+      auto if_valid = prog->begin_if(still_valid);
+      { prog->move(still_valid, at_end); }
+      prog->begin_else(if_valid);
+      { prog->first(cursor, at_end); }
+      prog->end_if(if_valid);
+    }
+    prog->begin_else(delete_if);
+    { prog->next(cursor, at_end); }
+    prog->end_if(delete_if);
+
+    prog->regs.pop_scope();
+  }
+  prog->end_while(scan_loop);
+
+  prog->close_cursor(cursor);
+}
+
 array<vm_instruction, query_arena> compile_create_table(stmt_node *stmt) {
   program_builder prog;
   create_table_stmt *create_stmt = &stmt->create_table_stmt;
@@ -564,76 +2810,102 @@ array<vm_instruction, query_arena> compile_create_table(stmt_node *stmt) {
   int root_page_reg =
       prog.call_function(vmfunc_create_relation, table_name_reg, 1);
 
-  relation &master = *catalog.get(MASTER_CATALOG);
-  auto master_ctx = btree_cursor_from_relation(master);
-  int master_cursor = prog.open_cursor(master_ctx);
+  insert_master_entry(&prog, create_stmt->table_name, create_stmt->table_name,
+                      root_page_reg, stmt->sql_stmt);
 
-  int row_start = prog.regs.allocate_range(5);
+  prog.halt();
 
-  prog.load_ptr(master.next_key.data, row_start);
+  prog.resolve_labels();
 
-  type_increment(master.next_key.type, master.next_key.data,
-                 master.next_key.data);
+  return prog.instructions;
+}
+
+array<vm_instruction, query_arena> compile_drop_table(stmt_node *stmt) {
+  program_builder prog;
+  drop_table_stmt *drop_stmt = &stmt->drop_table_stmt;
 
-  prog.load_string(TYPE_CHAR32, create_stmt->table_name.data(),
-                   create_stmt->table_name.size(), row_start + 1);
+  int name_reg = prog.load_string(TYPE_CHAR32, drop_stmt->table_name.data(),
+                                  drop_stmt->table_name.size());
+  prog.call_function(vmfunc_drop_relation, name_reg, 1);
 
-  prog.load_string(TYPE_CHAR32, create_stmt->table_name.data(),
-                   create_stmt->table_name.size(), row_start + 2);
+  delete_master_entries(&prog, name_reg, 2);
 
-  prog.move(root_page_reg, row_start + 3);
+  prog.halt();
+  prog.resolve_labels();
 
-  string_view sql = stmt->sql_stmt;
+  return prog.instructions;
+}
 
-  prog.load_string(TYPE_CHAR256, sql.data(), sql.size(), row_start + 4);
+array<vm_instruction, query_arena> compile_create_index(stmt_node *stmt) {
+  program_builder prog;
+  create_index_stmt *create_stmt = &stmt->create_index_stmt;
 
-  prog.insert_record(master_cursor, row_start, 5);
+  int index_name_reg =
+      prog.load_string(TYPE_CHAR32, create_stmt->index_name.data(),
+                       create_stmt->index_name.size());
+  int root_page_reg =
+      prog.call_function(vmfunc_create_index, index_name_reg, 1);
 
-  prog.close_cursor(master_cursor);
+  insert_master_entry(&prog, create_stmt->index_name, create_stmt->table_name,
+                      root_page_reg, stmt->sql_stmt);
 
   prog.halt();
-
   prog.resolve_labels();
 
   return prog.instructions;
 }
 
-array<vm_instruction, query_arena> compile_drop_table(stmt_node *stmt) {
+array<vm_instruction, query_arena> compile_drop_index(stmt_node *stmt) {
   program_builder prog;
-  drop_table_stmt *drop_stmt = &stmt->drop_table_stmt;
+  drop_index_stmt *drop_stmt = &stmt->drop_index_stmt;
 
-  int name_reg = prog.load_string(TYPE_CHAR32, drop_stmt->table_name.data(),
-                                  drop_stmt->table_name.size());
-  prog.call_function(vmfunc_drop_relation, name_reg, 1);
+  int name_reg = prog.load_string(TYPE_CHAR32, drop_stmt->index_name.data(),
+                                  drop_stmt->index_name.size());
+  prog.call_function(vmfunc_drop_index, name_reg, 1);
 
-  relation &master = *catalog.get(MASTER_CATALOG);
-  auto master_ctx = btree_cursor_from_relation(master);
-  int cursor = prog.open_cursor(master_ctx);
+  delete_master_entries(&prog, name_reg, 1);
 
-  int at_end = prog.first(cursor);
-  auto scan_loop = prog.begin_while(at_end);
-  {
-    prog.regs.push_scope();
+  prog.halt();
+  prog.resolve_labels();
+
+  return prog.instructions;
+}
 
-    int entry_name = prog.get_column(cursor, 1);
-    int matches = prog.eq(entry_name, name_reg);
+array<vm_instruction, query_arena> compile_copy(stmt_node *stmt) {
+  program_builder prog;
+  copy_stmt *copy = &stmt->copy_stmt;
 
-    auto delete_if = prog.begin_if(matches);
-    {
-      int deleted = prog.regs.allocate();
-      int still_valid = prog.regs.allocate();
-      prog.delete_record(cursor, deleted, still_valid);
-      prog.goto_label("done");
-    }
-    prog.end_if(delete_if);
+  int args = prog.regs.allocate_range(2);
+  prog.load_string(TYPE_CHAR32, copy->table_name.data(),
+                   copy->table_name.size(), args);
+  prog.load_string(TYPE_CHAR256, copy->file_path.data(),
+                   copy->file_path.size(), args + 1);
+  prog.call_function(vmfunc_copy, args, 2);
 
-    prog.next(cursor, at_end);
-    prog.regs.pop_scope();
+  prog.halt();
+  prog.resolve_labels();
+
+  return prog.instructions;
+}
+
+array<vm_instruction, query_arena> compile_analyze(stmt_node *stmt) {
+  program_builder prog;
+  analyze_stmt *analyze = &stmt->analyze_stmt;
+
+  if (analyze->sem.create_stats_table) {
+    int stats_name_reg = prog.load_string(TYPE_CHAR32, STATS_TABLE);
+    int root_page_reg =
+        prog.call_function(vmfunc_create_relation, stats_name_reg, 1);
+    insert_master_entry(&prog, STATS_TABLE, STATS_TABLE, root_page_reg,
+                        STATS_TABLE_SQL);
   }
-  prog.end_while(scan_loop);
 
-  prog.label("done");
-  prog.close_cursor(cursor);
+  int name_reg =
+      analyze->table_name.empty()
+          ? prog.load_string(TYPE_CHAR32, "")
+          : prog.load_string(TYPE_CHAR32, analyze->table_name.data(),
+                             analyze->table_name.size());
+  prog.call_function(vmfunc_analyze, name_reg, 1);
 
   prog.halt();
   prog.resolve_labels();
@@ -677,12 +2949,20 @@ array<vm_instruction, query_arena> compile_program(stmt_node *stmt) {
     return compile_create_table(stmt);
   case STMT_DROP_TABLE:
     return compile_drop_table(stmt);
+  case STMT_CREATE_INDEX:
+    return compile_create_index(stmt);
+  case STMT_DROP_INDEX:
+    return compile_drop_index(stmt);
   case STMT_BEGIN:
     return compile_begin();
   case STMT_COMMIT:
     return compile_commit();
   case STMT_ROLLBACK:
     return compile_rollback();
+  case STMT_COPY:
+    return compile_copy(stmt);
+  case STMT_ANALYZE:
+    return compile_analyze(stmt);
   }
 
   assert(false && "Invalid program");
@@ -12,6 +12,7 @@
 #include "types.hpp"
 #include "vm.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <cstring>
@@ -50,26 +51,22 @@ struct register_allocator {
 
   int allocate(int specific = -1) {
     if (specific >= 0) {
-      assert(specific < REGISTERS && "Register out of range");
       assert(specific >= next_free && "Cannot allocate already-used register");
       next_free = specific + 1;
       return specific;
     }
 
-    assert(next_free < REGISTERS && "Out of registers");
     return next_free++;
   }
 
   int allocate_range(int count, int start_at = -1) {
     if (start_at >= 0) {
-      assert(start_at + count <= REGISTERS && "Register range out of bounds");
       assert(start_at >= next_free && "Cannot allocate in used range");
       int first = start_at;
       next_free = start_at + count;
       return first;
     }
 
-    assert(next_free + count <= REGISTERS && "Not enough registers for range");
     int first = next_free;
     next_free += count;
     return first;
@@ -96,8 +93,10 @@ struct register_allocator {
  */
 struct while_context {
   const char *loop_label;
+  const char *body_label;
   const char *end_label;
   int condition_reg;
+  bool jump_on;
   int saved_reg_mark;
 };
 
@@ -143,7 +142,7 @@ struct program_builder {
   void emit(vm_instruction inst) { instructions.push(inst); }
 
   const char *unique_label() {
-    static char buf[32];
+    static thread_local char buf[32];
     snprintf(buf, sizeof(buf), ".L%d", label_counter++);
     size_t len = strlen(buf) + 1;
     char *label = (char *)arena<query_arena>::alloc(len);
@@ -161,10 +160,90 @@ struct program_builder {
   }
 
   void jumpif(int test_reg, const char *label, bool jump_if_true) {
+    if (fuse_column_test(test_reg, label, jump_if_true)) {
+      return;
+    }
     patches_needed.push({(uint32_t)instructions.size(), label});
     emit(JUMPIF_MAKE(test_reg, -1, jump_if_true));
   }
 
+  /*
+   * Superinstructions. A few sequences come up in nearly every loop, so
+   * they're replaced by one instruction doing the same work, to save the
+   * dispatches in between. Instructions can only be merged if nothing
+   * jumps between them.
+   */
+  bool label_after(uint32_t pc) {
+    for (const auto &label : labels) {
+      if ((uint32_t)label.pc > pc) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /*
+   * Column, [Load or Column,] Test of the first column, JumpIf on the test
+   *   -> [Load or Column,] ColumnTest
+   */
+  bool fuse_column_test(int test_reg, const char *label, bool jump_if_true) {
+    uint32_t count = instructions.size();
+    if (count < 2) {
+      return false;
+    }
+
+    vm_instruction test = instructions[count - 1];
+    if ((test.opcode != OP_Test && test.opcode != OP_TypedTest) ||
+        test.p1 != test_reg) {
+      return false;
+    }
+
+    uint32_t column_at = count - 2;
+    bool has_load = instructions[column_at].opcode == OP_Load ||
+                    instructions[column_at].opcode == OP_Column;
+    if (has_load) {
+      if (count < 3) {
+        return false;
+      }
+      column_at--;
+    }
+
+    vm_instruction column = instructions[column_at];
+    if (column.opcode != OP_Column || column.p3 != test.p2 ||
+        label_after(column_at)) {
+      return false;
+    }
+    if (has_load) {
+      vm_instruction &right = instructions[column_at + 1];
+      int right_reg = right.opcode == OP_Load ? right.p1 : right.p3;
+      if (right_reg == column.p3 || right_reg != test.p3) {
+        return false;
+      }
+    }
+
+    column_test *params =
+        (column_test *)arena<query_arena>::alloc(sizeof(column_test));
+    params->column = column.p2;
+    params->column_reg = column.p3;
+    params->right_reg = test.p3;
+    params->test_reg = test.p1;
+    params->op = (COMPARISON_OP)test.p5;
+    params->kernel = test.opcode == OP_TypedTest ? (type_test_kernel)test.p4
+                                                 : nullptr;
+
+    // The right side doesn't read the column, so it can go first
+    if (has_load) {
+      instructions[column_at] = instructions[column_at + 1];
+      column_at++;
+    }
+    instructions.pop_back();
+
+    patches_needed.push({column_at, label});
+    instructions[column_at] =
+        COLUMNTEST_MAKE(column.p1, -1, params, jump_if_true);
+    return true;
+  }
+
   void resolve_labels() {
     for (const auto &patch : patches_needed) {
       int32_t target_pc = -1;
@@ -184,6 +263,8 @@ struct program_builder {
         inst.p2 = target_pc;
         break;
       case OP_JumpIf:
+      case OP_StepJump:
+      case OP_ColumnTest:
         inst.p2 = target_pc;
         break;
       default:
@@ -198,14 +279,43 @@ struct program_builder {
     const char *loop_label = unique_label();
     const char *end_label = unique_label();
 
+    const char *body_label = unique_label();
     define_label(loop_label);
     jumpif(condition_reg, end_label, jump_on);
+    define_label(body_label);
 
-    return {loop_label, end_label, condition_reg, regs.mark()};
+    return {loop_label, body_label, end_label, condition_reg, jump_on,
+            regs.mark()};
   }
 
+  /*
+   * The condition is tested again at the bottom rather than jumping back to
+   * the test at the top, and a step of the loop's cursor just before fuses
+   * with that test:
+   *   Step -> R, JumpIf R body  ->  StepJump -> R, body
+   */
   void end_while(const while_context &ctx) {
-    jump_to(ctx.loop_label);
+    uint32_t count = instructions.size();
+    if (count > 0 && !ctx.jump_on && !label_after(count - 1)) {
+      vm_instruction &last = instructions[count - 1];
+      bool is_step = last.opcode == OP_Step ||
+                     (last.opcode == OP_Scan && last.p5 == 0);
+
+      if (is_step && last.p2 == ctx.condition_reg) {
+        STEP_JUMP_MODE mode = STEP_JUMP_SCAN;
+        if (last.opcode == OP_Step) {
+          mode = last.p5 ? STEP_JUMP_FORWARD : STEP_JUMP_BACKWARD;
+        }
+
+        patches_needed.push({count - 1, ctx.body_label});
+        last = STEPJUMP_MAKE(last.p1, ctx.condition_reg, -1, mode);
+        define_label(ctx.end_label);
+        regs.restore(ctx.saved_reg_mark);
+        return;
+      }
+    }
+
+    jumpif(ctx.condition_reg, ctx.body_label, !ctx.jump_on);
     define_label(ctx.end_label);
     regs.restore(ctx.saved_reg_mark);
   }
@@ -242,10 +352,11 @@ struct program_builder {
     assert(type_is_string(type));
     uint32_t size = type_size(type);
 
-    size_t len = src_len ? src_len : strlen((char *)src);
+    // Zero padded to the type's size, strings compare over all of it
+    size_t len = std::min<size_t>(src_len ? src_len : strlen((char *)src), size);
     void *ptr = arena<query_arena>::alloc(size);
+    memset(ptr, 0, size);
     memcpy(ptr, src, len);
-    ((char *)ptr)[len] = '\0';
 
     if (dest_reg == -1) {
       dest_reg = regs.allocate();
@@ -271,6 +382,19 @@ struct program_builder {
     return dest_reg;
   }
 
+  /*
+   * Loads what src holds when the instruction runs rather than a copy of it
+   * now, see parameter_slot
+   */
+  int load_from(data_type type, void *src, int dest_reg = -1) {
+    if (dest_reg == -1) {
+      dest_reg = regs.allocate();
+    }
+
+    emit(LOAD_MAKE(dest_reg, (int64_t)type, src));
+    return dest_reg;
+  }
+
   int load_ptr(void *ptr, int dest_reg = -1) {
 
     if (dest_reg == -1) {
@@ -297,6 +421,23 @@ struct program_builder {
     return dest_reg;
   }
 
+  /*
+   * When both operands are known to be of type, the kernel for it is called
+   * directly, otherwise it falls back to the generic instruction
+   */
+  int typed_arithmetic(int left_reg, int right_reg, ARITH_OP op,
+                       data_type type, int dest_reg = -1) {
+    type_arith_kernel kernel = type_arith_kernel_for(op, type);
+    if (!kernel) {
+      return arithmetic(left_reg, right_reg, op, dest_reg);
+    }
+    if (dest_reg == -1) {
+      dest_reg = regs.allocate();
+    }
+    emit(TYPED_ARITHMETIC_MAKE(dest_reg, left_reg, right_reg, op, kernel));
+    return dest_reg;
+  }
+
   int add(int left_reg, int right_reg, int dest_reg = -1) {
     return arithmetic(left_reg, right_reg, ARITH_ADD, dest_reg);
   }
@@ -321,6 +462,19 @@ struct program_builder {
     return dest_reg;
   }
 
+  int typed_test(int left_reg, int right_reg, COMPARISON_OP op,
+                 data_type type, int dest_reg = -1) {
+    type_test_kernel kernel = type_test_kernel_for(op, type);
+    if (!kernel) {
+      return test(left_reg, right_reg, op, dest_reg);
+    }
+    if (dest_reg == -1) {
+      dest_reg = regs.allocate();
+    }
+    emit(TYPED_TEST_MAKE(dest_reg, left_reg, right_reg, op, kernel));
+    return dest_reg;
+  }
+
   int eq(int left_reg, int right_reg, int dest_reg = -1) {
     return test(left_reg, right_reg, EQ, dest_reg);
   }
@@ -401,6 +555,17 @@ struct program_builder {
     return step(cursor_id, result_reg, false);
   }
 
+  /*
+   * Like next, but skips rows failing the cursor's scan_filter
+   */
+  int scan(int cursor_id, int result_reg = -1, bool from_current = false) {
+    if (result_reg == -1) {
+      result_reg = regs.allocate();
+    }
+    emit(SCAN_MAKE(cursor_id, result_reg, from_current));
+    return result_reg;
+  }
+
   int seek(int cursor_id, int key_reg, COMPARISON_OP op = EQ,
            int result_reg = -1) {
     if (result_reg == -1) {
@@ -410,22 +575,31 @@ struct program_builder {
     return result_reg;
   }
 
-  int get_column(int cursor_id, int col_index, int dest_reg = -1) {
+  /*
+   * By reference, the register points at the column where the row is
+   * stored, see COLUMN_REFERENCE_MAKE
+   */
+  int get_column(int cursor_id, int col_index, int dest_reg = -1,
+                 bool by_reference = false) {
     if (dest_reg == -1) {
       dest_reg = regs.allocate();
     }
-    emit(COLUMN_MAKE(cursor_id, col_index, dest_reg));
+    if (by_reference) {
+      emit(COLUMN_REFERENCE_MAKE(cursor_id, col_index, dest_reg));
+    } else {
+      emit(COLUMN_MAKE(cursor_id, col_index, dest_reg));
+    }
     return dest_reg;
   }
 
   int get_columns(int cursor_id, int start_col, int count,
-                  int first_dest_reg = -1) {
+                  int first_dest_reg = -1, bool by_reference = false) {
     if (first_dest_reg == -1) {
       first_dest_reg = regs.allocate_range(count);
     }
 
     for (int i = 0; i < count; i++) {
-      emit(COLUMN_MAKE(cursor_id, start_col + i, first_dest_reg + i));
+      get_column(cursor_id, start_col + i, first_dest_reg + i, by_reference);
     }
 
     return first_dest_reg;
@@ -435,6 +609,11 @@ struct program_builder {
     emit(INSERT_MAKE(cursor_id, key_reg, record_count));
   }
 
+  // The key in key_reg, the row's values after it, see OP_AggStep
+  void aggregate_step(int cursor_id, int key_reg) {
+    emit(AGGSTEP_MAKE(cursor_id, key_reg));
+  }
+
   int delete_record(int cursor_id, int occurred_reg = -1, int valid_reg = -1) {
     if (occurred_reg == -1) {
       occurred_reg = regs.allocate();
@@ -498,6 +677,16 @@ cursor_context *btree_cursor_from_relation(relation &structure);
 cursor_context *red_black_cursor_from_format(tuple_format &layout,
                                              bool allow_duplicates = true);
 
-array<vm_instruction, query_arena> compile_program(stmt_node *stmt);
+cursor_context *memtree_cursor_from_format(tuple_format &layout,
+                                           bool allow_duplicates = true);
 
-void load_catalog_from_master();
+cursor_context *sorter_cursor_from_format(tuple_format &layout, bool descending,
+                                          uint32_t keep = 0);
+
+cursor_context *hash_cursor_from_format(tuple_format &layout,
+                                        aggregate_spec *aggregates = nullptr);
+
+cursor_context *gather_cursor_from_plan(tuple_format &layout,
+                                        parallel_plan *plan);
+
+array<vm_instruction, query_arena> compile_program(stmt_node *stmt);
@@ -0,0 +1,200 @@
+/*
+ * SQL From Scratch
+ *
+ * Compression
+ *
+ * The compressor remembers the last position each hash of 4 bytes was seen
+ * at, and a position whose 4 bytes match the remembered ones starts a match,
+ * extended as far as it goes. No match starts in the last LZ_MATCH_LIMIT
+ * bytes or runs into the last LZ_LAST_LITERALS, so the tail is always
+ * literals, and the decoder can tell the final sequence by its running out of
+ * input.
+ */
+
+#include "compress.hpp"
+#include <cstring>
+
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+#define LZ_MATCH_LIMIT 12
+#define LZ_LAST_LITERALS 5
+
+static uint32_t read32(const uint8_t *bytes) {
+  uint32_t value;
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+static uint32_t hash4(uint32_t value) {
+  return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+ * The bytes continuing a 4 bit field that was 15, nullptr if they don't fit
+ */
+static uint8_t *write_length(uint8_t *out, uint8_t *end, uint32_t length) {
+  for (; length >= 255; length -= 255) {
+    if (out == end) {
+      return nullptr;
+    }
+    *out++ = 255;
+  }
+
+  if (out == end) {
+    return nullptr;
+  }
+  *out++ = length;
+  return out;
+}
+
+/*
+ * One sequence, a match_length of 0 for the final one with only literals
+ */
+static uint8_t *write_sequence(uint8_t *out, uint8_t *end,
+                               const uint8_t *literals, uint32_t literal_count,
+                               uint32_t offset, uint32_t match_length) {
+  uint32_t match_code = match_length ? match_length - LZ_MIN_MATCH : 0;
+  if (out == end) {
+    return nullptr;
+  }
+  *out++ = (literal_count < 15 ? literal_count : 15) << 4 |
+           (match_code < 15 ? match_code : 15);
+
+  if (literal_count >= 15 &&
+      !(out = write_length(out, end, literal_count - 15))) {
+    return nullptr;
+  }
+  if ((uint32_t)(end - out) < literal_count) {
+    return nullptr;
+  }
+  memcpy(out, literals, literal_count);
+  out += literal_count;
+
+  if (!match_length) {
+    return out;
+  }
+
+  if (end - out < 2) {
+    return nullptr;
+  }
+  *out++ = offset & 0xff;
+  *out++ = offset >> 8;
+
+  if (match_code >= 15 && !(out = write_length(out, end, match_code - 15))) {
+    return nullptr;
+  }
+  return out;
+}
+
+uint32_t lz_compress(const uint8_t *input, uint32_t size, uint8_t *output,
+                     uint32_t capacity) {
+  uint32_t table[1 << LZ_HASH_BITS] = {};
+  uint8_t *out = output;
+  uint8_t *end = output + capacity;
+  uint32_t literal_start = 0;
+  uint32_t pos = 0;
+
+  while (size >= LZ_MATCH_LIMIT && pos <= size - LZ_MATCH_LIMIT) {
+    uint32_t sequence = read32(input + pos);
+    uint32_t hash = hash4(sequence);
+    uint32_t candidate = table[hash];
+    table[hash] = pos;
+
+    if (candidate >= pos || pos - candidate > LZ_MAX_OFFSET ||
+        read32(input + candidate) != sequence) {
+      pos++;
+      continue;
+    }
+
+    uint32_t length = LZ_MIN_MATCH;
+    while (pos + length < size - LZ_LAST_LITERALS &&
+           input[candidate + length] == input[pos + length]) {
+      length++;
+    }
+
+    out = write_sequence(out, end, input + literal_start, pos - literal_start,
+                         pos - candidate, length);
+    if (!out) {
+      return 0;
+    }
+
+    pos += length;
+    literal_start = pos;
+  }
+
+  out = write_sequence(out, end, input + literal_start, size - literal_start,
+                       0, 0);
+  return out ? out - output : 0;
+}
+
+/*
+ * Adds the bytes continuing a 4 bit field that was 15, false if the input
+ * runs out first
+ */
+static bool read_length(const uint8_t **in, const uint8_t *end,
+                        uint32_t *length) {
+  uint8_t byte;
+  do {
+    if (*in == end) {
+      return false;
+    }
+    byte = *(*in)++;
+    *length += byte;
+  } while (byte == 255);
+
+  return true;
+}
+
+uint32_t lz_decompress(const uint8_t *input, uint32_t size, uint8_t *output,
+                       uint32_t capacity) {
+  const uint8_t *in = input;
+  const uint8_t *in_end = input + size;
+  uint8_t *out = output;
+  uint8_t *out_end = output + capacity;
+
+  while (in < in_end) {
+    uint8_t token = *in++;
+
+    uint32_t literal_count = token >> 4;
+    if (literal_count == 15 && !read_length(&in, in_end, &literal_count)) {
+      return 0;
+    }
+    if (literal_count > (uint32_t)(in_end - in) ||
+        literal_count > (uint32_t)(out_end - out)) {
+      return 0;
+    }
+    memcpy(out, in, literal_count);
+    in += literal_count;
+    out += literal_count;
+
+    if (in == in_end) {
+      break;
+    }
+
+    if (in_end - in < 2) {
+      return 0;
+    }
+    uint32_t offset = in[0] | in[1] << 8;
+    in += 2;
+
+    uint32_t length = token & 15;
+    if (length == 15 && !read_length(&in, in_end, &length)) {
+      return 0;
+    }
+    length += LZ_MIN_MATCH;
+
+    if (offset == 0 || offset > (uint32_t)(out - output) ||
+        length > (uint32_t)(out_end - out)) {
+      return 0;
+    }
+
+    // Byte at a time, a match can overlap what it's copying
+    const uint8_t *from = out - offset;
+    for (uint32_t i = 0; i < length; i++) {
+      out[i] = from[i];
+    }
+    out += length;
+  }
+
+  return out - output;
+}
@@ -0,0 +1,39 @@
+/*
+ * SQL From Scratch
+ *
+ * Compression
+ *
+ * A byte oriented LZ77 codec in the style of LZ4's block format, for data
+ * that's stored compressed, see blob_create. It trades ratio for speed:
+ * matches are found through a single hash of the next 4 bytes, and decoding
+ * is a loop of copies, with no entropy coding.
+ *
+ * Input is coded as a run of sequences, each a token byte holding its literal
+ * count and match length (less LZ_MIN_MATCH) as 4 bit fields, either of
+ * which is continued in further bytes when it's 15, then the literals, then
+ * the match's 2 byte distance back into what's been decoded. The last
+ * sequence is only literals.
+ *
+ *   token  [more literal count]  literals  offset  [more match length]
+ *   LLLLMMMM  255 255 .. n        ........  lo hi   255 .. n
+ */
+
+#pragma once
+#include <cstdint>
+
+#define LZ_MIN_MATCH 4
+
+/*
+ * Compresses size bytes of input into output, returning the compressed
+ * size, or 0 if it wouldn't fit in capacity.
+ */
+uint32_t lz_compress(const uint8_t *input, uint32_t size, uint8_t *output,
+                     uint32_t capacity);
+
+/*
+ * Decompresses size bytes of input into output, returning the decompressed
+ * size, or 0 if the input is corrupt or what it decodes to wouldn't fit in
+ * capacity.
+ */
+uint32_t lz_decompress(const uint8_t *input, uint32_t size, uint8_t *output,
+                       uint32_t capacity);
@@ -0,0 +1,512 @@
+/*
+ * SQL From Scratch
+ *
+ * COPY
+ *
+ * A chunk of the file is read into a buffer, its complete lines are loaded,
+ * and the incomplete one at the end is moved to the front before the next
+ * chunk is read in behind it. The next chunk is asked for as the current one
+ * is parsed, see os_file_prefetch.
+ *
+ * Each field is unquoted into a scratch buffer, then converted into its
+ * place in the row, which is laid out as the tree stores it, the key then
+ * the record. A table with VARCHAR columns stores its records packed, the row
+ * is packed as it goes into the tree, and sorted unpacked.
+ */
+
+#include "copy.hpp"
+#include "arena.hpp"
+#include "btree.hpp"
+#include "catalog.hpp"
+#include "os_layer.hpp"
+#include "sorter.hpp"
+#include "types.hpp"
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+struct copy_loader {
+  relation *table;
+  const char *path;
+  tuple_format format;
+  uint32_t key_size;
+  uint8_t *row;  /* The line being loaded, key then record */
+  uint8_t *packed; /* Its record packed, for a table with VARCHAR columns */
+  char *field;   /* The field being parsed, unquoted */
+  uint64_t line; /* Of the file, from 1 */
+  uint64_t rows;
+
+  /* Bulk loading, into an empty table without indexes */
+  bool bulk;
+  bt_bulk_loader loader;
+  bool sorting; /* A row came out of order, every row goes through sort */
+  sorter sort;
+
+  /* Inserting, otherwise */
+  bt_cursor cursor;
+  bt_cursor index_cursors[RELATION_MAX_INDEXES];
+  tuple_format index_formats[RELATION_MAX_INDEXES];
+  uint8_t *index_entries[RELATION_MAX_INDEXES];
+};
+
+/* Unset opens any path, see copy_set_directory */
+static struct {
+  bool confined;
+  char directory[COPY_MAX_PATH_SIZE];
+} COPY_PATHS;
+
+void copy_set_directory(const char *directory) {
+  assert((!directory || strlen(directory) < COPY_MAX_PATH_SIZE) &&
+         "COPY directory is too long");
+  COPY_PATHS.confined = directory != nullptr;
+  strcpy(COPY_PATHS.directory, directory ? directory : "");
+}
+
+/* Whether any of path's components is ".." */
+static bool climbs(const char *path) {
+  for (const char *at = path; *at;) {
+    size_t length = strcspn(at, "/\\");
+    if (length == 2 && at[0] == '.' && at[1] == '.') {
+      return true;
+    }
+    at += length + (at[length] != '\0');
+  }
+  return false;
+}
+
+/* The file to open for path into full, otherwise why it's refused */
+static const char *resolve_path(const char *path, char *full, size_t size) {
+  if (!COPY_PATHS.confined) {
+    snprintf(full, size, "%s", path);
+    return nullptr;
+  }
+  if (!COPY_PATHS.directory[0]) {
+    return "reading files is turned off";
+  }
+  if (path[0] == '/' || path[0] == '\\' || strchr(path, ':') || climbs(path)) {
+    return "the path has to be relative, without '..'";
+  }
+  snprintf(full, size, "%s/%s", COPY_PATHS.directory, path);
+  return nullptr;
+}
+
+static bool copy_error(copy_loader *copy, const char *message) {
+  printf("COPY %s from %s, line %llu: %s\n", copy->table->name, copy->path,
+         (unsigned long long)copy->line, message);
+  return false;
+}
+
+/*
+ * Fields
+ */
+
+static bool parse_unsigned(const char *field, uint32_t length, uint32_t size,
+                           uint64_t *value) {
+  uint64_t max = size >= 8 ? UINT64_MAX : (1ull << (size * 8)) - 1;
+  *value = 0;
+  for (uint32_t i = 0; i < length; i++) {
+    uint32_t digit = field[i] - '0';
+    if (digit > 9 || *value > (max - digit) / 10) {
+      return false;
+    }
+    *value = *value * 10 + digit;
+  }
+  return true;
+}
+
+/* An empty field is zero, as the row-at-a-time loader had it */
+static bool parse_value(data_type type, const char *field, uint32_t length,
+                        uint8_t *dst) {
+  uint32_t size = type_size(type);
+  uint8_t id = type_id(type);
+
+  if (type_is_string(type)) {
+    if (length > size) {
+      return false;
+    }
+    memcpy(dst, field, length);
+    return true;
+  }
+
+  if (id >= TYPE_ID_U8 && id <= TYPE_ID_U64) {
+    uint64_t value;
+    if (!parse_unsigned(field, length, size, &value)) {
+      return false;
+    }
+    memcpy(dst, &value, size);
+    return true;
+  }
+
+  if (id >= TYPE_ID_I8 && id <= TYPE_ID_I64) {
+    bool negative = length > 0 && field[0] == '-';
+    uint64_t magnitude;
+    if (!parse_unsigned(field + negative, length - negative, size, &magnitude) ||
+        magnitude > (1ull << (size * 8 - 1)) - !negative) {
+      return false;
+    }
+    int64_t value = negative ? -(int64_t)magnitude : (int64_t)magnitude;
+    memcpy(dst, &value, size);
+    return true;
+  }
+
+  if (id == TYPE_ID_F32 || id == TYPE_ID_F64) {
+    char *end;
+    double value = length ? strtod(field, &end) : 0;
+    if (length && end != field + length) {
+      return false;
+    }
+    if (id == TYPE_ID_F32) {
+      float narrowed = value;
+      memcpy(dst, &narrowed, sizeof(narrowed));
+    } else {
+      memcpy(dst, &value, sizeof(value));
+    }
+    return true;
+  }
+
+  return false;
+}
+
+/*
+ * Unquotes the field starting at *at into copy->field, leaving *at on the
+ * comma after it or at end. Spaces and tabs around the field are dropped.
+ */
+static bool next_field(copy_loader *copy, const char **at, const char *end,
+                       uint32_t *length) {
+  const char *c = *at;
+  char *out = copy->field;
+
+  while (c < end && (*c == ' ' || *c == '\t')) {
+    c++;
+  }
+
+  if (c < end && *c == '"') {
+    for (c++;; c++) {
+      if (c == end) {
+        return copy_error(copy, "Unterminated quoted field");
+      }
+      if (*c == '"' && (c + 1 == end || c[1] != '"')) {
+        c++;
+        break;
+      }
+      if (*c == '"') {
+        c++;
+      }
+      *out++ = *c;
+    }
+    while (c < end && (*c == ' ' || *c == '\t')) {
+      c++;
+    }
+    if (c < end && *c != ',') {
+      return copy_error(copy, "Characters after a quoted field");
+    }
+  } else {
+    while (c < end && *c != ',') {
+      *out++ = *c++;
+    }
+    while (out > copy->field && (out[-1] == ' ' || out[-1] == '\t')) {
+      out--;
+    }
+  }
+
+  *out = '\0';
+  *length = out - copy->field;
+  *at = c;
+  return true;
+}
+
+/* Fills copy->row from the line [start, end) */
+static bool parse_row(copy_loader *copy, const char *start, const char *end) {
+  tuple_format &format = copy->format;
+  uint32_t column_count = format.columns.size();
+  memset(copy->row, 0, copy->key_size + format.record_size);
+
+  const char *at = start;
+  for (uint32_t i = 0; i < column_count; i++) {
+    if (i > 0) {
+      if (at == end) {
+        char message[64];
+        snprintf(message, sizeof(message), "%u fields, expected %u", i,
+                 column_count);
+        return copy_error(copy, message);
+      }
+      at++; // The comma
+    }
+
+    uint32_t length;
+    if (!next_field(copy, &at, end, &length)) {
+      return false;
+    }
+
+    uint8_t *dst =
+        i == 0 ? copy->row : copy->row + copy->key_size + format.offsets[i - 1];
+    if (!parse_value(format.columns[i], copy->field, length, dst)) {
+      char message[128];
+      snprintf(message, sizeof(message), "'%.32s' isn't a valid %s",
+               copy->field, type_name(format.columns[i]));
+      return copy_error(copy, message);
+    }
+  }
+
+  if (at != end) {
+    return copy_error(copy, "More fields than the table has columns");
+  }
+  return true;
+}
+
+/*
+ * Rows
+ */
+
+/*
+ * The record as the table stores it, nullptr if it can't be made to fit
+ */
+static uint8_t *stored_record(copy_loader *copy, uint8_t *record,
+                              uint32_t *size) {
+  if (!copy->packed) {
+    *size = copy->format.record_size;
+    return record;
+  }
+  *size = record_pack(copy->format, record, copy->packed,
+                      copy->table->storage.btree.record_size);
+  return *size ? copy->packed : nullptr;
+}
+
+/*
+ * What's been bulk loaded so far goes into the sort, and the tree is emptied
+ * to be loaded again once every row's been sorted
+ */
+static bool start_sorting(copy_loader *copy) {
+  btree *tree = &copy->table->storage.btree;
+  bt_bulk_finish(&copy->loader);
+
+  copy->sort =
+      sorter_create(copy->format.key_type, copy->format.record_size, false);
+  copy->sorting = true;
+
+  uint8_t image[copy->format.record_size];
+  bt_cursor cursor = {.tree = tree};
+  if (bt_cursor_first(&cursor)) {
+    do {
+      uint8_t *record = (uint8_t *)bt_cursor_record(&cursor);
+      if (copy->packed) {
+        record_unpack(copy->format, record, image);
+        record_release(copy->format, record);
+        record = image;
+      }
+      if (!sorter_insert(&copy->sort, bt_cursor_key(&cursor), record)) {
+        return copy_error(copy, "Couldn't write to the sort");
+      }
+    } while (bt_cursor_next(&cursor));
+  }
+  bt_truncate(tree);
+  return true;
+}
+
+static bool insert_row(copy_loader *copy) {
+  uint8_t *key = copy->row;
+  uint8_t *record = copy->row + copy->key_size;
+
+  uint32_t size;
+  uint8_t *stored = stored_record(copy, record, &size);
+  if (!stored) {
+    return copy_error(copy, "The row is too long for the table");
+  }
+  if (!bt_cursor_insert(&copy->cursor, key, stored, size)) {
+    if (copy->packed) {
+      record_release(copy->format, stored);
+    }
+    return copy_error(copy, "The key is already in the table");
+  }
+
+  relation *table = copy->table;
+  for (uint32_t i = 0; i < table->indexes.size(); i++) {
+    uint8_t *entry = copy->index_entries[i];
+    uint8_t *entry_record =
+        entry + type_size(copy->index_formats[i].key_type);
+    build_index_entry(table->indexes[i], copy->format, key, record, entry,
+                      entry_record);
+    if (!bt_cursor_insert(&copy->index_cursors[i], entry, entry_record)) {
+      return copy_error(copy, "Couldn't add the row's index entry");
+    }
+  }
+  return true;
+}
+
+static bool load_row(copy_loader *copy) {
+  uint8_t *key = copy->row;
+  uint8_t *record = copy->row + copy->key_size;
+  copy->rows++;
+
+  if (!copy->bulk) {
+    return insert_row(copy);
+  }
+
+  if (!copy->sorting) {
+    uint32_t size;
+    uint8_t *stored = stored_record(copy, record, &size);
+    if (!stored) {
+      return copy_error(copy, "The row is too long for the table");
+    }
+    if (bt_bulk_append(&copy->loader, key, stored, size)) {
+      return true;
+    }
+    if (copy->packed) {
+      record_release(copy->format, stored);
+    }
+    if (!start_sorting(copy)) {
+      return false;
+    }
+  }
+
+  if (!sorter_insert(&copy->sort, key, record)) {
+    return copy_error(copy, "Couldn't write to the sort");
+  }
+  return true;
+}
+
+/* Loads the tree from the sort, now that it has every row */
+static bool load_sorted(copy_loader *copy) {
+  bt_bulk_begin(&copy->loader, &copy->table->storage.btree);
+
+  data_type key_type = copy->format.key_type;
+  uint8_t *previous = nullptr;
+  for (bool valid = sorter_first(&copy->sort); valid;
+       valid = sorter_next(&copy->sort)) {
+    uint8_t *key = (uint8_t *)sorter_key(&copy->sort);
+    if (previous && type_equals(key_type, previous, key)) {
+      return copy_error(copy, "A key appears more than once in the file");
+    }
+    uint32_t size;
+    uint8_t *stored =
+        stored_record(copy, (uint8_t *)sorter_record(&copy->sort), &size);
+    if (!stored) {
+      return copy_error(copy, "The row is too long for the table");
+    }
+    bt_bulk_append(&copy->loader, key, stored, size);
+
+    if (!previous) {
+      previous = copy->row;
+    }
+    memcpy(previous, key, copy->key_size);
+  }
+
+  if (copy->sort.failed) {
+    return copy_error(copy, "Couldn't read the sort back");
+  }
+  bt_bulk_finish(&copy->loader);
+  return true;
+}
+
+static bool finish(copy_loader *copy) {
+  if (!copy->bulk) {
+    return true;
+  }
+  if (!copy->sorting) {
+    bt_bulk_finish(&copy->loader);
+    return true;
+  }
+  return load_sorted(copy);
+}
+
+/*
+ * The file
+ */
+
+/* A line, without its end of line, the first is the header */
+static bool load_line(copy_loader *copy, const char *start, const char *end) {
+  copy->line++;
+  if (end > start && end[-1] == '\r') {
+    end--;
+  }
+  if (copy->line == 1 || end == start) {
+    return true;
+  }
+  return parse_row(copy, start, end) && load_row(copy);
+}
+
+static bool load_file(copy_loader *copy, os_file_handle_t file) {
+  char *buffer = (char *)arena<query_arena>::alloc(COPY_CHUNK_SIZE);
+  uint32_t used = 0;
+  os_file_offset_t offset = 0;
+
+  while (true) {
+    os_file_size_t read = os_file_read(file, buffer + used, COPY_CHUNK_SIZE - used);
+    offset += read;
+    used += read;
+    os_file_prefetch(file, offset, COPY_CHUNK_SIZE);
+
+    const char *at = buffer;
+    const char *end = buffer + used;
+    while (const char *newline = (const char *)memchr(at, '\n', end - at)) {
+      if (!load_line(copy, at, newline)) {
+        return false;
+      }
+      at = newline + 1;
+    }
+
+    if (read == 0) {
+      return at == end || load_line(copy, at, end);
+    }
+
+    if (at == buffer && used == COPY_CHUNK_SIZE) {
+      copy->line++;
+      return copy_error(copy, "Line longer than COPY_CHUNK_SIZE");
+    }
+
+    used = end - at;
+    memmove(buffer, at, used);
+  }
+}
+
+bool copy_from_csv(relation *table, const char *path, uint64_t *rows) {
+  char full[COPY_MAX_PATH_SIZE * 2];
+  if (const char *refused = resolve_path(path, full, sizeof(full))) {
+    printf("COPY %s: can't read %s, %s\n", table->name, path, refused);
+    return false;
+  }
+
+  os_file_handle_t file = os_file_open(full, false, false);
+  if (file == OS_INVALID_HANDLE) {
+    printf("COPY %s: couldn't open %s\n", table->name, path);
+    return false;
+  }
+
+  copy_loader copy = {};
+  copy.table = table;
+  copy.path = path;
+  copy.format = tuple_format_from_relation(*table);
+  copy.key_size = type_size(copy.format.key_type);
+  copy.row = (uint8_t *)arena<query_arena>::alloc(copy.key_size +
+                                                  copy.format.record_size);
+  copy.field = (char *)arena<query_arena>::alloc(COPY_CHUNK_SIZE + 1);
+
+  btree *tree = &table->storage.btree;
+  if (copy.format.packed_size) {
+    copy.packed = (uint8_t *)arena<query_arena>::alloc(tree->record_size);
+  }
+  copy.cursor = {.tree = tree};
+  copy.bulk = table->indexes.size() == 0 && !bt_cursor_first(&copy.cursor) &&
+              bt_bulk_begin(&copy.loader, tree);
+
+  for (uint32_t i = 0; !copy.bulk && i < table->indexes.size(); i++) {
+    secondary_index &index = table->indexes[i];
+    copy.index_cursors[i] = {.tree = &index.btree};
+    copy.index_formats[i] = tuple_format_from_index(*table, index);
+    copy.index_entries[i] = (uint8_t *)arena<query_arena>::alloc(
+        type_size(copy.index_formats[i].key_type) +
+        copy.index_formats[i].record_size);
+  }
+
+  bool loaded = load_file(&copy, file) && finish(&copy);
+  os_file_close(file);
+  if (copy.sorting) {
+    sorter_close(&copy.sort);
+  }
+
+  if (rows) {
+    *rows = copy.rows;
+  }
+  return loaded;
+}
@@ -0,0 +1,53 @@
+/*
+ * SQL From Scratch
+ *
+ * COPY
+ *
+ * 'COPY orders FROM 'orders.csv'' loads a CSV file into a table without going
+ * through INSERT statements. The file is read a chunk at a time, and each
+ * line's fields are parsed straight into the table's record layout, so a file
+ * of any size loads in a fixed amount of memory.
+ *
+ * The first line holds the column names and is skipped. Every other line is a
+ * row with a field for each of the table's columns, in table order. A field
+ * may be quoted, with "" for a quote inside it, and spaces around it are
+ * dropped. A line can't span lines, and can't be longer than COPY_CHUNK_SIZE.
+ *
+ * Into an empty table without indexes, rows are bulk loaded, see
+ * bt_bulk_begin. Rows already in key order go straight into the tree, if one
+ * arrives out of order, what's been loaded goes back through an external sort
+ * with the rest of the file, see sorter.hpp, and the tree is loaded from that.
+ * Otherwise each row is inserted, along with its index entries.
+ *
+ * The whole file is loaded within the statement's transaction, a bad row or a
+ * key that's already there fails the COPY, and it's rolled back.
+ *
+ * The server confines the files COPY can read, see copy_set_directory, as a
+ * client shouldn't be able to load any file the server's process can read.
+ */
+
+#pragma once
+#include "catalog.hpp"
+#include <cstdint>
+
+/* The file is read this much at a time */
+#define COPY_CHUNK_SIZE (1u << 20)
+
+/* Including the terminator */
+#define COPY_MAX_PATH_SIZE 256
+
+/*
+ * Loads the CSV file at path into table, inside the caller's transaction.
+ * False if the file can't be read, a row doesn't fit the table, or a key is
+ * already there, with the reason printed, and the caller should roll back.
+ */
+bool
+copy_from_csv(relation *table, const char *path, uint64_t *rows = nullptr);
+
+/*
+ * Confines the paths COPY opens to directory: a path has to be relative, with
+ * no ".." in it, and is opened under directory. "" refuses every path, and
+ * nullptr, as the REPL starts out, opens any path.
+ */
+void
+copy_set_directory(const char *directory);
@@ -12,213 +12,26 @@
 #include "catalog.hpp"
 #include "common.hpp"
 #include "compile.hpp"
+#include "copy.hpp"
+#include "pager.hpp"
 #include "repl.hpp"
 #include "types.hpp"
 #include "vm.hpp"
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
-bool execute_sql_statements(const char *sql);
 void formatted_result_callback(typed_value *result, size_t count);
+/*
+ * Through COPY, see copy.hpp, rather than an INSERT for each row
+ */
 void load_table_from_csv_sql(const char *csv_file, const char *table_name) {
-  relation *structure = catalog.get(table_name);
-  if (!structure) {
-    return;
-  }
-
-  FILE *file = fopen(csv_file, "r");
-  if (!file) {
-    fprintf(stderr, "Failed to open CSV file: %s\n", csv_file);
-    return;
-  }
-
-  fseek(file, 0, SEEK_END);
-  long file_size = ftell(file);
-  fseek(file, 0, SEEK_SET);
-
-  if (file_size <= 0) {
-    fprintf(stderr, "CSV file is empty: %s\n", csv_file);
-    fclose(file);
-    return;
-  }
-
-  char *file_buffer = (char *)arena<query_arena>::alloc(file_size + 1);
-  if (!file_buffer) {
-    fprintf(stderr, "Failed to allocate buffer for CSV file\n");
-    fclose(file);
-    return;
-  }
-
-  size_t bytes_read = fread(file_buffer, 1, file_size, file);
-  fclose(file);
-
-  if (bytes_read != (size_t)file_size) {
-    fprintf(stderr, "Failed to read entire CSV file\n");
-    return;
-  }
-  file_buffer[bytes_read] = '\0';
-
-  auto column_stream = stream_writer<query_arena>::begin();
-  for (uint32_t i = 0; i < structure->columns.size(); i++) {
-    if (i > 0) {
-      column_stream.write(", ");
-    }
-    column_stream.write(structure->columns[i].name);
-  }
-  string_view column_list = column_stream.finish().as_view();
-
-  char *current = file_buffer;
-  char *line_start = current;
-
-  while (*current && *current != '\n') {
-    current++;
-  }
-  if (*current == '\n') {
-    current++;
-  }
-
-  int count = 0;
-  int batch_count = 0;
-  const int BATCH_SIZE = 50;
-
-  while (*current) {
-    line_start = current;
-
-    char *line_end = current;
-    while (*line_end && *line_end != '\n' && *line_end != '\r') {
-      line_end++;
-    }
-
-    if (line_end == current) {
-      if (*current == '\r')
-        current++;
-      if (*current == '\n')
-        current++;
-      continue;
-    }
-
-    char **fields = (char **)arena<query_arena>::alloc(
-        sizeof(char *) * structure->columns.size());
-    size_t field_count = 0;
-
-    char *field_start = current;
-    char *write_pos = nullptr;
-    bool in_quotes = false;
-
-    char *field_buffer =
-        (char *)arena<query_arena>::alloc(line_end - current + 1);
-    write_pos = field_buffer;
-
-    while (current <= line_end) {
-      if (*current == '"' && current < line_end) {
-        if (!in_quotes) {
-          in_quotes = true;
-          field_start = current + 1;
-          write_pos = field_buffer;
-        } else if (*(current + 1) == '"') {
-
-          *write_pos++ = '"';
-          current++;
-        } else {
-
-          in_quotes = false;
-        }
-      } else if ((*current == ',' || current == line_end) && !in_quotes) {
-
-        if (field_count < structure->columns.size()) {
-          *write_pos = '\0';
-
-          char *field_final = field_buffer;
-          size_t field_len = write_pos - field_buffer;
-
-          while (*field_final == ' ' || *field_final == '\t') {
-            field_final++;
-          }
-
-          while (field_len > 0 && (field_final[field_len - 1] == ' ' ||
-                                   field_final[field_len - 1] == '\t' ||
-                                   field_final[field_len - 1] == '\r')) {
-            field_final[--field_len] = '\0';
-          }
-
-          fields[field_count++] = field_final;
-
-          field_buffer =
-              (char *)arena<query_arena>::alloc(line_end - current + 1);
-          write_pos = field_buffer;
-          field_start = current + 1;
-        }
-
-        if (current == line_end) {
-          break;
-        }
-      } else if (in_quotes || (*current != ',' && *current != '\r')) {
-
-        *write_pos++ = *current;
-      }
-
-      current++;
-    }
-
-    current = line_end;
-    if (*current == '\r') {
-      current++;
-    }
-    if (*current == '\n') {
-      current++;
-    }
-
-    if (field_count != structure->columns.size()) {
-      printf("Warning: row has %zu fields, expected %zu\n", field_count,
-             structure->columns.size());
-      continue;
-    }
-
-    auto sql_stream = stream_writer<query_arena>::begin();
-    sql_stream.write("INSERT INTO ");
-    sql_stream.write(table_name);
-    sql_stream.write(" (");
-    sql_stream.write(column_list.data(), column_list.size());
-    sql_stream.write(") VALUES (");
-
-    for (size_t i = 0; i < field_count; i++) {
-      if (i > 0) {
-        sql_stream.write(", ");
-      }
-
-      data_type col_type = structure->columns[i].type;
-
-      if (type_is_numeric(col_type)) {
-        sql_stream.write(fields[i]);
-      } else if (type_is_string(col_type)) {
-        sql_stream.write("'");
-
-        char *p = fields[i];
-        while (*p) {
-          if (*p == '\'') {
-            sql_stream.write("''");
-          } else {
-            sql_stream.write(p, 1);
-          }
-          p++;
-        }
-        sql_stream.write("'");
-      }
-    }
-
-    sql_stream.write(");");
-    string_view sql_statement = sql_stream.finish().as_view();
-
-    if (execute_sql_statements(sql_statement.data())) {
-      count++;
-    } else {
-      printf("❌ Failed to insert row %d\n", count + 1);
-    }
-
-    if (++batch_count >= BATCH_SIZE) {
-      batch_count = 0;
-    }
+  char sql[COPY_MAX_PATH_SIZE + 64];
+  snprintf(sql, sizeof(sql), "COPY %s FROM '%s';", table_name, csv_file);
+  if (!execute_sql_statements(sql)) {
+    fprintf(stderr, "Failed to load CSV file: %s\n", csv_file);
   }
 }
 
@@ -302,7 +115,7 @@ void demo_like_pattern(const char *args) {
 
   program_builder prog;
 
-  relation *users = catalog.get("users");
+  relation *users = catalog_get("users");
 
   if (!users) {
     printf("Products table not found!\n");
@@ -367,8 +180,8 @@ void demo_nested_loop_join(const char *args) {
 
   program_builder prog;
 
-  relation *users = catalog.get("users");
-  relation *orders = catalog.get("orders");
+  relation *users = catalog_get("users");
+  relation *orders = catalog_get("orders");
   if (!users || !orders) {
     printf("Required tables not found!\n");
     return;
@@ -466,7 +279,7 @@ void demo_subquery_pattern(const char *args) {
 
   program_builder prog;
 
-  relation *users = catalog.get("users");
+  relation *users = catalog_get("users");
   if (!users) {
     printf("Users table not found!\n");
     return;
@@ -474,7 +287,7 @@ void demo_subquery_pattern(const char *args) {
 
   auto users_ctx = btree_cursor_from_relation(*users);
   tuple_format temp_layout = users_ctx->layout;
-  auto temp_ctx = red_black_cursor_from_format(temp_layout);
+  auto temp_ctx = memtree_cursor_from_format(temp_layout);
 
   int users_cursor = prog.open_cursor(users_ctx);
   int temp_cursor = prog.open_cursor(temp_ctx);
@@ -553,7 +366,7 @@ void demo_group_by_aggregate(const char *args) {
         "Query: SELECT city, COUNT(*), SUM(age) FROM users GROUP BY city\n\n");
   }
   program_builder prog;
-  relation *users = catalog.get("users");
+  relation *users = catalog_get("users");
   if (!users) {
     printf("Users table not found!\n");
     return;
@@ -566,7 +379,7 @@ void demo_group_by_aggregate(const char *args) {
   };
   tuple_format agg_layout = tuple_format_from_types(agg_types);
   auto users_ctx = btree_cursor_from_relation(*users);
-  auto agg_ctx = red_black_cursor_from_format(agg_layout);
+  auto agg_ctx = memtree_cursor_from_format(agg_layout, false);
   int users_cursor = prog.open_cursor(users_ctx);
   int agg_cursor = prog.open_cursor(agg_ctx);
 
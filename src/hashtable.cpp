@@ -0,0 +1,367 @@
+/*
+ * SQL From Scratch
+ *
+ * Hash Table
+ *
+ * The map holds the first row of each key's chain, keyed on the key's bytes
+ * where they're stored in that row. Rows are allocated from blocks that are
+ * kept for the whole statement and refilled on every pass, so nothing a map
+ * entry or a register points at moves while its pass is being read.
+ *
+ * A partition is written out a buffer at a time, each buffer becoming a
+ * chunk of rows in the file, so reading a partition back is a few large
+ * reads however its rows were interleaved with the others'.
+ */
+
+#include "hashtable.hpp"
+#include "arena.hpp"
+#include "os_layer.hpp"
+#include "pager.hpp"
+#include "types.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+static size_t hash_memory_budget = HASH_TABLE_DEFAULT_MEMORY;
+
+void ht_set_memory_budget(size_t bytes) { hash_memory_budget = bytes; }
+
+/* In memory a row is a hash_row, then the key and record, 8 byte aligned */
+static inline uint32_t row_stride(hash_table *table) {
+  return (sizeof(hash_row) + table->row_size + 7) & ~7u;
+}
+
+static inline uint8_t *row_data(hash_row *row) { return (uint8_t *)(row + 1); }
+
+static inline uint32_t rows_per_buffer(hash_table *table) {
+  return std::max<uint32_t>(1, HASH_TABLE_WRITE_BUFFER_SIZE / table->row_size);
+}
+
+/*
+ * Keys are compared and hashed as bytes, so a string's bytes past its end,
+ * which could be anything, are zeroed
+ */
+static void copy_key(hash_table *table, uint8_t *dest, const void *key) {
+  if (type_is_string(table->key_type)) {
+    size_t length = strnlen((const char *)key, table->key_size);
+    memcpy(dest, key, length);
+    memset(dest + length, 0, table->key_size - length);
+  } else {
+    memcpy(dest, key, table->key_size);
+  }
+}
+
+static uint32_t partition_of(hash_table *table, const void *key) {
+  return hash_int(hash_bytes(key, table->key_size)) % HASH_TABLE_PARTITIONS;
+}
+
+hash_table ht_create(data_type key_type, uint32_t record_size,
+                     ht_combine_fn combine, void *context) {
+  hash_table table = {};
+  table.key_type = key_type;
+  table.combine = combine;
+  table.combine_context = context;
+  table.key_size = type_size(key_type);
+  table.row_size = table.key_size + record_size;
+
+  uint32_t stride = row_stride(&table);
+  table.rows_per_block = std::max<uint32_t>(1, HASH_TABLE_BLOCK_SIZE / stride);
+
+  // A map entry is about four pointers' worth
+  table.max_rows = (uint32_t)std::max<size_t>(
+      16, hash_memory_budget / (stride + 4 * sizeof(void *)));
+  table.file = OS_INVALID_HANDLE;
+  table.probe_key = (uint8_t *)arena<query_arena>::alloc(table.key_size);
+  return table;
+}
+
+static hash_row *row_at(hash_table *table, uint32_t number) {
+  return (hash_row *)(table->blocks[number / table->rows_per_block] +
+                      (size_t)(number % table->rows_per_block) *
+                          row_stride(table));
+}
+
+/*
+ * Adds a row to the ones in memory, at the front of its key's chain, or
+ * combines it into the row already there
+ */
+static void add_row(hash_table *table, const void *key, const void *record) {
+  if (table->combine) {
+    copy_key(table, table->probe_key, key);
+    hash_row **head = table->chains.get(
+        string_view((const char *)table->probe_key, table->key_size));
+    if (head) {
+      table->combine(table->combine_context,
+                     row_data(*head) + table->key_size,
+                     static_cast<const uint8_t *>(record));
+      return;
+    }
+  }
+
+  if (table->row_count / table->rows_per_block == table->blocks.size()) {
+    size_t size = std::max<size_t>(HASH_TABLE_BLOCK_SIZE, row_stride(table));
+    table->blocks.push((uint8_t *)arena<query_arena>::alloc(size));
+  }
+
+  hash_row *row = row_at(table, table->row_count++);
+  uint8_t *data = row_data(row);
+  copy_key(table, data, key);
+  memcpy(data + table->key_size, record, table->row_size - table->key_size);
+
+  string_view key_bytes((const char *)data, table->key_size);
+  hash_row **head = table->chains.get(key_bytes);
+  if (head) {
+    row->next = *head;
+    *head = row;
+  } else {
+    row->next = nullptr;
+    table->chains.insert(key_bytes, row);
+  }
+}
+
+static void clear_rows(hash_table *table) {
+  table->chains.clear();
+  table->row_count = 0;
+  table->current = nullptr;
+}
+
+/*
+ * Partitions
+ */
+
+static bool flush_partition(hash_table *table, hash_partition *partition) {
+  if (partition->write_rows == 0) {
+    return true;
+  }
+
+  size_t size = (size_t)partition->write_rows * table->row_size;
+  os_file_seek(table->file, table->file_size);
+  if (os_file_write(table->file, partition->write_buffer, size) != size) {
+    table->failed = true;
+    return false;
+  }
+
+  partition->chunks.push({table->file_size, partition->write_rows});
+  table->file_size += size;
+  partition->write_rows = 0;
+  return true;
+}
+
+static bool write_row(hash_table *table, const void *key, const void *record) {
+  copy_key(table, table->probe_key, key);
+  hash_partition *partition =
+      &table->partitions[partition_of(table, table->probe_key)];
+  if (!partition->write_buffer) {
+    partition->write_buffer = (uint8_t *)arena<query_arena>::alloc(
+        (size_t)rows_per_buffer(table) * table->row_size);
+  }
+
+  uint8_t *row =
+      partition->write_buffer + (size_t)partition->write_rows * table->row_size;
+  memcpy(row, table->probe_key, table->key_size);
+  memcpy(row + table->key_size, record, table->row_size - table->key_size);
+  partition->write_rows++;
+  partition->row_count++;
+
+  if (partition->write_rows == rows_per_buffer(table)) {
+    return flush_partition(table, partition);
+  }
+  return true;
+}
+
+/*
+ * Moves the rows in memory out to the partitions, every row after them goes
+ * straight there
+ */
+static bool spill(hash_table *table) {
+  pager_temp_file_name(table->file_name, sizeof(table->file_name));
+  table->file = os_file_open(table->file_name, true, true);
+  if (table->file == OS_INVALID_HANDLE) {
+    fprintf(stderr, "Hash table: can't create %s\n", table->file_name);
+    table->failed = true;
+    return false;
+  }
+  os_file_truncate(table->file, 0);
+
+  table->spilled = true;
+  table->read_buffer = (uint8_t *)arena<query_arena>::alloc(
+      (size_t)rows_per_buffer(table) * table->row_size);
+
+  for (uint32_t i = 0; i < table->row_count; i++) {
+    uint8_t *data = row_data(row_at(table, i));
+    if (!write_row(table, data, data + table->key_size)) {
+      return false;
+    }
+  }
+
+  clear_rows(table);
+  return true;
+}
+
+static bool load_chunk(hash_table *table, hash_chunk *chunk) {
+  size_t size = (size_t)chunk->count * table->row_size;
+  os_file_seek(table->file, chunk->offset);
+  if (os_file_read(table->file, table->read_buffer, size) != size) {
+    fprintf(stderr, "Hash table: failed reading a partition back from %s\n",
+            table->file_name);
+    table->failed = true;
+    return false;
+  }
+
+  for (uint32_t i = 0; i < chunk->count; i++) {
+    uint8_t *row = table->read_buffer + (size_t)i * table->row_size;
+    add_row(table, row, row + table->key_size);
+  }
+  return true;
+}
+
+/*
+ * Loads whole partitions while they fit. One that doesn't fit on its own is
+ * loaded as far as it does, the next pass picks it up where this one left it,
+ * unless rows are combined, when a key's rows must all be in the same pass.
+ */
+static bool load_pass(hash_table *table) {
+  clear_rows(table);
+
+  while (table->next_partition < HASH_TABLE_PARTITIONS &&
+         table->partitions[table->next_partition].row_count == 0) {
+    table->next_partition++;
+  }
+  if (table->next_partition == HASH_TABLE_PARTITIONS) {
+    return false;
+  }
+
+  table->first_loaded = table->next_partition;
+  while (table->next_partition < HASH_TABLE_PARTITIONS) {
+    hash_partition *partition = &table->partitions[table->next_partition];
+    if (table->next_chunk == 0 && table->row_count > 0 &&
+        table->row_count + partition->row_count > table->max_rows) {
+      break;
+    }
+
+    while (table->next_chunk < partition->chunks.size()) {
+      hash_chunk *chunk = &partition->chunks[table->next_chunk];
+      if (!table->combine && table->row_count > 0 &&
+          table->row_count + chunk->count > table->max_rows) {
+        table->end_loaded = table->next_partition + 1;
+        return true;
+      }
+      if (!load_chunk(table, chunk)) {
+        return false;
+      }
+      table->next_chunk++;
+    }
+
+    table->next_partition++;
+    table->next_chunk = 0;
+  }
+
+  table->end_loaded = table->next_partition;
+  return true;
+}
+
+bool ht_insert(hash_table *table, void *key, void *record) {
+  assert(!table->reading && "Rows can't be added to a table being read");
+
+  if (table->failed) {
+    return false;
+  }
+
+  if (!table->spilled && table->row_count == table->max_rows &&
+      !spill(table)) {
+    return false;
+  }
+
+  if (table->spilled) {
+    return write_row(table, key, record);
+  }
+
+  add_row(table, key, record);
+  return true;
+}
+
+bool ht_rewind(hash_table *table) {
+  if (!table->reading) {
+    table->reading = true;
+    for (uint32_t i = 0; table->spilled && i < HASH_TABLE_PARTITIONS; i++) {
+      if (!flush_partition(table, &table->partitions[i])) {
+        break;
+      }
+    }
+  }
+
+  table->current = nullptr;
+  if (table->failed) {
+    return false;
+  }
+
+  if (!table->spilled) {
+    if (table->passes_done) {
+      return false;
+    }
+    table->passes_done = true;
+  } else if (!load_pass(table)) {
+    return false;
+  }
+
+  table->in_chain = false;
+  table->position = 0;
+  table->current = table->row_count > 0 ? row_at(table, 0) : nullptr;
+  return table->current != nullptr;
+}
+
+bool ht_seek(hash_table *table, const void *key) {
+  table->in_chain = true;
+  table->current = nullptr;
+  copy_key(table, table->probe_key, key);
+
+  if (table->spilled) {
+    uint32_t partition = partition_of(table, table->probe_key);
+    if (partition < table->first_loaded || partition >= table->end_loaded) {
+      return false;
+    }
+  }
+
+  hash_row **head = table->chains.get(
+      string_view((const char *)table->probe_key, table->key_size));
+  if (head) {
+    table->current = *head;
+  }
+  return table->current != nullptr;
+}
+
+bool ht_next(hash_table *table) {
+  if (!table->current) {
+    return false;
+  }
+
+  if (table->in_chain) {
+    table->current = table->current->next;
+  } else if (++table->position < table->row_count) {
+    table->current = row_at(table, table->position);
+  } else {
+    table->current = nullptr;
+  }
+  return table->current != nullptr;
+}
+
+bool ht_is_valid(hash_table *table) { return table->current != nullptr; }
+
+void *ht_key(hash_table *table) {
+  return table->current ? row_data(table->current) : nullptr;
+}
+
+void *ht_record(hash_table *table) {
+  return table->current ? row_data(table->current) + table->key_size
+                        : nullptr;
+}
+
+void ht_close(hash_table *table) {
+  if (table->file != OS_INVALID_HANDLE) {
+    os_file_close(table->file);
+    os_file_delete(table->file_name);
+    table->file = OS_INVALID_HANDLE;
+  }
+  table->current = nullptr;
+}
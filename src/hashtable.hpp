@@ -0,0 +1,150 @@
+/*
+ * SQL From Scratch
+ *
+ * Hash Table
+ *
+ * Ephemeral storage for the build side of a hash join: rows are inserted
+ * under a key, then looked up by it, every row with an equal key in turn.
+ * Nothing is ordered, so there's no range seek, just equality.
+ *
+ * Past the memory budget, the rows are spread over HASH_TABLE_PARTITIONS
+ * partitions by the hash of their key and written out to a scratch file
+ * beside the database. The table is then read back in passes, each loading
+ * as many whole partitions as fit, and a lookup for a key whose partition
+ * isn't loaded fails without touching the map. The side probing it goes
+ * through its rows once per pass.
+ *
+ * Rows are laid out as in the other ephemeral storage, the key then the
+ * record. A string key is stored zero padded, so equal strings are equal
+ * bytes.
+ *
+ * Given a combine function, the table keeps one row per key instead, for
+ * hash aggregation: a row inserted under a key already in memory is combined
+ * into that key's record in place. Rows spilled to a partition are combined
+ * as it's loaded back, so a partition is loaded whole, however big.
+ */
+
+#pragma once
+#include "arena.hpp"
+#include "os_layer.hpp"
+#include "types.hpp"
+#include <cstdint>
+
+#define HASH_TABLE_DEFAULT_MEMORY (64u << 20)
+
+#define HASH_TABLE_PARTITIONS 16
+
+/* Rows are kept in blocks of this size, so they never move once inserted */
+#define HASH_TABLE_BLOCK_SIZE (64u << 10)
+
+/* Each partition is written through a buffer of this size */
+#define HASH_TABLE_WRITE_BUFFER_SIZE (16u << 10)
+
+#define HASH_TABLE_FILENAME_SIZE 64
+
+/*
+ * A row in memory, the next with the same key, then the row itself
+ */
+struct hash_row
+{
+	hash_row *next;
+};
+
+struct hash_chunk
+{
+	os_file_offset_t offset;
+	uint32_t		 count; /* Rows */
+};
+
+struct hash_partition
+{
+	array<hash_chunk, query_arena> chunks; /* Written so far, in order */
+	uint64_t					   row_count;
+	uint8_t						  *write_buffer;
+	uint32_t					   write_rows; /* Rows in the buffer */
+};
+
+/* Combines a record inserted under an existing key into the stored one */
+typedef void (*ht_combine_fn)(void *context, uint8_t *into, const uint8_t *from);
+
+struct hash_table
+{
+	data_type key_type;
+	uint32_t  key_size;
+	uint32_t  row_size; /* key_size + record size */
+	uint32_t  max_rows; /* That fit the budget */
+	uint8_t	 *probe_key; /* A key as it's stored, see copy_key */
+
+	ht_combine_fn combine; /* nullptr to keep every row */
+	void		 *combine_context;
+
+	/* The rows in memory, chained by key */
+	hash_map<string_view, hash_row *, query_arena> chains;
+	array<uint8_t *, query_arena>				   blocks;
+	uint32_t									   rows_per_block;
+	uint32_t									   row_count;
+
+	/* Once spilled, rows go to the partitions and memory holds one pass */
+	bool			 spilled;
+	hash_partition	 partitions[HASH_TABLE_PARTITIONS];
+	uint8_t			*read_buffer;
+	os_file_handle_t file;
+	char			 file_name[HASH_TABLE_FILENAME_SIZE];
+	os_file_offset_t file_size;
+
+	/*
+	 * The pass holds partitions [first_loaded, end_loaded). A partition too big
+	 * for a pass of its own is loaded a few chunks at a time, next_chunk is
+	 * where the next pass carries on from.
+	 */
+	uint32_t first_loaded;
+	uint32_t end_loaded;
+	uint32_t next_partition;
+	uint32_t next_chunk;
+
+	bool reading;	  /* Set by the first ht_rewind, no inserts after */
+	bool failed;	  /* A partition couldn't be written or read back */
+	bool passes_done; /* Without spilling, the one pass has been read */
+
+	/* Reading, either a chain after a seek or every row after a rewind */
+	hash_row *current; /* nullptr when there's no row */
+	bool	  in_chain;
+	uint32_t  position; /* Row number, after a rewind */
+};
+
+hash_table
+ht_create(data_type key_type, uint32_t record_size, ht_combine_fn combine = nullptr,
+		  void *context = nullptr);
+bool
+ht_insert(hash_table *table, void *key, void *record);
+
+/*
+ * Ends the inserts on the first call and loads the next pass of rows,
+ * false once there are none left. The cursor is left on the first row.
+ */
+bool
+ht_rewind(hash_table *table);
+
+/* The first row of the pass with an equal key */
+bool
+ht_seek(hash_table *table, const void *key);
+
+/* After a seek the next row with the same key, otherwise the next row */
+bool
+ht_next(hash_table *table);
+
+bool
+ht_is_valid(hash_table *table);
+void *
+ht_key(hash_table *table);
+void *
+ht_record(hash_table *table);
+void
+ht_close(hash_table *table);
+
+/*
+ * Bytes of rows a hash table keeps in memory before it partitions them to
+ * disk, for tables created after the call
+ */
+void
+ht_set_memory_budget(size_t bytes);
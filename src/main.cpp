@@ -7,26 +7,51 @@
 
 #include "arena.hpp"
 #include "repl.hpp"
+#include "server.hpp"
 #include <cstdio>
 #include <cstring>
 
 #include "tests/parser.hpp"
 #include "tests/types.hpp"
+#include "tests/arena.hpp"
 #include "tests/blob.hpp"
 #include "tests/btree.hpp"
+#include "tests/catalog.hpp"
+#include "tests/copy.hpp"
+#include "tests/explain.hpp"
 #include "tests/ephemeral.hpp"
+#include "tests/hashtable.hpp"
+#include "tests/parallel.hpp"
+#include "tests/memtree.hpp"
 #include "tests/pager.hpp"
+#include "tests/prepared.hpp"
+#include "tests/server.hpp"
+#include "tests/session.hpp"
+#include "tests/sorter.hpp"
+#include "tests/stats.hpp"
 
 
 void
 print_usage(const char *program_name)
 {
-	printf("Usage: %s [database_file]\n", program_name);
+	printf("Usage: %s [database_file] [--serve address [--copy-dir directory]] [--wal]\n", program_name);
 	printf("  database_file: Path to the database file (default: relational_test.db)\n");
+	printf("                 or :memory: for one that's never written to disk\n");
+	printf("  --serve:       Serve the database on a TCP port, host:port or Unix socket path\n");
+	printf("                 instead of running the REPL, see server.hpp. A port alone is\n");
+	printf("                 only reachable from this machine, *:port from any\n");
+	printf("  --copy-dir:    The directory COPY reads the server's clients' files from,\n");
+	printf("                 without it they can't COPY from files\n");
+	printf("  --wal:         Journal with a write-ahead log instead of a rollback journal\n");
 	printf("\nExamples:\n");
 	printf("  %s                    # Use default database\n", program_name);
 	printf("  %s mydata.db          # Use custom database\n", program_name);
 	printf("  %s /path/to/data.db   # Use database at specific path\n", program_name);
+	printf("  %s mydata.db --wal    # Use custom database in WAL mode\n", program_name);
+	printf("  %s :memory:           # Use a database in memory, gone on exit\n", program_name);
+	printf("  %s mydata.db --serve 7070            # Serve it on port 7070, locally\n", program_name);
+	printf("  %s mydata.db --serve *:7070          # Serve it on port 7070 to the network\n", program_name);
+	printf("  %s mydata.db --serve /tmp/sql.sock   # Serve it on a Unix socket\n", program_name);
 	printf("  %s test               # Run the tests\n", program_name);
 }
 
@@ -35,6 +60,27 @@ main(int argc, char **argv)
 {
 	arena<global_arena>::init();
 	const char *database_path = "relational_test.db";
+	bool		wal_mode = false;
+	const char *serve_address = nullptr;
+	const char *copy_directory = nullptr;
+
+	if (argc >= 3 && strcmp(argv[argc - 1], "--wal") == 0)
+	{
+		wal_mode = true;
+		argc--;
+	}
+
+	if (argc == 6 && strcmp(argv[2], "--serve") == 0 && strcmp(argv[4], "--copy-dir") == 0)
+	{
+		copy_directory = argv[5];
+		argc -= 2;
+	}
+
+	if (argc == 4 && strcmp(argv[2], "--serve") == 0)
+	{
+		serve_address = argv[3];
+		argc -= 2;
+	}
 
 	if (argc > 2)
 	{
@@ -56,8 +102,20 @@ main(int argc, char **argv)
 			test_pager();
 			test_blob();
 			test_ephemeral();
+			test_memtree();
 			test_parser();
 			test_types();
+			test_prepared();
+			test_sorter();
+			test_arena();
+			test_hash_table();
+			test_parallel();
+			test_session();
+			test_server();
+			test_copy();
+			test_stats();
+			test_catalog();
+			test_explain();
 			printf("All tests passed\n");
 			exit(0);
 		}
@@ -65,5 +123,9 @@ main(int argc, char **argv)
 		database_path = argv[1];
 	}
 
-	return run_repl(database_path);
+	if (serve_address)
+	{
+		return run_server(database_path, serve_address, wal_mode, copy_directory);
+	}
+	return run_repl(database_path, wal_mode);
 }
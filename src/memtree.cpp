@@ -0,0 +1,781 @@
+/*
+ * SQL From Scratch
+ *
+ * Memory Tree
+ *
+ * A B+tree kept on the query_arena, ephemeral storage for the VM like the
+ * red-black tree in ephemeral.cpp, but with the nodes laid out like those of
+ * the btree rather than one allocation per entry:
+ *
+ *   Leaf:      [header][key 0][key 1]...[key n][record 0][record 1]...[record n]
+ *   Internal:  [header][separator 0]...[separator n][child 0]...[child n + 1]
+ *
+ * So finding a key is a binary search through a few blocks of contiguous keys
+ * and reading in order walks along a leaf, then to the next through its
+ * link, instead of chasing a pointer for every comparison and every step.
+ *
+ * Separator i is the first key of child i + 1 when it was split off, so a
+ * child's keys are at least the separator before it and at most the one
+ * after it. With duplicates a run of equal keys can span children, so
+ * searches pick the child for the first entry not before the key (or the
+ * first after it), and carry on to the next leaf when that one runs out.
+ *
+ * Entries are only ever removed from leaves, without rebalancing; a leaf
+ * that empties is unlinked, an internal node left with one child is replaced
+ * by it. Ephemeral trees are mostly inserted into and read back, so that
+ * keeps deletes simple without bothering the common case.
+ */
+
+#include "memtree.hpp"
+#include "arena.hpp"
+#include "common.hpp"
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#define NODE_DATA(node) ((uint8_t *)((node) + 1))
+
+static inline uint8_t *key_at(const memtree *tree, mt_node *node,
+                              uint32_t index) {
+  return NODE_DATA(node) + index * tree->key_size;
+}
+
+static inline uint8_t *record_at(const memtree *tree, mt_node *leaf,
+                                 uint32_t index) {
+  return NODE_DATA(leaf) + (tree->leaf_max_keys + 1) * tree->key_size +
+         index * tree->record_size;
+}
+
+static inline mt_node **children(const memtree *tree, mt_node *node) {
+  return (mt_node **)(NODE_DATA(node) + tree->children_offset);
+}
+
+static inline int compare_key(const memtree *tree, const void *a,
+                              const void *b) {
+  return type_compare(tree->key_type, a, b);
+}
+
+/*
+ * Counts the keys in the node that sort before key, or that don't sort after
+ * it with after_equal
+ */
+static uint32_t search(const memtree *tree, mt_node *node, const void *key,
+                       bool after_equal) {
+  uint32_t low = 0;
+  uint32_t high = node->count;
+  uint8_t *keys = NODE_DATA(node);
+
+  while (low < high) {
+    uint32_t mid = (low + high) / 2;
+    int cmp = compare_key(tree, keys + mid * tree->key_size, key);
+    if (cmp < 0 || (after_equal && cmp == 0)) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+static mt_node *find_leaf(const memtree *tree, const void *key,
+                          bool after_equal) {
+  mt_node *node = tree->root;
+  while (!node->is_leaf) {
+    node = children(tree, node)[search(tree, node, key, after_equal)];
+  }
+  return node;
+}
+
+/*
+ * The leaf and index of the first entry not before key, or after it with
+ * after_equal, nullptr when there's none
+ */
+static mt_node *seek_bound(const memtree *tree, const void *key,
+                           bool after_equal, uint32_t *index) {
+  *index = 0;
+  if (!tree->root) {
+    return nullptr;
+  }
+
+  mt_node *leaf = find_leaf(tree, key, after_equal);
+  *index = search(tree, leaf, key, after_equal);
+  if (*index < leaf->count) {
+    return leaf;
+  }
+
+  *index = 0;
+  return leaf->next;
+}
+
+static mt_node *alloc_node(memtree *tree, bool is_leaf) {
+  size_t size = sizeof(mt_node);
+  if (is_leaf) {
+    size += (tree->leaf_max_keys + 1) * (tree->key_size + tree->record_size);
+  } else {
+    size += tree->children_offset +
+            (tree->internal_max_keys + 2) * sizeof(mt_node *);
+  }
+
+  auto *node = (mt_node *)arena<query_arena>::alloc(size);
+  node->parent = node->next = node->previous = nullptr;
+  node->count = 0;
+  node->is_leaf = is_leaf;
+  return node;
+}
+
+static uint32_t child_index(const memtree *tree, mt_node *parent,
+                            mt_node *child) {
+  mt_node **kids = children(tree, parent);
+  for (uint32_t i = 0; i <= parent->count; i++) {
+    if (kids[i] == child) {
+      return i;
+    }
+  }
+  assert(false && "Child not found in its parent");
+  return 0;
+}
+
+static void split_internal(memtree *tree, mt_node *node);
+
+static void insert_into_parent(memtree *tree, mt_node *left, uint8_t *separator,
+                               mt_node *right) {
+  mt_node *parent = left->parent;
+  if (!parent) {
+    parent = alloc_node(tree, false);
+    parent->count = 1;
+    memcpy(key_at(tree, parent, 0), separator, tree->key_size);
+    children(tree, parent)[0] = left;
+    children(tree, parent)[1] = right;
+    left->parent = right->parent = parent;
+    tree->root = parent;
+    return;
+  }
+
+  uint32_t at = child_index(tree, parent, left);
+  mt_node **kids = children(tree, parent);
+
+  memmove(key_at(tree, parent, at + 1), key_at(tree, parent, at),
+          (parent->count - at) * tree->key_size);
+  memmove(kids + at + 2, kids + at + 1,
+          (parent->count - at) * sizeof(mt_node *));
+  memcpy(key_at(tree, parent, at), separator, tree->key_size);
+  kids[at + 1] = right;
+  right->parent = parent;
+  parent->count++;
+
+  if (parent->count > tree->internal_max_keys) {
+    split_internal(tree, parent);
+  }
+}
+
+/*
+ * The middle separator moves up, the ones after it and their children go to
+ * a new node on the right
+ */
+static void split_internal(memtree *tree, mt_node *node) {
+  uint32_t mid = node->count / 2;
+  mt_node *right = alloc_node(tree, false);
+
+  right->count = node->count - mid - 1;
+  memcpy(key_at(tree, right, 0), key_at(tree, node, mid + 1),
+         right->count * tree->key_size);
+  memcpy(children(tree, right), children(tree, node) + mid + 1,
+         (right->count + 1) * sizeof(mt_node *));
+  for (uint32_t i = 0; i <= right->count; i++) {
+    children(tree, right)[i]->parent = right;
+  }
+
+  node->count = mid;
+  insert_into_parent(tree, node, key_at(tree, node, mid), right);
+}
+
+/*
+ * Halves the leaf, unless the entry that overflowed it is the last in the
+ * tree, when it alone goes to the new leaf. Rows often arrive in key order,
+ * which then leaves full leaves behind rather than half empty ones.
+ */
+static mt_node *split_leaf(memtree *tree, mt_node *leaf, bool appended) {
+  uint32_t keep = appended ? leaf->count - 1 : leaf->count / 2;
+  mt_node *right = alloc_node(tree, true);
+
+  right->count = leaf->count - keep;
+  memcpy(key_at(tree, right, 0), key_at(tree, leaf, keep),
+         right->count * tree->key_size);
+  memcpy(record_at(tree, right, 0), record_at(tree, leaf, keep),
+         right->count * tree->record_size);
+  leaf->count = keep;
+
+  right->next = leaf->next;
+  if (right->next) {
+    right->next->previous = right;
+  }
+  right->previous = leaf;
+  leaf->next = right;
+
+  insert_into_parent(tree, leaf, key_at(tree, right, 0), right);
+  return right;
+}
+
+/*
+ * Duplicates go after the entries with an equal key, so they come out in the
+ * order they went in. Sets where the entry ended up.
+ */
+static void insert_entry(memtree *tree, void *key, void *record,
+                         mt_node **leaf_out, uint32_t *index_out) {
+  if (!tree->root) {
+    tree->root = alloc_node(tree, true);
+  }
+
+  mt_node *leaf = find_leaf(tree, key, true);
+  uint32_t index = search(tree, leaf, key, tree->allow_duplicates);
+
+  if (!tree->allow_duplicates && index < leaf->count &&
+      compare_key(tree, key, key_at(tree, leaf, index)) == 0) {
+    if (record && tree->record_size > 0) {
+      memcpy(record_at(tree, leaf, index), record, tree->record_size);
+    }
+    *leaf_out = leaf;
+    *index_out = index;
+    return;
+  }
+
+  uint32_t after = leaf->count - index;
+  memmove(key_at(tree, leaf, index + 1), key_at(tree, leaf, index),
+          after * tree->key_size);
+  memmove(record_at(tree, leaf, index + 1), record_at(tree, leaf, index),
+          after * tree->record_size);
+
+  memcpy(key_at(tree, leaf, index), key, tree->key_size);
+  if (record && tree->record_size > 0) {
+    memcpy(record_at(tree, leaf, index), record, tree->record_size);
+  } else if (tree->record_size > 0) {
+    memset(record_at(tree, leaf, index), 0, tree->record_size);
+  }
+  leaf->count++;
+  tree->entry_count++;
+
+  if (leaf->count > tree->leaf_max_keys) {
+    bool appended = !leaf->next && index == leaf->count - 1;
+    mt_node *right = split_leaf(tree, leaf, appended);
+    if (index >= leaf->count) {
+      index -= leaf->count;
+      leaf = right;
+    }
+  }
+
+  *leaf_out = leaf;
+  *index_out = index;
+}
+
+static void replace_child(memtree *tree, mt_node *node, mt_node *replacement) {
+  mt_node *parent = node->parent;
+  replacement->parent = parent;
+  if (!parent) {
+    tree->root = replacement;
+    return;
+  }
+  children(tree, parent)[child_index(tree, parent, node)] = replacement;
+}
+
+/*
+ * Drops an empty leaf, or an internal node's emptied child, from its parent
+ */
+static void remove_child(memtree *tree, mt_node *node) {
+  if (node->is_leaf) {
+    if (node->previous) {
+      node->previous->next = node->next;
+    }
+    if (node->next) {
+      node->next->previous = node->previous;
+    }
+  }
+
+  mt_node *parent = node->parent;
+  if (!parent) {
+    tree->root = nullptr;
+    return;
+  }
+
+  uint32_t at = child_index(tree, parent, node);
+  uint32_t separator = at > 0 ? at - 1 : 0;
+  mt_node **kids = children(tree, parent);
+
+  memmove(key_at(tree, parent, separator), key_at(tree, parent, separator + 1),
+          (parent->count - separator - 1) * tree->key_size);
+  memmove(kids + at, kids + at + 1, (parent->count - at) * sizeof(mt_node *));
+  parent->count--;
+
+  if (parent->count == 0) {
+    replace_child(tree, parent, kids[0]);
+  }
+}
+
+static void remove_entry(memtree *tree, mt_node *leaf, uint32_t index) {
+  uint32_t after = leaf->count - index - 1;
+  memmove(key_at(tree, leaf, index), key_at(tree, leaf, index + 1),
+          after * tree->key_size);
+  memmove(record_at(tree, leaf, index), record_at(tree, leaf, index + 1),
+          after * tree->record_size);
+  leaf->count--;
+  tree->entry_count--;
+
+  if (leaf->count == 0) {
+    remove_child(tree, leaf);
+  }
+}
+
+memtree mt_create(data_type key_type, uint32_t record_size, uint8_t flags) {
+  memtree tree = {};
+  tree.key_type = key_type;
+  tree.key_size = type_size(key_type);
+  tree.record_size = record_size;
+  tree.allow_duplicates = flags & 0x01;
+
+  uint32_t space = MT_NODE_SIZE - sizeof(mt_node);
+  uint32_t leaf_keys = space / (tree.key_size + record_size);
+  tree.leaf_max_keys =
+      leaf_keys > MT_MIN_NODE_KEYS ? leaf_keys - 1 : MT_MIN_NODE_KEYS;
+
+  // Room for the extra child, and for aligning the children after the keys
+  uint32_t internal_keys =
+      (space - 2 * sizeof(mt_node *)) / (tree.key_size + sizeof(mt_node *));
+  tree.internal_max_keys =
+      internal_keys > MT_MIN_NODE_KEYS ? internal_keys - 1 : MT_MIN_NODE_KEYS;
+  tree.children_offset = ((tree.internal_max_keys + 1) * tree.key_size +
+                          sizeof(mt_node *) - 1) &
+                         ~(uint32_t)(sizeof(mt_node *) - 1);
+  return tree;
+}
+
+void mt_clear(memtree *tree) {
+  tree->root = nullptr;
+  tree->entry_count = 0;
+}
+
+bool mt_insert(memtree *tree, void *key, void *record) {
+  mt_node *leaf;
+  uint32_t index;
+  insert_entry(tree, key, record, &leaf, &index);
+  return true;
+}
+
+bool mt_delete(memtree *tree, void *key) {
+  uint32_t index;
+  mt_node *leaf = seek_bound(tree, key, false, &index);
+  if (!leaf || compare_key(tree, key, key_at(tree, leaf, index)) != 0) {
+    return false;
+  }
+
+  remove_entry(tree, leaf, index);
+  return true;
+}
+
+bool mt_cursor_first(mt_cursor *cursor) {
+  mt_node *node = cursor->tree.root;
+  if (!node) {
+    cursor->state = mt_cursor::AT_END;
+    return false;
+  }
+
+  while (!node->is_leaf) {
+    node = children(&cursor->tree, node)[0];
+  }
+  cursor->leaf = node;
+  cursor->index = 0;
+  cursor->state = mt_cursor::VALID;
+  return true;
+}
+
+bool mt_cursor_last(mt_cursor *cursor) {
+  mt_node *node = cursor->tree.root;
+  if (!node) {
+    cursor->state = mt_cursor::AT_END;
+    return false;
+  }
+
+  while (!node->is_leaf) {
+    node = children(&cursor->tree, node)[node->count];
+  }
+  cursor->leaf = node;
+  cursor->index = node->count - 1;
+  cursor->state = mt_cursor::VALID;
+  return true;
+}
+
+bool mt_cursor_next(mt_cursor *cursor) {
+  if (cursor->state != mt_cursor::VALID) {
+    return false;
+  }
+
+  if (++cursor->index < cursor->leaf->count) {
+    return true;
+  }
+
+  cursor->leaf = cursor->leaf->next;
+  cursor->index = 0;
+  if (cursor->leaf) {
+    return true;
+  }
+
+  cursor->state = mt_cursor::AT_END;
+  return false;
+}
+
+bool mt_cursor_previous(mt_cursor *cursor) {
+  if (cursor->state != mt_cursor::VALID) {
+    return false;
+  }
+
+  if (cursor->index > 0) {
+    cursor->index--;
+    return true;
+  }
+
+  cursor->leaf = cursor->leaf->previous;
+  if (cursor->leaf) {
+    cursor->index = cursor->leaf->count - 1;
+    return true;
+  }
+
+  cursor->state = mt_cursor::AT_END;
+  return false;
+}
+
+bool mt_cursor_has_next(mt_cursor *cursor) {
+  if (cursor->state != mt_cursor::VALID) {
+    return false;
+  }
+  return cursor->index + 1 < cursor->leaf->count || cursor->leaf->next;
+}
+
+bool mt_cursor_has_previous(mt_cursor *cursor) {
+  if (cursor->state != mt_cursor::VALID) {
+    return false;
+  }
+  return cursor->index > 0 || cursor->leaf->previous;
+}
+
+/*
+ * EQ, GE and LT start from the first entry not before the key, GT and LE
+ * from the first after it, LT and LE then take the entry before that
+ */
+bool mt_cursor_seek(mt_cursor *cursor, const void *key, COMPARISON_OP op) {
+  bool after_equal;
+  switch (op) {
+  case EQ:
+  case GE:
+  case LT:
+    after_equal = false;
+    break;
+  case GT:
+  case LE:
+    after_equal = true;
+    break;
+  default:
+    cursor->state = mt_cursor::INVALID;
+    return false;
+  }
+
+  cursor->leaf = seek_bound(&cursor->tree, key, after_equal, &cursor->index);
+
+  if (op == LT || op == LE) {
+    if (!cursor->leaf) {
+      cursor->state = mt_cursor::VALID;
+      return mt_cursor_last(cursor);
+    }
+    cursor->state = mt_cursor::VALID;
+    return mt_cursor_previous(cursor);
+  }
+
+  bool found = cursor->leaf != nullptr;
+  if (found && op == EQ) {
+    found = compare_key(&cursor->tree, key,
+                        key_at(&cursor->tree, cursor->leaf, cursor->index)) ==
+            0;
+  }
+
+  if (found) {
+    cursor->state = mt_cursor::VALID;
+    return true;
+  }
+
+  cursor->state = (op == EQ) ? mt_cursor::INVALID : mt_cursor::AT_END;
+  return false;
+}
+
+void *mt_cursor_key(mt_cursor *cursor) {
+  if (cursor->state != mt_cursor::VALID) {
+    return nullptr;
+  }
+  return key_at(&cursor->tree, cursor->leaf, cursor->index);
+}
+
+void *mt_cursor_record(mt_cursor *cursor) {
+  if (cursor->state != mt_cursor::VALID) {
+    return nullptr;
+  }
+  return record_at(&cursor->tree, cursor->leaf, cursor->index);
+}
+
+bool mt_cursor_is_valid(mt_cursor *cursor) {
+  return cursor->state == mt_cursor::VALID;
+}
+
+bool mt_cursor_insert(mt_cursor *cursor, void *key, void *record) {
+  insert_entry(&cursor->tree, key, record, &cursor->leaf, &cursor->index);
+  cursor->state = mt_cursor::VALID;
+  return true;
+}
+
+bool mt_cursor_delete(mt_cursor *cursor) {
+  if (cursor->state != mt_cursor::VALID) {
+    return false;
+  }
+
+  mt_node *leaf = cursor->leaf;
+  mt_node *next = leaf->next;
+  bool stays = cursor->index + 1 < leaf->count;
+
+  remove_entry(&cursor->tree, leaf, cursor->index);
+
+  if (!stays) {
+    cursor->leaf = next;
+    cursor->index = 0;
+    if (!next) {
+      cursor->state = mt_cursor::AT_END;
+    }
+  }
+  return true;
+}
+
+bool mt_cursor_update(mt_cursor *cursor, void *record) {
+  if (cursor->state != mt_cursor::VALID || cursor->tree.record_size == 0) {
+    return false;
+  }
+
+  memcpy(record_at(&cursor->tree, cursor->leaf, cursor->index), record,
+         cursor->tree.record_size);
+  return true;
+}
+
+struct validate_state {
+  uint32_t leaf_depth; // Of the first leaf, every leaf is as deep
+  uint32_t entries;
+  mt_node *previous_leaf;
+};
+
+static void validate_node(const memtree *tree, mt_node *node, mt_node *parent,
+                          const uint8_t *min_bound, const uint8_t *max_bound,
+                          uint32_t depth, validate_state &state) {
+  assert(node->parent == parent && "Parent pointer mismatch");
+  assert(node->count > 0 && "Empty node left in tree");
+
+  uint32_t max_keys =
+      node->is_leaf ? tree->leaf_max_keys : tree->internal_max_keys;
+  assert(node->count <= max_keys && "Node overflow");
+
+  for (uint32_t i = 0; i < node->count; i++) {
+    uint8_t *key = key_at(tree, node, i);
+    if (i > 0) {
+      int cmp = compare_key(tree, key_at(tree, node, i - 1), key);
+      assert((tree->allow_duplicates ? cmp <= 0 : cmp < 0) &&
+             "Keys out of order");
+    }
+    if (min_bound) {
+      assert(compare_key(tree, min_bound, key) <= 0 &&
+             "Key before its lower separator");
+    }
+    if (max_bound) {
+      int cmp = compare_key(tree, key, max_bound);
+      assert((tree->allow_duplicates ? cmp <= 0 : cmp < 0) &&
+             "Key after its upper separator");
+    }
+  }
+
+  if (node->is_leaf) {
+    if (state.entries == 0) {
+      state.leaf_depth = depth;
+    }
+    assert(depth == state.leaf_depth && "Leaves at different depths");
+    assert(node->previous == state.previous_leaf && "Leaf chain mismatch");
+    if (state.previous_leaf) {
+      assert(state.previous_leaf->next == node && "Leaf chain mismatch");
+    }
+    state.previous_leaf = node;
+    state.entries += node->count;
+    return;
+  }
+
+  mt_node **kids = children(tree, node);
+  for (uint32_t i = 0; i <= node->count; i++) {
+    const uint8_t *low = i > 0 ? key_at(tree, node, i - 1) : min_bound;
+    const uint8_t *high = i < node->count ? key_at(tree, node, i) : max_bound;
+    validate_node(tree, kids[i], node, low, high, depth + 1, state);
+  }
+}
+
+void mt_validate(const memtree *tree) {
+  if (!tree->root) {
+    assert(tree->entry_count == 0);
+    return;
+  }
+
+  assert(tree->root->parent == nullptr && "Root has parent");
+
+  validate_state state = {};
+  validate_node(tree, tree->root, nullptr, nullptr, nullptr, 0, state);
+
+  assert(state.previous_leaf->next == nullptr && "Leaf chain mismatch");
+  assert(state.entries == tree->entry_count && "Entry count mismatch");
+}
+
+static void
+print_record_columns(const uint8_t *record_data,
+                    array<data_type, query_arena> *columns,
+                    int start_col)
+{
+	printf("{");
+	uint32_t offset = 0;
+
+	for (int i = start_col; i < columns->size(); i++) {
+		if (i > start_col) printf(", ");
+
+		data_type col_type = (*columns)[i];
+		type_print(col_type, record_data + offset);
+		offset += type_size(col_type);
+	}
+	printf("}");
+}
+
+void
+mt_print(const memtree *tree, array<data_type, query_arena> *columns)
+{
+	if (!tree || !tree->root)
+	{
+		printf("Memory Tree: EMPTY\n");
+		return;
+	}
+
+	// Use columns[0] type if schema provided, otherwise use tree's key type
+	data_type key_type = (columns && columns->size() > 0)
+		? (*columns)[0]
+		: tree->key_type;
+
+	printf("====================================\n");
+	printf("Memory Tree Structure (B+Tree)\n");
+	printf("====================================\n");
+	printf("Key type: %s, Key size: %u bytes\n", type_name(tree->key_type), tree->key_size);
+	printf("Record size: %u bytes\n", tree->record_size);
+	printf("Keys per leaf: %u, per internal node: %u\n", tree->leaf_max_keys,
+		   tree->internal_max_keys);
+	printf("Allow duplicates: %s\n", tree->allow_duplicates ? "YES" : "NO");
+	printf("Entry count: %u\n", tree->entry_count);
+	printf("------------------------------------\n\n");
+
+	struct node_level
+	{
+		mt_node *node;
+		int		 level;
+	};
+
+	queue<node_level, query_arena> queue;
+	queue.push({tree->root, 0});
+
+	int current_level = -1;
+	int nodes_in_level = 0;
+
+	printf("Level-Order Traversal:\n");
+	while (!queue.empty())
+	{
+		node_level nl = *queue.front();
+		queue.pop();
+
+		if (nl.level != current_level)
+		{
+			if (current_level >= 0)
+			{
+				printf(" (%d nodes)\n", nodes_in_level);
+			}
+			printf("Level %d: ", nl.level);
+			current_level = nl.level;
+			nodes_in_level = 0;
+		}
+
+		if (nodes_in_level > 0)
+		{
+			printf("  ");
+		}
+
+		// Only the ends of a node, they hold hundreds of keys
+		printf("[");
+		type_print(key_type, key_at(tree, nl.node, 0));
+		if (nl.node->count > 1)
+		{
+			printf(" .. ");
+			type_print(key_type, key_at(tree, nl.node, nl.node->count - 1));
+		}
+		printf("]:%u", nl.node->count);
+		nodes_in_level++;
+
+		if (!nl.node->is_leaf)
+		{
+			for (uint32_t i = 0; i <= nl.node->count; i++)
+			{
+				queue.push({children(tree, nl.node)[i], nl.level + 1});
+			}
+		}
+	}
+	if (nodes_in_level > 0)
+	{
+		printf(" (%d nodes)\n", nodes_in_level);
+	}
+
+	printf("\n------------------------------------\n");
+	printf("In-order traversal: ");
+
+	mt_node *leaf = tree->root;
+	while (!leaf->is_leaf)
+	{
+		leaf = children(tree, leaf)[0];
+	}
+
+	bool first = true;
+	for (; leaf; leaf = leaf->next)
+	{
+		for (uint32_t i = 0; i < leaf->count; i++)
+		{
+			if (!first)
+			{
+				printf(", ");
+			}
+			first = false;
+			printf("[");
+			type_print(key_type, key_at(tree, leaf, i));
+
+			if (tree->record_size > 0)
+			{
+				printf(":");
+				if (columns && columns->size() > 1)
+				{
+					print_record_columns(record_at(tree, leaf, i), columns, 1);
+				}
+				else
+				{
+					// Fallback to hex dump
+					uint8_t *rec = record_at(tree, leaf, i);
+					for (uint32_t j = 0; j < std::min(tree->record_size, 4u); j++)
+					{
+						printf("%02x", rec[j]);
+					}
+					if (tree->record_size > 4)
+					{
+						printf("...");
+					}
+				}
+			}
+			printf("]");
+		}
+	}
+	printf("\n====================================\n\n");
+}
@@ -0,0 +1,113 @@
+/*
+ * SQL From Scratch
+ *
+ * Memory Tree
+ *
+ * An in-memory B+tree, the MEMTREE alternative to the ephemeral red-black
+ * tree with the same cursor api. Keys and records are stored inline in
+ * node-sized blocks, so a search is a binary search over contiguous keys
+ * and stepping, mostly, is moving along a leaf.
+ */
+
+#pragma once
+#include "arena.hpp"
+#include "common.hpp"
+#include "types.hpp"
+#include <cstdint>
+#include <cstring>
+
+#define MT_NODE_SIZE 4096
+
+/* Nodes are made bigger than MT_NODE_SIZE to hold at least this many entries */
+#define MT_MIN_NODE_KEYS 4
+
+/*
+ * Leaves hold [keys][records], internal nodes [separators][children], the
+ * arrays sized for one entry past the maximum, which is split off
+ */
+struct mt_node
+{
+	mt_node *parent;
+	mt_node *next; // Leaves only, the neighbouring leaves
+	mt_node *previous;
+	uint32_t count; // Keys, or separators, the node has one more child
+	bool	 is_leaf;
+};
+
+struct memtree
+{
+	mt_node	 *root;			   // null for an empty tree
+	data_type key_type;		   // Type of keys stored
+	uint32_t  key_size;		   // Size of each key in bytes
+	uint32_t  record_size;	   // Size of each record in bytes
+	uint32_t  entry_count;	   // Number of entries in tree
+	uint32_t  leaf_max_keys;	   // Before a leaf splits
+	uint32_t  internal_max_keys; // Before an internal node splits
+	uint32_t  children_offset;   // Of an internal node's children, past its separators
+	bool	  allow_duplicates;  // Whether duplicate keys are permitted
+};
+
+struct mt_cursor
+{
+	memtree	 tree;	// Tree being traversed
+	mt_node *leaf;	// Current position in tree
+	uint32_t index; // In leaf
+
+	enum MT_CURSOR_STATE
+	{
+		INVALID,
+		VALID,
+		AT_END
+	} state;
+};
+
+// Flags: bit 0 = allow_duplicates, equal keys come out in the order they went in
+memtree
+mt_create(data_type key_type, uint32_t record_size, uint8_t flags = 0x01);
+
+void
+mt_clear(memtree *tree);
+
+bool
+mt_insert(memtree *tree, void *key, void *record);
+
+bool
+mt_delete(memtree *tree, void *key);
+
+bool
+mt_cursor_seek(mt_cursor *cursor, const void *key, COMPARISON_OP op = EQ);
+bool
+mt_cursor_first(mt_cursor *cursor);
+bool
+mt_cursor_last(mt_cursor *cursor);
+
+bool
+mt_cursor_next(mt_cursor *cursor);
+bool
+mt_cursor_previous(mt_cursor *cursor);
+bool
+mt_cursor_has_next(mt_cursor *cursor);
+bool
+mt_cursor_has_previous(mt_cursor *cursor);
+
+void *
+mt_cursor_key(mt_cursor *cursor);
+void *
+mt_cursor_record(mt_cursor *cursor);
+bool
+mt_cursor_is_valid(mt_cursor *cursor);
+
+// Entries move within and between nodes as others are inserted, so the
+// cursor is left on the one it inserted
+bool
+mt_cursor_insert(mt_cursor *cursor, void *key, void *record);
+bool
+mt_cursor_update(mt_cursor *cursor, void *record);
+bool
+mt_cursor_delete(mt_cursor *cursor);
+
+void
+mt_validate(const memtree *tree);
+
+void
+mt_print(const memtree *tree, array<data_type, query_arena> *columns = nullptr);
@@ -98,10 +98,41 @@ os_file_truncate(os_file_handle_t handle, os_file_offset_t size)
 	SetEndOfFile((HANDLE)handle);
 }
 
+/*
+ * Windows has no per handle read-ahead hint, sequential scans rely on its own
+ * read-ahead detection
+ */
+void
+os_file_prefetch(os_file_handle_t handle, os_file_offset_t offset, os_file_size_t size)
+{
+}
+
+/*
+ * A copy on write view can't outgrow the file on Windows, and resetting it
+ * means remapping at a fixed address, which can race, so it isn't offered
+ */
+void *
+os_file_map(os_file_handle_t handle, os_file_size_t size)
+{
+	return nullptr;
+}
+
+void
+os_file_unmap(void *address, os_file_size_t size)
+{
+}
+
+bool
+os_file_map_reset(os_file_handle_t handle, void *address, os_file_offset_t offset, os_file_size_t size)
+{
+	return false;
+}
+
 #elif defined(USE_PLATFORM_FS)
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 os_file_handle_t
@@ -179,6 +210,43 @@ os_file_truncate(os_file_handle_t handle, os_file_offset_t size)
 	ftruncate(handle, size);
 }
 
+void
+os_file_prefetch(os_file_handle_t handle, os_file_offset_t offset, os_file_size_t size)
+{
+#if defined(__APPLE__)
+	struct radvisory advice = {offset, (int)size};
+	fcntl(handle, F_RDADVISE, &advice);
+#elif defined(POSIX_FADV_WILLNEED)
+	posix_fadvise(handle, offset, size, POSIX_FADV_WILLNEED);
+#endif
+}
+
+void *
+os_file_map(os_file_handle_t handle, os_file_size_t size)
+{
+	void *address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, handle, 0);
+	return address == MAP_FAILED ? nullptr : address;
+}
+
+void
+os_file_unmap(void *address, os_file_size_t size)
+{
+	if (address)
+	{
+		munmap(address, size);
+	}
+}
+
+/*
+ * Mapping the range again in place discards its private copies
+ */
+bool
+os_file_map_reset(os_file_handle_t handle, void *address, os_file_offset_t offset, os_file_size_t size)
+{
+	void *result = mmap(address, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, handle, offset);
+	return result == address;
+}
+
 #else
 
 /*
@@ -451,4 +519,29 @@ os_file_truncate(os_file_handle_t handle, os_file_offset_t size)
         handle_data.position = new_size;
     }
 }
+
+void
+os_file_prefetch(os_file_handle_t handle, os_file_offset_t offset, os_file_size_t size)
+{
+}
+
+/*
+ * The in-memory files live in vectors that move as they grow
+ */
+void *
+os_file_map(os_file_handle_t handle, os_file_size_t size)
+{
+    return nullptr;
+}
+
+void
+os_file_unmap(void *address, os_file_size_t size)
+{
+}
+
+bool
+os_file_map_reset(os_file_handle_t handle, void *address, os_file_offset_t offset, os_file_size_t size)
+{
+    return false;
+}
 #endif
@@ -44,3 +44,24 @@ void os_file_seek(os_file_handle_t handle, os_file_offset_t offset);
 os_file_offset_t os_file_size(os_file_handle_t handle);
 
 void os_file_truncate(os_file_handle_t handle, os_file_offset_t size);
+
+/*
+ * Advise the OS that a range will be read soon, so it can start reading it in
+ * the background. A hint only, it may do nothing.
+ */
+void os_file_prefetch(os_file_handle_t handle, os_file_offset_t offset, os_file_size_t size);
+
+/*
+ * Map a file as a private, writable view. Writes through the view are copy on
+ * write and never reach the file, os_file_map_reset drops them so the range
+ * shows the file's contents again. Pages never written through the view see
+ * later writes to the file (as on Linux and the BSDs, POSIX leaves it open). The view may be larger than the file, but
+ * only the part backed by the file can be touched.
+ *
+ * Returns nullptr where mapping isn't supported, callers fall back to reads.
+ */
+void *os_file_map(os_file_handle_t handle, os_file_size_t size);
+
+void os_file_unmap(void *address, os_file_size_t size);
+
+bool os_file_map_reset(os_file_handle_t handle, void *address, os_file_offset_t offset, os_file_size_t size);
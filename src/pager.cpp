@@ -11,15 +11,59 @@
  * reserved as the "root page" containing metadata. All other pages can be
  * used for data or placed on a free list for reuse.
  *
- * Cache: A LRU cache keeps frequently accessed pages in memory.
- * When the cache is full, the least recently used page is evicted.
- * Dirty pages are written to disk on eviction.
+ * Cache: A page cache keeps frequently accessed pages in memory. When it's
+ * full a page is evicted by the replacement policy, 2Q by default (plain LRU
+ * can be selected). Dirty pages are written to disk on eviction. Its capacity is set at
+ * pager_open, and callers can pin pages they hold across other pager calls.
+ * Pinned pages are skipped by eviction, and if nothing can be evicted the
+ * pool grows, shrinking back to its capacity on commit/rollback.
+ *
+ * Replacement: 2Q admits a page to a probation FIFO, and only a page that's
+ * requested again after leaving probation, while its index is still
+ * remembered in a ghost queue, is promoted to the hot LRU queue. Probation is
+ * kept to a quarter of the cache, so a large scan churns through it without
+ * touching the hot pages (internal nodes, the catalog). Scans can also say so
+ * with pager_get_sequential: their pages are never remembered in the ghost
+ * queue, and under LRU are inserted at the cold end.
+ *
+ * Shared Reads: Between pager_begin_shared_reads and pager_end_shared_reads
+ * several threads may read pages at once. Their calls are serialised on a
+ * latch, except for reading a missed page in: the reader takes a frame, marks
+ * it loading and reads into it through file handles of its own, so misses on
+ * different threads overlap, and another reader wanting that page waits for
+ * it. A reader keeps the last page it got pinned, so it stays valid until its
+ * next call as it would single threaded, and is handed it again without the
+ * latch, which is most calls on a scan. Eviction carries on as usual, so the
+ * pool only grows past its capacity by what the readers hold pinned.
+ *
+ * Memory Mapping: Optionally (pager_set_mmap_size), pages that are in the data
+ * file are served straight from a private mapping of it instead of being read
+ * into the cache. Writing a mapped page after pager_ensure_journaled has the
+ * kernel copy it into a private page, so the pointer callers hold stays valid
+ * and the file is untouched until commit writes it back. Commit and rollback
+ * then reset those pages so they show the file again. A page lives in exactly
+ * one place: a cache frame if it's cached, the mapping if it's mappable, and
+ * otherwise it's loaded into a frame. Pages past the mapped region, or whose
+ * latest version is in the WAL, go through the cache.
  *
  * Free List: Deleted pages are linked into a singly-linked free list, with
  * the head pointer stored in the root page. New allocations preferentially
  * reuse free pages before growing the file. The caller is responsible for
  * not using deleted pages.
  *
+ * Free Space Map: The first time the free list is needed it's indexed in
+ * memory, as a bitmap of free pages (runs of set bits are the free extents)
+ * and each free page's predecessor in the list, so any free page can be
+ * unlinked, not just the head. Allocation takes the first free page just
+ * after the caller's hint (a B+tree splitting a node passes the node), so
+ * related pages end up next to each other, and otherwise the lowest free page,
+ * so the file fills from the front. On commit, free pages at the end of the
+ * file are dropped and the file is truncated. pager_relocate moves a page
+ * into the lowest free page for compaction, the caller fixes up references.
+ * pager_new_extent allocates a run of consecutive pages, from a free extent
+ * long enough or the end of the file, so a chain written in one go (a blob)
+ * is laid out sequentially.
+ *
  * Transactions: The pager implements transactions using a rollback-journal.
  * Before modifying a page, its original content is saved to a journal file.
  * On commit, changes are written to the main file, then the journal is deleted.
@@ -31,6 +75,53 @@
  *   - Offset PAGE_SIZE+: Original content of modified data pages
  *   Each page stores its own index for recovery purposes.
  *
+ * The journal isn't synced per page. It's synced once, before the first
+ * write to the data file (a dirty eviction or the commit), which is the only
+ * point where its contents must be durable.
+ *
+ * Group Commit: Optionally, implicit transactions committed with
+ * pager_commit_grouped share one journal and one durable commit. Each one
+ * leaves a savepoint (journal offset + root copy) that a following rollback
+ * returns to, and the group is committed for real once the window elapses or
+ * the journal grows past a page limit. A page can then appear in the journal
+ * more than once, so recovery replays it backwards, the earliest copy winning.
+ *
+ * WAL Mode: Selected at pager_open, the journal is replaced by a write-ahead
+ * log. Instead of saving originals and overwriting pages in place, new page
+ * images are appended to the log and the data file is left alone. A commit is
+ * the root page appended last, followed by a single fsync of the log. Reads
+ * consult the WAL index (page -> latest frame) before the data file, and a
+ * checkpoint copies the latest frame of every page back into the data file
+ * and empties the log. Rollback forgets the frames appended since begin.
+ *
+ * WAL Format:
+ *   - Frame N at offset N * WAL_FRAME_SIZE: wal_frame_header + page image
+ *   - A root page frame marks the end of a committed transaction
+ *   Frames after the last valid commit frame are discarded on recovery.
+ *
+ * Snapshots: In WAL mode, threads other than the writer's can read the
+ * database as of the last commit before they began a snapshot, while the
+ * writer carries on. A committed frame is never changed until the next
+ * checkpoint, and neither is the data file, so a snapshot is just the log
+ * length it began at: a page's version is the latest frame of it before
+ * that, found by following wal_history back from the WAL index, otherwise
+ * the data file. Checkpoints wait until no snapshot is open.
+ *
+ * A reader has its own cache, and its own file handles, so it never touches
+ * the writer's. The cache is kept between its snapshots, each page tagged
+ * with the frame it was read from, so a page still current in the next
+ * snapshot isn't read again. Until a checkpoint, after which it's dropped.
+ *
+ * Memory Databases: Opened as PAGER_MEMORY, the data file is a store in
+ * memory instead, reserved up front and committed as it grows, that evictions
+ * and commits write pages back to as they would the file. Nothing is
+ * journaled or synced: the first time a transaction modifies a page, its
+ * before-image is copied to a second store (the root goes to tx_root), which
+ * is all rollback restores from, and commit just forgets them. Group commit
+ * and memory mapping are off, there's nothing for them to save, and the
+ * database is gone once the pager closes. A page the store has no room for,
+ * or a before-image, fails the transaction, its commit rolls it back.
+ *
  * Page Allocation:
  *   1. Check free list for available pages
  *   2. If empty, increment page counter to grow file
@@ -39,7 +130,9 @@
  * Crash Recovery:
  *   On startup, if a journal exists, the database was interrupted
  * mid-transaction. Recovery replays the journal to restore all pages to their
- * pre-transaction state, then deletes the journal.
+ * pre-transaction state, then deletes the journal. If a WAL exists, its
+ * committed frames are indexed, or checkpointed and deleted when opening in
+ * rollback mode.
  *
  * The pager allows callers to view the database file as a practically infinite
  * array of fixed sized nodes. The Caching layer is hidden from the caller, such
@@ -63,12 +156,18 @@
 #include "pager.hpp"
 #include "arena.hpp"
 #include "os_layer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
+#include <chrono>
 #include <cstdlib>
+#include <condition_variable>
 #include <cstring>
+#include <mutex>
 
 /*
  * The pager arena is initialized on startup, and reset in the event of a
@@ -76,11 +175,27 @@
  */
 struct pager_arena {};
 
+/* A reading thread's cache, see 'Snapshots' above */
+struct snapshot_arena {};
+template <> inline constexpr bool arena_per_thread<snapshot_arena> = true;
+
 #define INVALID_SLOT -1
+#define CACHE_GROW_FRAMES 16
+#define CACHE_PROBATION_SHARE 4 /* 2Q: probation holds 1/4 of the capacity */
+#define CACHE_GHOST_SHARE 2     /* 2Q: ghost queue remembers 1/2 of it */
 #define FILENAME_SIZE 32
 #define JOURNAL_POSTFIX "%s-journal"
 #define JOURNAL_FILENAME_SIZE FILENAME_SIZE + 12
+#define WAL_POSTFIX "%s-wal"
+#define TEMP_POSTFIX "%s-temp%u"
+#define WAL_FRAME_SIZE (sizeof(wal_frame_header) + PAGE_SIZE)
+#define WAL_AUTOCHECKPOINT_FRAMES 1024
+#define WAL_NO_FRAME UINT32_MAX /* A page not in the log, read from the data file */
+#define SNAPSHOT_CACHE_PAGES 256 /* A reader's cache, grown past while pinned */
 #define ROOT_PAGE_INDEX 0U
+#define FREE_NEAR_PAGES 64 /* How far after the hint to look for a free page */
+#define MEMORY_GROW_PAGES 256  /* Memory database store, committed 1MB at a time */
+#define MEMORY_KEEP_PAGES 1024 /* and 4MB of it kept when it shrinks */
 
 /*
  * When a page is deleted, it joins a linked list for future reuse,
@@ -101,21 +216,59 @@ struct free_page {
 struct root_page {
   uint32_t page_counter;   /* Next page index to allocate */
   uint32_t free_page_head; /* Head of free list (0 = empty list) */
-  char padding[PAGE_SIZE - (sizeof(uint32_t) * 2)];
+  uint32_t slots[PAGER_ROOT_SLOTS]; /* See pager_get_root_slot */
+  char padding[PAGE_SIZE - (sizeof(uint32_t) * (2 + PAGER_ROOT_SLOTS))];
 };
 
 /*
  * Invariants to ensure our reinterpret_casts are safe
  * and that disk I/O aligns with OS page boundaries
  */
+/*
+ * Each page image in the WAL is preceded by its location, since the root page
+ * doesn't store its own index. The checksum covers the page, its index and the
+ * frame's position, to detect torn or out of place frames on recovery.
+ */
+struct wal_frame_header {
+  uint32_t page_index;
+  uint32_t checksum;
+};
+
 static_assert(PAGE_SIZE == sizeof(base_page), "Page size mismatch");
 static_assert(PAGE_SIZE == sizeof(root_page), "root_page size mismatch");
 static_assert(PAGE_SIZE == sizeof(free_page), "free_page size mismatch");
 
 /*
- * Each cache slot has associated metadata for the LRU eviction policy.
+ * Pages of a memory database, see 'Memory Databases' above. Reserved for
+ * the limit given at pager_open, a page never moves as the store grows.
+ */
+struct memory_store {
+  uint8_t *data;
+  uint32_t pages;     /* Pages written, the store's "file size" */
+  uint32_t committed; /* Pages backed by memory */
+  uint32_t limit;     /* Pages reserved, the store is full past them */
+};
+
+/*
+ * The replacement policies keep resident slots in queues. LRU only uses the
+ * hot queue, 2Q admits pages to probation and promotes them to hot.
+ */
+enum cache_queue : uint8_t {
+  CACHE_QUEUE_HOT,       /* LRU order, head is most recently used */
+  CACHE_QUEUE_PROBATION, /* FIFO order, head is most recently admitted */
+  CACHE_QUEUE_COUNT
+};
+
+struct cache_list {
+  int32_t head; /* Most recent slot */
+  int32_t tail; /* Least recent slot (eviction candidate) */
+  uint32_t size;
+};
+
+/*
+ * Each cache slot has associated metadata for the replacement policy.
  * Separating metadata from data improves cache locality when scanning
- * the LRU list.
+ * the queues.
  *
  * The doubly-linked list allows O(1) removal from arbitrary positions,
  * essential for the LRU policy when a page hit occurs.
@@ -124,32 +277,86 @@ struct cache_metadata {
   uint32_t page_index; /* Which page is cached in this slot */
   bool is_dirty;       /* Needs write-back on eviction? */
   bool is_occupied;    /* Is this slot currently in use? */
-  int32_t lru_next;    /* Next slot in LRU order (-1 = end) */
-  int32_t lru_prev;    /* Previous slot in LRU order (-1 = end) */
+  uint16_t pin_count;  /* Pinned slots are never evicted */
+  cache_queue queue;   /* Queue the slot is in, if occupied */
+  bool low_priority;   /* Only touched by scans so far */
+  bool loading;        /* Being read in by a shared reader, see shared_load */
+  int32_t lru_next;    /* Next slot in its queue, or free list if unoccupied */
+  int32_t lru_prev;    /* Previous slot in its queue (-1 = end) */
+};
+
+/* A thread reading during a shared section, see 'Shared Reads' above */
+struct shared_reader {
+  os_file_handle_t data_fd; /* Its own, opened at its first miss */
+  os_file_handle_t wal_fd;
+  int32_t pinned_slot; /* Holding the page it got last */
 };
 
 /*
  * Single global instance simplifies the API
  */
 static struct {
+  PAGER_JOURNAL_MODE journal_mode;
   os_file_handle_t data_fd;
   os_file_handle_t journal_fd;
+  os_file_handle_t wal_fd;
 
   /* In-memory root page, accessed separate from the cache */
   root_page root;
 
-  /* Page cache with parallel arrays pattern for better memory layout */
-  cache_metadata cache_meta[MAX_CACHE_ENTRIES]; /* LRU and state tracking */
-  base_page cache_data[MAX_CACHE_ENTRIES];      /* Actual page data */
+  /*
+   * Page cache with parallel arrays pattern for better memory layout. Both
+   * are reserved for PAGER_MAX_CACHE_PAGES up front and committed as the pool
+   * grows, so a pointer to a pinned frame stays valid while it grows.
+   */
+  cache_metadata *cache_meta; /* LRU and state tracking */
+  base_page *cache_data;      /* Actual page data */
+  uint32_t cache_capacity;    /* Frames requested at open (the watermark) */
+  uint32_t cache_frames;      /* Frames currently committed */
 
-  /* LRU list endpoints for O(1) access to head (MRU) and tail (LRU) */
-  int32_t lru_head; /* Most recently used slot */
-  int32_t lru_tail; /* Least recently used slot (eviction candidate) */
+  /* Replacement policy queues, O(1) access to both ends */
+  PAGER_CACHE_POLICY cache_policy;
+  cache_list queues[CACHE_QUEUE_COUNT];
+  int32_t free_head; /* Unoccupied slots, linked through lru_next */
 
   /* Transaction state */
   bool in_transaction;
+  bool journal_synced;  /* Nothing written to the journal since its last sync */
+  int64_t journal_size; /* Append offset, saves a size query per page */
   char data_file[FILENAME_SIZE];
   char journal_file[JOURNAL_FILENAME_SIZE];
+  char wal_file[JOURNAL_FILENAME_SIZE];
+
+  /* Memory mapped reads, disabled while map is null */
+  uint8_t *map;       /* Private view of the data file */
+  size_t map_size;    /* Bytes reserved for the view */
+  uint32_t map_pages; /* Pages of the view backed by the file */
+
+  /* WAL mode state */
+  uint32_t wal_frames;   /* Frames in the log, the next frame's number */
+  uint32_t wal_tx_start; /* Log length at begin, what rollback cuts back to */
+  root_page tx_root;     /* Root at begin, what rollback restores */
+
+  /* Group commit, disabled while window_ms is 0 */
+  struct {
+    uint32_t window_ms;  /* Longest a soft commit waits to become durable */
+    uint32_t max_pages;  /* Journal size that forces a durable commit */
+    bool open;           /* Soft commits pending in the current journal */
+    bool idle;           /* No transaction since the latest soft commit */
+    uint64_t started_ms; /* When the first soft commit of the group happened */
+    int64_t savepoint;   /* Journal offset of the latest soft commit */
+    root_page root;      /* Root as of the latest soft commit */
+  } group;
+
+  /*
+   * Memory database, see 'Memory Databases' above. store holds the pages at
+   * their index, before_images the originals of the pages this transaction
+   * modified, in the order they were saved.
+   */
+  bool memory;
+  memory_store store;
+  memory_store before_images;
+  bool store_failed; /* A page of this transaction wasn't saved */
 
   /*
    * page_to_cache: Lookup of "is page X cached, and where?"
@@ -159,16 +366,396 @@ static struct {
   hash_map<uint32_t, uint32_t, pager_arena> page_to_cache;
   hash_set<uint32_t, pager_arena> journaled_or_new_pages;
 
+  /*
+   * wal_index: Latest committed frame of each page in the WAL
+   * wal_pending: Frames appended by the current transaction, which take
+   *              precedence and are merged into wal_index on commit
+   */
+  hash_map<uint32_t, uint32_t, pager_arena> wal_index;
+  hash_map<uint32_t, uint32_t, pager_arena> wal_pending;
+
+  /*
+   * See 'Snapshots' above. wal_history links each indexed frame to the frame
+   * its page had before it, and committed_frames and committed_pages are the
+   * log length and page count a new snapshot sees. They change under
+   * wal_latch, which readers take to look them up.
+   */
+  array<uint32_t, pager_arena> wal_history;
+  uint32_t committed_frames;
+  uint32_t committed_pages;
+  uint32_t snapshots;   /* Open, on any thread */
+  uint32_t checkpoints; /* Each rewrites the data file, readers' caches go */
+
+  /* map_dirty: Mapped pages modified (privately copied) in this transaction */
+  hash_set<uint32_t, pager_arena> map_dirty;
+
+  /*
+   * 2Q ghost queue: Pages recently evicted from probation, stamped with
+   * ghost_clock at eviction. Entries older than the ghost share of the cache
+   * have been forgotten, and are pruned lazily.
+   */
+  hash_map<uint32_t, uint32_t, pager_arena> ghosts;
+  uint32_t ghost_clock;
+
+  /*
+   * Free space map, see 'Free Space Map' above. free_prev maps a free page to
+   * the one that links to it (ROOT_PAGE_INDEX for the head), free_low is a
+   * lower bound on the lowest free page.
+   */
+  bool free_loaded;
+  array<uint64_t, pager_arena> free_bits;
+  hash_map<uint32_t, uint32_t, pager_arena> free_prev;
+  uint32_t free_count;
+  uint32_t free_low;
+
+  /* Instrumentation, tx_start_* are the byte counters at begin */
+  pager_io_stats io;
+  uint64_t tx_start_read;
+  uint64_t tx_start_written;
+
+  /* See 'Shared Reads', sections are numbered for shared_page */
+  bool shared;
+  uint32_t shared_section;
+  array<shared_reader, pager_arena> shared_readers; /* This section's */
+
 } PAGER = {};
 
-static void write_page_to_disk(uint32_t page_index, const void *data) {
+static std::mutex pager_latch;
+static std::mutex wal_latch;
+static std::condition_variable shared_loaded; /* A loading frame was read in */
+
+/* The calling thread's reader in a shared section, and the page it last got */
+static thread_local struct {
+  uint32_t section;
+  uint32_t reader;
+  uint32_t page_index;
+  base_page *page;
+} shared_page;
+
+/*
+ * A page in a reader's cache, the version of it from frame, or the data file
+ */
+struct snapshot_frame {
+  uint32_t page_index;
+  uint32_t frame;
+  uint32_t checked; /* The last snapshot it was found current in */
+  uint16_t pin_count;
+  bool referenced; /* Clock bit, set on every get */
+  bool is_occupied;
+};
+
+/* The calling thread's snapshot, and the cache it keeps between them */
+static thread_local struct {
+  bool open;
+  uint32_t frames;      /* Log frames it sees */
+  uint32_t page_counter;
+  uint32_t id;          /* Numbers this thread's snapshots */
+  uint32_t checkpoints; /* The PAGER.checkpoints the cache is good for */
+
+  bool files_open;
+  os_file_handle_t data_fd;
+  os_file_handle_t wal_fd;
+
+  array<snapshot_frame, snapshot_arena> slots;
+  array<base_page *, snapshot_arena> pages;
+  hash_map<uint32_t, uint32_t, snapshot_arena> page_to_slot;
+  uint32_t clock_hand;
+} reader;
+
+static uint64_t clock_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static void histogram_record(pager_histogram *histogram, uint64_t us) {
+  uint32_t bucket = 0;
+  while (bucket < PAGER_HISTOGRAM_BUCKETS - 1 && (1ULL << bucket) <= us) {
+    bucket++;
+  }
+
+  histogram->buckets[bucket]++;
+  histogram->samples++;
+  histogram->total_us += us;
+  if (us > histogram->max_us) {
+    histogram->max_us = us;
+  }
+}
+
+/*
+ * All file I/O goes through these, so it's counted in PAGER.io
+ */
+static os_file_size_t io_read(os_file_handle_t handle, void *data,
+                              os_file_size_t size) {
+  os_file_size_t n = os_file_read(handle, data, size);
+  PAGER.io.bytes_read += n;
+  return n;
+}
+
+static void io_write(os_file_handle_t handle, const void *data,
+                     os_file_size_t size) {
+  PAGER.io.bytes_written += os_file_write(handle, data, size);
+}
+
+static void io_sync(os_file_handle_t handle) {
+  uint64_t start = clock_us();
+  os_file_sync(handle);
+  PAGER.io.syncs++;
+  histogram_record(&PAGER.io.sync_latency, clock_us() - start);
+}
+
+static void io_start_transaction() {
+  PAGER.tx_start_read = PAGER.io.bytes_read;
+  PAGER.tx_start_written = PAGER.io.bytes_written;
+}
+
+static void io_end_transaction() {
+  PAGER.io.transactions++;
+  PAGER.io.tx_bytes_read = PAGER.io.bytes_read - PAGER.tx_start_read;
+  PAGER.io.tx_bytes_written = PAGER.io.bytes_written - PAGER.tx_start_written;
+}
+
+/*
+ * The journal must be durable before the data file is modified, otherwise a
+ * crash could leave a changed page with no original to recover it from.
+ */
+static void journal_sync() {
+  if (!PAGER.journal_synced) {
+    io_sync(PAGER.journal_fd);
+    PAGER.journal_synced = true;
+  }
+}
+
+static bool memory_store_open(memory_store *store, uint32_t limit) {
+  store->data = reinterpret_cast<uint8_t *>(
+      virtual_memory::reserve((size_t)limit * PAGE_SIZE));
+  store->pages = 0;
+  store->committed = 0;
+  store->limit = limit;
+  return store->data != nullptr;
+}
+
+static void memory_store_release(memory_store *store) {
+  if (store->data) {
+    virtual_memory::release(store->data, (size_t)store->limit * PAGE_SIZE);
+  }
+  *store = {};
+}
+
+/*
+ * Memory is committed MEMORY_GROW_PAGES at a time, so a transaction growing
+ * the store page by page doesn't make a system call per page
+ */
+static bool memory_store_write(memory_store *store, uint32_t index,
+                               const void *data) {
+  if (index >= store->committed) {
+    uint32_t committed = std::min(
+        (index / MEMORY_GROW_PAGES + 1) * MEMORY_GROW_PAGES, store->limit);
+    if (index >= store->limit ||
+        !virtual_memory::commit(store->data +
+                                    (size_t)store->committed * PAGE_SIZE,
+                                (size_t)(committed - store->committed) *
+                                    PAGE_SIZE)) {
+      fprintf(stderr, "Memory database full: page %u\n", index);
+      return false;
+    }
+    store->committed = committed;
+  }
+
+  memcpy(store->data + (size_t)index * PAGE_SIZE, data, PAGE_SIZE);
+  if (index >= store->pages) {
+    store->pages = index + 1;
+  }
+  return true;
+}
+
+static bool memory_store_read(memory_store *store, uint32_t index,
+                              void *data) {
+  if (index >= store->pages) {
+    return false;
+  }
+  memcpy(data, store->data + (size_t)index * PAGE_SIZE, PAGE_SIZE);
+  return true;
+}
+
+/* Cut back to 'pages', giving back memory above MEMORY_KEEP_PAGES */
+static void memory_store_truncate(memory_store *store, uint32_t pages) {
+  if (pages < store->pages) {
+    store->pages = pages;
+  }
+
+  uint32_t keep = store->pages > MEMORY_KEEP_PAGES
+                      ? (store->pages / MEMORY_GROW_PAGES + 1) *
+                            MEMORY_GROW_PAGES
+                      : MEMORY_KEEP_PAGES;
+  if (store->committed > keep) {
+    virtual_memory::decommit(store->data + (size_t)keep * PAGE_SIZE,
+                             (size_t)(store->committed - keep) * PAGE_SIZE);
+    store->committed = keep;
+  }
+}
+
+/*
+ * False if a memory database's store is full, which also marks the
+ * transaction failed, as an evicted page is lost with it. A failed
+ * transaction writes nothing more, so no page whose before-image was lost
+ * is overwritten before its rollback.
+ */
+static bool write_page_to_disk(uint32_t page_index, const void *data) {
+  if (PAGER.memory) {
+    if (PAGER.store_failed ||
+        !memory_store_write(&PAGER.store, page_index, data)) {
+      PAGER.store_failed = true;
+      return false;
+    }
+    PAGER.io.pages_written++;
+    return true;
+  }
+
+  if (PAGER.in_transaction) {
+    journal_sync();
+  }
+
   os_file_seek(PAGER.data_fd, page_index * PAGE_SIZE);
-  os_file_write(PAGER.data_fd, data, PAGE_SIZE);
+  io_write(PAGER.data_fd, data, PAGE_SIZE);
+  PAGER.io.pages_written++;
+  return true;
+}
+
+static uint32_t wal_checksum(uint32_t frame, uint32_t page_index,
+                             const void *data) {
+  return hash_bytes(data, PAGE_SIZE) ^
+         hash_int(((uint64_t)frame << 32) | page_index);
+}
+
+static void wal_append(uint32_t page_index, const void *data) {
+  uint8_t frame[WAL_FRAME_SIZE];
+  wal_frame_header *header = reinterpret_cast<wal_frame_header *>(frame);
+
+  header->page_index = page_index;
+  header->checksum = wal_checksum(PAGER.wal_frames, page_index, data);
+  memcpy(frame + sizeof(wal_frame_header), data, PAGE_SIZE);
+
+  os_file_seek(PAGER.wal_fd, (int64_t)PAGER.wal_frames * WAL_FRAME_SIZE);
+  io_write(PAGER.wal_fd, frame, WAL_FRAME_SIZE);
+  PAGER.io.wal_frames_written++;
+
+  PAGER.wal_pending.insert(page_index, PAGER.wal_frames++);
+}
+
+/*
+ * Read a frame's page image, returning the page it belongs to, or
+ * nothing if the frame is incomplete or its checksum doesn't match.
+ */
+static bool wal_read_frame(uint32_t frame_number, uint32_t *page_index,
+                           void *data) {
+  uint8_t frame[WAL_FRAME_SIZE];
+  os_file_seek(PAGER.wal_fd, (int64_t)frame_number * WAL_FRAME_SIZE);
+  if (io_read(PAGER.wal_fd, frame, WAL_FRAME_SIZE) != WAL_FRAME_SIZE) {
+    return false;
+  }
+
+  wal_frame_header *header = reinterpret_cast<wal_frame_header *>(frame);
+  uint8_t *page = frame + sizeof(wal_frame_header);
+  if (header->checksum !=
+      wal_checksum(frame_number, header->page_index, page)) {
+    return false;
+  }
+
+  *page_index = header->page_index;
+  memcpy(data, page, PAGE_SIZE);
+  return true;
+}
+
+/* The WAL frame with the latest version of a page, this transaction's first */
+static uint32_t wal_latest_frame(uint32_t page_index) {
+  if (PAGER.journal_mode != PAGER_JOURNAL_WAL) {
+    return WAL_NO_FRAME;
+  }
+
+  uint32_t *frame = PAGER.wal_pending.get(page_index);
+  if (!frame) {
+    frame = PAGER.wal_index.get(page_index);
+  }
+  return frame ? *frame : WAL_NO_FRAME;
 }
 
 static bool read_page_from_disk(uint32_t page_index, void *data) {
+  if (PAGER.memory) {
+    return memory_store_read(&PAGER.store, page_index, data);
+  }
+
+  uint32_t frame = wal_latest_frame(page_index);
+  if (frame != WAL_NO_FRAME) {
+    uint32_t frame_page;
+    return wal_read_frame(frame, &frame_page, data);
+  }
+
   os_file_seek(PAGER.data_fd, page_index * PAGE_SIZE);
-  return os_file_read(PAGER.data_fd, data, PAGE_SIZE) == PAGE_SIZE;
+  return io_read(PAGER.data_fd, data, PAGE_SIZE) == PAGE_SIZE;
+}
+
+/*
+ * Merge the frames appended since the last commit into the WAL index, each
+ * linked to the frame it replaces, and publish them to new snapshots
+ */
+static void wal_index_pending() {
+  std::lock_guard<std::mutex> guard(wal_latch);
+
+  while (PAGER.wal_history.size() < PAGER.wal_frames) {
+    PAGER.wal_history.push(WAL_NO_FRAME);
+  }
+
+  for (auto [page_index, frame] : PAGER.wal_pending) {
+    uint32_t *replaced = PAGER.wal_index.get(page_index);
+    PAGER.wal_history[frame] = replaced ? *replaced : WAL_NO_FRAME;
+    PAGER.wal_index.insert(page_index, frame);
+  }
+  PAGER.wal_pending.clear();
+
+  PAGER.committed_frames = PAGER.wal_frames;
+  PAGER.committed_pages = PAGER.root.page_counter;
+}
+
+/*
+ * Index the committed frames of an existing WAL.
+ *
+ * Frames are read in order into wal_pending, which is merged into the index at
+ * each commit frame. Reading stops at the first incomplete or corrupt frame,
+ * and the log is cut back to the last commit, discarding the frames of a
+ * transaction that was interrupted.
+ */
+static void wal_recover() {
+  uint32_t committed_frames = 0;
+  uint32_t frame = 0;
+  uint32_t page_index;
+  uint8_t page_buffer[PAGE_SIZE];
+
+  while (wal_read_frame(frame, &page_index, page_buffer)) {
+    PAGER.wal_pending.insert(page_index, frame++);
+
+    if (page_index == ROOT_PAGE_INDEX) {
+      PAGER.wal_frames = frame;
+      wal_index_pending();
+      committed_frames = frame;
+    }
+  }
+
+  PAGER.wal_pending.clear();
+  PAGER.wal_frames = committed_frames;
+  os_file_truncate(PAGER.wal_fd, (int64_t)committed_frames * WAL_FRAME_SIZE);
+}
+
+/*
+ * Dirty pages leaving the cache go to the WAL in WAL mode, otherwise in place
+ * to the data file, as their originals are in the journal.
+ */
+static void cache_write_back(uint32_t page_index, const void *data) {
+  if (PAGER.journal_mode == PAGER_JOURNAL_WAL) {
+    wal_append(page_index, data);
+  } else {
+    write_page_to_disk(page_index, data);
+  }
 }
 
 /*
@@ -177,250 +764,906 @@ static bool read_page_from_disk(uint32_t page_index, void *data) {
  *   1. Mark page as journaled in the journaled_or_new_pages set
  *   2. If root page, write at offset 0
  *   3. Otherwise, append to end of journal
- *   4. fsync journal to ensure durability
+ *   4. Defer the fsync until the data file is about to be written
+ *
+ * A memory database appends it to its before-images instead.
  */
 static void journal_write_page(uint32_t page_index, const void *data) {
   PAGER.journaled_or_new_pages.insert(page_index, 1);
 
+  if (PAGER.memory) {
+    if (!memory_store_write(&PAGER.before_images, PAGER.before_images.pages,
+                            data)) {
+      PAGER.store_failed = true;
+    }
+    return;
+  }
+
   if (page_index == ROOT_PAGE_INDEX) {
     os_file_seek(PAGER.journal_fd, 0);
   } else {
-    int64_t journal_size = os_file_size(PAGER.journal_fd);
-    if (journal_size < PAGE_SIZE) {
-      journal_size = PAGE_SIZE;
+    if (PAGER.journal_size < PAGE_SIZE) {
+      PAGER.journal_size = PAGE_SIZE;
     }
-    os_file_seek(PAGER.journal_fd, journal_size);
+    os_file_seek(PAGER.journal_fd, PAGER.journal_size);
+    PAGER.journal_size += PAGE_SIZE;
   }
 
-  os_file_write(PAGER.journal_fd, data, PAGE_SIZE);
-  os_file_sync(PAGER.journal_fd);
+  io_write(PAGER.journal_fd, data, PAGE_SIZE);
+  PAGER.journal_synced = false;
+  PAGER.io.journal_pages++;
 }
 
-static void lru_remove_from_list(int32_t slot) {
+static void queue_remove(int32_t slot) {
   cache_metadata *entry = &PAGER.cache_meta[slot];
+  cache_list *list = &PAGER.queues[entry->queue];
 
   if (entry->lru_prev != INVALID_SLOT) {
     PAGER.cache_meta[entry->lru_prev].lru_next = entry->lru_next;
   } else {
-    PAGER.lru_head = entry->lru_next;
+    list->head = entry->lru_next;
   }
 
   if (entry->lru_next != INVALID_SLOT) {
     PAGER.cache_meta[entry->lru_next].lru_prev = entry->lru_prev;
   } else {
-    PAGER.lru_tail = entry->lru_prev;
+    list->tail = entry->lru_prev;
   }
 
+  list->size--;
   entry->lru_next = INVALID_SLOT;
   entry->lru_prev = INVALID_SLOT;
 }
 
-static void lru_add_to_head(int32_t slot) {
+static void queue_push_head(int32_t slot, cache_queue queue) {
   cache_metadata *entry = &PAGER.cache_meta[slot];
+  cache_list *list = &PAGER.queues[queue];
 
-  entry->lru_next = PAGER.lru_head;
+  entry->queue = queue;
+  entry->lru_next = list->head;
   entry->lru_prev = INVALID_SLOT;
 
-  if (PAGER.lru_head != INVALID_SLOT) {
-    PAGER.cache_meta[PAGER.lru_head].lru_prev = slot;
+  if (list->head != INVALID_SLOT) {
+    PAGER.cache_meta[list->head].lru_prev = slot;
   }
 
-  PAGER.lru_head = slot;
-
-  if (PAGER.lru_tail == INVALID_SLOT) {
-    PAGER.lru_tail = slot;
-  }
-}
+  list->head = slot;
+  list->size++;
 
-static void cache_move_to_head(int32_t slot) {
-  if (PAGER.lru_head == slot) {
-    return;
+  if (list->tail == INVALID_SLOT) {
+    list->tail = slot;
   }
-
-  lru_remove_from_list(slot);
-  lru_add_to_head(slot);
 }
 
-/*
- * Evict the least recently used page from the cache.
- *
- *   1. Select the tail of the LRU list
- *   2. If page is dirty, write to disk
- *   3. Remove from page_to_cache map
- *   4. Remove from LRU list
- *   5. Mark slot as invalid
- *   6. Return the slot for reuse
- */
-static int32_t cache_evict_lru_entry() {
-  int32_t slot = PAGER.lru_tail;
+static void queue_push_tail(int32_t slot, cache_queue queue) {
   cache_metadata *entry = &PAGER.cache_meta[slot];
+  cache_list *list = &PAGER.queues[queue];
 
-  if (entry->is_dirty) {
-    write_page_to_disk(entry->page_index, &PAGER.cache_data[slot]);
-  }
-
-  PAGER.page_to_cache.remove(entry->page_index);
+  entry->queue = queue;
+  entry->lru_next = INVALID_SLOT;
+  entry->lru_prev = list->tail;
 
-  lru_remove_from_list(slot);
+  if (list->tail != INVALID_SLOT) {
+    PAGER.cache_meta[list->tail].lru_next = slot;
+  }
 
-  entry->is_occupied = false;
-  entry->is_dirty = false;
-  entry->page_index = ROOT_PAGE_INDEX;
+  list->tail = slot;
+  list->size++;
 
-  return slot;
+  if (list->head == INVALID_SLOT) {
+    list->head = slot;
+  }
 }
 
-static uint32_t cache_find_free_slot() {
-  for (uint32_t i = 0; i < MAX_CACHE_ENTRIES; i++) {
-    if (!PAGER.cache_meta[i].is_occupied) {
-      return i;
-    }
+static void queues_clear() {
+  for (uint32_t i = 0; i < CACHE_QUEUE_COUNT; i++) {
+    PAGER.queues[i] = {INVALID_SLOT, INVALID_SLOT, 0};
   }
 
-  return cache_evict_lru_entry();
+  PAGER.ghosts.clear();
+  PAGER.ghost_clock = 0;
 }
 
-static void cache_reset() {
-  for (uint32_t i = 0; i < MAX_CACHE_ENTRIES; i++) {
-    PAGER.cache_meta[i].page_index = ROOT_PAGE_INDEX;
-    PAGER.cache_meta[i].is_dirty = false;
-    PAGER.cache_meta[i].is_occupied = false;
-    PAGER.cache_meta[i].lru_next = INVALID_SLOT;
-    PAGER.cache_meta[i].lru_prev = INVALID_SLOT;
-  }
+static uint32_t ghost_capacity() {
+  uint32_t capacity = PAGER.cache_capacity / CACHE_GHOST_SHARE;
+  return capacity ? capacity : 1;
+}
 
-  PAGER.page_to_cache.clear();
-  PAGER.journaled_or_new_pages.clear();
+static void ghost_remember(uint32_t page_index) {
+  PAGER.ghosts.insert(page_index, ++PAGER.ghost_clock);
 
-  PAGER.lru_head = INVALID_SLOT;
-  PAGER.lru_tail = INVALID_SLOT;
+  if (PAGER.ghosts.size() > ghost_capacity() * 2) {
+    PAGER.ghosts.remove_if([](uint32_t, uint32_t stamp) {
+      return PAGER.ghost_clock - stamp >= ghost_capacity();
+    });
+  }
 }
 
 /*
- * Fetch a page into cache.
- *
- *   1. Check if page is already cached via page_to_cache map
- *   2. If cached, move to head of LRU and return
- *   3. Otherwise find a free cache slot (may evict)
- *   4. Read page from disk into slot
- *   5. Update cache metadata
- *   6. Insert into page_to_cache map
- *   7. Add to head of LRU list
+ * Was the page evicted from probation recently enough to still be remembered?
+ * Either way it's forgotten, it's about to be cached again.
  */
-static base_page *cache_get_or_load(uint32_t page_index) {
-  uint32_t *slot_ptr = PAGER.page_to_cache.get(page_index);
-  if (slot_ptr) {
-    uint32_t slot = *slot_ptr;
-    cache_move_to_head(slot);
-    return &PAGER.cache_data[slot];
+static bool ghost_forget(uint32_t page_index) {
+  uint32_t *stamp = PAGER.ghosts.get(page_index);
+  if (!stamp) {
+    return false;
   }
 
-  uint32_t slot = cache_find_free_slot();
-  cache_metadata *entry = &PAGER.cache_meta[slot];
-
-  read_page_from_disk(page_index, &PAGER.cache_data[slot]);
-
-  entry->page_index = page_index;
-  entry->is_occupied = true;
-  entry->is_dirty = false;
-
-  PAGER.page_to_cache.insert(page_index, slot);
-  lru_add_to_head(slot);
-
-  return &PAGER.cache_data[slot];
+  bool remembered = PAGER.ghost_clock - *stamp < ghost_capacity();
+  PAGER.ghosts.remove(page_index);
+  return remembered;
 }
 
 /*
- * Add a page to the free list.
+ * Queue a slot that has just been filled.
  *
- *   1. Ensure page is loaded
- *   2. Ensure it's journaled
- *   3. Reinterpret the page as a free_page, the index will be the same
- *   4. Set previous_free_page to the current free list head
- *   5. Update root to point to new head
+ * 2Q: A page remembered by the ghost queue has been requested twice in a
+ * short window, so goes straight to hot, everything else starts in probation.
+ * LRU: Pages go to the most recent end, scan pages to the least recent.
  */
-static void add_page_to_free_list(uint32_t page_index) {
-  free_page *free_page_ptr =
-      reinterpret_cast<free_page *>(cache_get_or_load(page_index));
-
-  pager_ensure_journaled(page_index);
-
-  uint32_t current_free_page = PAGER.root.free_page_head;
-  assert(free_page_ptr->index == page_index &&
-         "Conversion to free_page should not affect index at bytes 0-4");
-  free_page_ptr->previous_free_page = current_free_page;
+static void cache_admit(int32_t slot, bool low_priority) {
+  cache_metadata *entry = &PAGER.cache_meta[slot];
+  entry->low_priority = low_priority;
 
-  PAGER.root.free_page_head = page_index;
+  if (PAGER.cache_policy == PAGER_CACHE_2Q) {
+    bool promote = !low_priority && ghost_forget(entry->page_index);
+    queue_push_head(slot, promote ? CACHE_QUEUE_HOT : CACHE_QUEUE_PROBATION);
+  } else if (low_priority) {
+    queue_push_tail(slot, CACHE_QUEUE_HOT);
+  } else {
+    queue_push_head(slot, CACHE_QUEUE_HOT);
+  }
 }
 
 /*
- * Take a page from the free list.
+ * Record a hit on a cached slot.
  *
- *   1. Check if free list is empty (head == 0), return 0 if so
- *   2. Load the current head of free list
- *   3. Ensure it's journaled
- *   4. Update root to point to the current's previous_free_page
- *   5. Return the reclaimed page index
+ * Scan hits never raise a page's priority. Under 2Q, hits during probation
+ * don't either, so the burst of hits while a page is first being used (every
+ * row of a leaf) counts as a single reference.
  */
-static uint32_t take_page_from_free_list() {
-  if (PAGER.root.free_page_head == 0) {
-    return ROOT_PAGE_INDEX;
+static void cache_touch(int32_t slot, bool low_priority) {
+  cache_metadata *entry = &PAGER.cache_meta[slot];
+  if (low_priority) {
+    return;
   }
 
-  uint32_t current_index = PAGER.root.free_page_head;
-  free_page *current_free_page =
-      reinterpret_cast<free_page *>(cache_get_or_load(current_index));
-  pager_ensure_journaled(current_index);
-
-  PAGER.root.free_page_head = current_free_page->previous_free_page;
+  entry->low_priority = false;
 
-  return current_index;
+  if (entry->queue == CACHE_QUEUE_HOT && PAGER.queues[entry->queue].head != slot) {
+    queue_remove(slot);
+    queue_push_head(slot, CACHE_QUEUE_HOT);
+  }
 }
 
 /*
- * Count free pages by walking the linked list.
- *
- *   1. Start from root.free_page_head
- *   2. Load each free page
- *   3. Follow previous_free_page link
- *   4. Stop when reaching ROOT_PAGE_INDEX (sentinel)
+ * Commit or decommit the address space so exactly 'frames' slots are backed.
+ * The OS works in its own page size, so both regions are rounded up to it.
  */
-static uint32_t count_free_pages() {
-  uint32_t count = 0;
-  uint32_t current_free_page_index = PAGER.root.free_page_head;
-  while (ROOT_PAGE_INDEX != current_free_page_index) {
-    free_page *free_page_ptr = reinterpret_cast<free_page *>(
-        cache_get_or_load(current_free_page_index));
-
-    current_free_page_index = free_page_ptr->previous_free_page;
-
-    count++;
+static bool cache_set_frames(uint32_t frames) {
+  size_t meta_old = virtual_memory::round_to_pages(PAGER.cache_frames *
+                                                   sizeof(cache_metadata));
+  size_t meta_new =
+      virtual_memory::round_to_pages(frames * sizeof(cache_metadata));
+  size_t data_old =
+      virtual_memory::round_to_pages((size_t)PAGER.cache_frames * PAGE_SIZE);
+  size_t data_new = virtual_memory::round_to_pages((size_t)frames * PAGE_SIZE);
+
+  uint8_t *meta = reinterpret_cast<uint8_t *>(PAGER.cache_meta);
+  uint8_t *data = reinterpret_cast<uint8_t *>(PAGER.cache_data);
+
+  if (meta_new > meta_old &&
+      !virtual_memory::commit(meta + meta_old, meta_new - meta_old)) {
+    return false;
+  }
+  if (data_new > data_old &&
+      !virtual_memory::commit(data + data_old, data_new - data_old)) {
+    return false;
+  }
+  if (meta_new < meta_old) {
+    virtual_memory::decommit(meta + meta_new, meta_old - meta_new);
+  }
+  if (data_new < data_old) {
+    virtual_memory::decommit(data + data_new, data_old - data_new);
   }
 
-  return count;
+  PAGER.cache_frames = frames;
+  return true;
 }
 
-/*
- * Open a database file.
- *
- *   1. Initialize arena allocator
- *   2. Open data file (create if needed)
+static void cache_push_free_slot(int32_t slot) {
+  cache_metadata *entry = &PAGER.cache_meta[slot];
+
+  entry->page_index = ROOT_PAGE_INDEX;
+  entry->is_dirty = false;
+  entry->is_occupied = false;
+  entry->pin_count = 0;
+  entry->lru_prev = INVALID_SLOT;
+  entry->lru_next = PAGER.free_head;
+
+  PAGER.free_head = slot;
+}
+
+/*
+ * Grow the pool when every frame is occupied and pinned.
+ *
+ * The new frames go on the free list, they are given back by cache_shrink
+ * once the operation holding the pins has finished.
+ */
+static bool cache_grow() {
+  uint32_t old_frames = PAGER.cache_frames;
+  uint32_t new_frames = old_frames + CACHE_GROW_FRAMES;
+
+  if (new_frames > PAGER_MAX_CACHE_PAGES || !cache_set_frames(new_frames)) {
+    return false;
+  }
+
+  for (uint32_t i = new_frames; i > old_frames; i--) {
+    cache_push_free_slot(i - 1);
+  }
+
+  return true;
+}
+
+/*
+ * Write back a slot if dirty and remove it from the cache structures.
+ */
+static void cache_release_slot(int32_t slot) {
+  cache_metadata *entry = &PAGER.cache_meta[slot];
+
+  if (entry->is_dirty) {
+    cache_write_back(entry->page_index, &PAGER.cache_data[slot]);
+  }
+
+  PAGER.page_to_cache.remove(entry->page_index);
+
+  queue_remove(slot);
+
+  entry->is_occupied = false;
+  entry->is_dirty = false;
+  entry->pin_count = 0;
+  entry->page_index = ROOT_PAGE_INDEX;
+}
+
+static int32_t queue_find_victim(cache_queue queue) {
+  int32_t slot = PAGER.queues[queue].tail;
+  while (slot != INVALID_SLOT && PAGER.cache_meta[slot].pin_count > 0) {
+    slot = PAGER.cache_meta[slot].lru_prev;
+  }
+
+  return slot;
+}
+
+/*
+ * Evict an unpinned page chosen by the replacement policy.
+ *
+ *   1. Pick the victim queue. 2Q evicts from probation while it's over its
+ *      share of the cache, otherwise from hot, LRU only has hot
+ *   2. Walk from the tail of the queue, skipping pinned slots, falling back
+ *      to the other queue if all are pinned
+ *   3. 2Q remembers a page leaving probation in the ghost queue, unless only
+ *      scans used it
+ *   4. Write back if dirty, remove from page_to_cache and its queue
+ *   5. Return the slot for reuse, or INVALID_SLOT if all are pinned
+ */
+static int32_t cache_evict_entry() {
+  int32_t slot;
+
+  if (PAGER.cache_policy == PAGER_CACHE_2Q) {
+    cache_queue first = CACHE_QUEUE_HOT, second = CACHE_QUEUE_PROBATION;
+    if (PAGER.queues[CACHE_QUEUE_PROBATION].size * CACHE_PROBATION_SHARE >
+        PAGER.cache_capacity) {
+      first = CACHE_QUEUE_PROBATION;
+      second = CACHE_QUEUE_HOT;
+    }
+
+    slot = queue_find_victim(first);
+    if (slot == INVALID_SLOT) {
+      slot = queue_find_victim(second);
+    }
+  } else {
+    slot = queue_find_victim(CACHE_QUEUE_HOT);
+  }
+
+  if (slot == INVALID_SLOT) {
+    return INVALID_SLOT;
+  }
+
+  cache_metadata *entry = &PAGER.cache_meta[slot];
+  if (entry->queue == CACHE_QUEUE_PROBATION && !entry->low_priority) {
+    ghost_remember(entry->page_index);
+  }
+
+  if (entry->is_dirty) {
+    PAGER.io.dirty_evictions++;
+  } else {
+    PAGER.io.clean_evictions++;
+  }
+
+  cache_release_slot(slot);
+  return slot;
+}
+
+static uint32_t cache_find_free_slot() {
+  if (PAGER.free_head == INVALID_SLOT) {
+    int32_t slot = cache_evict_entry();
+    if (slot != INVALID_SLOT) {
+      return slot;
+    }
+
+    // A caller can't go on without its page, so this stops every build
+    if (!cache_grow()) {
+      fprintf(stderr, "Page cache exhausted, all %u frames are pinned\n",
+              PAGER.cache_frames);
+      abort();
+    }
+  }
+
+  int32_t slot = PAGER.free_head;
+  PAGER.free_head = PAGER.cache_meta[slot].lru_next;
+  PAGER.cache_meta[slot].lru_next = INVALID_SLOT;
+
+  return slot;
+}
+
+/*
+ * Shrink the pool back down to its capacity.
+ *
+ * Frames above the watermark are dropped from the top, stopping at the first
+ * one that is still pinned, then the free list is rebuilt from what remains.
+ */
+static void cache_shrink() {
+  if (PAGER.cache_frames <= PAGER.cache_capacity) {
+    return;
+  }
+
+  uint32_t frames = PAGER.cache_frames;
+  while (frames > PAGER.cache_capacity) {
+    cache_metadata *entry = &PAGER.cache_meta[frames - 1];
+    if (entry->is_occupied) {
+      if (entry->pin_count > 0) {
+        break;
+      }
+      cache_release_slot(frames - 1);
+    }
+    frames--;
+  }
+
+  PAGER.free_head = INVALID_SLOT;
+  for (uint32_t i = frames; i > 0; i--) {
+    if (!PAGER.cache_meta[i - 1].is_occupied) {
+      cache_push_free_slot(i - 1);
+    }
+  }
+
+  cache_set_frames(frames);
+}
+
+static void cache_release() {
+  if (PAGER.cache_meta) {
+    virtual_memory::release(PAGER.cache_meta,
+                            PAGER_MAX_CACHE_PAGES * sizeof(cache_metadata));
+  }
+  if (PAGER.cache_data) {
+    virtual_memory::release(PAGER.cache_data,
+                            (size_t)PAGER_MAX_CACHE_PAGES * PAGE_SIZE);
+  }
+
+  PAGER.cache_meta = nullptr;
+  PAGER.cache_data = nullptr;
+  PAGER.cache_frames = 0;
+}
+
+static bool free_map_test(uint32_t page_index) {
+  uint32_t word = page_index / 64;
+  return word < PAGER.free_bits.size() &&
+         (PAGER.free_bits[word] >> (page_index % 64)) & 1;
+}
+
+static void free_map_set(uint32_t page_index, bool free) {
+  uint32_t word = page_index / 64;
+  while (PAGER.free_bits.size() <= word) {
+    PAGER.free_bits.push(0);
+  }
+
+  uint64_t bit = 1ULL << (page_index % 64);
+  if (free) {
+    PAGER.free_bits[word] |= bit;
+    PAGER.free_count++;
+    if (page_index < PAGER.free_low) {
+      PAGER.free_low = page_index;
+    }
+  } else {
+    PAGER.free_bits[word] &= ~bit;
+    PAGER.free_count--;
+  }
+}
+
+/*
+ * First free page in [from, to), or ROOT_PAGE_INDEX if there's none.
+ */
+static uint32_t free_map_find(uint32_t from, uint32_t to) {
+  for (uint32_t word = from / 64;
+       word < PAGER.free_bits.size() && (uint64_t)word * 64 < to; word++) {
+    uint64_t bits = PAGER.free_bits[word];
+    if (word == from / 64) {
+      bits &= ~0ULL << (from % 64);
+    }
+
+    if (bits) {
+      uint32_t page_index = word * 64 + std::countr_zero(bits);
+      return page_index < to ? page_index : ROOT_PAGE_INDEX;
+    }
+  }
+
+  return ROOT_PAGE_INDEX;
+}
+
+static uint32_t free_map_lowest(uint32_t below) {
+  uint32_t page_index = free_map_find(PAGER.free_low, below);
+  PAGER.free_low = page_index != ROOT_PAGE_INDEX ? page_index : below;
+  return page_index;
+}
+
+/*
+ * Forget the map, after the free list on disk has been restored by a rollback
+ */
+static void free_map_invalidate() {
+  PAGER.free_loaded = false;
+  PAGER.free_bits.clear();
+  PAGER.free_prev.clear();
+  PAGER.free_count = 0;
+}
+
+static void cache_reset() {
+  cache_set_frames(PAGER.cache_capacity);
+
+  PAGER.free_head = INVALID_SLOT;
+  for (uint32_t i = PAGER.cache_frames; i > 0; i--) {
+    cache_push_free_slot(i - 1);
+  }
+
+  PAGER.page_to_cache.clear();
+  PAGER.journaled_or_new_pages.clear();
+
+  queues_clear();
+  free_map_invalidate();
+}
+
+/*
+ * Fetch a page into cache, returning its slot.
+ *
+ *   1. Check if page is already cached via page_to_cache map
+ *   2. If cached, record the hit with the replacement policy and return
+ *   3. Otherwise find a free cache slot (may evict or grow)
+ *   4. Read page from disk into slot
+ *   5. Update cache metadata
+ *   6. Insert into page_to_cache map
+ *   7. Admit to the replacement policy's queues
+ */
+static uint32_t cache_load_slot(uint32_t page_index, bool low_priority) {
+  uint32_t *slot_ptr = PAGER.page_to_cache.get(page_index);
+  if (slot_ptr) {
+    uint32_t slot = *slot_ptr;
+    cache_touch(slot, low_priority);
+    PAGER.io.cache_hits++;
+    return slot;
+  }
+
+  uint32_t slot = cache_find_free_slot();
+  cache_metadata *entry = &PAGER.cache_meta[slot];
+
+  uint64_t start = clock_us();
+  read_page_from_disk(page_index, &PAGER.cache_data[slot]);
+  PAGER.io.cache_misses++;
+  histogram_record(&PAGER.io.miss_latency, clock_us() - start);
+
+  entry->page_index = page_index;
+  entry->is_occupied = true;
+  entry->is_dirty = false;
+  entry->pin_count = 0;
+
+  PAGER.page_to_cache.insert(page_index, slot);
+  cache_admit(slot, low_priority);
+
+  return slot;
+}
+
+static base_page *cache_get_or_load(uint32_t page_index,
+                                    bool low_priority = false) {
+  return &PAGER.cache_data[cache_load_slot(page_index, low_priority)];
+}
+
+/*
+ * A page is served from the mapping if the file holds its latest version.
+ * Callers check the cache first, a cached page is never mapped.
+ */
+static bool map_contains(uint32_t page_index) {
+  if (!PAGER.map || page_index >= PAGER.map_pages) {
+    return false;
+  }
+
+  if (PAGER.journal_mode == PAGER_JOURNAL_WAL) {
+    return !PAGER.wal_pending.contains(page_index) &&
+           !PAGER.wal_index.contains(page_index);
+  }
+
+  return true;
+}
+
+static base_page *map_page(uint32_t page_index) {
+  return reinterpret_cast<base_page *>(PAGER.map +
+                                       (size_t)page_index * PAGE_SIZE);
+}
+
+/*
+ * The file only grows or shrinks at commit, rollback and checkpoint, after
+ * which the part of the view backed by it is measured again.
+ */
+static void map_refresh() {
+  if (!PAGER.map) {
+    return;
+  }
+
+  uint64_t file_pages = os_file_size(PAGER.data_fd) / PAGE_SIZE;
+  uint64_t view_pages = PAGER.map_size / PAGE_SIZE;
+  PAGER.map_pages = file_pages < view_pages ? file_pages : view_pages;
+}
+
+/*
+ * Drop the private copies of modified pages, once the file holds either
+ * their committed or their original content.
+ */
+static void map_reset_dirty() {
+  for (auto [page_index, _] : PAGER.map_dirty) {
+    os_file_map_reset(PAGER.data_fd, map_page(page_index),
+                      (os_file_offset_t)page_index * PAGE_SIZE, PAGE_SIZE);
+  }
+
+  PAGER.map_dirty.clear();
+}
+
+/*
+ * Find a page wherever it lives, see 'Memory Mapping' above.
+ */
+static base_page *page_get(uint32_t page_index, bool low_priority = false) {
+  uint32_t *slot_ptr = PAGER.page_to_cache.get(page_index);
+  if (slot_ptr) {
+    cache_touch(*slot_ptr, low_priority);
+    PAGER.io.cache_hits++;
+    return &PAGER.cache_data[*slot_ptr];
+  }
+
+  if (map_contains(page_index)) {
+    PAGER.io.map_hits++;
+    return map_page(page_index);
+  }
+
+  return cache_get_or_load(page_index, low_priority);
+}
+
+/*
+ * Index the free list by walking it once, see 'Free Space Map' above. Pages
+ * are read at scan priority, they're unlikely to be needed again soon.
+ */
+static void free_map_load() {
+  if (PAGER.free_loaded) {
+    return;
+  }
+
+  free_map_invalidate();
+  PAGER.free_loaded = true;
+  PAGER.free_low = PAGER.root.page_counter;
+
+  uint32_t previous = ROOT_PAGE_INDEX;
+  uint32_t current = PAGER.root.free_page_head;
+  while (current != ROOT_PAGE_INDEX) {
+    free_map_set(current, true);
+    PAGER.free_prev.insert(current, previous);
+
+    previous = current;
+    current =
+        reinterpret_cast<free_page *>(page_get(current, true))->previous_free_page;
+  }
+}
+
+/*
+ * Add a page to the free list.
+ *
+ *   1. Ensure page is loaded
+ *   2. Ensure it's journaled
+ *   3. Reinterpret the page as a free_page, the index will be the same
+ *   4. Set previous_free_page to the current free list head
+ *   5. Update root to point to new head, and the free space map
+ */
+static void add_page_to_free_list(uint32_t page_index) {
+  free_map_load();
+
+  free_page *free_page_ptr =
+      reinterpret_cast<free_page *>(page_get(page_index));
+
+  pager_ensure_journaled(page_index);
+
+  uint32_t current_free_page = PAGER.root.free_page_head;
+  assert(free_page_ptr->index == page_index &&
+         "Conversion to free_page should not affect index at bytes 0-4");
+  free_page_ptr->previous_free_page = current_free_page;
+
+  PAGER.root.free_page_head = page_index;
+
+  free_map_set(page_index, true);
+  PAGER.free_prev.insert(page_index, ROOT_PAGE_INDEX);
+  if (current_free_page != ROOT_PAGE_INDEX) {
+    PAGER.free_prev.insert(current_free_page, page_index);
+  }
+}
+
+/*
+ * Unlink a specific page from the free list.
+ *
+ *   1. Load the page and ensure it's journaled
+ *   2. Point its predecessor (the root, or another free page, journaled too)
+ *      at its successor
+ *   3. Update the free space map
+ */
+static void take_free_page(uint32_t page_index) {
+  assert(free_map_test(page_index) && "Page isn't on the free list");
+
+  free_page *page = reinterpret_cast<free_page *>(page_get(page_index));
+  pager_ensure_journaled(page_index);
+  uint32_t next = page->previous_free_page;
+
+  uint32_t previous = *PAGER.free_prev.get(page_index);
+  if (previous == ROOT_PAGE_INDEX) {
+    PAGER.root.free_page_head = next;
+  } else {
+    pager_ensure_journaled(previous);
+    reinterpret_cast<free_page *>(page_get(previous))->previous_free_page = next;
+  }
+
+  if (next != ROOT_PAGE_INDEX) {
+    PAGER.free_prev.insert(next, previous);
+  }
+  PAGER.free_prev.remove(page_index);
+  free_map_set(page_index, false);
+}
+
+/*
+ * Take a page from the free list.
+ *
+ *   1. Return ROOT_PAGE_INDEX if the free list is empty
+ *   2. Prefer the first free page shortly after near_page
+ *   3. Otherwise the lowest free page
+ *   4. Unlink it and return the reclaimed page index
+ */
+static uint32_t take_page_from_free_list(uint32_t near_page) {
+  if (PAGER.root.free_page_head == ROOT_PAGE_INDEX) {
+    return ROOT_PAGE_INDEX;
+  }
+
+  free_map_load();
+
+  uint32_t page_index = ROOT_PAGE_INDEX;
+  if (near_page != ROOT_PAGE_INDEX) {
+    page_index = free_map_find(near_page + 1, near_page + 1 + FREE_NEAR_PAGES);
+  }
+  if (page_index == ROOT_PAGE_INDEX) {
+    page_index = free_map_lowest(PAGER.root.page_counter);
+  }
+
+  take_free_page(page_index);
+  return page_index;
+}
+
+/*
+ * First page of count free pages in a row, starting in [from, to), or
+ * ROOT_PAGE_INDEX if there's no run that long.
+ */
+static uint32_t free_map_find_run(uint32_t from, uint32_t to, uint32_t count) {
+  uint32_t start = free_map_find(from, to);
+  while (start != ROOT_PAGE_INDEX) {
+    uint32_t end = start + 1;
+    while (end - start < count && free_map_test(end)) {
+      end++;
+    }
+    if (end - start == count) {
+      return start;
+    }
+    start = free_map_find(end + 1, to);
+  }
+
+  return ROOT_PAGE_INDEX;
+}
+
+/*
+ * Take count free pages in a row from the free list, see pager_new_extent.
+ *
+ *   1. Return ROOT_PAGE_INDEX if the free list is empty
+ *   2. Prefer the run starting just after near_page
+ *   3. Otherwise the lowest run long enough
+ *   4. Otherwise free pages at the end of the file, with page_counter
+ *      moved past what the run still needs
+ *   5. Unlink each and return the first
+ */
+static uint32_t take_extent_from_free_list(uint32_t count,
+                                           uint32_t near_page) {
+  if (PAGER.root.free_page_head == ROOT_PAGE_INDEX) {
+    return ROOT_PAGE_INDEX;
+  }
+
+  free_map_load();
+
+  uint32_t page_counter = PAGER.root.page_counter;
+  uint32_t first = ROOT_PAGE_INDEX;
+  if (near_page != ROOT_PAGE_INDEX) {
+    first = free_map_find_run(near_page + 1, near_page + 2, count);
+  }
+  if (first == ROOT_PAGE_INDEX) {
+    first = free_map_find_run(PAGER.free_low, page_counter, count);
+  }
+
+  uint32_t taken = count;
+  if (first == ROOT_PAGE_INDEX) {
+    first = page_counter;
+    while (first > ROOT_PAGE_INDEX + 1 && free_map_test(first - 1)) {
+      first--;
+    }
+    if (first == page_counter) {
+      return ROOT_PAGE_INDEX;
+    }
+    taken = page_counter - first;
+    PAGER.root.page_counter = first + count;
+  }
+
+  for (uint32_t i = 0; i < taken; i++) {
+    take_free_page(first + i);
+  }
+  return first;
+}
+
+static uint32_t count_free_pages() {
+  free_map_load();
+  return PAGER.free_count;
+}
+
+/*
+ * Drop pages past the end of the file from the cache and the mapping's
+ * private copies, after the file was cut back.
+ */
+static void cache_drop_from(uint32_t first_page) {
+  for (uint32_t slot = 0; slot < PAGER.cache_frames; slot++) {
+    cache_metadata *entry = &PAGER.cache_meta[slot];
+    if (entry->is_occupied && entry->page_index >= first_page) {
+      entry->is_dirty = false;
+      cache_release_slot(slot);
+      cache_push_free_slot(slot);
+    }
+  }
+
+  PAGER.map_dirty.remove_if([first_page](uint32_t page_index, char) {
+    if (page_index < first_page) {
+      return false;
+    }
+    os_file_map_reset(PAGER.data_fd, map_page(page_index),
+                      (os_file_offset_t)page_index * PAGE_SIZE, PAGE_SIZE);
+    return true;
+  });
+}
+
+/*
+ * Before a commit writes anything, drop the free pages at the end of the
+ * file, returning whether the file shrank. Each is journaled as it's unlinked,
+ * so a rollback still finds the free list it had. Only runs once the free
+ * list is indexed, which it is if anything was freed or allocated from it.
+ */
+static bool free_truncate_tail() {
+  if (!PAGER.free_loaded) {
+    return false;
+  }
+
+  uint32_t page_counter = PAGER.root.page_counter;
+  while (page_counter > ROOT_PAGE_INDEX + 1 && free_map_test(page_counter - 1)) {
+    take_free_page(page_counter - 1);
+    page_counter--;
+  }
+
+  if (page_counter == PAGER.root.page_counter) {
+    return false;
+  }
+
+  PAGER.root.page_counter = page_counter;
+  if (PAGER.free_low > page_counter) {
+    PAGER.free_low = page_counter;
+  }
+  cache_drop_from(page_counter);
+  return true;
+}
+
+/*
+ * A new memory database, see 'Memory Databases' above. No file is opened,
+ * the handles stay invalid.
+ */
+static bool memory_open(uint32_t memory_pages) {
+  PAGER.data_fd = OS_INVALID_HANDLE;
+  PAGER.journal_fd = OS_INVALID_HANDLE;
+
+  // A transaction can't modify more pages than the store has
+  if (!memory_store_open(&PAGER.store, memory_pages) ||
+      !memory_store_open(&PAGER.before_images, memory_pages)) {
+    pager_close();
+    return false;
+  }
+  cache_reset();
+
+  PAGER.root.page_counter = 1;
+  PAGER.root.free_page_head = ROOT_PAGE_INDEX;
+  memset(PAGER.root.slots, 0, sizeof(PAGER.root.slots));
+  write_page_to_disk(ROOT_PAGE_INDEX, &PAGER.root);
+  PAGER.committed_pages = PAGER.root.page_counter;
+
+  return true;
+}
+
+bool pager_exists(const char *filename) {
+  return strcmp(filename, PAGER_MEMORY) != 0 && os_file_exists(filename);
+}
+
+/*
+ * Open a database file.
+ *
+ *   1. Initialize arena allocator and reserve the page cache
+ *   2. Open data file (create if needed)
  *   3. Check for journal file (crash recovery)
  *   4. If journal exists, rollback incomplete transaction
- *   5. If existing database, load root page
- *   6. If new database, initialize root page
+ *   5. If a WAL exists or WAL mode is requested, index its committed frames,
+ *      in rollback mode checkpointing and deleting it
+ *   6. If existing database, load root page (through the WAL index)
+ *   7. If new database, initialize root page
+ *
+ * A memory database is always new, and opens no file, see memory_open.
  */
-bool pager_open(const char *filename) {
+bool pager_open(const char *filename, uint32_t cache_pages,
+                PAGER_JOURNAL_MODE journal_mode, uint32_t memory_pages) {
   if (strlen(filename) >= FILENAME_SIZE) {
     return false;
   }
 
+  if (cache_pages < PAGER_MIN_CACHE_PAGES) {
+    cache_pages = PAGER_MIN_CACHE_PAGES;
+  } else if (cache_pages > PAGER_MAX_CACHE_PAGES) {
+    cache_pages = PAGER_MAX_CACHE_PAGES;
+  }
+
   arena<pager_arena>::init();
+  PAGER.io = {};
+
+  PAGER.cache_meta = reinterpret_cast<cache_metadata *>(virtual_memory::reserve(
+      PAGER_MAX_CACHE_PAGES * sizeof(cache_metadata)));
+  PAGER.cache_data = reinterpret_cast<base_page *>(
+      virtual_memory::reserve((size_t)PAGER_MAX_CACHE_PAGES * PAGE_SIZE));
+  PAGER.cache_frames = 0;
+  PAGER.cache_capacity = cache_pages;
+
+  if (!PAGER.cache_meta || !PAGER.cache_data ||
+      !cache_set_frames(cache_pages)) {
+    cache_release();
+    return false;
+  }
 
   strcpy(PAGER.data_file, filename);
 
   snprintf(PAGER.journal_file, sizeof(PAGER.journal_file), JOURNAL_POSTFIX,
            filename);
+  snprintf(PAGER.wal_file, sizeof(PAGER.wal_file), WAL_POSTFIX, filename);
+
+  PAGER.journal_mode = PAGER_JOURNAL_ROLLBACK;
+  PAGER.wal_fd = OS_INVALID_HANDLE;
+
+  PAGER.memory = strcmp(filename, PAGER_MEMORY) == 0;
+  if (PAGER.memory) {
+    return memory_open(std::clamp<uint32_t>(memory_pages, 1,
+                                            PAGER_MAX_MEMORY_PAGES));
+  }
 
   bool exists = os_file_exists(filename);
   PAGER.data_fd = os_file_open(filename, true, true);
@@ -441,17 +1684,267 @@ bool pager_open(const char *filename) {
     cache_reset();
   }
 
+  if (journal_mode == PAGER_JOURNAL_WAL || os_file_exists(PAGER.wal_file)) {
+    PAGER.wal_fd = os_file_open(PAGER.wal_file, true, true);
+    if (OS_INVALID_HANDLE == PAGER.wal_fd) {
+      pager_close();
+      return false;
+    }
+
+    PAGER.journal_mode = PAGER_JOURNAL_WAL;
+    wal_recover();
+
+    if (journal_mode != PAGER_JOURNAL_WAL) {
+      pager_checkpoint();
+      os_file_close(PAGER.wal_fd);
+      os_file_delete(PAGER.wal_file);
+      PAGER.wal_fd = OS_INVALID_HANDLE;
+      PAGER.journal_mode = PAGER_JOURNAL_ROLLBACK;
+    }
+  }
+
   if (exists) {
     read_page_from_disk(ROOT_PAGE_INDEX, &PAGER.root);
   } else {
     PAGER.root.page_counter = 1;
     PAGER.root.free_page_head = ROOT_PAGE_INDEX;
+    memset(PAGER.root.slots, 0, sizeof(PAGER.root.slots));
     write_page_to_disk(ROOT_PAGE_INDEX, &PAGER.root);
   }
+  PAGER.committed_pages = PAGER.root.page_counter;
 
   return true;
 }
 
+/*
+ * Both files are only read, through the handles given, so it never moves
+ * another thread's file positions. A page past the end of the data file was
+ * never written, and reads as zeroes like a new one.
+ */
+static void read_page_through(os_file_handle_t data_fd,
+                              os_file_handle_t wal_fd, uint32_t page_index,
+                              uint32_t frame, base_page *page) {
+  if (frame != WAL_NO_FRAME) {
+    uint8_t buffer[WAL_FRAME_SIZE];
+    os_file_seek(wal_fd, (int64_t)frame * WAL_FRAME_SIZE);
+    if (os_file_read(wal_fd, buffer, WAL_FRAME_SIZE) == WAL_FRAME_SIZE) {
+      assert(reinterpret_cast<wal_frame_header *>(buffer)->page_index ==
+             page_index);
+      memcpy(page, buffer + sizeof(wal_frame_header), PAGE_SIZE);
+      return;
+    }
+  } else {
+    os_file_seek(data_fd, (int64_t)page_index * PAGE_SIZE);
+    if (os_file_read(data_fd, page, PAGE_SIZE) == PAGE_SIZE) {
+      return;
+    }
+  }
+
+  memset(page, 0, PAGE_SIZE);
+  page->index = page_index;
+}
+
+/*
+ * Registers the calling thread as a reader the first time it reads in a
+ * section, under pager_latch
+ */
+static uint32_t shared_join() {
+  if (shared_page.section != PAGER.shared_section) {
+    shared_page = {PAGER.shared_section, PAGER.shared_readers.size(),
+                   ROOT_PAGE_INDEX, nullptr};
+    PAGER.shared_readers.push({OS_INVALID_HANDLE, OS_INVALID_HANDLE, INVALID_SLOT});
+  }
+  return shared_page.reader;
+}
+
+/*
+ * Reads a missed page into a frame pinned for the reader, with the latch let
+ * go meanwhile, see 'Shared Reads' above. A memory database's pages are only
+ * copied, and so is a page read while the reader couldn't open its files.
+ */
+static uint32_t shared_load(uint32_t page_index, bool low_priority,
+                            uint32_t reader_index,
+                            std::unique_lock<std::mutex> &guard) {
+  uint32_t slot = cache_find_free_slot();
+  cache_metadata *entry = &PAGER.cache_meta[slot];
+  entry->page_index = page_index;
+  entry->is_occupied = true;
+  entry->is_dirty = false;
+  entry->pin_count = 1;
+  PAGER.page_to_cache.insert(page_index, slot);
+  cache_admit(slot, low_priority);
+  PAGER.io.cache_misses++;
+
+  shared_reader *self = &PAGER.shared_readers[reader_index];
+  if (!PAGER.memory && self->data_fd == OS_INVALID_HANDLE) {
+    self->data_fd = os_file_open(PAGER.data_file, false, false);
+    if (PAGER.journal_mode == PAGER_JOURNAL_WAL) {
+      self->wal_fd = os_file_open(PAGER.wal_file, false, false);
+    }
+  }
+
+  bool own_files = !PAGER.memory && self->data_fd != OS_INVALID_HANDLE &&
+                   (PAGER.journal_mode != PAGER_JOURNAL_WAL ||
+                    self->wal_fd != OS_INVALID_HANDLE);
+  uint64_t start = clock_us();
+  if (!own_files) {
+    read_page_from_disk(page_index, &PAGER.cache_data[slot]);
+  } else {
+    os_file_handle_t data_fd = self->data_fd, wal_fd = self->wal_fd;
+    uint32_t frame = wal_latest_frame(page_index);
+    entry->loading = true;
+
+    // The frame is pinned, and nothing else writes it while it's loading
+    guard.unlock();
+    read_page_through(data_fd, wal_fd, page_index, frame,
+                      &PAGER.cache_data[slot]);
+    guard.lock();
+
+    entry->loading = false;
+    PAGER.io.bytes_read += PAGE_SIZE;
+    shared_loaded.notify_all();
+  }
+  histogram_record(&PAGER.io.miss_latency, clock_us() - start);
+
+  return slot;
+}
+
+/*
+ * A page for a shared reader, see 'Shared Reads' above. The page it got last
+ * stays pinned for it until it gets another.
+ */
+static base_page *shared_get(uint32_t page_index, bool low_priority) {
+  if (shared_page.section == PAGER.shared_section &&
+      shared_page.page_index == page_index) {
+    return shared_page.page;
+  }
+
+  std::unique_lock<std::mutex> guard(pager_latch);
+  uint32_t reader_index = shared_join();
+
+  // The last page is let go first, so a reader never holds two frames
+  shared_reader *self = &PAGER.shared_readers[reader_index];
+  if (self->pinned_slot != INVALID_SLOT) {
+    PAGER.cache_meta[self->pinned_slot].pin_count--;
+    self->pinned_slot = INVALID_SLOT;
+  }
+
+  int32_t slot = INVALID_SLOT;
+  uint32_t *cached = PAGER.page_to_cache.get(page_index);
+  if (cached) {
+    slot = *cached;
+    PAGER.cache_meta[slot].pin_count++;
+    cache_touch(slot, low_priority);
+    PAGER.io.cache_hits++;
+    shared_loaded.wait(guard,
+                       [slot] { return !PAGER.cache_meta[slot].loading; });
+  } else if (map_contains(page_index)) {
+    PAGER.io.map_hits++;
+  } else {
+    slot = shared_load(page_index, low_priority, reader_index, guard);
+  }
+
+  // Found again through the index, the array may have grown meanwhile
+  PAGER.shared_readers[reader_index].pinned_slot = slot;
+
+  base_page *page =
+      slot == INVALID_SLOT ? map_page(page_index) : &PAGER.cache_data[slot];
+  shared_page.page_index = page_index;
+  shared_page.page = page;
+  return page;
+}
+
+/*
+ * The frame holding the snapshot's version of a page, under wal_latch
+ */
+static uint32_t snapshot_frame_of(uint32_t page_index) {
+  uint32_t *latest = PAGER.wal_index.get(page_index);
+  uint32_t frame = latest ? *latest : WAL_NO_FRAME;
+  while (frame != WAL_NO_FRAME && frame >= reader.frames) {
+    frame = PAGER.wal_history[frame];
+  }
+  return frame;
+}
+
+/*
+ * A slot for another page in the reader's cache. Up to SNAPSHOT_CACHE_PAGES
+ * they're added, then the clock hand passes over the slots, taking the first
+ * that's unpinned and hasn't been got since it last passed. If every slot is
+ * pinned the cache grows.
+ */
+static uint32_t snapshot_take_slot() {
+  uint32_t count = reader.slots.size();
+
+  if (count >= SNAPSHOT_CACHE_PAGES) {
+    for (uint32_t i = 0; i < 2 * count; i++) {
+      uint32_t slot = reader.clock_hand;
+      reader.clock_hand = (slot + 1) % count;
+
+      snapshot_frame *entry = &reader.slots[slot];
+      if (entry->pin_count > 0) {
+        continue;
+      }
+      if (entry->referenced) {
+        entry->referenced = false;
+        continue;
+      }
+
+      if (entry->is_occupied) {
+        reader.page_to_slot.remove(entry->page_index);
+      }
+      return slot;
+    }
+  }
+
+  reader.pages.push((base_page *)arena<snapshot_arena>::alloc(PAGE_SIZE));
+  reader.slots.push({});
+  return count;
+}
+
+/*
+ * A page as the snapshot sees it. One got earlier in the same snapshot is
+ * returned as is, one from an earlier snapshot if it's still the current
+ * version, otherwise the version is read into a slot.
+ */
+static base_page *snapshot_get(uint32_t page_index) {
+  assert(page_index < reader.page_counter && page_index != ROOT_PAGE_INDEX &&
+         "Page requested is invalid");
+
+  uint32_t *cached = reader.page_to_slot.get(page_index);
+  if (cached && reader.slots[*cached].checked == reader.id) {
+    reader.slots[*cached].referenced = true;
+    return reader.pages[*cached];
+  }
+
+  uint32_t frame;
+  {
+    std::lock_guard<std::mutex> guard(wal_latch);
+    frame = snapshot_frame_of(page_index);
+  }
+
+  uint32_t slot;
+  if (cached) {
+    slot = *cached;
+  } else {
+    slot = snapshot_take_slot();
+    reader.page_to_slot.insert(page_index, slot);
+  }
+
+  snapshot_frame *entry = &reader.slots[slot];
+  if (!cached || entry->frame != frame) {
+    read_page_through(reader.data_fd, reader.wal_fd, page_index, frame,
+                      reader.pages[slot]);
+    entry->page_index = page_index;
+    entry->frame = frame;
+    entry->pin_count = 0;
+    entry->is_occupied = true;
+  }
+
+  entry->checked = reader.id;
+  entry->referenced = true;
+  return reader.pages[slot];
+}
+
 /*
  * Get a page for reading/writing.
  *
@@ -460,10 +1953,188 @@ bool pager_open(const char *filename) {
  *   3. Load page into cache and return pointer to cache memory
  */
 base_page *pager_get(uint32_t page_index) {
+  if (reader.open) {
+    return snapshot_get(page_index);
+  }
+
+  assert(page_index < PAGER.root.page_counter &&
+         page_index != ROOT_PAGE_INDEX && "Page requested is invalid");
+
+  if (PAGER.shared) {
+    return shared_get(page_index, false);
+  }
+  return page_get(page_index);
+}
+
+/*
+ * Get a page for a sequential scan, which is unlikely to need it again soon.
+ * See 'Replacement' above, the page is cached at low priority, and a hit
+ * doesn't raise it.
+ */
+base_page *pager_get_sequential(uint32_t page_index) {
+  if (reader.open) {
+    return snapshot_get(page_index);
+  }
+
+  assert(page_index < PAGER.root.page_counter &&
+         page_index != ROOT_PAGE_INDEX && "Page requested is invalid");
+
+  if (PAGER.shared) {
+    return shared_get(page_index, true);
+  }
+  return page_get(page_index, true);
+}
+
+/*
+ * Switch replacement policy. Resident pages are kept, and requeued as hot.
+ */
+void pager_set_cache_policy(PAGER_CACHE_POLICY policy) {
+  PAGER.cache_policy = policy;
+  queues_clear();
+
+  for (uint32_t i = 0; i < PAGER.cache_frames; i++) {
+    if (PAGER.cache_meta[i].is_occupied) {
+      queue_push_head(i, CACHE_QUEUE_HOT);
+    }
+  }
+}
+
+/*
+ * Get a page and pin it in the cache.
+ *
+ * The returned pointer stays valid through any other pager call until the
+ * matching pager_unpin. Pins nest, a page pinned twice needs two unpins.
+ * Mapped pages never move, so pinning them is a no-op.
+ */
+base_page *pager_pin(uint32_t page_index) {
+  if (reader.open) {
+    base_page *page = snapshot_get(page_index);
+    reader.slots[*reader.page_to_slot.get(page_index)].pin_count++;
+    return page;
+  }
+
   assert(page_index < PAGER.root.page_counter &&
          page_index != ROOT_PAGE_INDEX && "Page requested is invalid");
 
-  return cache_get_or_load(page_index);
+  // The reader's pin on the page it got last keeps it there meanwhile
+  if (PAGER.shared) {
+    base_page *page = shared_get(page_index, false);
+    std::lock_guard<std::mutex> guard(pager_latch);
+    uint32_t *slot = PAGER.page_to_cache.get(page_index);
+    if (slot) {
+      PAGER.cache_meta[*slot].pin_count++;
+    }
+    return page;
+  }
+
+  if (!PAGER.page_to_cache.contains(page_index) && map_contains(page_index)) {
+    return map_page(page_index);
+  }
+
+  uint32_t slot = cache_load_slot(page_index, false);
+  PAGER.cache_meta[slot].pin_count++;
+
+  return &PAGER.cache_data[slot];
+}
+
+void pager_unpin(uint32_t page_index) {
+  if (reader.open) {
+    uint32_t *slot = reader.page_to_slot.get(page_index);
+    assert(slot && reader.slots[*slot].pin_count > 0 &&
+           "Unpinning a page that isn't pinned");
+    reader.slots[*slot].pin_count--;
+    return;
+  }
+
+  std::unique_lock<std::mutex> guard(pager_latch, std::defer_lock);
+  if (PAGER.shared) {
+    guard.lock();
+  }
+
+  uint32_t *slot_ptr = PAGER.page_to_cache.get(page_index);
+  if (!slot_ptr && map_contains(page_index)) {
+    return;
+  }
+
+  assert(slot_ptr && PAGER.cache_meta[*slot_ptr].pin_count > 0 &&
+         "Unpinning a page that isn't pinned");
+
+  PAGER.cache_meta[*slot_ptr].pin_count--;
+}
+
+/*
+ * Hint that a page will be needed soon.
+ *
+ * Cached pages are skipped, the rest are handed to the OS to start reading in
+ * the background, from the WAL if that's where the latest version is. Nothing
+ * is loaded into the cache, so a wrong guess costs no frames.
+ */
+void pager_prefetch(uint32_t page_index) {
+  if (reader.open || PAGER.memory) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> guard(pager_latch, std::defer_lock);
+  if (PAGER.shared) {
+    guard.lock();
+  }
+
+  if (page_index == ROOT_PAGE_INDEX || page_index >= PAGER.root.page_counter ||
+      PAGER.page_to_cache.contains(page_index)) {
+    return;
+  }
+
+  if (PAGER.journal_mode == PAGER_JOURNAL_WAL) {
+    uint32_t *frame = PAGER.wal_pending.get(page_index);
+    if (!frame) {
+      frame = PAGER.wal_index.get(page_index);
+    }
+    if (frame) {
+      os_file_prefetch(PAGER.wal_fd, (int64_t)*frame * WAL_FRAME_SIZE,
+                       WAL_FRAME_SIZE);
+      return;
+    }
+  }
+
+  os_file_prefetch(PAGER.data_fd, (int64_t)page_index * PAGE_SIZE, PAGE_SIZE);
+}
+
+/*
+ * Mark a page that was just allocated as new, and give it a zeroed frame
+ */
+static void page_init_new(uint32_t page_index) {
+  PAGER.journaled_or_new_pages.insert(page_index, 1);
+
+  /*
+   * A page reclaimed from the free list was just loaded to read its link, so
+   * reuse that slot (or its mapping) rather than having the page in two places
+   */
+  uint32_t *cached_slot = PAGER.page_to_cache.get(page_index);
+  if (!cached_slot && map_contains(page_index)) {
+    base_page *page = map_page(page_index);
+    memset(page, 0, PAGE_SIZE);
+    page->index = page_index;
+    PAGER.map_dirty.insert(page_index, 1);
+    return;
+  }
+
+  uint32_t slot = cached_slot ? *cached_slot : cache_find_free_slot();
+  cache_metadata *entry = &PAGER.cache_meta[slot];
+
+  memset(&PAGER.cache_data[slot], 0, PAGE_SIZE);
+  PAGER.cache_data[slot].index = page_index;
+
+  entry->page_index = page_index;
+  entry->is_dirty = true;
+
+  if (cached_slot) {
+    cache_touch(slot, false);
+  } else {
+    entry->is_occupied = true;
+    entry->pin_count = 0;
+    PAGER.page_to_cache.insert(page_index, slot);
+    cache_admit(slot, false);
+  }
 }
 
 /*
@@ -476,31 +2147,45 @@ base_page *pager_get(uint32_t page_index) {
  *   5. Find cache slot and initialize page data
  *   6. Ensure it's in the journaled_or_new set
  */
-uint32_t pager_new() {
+uint32_t pager_new(uint32_t near_page) {
   assert(PAGER.in_transaction && "Must be in a transaction to allocate a page");
 
-  uint32_t page_index = take_page_from_free_list();
+  uint32_t page_index = take_page_from_free_list(near_page);
 
   if (page_index == ROOT_PAGE_INDEX) {
     page_index = PAGER.root.page_counter++;
   }
 
-  PAGER.journaled_or_new_pages.insert(page_index, 1);
-
-  uint32_t slot = cache_find_free_slot();
-  cache_metadata *entry = &PAGER.cache_meta[slot];
+  page_init_new(page_index);
+  return page_index;
+}
 
-  memset(&PAGER.cache_data[slot], 0, PAGE_SIZE);
-  PAGER.cache_data[slot].index = page_index;
+/*
+ * Allocate count pages with consecutive indexes, returning the first.
+ *
+ *   1. Verify transaction is active
+ *   2. Prefer a free extent starting right after near_page, so a chain
+ *      that's being extended carries on in place
+ *   3. Otherwise the lowest free extent long enough
+ *   4. Otherwise the end of the file, starting from any free pages already
+ *      at the end
+ *   5. Initialize each as pager_new does
+ */
+uint32_t pager_new_extent(uint32_t count, uint32_t near_page) {
+  assert(PAGER.in_transaction && "Must be in a transaction to allocate a page");
+  assert(count > 0);
 
-  entry->page_index = page_index;
-  entry->is_occupied = true;
-  entry->is_dirty = true;
+  uint32_t first = take_extent_from_free_list(count, near_page);
 
-  PAGER.page_to_cache.insert(page_index, slot);
-  lru_add_to_head(slot);
+  if (first == ROOT_PAGE_INDEX) {
+    first = PAGER.root.page_counter;
+    PAGER.root.page_counter += count;
+  }
 
-  return page_index;
+  for (uint32_t i = 0; i < count; i++) {
+    page_init_new(first + i);
+  }
+  return first;
 }
 
 /*
@@ -511,9 +2196,10 @@ uint32_t pager_new() {
  * is journaled.
  *
  *   1. Validate page index and transaction state
- *   2. If page not yet journaled, write to journal
+ *   2. If page not yet journaled, write to journal (WAL mode has nothing to
+ *      save, the original stays where it is)
  *   3. Mark in journaled_or_new_pages set
- *   4. If cached, set dirty flag
+ *   4. If cached, set dirty flag, otherwise it's mapped, note it in map_dirty
  */
 bool pager_ensure_journaled(uint32_t page_index) {
   assert(page_index < PAGER.root.page_counter &&
@@ -522,57 +2208,206 @@ bool pager_ensure_journaled(uint32_t page_index) {
 
   assert(PAGER.in_transaction && "Must be in a transaction to journal a page");
 
-  if (!PAGER.journaled_or_new_pages.contains(page_index)) {
-    journal_write_page(page_index, cache_get_or_load(page_index));
+  base_page *page = page_get(page_index);
+  if (PAGER.journal_mode != PAGER_JOURNAL_WAL &&
+      !PAGER.journaled_or_new_pages.contains(page_index)) {
+    journal_write_page(page_index, page);
   }
 
   uint32_t *slot_ptr = PAGER.page_to_cache.get(page_index);
   if (slot_ptr) {
     PAGER.cache_meta[*slot_ptr].is_dirty = true;
+  } else {
+    PAGER.map_dirty.insert(page_index, 1);
+  }
+
+  return true;
+}
+
+/*
+ * Delete a page.
+ *
+ *   1. Validate page can be deleted (not root, valid index)
+ *   2. Verify transaction is active
+ *   3. Add page to free list
+ */
+bool pager_delete(uint32_t page_index) {
+  assert(page_index < PAGER.root.page_counter &&
+         page_index != ROOT_PAGE_INDEX && "Requesting delete of invalid page");
+  assert(PAGER.in_transaction && "Must be in a transaction to delete a page");
+
+  add_page_to_free_list(page_index);
+
+  return true;
+}
+
+/*
+ * Move a page down into the lowest free page, for compaction. Returns the
+ * page's new index, or page_index if there's no free page below it. The old
+ * page is freed, and the caller must update everything that refers to it.
+ *
+ *   1. Find the lowest free page, stop if it's above page_index
+ *   2. Unlink it from the free list, it's journaled in the process
+ *   3. Copy the page there, with its new index
+ *   4. Free the old page
+ */
+uint32_t pager_relocate(uint32_t page_index) {
+  assert(page_index < PAGER.root.page_counter &&
+         page_index != ROOT_PAGE_INDEX && "Requesting relocation of invalid page");
+  assert(PAGER.in_transaction && "Must be in a transaction to relocate a page");
+
+  free_map_load();
+  uint32_t target = free_map_lowest(page_index);
+  if (target == ROOT_PAGE_INDEX) {
+    return page_index;
+  }
+
+  base_page *from = pager_pin(page_index);
+  take_free_page(target);
+
+  pager_ensure_journaled(target);
+  base_page *to = page_get(target);
+  memcpy(to, from, PAGE_SIZE);
+  to->index = target;
+  pager_unpin(page_index);
+
+  add_page_to_free_list(page_index);
+
+  return target;
+}
+
+/*
+ * Begin a transaction.
+ *
+ *   1. Check not already in transaction (an open group counts as one, the
+ *      next transaction continues its journal)
+ *   2. Create journal file (WAL mode instead notes the log length and root,
+ *      a memory database just the root)
+ *   3. Write root page to journal
+ *   4. Set transaction flag
+ */
+bool pager_begin_transaction() {
+  // A snapshot only reads
+  if (reader.open) {
+    return false;
+  }
+
+  if (PAGER.in_transaction) {
+    PAGER.group.idle = false;
+    return true;
+  }
+
+  if (PAGER.journal_mode == PAGER_JOURNAL_WAL) {
+    PAGER.in_transaction = true;
+    PAGER.wal_tx_start = PAGER.wal_frames;
+    io_start_transaction();
+    memcpy(&PAGER.tx_root, &PAGER.root, PAGE_SIZE);
+    return true;
+  }
+
+  if (PAGER.memory) {
+    PAGER.in_transaction = true;
+    io_start_transaction();
+    memcpy(&PAGER.tx_root, &PAGER.root, PAGE_SIZE);
+    return true;
+  }
+
+  PAGER.journal_fd = os_file_open(PAGER.journal_file, true, true);
+
+  if (OS_INVALID_HANDLE == PAGER.journal_fd) {
+    return false;
   }
 
+  PAGER.in_transaction = true;
+  PAGER.journal_size = PAGE_SIZE;
+  io_start_transaction();
+
+  journal_write_page(ROOT_PAGE_INDEX, &PAGER.root);
+
   return true;
 }
 
 /*
- * Delete a page.
+ * Commit a WAL mode transaction.
  *
- *   1. Validate page can be deleted (not root, valid index)
- *   2. Verify transaction is active
- *   3. Add page to free list
+ *   1. Drop free pages at the end of the file, the checkpoint truncates it
+ *   2. Append all dirty cached and mapped pages to the log
+ *   3. Append the root page, marking the commit
+ *   4. Sync the log (atomic commit point)
+ *   5. Merge the transaction's frames into the WAL index, for snapshots too
+ *   6. Checkpoint once the log has grown past WAL_AUTOCHECKPOINT_FRAMES
  */
-bool pager_delete(uint32_t page_index) {
-  assert(page_index < PAGER.root.page_counter &&
-         page_index != ROOT_PAGE_INDEX && "Requesting delete of invalid page");
-  assert(PAGER.in_transaction && "Must be in a transaction to delete a page");
+static bool wal_commit() {
+  free_truncate_tail();
 
-  add_page_to_free_list(page_index);
+  for (auto [page_index, _] : PAGER.map_dirty) {
+    wal_append(page_index, map_page(page_index));
+  }
+
+  for (uint32_t slot = 0; slot < PAGER.cache_frames; slot++) {
+    cache_metadata *entry = &PAGER.cache_meta[slot];
+    if (entry->is_occupied && entry->is_dirty) {
+      wal_append(entry->page_index, &PAGER.cache_data[slot]);
+      entry->is_dirty = false;
+    }
+  }
+
+  wal_append(ROOT_PAGE_INDEX, &PAGER.root);
+  io_sync(PAGER.wal_fd);
+
+  wal_index_pending();
+  map_reset_dirty();
+
+  PAGER.in_transaction = false;
+  PAGER.journaled_or_new_pages.clear();
+  io_end_transaction();
+
+  cache_shrink();
+
+  if (PAGER.wal_frames >= WAL_AUTOCHECKPOINT_FRAMES) {
+    pager_checkpoint();
+  }
 
   return true;
 }
 
+static bool memory_rollback();
+
 /*
- * Begin a transaction.
+ * Commit a memory database transaction.
  *
- *   1. Check not already in transaction
- *   2. Create journal file
- *   3. Write root page to journal
- *   4. Set transaction flag
+ *   1. Drop free pages at the end of the store
+ *   2. Write all dirty cached pages and the root to the store, and cut it
+ *      back if it shrank
+ *   3. Forget the before-images
+ *
+ * If a page of the transaction couldn't be saved, now or when it was evicted
+ * or first modified, it's rolled back instead and the commit fails.
  */
-bool pager_begin_transaction() {
-  if (PAGER.in_transaction) {
-    return true;
+static bool memory_commit() {
+  free_truncate_tail();
+
+  for (uint32_t slot = 0; slot < PAGER.cache_frames && !PAGER.store_failed;
+       slot++) {
+    cache_metadata *entry = &PAGER.cache_meta[slot];
+    if (entry->is_occupied && entry->is_dirty) {
+      write_page_to_disk(entry->page_index, &PAGER.cache_data[slot]);
+      entry->is_dirty = false;
+    }
   }
 
-  PAGER.journal_fd = os_file_open(PAGER.journal_file, true, true);
-
-  if (OS_INVALID_HANDLE == PAGER.journal_fd) {
+  if (PAGER.store_failed || !write_page_to_disk(ROOT_PAGE_INDEX, &PAGER.root)) {
+    memory_rollback();
     return false;
   }
+  memory_store_truncate(&PAGER.store, PAGER.root.page_counter);
+  memory_store_truncate(&PAGER.before_images, 0);
 
-  PAGER.in_transaction = true;
+  PAGER.in_transaction = false;
+  PAGER.journaled_or_new_pages.clear();
+  io_end_transaction();
 
-  journal_write_page(ROOT_PAGE_INDEX, &PAGER.root);
+  cache_shrink();
 
   return true;
 }
@@ -580,34 +2415,166 @@ bool pager_begin_transaction() {
 /*
  * Commit a transaction.
  *
- *   1. Write all dirty cached pages to disk
- *   2. Write root page with updated metadata
- *   3. Sync data file
- *   4. Delete journal (atomic commit point)
- *   5. Clear transaction state
+ *   1. Drop free pages at the end of the file
+ *   2. Write all dirty cached and mapped pages to disk (syncing the journal
+ *      first)
+ *   3. Write root page with updated metadata
+ *   4. Sync data file, truncate it if it shrank
+ *   5. Delete journal (atomic commit point)
+ *   6. Clear transaction state, including any open group
+ *   7. Reset modified mapped pages, shrink the cache back to its watermark
  */
 bool pager_commit() {
   if (!PAGER.in_transaction) {
     return true;
   }
 
-  for (int32_t i = 0; i < MAX_CACHE_ENTRIES; i++) {
-    if (PAGER.cache_meta[i].is_occupied && PAGER.cache_meta[i].is_dirty) {
-      write_page_to_disk(PAGER.cache_meta[i].page_index, &PAGER.cache_data[i]);
-      PAGER.cache_meta[i].is_dirty = false;
+  if (PAGER.journal_mode == PAGER_JOURNAL_WAL) {
+    return wal_commit();
+  }
+
+  if (PAGER.memory) {
+    return memory_commit();
+  }
+
+  bool shrunk = free_truncate_tail();
+
+  for (auto [page_index, _] : PAGER.map_dirty) {
+    write_page_to_disk(page_index, map_page(page_index));
+  }
+
+  for (uint32_t slot = 0; slot < PAGER.cache_frames; slot++) {
+    cache_metadata *entry = &PAGER.cache_meta[slot];
+    if (entry->is_occupied && entry->is_dirty) {
+      write_page_to_disk(entry->page_index, &PAGER.cache_data[slot]);
+      entry->is_dirty = false;
     }
   }
 
   write_page_to_disk(ROOT_PAGE_INDEX, &PAGER.root);
-  os_file_sync(PAGER.data_fd);
+  io_sync(PAGER.data_fd);
+
+  if (shrunk) {
+    os_file_truncate(PAGER.data_fd, PAGER.root.page_counter * PAGE_SIZE);
+  }
 
   os_file_close(PAGER.journal_fd);
   os_file_delete(PAGER.journal_file);
 
   PAGER.journal_fd = OS_INVALID_HANDLE;
   PAGER.in_transaction = false;
+  PAGER.group.open = false;
+  PAGER.group.idle = false;
+  io_end_transaction();
+
+  PAGER.journaled_or_new_pages.clear();
+  map_reset_dirty();
+  map_refresh();
+
+  cache_shrink();
+
+  return true;
+}
+
+/*
+ * Return an open group to its latest soft commit.
+ *
+ * Everything up to the savepoint must survive, and unlike a full rollback the
+ * cache may hold dirty pages from those soft commits, so pages are restored
+ * into the cache where they're resident rather than resetting it.
+ *
+ *   1. Restore each page journaled since the savepoint
+ *   2. Restore the root as of the savepoint
+ *   3. Drop cached pages allocated since the savepoint
+ *   4. Cut the journal back to the savepoint
+ */
+static void group_rollback_to_savepoint() {
+  for (int64_t offset = PAGER.group.savepoint; offset < PAGER.journal_size;
+       offset += PAGE_SIZE) {
+    uint8_t page_buffer[PAGE_SIZE];
+    os_file_seek(PAGER.journal_fd, offset);
+    if (io_read(PAGER.journal_fd, page_buffer, PAGE_SIZE) != PAGE_SIZE) {
+      break;
+    }
+
+    uint32_t page_index = reinterpret_cast<base_page *>(page_buffer)->index;
+    uint32_t *slot_ptr = PAGER.page_to_cache.get(page_index);
+    if (slot_ptr) {
+      memcpy(&PAGER.cache_data[*slot_ptr], page_buffer, PAGE_SIZE);
+      PAGER.cache_meta[*slot_ptr].is_dirty = true;
+    } else if (map_contains(page_index)) {
+      memcpy(map_page(page_index), page_buffer, PAGE_SIZE);
+      PAGER.map_dirty.insert(page_index, 1);
+    } else {
+      write_page_to_disk(page_index, page_buffer);
+    }
+  }
+
+  memcpy(&PAGER.root, &PAGER.group.root, PAGE_SIZE);
+
+  cache_drop_from(PAGER.root.page_counter);
+  free_map_invalidate();
+
+  if (os_file_size(PAGER.data_fd) > PAGER.root.page_counter * PAGE_SIZE) {
+    os_file_truncate(PAGER.data_fd, PAGER.root.page_counter * PAGE_SIZE);
+  }
 
+  os_file_truncate(PAGER.journal_fd, PAGER.group.savepoint);
+  PAGER.journal_size = PAGER.group.savepoint;
+  PAGER.group.idle = true;
   PAGER.journaled_or_new_pages.clear();
+}
+
+/*
+ * Rollback a WAL mode transaction.
+ *
+ * The data file and committed frames were never touched, so the frames
+ * appended since begin are cut off, and the cache (which may hold dirty
+ * pages) is reset.
+ */
+static bool wal_rollback() {
+  os_file_truncate(PAGER.wal_fd, (int64_t)PAGER.wal_tx_start * WAL_FRAME_SIZE);
+  PAGER.wal_frames = PAGER.wal_tx_start;
+  PAGER.wal_pending.clear();
+  map_reset_dirty();
+
+  memcpy(&PAGER.root, &PAGER.tx_root, PAGE_SIZE);
+
+  cache_reset();
+
+  PAGER.in_transaction = false;
+  io_end_transaction();
+
+  return true;
+}
+
+/*
+ * Rollback a memory database transaction.
+ *
+ * Each page the transaction modified has its before-image put back in the
+ * store, where a dirty eviction may have overwritten it, the root is
+ * restored, and pages allocated past its end are cut off. The cache, which
+ * may hold dirty pages, is reset.
+ */
+static bool memory_rollback() {
+  uint8_t page_buffer[PAGE_SIZE];
+  for (uint32_t i = 0; i < PAGER.before_images.pages; i++) {
+    memory_store_read(&PAGER.before_images, i, page_buffer);
+    memory_store_write(&PAGER.store,
+                       reinterpret_cast<base_page *>(page_buffer)->index,
+                       page_buffer);
+  }
+
+  memcpy(&PAGER.root, &PAGER.tx_root, PAGE_SIZE);
+  memory_store_truncate(&PAGER.store, PAGER.root.page_counter);
+  memory_store_truncate(&PAGER.before_images, 0);
+
+  arena<pager_arena>::reset_and_decommit();
+  cache_reset();
+
+  PAGER.store_failed = false;
+  PAGER.in_transaction = false;
+  io_end_transaction();
 
   return true;
 }
@@ -616,35 +2583,54 @@ bool pager_commit() {
  * Rollback a transaction.
  *
  * NOTE:
- * The root page always goes at offset 0 in the journal, other pages can simply
- * be read sequentially as they contain their own index in the data file
+ * The root page always goes at offset 0 in the journal, other pages contain
+ * their own index in the data file. They're replayed from the end, so if
+ * group commit journaled a page more than once its original is written last.
+ *
+ * Inside a group only the transaction since the latest soft commit is undone,
+ * see group_rollback_to_savepoint.
  *
  *   1. Read root page from journal
  *   2. Restore root to disk
  *   3. Read each journaled page and restore to original location
  *   4. Truncate file to remove any newly allocated pages
  *   5. Delete journal
- *   6. Reset cache
+ *   6. Reset modified mapped pages and the cache, shrinking it to its
+ *      watermark
  */
 bool pager_rollback() {
   if (!PAGER.in_transaction) {
     return true;
   }
 
+  if (PAGER.journal_mode == PAGER_JOURNAL_WAL) {
+    return wal_rollback();
+  }
+
+  if (PAGER.memory) {
+    return memory_rollback();
+  }
+
+  if (PAGER.group.open) {
+    group_rollback_to_savepoint();
+    return true;
+  }
+
   int64_t journal_size = os_file_size(PAGER.journal_fd);
 
   if (journal_size >= PAGE_SIZE) {
     os_file_seek(PAGER.journal_fd, 0);
-    if (os_file_read(PAGER.journal_fd, &PAGER.root, PAGE_SIZE) == PAGE_SIZE) {
+    if (io_read(PAGER.journal_fd, &PAGER.root, PAGE_SIZE) == PAGE_SIZE) {
       write_page_to_disk(ROOT_PAGE_INDEX, &PAGER.root);
     }
 
-    for (int64_t offset = PAGE_SIZE; offset < journal_size;
-         offset += PAGE_SIZE) {
+    int64_t last_page = journal_size - (journal_size % PAGE_SIZE) - PAGE_SIZE;
+    for (int64_t offset = last_page; offset >= PAGE_SIZE;
+         offset -= PAGE_SIZE) {
       uint8_t page_buffer[PAGE_SIZE];
       os_file_seek(PAGER.journal_fd, offset);
-      if (os_file_read(PAGER.journal_fd, page_buffer, PAGE_SIZE) != PAGE_SIZE) {
-        break;
+      if (io_read(PAGER.journal_fd, page_buffer, PAGE_SIZE) != PAGE_SIZE) {
+        continue;
       }
 
       base_page *page_ptr = reinterpret_cast<base_page *>(page_buffer);
@@ -659,14 +2645,51 @@ bool pager_rollback() {
   os_file_delete(PAGER.journal_file);
   PAGER.journal_fd = OS_INVALID_HANDLE;
 
+  map_reset_dirty();
+  map_refresh();
+
   arena<pager_arena>::reset_and_decommit();
   cache_reset();
 
   PAGER.in_transaction = false;
+  io_end_transaction();
 
   return true;
 }
 
+/*
+ * An open group between transactions doesn't count, its soft commits are
+ * committed as far as the caller is concerned
+ */
+bool pager_in_transaction() {
+  return !reader.open && PAGER.in_transaction && !PAGER.group.idle;
+}
+
+/*
+ * A name beside the database for a scratch file, e.g. a sort's spilled runs,
+ * unique for the process. The pager never opens it, so it isn't journaled,
+ * the caller deletes it when it's done. A memory database's go in the working
+ * directory.
+ */
+void pager_temp_file_name(char *name, size_t size) {
+  static std::atomic<uint32_t> next_temp = 0;
+  snprintf(name, size, TEMP_POSTFIX, PAGER.memory ? "memory" : PAGER.data_file,
+           next_temp++);
+}
+
+/*
+ * Slots are part of the root, so the journal or the log covers them like the
+ * free list head
+ */
+uint32_t pager_get_root_slot(PAGER_ROOT_SLOT slot) {
+  return PAGER.root.slots[slot];
+}
+
+void pager_set_root_slot(PAGER_ROOT_SLOT slot, uint32_t value) {
+  assert(PAGER.in_transaction && "Root slots change inside a transaction");
+  PAGER.root.slots[slot] = value;
+}
+
 /*
  * Returns the next page that will be allocated
  */
@@ -675,32 +2698,367 @@ uint32_t pager_get_next() {
   return free_page != ROOT_PAGE_INDEX ? free_page : PAGER.root.page_counter;
 }
 
+/*
+ * Commit an implicit transaction, possibly as part of a group.
+ *
+ * With group commit disabled this is pager_commit. Otherwise the transaction
+ * is left open as a soft commit (a savepoint for the next rollback), and only
+ * once the group has been open for window_ms, or the journal holds max_pages,
+ * does the whole group get a durable commit.
+ *
+ * Nothing runs in the background, so a caller about to wait (for input, or
+ * until pager_group_commit_due) calls pager_flush_group, otherwise a soft
+ * commit would only become durable at the next commit past the window, an
+ * explicit pager_commit, or pager_close.
+ *
+ * WAL mode commits are already a single append and sync, so they aren't
+ * grouped.
+ */
+bool pager_commit_grouped() {
+  if (!PAGER.in_transaction) {
+    return true;
+  }
+
+  if (PAGER.group.window_ms == 0 || PAGER.journal_mode == PAGER_JOURNAL_WAL ||
+      PAGER.memory) {
+    return pager_commit();
+  }
+
+  uint64_t now = clock_us() / 1000;
+
+  if (!PAGER.group.open) {
+    PAGER.group.open = true;
+    PAGER.group.started_ms = now;
+  }
+
+  bool window_elapsed = now - PAGER.group.started_ms >= PAGER.group.window_ms;
+  bool journal_full =
+      PAGER.group.max_pages != 0 &&
+      PAGER.journal_size / PAGE_SIZE >= (int64_t)PAGER.group.max_pages;
+
+  if (window_elapsed || journal_full) {
+    return pager_commit();
+  }
+
+  /*
+   * Pages modified after this point are journaled again with their current
+   * content, which is what a rollback to this savepoint restores
+   */
+  PAGER.group.savepoint = PAGER.journal_size;
+  memcpy(&PAGER.group.root, &PAGER.root, PAGE_SIZE);
+  PAGER.journaled_or_new_pages.clear();
+  PAGER.group.idle = true;
+
+  return true;
+}
+
+void pager_set_group_commit(uint32_t window_ms, uint32_t max_pages) {
+  PAGER.group.window_ms = window_ms;
+  PAGER.group.max_pages = max_pages;
+}
+
+/*
+ * Only a group between transactions, one running in it is made durable by
+ * its own commit
+ */
+int32_t pager_group_commit_due() {
+  if (!PAGER.group.open || !PAGER.group.idle) {
+    return -1;
+  }
+
+  uint64_t open_ms = clock_us() / 1000 - PAGER.group.started_ms;
+  return open_ms >= PAGER.group.window_ms
+             ? 0
+             : (int32_t)(PAGER.group.window_ms - open_ms);
+}
+
+bool pager_flush_group() {
+  if (!PAGER.group.open || !PAGER.group.idle) {
+    return true;
+  }
+  return pager_commit();
+}
+
+/*
+ * Copy the latest committed frame of every page back into the data file.
+ *
+ *   1. Write each page in the WAL index to its place in the data file
+ *   2. Sync data file, cut it back to the committed page count
+ *   3. Empty the log and the index
+ *
+ * A crash part way through leaves the log intact, and checkpointing it again
+ * on recovery writes the same pages. Can't run inside a transaction, as the
+ * log holds its uncommitted frames, nor while a snapshot is open, as it may
+ * be reading the pages overwritten. New snapshots wait for it to finish.
+ */
+bool pager_checkpoint() {
+  if (PAGER.journal_mode != PAGER_JOURNAL_WAL) {
+    return true;
+  }
+
+  if (PAGER.in_transaction) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> guard(wal_latch);
+  if (PAGER.snapshots > 0) {
+    return false;
+  }
+
+  if (PAGER.wal_frames == 0) {
+    return true;
+  }
+
+  for (auto [page_index, frame] : PAGER.wal_index) {
+    uint8_t page_buffer[PAGE_SIZE];
+    uint32_t frame_page;
+    if (!wal_read_frame(frame, &frame_page, page_buffer)) {
+      return false;
+    }
+    write_page_to_disk(page_index, page_buffer);
+  }
+  io_sync(PAGER.data_fd);
+
+  if (os_file_size(PAGER.data_fd) > PAGER.root.page_counter * PAGE_SIZE) {
+    os_file_truncate(PAGER.data_fd, PAGER.root.page_counter * PAGE_SIZE);
+  }
+
+  os_file_truncate(PAGER.wal_fd, 0);
+  PAGER.wal_frames = 0;
+  PAGER.wal_index.clear();
+  PAGER.wal_history.clear();
+  PAGER.committed_frames = 0;
+  PAGER.checkpoints++;
+  map_refresh();
+
+  return true;
+}
+
+/*
+ * Serve pages from a mapping of up to 'bytes' of the data file, or stop
+ * mapping with 0. Pages past the mapped size are still read into the cache.
+ * Returns false where mapping isn't supported, for a memory database, or
+ * inside a transaction.
+ */
+bool pager_set_mmap_size(size_t bytes) {
+  if (PAGER.in_transaction || (PAGER.memory && bytes != 0)) {
+    return false;
+  }
+
+  os_file_unmap(PAGER.map, PAGER.map_size);
+  PAGER.map = nullptr;
+  PAGER.map_size = 0;
+  PAGER.map_pages = 0;
+
+  if (bytes == 0) {
+    return true;
+  }
+
+  size_t size = virtual_memory::round_to_pages(bytes);
+  PAGER.map = reinterpret_cast<uint8_t *>(os_file_map(PAGER.data_fd, size));
+  if (!PAGER.map) {
+    return false;
+  }
+
+  PAGER.map_size = size;
+  map_refresh();
+
+  /* Cached pages stay where they are, only misses are mapped from now on */
+  return true;
+}
+
+/*
+ * A pending group is made durable, discarding anything after its latest soft
+ * commit, which belongs to a transaction that never committed.
+ *
+ * In WAL mode the log is checkpointed and deleted, unless a transaction is
+ * still open, in which case it's left for recovery to discard. A memory
+ * database is released.
+ */
 void pager_close() {
+  assert(PAGER.snapshots == 0 && "Snapshots must end before the pager closes");
+
+  if (PAGER.in_transaction && PAGER.group.open) {
+    group_rollback_to_savepoint();
+    pager_commit();
+  }
+
+  if (PAGER.wal_fd != OS_INVALID_HANDLE) {
+    bool checkpointed = !PAGER.in_transaction && pager_checkpoint();
+    os_file_close(PAGER.wal_fd);
+    if (checkpointed) {
+      os_file_delete(PAGER.wal_file);
+    }
+    PAGER.wal_fd = OS_INVALID_HANDLE;
+  }
+  PAGER.wal_index.clear();
+  PAGER.wal_pending.clear();
+  PAGER.wal_history.clear();
+  PAGER.wal_frames = 0;
+  PAGER.committed_frames = 0;
+
+  os_file_unmap(PAGER.map, PAGER.map_size);
+  PAGER.map = nullptr;
+  PAGER.map_size = 0;
+  PAGER.map_pages = 0;
+  PAGER.map_dirty.clear();
+
   os_file_close(PAGER.data_fd);
+  memory_store_release(&PAGER.store);
+  memory_store_release(&PAGER.before_images);
 
   PAGER.in_transaction = false;
+  PAGER.memory = false;
   PAGER.data_fd = OS_INVALID_HANDLE;
 
+  cache_release();
+
   arena<pager_arena>::shutdown();
 }
 
-pager_meta pager_get_stats() {
+/*
+ * See 'Shared Reads' above. Only pager_get, pager_get_sequential, pager_pin,
+ * pager_unpin, pager_prefetch and pager_temp_file_name may be called until
+ * pager_end_shared_reads.
+ */
+void pager_begin_shared_reads() {
+  assert(!PAGER.shared && "Shared reads don't nest");
+  PAGER.shared = true;
+  PAGER.shared_section++;
+}
+
+/*
+ * Once the readers are done, their last pages are unpinned and their files
+ * closed, and frames the pool grew by are given back, as at commit
+ */
+void pager_end_shared_reads() {
+  assert(PAGER.shared);
+  for (shared_reader &reader : PAGER.shared_readers) {
+    if (reader.pinned_slot != INVALID_SLOT) {
+      PAGER.cache_meta[reader.pinned_slot].pin_count--;
+    }
+    if (reader.data_fd != OS_INVALID_HANDLE) {
+      os_file_close(reader.data_fd);
+    }
+    if (reader.wal_fd != OS_INVALID_HANDLE) {
+      os_file_close(reader.wal_fd);
+    }
+  }
+  PAGER.shared_readers.clear();
+
+  PAGER.shared = false;
+  cache_shrink();
+}
+
+/*
+ * See 'Snapshots' above. The cache a thread kept from its last snapshot is
+ * dropped if a checkpoint has run since.
+ */
+bool pager_begin_snapshot() {
+  assert(!reader.open && "Snapshots don't nest");
+
+  if (PAGER.journal_mode != PAGER_JOURNAL_WAL) {
+    return false;
+  }
+
+  if (!reader.files_open) {
+    reader.data_fd = os_file_open(PAGER.data_file, false, false);
+    reader.wal_fd = os_file_open(PAGER.wal_file, false, false);
+    if (reader.data_fd == OS_INVALID_HANDLE ||
+        reader.wal_fd == OS_INVALID_HANDLE) {
+      os_file_close(reader.data_fd);
+      os_file_close(reader.wal_fd);
+      return false;
+    }
+    reader.files_open = true;
+    arena<snapshot_arena>::init();
+  }
+
+  std::lock_guard<std::mutex> guard(wal_latch);
+  if (reader.checkpoints != PAGER.checkpoints) {
+    reader.page_to_slot.clear();
+    for (snapshot_frame &entry : reader.slots) {
+      entry = {};
+    }
+    reader.checkpoints = PAGER.checkpoints;
+  }
+
+  reader.frames = PAGER.committed_frames;
+  reader.page_counter = PAGER.committed_pages;
+  reader.id++;
+  reader.open = true;
+  PAGER.snapshots++;
+  return true;
+}
+
+void pager_end_snapshot() {
+  assert(reader.open);
+
+  std::lock_guard<std::mutex> guard(wal_latch);
+  reader.open = false;
+  PAGER.snapshots--;
+}
+
+bool pager_in_snapshot() { return reader.open; }
+
+/* The thread's snapshot cache and file handles, once it's done reading */
+void pager_release_snapshots() {
+  assert(!reader.open);
+
+  if (!reader.files_open) {
+    return;
+  }
+
+  os_file_close(reader.data_fd);
+  os_file_close(reader.wal_fd);
+  reader.slots.clear();
+  reader.pages.clear();
+  reader.page_to_slot.clear();
+  arena<snapshot_arena>::shutdown();
+  reader = {};
+}
+
+const pager_io_stats *pager_io_counters() { return &PAGER.io; }
+
+/*
+ * Returns page counts, and the I/O counters, zeroing the counters afterwards
+ * if reset_io is set.
+ */
+pager_meta pager_get_stats(bool reset_io) {
   pager_meta stats;
 
   stats.total_pages = PAGER.root.page_counter - 1;
   stats.free_pages = count_free_pages();
 
   stats.cached_pages = 0;
-  stats.dirty_pages = 0;
+  stats.pinned_pages = 0;
+  stats.cache_capacity = PAGER.cache_capacity;
+  stats.cache_frames = PAGER.cache_frames;
+  stats.wal_frames = PAGER.wal_frames;
+  {
+    std::lock_guard<std::mutex> guard(wal_latch);
+    stats.snapshots = PAGER.snapshots;
+  }
+  stats.mapped_pages = PAGER.map_pages;
+  stats.dirty_pages = PAGER.map_dirty.size();
 
-  for (int32_t i = 0; i < MAX_CACHE_ENTRIES; i++) {
+  for (uint32_t i = 0; i < PAGER.cache_frames; i++) {
     if (PAGER.cache_meta[i].is_occupied) {
       stats.cached_pages++;
       if (PAGER.cache_meta[i].is_dirty) {
         stats.dirty_pages++;
       }
+      if (PAGER.cache_meta[i].pin_count > 0) {
+        stats.pinned_pages++;
+      }
     }
   }
 
+  stats.io = PAGER.io;
+  if (reset_io) {
+    PAGER.io = {};
+    io_start_transaction();
+  }
+
   return stats;
 }
@@ -10,15 +10,19 @@
 
 #define PAGE_INVALID 0
 /*
- * Lowering this value, or the PAGE_SIZE to low can result in the tree being
- * corrupted. In a large tree a merge/split can propagate up, causing a node in use
- * to be evicted from the cache, making the pointer stale.
+ * The cache is a pool of frames sized in pages at pager_open. A pointer from
+ * pager_get is only valid until the next call that can load a page, so callers
+ * that hold a page across other pager calls (a b+tree split/merge propagating
+ * up the tree) pin it. Pinned frames are never evicted.
  *
- * To fix this, we could track which pages were used within a transaction, if everything
- * in the cache is, then we could just allocate additional cache nodes, then on commit shrink
- * down to a watermark level.
+ * If every frame is pinned the pool grows past its capacity rather than evict
+ * a page in use, then on commit/rollback shrinks back down to the capacity
+ * (the watermark) it was opened with.
  */
-#define MAX_CACHE_ENTRIES 128
+#define PAGER_DEFAULT_CACHE_PAGES 128
+#define PAGER_MIN_CACHE_PAGES	  4
+#define PAGER_MAX_CACHE_PAGES	  (1U << 21) /* Address space reserved up front, 8GB at 4KB pages */
+#define PAGER_CACHE_PAGES_FOR_BYTES(bytes) ((uint32_t)((bytes) / PAGE_SIZE))
 
 /*
 * The generic page layout used for all data pages. A page knowing it's own
@@ -44,31 +48,178 @@ struct base_page
 	char	 data[PAGE_SIZE - sizeof(uint32_t)];
 };
 
+#define PAGER_HISTOGRAM_BUCKETS 16
+
+/*
+ * Latencies in power of two buckets, bucket i counts samples under 2^i
+ * microseconds, the last one everything slower.
+ */
+struct pager_histogram
+{
+	uint64_t buckets[PAGER_HISTOGRAM_BUCKETS];
+	uint64_t samples, total_us, max_us;
+};
+
+/*
+ * Counters since pager_open, or the last pager_get_stats(true).
+ */
+struct pager_io_stats
+{
+	uint64_t cache_hits, map_hits, cache_misses;
+	uint64_t clean_evictions, dirty_evictions;
+	uint64_t pages_written, journal_pages, wal_frames_written;
+	uint64_t bytes_read, bytes_written, syncs;
+
+	/* Transactions ended (committed or rolled back), and the I/O of the last */
+	uint64_t transactions, tx_bytes_read, tx_bytes_written;
+
+	pager_histogram miss_latency; /* Reading a missed page in */
+	pager_histogram sync_latency;
+};
+
 struct pager_meta
 {
 	uint32_t total_pages, cached_pages, dirty_pages, free_pages;
+	uint32_t cache_capacity, cache_frames, pinned_pages;
+	uint32_t wal_frames, mapped_pages;
+	uint32_t snapshots; /* Open on other threads, see pager_begin_snapshot */
+	pager_io_stats io;
+};
+
+/*
+ * How transactions are made atomic, chosen at pager_open. Either way the
+ * begin/commit/rollback semantics are the same, see WRITE-AHEAD LOG below.
+ */
+enum PAGER_JOURNAL_MODE : uint8_t
+{
+	PAGER_JOURNAL_ROLLBACK, /* Originals saved to '<db>-journal', pages written in place */
+	PAGER_JOURNAL_WAL,		/* New page images appended to '<db>-wal', checkpointed back */
 };
 
+/*
+ * Page replacement policy, see the pager's 'Replacement' notes. 2Q is the
+ * default, and resists scans pushing out the working set.
+ */
+enum PAGER_CACHE_POLICY : uint8_t
+{
+	PAGER_CACHE_2Q,
+	PAGER_CACHE_LRU,
+};
+
+/*
+ * Words in the database's root page kept for the layers above, read at any
+ * time and set inside a transaction, which commits or rolls them back with
+ * the pages. A database made before a slot existed reads it as 0.
+ */
+enum PAGER_ROOT_SLOT : uint8_t
+{
+	PAGER_SLOT_CATALOG_SNAPSHOT, /* First page of the catalog's snapshot, see catalog.hpp */
+	PAGER_SLOT_BLOB_DEDUP,		 /* Root of the blob dedup index, see blob.hpp */
+	PAGER_ROOT_SLOTS,
+};
+
+/*
+ * Opened as the filename, a new database that lives only in memory until
+ * pager_close, see the pager's 'Memory Databases' notes. Transactions still
+ * roll back, but nothing is journaled or synced, and the journal mode is
+ * ignored. Its pages are reserved up front like the cache's, memory_pages of
+ * them, past which a transaction fails to commit.
+ */
+#define PAGER_MEMORY		   ":memory:"
+#define PAGER_MAX_MEMORY_PAGES (1U << 22) /* 16GB at 4KB pages */
+
 bool
-pager_open(const char *filename);
+pager_open(const char *filename, uint32_t cache_pages = PAGER_DEFAULT_CACHE_PAGES,
+		   PAGER_JOURNAL_MODE journal_mode = PAGER_JOURNAL_ROLLBACK, uint32_t memory_pages = PAGER_MAX_MEMORY_PAGES);
+/* Whether pager_open would find a database rather than make one */
+bool
+pager_exists(const char *filename);
 base_page *
 pager_get(uint32_t page_index);
+base_page *
+pager_get_sequential(uint32_t page_index);
+base_page *
+pager_pin(uint32_t page_index);
+void
+pager_unpin(uint32_t page_index);
+uint32_t
+pager_new(uint32_t near_page = 0);
 uint32_t
-pager_new();
+pager_new_extent(uint32_t count, uint32_t near_page = 0);
 bool
 pager_ensure_journaled(uint32_t page_index);
 bool
 pager_delete(uint32_t page_index);
+uint32_t
+pager_relocate(uint32_t page_index);
 bool
 pager_begin_transaction();
 bool
 pager_commit();
 bool
 pager_rollback();
+bool
+pager_commit_grouped();
+bool
+pager_in_transaction();
+void
+pager_temp_file_name(char *name, size_t size);
+void
+pager_set_group_commit(uint32_t window_ms, uint32_t max_pages);
+/*
+ * Milliseconds until the soft commits of an open group are due to be made
+ * durable, 0 once they are, -1 without any. pager_flush_group commits them.
+ */
+int32_t
+pager_group_commit_due();
+bool
+pager_flush_group();
+bool
+pager_checkpoint();
+bool
+pager_set_mmap_size(size_t bytes);
+void
+pager_prefetch(uint32_t page_index);
+void
+pager_set_cache_policy(PAGER_CACHE_POLICY policy);
+
+/*
+ * Lets several threads read pages at once until the matching end, the main
+ * thread included. Pins taken before must be released after, and a thread's
+ * pins taken between before it stops reading.
+ */
+void
+pager_begin_shared_reads();
+void
+pager_end_shared_reads();
+
+/*
+ * In WAL mode, the calling thread reads the database as of the last commit,
+ * until the matching end, however the writer's thread carries on. Only
+ * pager_get, pager_get_sequential, pager_pin, pager_unpin and pager_prefetch
+ * are served from it, and a transaction can't begin. A thread keeps its cache
+ * of the pages it read for its next snapshot, until it releases them, which
+ * it must do before the thread ends.
+ */
+bool
+pager_begin_snapshot();
+void
+pager_end_snapshot();
+bool
+pager_in_snapshot();
+void
+pager_release_snapshots();
+uint32_t
+pager_get_root_slot(PAGER_ROOT_SLOT slot);
+void
+pager_set_root_slot(PAGER_ROOT_SLOT slot, uint32_t value);
 uint32_t
 pager_get_next();
 pager_meta
-pager_get_stats();
+pager_get_stats(bool reset_io = false);
+/* The live I/O counters, without pager_get_stats' page counts, see vm_profile */
+const pager_io_stats *
+pager_io_counters();
 void
 pager_close();
 
@@ -238,6 +389,29 @@ Steps:
 
 
 
+
+WRITE-AHEAD LOG (PAGER_JOURNAL_WAL)
+-----------------------------------
+Originals stay in the data file, changed pages are appended to the log.
+Every commit costs one sequential append and one fsync.
+
+	DATA FILE              WAL FILE                          WAL INDEX
+	┌─────────────┐        ┌──────────────────────────┐      ┌────────────┐
+	│ Page 0 ROOT │        │ f0: [2|sum] Page 2 (v1)  │      │ 2 → f3     │
+	├─────────────┤        │ f1: [0|sum] ROOT  commit │      │ 5 → f2     │
+	│ Page 2 (v0) │        │ f2: [5|sum] Page 5 (new) │      │ 0 → f4     │
+	├─────────────┤        │ f3: [2|sum] Page 2 (v2)  │      └────────────┘
+	│ ...         │        │ f4: [0|sum] ROOT  commit │
+	└─────────────┘        │ f5: [2|sum] Page 2 (v3)  │ ← evicted, uncommitted
+	                       └──────────────────────────┘
+
+Reads:      pending frames of this transaction → WAL index → data file
+Commit:     append dirty pages, append root (commit frame), fsync WAL
+Rollback:   truncate WAL back to its length at begin (f5 above), reset cache
+Checkpoint: copy the indexed frames into the data file, fsync, empty WAL.
+            Runs once the log reaches WAL_AUTOCHECKPOINT_FRAMES, and on close
+Recovery:   index frames up to the last valid commit frame, drop the rest
+
 FREE PAGE MANAGEMENT SYSTEM
 
 
@@ -355,6 +529,34 @@ FREE PAGE MANAGEMENT SYSTEM
 	└──────────────┘
 
 
+	The head is only the choice without a hint or a free space map. Once the
+	list is indexed, any free page can be unlinked, by pointing whatever links
+	to it (free_prev) at its successor:
+
+	Free List              42 ───→ 7 ───→ 3 ───→ 0
+	free_bits (1 = free)   page  1 2 3 4 5 6 7 8 ... 42
+	                             0 0 1 0 0 0 1 0 ...  1
+
+	pager_new(6)  → 7, the first free page after the hint:  42 ───→ 3 ───→ 0
+	pager_new()   → 3, the lowest free page:                42 ───→ 0
+
+
+	TRUNCATION (pager_commit)
+	════════════════════════════════════════════════════════════════════
+
+	Free pages at the end of the file are unlinked (and journaled, so a
+	rollback can relink them), the page counter drops below them, and the
+	file is cut back after the data file is synced:
+
+	  page   1   2   3   4   5   6   7   8          page   1   2   3   4   5
+	       [ d ][ d ][ f ][ d ][ d ][ f ][ f ][ f ]  →   [ d ][ d ][ f ][ d ][ d ]
+	                                                      counter: 9 → 6
+
+	pager_relocate(5) then moves page 5 into page 3, for the next commit to
+	drop page 5 in turn. The caller points everything that referred to page
+	5 at page 3 (bt_vacuum does this for B+tree nodes).
+
+
 
 
 
@@ -371,16 +573,24 @@ LRU CACHE SYSTEM
 
 	Global Pager State:
 	┌─────────────────────────────────────────────────────────────────┐
-	│ cache_meta[MAX_CACHE_ENTRIES]  │ cache_data[MAX_CACHE_ENTRIES]  │
+	│ cache_meta[cache_frames]       │ cache_data[cache_frames]       │
 	├────────────────────────────────┼────────────────────────────────┤
-	│ [0] page_idx=7,  dirty, occ... │ [0] Page 7 data (4KB)          │
-	│ [1] page_idx=42, clean, occ... │ [1] Page 42 data (4KB)         │
-	│ [2] page_idx=15, dirty, occ... │ [2] Page 15 data (4KB)         │
-	│ [3] empty                      │ [3] uninitialized              │
+	│ [0] page_idx=7,  dirty, pin=1  │ [0] Page 7 data (4KB)          │
+	│ [1] page_idx=42, clean, pin=0  │ [1] Page 42 data (4KB)         │
+	│ [2] page_idx=15, dirty, pin=0  │ [2] Page 15 data (4KB)         │
+	│ [3] empty (on the free list)   │ [3] uninitialized              │
 	│ ...                            │ ...                            │
 	└────────────────────────────────┴────────────────────────────────┘
 	Separated for cache locality when scanning metadata
 
+	Both arrays are reserved for PAGER_MAX_CACHE_PAGES up front and
+	committed as the pool grows, so a frame never moves:
+
+	            capacity (watermark)        cache_frames
+	                   ↓                          ↓
+	[ frames committed at open ][ grown, all pinned ][ reserved only ... ]
+	                            └── dropped on commit/rollback once unpinned
+
 
 	┌──────────────────────────────┐     ┌─────────────────────────┐
 	│   page_to_cache (hash_map)   │     │    LRU Doubly-Linked    │
@@ -390,6 +600,15 @@ LRU CACHE SYSTEM
 	│ Page 15 → Slot 2             │     │  (MRU)           (LRU)  │
 	└──────────────────────────────┘     └─────────────────────────┘
 	  O(1) lookup: "Is page           O(1) operations for LRU policy
-	  cached? Where?"
+	  cached? Where?"                 eviction skips pinned slots from the tail
+
+
+	PINNING
+	════════════════════════════════════════════════════════════════════
+
+	btree_node *parent = (btree_node *)pager_pin(7);
+	btree_node *child = (btree_node *)pager_get(42); // may evict, but never 7
+	...
+	pager_unpin(7);
 
  */
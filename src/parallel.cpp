@@ -0,0 +1,341 @@
+/*
+ * SQL From Scratch
+ *
+ * Parallel Scans
+ *
+ * The main thread's VM is in the middle of the OP_Open that called par_open,
+ * and a thread has one VM, so the ranges are always run on threads of their
+ * own, while the main thread's program reads what they output. Each worker
+ * takes the next range nobody has yet, runs that range's program, and
+ * repeats until none are left.
+ *
+ * A worker's rows are handed over as they're output, straight from its
+ * registers (see vm_set_result_callback), and copied into its range's blocks.
+ * The reader learns of them through the range's row count, and only takes
+ * the job's latch to wait, for a block to fill or a range to end, and to give
+ * a block back. A worker takes it to wait for a free block, and to say a
+ * block is full or its range is done. A range is always taken after the ones
+ * before it, so the range being read has a worker, and waiting on each other
+ * never deadlocks.
+ */
+
+#include "parallel.hpp"
+#include "arena.hpp"
+#include "btree.hpp"
+#include "pager.hpp"
+#include "types.hpp"
+#include "vm.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+
+static uint32_t parallel_workers = PARALLEL_DEFAULT_WORKERS;
+
+void par_set_workers(uint32_t workers) {
+  parallel_workers = std::clamp<uint32_t>(workers, 1, PARALLEL_MAX_WORKERS);
+}
+
+uint32_t par_workers() { return parallel_workers; }
+
+/*
+ * The ranges, each with its own copy of the plan's program, shared by the
+ * workers and the reader, see the notes above
+ */
+struct parallel_job {
+  arena_share<query_arena> share;
+  parallel_rows *rows;
+  vm_instruction **programs;
+  uint32_t program_size;
+  std::atomic<uint32_t> next_range;
+  std::atomic<bool> failed;
+  std::atomic<bool> stopping; /* par_close came before the last row was read */
+
+  std::mutex latch;
+  std::condition_variable changed;
+  uint8_t *free_blocks; /* Given back, linked through their first bytes */
+
+  std::thread threads[PARALLEL_MAX_WORKERS];
+  uint32_t thread_count;
+};
+
+/* Where the rows a worker outputs go */
+static thread_local parallel_rows *sink_rows;
+static thread_local parallel_range *sink;
+
+/* Wakes whoever waits for a change made just before, under the latch */
+static void job_changed(parallel_job *job) {
+  { std::lock_guard<std::mutex> guard(job->latch); }
+  job->changed.notify_all();
+}
+
+/*
+ * A block for the range's block'th, once the reader is done with the one
+ * that was there. False once par_close is stopping the workers.
+ */
+static bool take_block(parallel_rows *rows, parallel_range *range,
+                       uint32_t block) {
+  parallel_job *job = rows->job;
+  std::unique_lock<std::mutex> guard(job->latch);
+  job->changed.wait(guard, [&] {
+    return block < range->released + PARALLEL_RANGE_BLOCKS || job->stopping;
+  });
+  if (job->stopping) {
+    return false;
+  }
+
+  uint8_t *memory = job->free_blocks;
+  if (memory) {
+    memcpy(&job->free_blocks, memory, sizeof(uint8_t *));
+  } else {
+    size_t size = std::max<size_t>(PARALLEL_BLOCK_SIZE, rows->row_size);
+    memory = (uint8_t *)arena<query_arena>::alloc(size);
+  }
+  range->blocks[block % PARALLEL_RANGE_BLOCKS] = memory;
+  return true;
+}
+
+static void collect_row(typed_value *values, size_t count) {
+  parallel_rows *rows = sink_rows;
+  parallel_range *range = sink;
+  assert(count == rows->layout.columns.size());
+
+  // Once stopped, the rest of the range's rows go nowhere
+  uint32_t row_count = range->row_count.load(std::memory_order_relaxed);
+  uint32_t block = row_count / rows->rows_per_block;
+  uint32_t position = row_count % rows->rows_per_block;
+  if (position == 0 && !take_block(rows, range, block)) {
+    return;
+  }
+
+  uint8_t *row = range->blocks[block % PARALLEL_RANGE_BLOCKS] +
+                 (size_t)position * rows->row_size;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t size = type_size(rows->layout.columns[i]);
+    uint8_t *dest =
+        i == 0 ? row : row + rows->key_size + rows->layout.offsets[i - 1];
+    if (values[i].data) {
+      memcpy(dest, values[i].data, size);
+    } else {
+      memset(dest, 0, size);
+    }
+  }
+  range->row_count.store(row_count + 1, std::memory_order_release);
+
+  if (position + 1 == rows->rows_per_block) {
+    job_changed(rows->job);
+  }
+}
+
+static void run_ranges(parallel_job *job) {
+  job->share.join();
+  vm_set_result_callback(collect_row, true);
+  sink_rows = job->rows;
+
+  for (;;) {
+    uint32_t range = job->next_range.fetch_add(1);
+    if (range >= job->rows->range_count || job->failed || job->stopping) {
+      break;
+    }
+
+    sink = &job->rows->ranges[range];
+    if (vm_execute(job->programs[range], job->program_size) != OK) {
+      job->failed = true;
+    }
+    sink->done = true;
+    job_changed(job);
+  }
+  job->share.leave();
+}
+
+/*
+ * The plan's program for the range starting at lower and ending before upper,
+ * nullptr for no end. The table cursor gets its own filter, stopping at upper.
+ */
+static vm_instruction *range_program(parallel_plan *plan, uint8_t *lower,
+                                     uint8_t *upper) {
+  size_t size = sizeof(vm_instruction) * plan->program_size;
+  vm_instruction *program = (vm_instruction *)arena<query_arena>::alloc(size);
+  memcpy(program, plan->program, size);
+
+  cursor_context *table =
+      (cursor_context *)arena<query_arena>::alloc(sizeof(cursor_context));
+  *table = *plan->table;
+  table->filter = (scan_filter *)arena<query_arena>::alloc(sizeof(scan_filter));
+  *table->filter = *plan->table->filter;
+  assert(!table->filter->has_stop && "A full scan has no end of its own");
+
+  if (upper) {
+    data_type key_type = table->layout.columns[0];
+    table->filter->has_stop = true;
+    table->filter->stop = {0, LT, upper, type_test_kernel_for(LT, key_type)};
+  }
+
+  for (uint32_t i = 0; i < plan->program_size; i++) {
+    if (program[i].opcode == OP_Open && program[i].p4 == plan->table) {
+      program[i].p4 = table;
+    } else if (program[i].opcode == OP_Load && program[i].p4 == plan->lower) {
+      program[i].p4 = lower;
+    }
+  }
+  return program;
+}
+
+void par_open(parallel_rows *rows, parallel_plan *plan, tuple_format &layout) {
+  assert(!pager_in_snapshot() && "Workers can't read another thread's snapshot");
+
+  btree *tree = plan->table->storage.tree;
+  uint32_t key_size = tree->node_key_size;
+  uint32_t max_points = par_workers() * PARALLEL_RANGES_PER_WORKER - 1;
+  uint8_t *points =
+      (uint8_t *)arena<query_arena>::alloc((size_t)max_points * key_size);
+  uint32_t range_count = bt_split_points(tree, max_points, points) + 1;
+
+  memset(rows, 0, sizeof(parallel_rows));
+  rows->layout = layout;
+  rows->key_size = type_size(layout.columns[0]);
+  rows->row_size = rows->key_size + layout.record_size;
+  rows->rows_per_block =
+      std::max<uint32_t>(1, PARALLEL_BLOCK_SIZE / rows->row_size);
+  rows->range_count = range_count;
+  rows->ranges = (parallel_range *)arena<query_arena>::alloc(
+      sizeof(parallel_range) * range_count);
+  memset(rows->ranges, 0, sizeof(parallel_range) * range_count);
+
+  vm_instruction **programs = (vm_instruction **)arena<query_arena>::alloc(
+      sizeof(vm_instruction *) * range_count);
+  for (uint32_t r = 0; r < range_count; r++) {
+    uint8_t *lower = r == 0 ? plan->lower : points + (r - 1) * key_size;
+    uint8_t *upper = r + 1 < range_count ? points + r * key_size : nullptr;
+    programs[r] = range_program(plan, lower, upper);
+  }
+
+  // Lives in the query arena until par_close, which ends it by hand
+  parallel_job *job =
+      new (arena<query_arena>::alloc(sizeof(parallel_job))) parallel_job();
+  job->rows = rows;
+  job->programs = programs;
+  job->program_size = plan->program_size;
+  job->next_range = 0;
+  job->failed = false;
+  job->stopping = false;
+  job->free_blocks = nullptr;
+  rows->job = job;
+
+  pager_begin_shared_reads();
+  job->thread_count = std::min(par_workers(), range_count);
+  for (uint32_t t = 0; t < job->thread_count; t++) {
+    job->threads[t] = std::thread(run_ranges, job);
+  }
+}
+
+bool par_close(parallel_rows *rows) {
+  parallel_job *job = rows->job;
+  if (!job) {
+    return true;
+  }
+
+  job->stopping = true;
+  job_changed(job);
+  for (uint32_t t = 0; t < job->thread_count; t++) {
+    job->threads[t].join();
+  }
+  pager_end_shared_reads();
+
+  bool failed = job->failed;
+  job->~parallel_job();
+  rows->job = nullptr;
+  rows->range = rows->range_count;
+  return !failed;
+}
+
+/* The reader is done with the range's oldest block, a worker can reuse it */
+static void release_block(parallel_rows *rows, parallel_range *range) {
+  parallel_job *job = rows->job;
+  {
+    std::lock_guard<std::mutex> guard(job->latch);
+    uint8_t *memory = range->blocks[range->released % PARALLEL_RANGE_BLOCKS];
+    memcpy(memory, &job->free_blocks, sizeof(uint8_t *));
+    job->free_blocks = memory;
+    range->released++;
+  }
+  job->changed.notify_all();
+}
+
+/*
+ * Waits for the row at the reading position to be output, moving on to the
+ * next range when its range is done without it. False past the last range,
+ * or once a worker has failed.
+ */
+static bool settle(parallel_rows *rows) {
+  parallel_job *job = rows->job;
+  while (rows->range < rows->range_count) {
+    parallel_range *range = &rows->ranges[rows->range];
+    auto ready = [&] {
+      return rows->position < range->row_count.load(std::memory_order_acquire);
+    };
+
+    if (!ready()) {
+      std::unique_lock<std::mutex> guard(job->latch);
+      job->changed.wait(guard,
+                        [&] { return ready() || range->done || job->failed; });
+    }
+    if (job->failed) {
+      rows->range = rows->range_count;
+      return false;
+    }
+    if (ready()) {
+      return true;
+    }
+
+    while ((uint64_t)range->released * rows->rows_per_block <
+           range->row_count) {
+      release_block(rows, range);
+    }
+    rows->range++;
+    rows->position = 0;
+  }
+  return false;
+}
+
+bool par_first(parallel_rows *rows) {
+  assert(rows->range == 0 && rows->position == 0 &&
+         "Gathered rows are read once");
+  return rows->job && settle(rows);
+}
+
+bool par_next(parallel_rows *rows) {
+  if (!par_is_valid(rows)) {
+    return false;
+  }
+
+  rows->position++;
+  if (rows->position % rows->rows_per_block == 0) {
+    release_block(rows, &rows->ranges[rows->range]);
+  }
+  return settle(rows);
+}
+
+bool par_is_valid(parallel_rows *rows) {
+  return rows->range < rows->range_count;
+}
+
+void *par_key(parallel_rows *rows) {
+  if (!par_is_valid(rows)) {
+    return nullptr;
+  }
+
+  parallel_range *range = &rows->ranges[rows->range];
+  uint32_t block = rows->position / rows->rows_per_block;
+  return range->blocks[block % PARALLEL_RANGE_BLOCKS] +
+         (size_t)(rows->position % rows->rows_per_block) * rows->row_size;
+}
+
+void *par_record(parallel_rows *rows) {
+  uint8_t *key = (uint8_t *)par_key(rows);
+  return key ? key + rows->key_size : nullptr;
+}
@@ -0,0 +1,117 @@
+/*
+ * SQL From Scratch
+ *
+ * Parallel Scans
+ *
+ * A full scan of a table can be cut into key ranges, see bt_split_points,
+ * each scanned by its own copy of a worker program on a thread of its own,
+ * with the rows the workers output gathered for the program that started
+ * them. That program reads them through a GATHER cursor, range after range,
+ * so they come out in key order as a serial scan's would, while the workers
+ * are still scanning: rows are read as they're output.
+ *
+ * The worker program is compiled once, scanning from the key its lower
+ * buffer holds when it runs, under a scan_filter, and par_open gives every
+ * range its own copy with the range's first key in the buffer and a stop at
+ * the next range's. Workers only read, sharing the pager and the query arena
+ * for the duration, see pager_begin_shared_reads and arena_share.
+ *
+ * Rows are laid out as in the other ephemeral storage, the key then the
+ * record, in blocks. A range holds at most PARALLEL_RANGE_BLOCKS of them, its
+ * worker waiting for the reader to be done with one before it starts another,
+ * so the rows in memory are bounded however many the scan outputs. A block
+ * goes back for reuse once the cursor has moved past it, so like a table's
+ * row, a register can reference the current row until the cursor moves.
+ */
+
+#pragma once
+#include "arena.hpp"
+#include "catalog.hpp"
+#include "vm.hpp"
+#include <atomic>
+#include <cstdint>
+
+/* Workers unless set otherwise, 1 scans serially */
+#define PARALLEL_DEFAULT_WORKERS 1
+#define PARALLEL_MAX_WORKERS	 64
+
+/* Ranges per worker, so a worker done early takes another */
+#define PARALLEL_RANGES_PER_WORKER 4
+
+/* Gathered rows are kept in blocks of this size, up to this many a range */
+#define PARALLEL_BLOCK_SIZE	  (64u << 10)
+#define PARALLEL_RANGE_BLOCKS 4
+
+/*
+ * A worker program scanning the table from the key in lower, see the notes
+ * above
+ */
+struct parallel_plan
+{
+	vm_instruction *program;
+	uint32_t		program_size;
+	cursor_context *table; /* The program's table cursor, with a scan_filter */
+	uint8_t		   *lower; /* Read by the program's seek */
+};
+
+/*
+ * The rows one range's worker output, in order. Block b of the range is in
+ * blocks[b % PARALLEL_RANGE_BLOCKS], and the ones before released have been
+ * read.
+ */
+struct parallel_range
+{
+	uint8_t				 *blocks[PARALLEL_RANGE_BLOCKS];
+	std::atomic<uint32_t> row_count; /* Each published as it's written */
+	std::atomic<bool>	  done;
+	uint32_t			  released;
+};
+
+struct parallel_job;
+
+struct parallel_rows
+{
+	tuple_format layout;
+	uint32_t	 key_size;
+	uint32_t	 row_size;
+	uint32_t	 rows_per_block;
+
+	parallel_range *ranges;
+	uint32_t		range_count;
+	parallel_job   *job; /* The workers, until par_close */
+
+	/* Reading, row position of range */
+	uint32_t range;
+	uint32_t position;
+};
+
+/*
+ * Starts the workers on every range of the plan's table, their rows read
+ * through rows as they're output. The pager's reads are shared until
+ * par_close, which stops the workers, if the rows weren't all read, and is
+ * false if any of them failed. A failed worker ends the rows early.
+ */
+void
+par_open(parallel_rows *rows, parallel_plan *plan, tuple_format &layout);
+bool
+par_close(parallel_rows *rows);
+
+bool
+par_first(parallel_rows *rows);
+bool
+par_next(parallel_rows *rows);
+bool
+par_is_valid(parallel_rows *rows);
+void *
+par_key(parallel_rows *rows);
+void *
+par_record(parallel_rows *rows);
+
+/*
+ * Worker threads for the scans compiled after the call, 1 compiles them
+ * serially as before
+ */
+void
+par_set_workers(uint32_t workers);
+uint32_t
+par_workers();
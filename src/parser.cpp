@@ -41,7 +41,8 @@ enum TOKEN_TYPE : uint8_t
 	TOKEN_RPAREN,
 	TOKEN_COMMA,
 	TOKEN_SEMICOLON,
-	TOKEN_STAR
+	TOKEN_STAR,
+	TOKEN_PARAMETER
 };
 
 struct tok
@@ -64,6 +65,7 @@ struct lexer
 struct parser
 {
 	lexer		lex;
+	stmt_node  *statement; // Being parsed, owns the parameters
 	string_view error_msg;
 	int			error_line;
 	int			error_column;
@@ -86,12 +88,20 @@ stmt_type_to_string(STMT_TYPE type)
 		return "CREATE_TABLE";
 	case STMT_DROP_TABLE:
 		return "DROP_TABLE";
+	case STMT_CREATE_INDEX:
+		return "CREATE_INDEX";
+	case STMT_DROP_INDEX:
+		return "DROP_INDEX";
 	case STMT_BEGIN:
 		return "BEGIN";
 	case STMT_COMMIT:
 		return "COMMIT";
 	case STMT_ROLLBACK:
 		return "ROLLBACK";
+	case STMT_COPY:
+		return "COPY";
+	case STMT_ANALYZE:
+		return "ANALYZE";
 	default:
 		return "UNKNOWN";
 	}
@@ -109,7 +119,12 @@ const static std::unordered_map<string_view, int32_t> sql_keywords = {
 	{"ROLLBACK", 15}, {"rollback", 15}, {"AND", 16},   {"and", 16},	  {"OR", 17},	  {"or", 17},	  {"NOT", 18},
 	{"not", 18},	  {"NULL", 19},		{"null", 19},  {"ORDER", 20}, {"order", 20},  {"BY", 21},	  {"by", 21},
 	{"ASC", 22},	  {"asc", 22},		{"DESC", 23},  {"desc", 23},  {"INT", 24},	  {"int", 24},	  {"TEXT", 25},
-	{"text", 25}};
+	{"text", 25},	  {"INDEX", 26},	{"index", 26}, {"ON", 27},	  {"on", 27},
+	{"BETWEEN", 28},  {"between", 28},	{"IN", 29},	   {"in", 29},	  {"LIMIT", 30},  {"limit", 30},  {"OFFSET", 31},
+	{"offset", 31},	  {"JOIN", 32},		{"join", 32},  {"INNER", 33}, {"inner", 33},
+	{"GROUP", 34},	  {"group", 34},	{"COPY", 35},  {"copy", 35},
+	{"VARCHAR", 36},  {"varchar", 36},	{"ANALYZE", 37}, {"analyze", 37},
+	{"EXPLAIN", 38},  {"explain", 38}};
 
 static string_view
 format_error(parser *p, const char *fmt, ...)
@@ -182,6 +197,27 @@ skip_whitespace(lexer *lex)
 				lex->current++;
 			}
 		}
+		else if (lex->current[0] == '/' && lex->current[1] == '*')
+		{
+			// Block comment, to its '*/' or the end of the text
+			lex->current += 2;
+			lex->column += 2;
+			while (*lex->current && !(lex->current[0] == '*' && lex->current[1] == '/'))
+			{
+				if (*lex->current == '\n')
+				{
+					lex->line++;
+					lex->column = 0;
+				}
+				lex->column++;
+				lex->current++;
+			}
+			if (*lex->current)
+			{
+				lex->current += 2;
+				lex->column += 2;
+			}
+		}
 		else
 		{
 			break;
@@ -259,6 +295,16 @@ lexer_next_token(lexer *lex)
 		return token;
 	}
 
+	if (*lex->current == '?')
+	{
+		token.type = TOKEN_PARAMETER;
+		token.text = string_view(lex->current, 1);
+		lex->current++;
+		lex->column++;
+		lex->current_token = token;
+		return token;
+	}
+
 	// Operators
 	if (*lex->current == '=' || *lex->current == '<' || *lex->current == '>' || *lex->current == '!')
 	{
@@ -320,14 +366,22 @@ lexer_next_token(lexer *lex)
 		return token;
 	}
 
-	// Identifiers and keywords
+	// Identifiers and keywords, 'table.column' is one identifier
 	if (isalpha(*lex->current) || *lex->current == '_')
 	{
 		start = lex->current;
+		bool qualified = false;
 		while (isalnum(*lex->current) || *lex->current == '_')
 		{
 			lex->current++;
 			lex->column++;
+
+			if (!qualified && lex->current[0] == '.' && (isalpha(lex->current[1]) || lex->current[1] == '_'))
+			{
+				qualified = true;
+				lex->current++;
+				lex->column++;
+			}
 		}
 
 		token.text = string_view(start, lex->current - start);
@@ -395,6 +449,20 @@ peek_keyword(parser *parser, const char *keyword)
 	return token.type == TOKEN_KEYWORD && is_keyword(token.text, keyword);
 }
 
+/*
+ * Whether the two tokens ahead are the given keywords, e.g. CREATE INDEX
+ */
+static bool
+peek_keywords(parser *parser, const char *first, const char *second)
+{
+	lexer saved = parser->lex;
+
+	bool matches = consume_keyword(parser, first) && peek_keyword(parser, second);
+
+	parser->lex = saved;
+	return matches;
+}
+
 static bool
 consume_operator(parser *parser, const char *op)
 {
@@ -436,7 +504,7 @@ parse_uint32(string_view sv, uint32_t *out)
  * EXPRESSION PARSING
  *
  * Precedence (lowest to highest):
- *   OR → AND → NOT → Comparisons (=, <, >, etc)
+ *   OR → AND → NOT → Comparisons (=, <, >, BETWEEN, IN, etc)
  *
  * Example: "a = 1 AND b = 2 OR c = 3" parses as:
  *   OR
@@ -475,8 +543,27 @@ parse_data_type(parser *parser)
 	{
 		return TYPE_CHAR32;
 	}
+	if (consume_keyword(parser, "VARCHAR"))
+	{
+		// VARCHAR(n), stored in as many bytes as each value has, see record_pack
+		uint32_t length = 0;
+		bool	 valid = consume_token(parser, TOKEN_LPAREN);
+		tok		 token = lexer_next_token(&parser->lex);
+		valid = valid && token.type == TOKEN_NUMBER && parse_uint32(token.text, &length);
+		if (!valid || !consume_token(parser, TOKEN_RPAREN))
+		{
+			format_error(parser, "Expected VARCHAR(length)");
+			return TYPE_NULL;
+		}
+		if (length == 0 || length > VARCHAR_MAX_SIZE)
+		{
+			format_error(parser, "VARCHAR length must be between 1 and %u", VARCHAR_MAX_SIZE);
+			return TYPE_NULL;
+		}
+		return TYPE_VARCHAR(length);
+	}
 
-	format_error(parser, "Expected data type (INT or TEXT)");
+	format_error(parser, "Expected data type (INT, TEXT or VARCHAR)");
 	return TYPE_NULL;
 }
 
@@ -592,6 +679,118 @@ parse_not_expr(parser *parser)
 	return parse_comparison_expr(parser);
 }
 
+static expr_node *
+make_binary_expr(BINARY_OP op, expr_node *left, expr_node *right)
+{
+	expr_node *expr = (expr_node *)arena<query_arena>::alloc(sizeof(expr_node));
+	expr->type = EXPR_BINARY_OP;
+	expr->op = op;
+	expr->left = left;
+	expr->right = right;
+	return expr;
+}
+
+/*
+ * BETWEEN and IN are rewritten into the comparisons they stand for, so the
+ * later passes only ever see =, <, >, AND and OR
+ * Pattern: expr BETWEEN low AND high
+ * Tree:    AND
+ *         /   \
+ *      (>= low) (<= high)
+ *
+ * Pattern: expr IN (a, b, c)
+ * Tree:    OR
+ *         /  \
+ *        OR   (= c)
+ *       /  \
+ *    (= a)  (= b)
+ *
+ * The operand is copied so each comparison owns its node, as the planner
+ * rewrites comparisons in place.
+ */
+static expr_node *
+parse_between_expr(parser *parser, expr_node *left)
+{
+	expr_node *low = parse_primary_expr(parser);
+	if (!low)
+	{
+		format_error(parser, "Expected expression after BETWEEN");
+		return nullptr;
+	}
+
+	if (!consume_keyword(parser, "AND"))
+	{
+		format_error(parser, "Expected AND after BETWEEN value");
+		return nullptr;
+	}
+
+	expr_node *high = parse_primary_expr(parser);
+	if (!high)
+	{
+		format_error(parser, "Expected expression after AND");
+		return nullptr;
+	}
+
+	expr_node *copy = (expr_node *)arena<query_arena>::alloc(sizeof(expr_node));
+	*copy = *left;
+
+	return make_binary_expr(OP_AND, make_binary_expr(OP_GE, left, low), make_binary_expr(OP_LE, copy, high));
+}
+
+static expr_node *
+parse_in_expr(parser *parser, expr_node *left)
+{
+	if (!consume_token(parser, TOKEN_LPAREN))
+	{
+		format_error(parser, "Expected '(' after IN");
+		return nullptr;
+	}
+
+	expr_node *list = nullptr;
+	do
+	{
+		expr_node *value = parse_primary_expr(parser);
+		if (!value)
+		{
+			format_error(parser, "Expected value in IN list");
+			return nullptr;
+		}
+
+		expr_node *operand = left;
+		if (list)
+		{
+			operand = (expr_node *)arena<query_arena>::alloc(sizeof(expr_node));
+			*operand = *left;
+		}
+
+		expr_node *equals = make_binary_expr(OP_EQ, operand, value);
+		list = list ? make_binary_expr(OP_OR, list, equals) : equals;
+	} while (consume_token(parser, TOKEN_COMMA));
+
+	if (!consume_token(parser, TOKEN_RPAREN))
+	{
+		format_error(parser, "Expected ')' after IN list");
+		return nullptr;
+	}
+
+	return list;
+}
+
+static expr_node *
+make_not_expr(expr_node *operand)
+{
+	if (!operand)
+	{
+		return nullptr;
+	}
+
+	expr_node *expr = (expr_node *)arena<query_arena>::alloc(sizeof(expr_node));
+	expr->type = EXPR_UNARY_OP;
+	expr->unary_op = OP_NOT;
+	expr->operand = operand;
+	return expr;
+}
+
 expr_node *
 parse_comparison_expr(parser *parser)
 {
@@ -601,6 +800,25 @@ parse_comparison_expr(parser *parser)
 		return nullptr;
 	}
 
+	if (consume_keyword(parser, "BETWEEN"))
+	{
+		return parse_between_expr(parser, left);
+	}
+	if (consume_keyword(parser, "IN"))
+	{
+		return parse_in_expr(parser, left);
+	}
+	if (peek_keywords(parser, "NOT", "BETWEEN") || peek_keywords(parser, "NOT", "IN"))
+	{
+		consume_keyword(parser, "NOT");
+		if (consume_keyword(parser, "BETWEEN"))
+		{
+			return make_not_expr(parse_between_expr(parser, left));
+		}
+		consume_keyword(parser, "IN");
+		return make_not_expr(parse_in_expr(parser, left));
+	}
+
 	tok token = lexer_peek_token(&parser->lex);
 	if (token.type == TOKEN_OPERATOR)
 	{
@@ -707,9 +925,10 @@ parse_primary_expr(parser *parser)
 	if (token.type == TOKEN_STRING)
 	{
 
-		if (token.text.size() > type_size(TYPE_CHAR32))
+		// A TEXT column's 32 byte limit is checked against the column, see semantic.cpp
+		if (token.text.size() > VARCHAR_MAX_SIZE)
 		{
-			format_error(parser, "Literal 32 byte limit for TEXT columns");
+			format_error(parser, "Literal %u byte limit", VARCHAR_MAX_SIZE);
 			return nullptr;
 		}
 
@@ -729,6 +948,21 @@ parse_primary_expr(parser *parser)
 		return expr;
 	}
 
+	// Parameter, numbered left to right from 0
+	if (token.type == TOKEN_PARAMETER)
+	{
+		parameter_slot *slot = (parameter_slot *)arena<query_arena>::alloc(sizeof(parameter_slot));
+		slot->index = parser->statement->parameters.size();
+		slot->type = TYPE_NULL;
+		slot->value = nullptr;
+		parser->statement->parameters.push(slot);
+
+		expr_node *expr = (expr_node *)arena<query_arena>::alloc(sizeof(expr_node));
+		expr->type = EXPR_PARAMETER;
+		expr->parameter = slot;
+		return expr;
+	}
+
 	format_error(parser, "Unexpected token '%.*s'", (int)token.text.size(), token.text.data());
 	return nullptr;
 }
@@ -750,6 +984,54 @@ parse_where_clause(parser *parser)
 	return expr;
 }
 
+const char *
+aggregate_function_name(AGGREGATE_FUNCTION function)
+{
+	switch (function)
+	{
+	case AGG_COUNT:
+		return "COUNT";
+	case AGG_SUM:
+		return "SUM";
+	case AGG_AVG:
+		return "AVG";
+	case AGG_MIN:
+		return "MIN";
+	case AGG_MAX:
+		return "MAX";
+	default:
+		return "";
+	}
+}
+
+/*
+ * Aggregates aren't keywords, so a column can still be called count, they're
+ * told apart by the '(' after them, in any case
+ */
+static AGGREGATE_FUNCTION
+aggregate_from_name(string_view name)
+{
+	for (uint8_t function = AGG_COUNT; function <= AGG_MAX; function++)
+	{
+		const char *candidate = aggregate_function_name((AGGREGATE_FUNCTION)function);
+		if (name.size() != strlen(candidate))
+		{
+			continue;
+		}
+
+		uint32_t i = 0;
+		while (i < name.size() && toupper((unsigned char)name[i]) == candidate[i])
+		{
+			i++;
+		}
+		if (i == name.size())
+		{
+			return (AGGREGATE_FUNCTION)function;
+		}
+	}
+	return AGG_NONE;
+}
+
 void
 parse_select(parser *parser, select_stmt *stmt)
 {
@@ -776,7 +1058,39 @@ parse_select(parser *parser, select_stmt *stmt)
 				return;
 			}
 
+			AGGREGATE_FUNCTION aggregate = AGG_NONE;
+			if (consume_token(parser, TOKEN_LPAREN))
+			{
+				aggregate = aggregate_from_name(token.text);
+				if (aggregate == AGG_NONE)
+				{
+					format_error(parser, "Unknown function %.*s", (int)token.text.size(), token.text.data());
+					return;
+				}
+
+				if (aggregate == AGG_COUNT && consume_token(parser, TOKEN_STAR))
+				{
+					token.text = "*";
+				}
+				else
+				{
+					token = lexer_next_token(&parser->lex);
+					if (token.type != TOKEN_IDENTIFIER)
+					{
+						format_error(parser, "Expected column name in %s()", aggregate_function_name(aggregate));
+						return;
+					}
+				}
+
+				if (!consume_token(parser, TOKEN_RPAREN))
+				{
+					format_error(parser, "Expected ')' after %s argument", aggregate_function_name(aggregate));
+					return;
+				}
+			}
+
 			stmt->columns.push(token.text);
+			stmt->column_aggregates.push(aggregate);
 		} while (consume_token(parser, TOKEN_COMMA));
 	}
 
@@ -795,8 +1109,58 @@ parse_select(parser *parser, select_stmt *stmt)
 
 	stmt->table_name = token.text;
 
+	stmt->join_table = string_view{};
+	stmt->join_condition = nullptr;
+	bool inner = consume_keyword(parser, "INNER");
+	if (consume_keyword(parser, "JOIN"))
+	{
+		token = lexer_next_token(&parser->lex);
+		if (token.type != TOKEN_IDENTIFIER)
+		{
+			format_error(parser, "Expected table name after JOIN");
+			return;
+		}
+		stmt->join_table = token.text;
+
+		if (!consume_keyword(parser, "ON"))
+		{
+			format_error(parser, "Expected ON after JOIN table");
+			return;
+		}
+
+		stmt->join_condition = parse_expression(parser);
+		if (!stmt->join_condition)
+		{
+			format_error(parser, "Expected expression after ON");
+			return;
+		}
+	}
+	else if (inner)
+	{
+		format_error(parser, "Expected JOIN after INNER");
+		return;
+	}
+
 	stmt->where_clause = parse_where_clause(parser);
 
+	if (consume_keyword(parser, "GROUP"))
+	{
+		if (!consume_keyword(parser, "BY"))
+		{
+			format_error(parser, "Expected BY after GROUP");
+			return;
+		}
+
+		token = lexer_next_token(&parser->lex);
+		if (token.type != TOKEN_IDENTIFIER)
+		{
+			format_error(parser, "Expected column name after GROUP BY");
+			return;
+		}
+
+		stmt->group_by_column = token.text;
+	}
+
 	if (consume_keyword(parser, "ORDER"))
 	{
 		if (!consume_keyword(parser, "BY"))
@@ -824,6 +1188,30 @@ parse_select(parser *parser, select_stmt *stmt)
 			stmt->order_desc = false;
 		}
 	}
+
+	stmt->has_limit = false;
+	stmt->offset = 0;
+	if (consume_keyword(parser, "LIMIT"))
+	{
+		stmt->has_limit = true;
+
+		token = lexer_next_token(&parser->lex);
+		if (token.type != TOKEN_NUMBER || !parse_uint32(token.text, &stmt->limit))
+		{
+			format_error(parser, "Expected row count after LIMIT");
+			return;
+		}
+
+		if (consume_keyword(parser, "OFFSET"))
+		{
+			token = lexer_next_token(&parser->lex);
+			if (token.type != TOKEN_NUMBER || !parse_uint32(token.text, &stmt->offset))
+			{
+				format_error(parser, "Expected row count after OFFSET");
+				return;
+			}
+		}
+	}
 }
 
 void
@@ -877,28 +1265,40 @@ parse_insert(parser *parser, insert_stmt *stmt)
 		return;
 	}
 
-	if (!consume_token(parser, TOKEN_LPAREN))
-	{
-		format_error(parser, "Expected '(' after VALUES");
-		return;
-	}
-
+	stmt->row_count = 0;
 	do
 	{
-		expr_node *expr = parse_expression(parser);
-		if (!expr)
+		if (!consume_token(parser, TOKEN_LPAREN))
 		{
-			format_error(parser, "Expected value expression in VALUES list");
+			format_error(parser, stmt->row_count ? "Expected '(' after ','" : "Expected '(' after VALUES");
 			return;
 		}
-		stmt->values.push(expr);
-	} while (consume_token(parser, TOKEN_COMMA));
 
-	if (!consume_token(parser, TOKEN_RPAREN))
-	{
-		format_error(parser, "Expected ')' after VALUES list");
-		return;
-	}
+		uint32_t row_start = stmt->values.size();
+		do
+		{
+			expr_node *expr = parse_expression(parser);
+			if (!expr)
+			{
+				format_error(parser, "Expected value expression in VALUES list");
+				return;
+			}
+			stmt->values.push(expr);
+		} while (consume_token(parser, TOKEN_COMMA));
+
+		if (!consume_token(parser, TOKEN_RPAREN))
+		{
+			format_error(parser, "Expected ')' after VALUES list");
+			return;
+		}
+
+		if (stmt->row_count > 0 && stmt->values.size() - row_start != row_start / stmt->row_count)
+		{
+			format_error(parser, "Every row in VALUES needs the same number of values");
+			return;
+		}
+		stmt->row_count++;
+	} while (consume_token(parser, TOKEN_COMMA));
 }
 
 void
@@ -1076,6 +1476,101 @@ parse_drop_table(parser *parser, drop_table_stmt *stmt)
 	stmt->table_name = token.text;
 }
 
+void
+parse_create_index(parser *parser, create_index_stmt *stmt)
+{
+	if (!consume_keyword(parser, "CREATE"))
+	{
+		format_error(parser, "Expected CREATE");
+		return;
+	}
+
+	if (!consume_keyword(parser, "INDEX"))
+	{
+		format_error(parser, "Expected INDEX after CREATE");
+		return;
+	}
+
+	tok token = lexer_next_token(&parser->lex);
+	if (token.type != TOKEN_IDENTIFIER)
+	{
+		format_error(parser, "Expected index name after CREATE INDEX");
+		return;
+	}
+
+	stmt->index_name = token.text;
+
+	if (!consume_keyword(parser, "ON"))
+	{
+		format_error(parser, "Expected ON after index name");
+		return;
+	}
+
+	token = lexer_next_token(&parser->lex);
+	if (token.type != TOKEN_IDENTIFIER)
+	{
+		format_error(parser, "Expected table name after ON");
+		return;
+	}
+
+	stmt->table_name = token.text;
+
+	if (!consume_token(parser, TOKEN_LPAREN))
+	{
+		format_error(parser, "Expected '(' after table name");
+		return;
+	}
+
+	do
+	{
+		token = lexer_next_token(&parser->lex);
+		if (token.type != TOKEN_IDENTIFIER)
+		{
+			format_error(parser, "Expected column name in CREATE INDEX");
+			return;
+		}
+
+		stmt->columns.push(token.text);
+	} while (consume_token(parser, TOKEN_COMMA));
+
+	if (!consume_token(parser, TOKEN_RPAREN))
+	{
+		format_error(parser, "Expected ')' after index columns");
+		return;
+	}
+
+	if (stmt->columns.size() > 2)
+	{
+		format_error(parser, "An index covers at most 2 columns");
+		return;
+	}
+}
+
+void
+parse_drop_index(parser *parser, drop_index_stmt *stmt)
+{
+	if (!consume_keyword(parser, "DROP"))
+	{
+		format_error(parser, "Expected DROP");
+		return;
+	}
+
+	if (!consume_keyword(parser, "INDEX"))
+	{
+		format_error(parser, "Expected INDEX after DROP");
+		return;
+	}
+
+	tok token = lexer_next_token(&parser->lex);
+	if (token.type != TOKEN_IDENTIFIER)
+	{
+		format_error(parser, "Expected index name after DROP INDEX");
+		return;
+	}
+
+	stmt->index_name = token.text;
+}
+
 void
 parse_begin(parser *parser, begin_stmt *stmt)
 {
@@ -1106,10 +1601,86 @@ parse_rollback(parser *parser, rollback_stmt *stmt)
 	}
 }
 
+void
+parse_copy(parser *parser, copy_stmt *stmt)
+{
+	if (!consume_keyword(parser, "COPY"))
+	{
+		format_error(parser, "Expected COPY");
+		return;
+	}
+
+	tok token = lexer_next_token(&parser->lex);
+	if (token.type != TOKEN_IDENTIFIER)
+	{
+		format_error(parser, "Expected table name after COPY");
+		return;
+	}
+
+	stmt->table_name = token.text;
+
+	if (!consume_keyword(parser, "FROM"))
+	{
+		format_error(parser, "Expected FROM after table name");
+		return;
+	}
+
+	token = lexer_next_token(&parser->lex);
+	if (token.type != TOKEN_STRING || token.text.empty())
+	{
+		format_error(parser, "Expected a quoted file name after FROM");
+		return;
+	}
+
+	stmt->file_path = token.text;
+}
+
+void
+parse_analyze(parser *parser, analyze_stmt *stmt)
+{
+	if (!consume_keyword(parser, "ANALYZE"))
+	{
+		format_error(parser, "Expected ANALYZE");
+		return;
+	}
+
+	stmt->table_name = {};
+	stmt->sem.create_stats_table = false;
+	if (lexer_peek_token(&parser->lex).type == TOKEN_IDENTIFIER)
+	{
+		stmt->table_name = lexer_next_token(&parser->lex).text;
+	}
+}
+
 stmt_node *
 parse_statement(parser *parser)
 {
+	// Zeroed, the statements' parsers leave what they don't see that way, and
+	// memory reclaimed into the arena isn't
 	stmt_node *stmt = (stmt_node *)arena<query_arena>::alloc(sizeof(stmt_node));
+	memset(stmt, 0, sizeof(stmt_node));
+	stmt->parameters = array<parameter_slot *, query_arena>();
+	stmt->plan = array<const char *, query_arena>();
+	parser->statement = stmt;
+
+	/*
+	 * EXPLAIN ANALYZE followed by a statement profiles it, otherwise the
+	 * ANALYZE is the statement being explained, 'EXPLAIN ANALYZE users'
+	 */
+	if (consume_keyword(parser, "EXPLAIN"))
+	{
+		stmt->explain = EXPLAIN_PLAN;
+
+		lexer saved = parser->lex;
+		if (consume_keyword(parser, "ANALYZE") && lexer_peek_token(&parser->lex).type == TOKEN_KEYWORD)
+		{
+			stmt->explain = EXPLAIN_ANALYZE;
+		}
+		else
+		{
+			parser->lex = saved;
+		}
+	}
 
 	tok token = lexer_peek_token(&parser->lex);
 	const char *stmt_start = parser->lex.current;
@@ -1129,6 +1700,16 @@ parse_statement(parser *parser)
 		stmt->type = STMT_DELETE;
 		parse_delete(parser, &stmt->delete_stmt);
 	}
+	else if (peek_keywords(parser, "CREATE", "INDEX"))
+	{
+		stmt->type = STMT_CREATE_INDEX;
+		parse_create_index(parser, &stmt->create_index_stmt);
+	}
+	else if (peek_keywords(parser, "DROP", "INDEX"))
+	{
+		stmt->type = STMT_DROP_INDEX;
+		parse_drop_index(parser, &stmt->drop_index_stmt);
+	}
 	else if (peek_keyword(parser, "CREATE"))
 	{
 		stmt->type = STMT_CREATE_TABLE;
@@ -1159,6 +1740,16 @@ parse_statement(parser *parser)
 		stmt->type = STMT_ROLLBACK;
 		parse_rollback(parser, &stmt->rollback_stmt);
 	}
+	else if (peek_keyword(parser, "COPY"))
+	{
+		stmt->type = STMT_COPY;
+		parse_copy(parser, &stmt->copy_stmt);
+	}
+	else if (peek_keyword(parser, "ANALYZE"))
+	{
+		stmt->type = STMT_ANALYZE;
+		parse_analyze(parser, &stmt->analyze_stmt);
+	}
 	else
 	{
 		if (token.type == TOKEN_EOF)
@@ -1243,6 +1834,213 @@ parse_sql(const char *sql)
 	return result;
 }
 
+bool
+sql_stream_open(sql_stream *stream, const char *path, uint32_t buffer_size)
+{
+	*stream = {};
+	stream->file = os_file_open(path, false, false);
+	if (stream->file == OS_INVALID_HANDLE)
+	{
+		return false;
+	}
+
+	stream->capacity = buffer_size;
+	stream->buffer = (char *)arena<global_arena>::alloc(buffer_size + 1);
+	stream->line = 1;
+	if (!stream->buffer)
+	{
+		sql_stream_close(stream);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Moves what's left to the front of the buffer, doubling it if that's all of
+ * it, and reads more after it. False at the end of the file.
+ */
+static bool
+stream_fill(sql_stream *stream)
+{
+	if (stream->eof)
+	{
+		return false;
+	}
+
+	if (stream->start > 0)
+	{
+		memmove(stream->buffer, stream->buffer + stream->start, stream->end - stream->start);
+		stream->end -= stream->start;
+		stream->start = 0;
+	}
+
+	if (stream->end == stream->capacity)
+	{
+		char *larger = (char *)arena<global_arena>::alloc(stream->capacity * 2 + 1);
+		if (!larger)
+		{
+			stream->eof = true;
+			return false;
+		}
+		memcpy(larger, stream->buffer, stream->end);
+		arena<global_arena>::reclaim(stream->buffer, stream->capacity + 1);
+		stream->buffer = larger;
+		stream->capacity *= 2;
+	}
+
+	os_file_size_t read = os_file_read(stream->file, stream->buffer + stream->end, stream->capacity - stream->end);
+	if (read == 0)
+	{
+		stream->eof = true;
+		return false;
+	}
+
+	// The next chunk is read ahead while this one's statements run
+	stream->end += read;
+	stream->offset += read;
+	os_file_prefetch(stream->file, stream->offset, stream->capacity);
+	return true;
+}
+
+/*
+ * The text up to the next ';', or the end of the file, with the ';' taken
+ * off. Complete says if there was one.
+ */
+static char *
+stream_scan(sql_stream *stream, uint32_t *scanned_out, bool *complete_out)
+{
+	/*
+	 * Scanning resumes where it left off after a fill, the text before having
+	 * moved with start. A '-', '/' or, in a block comment, '*' at the end of
+	 * what's read waits for the next byte to know if it begins or ends a
+	 * comment.
+	 */
+	uint32_t scanned = 0;
+	bool	 in_string = false;
+	bool	 in_comment = false;
+	bool	 in_block_comment = false;
+	bool	 complete = false;
+	while (true)
+	{
+		const char *text = stream->buffer + stream->start;
+		uint32_t	length = stream->end - stream->start;
+		for (; scanned < length && !complete; scanned++)
+		{
+			char c = text[scanned];
+			if (in_comment)
+			{
+				in_comment = c != '\n';
+			}
+			else if (in_block_comment)
+			{
+				if (c == '*')
+				{
+					if (scanned + 1 == length && !stream->eof)
+					{
+						break;
+					}
+					if (scanned + 1 < length && text[scanned + 1] == '/')
+					{
+						in_block_comment = false;
+						scanned++;
+					}
+				}
+			}
+			else if (in_string)
+			{
+				in_string = c != '\'';
+			}
+			else if (c == '\'')
+			{
+				in_string = true;
+			}
+			else if (c == ';')
+			{
+				complete = true;
+			}
+			else if (c == '-')
+			{
+				if (scanned + 1 == length && !stream->eof)
+				{
+					break;
+				}
+				in_comment = scanned + 1 < length && text[scanned + 1] == '-';
+			}
+			else if (c == '/')
+			{
+				if (scanned + 1 == length && !stream->eof)
+				{
+					break;
+				}
+				if (scanned + 1 < length && text[scanned + 1] == '*')
+				{
+					in_block_comment = true;
+					scanned++; // So '/*/' doesn't end it
+				}
+			}
+		}
+
+		// At the end of the file, what's left is the last statement
+		if (complete || (!stream_fill(stream) && scanned == stream->end - stream->start))
+		{
+			break;
+		}
+	}
+
+	// The ';' becomes the terminator, the lexer doesn't need it
+	char *text = stream->buffer + stream->start;
+	text[complete ? scanned - 1 : scanned] = '\0';
+	stream->start += scanned;
+	*scanned_out = scanned;
+	*complete_out = complete;
+	return text;
+}
+
+/*
+ * An empty statement (';;') or one that's only a comment parses to none, so
+ * it's skipped rather than taken for the end of the file
+ */
+parser_result
+sql_stream_next(sql_stream *stream)
+{
+	while (true)
+	{
+		uint32_t scanned;
+		bool	 complete;
+		char	*text = stream_scan(stream, &scanned, &complete);
+
+		parser_result result = parse_sql(text);
+		if (!result.success)
+		{
+			result.error_line += stream->line - 1;
+		}
+		for (uint32_t i = 0; i < scanned; i++)
+		{
+			stream->line += text[i] == '\n';
+		}
+
+		if (!result.success || result.statements.size() > 0 || !complete)
+		{
+			return result;
+		}
+	}
+}
+
+void
+sql_stream_close(sql_stream *stream)
+{
+	if (stream->buffer)
+	{
+		arena<global_arena>::reclaim(stream->buffer, stream->capacity + 1);
+	}
+	if (stream->file != OS_INVALID_HANDLE)
+	{
+		os_file_close(stream->file);
+	}
+	*stream = {};
+	stream->file = OS_INVALID_HANDLE;
+}
+
 // Debug printing functions
 static void
 print_expr(expr_node *expr, int indent)
@@ -1270,6 +2068,10 @@ print_expr(expr_node *expr, int indent)
 		printf("%*sColumn: %.*s\n", indent, "", (int)expr->column_name.size(), expr->column_name.data());
 		break;
 
+	case EXPR_PARAMETER:
+		printf("%*sParameter: %u\n", indent, "", expr->parameter->index);
+		break;
+
 	case EXPR_BINARY_OP: {
 		const char *op_str[] = {"=", "!=", "<", "<=", ">", ">=", "AND", "OR"};
 		printf("%*sBinaryOp: %s\n", indent, "", op_str[expr->op]);
@@ -1297,6 +2099,10 @@ print_ast(stmt_node *stmt)
 	}
 
 	printf("Statement Type: %s\n", stmt_type_to_string(stmt->type));
+	if (stmt->explain != EXPLAIN_NONE)
+	{
+		printf("  Explain: %s\n", stmt->explain == EXPLAIN_ANALYZE ? "ANALYZE" : "PLAN");
+	}
 
 	switch (stmt->type)
 	{
@@ -1304,6 +2110,12 @@ print_ast(stmt_node *stmt)
 		select_stmt *s = &stmt->select_stmt;
 		printf("  Table: %.*s\n", (int)s->table_name.size(), s->table_name.data());
 
+		if (!s->join_table.empty())
+		{
+			printf("  JOIN: %.*s ON:\n", (int)s->join_table.size(), s->join_table.data());
+			print_expr(s->join_condition, 4);
+		}
+
 		if (s->is_star)
 		{
 			printf("  Columns: *\n");
@@ -1315,7 +2127,11 @@ print_ast(stmt_node *stmt)
 			{
 				if (i > 0)
 					printf(", ");
-				printf("%.*s", (int)s->columns[i].size(), s->columns[i].data());
+				if (s->column_aggregates[i] != AGG_NONE)
+					printf("%s(%.*s)", aggregate_function_name(s->column_aggregates[i]), (int)s->columns[i].size(),
+						   s->columns[i].data());
+				else
+					printf("%.*s", (int)s->columns[i].size(), s->columns[i].data());
 			}
 			printf("\n");
 		}
@@ -1326,11 +2142,21 @@ print_ast(stmt_node *stmt)
 			print_expr(s->where_clause, 4);
 		}
 
+		if (!s->group_by_column.empty())
+		{
+			printf("  GROUP BY: %.*s\n", (int)s->group_by_column.size(), s->group_by_column.data());
+		}
+
 		if (!s->order_by_column.empty())
 		{
 			printf("  ORDER BY: %.*s %s\n", (int)s->order_by_column.size(), s->order_by_column.data(),
 				   s->order_desc ? "DESC" : "ASC");
 		}
+
+		if (s->has_limit)
+		{
+			printf("  LIMIT: %u OFFSET: %u\n", s->limit, s->offset);
+		}
 		break;
 	}
 
@@ -1350,10 +2176,14 @@ print_ast(stmt_node *stmt)
 			printf("\n");
 		}
 
-		printf("  Values:\n");
-		for (uint32_t i = 0; i < s->values.size(); i++)
+		uint32_t row_width = s->values.size() / s->row_count;
+		for (uint32_t row = 0; row < s->row_count; row++)
 		{
-			print_expr(s->values[i], 4);
+			printf(s->row_count > 1 ? "  Values (row %u):\n" : "  Values:\n", row + 1);
+			for (uint32_t i = 0; i < row_width; i++)
+			{
+				print_expr(s->values[row * row_width + i], 4);
+			}
 		}
 		break;
 	}
@@ -1393,7 +2223,12 @@ print_ast(stmt_node *stmt)
 		for (uint32_t i = 0; i < s->columns.size(); i++)
 		{
 			attribute_node *col = &s->columns[i];
-			printf("    %.*s %s%s\n", (int)col->name.size(), col->name.data(), col->type == TYPE_U32 ? "INT" : "TEXT",
+			const char *sql_type = col->type == TYPE_U32 ? "INT" : "TEXT";
+			if (type_id(col->type) == TYPE_ID_VARCHAR)
+			{
+				sql_type = "VARCHAR";
+			}
+			printf("    %.*s %s%s\n", (int)col->name.size(), col->name.data(), sql_type,
 				   col->sem.is_primary_key ? " (PRIMARY KEY)" : "");
 		}
 		break;
@@ -1405,6 +2240,43 @@ print_ast(stmt_node *stmt)
 		break;
 	}
 
+	case STMT_CREATE_INDEX: {
+		create_index_stmt *s = &stmt->create_index_stmt;
+		printf("  Index: %.*s\n", (int)s->index_name.size(), s->index_name.data());
+		printf("  Table: %.*s\n", (int)s->table_name.size(), s->table_name.data());
+		printf("  Columns: ");
+		for (uint32_t i = 0; i < s->columns.size(); i++)
+		{
+			if (i > 0)
+				printf(", ");
+			printf("%.*s", (int)s->columns[i].size(), s->columns[i].data());
+		}
+		printf("\n");
+		break;
+	}
+
+	case STMT_DROP_INDEX: {
+		drop_index_stmt *s = &stmt->drop_index_stmt;
+		printf("  Index: %.*s\n", (int)s->index_name.size(), s->index_name.data());
+		break;
+	}
+
+	case STMT_COPY: {
+		copy_stmt *s = &stmt->copy_stmt;
+		printf("  Table: %.*s\n", (int)s->table_name.size(), s->table_name.data());
+		printf("  File: %.*s\n", (int)s->file_path.size(), s->file_path.data());
+		break;
+	}
+
+	case STMT_ANALYZE: {
+		analyze_stmt *s = &stmt->analyze_stmt;
+		if (!s->table_name.empty())
+		{
+			printf("  Table: %.*s\n", (int)s->table_name.size(), s->table_name.data());
+		}
+		break;
+	}
+
 	case STMT_BEGIN:
 	case STMT_COMMIT:
 	case STMT_ROLLBACK:
@@ -8,15 +8,36 @@
  * Data Definition Language (DDL):
  *   CREATE TABLE table_name (column_name INT|TEXT, ...)
  *   DROP TABLE table_name
+ *   CREATE INDEX index_name ON table_name (column_name[, column_name])
+ *   DROP INDEX index_name
  *
  * Data Manipulation Language (DML):
- *   SELECT * FROM table_name [WHERE expr] [ORDER BY column [ASC|DESC]]
- *   SELECT col1, col2, ... FROM table_name [WHERE expr] [ORDER BY column [ASC|DESC]]
+ *   SELECT * FROM table_name [WHERE expr] [ORDER BY column [ASC|DESC]] [LIMIT n [OFFSET m]]
+ *   SELECT col1, col2, ... FROM table_name [WHERE expr] [ORDER BY column [ASC|DESC]] [LIMIT n [OFFSET m]]
+ *   SELECT ... FROM table_name [INNER] JOIN table_name ON expr [WHERE expr] ...
+ *   SELECT column, COUNT(*), SUM(col), ... FROM ... [WHERE expr] [GROUP BY column] ...
  *   INSERT INTO table_name VALUES (val1, val2, ...)
  *   INSERT INTO table_name (col1, col2, ...) VALUES (val1, val2, ...)
  *   UPDATE table_name SET col1 = val1, col2 = val2, ... [WHERE expr]
  *   DELETE FROM table_name [WHERE expr]
  *
+ * Expressions:
+ *   comparisons (=, !=, <, <=, >, >=) combined with AND, OR, NOT
+ *   expr [NOT] BETWEEN low AND high
+ *   expr [NOT] IN (val1, val2, ...)
+ *   ? in place of a value, bound before the statement runs (see prepared.hpp)
+ *   table.column wherever a column can go, needed in a join for a name both tables have
+ *
+ * Aggregates:
+ *   COUNT(*), COUNT(col), SUM(col), AVG(col), MIN(col), MAX(col) in the SELECT list
+ *
+ * Statistics:
+ *   ANALYZE [table_name]
+ *
+ * Plans:
+ *   EXPLAIN statement          the plan and compiled program, without running it
+ *   EXPLAIN ANALYZE statement  runs it, profiling each instruction (see vm_profile)
+ *
  * Transaction Control:
  *   BEGIN
  *   COMMIT
@@ -37,6 +58,7 @@
 #include "catalog.hpp"
 #include "common.hpp"
 #include "arena.hpp"
+#include "os_layer.hpp"
 #include "types.hpp"
 
 enum EXPR_TYPE : uint8_t
@@ -45,7 +67,8 @@ enum EXPR_TYPE : uint8_t
 	EXPR_COLUMN,	  // Column reference
 	EXPR_BINARY_OP,	  // Binary operation (comparison or logical)
 	EXPR_UNARY_OP,	  // Unary operation (NOT, -)
-	EXPR_NULL		  // NULL literal
+	EXPR_NULL,		  // NULL literal
+	EXPR_PARAMETER	  // '?' placeholder
 };
 
 enum BINARY_OP : uint8_t
@@ -61,12 +84,35 @@ enum BINARY_OP : uint8_t
 	OP_OR
 };
 
+enum AGGREGATE_FUNCTION : uint8_t
+{
+	AGG_NONE = 0, // A plain column
+	AGG_COUNT,
+	AGG_SUM,
+	AGG_AVG,
+	AGG_MIN,
+	AGG_MAX
+};
+
 enum UNARY_OP : uint8_t
 {
 	OP_NOT = 0,
 	OP_NEG
 };
 
+/*
+ * Where a '?' gets its value. Copies of the placeholder's node (see BETWEEN)
+ * share it, the semantic pass types it from what it's compared with and the
+ * compiler gives it a buffer that the program loads from, so binding a new
+ * value doesn't need a recompile
+ */
+struct parameter_slot
+{
+	uint32_t  index;
+	data_type type;	 // TYPE_NULL until resolved
+	uint8_t	 *value; // type_size(type) bytes, nullptr until compiled
+};
+
 struct expr_node
 {
 	EXPR_TYPE type;
@@ -75,6 +121,7 @@ struct expr_node
 	{
 		data_type resolved_type = TYPE_NULL;
 		int32_t	  column_index = -1;
+		uint32_t  table_index = 0; // In a join, 0 for the FROM table, 1 for the JOIN table
 	} sem;
 
 	union {
@@ -105,6 +152,11 @@ struct expr_node
 			UNARY_OP   unary_op;
 			expr_node *operand;
 		};
+
+		struct
+		{
+			parameter_slot *parameter;
+		};
 	};
 };
 
@@ -116,9 +168,13 @@ enum STMT_TYPE : uint8_t
 	STMT_DELETE,
 	STMT_CREATE_TABLE,
 	STMT_DROP_TABLE,
+	STMT_CREATE_INDEX,
+	STMT_DROP_INDEX,
 	STMT_BEGIN,
 	STMT_COMMIT,
-	STMT_ROLLBACK
+	STMT_ROLLBACK,
+	STMT_COPY,
+	STMT_ANALYZE
 };
 
 struct attribute_node
@@ -135,17 +191,29 @@ struct attribute_node
 struct select_stmt
 {
 	bool							is_star;		 // SELECT *
-	array<string_view, query_arena> columns;		 // Column names (if not *)
+	array<string_view, query_arena> columns;		 // Column names (if not *), "*" for COUNT(*)
+	array<AGGREGATE_FUNCTION, query_arena> column_aggregates; // Of each column, AGG_NONE for none
 	string_view						table_name;		 // FROM table
+	string_view						join_table;		 // Optional JOIN table, empty without one
+	expr_node					   *join_condition;	 // Its ON
 	expr_node					   *where_clause;	 // Optional WHERE
+	string_view						group_by_column; // Optional GROUP BY column
 	string_view						order_by_column; // Optional ORDER BY column
 	bool							order_desc;		 // DESC if true, ASC if false
+	bool							has_limit;		 // LIMIT n [OFFSET m]
+	uint32_t						limit;
+	uint32_t						offset;
 
 	struct
 	{
-		array<int32_t, query_arena>	  column_indices;
+		array<int32_t, query_arena>	  column_indices; // An aggregate's argument, -1 for COUNT(*)
+		array<uint32_t, query_arena>  column_tables; // table_index of each column, see expr_node
 		array<data_type, query_arena> column_types;
 		int32_t						  order_by_index = -1;
+		uint32_t					  order_by_table = 0;
+		bool						  is_aggregate; // One row per group, see column_aggregates
+		int32_t						  group_by_index = -1; // -1 for the one group of every row
+		uint32_t					  group_by_table = 0;
 
 		tuple_format rb_format; // For ORDER BY temp table
 	} sem;
@@ -155,7 +223,8 @@ struct insert_stmt
 {
 	string_view						table_name;
 	array<string_view, query_arena> columns;
-	array<expr_node *, query_arena> values;
+	array<expr_node *, query_arena> values;	   // Every row's values, one row after another
+	uint32_t						row_count; // Rows in VALUES (...), (...), each the same width
 
 	struct
 	{
@@ -199,6 +268,45 @@ struct drop_table_stmt
 	string_view table_name;
 };
 
+struct create_index_stmt
+{
+	string_view						index_name;
+	string_view						table_name;
+	array<string_view, query_arena> columns; // Leading column, then an optional covered one
+
+	struct
+	{
+		array<int32_t, query_arena> column_indices;
+	} sem;
+};
+
+struct drop_index_stmt
+{
+	string_view index_name;
+};
+
+/*
+ * COPY table FROM 'file.csv', see copy.hpp
+ */
+struct copy_stmt
+{
+	string_view table_name;
+	string_view file_path;
+};
+
+/*
+ * ANALYZE [table], see stats.hpp
+ */
+struct analyze_stmt
+{
+	string_view table_name; // Empty for every table
+
+	struct
+	{
+		bool create_stats_table; // The first ANALYZE creates master_stats
+	} sem;
+};
+
 struct begin_stmt
 {
 };
@@ -209,10 +317,23 @@ struct rollback_stmt
 {
 };
 
+enum EXPLAIN_MODE : uint8_t
+{
+	EXPLAIN_NONE = 0,
+	EXPLAIN_PLAN,	 // EXPLAIN, the statement isn't run
+	EXPLAIN_ANALYZE, // EXPLAIN ANALYZE, run with its rows counted rather than returned
+};
+
 struct stmt_node
 {
 	STMT_TYPE	type;
 	string_view sql_stmt;
+	EXPLAIN_MODE explain;
+
+	array<parameter_slot *, query_arena> parameters; // By index, in order of appearance
+
+	// How the compiler chose to find the rows, a line for each choice, for EXPLAIN
+	array<const char *, query_arena> plan;
 
 	struct
 	{
@@ -226,9 +347,13 @@ struct stmt_node
 		delete_stmt		  delete_stmt;
 		create_table_stmt create_table_stmt;
 		drop_table_stmt	  drop_table_stmt;
+		create_index_stmt create_index_stmt;
+		drop_index_stmt	  drop_index_stmt;
 		begin_stmt		  begin_stmt;
 		commit_stmt		  commit_stmt;
 		rollback_stmt	  rollback_stmt;
+		copy_stmt		  copy_stmt;
+		analyze_stmt	  analyze_stmt;
 	};
 };
 
@@ -245,5 +370,49 @@ struct parser_result
 parser_result
 parse_sql(const char *sql);
 
+/*
+ * Statements read one at a time from a file, for scripts and dumps too large
+ * to hold. The file is read into a buffer a chunk at a time, and each call to
+ * sql_stream_next finds the next ';' outside a string or comment and parses
+ * up to it in place, the tokens and the AST's strings pointing into the
+ * buffer. So a statement's AST lives until the next call, and the caller can
+ * reset query_arena once it's run, and the script runs in the memory of its
+ * largest statement. The buffer grows for a statement longer than it.
+ */
+#define SQL_STREAM_BUFFER_SIZE (1u << 20)
+
+struct sql_stream
+{
+	os_file_handle_t file;
+	os_file_offset_t offset; // Read up to, for the readahead
+	char			*buffer; // capacity + 1, for a terminator after the statement
+	uint32_t		 capacity;
+	uint32_t		 start; // The next statement's first byte
+	uint32_t		 end;	// Of what's been read
+	uint32_t		 line;	// Of start, for errors
+	bool			 eof;
+};
+
+bool
+sql_stream_open(sql_stream *stream, const char *path, uint32_t buffer_size = SQL_STREAM_BUFFER_SIZE);
+
+/*
+ * The next statement, with one statement in the result, none at the end of
+ * the file. Empty statements, and ones that are only comments, are skipped.
+ * On an error the result says so, with the line in the file, and
+ * the stream has moved past the statement, so the caller can carry on.
+ */
+parser_result
+sql_stream_next(sql_stream *stream);
+
+void
+sql_stream_close(sql_stream *stream);
+
+const char *
+aggregate_function_name(AGGREGATE_FUNCTION function);
+
+const char *
+stmt_type_to_string(STMT_TYPE type);
+
 void
 print_ast(stmt_node *stmt);
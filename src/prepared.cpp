@@ -0,0 +1,322 @@
+/*
+ * SQL From Scratch
+ *
+ * Prepared Statements
+ *
+ * A plan is built by running the usual parse, semantic and compile passes
+ * with the query_arena redirected into the plan_arena, so everything they
+ * allocate outlives the statement. The cache is a map from normalized text
+ * to plan, dropped as a whole rather than entry by entry, whenever the
+ * catalog changes or it grows past its limits.
+ */
+
+#include "prepared.hpp"
+#include "arena.hpp"
+#include "catalog.hpp"
+#include "compile.hpp"
+#include "pager.hpp"
+#include "parser.hpp"
+#include "semantic.hpp"
+#include "session.hpp"
+#include "types.hpp"
+#include "vm.hpp"
+#include <cassert>
+#include <cctype>
+#include <cstring>
+
+#define PLAN_CACHE_MAX_PLANS 128
+#define PLAN_CACHE_MAX_BYTES (4u << 20)
+
+/* The largest value a parameter can take, a VARCHAR */
+#define PARAMETER_MAX_SIZE VARCHAR_MAX_SIZE
+
+static thread_local struct {
+  hash_map<string_view, compiled_plan *, plan_arena> plans;
+  uint32_t catalog_version;
+  uint32_t generation; // Bumped on every clear, so statements notice
+} cache;
+
+/*
+ * The cache key: whitespace outside quotes collapsed to a single space, the
+ * ends trimmed and a trailing ';' dropped, so 'SELECT  * FROM t;' and
+ * 'SELECT * FROM t' share a plan. Identifiers are case sensitive, so case
+ * is kept.
+ */
+static string_view normalize_sql(string_view sql) {
+  char *out = (char *)arena<query_arena>::alloc(sql.size() + 1);
+  size_t length = 0;
+  bool in_string = false;
+  bool space = false;
+
+  for (char c : sql) {
+    if (c == '\'') {
+      in_string = !in_string;
+    }
+    if (!in_string && isspace((unsigned char)c)) {
+      space = length > 0;
+      continue;
+    }
+    if (space) {
+      out[length++] = ' ';
+      space = false;
+    }
+    out[length++] = c;
+  }
+
+  if (!in_string && length > 0 && out[length - 1] == ';') {
+    length--;
+    if (length > 0 && out[length - 1] == ' ') {
+      length--;
+    }
+  }
+
+  return string_view(out, length);
+}
+
+void plan_cache_clear() {
+  cache.plans.clear();
+  arena<plan_arena>::reset_and_decommit();
+  cache.generation++;
+}
+
+/*
+ * nullptr if it isn't a single DML statement, or doesn't parse or analyse,
+ * in which case running it the usual way reports why
+ */
+static compiled_plan *compile_plan(string_view sql) {
+  arena_redirect<query_arena, plan_arena> redirect;
+
+  char *text = (char *)arena<query_arena>::alloc(sql.size() + 1);
+  memcpy(text, sql.data(), sql.size());
+  text[sql.size()] = '\0';
+
+  parser_result result = parse_sql(text);
+  if (!result.success || result.statements.size() != 1) {
+    return nullptr;
+  }
+
+  stmt_node *stmt = result.statements[0];
+  switch (stmt->type) {
+  case STMT_SELECT:
+  case STMT_INSERT:
+  case STMT_UPDATE:
+  case STMT_DELETE:
+    break;
+  default:
+    return nullptr;
+  }
+
+  if (!semantic_analyze(stmt, true).success) {
+    return nullptr;
+  }
+
+  array<vm_instruction, query_arena> program = compile_program(stmt);
+  if (program.size() == 0) {
+    return nullptr;
+  }
+
+  compiled_plan *plan =
+      (compiled_plan *)arena<query_arena>::alloc(sizeof(compiled_plan));
+  plan->sql = string_view(text, sql.size());
+  plan->stmt = stmt;
+  plan->program = program.data();
+  plan->program_size = program.size();
+  return plan;
+}
+
+compiled_plan *plan_cache_get(string_view sql) {
+  arena<plan_arena>::init();
+
+  if (cache.catalog_version != catalog_version) {
+    plan_cache_clear();
+    cache.catalog_version = catalog_version;
+  }
+
+  string_view key = normalize_sql(sql);
+  compiled_plan **cached = cache.plans.get(key);
+  if (cached) {
+    return *cached;
+  }
+
+  if (cache.plans.size() >= PLAN_CACHE_MAX_PLANS ||
+      arena<plan_arena>::used() >= PLAN_CACHE_MAX_BYTES) {
+    plan_cache_clear();
+  }
+
+  compiled_plan *plan = compile_plan(key);
+  if (!plan) {
+    return nullptr;
+  }
+
+  cache.plans.insert(plan->sql, plan);
+  return plan;
+}
+
+struct parameter_binding {
+  data_type type; // TYPE_NULL until bound
+  uint8_t value[PARAMETER_MAX_SIZE];
+};
+
+struct prepared_statement {
+  string_view sql;
+  compiled_plan *plan;
+  uint32_t generation; // Of the cache the plan came from
+  uint32_t parameter_count;
+  parameter_binding *bindings;
+};
+
+/*
+ * The plan is only good for the cache generation it came from, after that
+ * the text is compiled again, against the catalog as it is now
+ */
+static bool refresh_plan(prepared_statement *stmt) {
+  if (stmt->plan && stmt->generation == cache.generation &&
+      cache.catalog_version == catalog_version) {
+    return true;
+  }
+
+  stmt->plan = plan_cache_get(stmt->sql);
+  stmt->generation = cache.generation;
+  return stmt->plan != nullptr;
+}
+
+prepared_statement *sql_prepare(string_view sql) {
+  session_statement statement;
+  if (statement.failed) {
+    return nullptr;
+  }
+
+  compiled_plan *plan = plan_cache_get(sql);
+  if (!plan) {
+    return nullptr;
+  }
+
+  prepared_statement *stmt = (prepared_statement *)arena<global_arena>::alloc(
+      sizeof(prepared_statement));
+  stmt->sql = arena_intern<global_arena>(plan->sql);
+  stmt->plan = plan;
+  stmt->generation = cache.generation;
+  stmt->parameter_count = plan->stmt->parameters.size();
+  stmt->bindings = (parameter_binding *)arena<global_arena>::alloc(
+      stmt->parameter_count * sizeof(parameter_binding));
+  sql_reset(stmt);
+  return stmt;
+}
+
+uint32_t sql_parameter_count(prepared_statement *stmt) {
+  return stmt->parameter_count;
+}
+
+/*
+ * The binding for index, if a value of type and size can go there. A string
+ * takes the TEXT or VARCHAR type of where it goes.
+ */
+static parameter_binding *binding_for(prepared_statement *stmt, uint32_t index,
+                                      data_type type, uint32_t size) {
+  session_statement statement;
+  if (statement.failed || index >= stmt->parameter_count ||
+      !refresh_plan(stmt)) {
+    return nullptr;
+  }
+
+  parameter_slot *slot = stmt->plan->stmt->parameters[index];
+  if (type_is_string(type) && type_is_string(slot->type)) {
+    type = slot->type;
+  }
+  if ((slot->type != TYPE_NULL && slot->type != type) ||
+      size > type_size(type)) {
+    return nullptr;
+  }
+
+  parameter_binding *binding = &stmt->bindings[index];
+  binding->type = type;
+  memset(binding->value, 0, sizeof(binding->value));
+  return binding;
+}
+
+bool sql_bind_int(prepared_statement *stmt, uint32_t index, uint32_t value) {
+  parameter_binding *binding =
+      binding_for(stmt, index, TYPE_U32, sizeof(value));
+  if (!binding) {
+    return false;
+  }
+
+  memcpy(binding->value, &value, sizeof(value));
+  return true;
+}
+
+bool sql_bind_text(prepared_statement *stmt, uint32_t index,
+                   string_view value) {
+  parameter_binding *binding =
+      binding_for(stmt, index, TYPE_CHAR32, value.size());
+  if (!binding) {
+    return false;
+  }
+
+  memcpy(binding->value, value.data(), value.size());
+  return true;
+}
+
+static void discard_row(typed_value *values, size_t count) {}
+
+/*
+ * Runs the statement to completion, handing each row to callback. Like the
+ * REPL, a mutation outside a transaction gets one of its own, and a read
+ * session can only run a SELECT.
+ */
+VM_RESULT sql_step(prepared_statement *stmt, result_callback callback) {
+  session_statement statement;
+  if (statement.failed || !refresh_plan(stmt)) {
+    return ERR;
+  }
+
+  compiled_plan *plan = stmt->plan;
+  if (session_is_reader() && plan->stmt->type != STMT_SELECT) {
+    return ERR;
+  }
+  for (uint32_t i = 0; i < stmt->parameter_count; i++) {
+    parameter_slot *slot = plan->stmt->parameters[i];
+    parameter_binding &binding = stmt->bindings[i];
+    if (binding.type == TYPE_NULL ||
+        (slot->type != TYPE_NULL && slot->type != binding.type)) {
+      return ERR;
+    }
+    if (slot->value) {
+      memcpy(slot->value, binding.value, type_size(slot->type));
+    }
+  }
+
+  vm_set_result_callback(callback ? callback : discard_row);
+
+  bool injected_transaction =
+      plan->stmt->type != STMT_SELECT && !pager_in_transaction();
+  if (injected_transaction) {
+    pager_begin_transaction();
+  }
+
+  VM_RESULT result = vm_execute(plan->program, plan->program_size);
+
+  if (injected_transaction) {
+    if (result == OK) {
+      pager_commit_grouped();
+      catalog_commit();
+    } else {
+      pager_rollback();
+      catalog_rollback();
+    }
+  }
+  return result;
+}
+
+void sql_reset(prepared_statement *stmt) {
+  for (uint32_t i = 0; i < stmt->parameter_count; i++) {
+    stmt->bindings[i].type = TYPE_NULL;
+  }
+}
+
+void sql_finalize(prepared_statement *stmt) {
+  arena_reclaim_string<global_arena>(stmt->sql);
+  arena<global_arena>::reclaim(stmt->bindings, stmt->parameter_count *
+                                                   sizeof(parameter_binding));
+  arena<global_arena>::reclaim(stmt, sizeof(prepared_statement));
+}
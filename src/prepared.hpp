@@ -0,0 +1,73 @@
+/*
+ * SQL From Scratch
+ *
+ * Prepared Statements
+ *
+ * For a statement that only touches a row or two, parsing, analysing and
+ * compiling it costs more than running it. So compiled programs are kept,
+ * keyed on the statement's text, and run again when the same text comes
+ * back. Values can be left as '?' and bound before each run:
+ *
+ *   prepared_statement *insert = sql_prepare("INSERT INTO users VALUES (?, ?, ?, ?)");
+ *   sql_bind_int(insert, 0, 101);
+ *   sql_bind_text(insert, 1, "bob");
+ *   ...
+ *   sql_step(insert);
+ *   sql_reset(insert);
+ *   ...
+ *   sql_finalize(insert);
+ *
+ * Programs load parameters from buffers rather than holding copies of them
+ * (see parameter_slot), so binding is just a copy into those buffers.
+ *
+ * Only SELECT, INSERT, UPDATE and DELETE are cached. A plan holds pointers
+ * into the catalog, so the whole cache is dropped once catalog_version moves.
+ *
+ * Each thread has a cache of its own, so a read session (see session.hpp)
+ * never runs a plan another thread is running.
+ */
+
+#pragma once
+
+#include "arena.hpp"
+#include "parser.hpp"
+#include "vm.hpp"
+
+/*
+ * Plans, and the ASTs and strings they point to, live here rather than the
+ * query_arena, which is reset after every statement
+ */
+struct plan_arena
+{
+};
+template <> inline constexpr bool arena_per_thread<plan_arena> = true;
+
+struct compiled_plan
+{
+	string_view		sql; // Normalized, see normalize_sql
+	stmt_node	   *stmt;
+	vm_instruction *program;
+	uint32_t		program_size;
+};
+
+compiled_plan *
+plan_cache_get(string_view sql);
+void
+plan_cache_clear();
+
+struct prepared_statement;
+
+prepared_statement *
+sql_prepare(string_view sql);
+uint32_t
+sql_parameter_count(prepared_statement *stmt);
+bool
+sql_bind_int(prepared_statement *stmt, uint32_t index, uint32_t value);
+bool
+sql_bind_text(prepared_statement *stmt, uint32_t index, string_view value);
+VM_RESULT
+sql_step(prepared_statement *stmt, result_callback callback = nullptr);
+void
+sql_reset(prepared_statement *stmt);
+void
+sql_finalize(prepared_statement *stmt);
@@ -11,13 +11,17 @@
 #include "common.hpp"
 #include "compile.hpp"
 #include "demo.hpp"
-#include "os_layer.hpp"
+#include "hashtable.hpp"
 #include "pager.hpp"
+#include "parallel.hpp"
 #include "parser.hpp"
+#include "prepared.hpp"
 #include "semantic.hpp"
+#include "sorter.hpp"
 #include "types.hpp"
 #include "vm.hpp"
 #include <cassert>
+#include <cctype>
 #include <chrono>
 #include <cstdio>
 #include <cstring>
@@ -56,56 +60,51 @@ static int get_column_width(data_type type) {
     return 15;
   }
 }
+/*
+ * The semantic pass resolved every output column, SELECT * included, to a
+ * table of the query and a column of it, an aggregate's being its argument
+ */
 static void print_select_headers(select_stmt *select_stmt) {
-  relation *table = catalog.get(select_stmt->table_name);
-  if (!table) {
-    return;
+  relation *tables[2] = {catalog_get(select_stmt->table_name), nullptr};
+  if (!select_stmt->join_table.empty()) {
+    tables[1] = catalog_get(select_stmt->join_table);
   }
 
   printf("\n");
 
-  if (select_stmt->is_star) {
-    for (uint32_t i = 0; i < table->columns.size(); i++) {
-      int width = get_column_width(table->columns[i].type);
-      printf("%-*s  ", width, table->columns[i].name);
+  for (uint32_t i = 0; i < select_stmt->sem.column_indices.size(); i++) {
+    int width = get_column_width(select_stmt->sem.column_types[i]);
+    AGGREGATE_FUNCTION aggregate = AGG_NONE;
+    if (!select_stmt->is_star) {
+      aggregate = select_stmt->column_aggregates[i];
     }
-    printf("\n");
 
-    for (uint32_t i = 0; i < table->columns.size(); i++) {
-      int width = get_column_width(table->columns[i].type);
-      for (int j = 0; j < width; j++) {
-        printf("-");
-      }
-      printf("  ");
-    }
-    printf("\n");
-  } else {
-    for (uint32_t i = 0; i < select_stmt->sem.column_indices.size(); i++) {
-      uint32_t col_idx = select_stmt->sem.column_indices[i];
-      const char *name = table->columns[col_idx].name;
-      data_type type = table->columns[col_idx].type;
-
-      int width = get_column_width(type);
-      printf("%-*s  ", width, name);
+    if (aggregate != AGG_NONE) {
+      string_view argument = select_stmt->columns[i];
+      char label[96];
+      snprintf(label, sizeof(label), "%s(%.*s)",
+               aggregate_function_name(aggregate), (int)argument.size(),
+               argument.data());
+      printf("%-*s  ", width, label);
+      continue;
     }
-    printf("\n");
 
-    for (uint32_t i = 0; i < select_stmt->sem.column_indices.size(); i++) {
-      uint32_t col_idx = select_stmt->sem.column_indices[i];
-      data_type type = table->columns[col_idx].type;
+    relation *table = tables[select_stmt->sem.column_tables[i]];
+    attribute &column = table->columns[select_stmt->sem.column_indices[i]];
+    printf("%-*s  ", width, column.name);
+  }
+  printf("\n");
 
-      int width = get_column_width(type);
-      for (int j = 0; j < width; j++) {
-        printf("-");
-      }
-      printf("  ");
+  for (uint32_t i = 0; i < select_stmt->sem.column_indices.size(); i++) {
+    int width = get_column_width(select_stmt->sem.column_types[i]);
+    for (int j = 0; j < width; j++) {
+      printf("-");
     }
-    printf("\n");
+    printf("  ");
   }
+  printf("\n");
 }
 
-
-
 void formatted_result_callback(typed_value *result, size_t count) {
   for (size_t i = 0; i < count; i++) {
     int width = get_column_width(result->type);
@@ -135,6 +134,13 @@ void formatted_result_callback(typed_value *result, size_t count) {
       const char *str = result[i].as_char();
       str = str ? str : "NULL";
 
+      // As long as it is, it needn't be terminated, padded like the header
+      if (type_id(result[i].type) == TYPE_ID_VARCHAR) {
+        int length = (int)strnlen(str, type_size(result[i].type));
+        printf("%-*.*s  ", get_column_width(result[i].type), length, str);
+        break;
+      }
+
       // Extract the exact size from the type for CHAR types
       int exact_size = 0;
       switch (result[i].type) {
@@ -186,103 +192,417 @@ void formatted_result_callback(typed_value *result, size_t count) {
   printf("\n");
 }
 
-bool execute_sql_statements(const char *sql) {
-  bool in_explicit_transaction = false;
-  parser_result result = parse_sql(sql);
-  if (!result.success) {
-    printf("%s\n", result.error.data());
-    return false;
+static void discard_rows(typed_value *result, size_t count) {}
+
+static void print_plan(stmt_node *stmt) {
+  printf("QUERY PLAN\n");
+  for (const char *line : stmt->plan) {
+    printf("  %s\n", line);
+  }
+  if (stmt->plan.size() == 0) {
+    printf("  %s\n", stmt_type_to_string(stmt->type));
   }
+  printf("\n");
+}
 
-  for (auto &stmt : result.statements) {
-    semantic_result res = semantic_analyze(stmt, true);
-    if (!res.success) {
-      printf("%s\n", res.error.data());
-      if (in_explicit_transaction) {
+/*
+ * Runs an analysed statement's program. in_explicit_transaction is whether a
+ * BEGIN earlier in the input is still open. A SELECT's rows go to callback,
+ * or are printed as a table without one.
+ *
+ * EXPLAIN prints the plan and program instead of running it. EXPLAIN ANALYZE
+ * runs it as usual, changes and all, but its rows are only counted, then
+ * prints what each instruction did.
+ */
+static bool run_statement(stmt_node *stmt, vm_instruction *program,
+                          uint32_t program_size, bool in_explicit_transaction,
+                          const char *sql, result_callback callback) {
+  bool needs_transaction = false;
+  bool injected_transaction = false;
+
+  if (stmt->explain == EXPLAIN_PLAN) {
+    print_plan(stmt);
+    printf("PROGRAM\n");
+    for (uint32_t pc = 0; pc < program_size; pc++) {
+      vm_debug_print_instruction(&program[pc], pc);
+    }
+    return true;
+  }
+
+  switch (stmt->type) {
+  case STMT_INSERT:
+  case STMT_UPDATE:
+  case STMT_DELETE:
+  case STMT_CREATE_TABLE:
+  case STMT_DROP_TABLE:
+  case STMT_CREATE_INDEX:
+  case STMT_DROP_INDEX:
+  case STMT_COPY:
+  case STMT_ANALYZE:
+    needs_transaction = true;
+    break;
+  default:
+    break;
+  }
+
+  /*
+   * All mutations take place within a transaction, because a single row
+   * deletion might cause a cascade of btree modifications that all need to be
+   * done as one atomic unit. So there are explicit transactions (those with
+   * 'BEGIN;') and implicit ones, which are injected before and and after a
+   * mutating statement, if we're not already in an explicit transaction.
+   */
+  if (needs_transaction && !in_explicit_transaction) {
+    pager_begin_transaction();
+    injected_transaction = true;
+  }
+
+  vm_profile profile;
+  vm_profile *profiling = nullptr;
+  if (stmt->explain == EXPLAIN_ANALYZE) {
+    vm_set_result_callback(discard_rows, true);
+    profiling = &profile;
+  } else if (stmt->type == STMT_SELECT && callback) {
+    vm_set_result_callback(callback);
+  } else if (stmt->type == STMT_SELECT) {
+    print_select_headers(&stmt->select_stmt);
+    vm_set_result_callback(formatted_result_callback);
+  }
+
+  VM_RESULT vm_result = vm_execute(program, program_size, profiling);
+  if (profiling && vm_result == OK) {
+    print_plan(stmt);
+    vm_print_profile(program, program_size, profiling);
+  }
+  if (vm_result != OK) {
+    /*
+     * The catalog might have been mutated during the transaction
+     * aka, drop table users -> catalog.remove('users'); so
+     * we need to undo those changes too
+     */
+    if (vm_result == ABORT) {
+      catalog_rollback();
+    } else {
+      printf("❌ Execution failed: %s\n", sql);
+      if (in_explicit_transaction || injected_transaction) {
         pager_rollback();
+        catalog_rollback();
       }
       return false;
     }
+  }
 
-    if (stmt->type == STMT_BEGIN) {
-      in_explicit_transaction = true;
-    } else if (stmt->type == STMT_COMMIT || stmt->type == STMT_ROLLBACK) {
-      in_explicit_transaction = false;
+  /*
+   * Implicit transactions may be batched into one durable commit, see
+   * .group_commit. Either way the statement is committed, so a later one
+   * failing doesn't undo its schema changes.
+   */
+  if (injected_transaction) {
+    pager_commit_grouped();
+    catalog_commit();
+  }
+  return true;
+}
+
+/*
+ * Whether the input is one SELECT, INSERT, UPDATE or DELETE, which are the
+ * statements the plan cache keeps
+ */
+static bool is_single_dml(const char *sql) {
+  uint32_t semicolons = 0;
+  bool in_string = false;
+  const char *last = sql;
+  for (const char *c = sql; *c; c++) {
+    if (*c == '\'') {
+      in_string = !in_string;
+    } else if (!in_string && *c == ';') {
+      semicolons++;
+      last = c;
     }
+  }
 
-    bool needs_transaction = false;
-    bool injected_transaction = false;
+  if (semicolons > 1 || (semicolons == 1 && last[1 + strspn(last + 1, " \t")])) {
+    return false;
+  }
 
-    switch (stmt->type) {
-    case STMT_INSERT:
-    case STMT_UPDATE:
-    case STMT_DELETE:
-    case STMT_CREATE_TABLE:
-    case STMT_DROP_TABLE:
-      needs_transaction = true;
-      break;
-    default:
-      break;
+  sql += strspn(sql, " \t");
+  const char *keywords[] = {"SELECT", "INSERT", "UPDATE", "DELETE"};
+  for (const char *keyword : keywords) {
+    size_t length = 0;
+    while (keyword[length] && toupper((unsigned char)sql[length]) == keyword[length]) {
+      length++;
+    }
+    if (!keyword[length] && !isalnum((unsigned char)sql[length]) &&
+        sql[length] != '_') {
+      return true;
     }
+  }
+  return false;
+}
 
-    /*
-     * All mutations take place within a transaction, because a single row
-     * deletion might cause a cascade of btree modifications that all need to be
-     * done as one atomic unit. So there are explicit transactions (those with
-     * 'BEGIN;') and implicit ones, which are injected before and and after a
-     * mutating statement, if we're not already in an explicit transaction.
-     */
-    if (needs_transaction && !in_explicit_transaction) {
-      pager_begin_transaction();
-      injected_transaction = true;
+/*
+ * Whether the statement changes the catalog, which read sessions then wait
+ * for until it commits, see catalog.hpp
+ */
+static bool changes_schema(stmt_node *stmt) {
+  if (stmt->explain == EXPLAIN_PLAN) {
+    return false;
+  }
+
+  switch (stmt->type) {
+  case STMT_CREATE_TABLE:
+  case STMT_DROP_TABLE:
+  case STMT_CREATE_INDEX:
+  case STMT_DROP_INDEX:
+  case STMT_ANALYZE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/*
+ * Analyzes, compiles and runs one parsed statement, tracking whether it
+ * leaves an explicit transaction open
+ */
+static bool execute_statement(stmt_node *stmt, bool *in_explicit_transaction,
+                              const char *sql, result_callback callback) {
+  if (stmt->parameters.size() > 0) {
+    printf("Can't run a statement with '?' parameters, prepare and bind "
+           "it (see prepared.hpp)\n");
+    if (*in_explicit_transaction) {
+      pager_rollback();
+      catalog_rollback();
     }
+    return false;
+  }
+
+  if (changes_schema(stmt)) {
+    catalog_lock_exclusive();
+  }
 
-    if (stmt->type == STMT_SELECT) {
-      print_select_headers(&stmt->select_stmt);
-      vm_set_result_callback(formatted_result_callback);
+  semantic_result res = semantic_analyze(stmt, true);
+  if (!res.success) {
+    printf("%s\n", res.error.data());
+    if (*in_explicit_transaction) {
+      pager_rollback();
+      catalog_rollback();
     }
+    return false;
+  }
 
-    array<vm_instruction, query_arena> program = compile_program(stmt);
-    if (program.size() == 0) {
-      printf("Compilation failed: %s\n", sql);
-      if (injected_transaction) {
-        pager_rollback();
+  if (stmt->explain == EXPLAIN_PLAN) {
+    // Nothing's run, so no transaction starts or ends
+  } else if (stmt->type == STMT_BEGIN) {
+    *in_explicit_transaction = true;
+  } else if (stmt->type == STMT_COMMIT || stmt->type == STMT_ROLLBACK) {
+    *in_explicit_transaction = false;
+  }
+
+  array<vm_instruction, query_arena> program = compile_program(stmt);
+  if (program.size() == 0) {
+    printf("Compilation failed: %s\n", sql);
+    return false;
+  }
+
+  return run_statement(stmt, program.data(), program.size(),
+                       *in_explicit_transaction, sql, callback);
+}
+
+static bool execute_statements(const char *sql, result_callback callback) {
+  /*
+   * A statement seen before skips straight to its compiled program, see
+   * prepared.hpp. Anything the cache won't take, or that fails to compile,
+   * goes the long way round, which reports the errors.
+   */
+  if (is_single_dml(sql)) {
+    compiled_plan *plan = plan_cache_get(sql);
+    if (plan && plan->stmt->parameters.size() == 0) {
+      bool success =
+          run_statement(plan->stmt, plan->program, plan->program_size,
+                        pager_in_transaction(), sql, callback);
+      if (success && !callback) {
+        printf("\n");
       }
+      return success;
+    }
+  }
+
+  // A BEGIN in an earlier input (a REPL line, a server request) still counts
+  bool in_explicit_transaction = pager_in_transaction();
+  parser_result result = parse_sql(sql);
+  if (!result.success) {
+    printf("%s\n", result.error.data());
+    return false;
+  }
+
+  for (auto &stmt : result.statements) {
+    if (!execute_statement(stmt, &in_explicit_transaction, sql, callback)) {
       return false;
     }
+  }
+  if (!callback) {
+    printf("\n");
+  }
 
-    VM_RESULT vm_result = vm_execute(program.data(), program.size());
-    if (vm_result != OK) {
-      /*
-       * The catalog might have been mutated during the transaction
-       * aka, drop table users -> catalog.remove('users'); so
-       * we need to reload the catalog
-       */
-      if (vm_result == ABORT) {
-        catalog_reload();
-      } else {
-        printf("❌ Execution failed: %s\n", sql);
-        if (in_explicit_transaction || injected_transaction) {
-          pager_rollback();
-          catalog_reload();
-        }
-        return false;
+  return true;
+}
+
+bool execute_sql_statements(const char *sql, result_callback callback) {
+  bool success = execute_statements(sql, callback);
+  if (!pager_in_transaction()) {
+    catalog_unlock_exclusive();
+  }
+  return success;
+}
+
+bool execute_sql_file(const char *path, result_callback callback,
+                      uint64_t *statements) {
+  sql_stream stream;
+  if (!sql_stream_open(&stream, path)) {
+    printf("Couldn't open %s\n", path);
+    return false;
+  }
+
+  bool in_explicit_transaction = pager_in_transaction();
+  bool success = true;
+  uint64_t count = 0;
+  while (success) {
+    uint32_t line = stream.line;
+    parser_result result = sql_stream_next(&stream);
+    if (!result.success) {
+      printf("%s:%d: %s\n", path, result.error_line, result.error.data());
+      success = false;
+    } else if (result.statements.size() == 0) {
+      break;
+    } else {
+      stmt_node *stmt = result.statements[0];
+      success = execute_statement(stmt, &in_explicit_transaction,
+                                  stmt->sql_stmt.data(), callback);
+      if (!success) {
+        printf("%s: stopped at the statement after line %u\n", path, line);
       }
+      count += success;
     }
 
-    if (injected_transaction) {
-      pager_commit();
+    if (!pager_in_transaction()) {
+      catalog_unlock_exclusive();
     }
+    arena<query_arena>::reset();
   }
-  printf("\n");
 
-  return true;
+  sql_stream_close(&stream);
+  if (statements) {
+    *statements = count;
+  }
+  return success;
+}
+
+static void print_histogram(const char *name, const pager_histogram *histogram) {
+  if (histogram->samples == 0) {
+    printf("  %-22s none\n", name);
+    return;
+  }
+
+  printf("  %-22s %llu, avg %llu us, max %llu us\n", name,
+         (unsigned long long)histogram->samples,
+         (unsigned long long)(histogram->total_us / histogram->samples),
+         (unsigned long long)histogram->max_us);
+
+  for (uint32_t i = 0; i < PAGER_HISTOGRAM_BUCKETS; i++) {
+    if (histogram->buckets[i] == 0) {
+      continue;
+    }
+    if (i == PAGER_HISTOGRAM_BUCKETS - 1) {
+      printf("    >= %-8llu us  %llu\n", 1ULL << (i - 1),
+             (unsigned long long)histogram->buckets[i]);
+    } else {
+      printf("    <  %-8llu us  %llu\n", 1ULL << i,
+             (unsigned long long)histogram->buckets[i]);
+    }
+  }
+}
+
+/*
+ * .stats [reset], the counters since open or the last reset
+ */
+static void print_pager_stats(bool reset) {
+  pager_meta stats = pager_get_stats(reset);
+  const pager_io_stats &io = stats.io;
+
+  uint64_t lookups = io.cache_hits + io.map_hits + io.cache_misses;
+  double hit_rate =
+      lookups ? 100.0 * (io.cache_hits + io.map_hits) / lookups : 100.0;
+
+  printf("Pages:\n");
+  printf("  %-22s %u (%u free)\n", "total", stats.total_pages,
+         stats.free_pages);
+  printf("  %-22s %u/%u (%u dirty, %u pinned)\n", "cached", stats.cached_pages,
+         stats.cache_capacity, stats.dirty_pages, stats.pinned_pages);
+  printf("  %-22s %u\n", "mapped", stats.mapped_pages);
+  printf("  %-22s %u\n", "wal frames", stats.wal_frames);
+  printf("  %-22s %u\n", "snapshots", stats.snapshots);
+
+  printf("Cache:\n");
+  printf("  %-22s %llu (%.1f%%)\n", "hits",
+         (unsigned long long)(io.cache_hits + io.map_hits), hit_rate);
+  printf("  %-22s %llu\n", "  from the mapping",
+         (unsigned long long)io.map_hits);
+  printf("  %-22s %llu\n", "misses", (unsigned long long)io.cache_misses);
+  printf("  %-22s %llu clean, %llu dirty\n", "evictions",
+         (unsigned long long)io.clean_evictions,
+         (unsigned long long)io.dirty_evictions);
+  print_histogram("miss latency", &io.miss_latency);
+
+  printf("I/O:\n");
+  printf("  %-22s %llu bytes\n", "read", (unsigned long long)io.bytes_read);
+  printf("  %-22s %llu bytes\n", "written",
+         (unsigned long long)io.bytes_written);
+  printf("  %-22s %llu\n", "data pages written",
+         (unsigned long long)io.pages_written);
+  printf("  %-22s %llu\n", "journal pages written",
+         (unsigned long long)io.journal_pages);
+  printf("  %-22s %llu\n", "wal frames written",
+         (unsigned long long)io.wal_frames_written);
+  print_histogram("fsyncs", &io.sync_latency);
+
+  printf("Transactions:\n");
+  printf("  %-22s %llu\n", "ended", (unsigned long long)io.transactions);
+  printf("  %-22s %llu read, %llu written\n", "last, bytes",
+         (unsigned long long)io.tx_bytes_read,
+         (unsigned long long)io.tx_bytes_written);
+
+  if (reset) {
+    printf("(counters reset)\n");
+  }
+}
+
+/*
+ * .arena, how much memory statements have been using, see arena_stats
+ */
+static void print_arena_stats() {
+  arena_stats stats = arena<query_arena>::stats();
+  printf("Query arena:\n");
+  printf("  %-22s %zu KB\n", "peak", stats.peak / 1024);
+  printf("  %-22s %zu KB\n", "committed", stats.committed / 1024);
+  printf("  %-22s %llu\n", "commits", (unsigned long long)stats.commits);
+  printf("  %-22s %llu\n", "decommits", (unsigned long long)stats.decommits);
+  printf("  %-22s %llu\n", "resets", (unsigned long long)stats.resets);
+}
+
+/*
+ * The catalog is saved on the way out so the next start needn't parse it, see
+ * catalog.hpp
+ */
+static void close_database() {
+  catalog_snapshot_save();
+  pager_close();
 }
 
 void run_meta_command(const char *cmd) {
   if (strcmp(cmd, ".quit") == 0 || strcmp(cmd, ".exit") == 0) {
     printf("Goodbye!\n");
-    pager_close();
+    close_database();
     exit(0);
   } else if (strcmp(cmd, ".help") == 0) {
     printf("Available commands:\n");
@@ -294,6 +614,18 @@ void run_meta_command(const char *cmd) {
     printf("  .btree <table>    Dump btree\n");
     printf("  .debug            Toggle debug mode\n");
     printf("  .reload           Reload catalog from disk\n");
+    printf("  .group_commit <ms> [pages] | off\n");
+    printf("                    Batch implicit commits within a window\n");
+    printf("  .checkpoint       Copy the WAL back into the database file\n");
+    printf("  .mmap <MB> | off  Read pages through a memory map of the file\n");
+    printf("  .cache 2q | lru   Set the page cache replacement policy\n");
+    printf("  .sort_memory <KB> Memory an ORDER BY sorts in before spilling to disk\n");
+    printf("  .join_memory <KB> Memory a hash join builds in before partitioning to disk\n");
+    printf("  .parallel <n>     Worker threads for full table scans, 1 to scan serially\n");
+    printf("  .stats [reset]    Show pager and I/O counters, optionally zeroing them\n");
+    printf("  .arena            Show the query arena's peak, committed memory and counters\n");
+    printf("  .read <file>      Run a SQL script a statement at a time\n");
+    printf("  .vacuum [pages]   Compact the file, moving at most 'pages' pages\n");
     printf("  .demo_like            %LIKE% demo\n");
     printf("  .demo_group           grouping demo\n");
     printf("  .demo_join            join demo\n");
@@ -307,6 +639,7 @@ void run_meta_command(const char *cmd) {
     printf("\nTables:\n");
     printf("-------\n");
 
+    catalog_load_all();
     for (auto [name, relation] : catalog) {
       printf("  %.*s (%d columns)\n", (int)name.length(), name.c_str(),
              relation.columns.size());
@@ -347,7 +680,7 @@ void run_meta_command(const char *cmd) {
     printf("\n");
   } else if (strncmp(cmd, ".btree ", 7) == 0) {
     const char *table_name = cmd + 7;
-    relation *s = catalog.get(table_name);
+    relation *s = catalog_get(table_name);
     if (s) {
       bt_print(&s->storage.btree);
     } else {
@@ -355,7 +688,7 @@ void run_meta_command(const char *cmd) {
     }
   } else if (strncmp(cmd, ".schema ", 8) == 0) {
     const char *table_name = cmd + 8;
-    relation *s = catalog.get(table_name);
+    relation *s = catalog_get(table_name);
     if (s) {
       printf("\nSchema for %s:\n", table_name);
       printf("--------------\n");
@@ -363,10 +696,119 @@ void run_meta_command(const char *cmd) {
         printf("  %-20s %s\n", s->columns[i].name,
                type_name(s->columns[i].type));
       }
+      for (auto &index : s->indexes) {
+        printf("  index %-14s (%s%s%s)\n", index.name,
+               s->columns[index.columns[0]].name,
+               index.column_count > 1 ? ", " : "",
+               index.column_count > 1 ? s->columns[index.columns[1]].name
+                                      : "");
+      }
       printf("\n");
     } else {
       printf("Table '%s' not found\n", table_name);
     }
+  } else if (strncmp(cmd, ".group_commit", 13) == 0) {
+    const char *args = cmd[13] ? cmd + 14 : "";
+    if (strcmp(args, "off") == 0) {
+      pager_set_group_commit(0, 0);
+      printf("Group commit: OFF\n");
+    } else {
+      char *end;
+      long window_ms = strtol(args, &end, 10);
+      long max_pages = strtol(end, nullptr, 10);
+      if (end == args || window_ms <= 0 || max_pages < 0) {
+        printf("Usage: .group_commit <ms> [max_pages] | off\n");
+      } else {
+        pager_set_group_commit(window_ms, max_pages);
+        printf("Group commit: %ldms window, %ld page limit\n", window_ms,
+               max_pages);
+      }
+    }
+  } else if (strcmp(cmd, ".checkpoint") == 0) {
+    if (pager_checkpoint()) {
+      printf("Checkpoint complete\n");
+    } else {
+      printf("Can't checkpoint inside a transaction\n");
+    }
+  } else if (strncmp(cmd, ".mmap", 5) == 0) {
+    const char *args = cmd[5] ? cmd + 6 : "";
+    long megabytes = strcmp(args, "off") == 0 ? 0 : strtol(args, nullptr, 10);
+    if (megabytes < 0 || (megabytes == 0 && strcmp(args, "off") != 0)) {
+      printf("Usage: .mmap <MB> | off\n");
+    } else if (!pager_set_mmap_size((size_t)megabytes << 20)) {
+      printf("Memory mapping isn't available\n");
+    } else {
+      printf("Memory mapping: %s\n", megabytes ? args : "OFF");
+    }
+  } else if (strncmp(cmd, ".sort_memory", 12) == 0) {
+    const char *args = cmd[12] ? cmd + 13 : "";
+    long kilobytes = strtol(args, nullptr, 10);
+    if (kilobytes <= 0) {
+      printf("Usage: .sort_memory <KB>\n");
+    } else {
+      sorter_set_memory_budget((size_t)kilobytes << 10);
+      printf("Sort memory: %ld KB\n", kilobytes);
+    }
+  } else if (strncmp(cmd, ".join_memory", 12) == 0) {
+    const char *args = cmd[12] ? cmd + 13 : "";
+    long kilobytes = strtol(args, nullptr, 10);
+    if (kilobytes <= 0) {
+      printf("Usage: .join_memory <KB>\n");
+    } else {
+      ht_set_memory_budget((size_t)kilobytes << 10);
+      printf("Join memory: %ld KB\n", kilobytes);
+    }
+  } else if (strncmp(cmd, ".parallel", 9) == 0) {
+    const char *args = cmd[9] ? cmd + 10 : "";
+    long workers = strtol(args, nullptr, 10);
+    if (workers <= 0 || workers > PARALLEL_MAX_WORKERS) {
+      printf("Usage: .parallel <1-%d>\n", PARALLEL_MAX_WORKERS);
+    } else {
+      // Cached plans were compiled for the old count
+      par_set_workers((uint32_t)workers);
+      plan_cache_clear();
+      printf("Parallel workers: %ld\n", workers);
+    }
+  } else if (strcmp(cmd, ".cache 2q") == 0) {
+    pager_set_cache_policy(PAGER_CACHE_2Q);
+    printf("Cache policy: 2Q\n");
+  } else if (strcmp(cmd, ".cache lru") == 0) {
+    pager_set_cache_policy(PAGER_CACHE_LRU);
+    printf("Cache policy: LRU\n");
+  } else if (strncmp(cmd, ".cache", 6) == 0) {
+    printf("Usage: .cache 2q | lru\n");
+  } else if (strcmp(cmd, ".stats") == 0) {
+    print_pager_stats(false);
+  } else if (strcmp(cmd, ".stats reset") == 0) {
+    print_pager_stats(true);
+  } else if (strncmp(cmd, ".read ", 6) == 0) {
+    uint64_t statements = 0;
+    auto start = std::chrono::steady_clock::now();
+    bool success = execute_sql_file(cmd + 6, nullptr, &statements);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+    printf("%s %llu statements in %lld ms\n", success ? "Ran" : "Stopped after",
+           (unsigned long long)statements, (long long)ms.count());
+  } else if (strcmp(cmd, ".arena") == 0) {
+    print_arena_stats();
+  } else if (strncmp(cmd, ".vacuum", 7) == 0) {
+    long max_moves = cmd[7] ? strtol(cmd + 8, nullptr, 10) : 0;
+    if (max_moves < 0) {
+      printf("Usage: .vacuum [pages]\n");
+      return;
+    }
+
+    // Moving pages moves roots the catalog points at
+    uint32_t before = pager_get_stats().total_pages;
+    catalog_lock_exclusive();
+    pager_begin_transaction();
+    uint32_t moved = catalog_vacuum((uint32_t)max_moves);
+    pager_commit();
+    catalog_unlock_exclusive();
+
+    pager_meta stats = pager_get_stats();
+    printf("Moved %u pages, %u -> %u pages (%u free)\n", moved, before,
+           stats.total_pages, stats.free_pages);
   } else if (strcmp(cmd, ".reload") == 0) {
     catalog_reload();
     printf("Catalog reloaded from disk\n");
@@ -391,14 +833,17 @@ void run_meta_command(const char *cmd) {
   }
 }
 
-int run_repl(const char *database_path) {
+int run_repl(const char *database_path, bool wal_mode) {
   arena<query_arena>::init();
+  arena<query_arena>::set_decommit_policy(QUERY_ARENA_WATERMARK,
+                                          QUERY_ARENA_DECOMMIT_AFTER);
   arena<catalog_arena>::init();
 
   current_database_path = database_path;
-  bool exists = os_file_exists(database_path);
+  bool exists = pager_exists(database_path);
 
-  if (!pager_open(database_path)) {
+  if (!pager_open(database_path, PAGER_DEFAULT_CACHE_PAGES,
+                  wal_mode ? PAGER_JOURNAL_WAL : PAGER_JOURNAL_ROLLBACK)) {
     fprintf(stdout, "Couldn't open existing database");
     return 1;
   }
@@ -419,6 +864,9 @@ int run_repl(const char *database_path) {
   printf("Type .help for commands or start typing SQL\n\n");
 
   while (true) {
+    // Soft commits are durable before waiting on the user, however long that is
+    pager_flush_group();
+
     printf("sql> ");
     fflush(stdout);
 
@@ -478,9 +926,9 @@ int run_repl(const char *database_path) {
       arena<query_arena>::print_info();
     }
 
-    arena<query_arena>::reset_and_decommit();
+    arena<query_arena>::reset();
   }
 
-  pager_close();
+  close_database();
   return 0;
 }
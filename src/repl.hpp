@@ -5,9 +5,23 @@
  */
 
 #pragma once
+#include "vm.hpp"
 
 
 int
-run_repl(const char *database_path);
+run_repl(const char *database_path, bool wal_mode = false);
+
+/*
+ * Runs every statement in sql as the REPL would. Given a callback, a SELECT's
+ * rows go to it instead of being printed, errors are still printed.
+ */
+bool
+execute_sql_statements(const char *sql, result_callback callback = nullptr);
+
+/*
+ * Runs a SQL script, a dump say, a statement at a time as it's read, see
+ * sql_stream. query_arena is reset after each statement, so nothing the
+ * caller allocated there lasts. Stops at the first statement that fails.
+ */
 bool
-execute_sql_statements(const char *sql);
+execute_sql_file(const char *path, result_callback callback = nullptr, uint64_t *statements = nullptr);
@@ -29,14 +29,24 @@
  * has a 'sem(antic)' context. 'SELECT * FROM users WHERE age > 50;' will
  * resolve to expr_node.sem.resolved_type = TYPE_U32, .column_index = 2
  *
+ * A '?' has no type of its own, it takes the type of whatever it's compared
+ * with or stored into, so 'age > ?' makes it an INT.
+ *
+ * A SELECT with a JOIN has two tables in scope. A column is found in
+ * whichever has it, 'users.id' naming the table when both do, and its
+ * sem.table_index says which.
+ *
  */
 
 #include "semantic.hpp"
 #include "arena.hpp"
 #include "catalog.hpp"
 #include "common.hpp"
+#include "copy.hpp"
 #include "parser.hpp"
+#include "stats.hpp"
 #include "types.hpp"
+#include <cassert>
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
@@ -70,7 +80,7 @@ set_error(semantic_context *ctx, string_view error, string_view context = {})
 static relation *
 lookup_table(semantic_context *ctx, string_view name)
 {
-	return catalog.get(name);
+	return catalog_get(name);
 }
 
 static int32_t
@@ -86,6 +96,74 @@ find_column_index(relation *table, string_view column_name)
 	return -1;
 }
 
+/*
+ * The tables a statement's columns can come from, the FROM table first
+ */
+struct table_scope
+{
+	relation   *tables[2];
+	string_view names[2];
+	uint32_t	count;
+};
+
+static table_scope
+single_table_scope(relation *table, string_view name)
+{
+	table_scope scope = {};
+	scope.tables[0] = table;
+	scope.names[0] = name;
+	scope.count = 1;
+	return scope;
+}
+
+/*
+ * 'column' or 'table.column', sets ctx->error if it isn't exactly one
+ * column of the scope
+ */
+static bool
+resolve_column(semantic_context *ctx, table_scope *scope, string_view name, uint32_t *table_index,
+			   int32_t *column_index)
+{
+	string_view qualifier;
+	string_view column_name = name;
+	size_t		dot = name.find('.');
+	if (dot != string_view::npos)
+	{
+		qualifier = name.substr(0, dot);
+		column_name = name.substr(dot + 1);
+	}
+
+	bool found = false;
+	for (uint32_t i = 0; i < scope->count; i++)
+	{
+		if (!qualifier.empty() && qualifier != scope->names[i])
+		{
+			continue;
+		}
+
+		int32_t idx = find_column_index(scope->tables[i], column_name);
+		if (idx < 0)
+		{
+			continue;
+		}
+		if (found)
+		{
+			set_error(ctx, "Ambiguous column name, qualify it with its table", name);
+			return false;
+		}
+
+		found = true;
+		*table_index = i;
+		*column_index = idx;
+	}
+
+	if (!found)
+	{
+		set_error(ctx, "Column not found", name);
+	}
+	return found;
+}
+
 static bool
 resolve_column_list(semantic_context *ctx, relation *table, array<string_view, query_arena> &column_names,
 					array<int32_t, query_arena> &out_indices)
@@ -110,9 +188,38 @@ resolve_column_list(semantic_context *ctx, relation *table, array<string_view, q
 static const char *
 sql_type_name(data_type type)
 {
+	if (type_id(type) == TYPE_ID_VARCHAR)
+	{
+		return "VARCHAR";
+	}
 	return (type == TYPE_U32) ? "INT" : "TEXT";
 }
 
+/* String literals are parsed as TEXT, whatever their length */
+static bool
+is_string_literal(expr_node *expr)
+{
+	return expr->type == EXPR_LITERAL && expr->lit_type == TYPE_CHAR32;
+}
+
+/*
+ * A string literal takes the type of the TEXT or VARCHAR column it's given
+ * to or compared with, false if it's too long for it
+ */
+static bool
+coerce_string_literal(semantic_context *ctx, expr_node *expr, data_type type)
+{
+	if (expr->str_val.size() > type_size(type))
+	{
+		set_error(ctx, format_error(ctx, "String literal longer than its %s(%u)", sql_type_name(type), type_size(type)),
+				  expr->str_val);
+		return false;
+	}
+
+	expr->sem.resolved_type = type;
+	return true;
+}
+
 static relation *
 require_table(semantic_context *ctx, string_view table_name)
 {
@@ -126,16 +233,50 @@ require_table(semantic_context *ctx, string_view table_name)
 	return table;
 }
 
+/*
+ * Gives a parameter the type its context expects. One used twice, see
+ * BETWEEN, must be the same type both times
+ */
+static bool
+resolve_parameter(semantic_context *ctx, expr_node *expr, data_type type)
+{
+	parameter_slot *slot = expr->parameter;
+	if (slot->type != TYPE_NULL && slot->type != type)
+	{
+		set_error(ctx, "Types need to match");
+		return false;
+	}
+
+	slot->type = type;
+	expr->sem.resolved_type = type;
+	return true;
+}
+
 static bool
 validate_literal_value(semantic_context *ctx, expr_node *expr, data_type expected_type, const char *column_name,
 					   const char *operation)
 {
+	if (expr->type == EXPR_PARAMETER)
+	{
+		if (!resolve_parameter(ctx, expr, expected_type))
+		{
+			return false;
+		}
+		expr->sem.resolved_type = expected_type;
+		return true;
+	}
+
 	if (expr->type != EXPR_LITERAL)
 	{
 		set_error(ctx, format_error(ctx, "Only literal values allowed in %s", operation), column_name);
 		return false;
 	}
 
+	if (is_string_literal(expr) && type_is_string(expected_type))
+	{
+		return coerce_string_literal(ctx, expr, expected_type);
+	}
+
 	if (expr->lit_type != expected_type)
 	{
 		set_error(ctx,
@@ -150,7 +291,7 @@ validate_literal_value(semantic_context *ctx, expr_node *expr, data_type expecte
 }
 
 static bool
-semantic_resolve_expr(semantic_context *ctx, expr_node *expr, relation *table)
+semantic_resolve_expr(semantic_context *ctx, expr_node *expr, table_scope *scope)
 {
 	if (!expr)
 	{
@@ -163,25 +304,47 @@ semantic_resolve_expr(semantic_context *ctx, expr_node *expr, relation *table)
 		expr->sem.resolved_type = expr->lit_type;
 		return true;
 
+	case EXPR_PARAMETER:
+		// Typed by the expression around it
+		expr->sem.resolved_type = expr->parameter->type;
+		return true;
+
 	case EXPR_COLUMN: {
-		int32_t idx = find_column_index(table, expr->column_name);
-		if (idx < 0)
+		uint32_t table_index;
+		int32_t	 idx;
+		if (!resolve_column(ctx, scope, expr->column_name, &table_index, &idx))
 		{
-			set_error(ctx, "Column not found", expr->column_name);
 			return false;
 		}
 
+		expr->sem.table_index = table_index;
 		expr->sem.column_index = idx;
-		expr->sem.resolved_type = table->columns[idx].type;
+		expr->sem.resolved_type = scope->tables[table_index]->columns[idx].type;
 		return true;
 	}
 
 	case EXPR_BINARY_OP: {
-		if (!semantic_resolve_expr(ctx, expr->left, table))
+		if (!semantic_resolve_expr(ctx, expr->left, scope))
 		{
 			return false;
 		}
-		if (!semantic_resolve_expr(ctx, expr->right, table))
+		if (!semantic_resolve_expr(ctx, expr->right, scope))
+		{
+			return false;
+		}
+
+		bool left_untyped = expr->left->type == EXPR_PARAMETER && expr->left->sem.resolved_type == TYPE_NULL;
+		bool right_untyped = expr->right->type == EXPR_PARAMETER && expr->right->sem.resolved_type == TYPE_NULL;
+		if (left_untyped && right_untyped)
+		{
+			set_error(ctx, "Can't infer the type of a parameter compared with a parameter");
+			return false;
+		}
+		if (left_untyped && !resolve_parameter(ctx, expr->left, expr->right->sem.resolved_type))
+		{
+			return false;
+		}
+		if (right_untyped && !resolve_parameter(ctx, expr->right, expr->left->sem.resolved_type))
 		{
 			return false;
 		}
@@ -189,6 +352,26 @@ semantic_resolve_expr(semantic_context *ctx, expr_node *expr, relation *table)
 		data_type left_type = expr->left->sem.resolved_type;
 		data_type right_type = expr->right->sem.resolved_type;
 
+		if (left_type != right_type && type_is_string(left_type) && type_is_string(right_type))
+		{
+			if (is_string_literal(expr->right) && !is_string_literal(expr->left))
+			{
+				if (!coerce_string_literal(ctx, expr->right, left_type))
+				{
+					return false;
+				}
+				right_type = left_type;
+			}
+			else if (is_string_literal(expr->left))
+			{
+				if (!coerce_string_literal(ctx, expr->left, right_type))
+				{
+					return false;
+				}
+				left_type = right_type;
+			}
+		}
+
 		if (left_type != right_type)
 		{
 			set_error(ctx, "Types need to match");
@@ -212,7 +395,13 @@ semantic_resolve_expr(semantic_context *ctx, expr_node *expr, relation *table)
 		return true;
 	}
 	case EXPR_UNARY_OP: {
-		if (!semantic_resolve_expr(ctx, expr->operand, table))
+		if (!semantic_resolve_expr(ctx, expr->operand, scope))
+		{
+			return false;
+		}
+
+		if (expr->operand->type == EXPR_PARAMETER && expr->operand->sem.resolved_type == TYPE_NULL &&
+			!resolve_parameter(ctx, expr->operand, TYPE_U32))
 		{
 			return false;
 		}
@@ -236,31 +425,52 @@ semantic_resolve_expr(semantic_context *ctx, expr_node *expr, relation *table)
 }
 
 static bool
-resolve_where_clause(semantic_context *ctx, expr_node *where_clause, relation *table)
+resolve_where_clause(semantic_context *ctx, expr_node *where_clause, table_scope *scope,
+					 const char *clause = "WHERE")
 {
 	if (!where_clause)
 	{
 		return true;
 	}
 
-	if (!semantic_resolve_expr(ctx, where_clause, table))
+	if (!semantic_resolve_expr(ctx, where_clause, scope))
 	{
 		if (ctx->error.empty())
 		{
-			set_error(ctx, "Invalid expression in WHERE clause");
+			set_error(ctx, format_error(ctx, "Invalid expression in %s clause", clause));
 		}
 		return false;
 	}
 
 	if (where_clause->sem.resolved_type != TYPE_U32)
 	{
-		set_error(ctx, "WHERE clause must evaluate to boolean");
+		set_error(ctx, format_error(ctx, "%s clause must evaluate to boolean", clause));
 		return false;
 	}
 
 	return true;
 }
 
+/*
+ * Rows are matched up on one of the ON's AND'ed conditions comparing a
+ * column of each table for equality, so there has to be one
+ */
+static bool
+has_join_key(expr_node *expr)
+{
+	if (expr->type != EXPR_BINARY_OP)
+	{
+		return false;
+	}
+	if (expr->op == OP_AND)
+	{
+		return has_join_key(expr->left) || has_join_key(expr->right);
+	}
+
+	return expr->op == OP_EQ && expr->left->type == EXPR_COLUMN && expr->right->type == EXPR_COLUMN &&
+		   expr->left->sem.table_index != expr->right->sem.table_index;
+}
+
 static bool
 resolve_insert_columns(semantic_context *ctx, insert_stmt *stmt, relation *table)
 {
@@ -277,6 +487,56 @@ resolve_insert_columns(semantic_context *ctx, insert_stmt *stmt, relation *table
 	return true;
 }
 
+/*
+ * With GROUP BY or an aggregate there's a row per group, so every column
+ * that isn't aggregated has to be the group's key
+ */
+static bool
+resolve_group_by(semantic_context *ctx, select_stmt *stmt, table_scope *scope)
+{
+	stmt->sem.group_by_index = -1;
+	stmt->sem.group_by_table = 0;
+	stmt->sem.is_aggregate = !stmt->group_by_column.empty();
+	for (AGGREGATE_FUNCTION aggregate : stmt->column_aggregates)
+	{
+		stmt->sem.is_aggregate |= aggregate != AGG_NONE;
+	}
+
+	if (!stmt->sem.is_aggregate)
+	{
+		return true;
+	}
+
+	if (stmt->is_star)
+	{
+		set_error(ctx, "SELECT * can't be grouped, list the GROUP BY column and aggregates",
+				  stmt->group_by_column);
+		return false;
+	}
+
+	if (!stmt->group_by_column.empty() &&
+		!resolve_column(ctx, scope, stmt->group_by_column, &stmt->sem.group_by_table, &stmt->sem.group_by_index))
+	{
+		if (scope->count == 1)
+		{
+			set_error(ctx, "GROUP BY column does not exist in table", stmt->group_by_column);
+		}
+		return false;
+	}
+
+	for (uint32_t i = 0; i < stmt->columns.size(); i++)
+	{
+		if (stmt->column_aggregates[i] == AGG_NONE &&
+			(stmt->sem.column_tables[i] != stmt->sem.group_by_table ||
+			 stmt->sem.column_indices[i] != stmt->sem.group_by_index))
+		{
+			set_error(ctx, "Column must be the GROUP BY column or in an aggregate", stmt->columns[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
 static bool
 semantic_resolve_select(semantic_context *ctx, select_stmt *stmt)
 {
@@ -286,46 +546,132 @@ semantic_resolve_select(semantic_context *ctx, select_stmt *stmt)
 		return false;
 	}
 
+	table_scope scope = single_table_scope(table, stmt->table_name);
+	if (!stmt->join_table.empty())
+	{
+		relation *joined = require_table(ctx, stmt->join_table);
+		if (!joined)
+		{
+			return false;
+		}
+
+		// Without aliases, the two sides would have no names to tell them apart
+		if (joined == table)
+		{
+			set_error(ctx, "A table can't be joined with itself", stmt->join_table);
+			return false;
+		}
+
+		scope.tables[1] = joined;
+		scope.names[1] = stmt->join_table;
+		scope.count = 2;
+	}
+
 	stmt->sem.column_indices.clear();
+	stmt->sem.column_tables.clear();
 	stmt->sem.column_types.clear();
 
 	if (stmt->is_star)
 	{
-		for (uint32_t i = 0; i < table->columns.size(); i++)
+		for (uint32_t t = 0; t < scope.count; t++)
 		{
-			stmt->sem.column_indices.push(i);
-			stmt->sem.column_types.push(table->columns[i].type);
+			for (uint32_t i = 0; i < scope.tables[t]->columns.size(); i++)
+			{
+				stmt->sem.column_indices.push(i);
+				stmt->sem.column_tables.push(t);
+				stmt->sem.column_types.push(scope.tables[t]->columns[i].type);
+			}
 		}
 	}
 	else
 	{
-		if (!resolve_column_list(ctx, table, stmt->columns, stmt->sem.column_indices))
+		for (uint32_t i = 0; i < stmt->columns.size(); i++)
+		{
+			string_view		   column_name = stmt->columns[i];
+			AGGREGATE_FUNCTION aggregate = stmt->column_aggregates[i];
+			if (aggregate == AGG_COUNT && column_name == "*")
+			{
+				stmt->sem.column_indices.push(-1);
+				stmt->sem.column_tables.push(0);
+				stmt->sem.column_types.push(TYPE_U32);
+				continue;
+			}
+
+			uint32_t table_index;
+			int32_t	 idx;
+			if (!resolve_column(ctx, &scope, column_name, &table_index, &idx))
+			{
+				if (scope.count == 1)
+				{
+					set_error(ctx, "Column does not exist in table", column_name);
+				}
+				return false;
+			}
+
+			data_type type = scope.tables[table_index]->columns[idx].type;
+			if ((aggregate == AGG_SUM || aggregate == AGG_AVG) && type != TYPE_U32)
+			{
+				set_error(ctx, format_error(ctx, "%s needs an INT column", aggregate_function_name(aggregate)),
+						  column_name);
+				return false;
+			}
+
+			stmt->sem.column_indices.push(idx);
+			stmt->sem.column_tables.push(table_index);
+			stmt->sem.column_types.push(aggregate == AGG_NONE || aggregate == AGG_MIN || aggregate == AGG_MAX
+											? type
+											: TYPE_U32);
+		}
+	}
+
+	if (!resolve_group_by(ctx, stmt, &scope))
+	{
+		return false;
+	}
+
+	if (stmt->join_condition)
+	{
+		if (!resolve_where_clause(ctx, stmt->join_condition, &scope, "ON"))
 		{
 			return false;
 		}
 
-		for (uint32_t i = 0; i < stmt->sem.column_indices.size(); i++)
+		if (!has_join_key(stmt->join_condition))
 		{
-			stmt->sem.column_types.push(table->columns[stmt->sem.column_indices[i]].type);
+			set_error(ctx, "JOIN needs an ON condition equating a column of each table", stmt->join_table);
+			return false;
 		}
 	}
 
-	if (!resolve_where_clause(ctx, stmt->where_clause, table))
+	if (!resolve_where_clause(ctx, stmt->where_clause, &scope))
 	{
 		return false;
 	}
 
+	stmt->sem.order_by_table = 0;
 	if (stmt->order_by_column.size() > 0)
 	{
-		stmt->sem.order_by_index = find_column_index(table, stmt->order_by_column);
-		if (stmt->sem.order_by_index < 0)
+		if (!resolve_column(ctx, &scope, stmt->order_by_column, &stmt->sem.order_by_table,
+							&stmt->sem.order_by_index))
 		{
-			set_error(ctx, "ORDER BY column does not exist in table", stmt->order_by_column);
+			if (scope.count == 1)
+			{
+				set_error(ctx, "ORDER BY column does not exist in table", stmt->order_by_column);
+			}
+			return false;
+		}
+
+		// Groups only have their key to be ordered on
+		if (stmt->sem.is_aggregate &&
+			(stmt->sem.order_by_table != stmt->sem.group_by_table ||
+			 stmt->sem.order_by_index != stmt->sem.group_by_index))
+		{
+			set_error(ctx, "ORDER BY column must be the GROUP BY column", stmt->order_by_column);
 			return false;
 		}
 
 		array<data_type, query_arena> rb_types;
-		rb_types.push(table->columns[stmt->sem.order_by_index].type);
+		rb_types.push(scope.tables[stmt->sem.order_by_table]->columns[stmt->sem.order_by_index].type);
 		for (auto &type : stmt->sem.column_types)
 		{
 			rb_types.push(type);
@@ -351,11 +697,13 @@ semantic_resolve_insert(semantic_context *ctx, insert_stmt *stmt)
 		return false;
 	}
 
-	if (stmt->values.size() != stmt->sem.column_indices.size())
+	// The parser has made every row the same width
+	uint32_t row_width = stmt->values.size() / stmt->row_count;
+	if (row_width != stmt->sem.column_indices.size())
 	{
 		set_error(ctx,
 				  format_error(ctx, "Value count mismatch: expected %u, got %u", stmt->sem.column_indices.size(),
-							   stmt->values.size()),
+							   row_width),
 				  stmt->table_name);
 		return false;
 	}
@@ -363,7 +711,7 @@ semantic_resolve_insert(semantic_context *ctx, insert_stmt *stmt)
 	for (uint32_t i = 0; i < stmt->values.size(); i++)
 	{
 		expr_node *expr = stmt->values[i];
-		uint32_t   col_idx = stmt->sem.column_indices[i];
+		uint32_t   col_idx = stmt->sem.column_indices[i % row_width];
 		data_type  expected_type = table->columns[col_idx].type;
 
 		if (!validate_literal_value(ctx, expr, expected_type, table->columns[col_idx].name, "INSERT"))
@@ -401,7 +749,8 @@ semantic_resolve_update(semantic_context *ctx, update_stmt *stmt)
 		}
 	}
 
-	if (!resolve_where_clause(ctx, stmt->where_clause, table))
+	table_scope scope = single_table_scope(table, stmt->table_name);
+	if (!resolve_where_clause(ctx, stmt->where_clause, &scope))
 	{
 		return false;
 	}
@@ -418,7 +767,8 @@ semantic_resolve_delete(semantic_context *ctx, delete_stmt *stmt)
 		return false;
 	}
 
-	if (!resolve_where_clause(ctx, stmt->where_clause, table))
+	table_scope scope = single_table_scope(table, stmt->table_name);
+	if (!resolve_where_clause(ctx, stmt->where_clause, &scope))
 	{
 		return false;
 	}
@@ -437,7 +787,7 @@ semantic_resolve_create_table(semantic_context *ctx, create_table_stmt *stmt)
 	}
 
 	relation *existing = lookup_table(ctx, stmt->table_name);
-	if (existing)
+	if (existing || find_index(stmt->table_name))
 	{
 		set_error(ctx, "Table already exists", stmt->table_name);
 		return false;
@@ -473,12 +823,20 @@ semantic_resolve_create_table(semantic_context *ctx, create_table_stmt *stmt)
 	array<attribute, query_arena> cols;
 	for (attribute_node &def : stmt->columns)
 	{
-		if (def.type != TYPE_U32 && def.type != TYPE_CHAR32)
+		if (def.type != TYPE_U32 && def.type != TYPE_CHAR32 && type_id(def.type) != TYPE_ID_VARCHAR)
 		{
 			set_error(ctx, "Invalid column type", def.name);
 			return false;
 		}
 
+		// The key goes into index entries as part of a dual, see INDEXED_COLUMN_MAX_SIZE
+		if (def.sem.is_primary_key && type_size(def.type) > INDEXED_COLUMN_MAX_SIZE)
+		{
+			set_error(ctx, format_error(ctx, "A primary key can be at most %u bytes", INDEXED_COLUMN_MAX_SIZE),
+					  def.name);
+			return false;
+		}
+
 		attribute attr;
 		sv_to_cstr(def.name, attr.name, ATTRIBUTE_NAME_MAX_SIZE);
 		attr.type = def.type;
@@ -489,7 +847,7 @@ semantic_resolve_create_table(semantic_context *ctx, create_table_stmt *stmt)
 	relation new_relation = create_relation(stmt->table_name, cols);
 	if (ctx->modify)
 	{
-		catalog.insert(new_relation.name, new_relation);
+		catalog_add_table(new_relation);
 	}
 	stmt->sem.created_structure = stmt->table_name;
 	return true;
@@ -513,6 +871,139 @@ semantic_resolve_drop_table(semantic_context *ctx, drop_table_stmt *stmt)
 	return true;
 }
 
+/*
+ * The index is added to the catalog here, its btree is created and filled
+ * by OP_Function in the program, see vmfunc_create_index
+ */
+static bool
+semantic_resolve_create_index(semantic_context *ctx, create_index_stmt *stmt)
+{
+	if (stmt->index_name.size() > RELATION_NAME_MAX_SIZE)
+	{
+		set_error(ctx, format_error(ctx, "Index name max size is %u, got %u", RELATION_NAME_MAX_SIZE,
+									stmt->index_name.size()));
+		return false;
+	}
+
+	if (lookup_table(ctx, stmt->index_name) || find_index(stmt->index_name))
+	{
+		set_error(ctx, "Index already exists", stmt->index_name);
+		return false;
+	}
+
+	relation *table = require_table(ctx, stmt->table_name);
+	if (!table)
+	{
+		return false;
+	}
+
+	if (table->indexes.size() >= RELATION_MAX_INDEXES)
+	{
+		set_error(ctx, format_error(ctx, "A table can have at most %u indexes", RELATION_MAX_INDEXES),
+				  stmt->table_name);
+		return false;
+	}
+
+	if (!resolve_column_list(ctx, table, stmt->columns, stmt->sem.column_indices))
+	{
+		return false;
+	}
+
+	for (uint32_t i = 0; i < stmt->sem.column_indices.size(); i++)
+	{
+		if (stmt->sem.column_indices[i] == 0)
+		{
+			set_error(ctx, "The primary key is already indexed by the table", stmt->columns[i]);
+			return false;
+		}
+		if (type_size(table->columns[stmt->sem.column_indices[i]].type) > INDEXED_COLUMN_MAX_SIZE)
+		{
+			set_error(ctx, format_error(ctx, "An indexed column can be at most %u bytes", INDEXED_COLUMN_MAX_SIZE),
+					  stmt->columns[i]);
+			return false;
+		}
+	}
+
+	if (stmt->sem.column_indices.size() == 2 && stmt->sem.column_indices[0] == stmt->sem.column_indices[1])
+	{
+		set_error(ctx, "Duplicate column name", stmt->columns[1]);
+		return false;
+	}
+
+	if (ctx->modify)
+	{
+		secondary_index index = {};
+		sv_to_cstr(stmt->index_name, index.name, RELATION_NAME_MAX_SIZE);
+		for (int32_t column : stmt->sem.column_indices)
+		{
+			index.columns[index.column_count++] = column;
+		}
+		catalog_add_index(table, index);
+	}
+
+	return true;
+}
+
+static bool
+semantic_resolve_drop_index(semantic_context *ctx, drop_index_stmt *stmt)
+{
+	if (!find_index(stmt->index_name))
+	{
+		set_error(ctx, "Index does not exist", stmt->index_name);
+		return false;
+	}
+
+	return true;
+}
+
+static bool
+semantic_resolve_copy(semantic_context *ctx, copy_stmt *stmt)
+{
+	if (!require_table(ctx, stmt->table_name))
+	{
+		return false;
+	}
+
+	if (stmt->file_path.size() >= COPY_MAX_PATH_SIZE)
+	{
+		set_error(ctx, format_error(ctx, "File name max size is %u, got %u", COPY_MAX_PATH_SIZE - 1,
+									stmt->file_path.size()),
+				  stmt->file_path);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * The first ANALYZE creates master_stats, as 'CREATE TABLE' would, and
+ * compile_analyze adds its master_catalog row
+ */
+static bool
+semantic_resolve_analyze(semantic_context *ctx, analyze_stmt *stmt)
+{
+	if (!stmt->table_name.empty() && !require_table(ctx, stmt->table_name))
+	{
+		return false;
+	}
+
+	relation *stats_table = lookup_table(ctx, STATS_TABLE);
+	if (stats_table)
+	{
+		if (stats_table->columns.size() != 4)
+		{
+			set_error(ctx, "Table " STATS_TABLE " is not a statistics table");
+			return false;
+		}
+		return true;
+	}
+
+	parser_result create = parse_sql(STATS_TABLE_SQL);
+	assert(create.success && create.statements.size() == 1);
+	stmt->sem.create_stats_table = true;
+	return semantic_resolve_create_table(ctx, &create.statements[0]->create_table_stmt);
+}
+
 static bool
 semantic_resolve_statement(semantic_context *ctx, stmt_node *stmt)
 {
@@ -534,6 +1025,14 @@ semantic_resolve_statement(semantic_context *ctx, stmt_node *stmt)
 		return semantic_resolve_create_table(ctx, &stmt->create_table_stmt);
 	case STMT_DROP_TABLE:
 		return semantic_resolve_drop_table(ctx, &stmt->drop_table_stmt);
+	case STMT_CREATE_INDEX:
+		return semantic_resolve_create_index(ctx, &stmt->create_index_stmt);
+	case STMT_DROP_INDEX:
+		return semantic_resolve_drop_index(ctx, &stmt->drop_index_stmt);
+	case STMT_COPY:
+		return semantic_resolve_copy(ctx, &stmt->copy_stmt);
+	case STMT_ANALYZE:
+		return semantic_resolve_analyze(ctx, &stmt->analyze_stmt);
 
 	case STMT_BEGIN:
 	case STMT_COMMIT:
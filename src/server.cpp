@@ -0,0 +1,791 @@
+/*
+ * SQL From Scratch
+ *
+ * Server
+ *
+ * One poll loop on the writer's thread. Each round reads whatever has arrived
+ * on each connection into its input buffer, then runs the complete requests
+ * in it, one per connection in turn until none can run, so a client sending a
+ * long pipeline doesn't hold the others up. Replies are appended to the
+ * connection's output buffer, and written out as the socket takes them.
+ *
+ * A request's rows are encoded straight from the VM's result callback. Once
+ * its replies pass SERVER_FLUSH_SIZE they're written out there and then,
+ * waiting for the client to read them if need be, so a big result is
+ * streamed rather than held in memory. Every other connection waits with it,
+ * so a client that stops reading for SERVER_STALL_MS is cut off. A
+ * connection with that much still unread doesn't get its next request run
+ * until it's read some.
+ *
+ * The connection holding a transaction is cut off once it's gone
+ * idle_timeout_ms without a request run, the poll waking in time to do it.
+ *
+ * Connection buffers and prepared statements live in the global_arena, the
+ * query_arena is reset after every request as the REPL does after every
+ * line.
+ *
+ * POSIX sockets only.
+ */
+
+#include "server.hpp"
+#include "arena.hpp"
+#include "catalog.hpp"
+#include "copy.hpp"
+#include "pager.hpp"
+#include "prepared.hpp"
+#include "repl.hpp"
+#include "types.hpp"
+#include "vm.hpp"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static_assert(std::endian::native == std::endian::little,
+              "Frames are written as the values are laid out in memory");
+
+#define SERVER_READ_SIZE (64u << 10)
+
+/* Bytes [start, size) are yet to be consumed */
+struct server_buffer {
+  uint8_t *data;
+  uint32_t start;
+  uint32_t size;
+  uint32_t capacity;
+
+  uint32_t pending() { return size - start; }
+};
+
+/* Room for bytes more at the end, moving what's pending to the front first */
+static uint8_t *buffer_append(server_buffer *buffer, uint32_t bytes) {
+  if (buffer->start > 0 && buffer->size + bytes > buffer->capacity) {
+    memmove(buffer->data, buffer->data + buffer->start, buffer->pending());
+    buffer->size -= buffer->start;
+    buffer->start = 0;
+  }
+
+  if (buffer->size + bytes > buffer->capacity) {
+    uint32_t capacity = std::max(buffer->capacity * 2, buffer->size + bytes);
+    capacity = std::max(capacity, SERVER_READ_SIZE);
+    uint8_t *data = (uint8_t *)arena<global_arena>::alloc(capacity);
+    if (buffer->data) {
+      memcpy(data, buffer->data, buffer->size);
+      arena<global_arena>::reclaim(buffer->data, buffer->capacity);
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+  }
+
+  uint8_t *end = buffer->data + buffer->size;
+  buffer->size += bytes;
+  return end;
+}
+
+static void buffer_consume(server_buffer *buffer, uint32_t bytes) {
+  buffer->start += bytes;
+  if (buffer->start == buffer->size) {
+    buffer->start = 0;
+    buffer->size = 0;
+  }
+}
+
+static void buffer_free(server_buffer *buffer) {
+  if (buffer->data) {
+    arena<global_arena>::reclaim(buffer->data, buffer->capacity);
+  }
+  *buffer = {};
+}
+
+struct server_connection {
+  int fd;
+  server_buffer in;
+  server_buffer out;
+  array<prepared_statement *, global_arena> statements; /* nullptr once finalized */
+  uint64_t active_ms; /* When its last request was run */
+  bool eof;    /* The client is done sending */
+  bool broken; /* Unreadable, unwritable or sent a bad frame, so it's closed */
+};
+
+static struct {
+  int listener = -1;
+  char unix_path[sizeof(sockaddr_un::sun_path)];
+  server_connection *connections[SERVER_MAX_CONNECTIONS];
+  uint32_t connection_count;
+  server_connection *owner; /* Has a transaction open */
+  uint32_t idle_timeout_ms = SERVER_IDLE_TRANSACTION_MS;
+} SERVER;
+
+static volatile sig_atomic_t server_stopping;
+
+void server_stop() { server_stopping = true; }
+
+void server_set_idle_timeout(uint32_t timeout_ms) {
+  SERVER.idle_timeout_ms = timeout_ms;
+}
+
+static uint64_t now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/*
+ * Replies
+ */
+
+static uint8_t *begin_frame(server_connection *conn, SERVER_FRAME kind,
+                            uint32_t payload_size) {
+  uint8_t *frame = buffer_append(&conn->out, SERVER_FRAME_HEADER_SIZE + payload_size);
+  uint32_t length = payload_size + 1;
+  memcpy(frame, &length, sizeof(length));
+  frame[4] = kind;
+  return frame + SERVER_FRAME_HEADER_SIZE;
+}
+
+static void reply_error(server_connection *conn, const char *message) {
+  uint32_t length = strlen(message);
+  memcpy(begin_frame(conn, SERVER_ERROR, length), message, length);
+}
+
+static void reply_done(server_connection *conn, uint32_t rows) {
+  memcpy(begin_frame(conn, SERVER_DONE, sizeof(rows)), &rows, sizeof(rows));
+}
+
+/* Writes what the socket will take without waiting, false if it's gone */
+static bool flush(server_connection *conn) {
+  while (conn->out.pending() > 0 && !conn->broken) {
+    ssize_t sent = send(conn->fd, conn->out.data + conn->out.start,
+                        conn->out.pending(), MSG_NOSIGNAL);
+    if (sent > 0) {
+      buffer_consume(&conn->out, sent);
+    } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    } else if (!(sent < 0 && errno == EINTR)) {
+      conn->broken = true;
+    }
+  }
+
+  // Nobody's going to read what a broken connection was sent
+  if (conn->broken) {
+    buffer_consume(&conn->out, conn->out.pending());
+  }
+  return !conn->broken;
+}
+
+/*
+ * Waits for the client to read everything, unless it stalls, when it's
+ * broken off and the rest of the request's replies are dropped
+ */
+static void flush_all(server_connection *conn) {
+  while (flush(conn) && conn->out.pending() > 0) {
+    pollfd writable = {conn->fd, POLLOUT, 0};
+    if (poll(&writable, 1, SERVER_STALL_MS) == 0) {
+      conn->broken = true;
+      flush(conn);
+    }
+  }
+}
+
+/*
+ * The request being run, and the column types its rows were last described
+ * with
+ */
+static server_connection *replying;
+static uint32_t reply_rows;
+static array<data_type, global_arena> reply_types;
+static bool reply_described;
+
+static uint32_t value_length(typed_value *value) {
+  uint32_t size = type_size(value->type);
+  if (type_is_string(value->type)) {
+    return std::min<uint32_t>(strnlen(value->as_char(), size), UINT16_MAX);
+  }
+  return size;
+}
+
+static void reply_columns(typed_value *values, size_t count) {
+  bool described = reply_described && reply_types.size() == count;
+  for (uint32_t i = 0; described && i < count; i++) {
+    described = !values[i].data || values[i].type == reply_types[i];
+  }
+  if (described) {
+    return;
+  }
+
+  // A NULL doesn't say what its column is, so keeps the type it had
+  for (uint32_t i = 0; i < count; i++) {
+    if (i >= reply_types.size()) {
+      reply_types.push(values[i].type);
+    } else if (values[i].data) {
+      reply_types[i] = values[i].type;
+    }
+  }
+  while (reply_types.size() > count) {
+    reply_types.pop_back();
+  }
+  reply_described = true;
+
+  uint16_t columns = count;
+  uint8_t *payload =
+      begin_frame(replying, SERVER_COLUMNS, sizeof(uint16_t) + count * sizeof(data_type));
+  memcpy(payload, &columns, sizeof(columns));
+  memcpy(payload + sizeof(columns), reply_types.data(), count * sizeof(data_type));
+}
+
+static void reply_row(typed_value *values, size_t count) {
+  server_connection *conn = replying;
+  if (conn->broken) {
+    return;
+  }
+
+  reply_columns(values, count);
+
+  uint32_t bitmap_size = (count + 7) / 8;
+  uint32_t size = bitmap_size;
+  for (size_t i = 0; i < count; i++) {
+    if (values[i].data) {
+      size += value_length(&values[i]) +
+              (type_is_string(values[i].type) ? sizeof(uint16_t) : 0);
+    }
+  }
+
+  uint8_t *payload = begin_frame(conn, SERVER_ROW, size);
+  memset(payload, 0, bitmap_size);
+  uint8_t *value = payload + bitmap_size;
+  for (size_t i = 0; i < count; i++) {
+    if (!values[i].data) {
+      continue;
+    }
+
+    payload[i / 8] |= 1 << (i % 8);
+    uint16_t length = value_length(&values[i]);
+    if (type_is_string(values[i].type)) {
+      memcpy(value, &length, sizeof(length));
+      value += sizeof(length);
+    }
+    memcpy(value, values[i].data, length);
+    value += length;
+  }
+  reply_rows++;
+
+  if (conn->out.pending() > SERVER_FLUSH_SIZE) {
+    flush_all(conn);
+  }
+}
+
+/*
+ * Requests
+ */
+
+/* Reads a request's payload front to back, failing once it runs out */
+struct request_reader {
+  uint8_t *at;
+  uint8_t *end;
+  bool failed;
+
+  template <typename T> T read() {
+    T value = {};
+    if (end - at < (ptrdiff_t)sizeof(T)) {
+      failed = true;
+      return value;
+    }
+    memcpy(&value, at, sizeof(T));
+    at += sizeof(T);
+    return value;
+  }
+};
+
+static prepared_statement *statement_for(server_connection *conn, uint32_t id) {
+  prepared_statement **stmt = conn->statements.get(id - 1);
+  return stmt ? *stmt : nullptr;
+}
+
+static void run_prepare(server_connection *conn, string_view sql) {
+  prepared_statement *stmt = sql_prepare(sql);
+  conn->statements.push(stmt);
+  if (!stmt) {
+    reply_error(conn, "Couldn't prepare the statement");
+    return;
+  }
+
+  uint32_t id = conn->statements.size();
+  uint16_t parameters = sql_parameter_count(stmt);
+  uint8_t *payload = begin_frame(conn, SERVER_PREPARED, sizeof(id) + sizeof(parameters));
+  memcpy(payload, &id, sizeof(id));
+  memcpy(payload + sizeof(id), &parameters, sizeof(parameters));
+}
+
+static void run_execute(server_connection *conn, request_reader request) {
+  prepared_statement *stmt = statement_for(conn, request.read<uint32_t>());
+  uint16_t count = request.read<uint16_t>();
+  if (request.failed || !stmt) {
+    reply_error(conn, "No such statement");
+    return;
+  }
+
+  bool bound = true;
+  for (uint16_t i = 0; i < count && bound && !request.failed; i++) {
+    uint8_t kind = request.read<uint8_t>();
+    if (kind == SERVER_PARAM_INT) {
+      uint32_t value = request.read<uint32_t>();
+      bound = !request.failed && sql_bind_int(stmt, i, value);
+    } else if (kind == SERVER_PARAM_TEXT) {
+      uint16_t length = request.read<uint16_t>();
+      if (request.end - request.at < length) {
+        request.failed = true;
+        break;
+      }
+      bound = sql_bind_text(stmt, i, string_view((char *)request.at, length));
+      request.at += length;
+    } else {
+      request.failed = true;
+    }
+  }
+
+  if (request.failed) {
+    reply_error(conn, "Malformed parameters");
+  } else if (!bound) {
+    reply_error(conn, "A parameter couldn't be bound");
+  } else if (sql_step(stmt, reply_row) != OK) {
+    reply_error(conn, "Execution failed");
+  } else {
+    reply_done(conn, reply_rows);
+  }
+  sql_reset(stmt);
+}
+
+static void run_request(server_connection *conn, uint8_t kind, uint8_t *payload,
+                        uint32_t size) {
+  replying = conn;
+  reply_rows = 0;
+  reply_described = false;
+  while (reply_types.pop_back()) {
+  }
+
+  switch (kind) {
+  case SERVER_QUERY: {
+    char *sql = (char *)arena<query_arena>::alloc(size + 1);
+    memcpy(sql, payload, size);
+    sql[size] = '\0';
+    if (execute_sql_statements(sql, reply_row)) {
+      reply_done(conn, reply_rows);
+    } else {
+      reply_error(conn, "Statement failed");
+    }
+    break;
+  }
+
+  case SERVER_PREPARE:
+    run_prepare(conn, string_view((char *)payload, size));
+    break;
+
+  case SERVER_EXECUTE:
+    run_execute(conn, {payload, payload + size, false});
+    break;
+
+  case SERVER_FINALIZE: {
+    request_reader request = {payload, payload + size, false};
+    uint32_t id = request.read<uint32_t>();
+    prepared_statement *stmt = statement_for(conn, id);
+    if (request.failed || !stmt) {
+      reply_error(conn, "No such statement");
+      break;
+    }
+    sql_finalize(stmt);
+    conn->statements[id - 1] = nullptr;
+    reply_done(conn, 0);
+    break;
+  }
+
+  default:
+    reply_error(conn, "Unknown request");
+  }
+
+  SERVER.owner = pager_in_transaction() ? conn : nullptr;
+  conn->active_ms = now_ms();
+  arena<query_arena>::reset();
+}
+
+/* The length of the complete request at the front of the input, or 0 */
+static uint32_t next_request(server_connection *conn) {
+  uint32_t length;
+  if (conn->in.pending() < sizeof(length)) {
+    return 0;
+  }
+  memcpy(&length, conn->in.data + conn->in.start, sizeof(length));
+
+  if (length == 0 || length > SERVER_MAX_FRAME_SIZE) {
+    conn->broken = true;
+    return 0;
+  }
+  return conn->in.pending() >= sizeof(length) + length ? length : 0;
+}
+
+static bool run_next_request(server_connection *conn) {
+  if (conn->broken || (SERVER.owner && SERVER.owner != conn) ||
+      conn->out.pending() > SERVER_FLUSH_SIZE) {
+    return false;
+  }
+
+  uint32_t length = next_request(conn);
+  if (!length) {
+    return false;
+  }
+
+  uint8_t *frame = conn->in.data + conn->in.start + sizeof(length);
+  run_request(conn, frame[0], frame + 1, length - 1);
+  buffer_consume(&conn->in, sizeof(length) + length);
+  return true;
+}
+
+/*
+ * Connections
+ */
+
+static bool set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static void accept_connections() {
+  while (SERVER.connection_count < SERVER_MAX_CONNECTIONS) {
+    int fd = accept(SERVER.listener, nullptr, nullptr);
+    if (fd < 0) {
+      return;
+    }
+
+    // Replies are small and shouldn't wait to be coalesced
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (!set_nonblocking(fd)) {
+      close(fd);
+      continue;
+    }
+
+    server_connection *conn =
+        (server_connection *)arena<global_arena>::alloc(sizeof(server_connection));
+    *conn = {};
+    conn->fd = fd;
+    SERVER.connections[SERVER.connection_count++] = conn;
+  }
+}
+
+static void read_available(server_connection *conn) {
+  uint8_t *into = buffer_append(&conn->in, SERVER_READ_SIZE);
+  conn->in.size -= SERVER_READ_SIZE;
+
+  ssize_t received = recv(conn->fd, into, SERVER_READ_SIZE, 0);
+  if (received > 0) {
+    conn->in.size += received;
+  } else if (received == 0) {
+    conn->eof = true;
+  } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+    conn->broken = true;
+  }
+}
+
+static void close_connection(uint32_t index) {
+  server_connection *conn = SERVER.connections[index];
+
+  if (SERVER.owner == conn) {
+    pager_rollback();
+    catalog_rollback();
+    catalog_unlock_exclusive();
+    SERVER.owner = nullptr;
+  }
+
+  for (prepared_statement *stmt : conn->statements) {
+    if (stmt) {
+      sql_finalize(stmt);
+    }
+  }
+  conn->statements.clear();
+  buffer_free(&conn->in);
+  buffer_free(&conn->out);
+  close(conn->fd);
+  arena<global_arena>::reclaim(conn, sizeof(server_connection));
+
+  SERVER.connections[index] = SERVER.connections[--SERVER.connection_count];
+}
+
+/*
+ * How long until the connection holding a transaction has been idle too long,
+ * or -1 if none is. Idle is having no request it can run, one held back by
+ * its unread replies included.
+ */
+static int32_t idle_due() {
+  server_connection *owner = SERVER.owner;
+  if (!owner || !SERVER.idle_timeout_ms ||
+      (next_request(owner) && owner->out.pending() <= SERVER_FLUSH_SIZE)) {
+    return -1;
+  }
+  uint64_t idle_ms = now_ms() - owner->active_ms;
+  return idle_ms >= SERVER.idle_timeout_ms
+             ? 0
+             : (int32_t)(SERVER.idle_timeout_ms - idle_ms);
+}
+
+/*
+ * Done once it's broken, or the client is done sending and has been sent
+ * everything. Requests waiting on another connection's transaction keep it
+ * open.
+ */
+static bool is_finished(server_connection *conn) {
+  return conn->broken || (conn->eof && conn->out.pending() == 0 && !next_request(conn));
+}
+
+/*
+ * Listening
+ */
+
+static int listen_unix(const char *path) {
+  sockaddr_un addr = {};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+
+  // A socket left behind by a server that didn't close it
+  unlink(path);
+  if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return -1;
+  }
+  strcpy(SERVER.unix_path, path);
+  return fd;
+}
+
+/*
+ * Without a host it's the IPv4 loopback, which clients expect more than ::1,
+ * and "*" is getaddrinfo's AI_PASSIVE, every interface
+ */
+static int listen_tcp(const char *address) {
+  char host[256] = {};
+  const char *port = strrchr(address, ':');
+  if (port) {
+    // "[::1]" to "::1"
+    const char *start = address + (address[0] == '[');
+    const char *end = port - (port > start && port[-1] == ']');
+    size_t length = std::min<size_t>(end - start, sizeof(host) - 1);
+    memcpy(host, start, length);
+    port++;
+  } else {
+    port = address;
+  }
+
+  bool every_interface = strcmp(host, "*") == 0;
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = every_interface ? AI_PASSIVE : 0;
+  addrinfo *found;
+  if (getaddrinfo(every_interface ? nullptr : host[0] ? host : "127.0.0.1",
+                  port, &hints, &found) != 0) {
+    return -1;
+  }
+
+  int fd = -1;
+  for (addrinfo *ai = found; ai && fd < 0; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, SOMAXCONN) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(found);
+  return fd;
+}
+
+bool server_listen(const char *address, const char *copy_directory) {
+  assert(SERVER.listener < 0 && "Already listening");
+  server_stopping = false;
+  SERVER.unix_path[0] = '\0';
+
+  if (strncmp(address, "unix:", 5) == 0) {
+    SERVER.listener = listen_unix(address + 5);
+  } else if (strchr(address, '/')) {
+    SERVER.listener = listen_unix(address);
+  } else {
+    SERVER.listener = listen_tcp(address);
+  }
+
+  if (SERVER.listener >= 0 && !set_nonblocking(SERVER.listener)) {
+    server_close();
+  }
+  if (SERVER.listener >= 0) {
+    copy_set_directory(copy_directory ? copy_directory : "");
+  }
+  return SERVER.listener >= 0;
+}
+
+void server_poll(int timeout_ms) {
+  pollfd fds[SERVER_MAX_CONNECTIONS + 1];
+  uint32_t count = SERVER.connection_count;
+
+  fds[0] = {SERVER.listener, count < SERVER_MAX_CONNECTIONS ? (short)POLLIN : (short)0, 0};
+  for (uint32_t i = 0; i < count; i++) {
+    server_connection *conn = SERVER.connections[i];
+
+    // Unrun requests aren't added to until they're run
+    bool wants_input = !conn->eof && !conn->broken &&
+                       (conn->in.pending() < SERVER_FLUSH_SIZE || !next_request(conn));
+    short events = (wants_input ? POLLIN : 0) | (conn->out.pending() > 0 ? POLLOUT : 0);
+
+    // Otherwise a hung up client waiting its turn would wake the poll at once
+    fds[i + 1] = {events ? conn->fd : -1, events, 0};
+  }
+
+  // Woken for the group's window to make its soft commits durable, and to
+  // cut off an idle transaction
+  for (int32_t due : {pager_group_commit_due(), idle_due()}) {
+    if (due >= 0 && (timeout_ms < 0 || due < timeout_ms)) {
+      timeout_ms = due;
+    }
+  }
+
+  if (poll(fds, count + 1, timeout_ms) > 0) {
+    for (uint32_t i = 0; i < count; i++) {
+      if ((fds[i + 1].events & POLLIN) &&
+          (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+        read_available(SERVER.connections[i]);
+      }
+    }
+    if (fds[0].revents & POLLIN) {
+      accept_connections();
+    }
+  }
+
+  if (idle_due() == 0) {
+    SERVER.owner->broken = true;
+  }
+
+  // Closing the connection with the transaction open lets the others run
+  for (bool ran = true; ran;) {
+    ran = false;
+    for (uint32_t i = 0; i < SERVER.connection_count; i++) {
+      ran |= run_next_request(SERVER.connections[i]);
+    }
+
+    for (uint32_t i = SERVER.connection_count; i-- > 0;) {
+      server_connection *conn = SERVER.connections[i];
+      flush(conn);
+      if (is_finished(conn)) {
+        ran |= SERVER.owner == conn;
+        close_connection(i);
+      }
+    }
+  }
+
+  if (pager_group_commit_due() == 0) {
+    pager_flush_group();
+  }
+}
+
+void server_close() {
+  while (SERVER.connection_count > 0) {
+    close_connection(SERVER.connection_count - 1);
+  }
+  if (SERVER.listener >= 0) {
+    close(SERVER.listener);
+    SERVER.listener = -1;
+  }
+  if (SERVER.unix_path[0]) {
+    unlink(SERVER.unix_path);
+    SERVER.unix_path[0] = '\0';
+  }
+  copy_set_directory(nullptr);
+  reply_types.clear();
+}
+
+static void handle_stop_signal(int) { server_stop(); }
+
+int run_server(const char *database_path, const char *address, bool wal_mode,
+               const char *copy_directory) {
+  arena<query_arena>::init();
+  arena<query_arena>::set_decommit_policy(QUERY_ARENA_WATERMARK,
+                                          QUERY_ARENA_DECOMMIT_AFTER);
+  arena<catalog_arena>::init();
+
+  bool exists = pager_exists(database_path);
+  if (!pager_open(database_path, PAGER_DEFAULT_CACHE_PAGES,
+                  wal_mode ? PAGER_JOURNAL_WAL : PAGER_JOURNAL_ROLLBACK)) {
+    printf("Couldn't open existing database\n");
+    return 1;
+  }
+
+  if (exists) {
+    catalog_reload();
+  } else {
+    bootstrap_master(true);
+  }
+
+  if (!server_listen(address, copy_directory)) {
+    printf("Couldn't listen on %s\n", address);
+    pager_close();
+    return 1;
+  }
+
+  signal(SIGINT, handle_stop_signal);
+  signal(SIGTERM, handle_stop_signal);
+  signal(SIGPIPE, SIG_IGN);
+  printf("Serving %s on %s\n", database_path, address);
+  fflush(stdout);
+
+  while (!server_stopping) {
+    server_poll(-1);
+  }
+
+  server_close();
+  catalog_snapshot_save(); // See catalog.hpp
+  pager_close();
+  return 0;
+}
+
+#else
+
+int run_server(const char *database_path, const char *address, bool wal_mode,
+               const char *copy_directory) {
+  printf("Server mode needs POSIX sockets\n");
+  return 1;
+}
+
+bool server_listen(const char *address, const char *copy_directory) {
+  return false;
+}
+void server_set_idle_timeout(uint32_t timeout_ms) {}
+void server_poll(int timeout_ms) {}
+void server_stop() {}
+void server_close() {}
+
+#endif
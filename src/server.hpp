@@ -0,0 +1,137 @@
+/*
+ * SQL From Scratch
+ *
+ * Server
+ *
+ * Serves the database over a TCP or Unix socket, so every client shares the
+ * one warm page cache, catalog and plan cache, rather than each starting a
+ * process and reloading them. Connections stay open for any number of
+ * requests, and a client can send its requests without waiting for replies,
+ * which come back in the order the requests were sent.
+ *
+ * Requests are run one at a time on the thread that opened the pager, the
+ * writer, see session.hpp. A connection that leaves a transaction open (a
+ * BEGIN without its COMMIT) has the database to itself until it commits or
+ * rolls back, the other connections' requests wait, and a connection that
+ * closes with a transaction open has it rolled back. So does one that holds
+ * its transaction for SERVER_IDLE_TRANSACTION_MS without sending anything to
+ * run, and it's disconnected.
+ *
+ * There's no authentication, so TCP listens on the loopback interface unless
+ * it's given a host, and COPY only reads files under a directory the server
+ * is given, see server_listen.
+ *
+ * Every message either way is a frame: a u32 length of what follows, a u8
+ * kind, then the kind's payload. Integers are little endian.
+ *
+ * Requests:
+ *   SERVER_QUERY     The SQL text, any number of statements, run as the REPL
+ *                    runs them
+ *   SERVER_PREPARE   The SQL text of one statement, with '?' parameters
+ *   SERVER_EXECUTE   u32 statement, u16 parameter count, then each parameter
+ *                    as SERVER_PARAM_INT and a u32, or SERVER_PARAM_TEXT, a
+ *                    u16 length and the text
+ *   SERVER_FINALIZE  u32 statement
+ *
+ * Replies, a request's rows then its SERVER_DONE or SERVER_ERROR:
+ *   SERVER_COLUMNS   u16 count, then each column's data_type as a u64. Sent
+ *                    before a request's first row, and before any row whose
+ *                    types differ from the last ones sent.
+ *   SERVER_ROW       A bitmap of the columns that aren't NULL, a bit each,
+ *                    then each of those columns' values. A string is a u16
+ *                    length and its bytes, anything else its type_size bytes,
+ *                    as stored.
+ *   SERVER_PREPARED  u32 statement, u16 parameter count (to a PREPARE)
+ *   SERVER_DONE      u32 rows
+ *   SERVER_ERROR     The error's text
+ *
+ * A connection's statements are numbered from 1 in the order it prepares
+ * them, a failed PREPARE taking a number too, so a client can send the
+ * EXECUTEs behind their PREPARE without waiting for its reply.
+ */
+
+#pragma once
+#include <cstdint>
+
+enum SERVER_FRAME : uint8_t
+{
+	SERVER_QUERY = 'Q',
+	SERVER_PREPARE = 'P',
+	SERVER_EXECUTE = 'E',
+	SERVER_FINALIZE = 'F',
+
+	SERVER_COLUMNS = 'C',
+	SERVER_ROW = 'R',
+	SERVER_PREPARED = 'S',
+	SERVER_DONE = 'D',
+	SERVER_ERROR = 'X',
+};
+
+enum SERVER_PARAM : uint8_t
+{
+	SERVER_PARAM_INT = 1,
+	SERVER_PARAM_TEXT = 2,
+};
+
+/* The u32 length and the u8 kind */
+#define SERVER_FRAME_HEADER_SIZE 5
+
+/* A request longer than this closes its connection */
+#define SERVER_MAX_FRAME_SIZE (16u << 20)
+
+#define SERVER_MAX_CONNECTIONS 256
+
+/* Replies past this much are written out before the request carries on */
+#define SERVER_FLUSH_SIZE (64u << 10)
+
+/*
+ * A client that reads none of a request's replies for this long, while the
+ * request waits to write them, is disconnected rather than hold up the others
+ */
+#define SERVER_STALL_MS 5000
+
+/*
+ * A connection holding a transaction that sends nothing to run for this long
+ * is disconnected, and the transaction rolled back, see
+ * server_set_idle_timeout
+ */
+#define SERVER_IDLE_TRANSACTION_MS 30000
+
+/*
+ * Opens the database and serves it on address until SIGINT or SIGTERM, see
+ * server_listen
+ */
+int
+run_server(const char *database_path, const char *address, bool wal_mode = false,
+		   const char *copy_directory = nullptr);
+
+/*
+ * Listens on address, a Unix socket's path if it has a '/' or starts with
+ * "unix:", otherwise a TCP "host:port", or just a port for the loopback
+ * interface. "*:port" listens on every interface, "[::1]:port" is an IPv6
+ * host. The pager must be open and the catalog loaded.
+ *
+ * Requests' COPYs read files under copy_directory, see copy_set_directory,
+ * or none without one, until server_close.
+ */
+bool
+server_listen(const char *address, const char *copy_directory = nullptr);
+
+/* 0 never disconnects an idle transaction, SERVER_IDLE_TRANSACTION_MS to start */
+void
+server_set_idle_timeout(uint32_t timeout_ms);
+
+/*
+ * Waits up to timeout_ms (-1 for as long as it takes) for connections and
+ * requests, then runs every request that's arrived
+ */
+void
+server_poll(int timeout_ms);
+
+/* Asks run_server's loop to return, safe from a signal handler */
+void
+server_stop();
+
+/* Closes every connection, rolling back a transaction left open, and the socket */
+void
+server_close();
@@ -0,0 +1,88 @@
+/*
+ * SQL From Scratch
+ *
+ * Sessions
+ */
+
+#include "session.hpp"
+#include "arena.hpp"
+#include "catalog.hpp"
+#include "pager.hpp"
+#include "prepared.hpp"
+#include <cassert>
+
+static thread_local struct {
+  bool reader;
+  bool in_read; // Between session_begin_read and session_end_read
+} session;
+
+bool session_begin() {
+  assert(!session.reader && "The thread is already a session");
+
+  // The snapshot files are opened once, and kept for the session
+  if (!pager_begin_snapshot()) {
+    return false;
+  }
+  pager_end_snapshot();
+
+  arena<query_arena>::init();
+
+  arena<query_arena>::set_decommit_policy(QUERY_ARENA_WATERMARK,
+                                          QUERY_ARENA_DECOMMIT_AFTER);
+  arena<global_arena>::init();
+  session.reader = true;
+  return true;
+}
+
+void session_end() {
+  assert(session.reader && !session.in_read);
+
+  plan_cache_clear();
+  arena<plan_arena>::shutdown();
+  arena<query_arena>::shutdown();
+  arena<global_arena>::shutdown();
+  pager_release_snapshots();
+  session.reader = false;
+}
+
+/*
+ * The catalog first, so the snapshot is at least as new as the catalog is,
+ * since the writer holds it until a schema change commits
+ */
+bool session_begin_read() {
+  assert(session.reader && !session.in_read);
+
+  catalog_lock_shared();
+  if (!pager_begin_snapshot()) {
+    catalog_unlock_shared();
+    return false;
+  }
+
+  session.in_read = true;
+  return true;
+}
+
+/* Nothing the read allocated outlives it, as after a REPL input */
+void session_end_read() {
+  assert(session.in_read);
+
+  pager_end_snapshot();
+  catalog_unlock_shared();
+  session.in_read = false;
+  arena<query_arena>::reset();
+}
+
+bool session_is_reader() { return session.reader; }
+
+session_statement::session_statement() : began(false), failed(false) {
+  if (session.reader && !session.in_read) {
+    began = session_begin_read();
+    failed = !began;
+  }
+}
+
+session_statement::~session_statement() {
+  if (began) {
+    session_end_read();
+  }
+}
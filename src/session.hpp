@@ -0,0 +1,52 @@
+/*
+ * SQL From Scratch
+ *
+ * Sessions
+ *
+ * The thread that opens the pager is the writer, the REPL runs on it. In WAL
+ * mode any number of other threads can read meanwhile, each as a read
+ * session. session_begin gives the calling thread arenas of its own (the
+ * query, plan and global arenas are per thread, see arena_per_thread), and
+ * with them a plan cache and VM state of its own.
+ *
+ * From then on every statement the thread prepares, binds or steps (see
+ * prepared.hpp) holds the catalog shared and a snapshot of the database as of
+ * the last commit before it, see pager_begin_snapshot. So a session never
+ * sees a transaction half done, and never waits for the writer, other than
+ * for a schema change to commit. A SELECT is all it can run.
+ *
+ * Statements between session_begin_read and session_end_read share one
+ * snapshot instead, and a schema change waits for the read to end.
+ *
+ * A prepared statement belongs to the session that prepared it.
+ */
+
+#pragma once
+
+/* False if the database isn't in WAL mode */
+bool
+session_begin();
+void
+session_end();
+
+bool
+session_begin_read();
+void
+session_end_read();
+
+/* Whether the calling thread is a read session */
+bool
+session_is_reader();
+
+/*
+ * Held around each statement a session prepares or steps, does nothing on
+ * the writer's thread or inside a read
+ */
+struct session_statement
+{
+	bool began;
+	bool failed; /* No snapshot could be taken */
+
+	session_statement();
+	~session_statement();
+};
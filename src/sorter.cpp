@@ -0,0 +1,468 @@
+/*
+ * SQL From Scratch
+ *
+ * External Sort
+ *
+ * Rows are sorted through an array of pointers, so only pointers move. A run
+ * is written in sorted order through a write buffer, so the file only ever
+ * sees large sequential writes, and is read back the same way a chunk at a
+ * time. With the budget split between the chunks of the runs being merged,
+ * each run is read in pieces of budget / SORTER_MERGE_WIDTH or more.
+ *
+ * Ties are broken on where the rows came from. Within the buffer, that's
+ * their address, it's filled front to back. Across runs, it's the run's
+ * index, runs are written in insertion order and a merge pass only ever
+ * merges neighbouring runs, keeping its output in their place.
+ */
+
+#include "sorter.hpp"
+#include "arena.hpp"
+#include "os_layer.hpp"
+#include "pager.hpp"
+#include "types.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+static size_t sort_memory_budget = SORTER_DEFAULT_MEMORY;
+
+void sorter_set_memory_budget(size_t bytes) { sort_memory_budget = bytes; }
+
+sorter sorter_create(data_type key_type, uint32_t record_size,
+                     bool descending, uint32_t keep) {
+  sorter sorter = {};
+  sorter.key_type = key_type;
+  sorter.key_size = type_size(key_type);
+  sorter.row_size = sorter.key_size + record_size;
+  sorter.descending = descending;
+  sorter.max_rows = (uint32_t)std::max<size_t>(
+      2, sort_memory_budget / (sorter.row_size + sizeof(uint8_t *)));
+  sorter.keep = keep <= sorter.max_rows ? keep : 0;
+  sorter.file = OS_INVALID_HANDLE;
+  return sorter;
+}
+
+static int compare_rows(sorter *sorter, const uint8_t *a, const uint8_t *b) {
+  int cmp = type_compare(sorter->key_type, a, b);
+  return sorter->descending ? -cmp : cmp;
+}
+
+static void sort_rows(sorter *sorter) {
+  arena<query_arena>::reclaim(sorter->order,
+                              sorter->row_capacity * sizeof(uint8_t *));
+  sorter->order = (uint8_t **)arena<query_arena>::alloc(
+      sorter->row_capacity * sizeof(uint8_t *));
+
+  for (uint32_t i = 0; i < sorter->row_count; i++) {
+    sorter->order[i] = sorter->rows + (size_t)i * sorter->row_size;
+  }
+
+  std::sort(sorter->order, sorter->order + sorter->row_count,
+            [sorter](const uint8_t *a, const uint8_t *b) {
+              int cmp = compare_rows(sorter, a, b);
+              return cmp != 0 ? cmp < 0 : a < b;
+            });
+}
+
+static bool flush_writes(sorter *sorter) {
+  if (sorter->write_used == 0) {
+    return true;
+  }
+
+  os_file_seek(sorter->file, sorter->file_size);
+  if (os_file_write(sorter->file, sorter->write_buffer, sorter->write_used) !=
+      sorter->write_used) {
+    sorter->failed = true;
+    return false;
+  }
+  sorter->file_size += sorter->write_used;
+  sorter->write_used = 0;
+  return true;
+}
+
+static bool write_row(sorter *sorter, const uint8_t *row) {
+  if (sorter->write_used + sorter->row_size > SORTER_WRITE_BUFFER_SIZE &&
+      !flush_writes(sorter)) {
+    return false;
+  }
+
+  // A row larger than the whole buffer goes straight to the file
+  if (sorter->row_size > SORTER_WRITE_BUFFER_SIZE) {
+    os_file_seek(sorter->file, sorter->file_size);
+    if (os_file_write(sorter->file, row, sorter->row_size) !=
+        sorter->row_size) {
+      sorter->failed = true;
+      return false;
+    }
+    sorter->file_size += sorter->row_size;
+    return true;
+  }
+
+  memcpy(sorter->write_buffer + sorter->write_used, row, sorter->row_size);
+  sorter->write_used += sorter->row_size;
+  return true;
+}
+
+static bool open_file(sorter *sorter) {
+  if (sorter->file != OS_INVALID_HANDLE) {
+    return true;
+  }
+
+  pager_temp_file_name(sorter->file_name, sizeof(sorter->file_name));
+  sorter->file = os_file_open(sorter->file_name, true, true);
+  if (sorter->file == OS_INVALID_HANDLE) {
+    fprintf(stderr, "Sort: can't create %s\n", sorter->file_name);
+    sorter->failed = true;
+    return false;
+  }
+
+  os_file_truncate(sorter->file, 0);
+  sorter->write_buffer =
+      (uint8_t *)arena<query_arena>::alloc(SORTER_WRITE_BUFFER_SIZE);
+  return true;
+}
+
+/*
+ * Sorts the buffered rows and writes them out as the next run, emptying the
+ * buffer
+ */
+static bool write_run(sorter *sorter) {
+  if (!open_file(sorter)) {
+    return false;
+  }
+
+  sort_rows(sorter);
+
+  sorter_run run = {sorter->file_size, sorter->row_count};
+  for (uint32_t i = 0; i < sorter->row_count; i++) {
+    if (!write_row(sorter, sorter->order[i])) {
+      return false;
+    }
+  }
+  if (!flush_writes(sorter)) {
+    return false;
+  }
+
+  sorter->runs.push(run);
+  sorter->row_count = 0;
+  return true;
+}
+
+/*
+ * Keeping only the first rows
+ */
+
+static uint64_t row_sequence(sorter *sorter, const uint8_t *row) {
+  return sorter->sequence[(row - sorter->rows) / sorter->row_size];
+}
+
+static bool row_before(sorter *sorter, const uint8_t *a, const uint8_t *b) {
+  int cmp = compare_rows(sorter, a, b);
+  return cmp != 0 ? cmp < 0 : row_sequence(sorter, a) < row_sequence(sorter, b);
+}
+
+static bool insert_kept(sorter *sorter, void *key, void *record) {
+  auto before = [sorter](const uint8_t *a, const uint8_t *b) {
+    return row_before(sorter, a, b);
+  };
+
+  if (!sorter->rows) {
+    sorter->row_capacity = sorter->keep;
+    sorter->rows = (uint8_t *)arena<query_arena>::alloc((size_t)sorter->keep *
+                                                        sorter->row_size);
+    sorter->order = (uint8_t **)arena<query_arena>::alloc(sorter->keep *
+                                                          sizeof(uint8_t *));
+    sorter->sequence = (uint64_t *)arena<query_arena>::alloc(
+        sorter->keep * sizeof(uint64_t));
+  }
+
+  uint8_t *row;
+  if (sorter->row_count < sorter->keep) {
+    row = sorter->rows + (size_t)sorter->row_count * sorter->row_size;
+    sorter->order[sorter->row_count++] = row;
+  } else {
+    // Ties go to the row already kept, it was inserted first
+    if (compare_rows(sorter, (uint8_t *)key, sorter->order[0]) >= 0) {
+      sorter->inserted++;
+      return true;
+    }
+    std::pop_heap(sorter->order, sorter->order + sorter->row_count, before);
+    row = sorter->order[sorter->row_count - 1];
+  }
+
+  memcpy(row, key, sorter->key_size);
+  memcpy(row + sorter->key_size, record, sorter->row_size - sorter->key_size);
+  sorter->sequence[(row - sorter->rows) / sorter->row_size] =
+      sorter->inserted++;
+  std::push_heap(sorter->order, sorter->order + sorter->row_count, before);
+  return true;
+}
+
+bool sorter_insert(sorter *sorter, void *key, void *record) {
+  assert(!sorter->sorted && "Rows can't be added to a sort being read");
+
+  if (sorter->keep) {
+    return insert_kept(sorter, key, record);
+  }
+
+  if (sorter->row_count == sorter->max_rows && !write_run(sorter)) {
+    return false;
+  }
+
+  if (sorter->row_count == sorter->row_capacity) {
+    uint32_t capacity = std::min(
+        sorter->max_rows, std::max<uint32_t>(64, sorter->row_capacity * 2));
+    uint8_t *rows =
+        (uint8_t *)arena<query_arena>::alloc((size_t)capacity * sorter->row_size);
+    if (sorter->row_count) {
+      memcpy(rows, sorter->rows, (size_t)sorter->row_count * sorter->row_size);
+    }
+    arena<query_arena>::reclaim(sorter->rows, (size_t)sorter->row_capacity *
+                                                   sorter->row_size);
+    sorter->rows = rows;
+    sorter->row_capacity = capacity;
+  }
+
+  uint8_t *row = sorter->rows + (size_t)sorter->row_count * sorter->row_size;
+  memcpy(row, key, sorter->key_size);
+  memcpy(row + sorter->key_size, record, sorter->row_size - sorter->key_size);
+  sorter->row_count++;
+  return true;
+}
+
+/*
+ * Merging
+ */
+
+static uint8_t *source_row(sorter *sorter, sorter_source *source) {
+  return source->chunk + (size_t)source->position * sorter->row_size;
+}
+
+static bool fill_source(sorter *sorter, sorter_source *source) {
+  uint32_t rows =
+      (uint32_t)std::min<uint64_t>(source->remaining, source->chunk_capacity);
+  size_t size = (size_t)rows * sorter->row_size;
+
+  os_file_seek(sorter->file, source->next);
+  if (os_file_read(sorter->file, source->chunk, size) != size) {
+    fprintf(stderr, "Sort: failed reading a run back from %s\n",
+            sorter->file_name);
+    sorter->failed = true;
+    return false;
+  }
+
+  source->next += size;
+  source->remaining -= rows;
+  source->chunk_rows = rows;
+  source->position = 0;
+  return true;
+}
+
+/*
+ * Whether a's row comes out after b's, the order of the heap
+ */
+static bool source_after(sorter *sorter, uint32_t a, uint32_t b) {
+  sorter_source *left = &sorter->sources[a];
+  sorter_source *right = &sorter->sources[b];
+  int cmp =
+      compare_rows(sorter, source_row(sorter, left), source_row(sorter, right));
+  return cmp != 0 ? cmp > 0 : left->run > right->run;
+}
+
+static void update_current(sorter *sorter) {
+  sorter->current =
+      sorter->heap_size > 0
+          ? source_row(sorter, &sorter->sources[sorter->heap[0]])
+          : nullptr;
+}
+
+/*
+ * Sets up a merge of runs [first, first + count), splitting the row buffer,
+ * which is at its largest by the time anything has been written, between
+ * them
+ */
+static bool begin_merge(sorter *sorter, uint32_t first, uint32_t count) {
+  sorter->sources = (sorter_source *)arena<query_arena>::alloc(
+      count * sizeof(sorter_source));
+  sorter->heap =
+      (uint32_t *)arena<query_arena>::alloc(count * sizeof(uint32_t));
+  sorter->heap_size = 0;
+
+  uint32_t chunk_capacity = std::max<uint32_t>(1, sorter->row_capacity / count);
+  if ((uint64_t)chunk_capacity * count > sorter->row_capacity) {
+    // Fewer rows than runs fit the budget, all the same, each needs one
+    sorter->rows = (uint8_t *)arena<query_arena>::alloc((size_t)count *
+                                                        sorter->row_size);
+  }
+
+  auto after = [sorter](uint32_t a, uint32_t b) {
+    return source_after(sorter, a, b);
+  };
+
+  for (uint32_t i = 0; i < count; i++) {
+    sorter_run &run = sorter->runs[first + i];
+    sorter_source *source = &sorter->sources[i];
+    source->next = run.offset;
+    source->remaining = run.count;
+    source->chunk =
+        sorter->rows + (size_t)i * chunk_capacity * sorter->row_size;
+    source->chunk_capacity = chunk_capacity;
+    source->run = first + i;
+    if (run.count == 0) {
+      continue;
+    }
+    if (!fill_source(sorter, source)) {
+      return false;
+    }
+    sorter->heap[sorter->heap_size++] = i;
+    std::push_heap(sorter->heap, sorter->heap + sorter->heap_size, after);
+  }
+
+  update_current(sorter);
+  return true;
+}
+
+/*
+ * Moves past the current row of the merge
+ */
+static bool advance_merge(sorter *sorter) {
+  auto after = [sorter](uint32_t a, uint32_t b) {
+    return source_after(sorter, a, b);
+  };
+
+  std::pop_heap(sorter->heap, sorter->heap + sorter->heap_size, after);
+  uint32_t index = sorter->heap[sorter->heap_size - 1];
+  sorter_source *source = &sorter->sources[index];
+
+  bool live = true;
+  if (++source->position == source->chunk_rows) {
+    live = source->remaining > 0 && fill_source(sorter, source);
+  }
+
+  if (live) {
+    std::push_heap(sorter->heap, sorter->heap + sorter->heap_size, after);
+  } else {
+    sorter->heap_size--;
+  }
+
+  update_current(sorter);
+  return !sorter->failed;
+}
+
+/*
+ * Merges neighbouring runs, SORTER_MERGE_WIDTH at a time, until few enough
+ * are left to merge in one go as they're read
+ */
+static bool merge_passes(sorter *sorter) {
+  while (sorter->runs.size() > SORTER_MERGE_WIDTH) {
+    array<sorter_run, query_arena> merged;
+
+    for (uint32_t first = 0; first < sorter->runs.size();
+         first += SORTER_MERGE_WIDTH) {
+      uint32_t count =
+          std::min<uint32_t>(SORTER_MERGE_WIDTH, sorter->runs.size() - first);
+      if (count == 1) {
+        merged.push(sorter->runs[first]);
+        continue;
+      }
+
+      if (!begin_merge(sorter, first, count)) {
+        return false;
+      }
+
+      sorter_run run = {sorter->file_size, 0};
+      while (sorter->current) {
+        if (!write_row(sorter, sorter->current) || !advance_merge(sorter)) {
+          return false;
+        }
+        run.count++;
+      }
+      if (!flush_writes(sorter)) {
+        return false;
+      }
+      merged.push(run);
+    }
+
+    sorter->runs = merged;
+  }
+  return true;
+}
+
+static bool finish(sorter *sorter) {
+  sorter->sorted = true;
+
+  if (sorter->keep) {
+    std::sort_heap(sorter->order, sorter->order + sorter->row_count,
+                   [sorter](const uint8_t *a, const uint8_t *b) {
+                     return row_before(sorter, a, b);
+                   });
+    return true;
+  }
+
+  if (sorter->runs.size() == 0) {
+    sort_rows(sorter);
+    return true;
+  }
+
+  // Once anything is on disk, everything is, so there's one way to read
+  if (sorter->row_count > 0 && !write_run(sorter)) {
+    return false;
+  }
+  return merge_passes(sorter);
+}
+
+bool sorter_first(sorter *sorter) {
+  if (!sorter->sorted && !finish(sorter)) {
+    sorter->current = nullptr;
+    return false;
+  }
+
+  if (sorter->runs.size() == 0) {
+    sorter->position = 0;
+    sorter->current = sorter->row_count > 0 ? sorter->order[0] : nullptr;
+    return sorter->current != nullptr;
+  }
+
+  if (!begin_merge(sorter, 0, sorter->runs.size())) {
+    sorter->current = nullptr;
+    return false;
+  }
+  return sorter->current != nullptr;
+}
+
+bool sorter_next(sorter *sorter) {
+  if (!sorter->current) {
+    return false;
+  }
+
+  if (sorter->runs.size() == 0) {
+    sorter->position++;
+    sorter->current = sorter->position < sorter->row_count
+                          ? sorter->order[sorter->position]
+                          : nullptr;
+    return sorter->current != nullptr;
+  }
+
+  if (!advance_merge(sorter)) {
+    sorter->current = nullptr;
+  }
+  return sorter->current != nullptr;
+}
+
+bool sorter_is_valid(sorter *sorter) { return sorter->current != nullptr; }
+
+void *sorter_key(sorter *sorter) { return sorter->current; }
+
+void *sorter_record(sorter *sorter) {
+  return sorter->current ? sorter->current + sorter->key_size : nullptr;
+}
+
+void sorter_close(sorter *sorter) {
+  if (sorter->file != OS_INVALID_HANDLE) {
+    os_file_close(sorter->file);
+    os_file_delete(sorter->file_name);
+    sorter->file = OS_INVALID_HANDLE;
+  }
+  sorter->current = nullptr;
+}
@@ -0,0 +1,119 @@
+/*
+ * SQL From Scratch
+ *
+ * External Sort
+ *
+ * Rows for an ORDER BY are appended to a buffer, which is sorted and written
+ * out as a run to a scratch file beside the database whenever it reaches the
+ * memory budget. Reading the rows back merges the runs, with only a chunk of
+ * each one in memory. A sort that fits in the budget never touches a file,
+ * the rows are read straight out of the sorted buffer.
+ *
+ * A sort that's only read up to a LIMIT can be told how many rows it'll be
+ * read for. If they fit the budget, it then only keeps that many, in a heap
+ * with the last of them on top, and a row that isn't ahead of that one is
+ * dropped as it's inserted.
+ *
+ * Rows are laid out as in the ephemeral tree, the key then the record. Rows
+ * with equal keys come out in the order they went in, in either direction.
+ */
+
+#pragma once
+#include "arena.hpp"
+#include "os_layer.hpp"
+#include "types.hpp"
+#include <cstdint>
+
+#define SORTER_DEFAULT_MEMORY (64u << 20)
+
+/*
+ * At most this many runs are merged at once, more are first merged in groups
+ * of this many into longer runs
+ */
+#define SORTER_MERGE_WIDTH 64
+
+/* Runs are written through a buffer of this size */
+#define SORTER_WRITE_BUFFER_SIZE (64u << 10)
+
+#define SORTER_FILENAME_SIZE 64
+
+struct sorter_run
+{
+	os_file_offset_t offset; /* Of the first row in the file */
+	uint64_t		 count;
+};
+
+/*
+ * A run being merged, read a chunk at a time
+ */
+struct sorter_source
+{
+	os_file_offset_t next;		/* File offset of the first row not yet read */
+	uint64_t		 remaining; /* Rows not yet read */
+	uint8_t			*chunk;
+	uint32_t		 chunk_capacity; /* In rows */
+	uint32_t		 chunk_rows;	 /* Rows read into the chunk */
+	uint32_t		 position;		 /* The current row in the chunk */
+	uint32_t		 run;			 /* Index of the run, breaks ties */
+};
+
+struct sorter
+{
+	data_type key_type;
+	uint32_t  key_size;
+	uint32_t  row_size; /* key_size + record size */
+	bool	  descending;
+
+	/* Rows not yet written out, in the order they were inserted */
+	uint8_t	 *rows;
+	uint32_t  row_count;
+	uint32_t  row_capacity;
+	uint32_t  max_rows; /* Rows, with their place in order, that fit the budget */
+	uint8_t **order;	/* The rows, sorted */
+
+	/* When keep is set, only that many rows are held, and order is a heap */
+	uint32_t  keep;		/* 0 keeps every row */
+	uint64_t *sequence; /* Insertion number of the row in each slot, breaks ties */
+	uint64_t  inserted;
+
+	os_file_handle_t			   file; /* OS_INVALID_HANDLE until the first run */
+	char						   file_name[SORTER_FILENAME_SIZE];
+	os_file_offset_t			   file_size;
+	array<sorter_run, query_arena> runs;
+	uint8_t						  *write_buffer;
+	uint32_t					   write_used;
+
+	bool sorted; /* Set by the first sorter_first, no inserts after */
+	bool failed; /* A run couldn't be written or read back */
+
+	/* Reading */
+	uint32_t	   position; /* Into order, when nothing was written out */
+	sorter_source *sources;
+	uint32_t	  *heap; /* Of sources, the one whose row is next on top */
+	uint32_t	   heap_size;
+	uint8_t		  *current; /* nullptr past the last row */
+};
+
+sorter
+sorter_create(data_type key_type, uint32_t record_size, bool descending, uint32_t keep = 0);
+bool
+sorter_insert(sorter *sorter, void *key, void *record);
+bool
+sorter_first(sorter *sorter);
+bool
+sorter_next(sorter *sorter);
+bool
+sorter_is_valid(sorter *sorter);
+void *
+sorter_key(sorter *sorter);
+void *
+sorter_record(sorter *sorter);
+void
+sorter_close(sorter *sorter);
+
+/*
+ * Bytes of rows a sort keeps in memory before it writes a run, for sorts
+ * created after the call
+ */
+void
+sorter_set_memory_budget(size_t bytes);
@@ -0,0 +1,394 @@
+/*
+ * SQL From Scratch
+ *
+ * Table Statistics
+ *
+ * Each sampled row's columns are put on their lines, and hashed, into an
+ * array per column. Sorting the positions gives the histogram's bounds, and
+ * counting the runs of equal hashes the sample's distinct values.
+ *
+ * From a sample of n rows out of N, with d distinct values of which f1 were
+ * seen only once, the column's distinct count is estimated as
+ *
+ *   d / (1 - (1 - n/N) * f1 / n)
+ *
+ * (Haas and Stokes' Duj1), which is d when every value was seen more than
+ * once, and grows towards N the more of the sample was unique.
+ */
+
+#include "stats.hpp"
+#include "arena.hpp"
+#include "btree.hpp"
+#include "catalog.hpp"
+#include "types.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+uint32_t stats_position(data_type type, const void *value) {
+  if (type_is_string(type)) {
+    // Big endian, so the positions compare as the bytes do
+    const uint8_t *bytes = (const uint8_t *)value;
+    uint32_t size = std::min<uint32_t>(type_size(type), sizeof(uint32_t));
+    uint32_t position = 0;
+    for (uint32_t i = 0; i < sizeof(uint32_t); i++) {
+      position = position << 8 | (i < size ? bytes[i] : 0);
+    }
+    return position;
+  }
+
+  switch (type_size(type)) {
+  case 1:
+    return *(const uint8_t *)value;
+  case 2:
+    return *(const uint16_t *)value;
+  default:
+    return *(const uint32_t *)value;
+  }
+}
+
+/*
+ * Sampling
+ */
+
+struct stats_sample {
+  tuple_format layout;
+  uint8_t *image; // For unpacking packed records into
+  array<uint32_t, query_arena> *positions; // Per column
+  array<uint32_t, query_arena> *hashes;
+};
+
+static BT_MATCH_RESULT sample_entry(void *context, const uint8_t *key,
+                                    const uint8_t *record) {
+  stats_sample *sample = (stats_sample *)context;
+  tuple_format &layout = sample->layout;
+  if (layout.packed_size) {
+    record_unpack(layout, record, sample->image);
+    record = sample->image;
+  }
+
+  for (uint32_t col = 0; col < layout.columns.size(); col++) {
+    data_type type = layout.columns[col];
+    const uint8_t *value = col == 0 ? key : record + layout.offsets[col - 1];
+    uint32_t size = type_size(type);
+    if (type_is_string(type)) {
+      size = strnlen((const char *)value, size);
+    }
+    sample->positions[col].push(stats_position(type, value));
+    sample->hashes[col].push(hash_bytes(value, size));
+  }
+  return BT_MATCH_SKIP;
+}
+
+static uint64_t estimate_distinct(array<uint32_t, query_arena> &hashes,
+                                  uint64_t rows, bool whole) {
+  std::sort(hashes.begin(), hashes.end());
+
+  uint64_t distinct = 0;
+  uint64_t once = 0;
+  for (uint32_t i = 0; i < hashes.size();) {
+    uint32_t run = 1;
+    while (i + run < hashes.size() && hashes[i + run] == hashes[i]) {
+      run++;
+    }
+    distinct++;
+    once += run == 1;
+    i += run;
+  }
+
+  if (whole || hashes.size() == 0) {
+    return distinct;
+  }
+
+  double n = hashes.size();
+  double unsampled = 1.0 - n / rows;
+  double estimate = distinct / (1.0 - unsampled * once / n);
+  return std::clamp<uint64_t>((uint64_t)estimate, distinct, rows);
+}
+
+static void build_column(column_stats *column,
+                         array<uint32_t, query_arena> &positions) {
+  uint32_t n = positions.size();
+  if (n == 0) {
+    return;
+  }
+
+  std::sort(positions.begin(), positions.end());
+  column->min = positions[0];
+  column->max = positions[n - 1];
+  for (uint32_t b = 0; b < STATS_HISTOGRAM_BUCKETS; b++) {
+    uint32_t last = (uint64_t)(b + 1) * n / STATS_HISTOGRAM_BUCKETS;
+    column->bounds[b] = positions[last ? last - 1 : 0];
+  }
+}
+
+static table_stats *collect_stats(relation *table) {
+  tuple_format layout = tuple_format_from_relation(*table);
+  uint32_t column_count = layout.columns.size();
+
+  stats_sample sample;
+  sample.layout = layout;
+  sample.image = (uint8_t *)arena<query_arena>::alloc(layout.record_size);
+  sample.positions = (array<uint32_t, query_arena> *)arena<query_arena>::alloc(
+      sizeof(array<uint32_t, query_arena>) * column_count);
+  sample.hashes = (array<uint32_t, query_arena> *)arena<query_arena>::alloc(
+      sizeof(array<uint32_t, query_arena>) * column_count);
+  for (uint32_t col = 0; col < column_count; col++) {
+    sample.positions[col] = array<uint32_t, query_arena>();
+    sample.hashes[col] = array<uint32_t, query_arena>();
+  }
+
+  bt_sample_info info;
+  if (!bt_sample(&table->storage.btree, STATS_SAMPLE_LEAVES, sample_entry,
+                 &sample, &info)) {
+    return nullptr;
+  }
+
+  bool whole = info.sampled_leaves == info.leaf_pages;
+  uint64_t rows = info.sampled_entries;
+  if (!whole) {
+    rows = info.sampled_entries * info.leaf_pages / info.sampled_leaves;
+  }
+
+  table_stats *stats =
+      (table_stats *)arena<catalog_arena>::alloc(sizeof(table_stats));
+  stats->rows = rows;
+  stats->pages = info.leaf_pages + info.internal_pages;
+  stats->height = info.height;
+  stats->column_count = column_count;
+  stats->columns = (column_stats *)arena<catalog_arena>::alloc(
+      sizeof(column_stats) * column_count);
+  memset(stats->columns, 0, sizeof(column_stats) * column_count);
+
+  for (uint32_t col = 0; col < column_count; col++) {
+    column_stats *column = &stats->columns[col];
+    build_column(column, sample.positions[col]);
+    // Keys are unique, however alike their sample looks
+    column->distinct = col == 0 ? rows
+                                : estimate_distinct(sample.hashes[col], rows,
+                                                    whole);
+  }
+  return stats;
+}
+
+/*
+ * master_stats
+ */
+
+/* tbl_name, col and stat, after the id key */
+#define STATS_COL_TABLE 1
+#define STATS_COL_COLUMN 2
+#define STATS_COL_STAT 3
+
+static void delete_stats_rows(relation *stats_table, const char *table_name) {
+  tuple_format layout = tuple_format_from_relation(*stats_table);
+  uint8_t image[layout.record_size];
+
+  bt_cursor cursor = {.tree = &stats_table->storage.btree};
+  bool more = bt_cursor_first(&cursor);
+  while (more) {
+    const uint8_t *record = (const uint8_t *)bt_cursor_record(&cursor);
+    record_unpack(layout, record, image);
+
+    const char *name =
+        (const char *)image + layout.offsets[STATS_COL_TABLE - 1];
+    if (strncmp(name, table_name, RELATION_NAME_MAX_SIZE) != 0) {
+      more = bt_cursor_next(&cursor);
+      continue;
+    }
+
+    // The delete leaves the cursor on the next row, if there is one
+    record_release(layout, (const uint8_t *)bt_cursor_record(&cursor));
+    bt_cursor_delete(&cursor);
+    more = bt_cursoris_valid(&cursor);
+  }
+}
+
+static bool store_stats(relation *table, table_stats *stats) {
+  relation *stats_table = catalog_get(STATS_TABLE);
+  assert(stats_table && "ANALYZE creates master_stats before it runs");
+
+  delete_stats_rows(stats_table, table->name);
+
+  tuple_format layout = tuple_format_from_relation(*stats_table);
+  btree *tree = &stats_table->storage.btree;
+  bt_cursor cursor = {.tree = tree};
+
+  uint32_t id = 1;
+  if (bt_cursor_last(&cursor)) {
+    id = *(uint32_t *)bt_cursor_key(&cursor) + 1;
+  }
+
+  uint8_t image[layout.record_size];
+  uint8_t packed[tree->record_size];
+  uint32_t stat_size = type_size(layout.columns[STATS_COL_STAT]);
+
+  for (uint32_t col = 0; col < stats->column_count; col++, id++) {
+    column_stats *column = &stats->columns[col];
+    memset(image, 0, layout.record_size);
+    strncpy((char *)image + layout.offsets[STATS_COL_TABLE - 1], table->name,
+            RELATION_NAME_MAX_SIZE);
+    memcpy(image + layout.offsets[STATS_COL_COLUMN - 1], &col,
+           sizeof(uint32_t));
+
+    char *stat = (char *)image + layout.offsets[STATS_COL_STAT - 1];
+    int written = snprintf(stat, stat_size, "%llu %u %u %llu %u %u",
+                           (unsigned long long)stats->rows, stats->pages,
+                           stats->height,
+                           (unsigned long long)column->distinct, column->min,
+                           column->max);
+    for (uint32_t b = 0; b < STATS_HISTOGRAM_BUCKETS; b++) {
+      written += snprintf(stat + written, stat_size - written, " %u",
+                          column->bounds[b]);
+    }
+    assert((uint32_t)written < stat_size && "stat column too narrow");
+
+    uint32_t size = record_pack(layout, image, packed, tree->record_size);
+    if (!size || !bt_cursor_insert(&cursor, &id, packed, size)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool stats_analyze(relation *table) {
+  table_stats *stats = collect_stats(table);
+  if (!stats || !store_stats(table, stats)) {
+    return false;
+  }
+
+  catalog_set_stats(table, stats);
+  return true;
+}
+
+void stats_drop(const char *table_name) {
+  relation *stats_table = catalog_get(STATS_TABLE);
+  if (stats_table) {
+    delete_stats_rows(stats_table, table_name);
+  }
+}
+
+/*
+ * Parses a row's stat into the table's stats, which are made on its first
+ * row. Stats that don't parse are left out.
+ */
+static void load_stats_row(relation *table, uint32_t col, const char *stat) {
+  if (col >= table->columns.size()) {
+    return;
+  }
+
+  uint64_t fields[6 + STATS_HISTOGRAM_BUCKETS];
+  char *end;
+  for (uint32_t i = 0; i < 6 + STATS_HISTOGRAM_BUCKETS; i++) {
+    fields[i] = strtoull(stat, &end, 10);
+    if (end == stat) {
+      return;
+    }
+    stat = end;
+  }
+
+  table_stats *stats = table->stats;
+  if (!stats) {
+    uint32_t column_count = table->columns.size();
+    stats = (table_stats *)arena<catalog_arena>::alloc(sizeof(table_stats));
+    stats->column_count = column_count;
+    stats->columns = (column_stats *)arena<catalog_arena>::alloc(
+        sizeof(column_stats) * column_count);
+    memset(stats->columns, 0, sizeof(column_stats) * column_count);
+    table->stats = stats;
+  }
+
+  stats->rows = fields[0];
+  stats->pages = (uint32_t)fields[1];
+  stats->height = (uint32_t)fields[2];
+
+  column_stats *column = &stats->columns[col];
+  column->distinct = fields[3];
+  column->min = (uint32_t)fields[4];
+  column->max = (uint32_t)fields[5];
+  for (uint32_t b = 0; b < STATS_HISTOGRAM_BUCKETS; b++) {
+    column->bounds[b] = (uint32_t)fields[6 + b];
+  }
+}
+
+void stats_load() {
+  relation *stats_table = catalog_get(STATS_TABLE);
+  if (!stats_table) {
+    return;
+  }
+
+  tuple_format layout = tuple_format_from_relation(*stats_table);
+  uint8_t image[layout.record_size + 1];
+  image[layout.record_size] = '\0';
+
+  bt_cursor cursor = {.tree = &stats_table->storage.btree};
+  if (!bt_cursor_first(&cursor)) {
+    return;
+  }
+
+  do {
+    record_unpack(layout, (const uint8_t *)bt_cursor_record(&cursor), image);
+
+    char name[RELATION_NAME_MAX_SIZE + 1] = {};
+    memcpy(name, image + layout.offsets[STATS_COL_TABLE - 1],
+           RELATION_NAME_MAX_SIZE);
+    uint32_t col;
+    memcpy(&col, image + layout.offsets[STATS_COL_COLUMN - 1],
+           sizeof(uint32_t));
+
+    relation *table = catalog_get(name);
+    if (table) {
+      load_stats_row(table, col,
+                     (const char *)image + layout.offsets[STATS_COL_STAT - 1]);
+    }
+  } while (bt_cursor_next(&cursor));
+}
+
+/*
+ * Estimates
+ */
+
+double stats_equal_selectivity(table_stats *stats, uint32_t column) {
+  uint64_t distinct = stats->columns[column].distinct;
+  return distinct ? 1.0 / distinct : 1.0;
+}
+
+/*
+ * The fraction of the column's values below position, within a bucket
+ * taking its values to be spread evenly between its bounds
+ */
+static double fraction_below(column_stats *column, uint32_t position) {
+  if (position <= column->min) {
+    return 0.0;
+  }
+  if (position > column->max) {
+    return 1.0;
+  }
+
+  double bucket_share = 1.0 / STATS_HISTOGRAM_BUCKETS;
+  uint32_t low = column->min;
+  for (uint32_t b = 0; b < STATS_HISTOGRAM_BUCKETS; b++) {
+    uint32_t high = column->bounds[b];
+    if (position <= high) {
+      double within =
+          high > low ? (double)(position - low) / (high - low) : 0.0;
+      return bucket_share * (b + within);
+    }
+    low = high;
+  }
+  return 1.0;
+}
+
+double stats_range_selectivity(table_stats *stats, uint32_t column,
+                               data_type type, const void *lower,
+                               const void *upper) {
+  column_stats *col = &stats->columns[column];
+  double from = lower ? fraction_below(col, stats_position(type, lower)) : 0.0;
+  double to = upper ? fraction_below(col, stats_position(type, upper)) : 1.0;
+
+  // Values sharing a position with a bound count towards the range
+  double selectivity = to - from + stats_equal_selectivity(stats, column);
+  return std::clamp(selectivity, 0.0, 1.0);
+}
@@ -0,0 +1,104 @@
+/*
+ * SQL From Scratch
+ *
+ * Table Statistics
+ *
+ * 'ANALYZE users' (or 'ANALYZE' for every table) samples the table and keeps
+ * what it finds for the compiler, which uses it to pick between a table's
+ * access paths, see choose_access_path in compile.cpp:
+ *   - the number of rows and pages, and the height of the tree
+ *   - for each column, its smallest and largest value, an estimate of how
+ *     many distinct values it has, and an equi-depth histogram, the values
+ *     that cut its rows into STATS_HISTOGRAM_BUCKETS buckets of equal count
+ *
+ * Up to STATS_SAMPLE_LEAVES leaves, spread across the tree, are read, see
+ * bt_sample. A table that small is read whole and its stats are exact,
+ * otherwise the row count is scaled up from the sample, and the distinct
+ * count estimated from how many of the sample's values were seen only once.
+ *
+ * Values are placed on a line by stats_position, which keeps their order.
+ * A string's position is its first 4 bytes, so strings that share those
+ * share a bucket.
+ *
+ * Stats are kept in a system table next to master_catalog, one row per
+ * column, created the first time ANALYZE runs:
+ *
+ *   id | tbl_name | col | stat
+ *    1 | users    |   0 | '1000 9 2 1000 1 1000 63 125 ...'
+ *
+ * the stat being 'rows pages height distinct min max' then the bucket
+ * bounds. catalog_reload reads them back into each relation's stats, so
+ * they last across restarts, and rolling back an ANALYZE restores the old
+ * ones. They aren't kept up to date as rows change, only ANALYZE refreshes
+ * them. A table without them is planned as it was before ANALYZE existed.
+ */
+
+#pragma once
+#include "catalog.hpp"
+#include "common.hpp"
+#include <cstdint>
+
+#define STATS_TABLE		"master_stats"
+#define STATS_TABLE_SQL "CREATE TABLE master_stats (id INT, tbl_name TEXT, col INT, stat VARCHAR(320))"
+
+#define STATS_HISTOGRAM_BUCKETS 16
+#define STATS_SAMPLE_LEAVES		256
+
+/* The share of rows taken to be on one side of a bound that isn't known until the statement runs, a parameter */
+#define STATS_DEFAULT_RANGE 0.33
+
+struct column_stats
+{
+	uint64_t distinct;
+	uint32_t min; // Positions, see stats_position
+	uint32_t max;
+	uint32_t bounds[STATS_HISTOGRAM_BUCKETS]; // The largest value in each bucket
+};
+
+struct table_stats
+{
+	uint64_t	  rows;
+	uint32_t	  pages; // Leaves and internal nodes
+	uint32_t	  height;
+	uint32_t	  column_count;
+	column_stats *columns;
+};
+
+/*
+ * Where a value lies on its column's line, in the same order as the values
+ */
+uint32_t
+stats_position(data_type type, const void *value);
+
+/*
+ * Samples the table, stores its stats in master_stats and sets them on the
+ * relation, inside the caller's transaction. Bumps catalog_version so cached
+ * plans are recompiled with them.
+ */
+bool
+stats_analyze(relation *table);
+
+/*
+ * Removes a table's rows from master_stats as it's dropped
+ */
+void
+stats_drop(const char *table_name);
+
+/*
+ * Reads master_stats into the relations, see catalog_reload
+ */
+void
+stats_load();
+
+/*
+ * The fraction of the table's rows whose column is any one value
+ */
+double
+stats_equal_selectivity(table_stats *stats, uint32_t column);
+
+/*
+ * The fraction of the table's rows whose column lies between lower and
+ * upper, either nullptr for no bound on that side
+ */
+double
+stats_range_selectivity(table_stats *stats, uint32_t column, data_type type, const void *lower, const void *upper);
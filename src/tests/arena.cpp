@@ -0,0 +1,203 @@
+#include "arena.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "../arena.hpp"
+
+struct test_arena_tag
+{
+};
+
+using test_memory = arena<test_arena_tag>;
+
+static bool
+is_zero(const uint8_t *memory, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		if (memory[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * What was used comes back zeroed whether it was memset, for a little, or
+ * given to the OS, for a lot
+ */
+static void
+test_zero_on_reset()
+{
+	size_t sizes[] = {1000, ARENA_MEMSET_LIMIT + 12345};
+	for (size_t size : sizes)
+	{
+		uint8_t *memory = (uint8_t *)test_memory::alloc(size);
+		memset(memory, 0xff, size);
+		test_memory::reset();
+
+		uint8_t *again = (uint8_t *)test_memory::alloc(size);
+		assert(again == memory && is_zero(again, size));
+		test_memory::reset();
+	}
+
+	// Written past where current is rewound to, still zeroed by the reset
+	auto writer = stream_writer<test_arena_tag>::begin();
+	for (int i = 0; i < 100; i++)
+	{
+		writer.write("some bytes to abandon");
+	}
+	writer.abandon();
+	assert(test_memory::used() == 0);
+	test_memory::reset();
+	assert(is_zero((uint8_t *)test_memory::alloc(4096), 4096));
+	test_memory::reset();
+}
+
+static void
+test_decommit_policy()
+{
+	size_t watermark = 64 * 1024;
+	test_memory::set_decommit_policy(watermark, 3);
+	arena_stats before = test_memory::stats();
+
+	test_memory::alloc(1 << 20);
+	test_memory::reset();
+	assert(test_memory::committed() >= (1 << 20));
+
+	// A large reset in the run starts it over
+	test_memory::alloc(100);
+	test_memory::reset();
+	test_memory::alloc(1 << 20);
+	test_memory::reset();
+	for (int i = 0; i < 2; i++)
+	{
+		test_memory::alloc(100);
+		test_memory::reset();
+		assert(test_memory::committed() >= (1 << 20));
+	}
+
+	test_memory::alloc(100);
+	test_memory::reset();
+	assert(test_memory::committed() == watermark);
+
+	arena_stats after = test_memory::stats();
+	assert(after.decommits == before.decommits + 1);
+	assert(after.resets == before.resets + 6);
+	assert(after.peak >= (1 << 20));
+	assert(after.commits > before.commits);
+
+	// Recommitted pages come back zeroed
+	uint8_t *memory = (uint8_t *)test_memory::alloc(1 << 20);
+	assert(is_zero(memory, 1 << 20));
+	test_memory::set_decommit_policy(0, 0);
+	test_memory::reset();
+}
+
+/*
+ * Random inserts and removes, checked against a plain array of what each key
+ * should map to, so removes shift entries back through full groups
+ */
+static void
+test_hash_map_random()
+{
+	const uint32_t keys = 5000;
+	int32_t		  *expected = (int32_t *)test_memory::alloc(sizeof(int32_t) * keys);
+	memset(expected, 0xff, sizeof(int32_t) * keys);
+
+	hash_map<uint32_t, int32_t, test_arena_tag> map;
+	uint32_t									 size = 0;
+	uint64_t									 state = 42;
+	for (uint32_t i = 0; i < 200000; i++)
+	{
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		uint32_t key = (uint32_t)(state >> 33) % keys;
+		if ((state >> 20) % 3 == 0)
+		{
+			assert(map.remove(key) == (expected[key] >= 0));
+			size -= expected[key] >= 0;
+			expected[key] = -1;
+		}
+		else
+		{
+			assert(map.insert(key, (int32_t)i));
+			size += expected[key] < 0;
+			expected[key] = (int32_t)i;
+		}
+	}
+
+	assert(map.size() == size);
+	uint32_t iterated = 0;
+	for (auto [key, value] : map)
+	{
+		assert(expected[key] == value);
+		iterated++;
+	}
+	assert(iterated == size);
+	for (uint32_t key = 0; key < keys; key++)
+	{
+		int32_t *value = map.get(key);
+		assert(expected[key] < 0 ? !value : value && *value == expected[key]);
+	}
+
+	// Removing while walking the table misses nothing
+	uint32_t odd = 0;
+	for (uint32_t key = 0; key < keys; key++)
+	{
+		odd += expected[key] >= 0 && key % 2;
+	}
+	assert(map.remove_if([](uint32_t key, int32_t) { return key % 2 == 1; }) == odd);
+	for (uint32_t key = 0; key < keys; key++)
+	{
+		assert(map.contains(key) == (expected[key] >= 0 && key % 2 == 0));
+	}
+	test_memory::reset();
+}
+
+/*
+ * A map keyed by fixed_string found by string_view or const char *
+ */
+static void
+test_hash_map_strings()
+{
+	hash_map<fixed_string<16>, uint32_t, test_arena_tag> map;
+	char												 name[16];
+	for (uint32_t i = 0; i < 100; i++)
+	{
+		snprintf(name, sizeof(name), "table_%u", i);
+		map.insert(name, i);
+	}
+
+	std::string_view text = "table_42 and more";
+	assert(*map.get(text.substr(0, 8)) == 42);
+	assert(*map.get("table_7") == 7);
+	assert(!map.get(std::string_view("table_100")));
+	assert(map.contains(std::string_view("table_99")));
+
+	assert(map.remove(std::string_view("table_42")));
+	assert(!map.get("table_42") && map.size() == 99);
+	assert(*map.get(fixed_string<16>("table_43")) == 43);
+
+	// Longer than the key holds is cut as a key would be
+	map.insert("abcdefghijklmnopqrstuvwxyz", 1000);
+	assert(*map.get("abcdefghijklmnopqrstuvwxyz") == 1000);
+	test_memory::reset();
+}
+
+void
+test_arena()
+{
+	test_memory::init();
+
+	test_zero_on_reset();
+	test_decommit_policy();
+	test_hash_map_random();
+	test_hash_map_strings();
+
+	test_memory::shutdown();
+	printf("arena tests passed\n");
+}
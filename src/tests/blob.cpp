@@ -1,6 +1,8 @@
 #include "blob.hpp"
 #include "../os_layer.hpp"
 #include "../blob.hpp"
+#include "../btree.hpp"
+#include "../compress.hpp"
 #include "../common.hpp"
 #include "../pager.hpp"
 #include "../arena.hpp"
@@ -183,11 +185,289 @@ test_binary_data()
 	blob_delete(blob_id);
 }
 
+static void
+test_range_reads()
+{
+	const uint32_t total_size = (PAGE_SIZE - 12) * 5 + 100;
+	uint8_t		  *data = (uint8_t *)arena<query_arena>::alloc(total_size);
+	for (uint32_t i = 0; i < total_size; i++)
+	{
+		data[i] = (uint8_t)(i % 251);
+	}
+
+	uint32_t blob_id = blob_create(data, total_size);
+	ASSERT_PRINT(blob_get_size(blob_id) == total_size, "Size mismatch\n");
+
+	// Within a page, across pages, up to and past the end
+	uint8_t	 buffer[3 * PAGE_SIZE];
+	uint32_t ranges[][2] = {{0, 10}, {100, 500}, {PAGE_SIZE - 20, 40}, {2 * PAGE_SIZE, 2 * PAGE_SIZE},
+							{total_size - 50, 50}, {total_size - 50, 200}, {total_size, 10}, {total_size + 5000, 10}};
+	for (auto [offset, size] : ranges)
+	{
+		uint32_t expected = offset >= total_size ? 0 : (total_size - offset < size ? total_size - offset : size);
+		uint32_t copied = blob_read_range(blob_id, offset, buffer, size);
+		ASSERT_PRINT(copied == expected, "Range %u+%u: expected %u bytes, got %u\n", offset, size, expected, copied);
+		ASSERT_PRINT(memcmp(buffer, data + offset, copied) == 0, "Range %u+%u content mismatch\n", offset, size);
+	}
+
+	// A cursor walks the pages in place, from part way into the first
+	blob_cursor	   cursor;
+	const uint8_t *piece;
+	uint32_t	   piece_size;
+	uint32_t	   position = 5000;
+	uint32_t	   pieces = 0;
+	ASSERT_PRINT(blob_cursor_open(&cursor, blob_id, position), "Cursor open failed\n");
+	while (blob_cursor_next(&cursor, &piece, &piece_size))
+	{
+		ASSERT_PRINT(memcmp(piece, data + position, piece_size) == 0, "Cursor content mismatch at %u\n", position);
+		position += piece_size;
+		pieces++;
+	}
+	ASSERT_PRINT(position == total_size && pieces == 5, "Cursor ended at %u after %u pages\n", position, pieces);
+	ASSERT_PRINT(!blob_cursor_open(&cursor, blob_id, total_size), "Cursor opened past the end\n");
+
+	blob_delete(blob_id);
+}
+
+static void
+test_streaming_writes()
+{
+	const uint32_t total_size = (PAGE_SIZE - 12) * 4 + 1234;
+	uint8_t		  *data = (uint8_t *)arena<query_arena>::alloc(total_size);
+	for (uint32_t i = 0; i < total_size; i++)
+	{
+		data[i] = (uint8_t)(i * 7 % 253);
+	}
+
+	// Written in uneven pieces, the pages still end up consecutive
+	blob_writer writer = blob_write_begin();
+	uint32_t	written = 0;
+	for (uint32_t piece = 1; written < total_size; piece = piece * 3 + 1)
+	{
+		uint32_t size = total_size - written < piece ? total_size - written : piece;
+		ASSERT_PRINT(blob_write(&writer, data + written, size), "Write failed\n");
+		written += size;
+	}
+	uint32_t blob_id = writer.first_page;
+	ASSERT_PRINT(writer.last_page == blob_id + 4, "Pages %u to %u aren't consecutive\n", blob_id, writer.last_page);
+
+	size_t	 read_size;
+	uint8_t *result = blob_read_full(blob_id, &read_size);
+	ASSERT_PRINT(read_size == total_size && memcmp(result, data, total_size) == 0, "Streamed content mismatch\n");
+
+	// Appending to an existing blob, after another took the next page
+	uint32_t other = blob_create(data, 10);
+	writer = blob_write_begin(blob_id);
+	ASSERT_PRINT(writer.last_page == blob_id + 4, "Append begins at %u\n", writer.last_page);
+	ASSERT_PRINT(blob_write(&writer, data, total_size), "Append failed\n");
+	ASSERT_PRINT(blob_get_size(blob_id) == 2 * total_size, "Appended size %u\n", blob_get_size(blob_id));
+
+	uint8_t buffer[256];
+	ASSERT_PRINT(blob_read_range(blob_id, total_size - 100, buffer, 200) == 200, "Read across the append failed\n");
+	ASSERT_PRINT(memcmp(buffer, data + total_size - 100, 100) == 0 && memcmp(buffer + 100, data, 100) == 0,
+				 "Content across the append mismatch\n");
+
+	// Freed extents are reused as a whole
+	blob_delete(blob_id);
+	uint32_t again = blob_create(data, total_size);
+	ASSERT_PRINT(again == blob_id, "Expected the freed extent at %u, got %u\n", blob_id, again);
+
+	blob_delete(again);
+	blob_delete(other);
+}
+
+static uint32_t
+pages_in_use()
+{
+	pager_meta stats = pager_get_stats();
+	return stats.total_pages - stats.free_pages;
+}
+
+/*
+ * Rows of a templated document, repetitive enough to compress well
+ */
+static uint32_t
+write_documents(char *buffer, uint32_t count, uint32_t seed)
+{
+	uint32_t size = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		size += sprintf(buffer + size, "{\"id\": %u, \"status\": \"active\", \"tags\": [\"alpha\", \"beta\"], \"owner\": %u}\n",
+						seed + i, (seed + i) % 17);
+	}
+	return size;
+}
+
+static void
+test_codec()
+{
+	uint8_t	 input[20000];
+	uint8_t	 coded[22000];
+	uint8_t	 decoded[20000];
+	uint32_t sizes[] = {1, 11, 12, 13, 100, 4096, 20000};
+
+	// Repetitive, incompressible, and long runs of one byte
+	for (int kind = 0; kind < 3; kind++)
+	{
+		uint32_t state = 12345;
+		for (uint32_t i = 0; i < sizeof(input); i++)
+		{
+			state = state * 1103515245 + 12345;
+			input[i] = kind == 0 ? "abcabd"[i % 6] : kind == 1 ? (uint8_t)(state >> 16) : 'z';
+		}
+
+		for (uint32_t size : sizes)
+		{
+			uint32_t coded_size = lz_compress(input, size, coded, sizeof(coded));
+			ASSERT_PRINT(coded_size > 0, "Kind %d, size %u didn't compress\n", kind, size);
+			if (kind != 1 && size >= 100)
+			{
+				ASSERT_PRINT(coded_size < size / 4, "Kind %d, size %u coded to %u\n", kind, size, coded_size);
+			}
+
+			uint32_t decoded_size = lz_decompress(coded, coded_size, decoded, sizeof(decoded));
+			ASSERT_PRINT(decoded_size == size && memcmp(decoded, input, size) == 0, "Kind %d, size %u round trip\n",
+						 kind, size);
+
+			// Too little room for either is refused rather than overrun
+			ASSERT_PRINT(lz_decompress(coded, coded_size, decoded, size - 1) == 0 || size == 1, "Decoded past capacity\n");
+		}
+	}
+
+	ASSERT_PRINT(lz_compress(input, 1000, coded, 10) == 0, "Compressed past capacity\n");
+
+	// An offset back past the start of the output
+	uint8_t corrupt[] = {0x10, 'a', 0x05, 0x00};
+	ASSERT_PRINT(lz_decompress(corrupt, sizeof(corrupt), decoded, sizeof(decoded)) == 0, "Corrupt input decoded\n");
+}
+
+static void
+test_compressed_blob()
+{
+	char	*documents = (char *)arena<query_arena>::alloc(64 * 1024);
+	uint32_t size = write_documents(documents, 600, 0);
+
+	uint32_t before = pages_in_use();
+	uint32_t blob_id = blob_create(documents, size, true);
+	uint32_t pages = pages_in_use() - before;
+	ASSERT_PRINT(pages < (size / (PAGE_SIZE - 12)) / 2, "%u bytes compressed into %u pages\n", size, pages);
+	ASSERT_PRINT(blob_get_size(blob_id) == size, "Compressed size %u\n", blob_get_size(blob_id));
+
+	size_t	 read_size;
+	uint8_t *result = blob_read_full(blob_id, &read_size);
+	ASSERT_PRINT(read_size == size && memcmp(result, documents, size) == 0, "Compressed content mismatch\n");
+
+	char buffer[300];
+	ASSERT_PRINT(blob_read_range(blob_id, size - 200, buffer, 300) == 200, "Compressed range read\n");
+	ASSERT_PRINT(memcmp(buffer, documents + size - 200, 200) == 0, "Compressed range mismatch\n");
+
+	blob_writer writer = blob_write_begin(blob_id);
+	ASSERT_PRINT(!blob_write(&writer, documents, 10), "Appended to a compressed blob\n");
+
+	blob_delete(blob_id);
+	ASSERT_PRINT(pages_in_use() == before, "Compressed blob's pages not freed\n");
+
+	// Data that doesn't compress is stored as it is
+	uint8_t noise[9000];
+	uint32_t state = 99;
+	for (uint32_t i = 0; i < sizeof(noise); i++)
+	{
+		state = state * 1103515245 + 12345;
+		noise[i] = (uint8_t)(state >> 16);
+	}
+	blob_id = blob_create(noise, sizeof(noise), true);
+	writer = blob_write_begin(blob_id);
+	ASSERT_PRINT(blob_write(&writer, noise, 10), "Uncompressed blob is sealed\n");
+	ASSERT_PRINT(blob_get_size(blob_id) == sizeof(noise) + 10, "Uncompressed size\n");
+	blob_delete(blob_id);
+}
+
+static void
+test_dedup()
+{
+	btree	 dedup = blob_dedup_create();
+	char	*first = (char *)arena<query_arena>::alloc(64 * 1024);
+	char	*second = (char *)arena<query_arena>::alloc(64 * 1024);
+	uint32_t first_size = write_documents(first, 200, 0);
+	uint32_t second_size = write_documents(second, 200, 1);
+
+	uint32_t before = pages_in_use();
+	uint32_t a = blob_create(first, first_size, false, &dedup);
+	uint32_t used = pages_in_use();
+	uint32_t b = blob_create(first, first_size, false, &dedup);
+	ASSERT_PRINT(a == b && pages_in_use() == used, "Identical blob stored again\n");
+
+	uint32_t c = blob_create(second, second_size, false, &dedup);
+	ASSERT_PRINT(c != a, "Different blob shared\n");
+
+	// The range reads skip the blob_info
+	char buffer[100];
+	ASSERT_PRINT(blob_read_range(a, 5000, buffer, 100) == 100 && memcmp(buffer, first + 5000, 100) == 0,
+				 "Shared range mismatch\n");
+	ASSERT_PRINT(blob_get_size(a) == first_size, "Shared size %u\n", blob_get_size(a));
+
+	blob_writer writer = blob_write_begin(a);
+	ASSERT_PRINT(!blob_write(&writer, first, 10), "Appended to a shared blob\n");
+
+	blob_delete(a, &dedup);
+	size_t	 read_size;
+	uint8_t *result = blob_read_full(b, &read_size);
+	ASSERT_PRINT(read_size == first_size && memcmp(result, first, first_size) == 0, "Shared blob freed early\n");
+	blob_delete(b, &dedup);
+	blob_delete(c, &dedup);
+
+	// Only the index's root is left, and nothing's in it
+	bt_cursor cursor = {.tree = &dedup};
+	ASSERT_PRINT(!bt_cursor_first(&cursor), "Dedup entries left behind\n");
+	ASSERT_PRINT(pages_in_use() == before, "Shared blobs' pages not freed\n");
+
+	// Compressed and shared
+	a = blob_create(first, first_size, true, &dedup);
+	b = blob_create(first, first_size, true, &dedup);
+	ASSERT_PRINT(a == b, "Identical compressed blob stored again\n");
+	result = blob_read_full(a, &read_size);
+	ASSERT_PRINT(read_size == first_size && memcmp(result, first, first_size) == 0, "Compressed shared mismatch\n");
+	blob_delete(a, &dedup);
+	blob_delete(b, &dedup);
+	ASSERT_PRINT(pages_in_use() == before, "Compressed shared blob's pages not freed\n");
+
+	bt_clear(&dedup);
+}
+
+/*
+ * The database's index is found again after a reopen, through its root slot
+ */
+static void
+test_dedup_persisted()
+{
+	char	*first = (char *)arena<query_arena>::alloc(64 * 1024);
+	uint32_t first_size = write_documents(first, 200, 0);
+
+	btree	 dedup = blob_dedup_open();
+	uint32_t root = dedup.root_page_index;
+	uint32_t a = blob_create(first, first_size, false, &dedup);
+	pager_commit();
+	pager_close();
+
+	pager_open("test_blob.db");
+	pager_begin_transaction();
+	dedup = blob_dedup_open();
+	ASSERT_PRINT(dedup.root_page_index == root, "Dedup index not found again\n");
+	uint32_t b = blob_create(first, first_size, false, &dedup);
+	ASSERT_PRINT(a == b, "Identical blob not shared after a reopen\n");
+
+	blob_delete(a, &dedup);
+	blob_delete(b, &dedup);
+	bt_cursor cursor = {.tree = &dedup};
+	ASSERT_PRINT(!bt_cursor_first(&cursor), "Dedup entries left behind\n");
+}
+
 int
 test_blob()
 {
 
 	arena<query_arena>::init(16 * 1024 * 1024);
+	os_file_delete("test_blob.db");
 	pager_open("test_blob.db");
 
 	pager_begin_transaction();
@@ -197,6 +477,12 @@ test_blob()
 	test_page_boundary();
 	test_multi_page_blob();
 	test_binary_data();
+	test_range_reads();
+	test_streaming_writes();
+	test_codec();
+	test_compressed_blob();
+	test_dedup();
+	test_dedup_persisted();
 
 	os_file_delete("test_blob.db");
 
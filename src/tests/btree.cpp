@@ -419,12 +419,7 @@ test_btree_multiple_cursors()
 void
 test_btree_page_eviction()
 {
-	if (MAX_CACHE_ENTRIES > 10)
-	{
-		return;
-	}
-
-	pager_open(TEST_DB);
+	pager_open(TEST_DB, PAGER_MIN_CACHE_PAGES);
 	pager_begin_transaction();
 
 	btree	  tree = bt_create(TYPE_U32, sizeof(uint32_t), true);
@@ -467,6 +462,535 @@ test_btree_page_eviction()
 	os_file_delete(TEST_DB);
 }
 
+/*
+ * Full scans in both directions, changing direction midway, with too few
+ * frames to hold the tree, so read-ahead runs across several parents
+ */
+void
+test_btree_sequential_scan()
+{
+	os_file_delete(TEST_DB);
+	pager_open(TEST_DB, PAGER_MIN_CACHE_PAGES);
+	pager_begin_transaction();
+
+	btree	  tree = bt_create(TYPE_U32, sizeof(uint32_t), true);
+	bt_cursor cursor = {.tree = &tree};
+
+	const uint32_t count = 20000;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		assert(bt_cursor_insert(&cursor, &i, &i));
+	}
+	pager_commit();
+
+	assert(bt_cursor_first(&cursor));
+	uint32_t expected = 0;
+	do
+	{
+		assert(*(uint32_t *)bt_cursor_key(&cursor) == expected++);
+	} while (bt_cursor_next(&cursor));
+	assert(expected == count);
+
+	assert(bt_cursor_last(&cursor));
+	do
+	{
+		assert(*(uint32_t *)bt_cursor_key(&cursor) == --expected);
+	} while (expected > count / 2 && bt_cursor_previous(&cursor));
+
+	while (bt_cursor_next(&cursor))
+	{
+		assert(*(uint32_t *)bt_cursor_key(&cursor) == ++expected);
+	}
+	assert(expected == count - 1);
+
+	pager_close();
+	os_file_delete(TEST_DB);
+}
+
+/*
+ * Two trees interleaved through the file, one emptied out and a third dropped,
+ * then compacted in two steps
+ */
+void
+test_btree_vacuum()
+{
+	arena<query_arena>::init();
+	os_file_delete(TEST_DB);
+	pager_open(TEST_DB, PAGER_MIN_CACHE_PAGES);
+	pager_begin_transaction();
+
+	btree	  kept = bt_create(TYPE_U32, sizeof(uint32_t), true);
+	btree	  thinned = bt_create(TYPE_U32, sizeof(uint32_t), true);
+	btree	  dropped = bt_create(TYPE_U32, sizeof(uint32_t), true);
+	bt_cursor kept_cursor = {.tree = &kept};
+	bt_cursor thinned_cursor = {.tree = &thinned};
+	bt_cursor dropped_cursor = {.tree = &dropped};
+
+	const uint32_t count = 30000;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		assert(bt_cursor_insert(&dropped_cursor, &i, &i));
+		assert(bt_cursor_insert(&kept_cursor, &i, &i));
+		assert(bt_cursor_insert(&thinned_cursor, &i, &i));
+	}
+	pager_commit();
+	uint32_t full_pages = pager_get_stats().total_pages;
+
+	pager_begin_transaction();
+	bt_clear(&dropped);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (i % 100 != 0)
+		{
+			assert(bt_cursor_seek(&thinned_cursor, &i));
+			assert(bt_cursor_delete(&thinned_cursor));
+		}
+	}
+	pager_commit();
+	assert(pager_get_stats().free_pages > full_pages / 3);
+
+	btree *trees[] = {&kept, &thinned};
+
+	pager_begin_transaction();
+	assert(bt_vacuum(trees, 2, 10) == 10);
+	pager_commit();
+	bt_validate(&kept);
+	bt_validate(&thinned);
+
+	pager_begin_transaction();
+	assert(bt_vacuum(trees, 2) > 0);
+	pager_commit();
+	bt_validate(&kept);
+	bt_validate(&thinned);
+
+	pager_meta stats = pager_get_stats();
+	assert(stats.total_pages < full_pages / 2 && "The file should have shrunk");
+	os_file_handle_t handle = os_file_open(TEST_DB, false, false);
+	assert(os_file_size(handle) == (stats.total_pages + 1) * PAGE_SIZE);
+	os_file_close(handle);
+
+	pager_begin_transaction();
+	assert(bt_vacuum(trees, 2) == 0 && "Nothing left to move");
+	pager_commit();
+
+	/* Everything's still there, in order, from both ends */
+	uint32_t expected = 0;
+	assert(bt_cursor_first(&kept_cursor));
+	do
+	{
+		assert(*(uint32_t *)bt_cursor_key(&kept_cursor) == expected);
+		assert(*(uint32_t *)bt_cursor_record(&kept_cursor) == expected++);
+	} while (bt_cursor_next(&kept_cursor));
+	assert(expected == count);
+
+	assert(bt_cursor_last(&thinned_cursor));
+	expected = count;
+	do
+	{
+		expected -= 100;
+		assert(*(uint32_t *)bt_cursor_key(&thinned_cursor) == expected);
+	} while (bt_cursor_previous(&thinned_cursor));
+	assert(expected == 0);
+
+	pager_close();
+	os_file_delete(TEST_DB);
+	arena<query_arena>::reset();
+}
+
+static uint32_t
+count_leaves(btree *tree)
+{
+	bt_cursor cursor = {.tree = tree};
+	uint32_t  leaves = 0;
+	uint32_t  last_leaf = 0;
+	if (bt_cursor_first(&cursor))
+	{
+		do
+		{
+			if (cursor.leaf_page != last_leaf)
+			{
+				last_leaf = cursor.leaf_page;
+				leaves++;
+			}
+		} while (bt_cursor_next(&cursor));
+	}
+	return leaves;
+}
+
+/*
+ * Build a tree of count entries with the bulk loader and check it's a valid
+ * tree holding everything in order. Returns the number of leaves.
+ */
+static uint32_t
+bulk_load_and_check(data_type key_type, uint32_t record_size, uint32_t count, uint32_t fill_percent,
+					bool compress_keys = true)
+{
+	btree		   tree = bt_create(key_type, record_size, true, compress_keys);
+	bt_bulk_loader loader;
+	assert(bt_bulk_begin(&loader, &tree, fill_percent));
+
+	uint8_t key[256] = {0};
+	uint8_t record[1024] = {0};
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (key_type == TYPE_U32)
+		{
+			memcpy(key, &i, sizeof(i));
+		}
+		else
+		{
+			snprintf((char *)key, sizeof(key), "key_%08u", i);
+		}
+		memcpy(record, &i, sizeof(i));
+		assert(bt_bulk_append(&loader, key, record));
+	}
+	assert(loader.count == count);
+	assert(bt_bulk_finish(&loader));
+	bt_validate(&tree);
+
+	bt_cursor cursor = {.tree = &tree};
+	uint32_t  expected = 0;
+	if (bt_cursor_first(&cursor))
+	{
+		do
+		{
+			assert(*(uint32_t *)bt_cursor_record(&cursor) == expected++);
+		} while (bt_cursor_next(&cursor));
+	}
+	assert(expected == count);
+	uint32_t leaves = count_leaves(&tree);
+
+	bt_clear(&tree);
+	return leaves;
+}
+
+void
+test_btree_bulk_load()
+{
+	os_file_delete(TEST_DB);
+	pager_open(TEST_DB);
+	pager_begin_transaction();
+
+	/* Every size through the first few levels, to hit each right edge fix-up */
+	btree wide_keys = bt_create(TYPE_CHAR256, 1000, false, false);
+	for (uint32_t fill : {100u, 60u, 1u})
+	{
+		for (uint32_t count = 0; count < 400; count++)
+		{
+			bulk_load_and_check(TYPE_CHAR256, 1000, count, fill, false);
+			bulk_load_and_check(TYPE_CHAR256, 1000, count, fill);
+		}
+	}
+	assert(wide_keys.leaf_max_keys == 3 && wide_keys.internal_max_keys == 15);
+
+	/* Leaves are packed to the fill factor */
+	btree	 narrow = bt_create(TYPE_U32, sizeof(uint32_t), false);
+	uint32_t per_leaf = narrow.leaf_max_keys;
+	assert(bulk_load_and_check(TYPE_U32, sizeof(uint32_t), per_leaf * 100, 100) == 100);
+	assert(bulk_load_and_check(TYPE_U32, sizeof(uint32_t), (per_leaf / 2) * 100, 50) == 100);
+	assert(bulk_load_and_check(TYPE_U32, sizeof(uint32_t), 200000, 90) > 0);
+	pager_commit();
+
+	/* Out of order keys are refused, and only an empty tree can be loaded */
+	pager_begin_transaction();
+	btree		   tree = bt_create(TYPE_U32, sizeof(uint32_t), true);
+	bt_bulk_loader loader;
+	assert(bt_bulk_begin(&loader, &tree, 80));
+	for (uint32_t i = 0; i < 5000; i++)
+	{
+		uint32_t key = i * 2;
+		assert(bt_bulk_append(&loader, &key, &key));
+	}
+	uint32_t duplicate = 9998;
+	assert(!bt_bulk_append(&loader, &duplicate, &duplicate));
+	uint32_t smaller = 10;
+	assert(!bt_bulk_append(&loader, &smaller, &smaller));
+	assert(bt_bulk_finish(&loader));
+	assert(!bt_bulk_begin(&loader, &tree, 100));
+
+	/* The loaded tree takes ordinary inserts and deletes */
+	bt_cursor cursor = {.tree = &tree};
+	for (uint32_t i = 1; i < 10000; i += 2)
+	{
+		assert(bt_cursor_insert(&cursor, &i, &i));
+	}
+	for (uint32_t i = 0; i < 10000; i += 3)
+	{
+		assert(bt_cursor_seek(&cursor, &i));
+		assert(bt_cursor_delete(&cursor));
+	}
+	bt_validate(&tree);
+	pager_commit();
+
+	pager_close();
+	os_file_delete(TEST_DB);
+}
+
+void
+test_btree_append_splits()
+{
+	os_file_delete(TEST_DB);
+	pager_open(TEST_DB);
+	pager_begin_transaction();
+
+	/* Ascending inserts leave every leaf but the last one full */
+	btree	  tree = bt_create(TYPE_U32, sizeof(uint32_t), true);
+	bt_cursor cursor = {.tree = &tree};
+	const uint32_t count = 100000;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		assert(bt_cursor_insert(&cursor, &i, &i));
+	}
+	bt_validate(&tree);
+	uint32_t per_leaf = tree.leaf_max_keys;
+	assert(count_leaves(&tree) == (count + per_leaf - 1) / per_leaf);
+
+	/* Wide keys make the internal levels split along the right spine too */
+	btree wide = bt_create(TYPE_CHAR256, 1000, true);
+	bt_cursor wide_cursor = {.tree = &wide};
+	uint8_t key[256] = {0};
+	uint8_t record[1000] = {0};
+	for (uint32_t i = 0; i < 3000; i++)
+	{
+		snprintf((char *)key, sizeof(key), "key_%08u", i);
+		memcpy(record, &i, sizeof(i));
+		assert(bt_cursor_insert(&wide_cursor, key, record));
+	}
+	bt_validate(&wide);
+	assert(count_leaves(&wide) == 1000);
+
+	/* Out of order inserts still split in the middle */
+	for (uint32_t i = 1; i < 3000; i += 2)
+	{
+		snprintf((char *)key, sizeof(key), "key_%08u_", i);
+		assert(bt_cursor_insert(&wide_cursor, key, record));
+	}
+	bt_validate(&wide);
+
+	/* The underfull right spine is repaired by deletes like any other node */
+	for (uint32_t i = count; i-- > 0;)
+	{
+		if (i % 7 != 0)
+		{
+			assert(bt_cursor_seek(&cursor, &i));
+			assert(bt_cursor_delete(&cursor));
+		}
+		if (i % 10000 == 0)
+		{
+			bt_validate(&tree);
+		}
+	}
+	for (uint32_t i = count; i < count + 5000; i++)
+	{
+		assert(bt_cursor_insert(&cursor, &i, &i));
+	}
+	bt_validate(&tree);
+	pager_commit();
+
+	pager_close();
+	os_file_delete(TEST_DB);
+}
+
+/* Key bytes for the i'th smallest key of the given type */
+static void
+make_search_key(data_type type, int32_t i, uint8_t *key)
+{
+	memset(key, 0, 64);
+	switch (type_id(type))
+	{
+	case TYPE_ID_U32: {
+		uint32_t value = i;
+		memcpy(key, &value, sizeof(value));
+		break;
+	}
+	case TYPE_ID_I64: {
+		int64_t value = (int64_t)i - 5000;
+		memcpy(key, &value, sizeof(value));
+		break;
+	}
+	case TYPE_ID_F64: {
+		double value = (i - 5000) * 0.5;
+		memcpy(key, &value, sizeof(value));
+		break;
+	}
+	case TYPE_ID_CHAR:
+		snprintf((char *)key, type_size(type), "k%08d", i);
+		break;
+	default: {
+		uint32_t high = i / 16, low = i % 16;
+		pack_dual(key, TYPE_U32, &high, TYPE_U32, &low);
+		break;
+	}
+	}
+}
+
+/*
+ * The search bt_create picks for each key type agrees with plain ordering:
+ * even keys are present, odd ones seek to their successor.
+ */
+void
+test_btree_key_search()
+{
+	os_file_delete(TEST_DB);
+	pager_open(TEST_DB);
+	pager_begin_transaction();
+
+	data_type types[] = {TYPE_U32, TYPE_I64, TYPE_F64, TYPE_CHAR16, TYPE_CHAR32, make_dual(TYPE_U32, TYPE_U32)};
+	const int32_t count = 6000;
+
+	std::vector<int32_t> order;
+	for (int32_t i = 0; i < count; i += 2)
+	{
+		order.push_back(i);
+	}
+	std::mt19937 rng(42);
+	std::shuffle(order.begin(), order.end(), rng);
+
+	for (data_type type : types)
+	{
+		btree	  tree = bt_create(type, sizeof(int32_t), true);
+		bt_cursor cursor = {.tree = &tree};
+		uint8_t	  key[64];
+
+		for (int32_t i : order)
+		{
+			make_search_key(type, i, key);
+			assert(bt_cursor_insert(&cursor, key, &i));
+		}
+		bt_validate(&tree);
+
+		for (int32_t i = 0; i < count; i++)
+		{
+			make_search_key(type, i, key);
+			bool found = bt_cursor_seek(&cursor, key);
+			assert(found == (i % 2 == 0));
+			if (found)
+			{
+				assert(*(int32_t *)bt_cursor_record(&cursor) == i);
+			}
+
+			if (i < count - 2)
+			{
+				assert(bt_cursor_seek(&cursor, key, GT));
+				assert(*(int32_t *)bt_cursor_record(&cursor) == i + (i % 2 == 0 ? 2 : 1));
+			}
+		}
+		bt_clear(&tree);
+	}
+	pager_commit();
+
+	pager_close();
+	os_file_delete(TEST_DB);
+}
+
+/*
+ * String trees keep prefixes of their keys in internal nodes, dual keys a
+ * normalized copy. Keys sharing a prefix longer than that are still found,
+ * by following the leaf chain from the leftmost leaf with the prefix.
+ */
+void
+test_btree_separators()
+{
+	os_file_delete(TEST_DB);
+	pager_open(TEST_DB);
+	pager_begin_transaction();
+
+	btree full = bt_create(TYPE_CHAR32, sizeof(uint32_t), true, false);
+	btree prefixed = bt_create(TYPE_CHAR32, sizeof(uint32_t), true);
+	assert(prefixed.separator_format == BT_SEPARATOR_PREFIX);
+	assert(prefixed.internal_max_keys > full.internal_max_keys);
+
+	/* The same keys take fewer internal nodes */
+	std::vector<int> order;
+	for (int i = 0; i < 60000; i++)
+	{
+		order.push_back(i);
+	}
+	std::mt19937 rng(7);
+	std::shuffle(order.begin(), order.end(), rng);
+
+	btree	*trees[] = {&full, &prefixed};
+	uint32_t pages[2];
+	char	 key[32];
+	for (uint32_t t = 0; t < 2; t++)
+	{
+		uint32_t  before = pager_get_stats().total_pages;
+		bt_cursor cursor = {.tree = trees[t]};
+		for (int i : order)
+		{
+			memset(key, 0, sizeof(key));
+			snprintf(key, sizeof(key), "customer-%06d@example.com", i);
+			assert(bt_cursor_insert(&cursor, key, &i));
+		}
+		bt_validate(trees[t]);
+		pages[t] = pager_get_stats().total_pages - before;
+	}
+	assert(pages[1] < pages[0]);
+
+	/* Runs of keys sharing the whole prefix span many leaves */
+	btree	  runs = bt_create(TYPE_CHAR32, sizeof(uint32_t), true);
+	bt_cursor cursor = {.tree = &runs};
+	order.resize(3000);
+	for (int i = 0; i < 3000; i++)
+	{
+		order[i] = i;
+	}
+	std::shuffle(order.begin(), order.end(), rng);
+	for (int i : order)
+	{
+		memset(key, 0, sizeof(key));
+		snprintf(key, sizeof(key), "%s-%04d", i % 2 ? "same-prefix-everywhere" : "another-prefix-shared", i);
+		assert(bt_cursor_insert(&cursor, key, &i));
+	}
+	bt_validate(&runs);
+
+	for (int i = 0; i < 3000; i++)
+	{
+		memset(key, 0, sizeof(key));
+		snprintf(key, sizeof(key), "%s-%04d", i % 2 ? "same-prefix-everywhere" : "another-prefix-shared", i);
+		assert(bt_cursor_seek(&cursor, key));
+		assert(*(uint32_t *)bt_cursor_record(&cursor) == (uint32_t)i);
+		if (i % 3 == 0)
+		{
+			assert(bt_cursor_delete(&cursor));
+		}
+	}
+	bt_validate(&runs);
+
+	for (int i = 0; i < 3000; i++)
+	{
+		memset(key, 0, sizeof(key));
+		snprintf(key, sizeof(key), "%s-%04d", i % 2 ? "same-prefix-everywhere" : "another-prefix-shared", i);
+		assert(bt_cursor_seek(&cursor, key) == (i % 3 != 0));
+	}
+
+	/* Negative and positive components of a dual sort through the encoding */
+	btree dual = bt_create(make_dual(TYPE_I32, TYPE_F64), sizeof(uint32_t), true);
+	assert(dual.separator_format == BT_SEPARATOR_NORMALIZED);
+	bt_cursor dual_cursor = {.tree = &dual};
+	uint8_t	  pair[12];
+	for (int i = -3000; i < 3000; i++)
+	{
+		int32_t high = i / 10;
+		double	low = (i % 10) * -1.5;
+		pack_dual(pair, TYPE_I32, &high, TYPE_F64, &low);
+		assert(bt_cursor_insert(&dual_cursor, pair, &i));
+	}
+	bt_validate(&dual);
+	for (int i = -3000; i < 3000; i++)
+	{
+		int32_t high = i / 10;
+		double	low = (i % 10) * -1.5;
+		pack_dual(pair, TYPE_I32, &high, TYPE_F64, &low);
+		assert(bt_cursor_seek(&dual_cursor, pair));
+		assert(*(int *)bt_cursor_record(&dual_cursor) == i);
+	}
+	pager_commit();
+
+	pager_close();
+	os_file_delete(TEST_DB);
+}
+
 void
 test_btree_varchar_collation()
 {
@@ -993,6 +1517,138 @@ test_btree_sequential_ops_parameterized(const btree_test_config &config)
 	os_file_delete(TEST_DB);
 }
 
+/*
+ * Deleting during a scan leaves the cursor on the successor, through merges
+ * and borrows, and truncating keeps the root page
+ */
+void
+test_btree_delete_during_scan()
+{
+	os_file_delete(TEST_DB);
+	pager_open(TEST_DB);
+	pager_begin_transaction();
+
+	btree	  tree = bt_create(TYPE_U32, sizeof(uint32_t), true);
+	bt_cursor cursor = {.tree = &tree};
+
+	const uint32_t COUNT = tree.leaf_max_keys * 40;
+	for (uint32_t i = 0; i < COUNT; i++)
+	{
+		assert(bt_cursor_insert(&cursor, &i, &i));
+	}
+
+	/* Keep every third key, the scan must still see each key once in order */
+	uint32_t expected = 0;
+	bool	 valid = bt_cursor_first(&cursor);
+	while (valid)
+	{
+		uint32_t key = *(uint32_t *)bt_cursor_key(&cursor);
+		assert(key == expected);
+		expected++;
+
+		if (key % 3 != 0)
+		{
+			assert(bt_cursor_delete(&cursor));
+			valid = bt_cursoris_valid(&cursor);
+		}
+		else
+		{
+			valid = bt_cursor_next(&cursor);
+		}
+	}
+	assert(expected == COUNT);
+	bt_validate(&tree);
+
+	expected = 0;
+	valid = bt_cursor_first(&cursor);
+	while (valid)
+	{
+		assert(*(uint32_t *)bt_cursor_key(&cursor) == expected);
+		expected += 3;
+		valid = bt_cursor_next(&cursor);
+	}
+	assert(expected == (COUNT + 2) / 3 * 3);
+
+	/* Deleting the last key leaves the cursor invalid */
+	assert(bt_cursor_last(&cursor));
+	assert(bt_cursor_delete(&cursor));
+	assert(!bt_cursoris_valid(&cursor));
+
+	uint32_t root = tree.root_page_index;
+	assert(bt_truncate(&tree));
+	assert(tree.root_page_index == root);
+	assert(!bt_cursor_first(&cursor));
+	bt_validate(&tree);
+
+	for (uint32_t i = 0; i < COUNT; i++)
+	{
+		assert(bt_cursor_insert(&cursor, &i, &i));
+	}
+	bt_validate(&tree);
+	assert(bt_cursor_first(&cursor));
+
+	pager_rollback();
+	pager_close();
+	os_file_delete(TEST_DB);
+}
+
+static BT_MATCH_RESULT
+match_sevens_below(void *context, const uint8_t *key, const uint8_t *record)
+{
+	uint32_t limit = *(uint32_t *)context;
+	uint32_t value = *(uint32_t *)key;
+	assert(*(uint32_t *)record == value * 2);
+
+	if (value >= limit)
+	{
+		return BT_MATCH_STOP;
+	}
+	return value % 7 == 0 ? BT_MATCH_FOUND : BT_MATCH_SKIP;
+}
+
+/*
+ * bt_cursor_scan visits the matching entries across leaves and stops early
+ */
+void
+test_btree_scan_match()
+{
+	os_file_delete(TEST_DB);
+	pager_open(TEST_DB);
+	pager_begin_transaction();
+
+	btree	  tree = bt_create(TYPE_U32, sizeof(uint32_t), true);
+	bt_cursor cursor = {.tree = &tree};
+
+	const uint32_t COUNT = tree.leaf_max_keys * 10;
+	for (uint32_t i = 0; i < COUNT; i++)
+	{
+		uint32_t record = i * 2;
+		assert(bt_cursor_insert(&cursor, &i, &record));
+	}
+
+	uint32_t limit = COUNT - tree.leaf_max_keys / 2;
+	uint32_t expected = 0;
+	bool	 found = bt_cursor_first(&cursor) && bt_cursor_scan(&cursor, match_sevens_below, &limit, true);
+	while (found)
+	{
+		assert(*(uint32_t *)bt_cursor_key(&cursor) == expected);
+		expected += 7;
+		found = bt_cursor_scan(&cursor, match_sevens_below, &limit);
+	}
+	assert(expected == (limit + 6) / 7 * 7);
+	assert(!bt_cursoris_valid(&cursor));
+
+	/* from_current only takes the current entry if it matches */
+	uint32_t start = 8;
+	assert(bt_cursor_seek(&cursor, &start));
+	assert(bt_cursor_scan(&cursor, match_sevens_below, &limit, true));
+	assert(*(uint32_t *)bt_cursor_key(&cursor) == 14);
+
+	pager_rollback();
+	pager_close();
+	os_file_delete(TEST_DB);
+}
+
 void
 test_btree_sequential_all_types()
 {
@@ -1012,6 +1668,214 @@ test_btree_sequential_all_types()
 }
 
 
+/*
+ * Inserts through a cursor that's already on the key's leaf go straight in,
+ * the rest search from the root as ever. Either way the tree has to come out
+ * the same.
+ */
+void
+test_btree_cursor_insert_in_leaf()
+{
+	os_file_delete(TEST_DB);
+	pager_open(TEST_DB);
+	pager_begin_transaction();
+
+	/* Ascending runs with gaps, then the gaps filled in, backwards */
+	btree	  tree = bt_create(TYPE_U32, sizeof(uint32_t), true);
+	bt_cursor cursor = {.tree = &tree};
+	for (uint32_t pass = 0; pass < 2; pass++)
+	{
+		for (uint32_t i = 0; i < 20000; i++)
+		{
+			uint32_t key = pass == 0 ? i * 2 : (20000 - i) * 2 - 1;
+			assert(bt_cursor_insert(&cursor, &key, &i));
+			assert(*(uint32_t *)bt_cursor_key(&cursor) == key);
+			assert(!bt_cursor_insert(&cursor, &key, &i));
+		}
+		bt_validate(&tree);
+	}
+
+	uint32_t expected = 0;
+	assert(bt_cursor_first(&cursor));
+	do
+	{
+		assert(*(uint32_t *)bt_cursor_key(&cursor) == expected++);
+	} while (bt_cursor_next(&cursor));
+	assert(expected == 40000);
+
+	/* Nearby string keys, whose leaves are told apart by prefix separators */
+	btree	  strings = bt_create(TYPE_CHAR32, sizeof(uint32_t), true);
+	bt_cursor string_cursor = {.tree = &strings};
+	std::mt19937 rng(11);
+	char		 key[32];
+	for (uint32_t i = 0; i < 20000; i++)
+	{
+		uint32_t near = i + rng() % 64;
+		memset(key, 0, sizeof(key));
+		snprintf(key, sizeof(key), "order-%08u", near);
+		bt_cursor_insert(&string_cursor, key, &near);
+	}
+	bt_validate(&strings);
+
+	for (uint32_t i = 0; i < 20000; i++)
+	{
+		memset(key, 0, sizeof(key));
+		snprintf(key, sizeof(key), "order-%08u", i);
+		if (bt_cursor_seek(&string_cursor, key))
+		{
+			assert(*(uint32_t *)bt_cursor_record(&string_cursor) == i);
+		}
+	}
+
+	pager_rollback();
+	pager_close();
+	os_file_delete(TEST_DB);
+}
+
+/* A record of size bytes that only key's could be */
+static uint32_t
+fill_variable_record(uint32_t key, uint32_t size, uint8_t *record)
+{
+	for (uint32_t i = 0; i < size; i++)
+	{
+		record[i] = (uint8_t)(key * 31 + i);
+	}
+	return size;
+}
+
+static void
+check_variable_record(bt_cursor *cursor, uint32_t key, uint32_t size)
+{
+	uint8_t expected[2048];
+	fill_variable_record(key, size, expected);
+	assert(bt_cursor_record_size(cursor) == size);
+	assert(0 == memcmp(bt_cursor_record(cursor), expected, size));
+}
+
+void
+test_btree_variable_records()
+{
+	os_file_delete(TEST_DB);
+	pager_open(TEST_DB);
+	pager_begin_transaction();
+
+	/* The largest record is capped to a third of the heap */
+	btree tree = bt_create(TYPE_U32, 4000, true, true, true);
+	assert(tree.variable_records && tree.record_size * 3 < PAGE_SIZE);
+	assert(tree.leaf_min_keys == 1);
+
+	/* Sizes from a few bytes to the largest, in random order */
+	const uint32_t	COUNT = 5000;
+	std::mt19937	rng(5);
+	std::vector<uint32_t> sizes(COUNT);
+	std::vector<uint32_t> keys(COUNT);
+	for (uint32_t i = 0; i < COUNT; i++)
+	{
+		keys[i] = i;
+		sizes[i] = rng() % 8 == 0 ? tree.record_size - rng() % 16 : 1 + rng() % 64;
+	}
+	std::shuffle(keys.begin(), keys.end(), rng);
+
+	bt_cursor cursor = {.tree = &tree};
+	uint8_t	  record[2048];
+	for (uint32_t key : keys)
+	{
+		uint32_t size = fill_variable_record(key, sizes[key], record);
+		assert(bt_cursor_insert(&cursor, &key, record, size));
+		assert(!bt_cursor_insert(&cursor, &key, record, size));
+	}
+	bt_validate(&tree);
+
+	for (uint32_t key = 0; key < COUNT; key++)
+	{
+		assert(bt_cursor_seek(&cursor, &key));
+		check_variable_record(&cursor, key, sizes[key]);
+	}
+
+	/* Records shrink in place, grow into the heap, or move the entry */
+	for (uint32_t key = 0; key < COUNT; key += 3)
+	{
+		sizes[key] = key % 2 ? 1 + sizes[key] / 4 : std::min(tree.record_size, sizes[key] * 3 + 100);
+		assert(bt_cursor_seek(&cursor, &key));
+		uint32_t size = fill_variable_record(key, sizes[key], record);
+		assert(bt_cursor_update(&cursor, record, size));
+		assert(*(uint32_t *)bt_cursor_key(&cursor) == key);
+		check_variable_record(&cursor, key, size);
+	}
+	bt_validate(&tree);
+
+	/* Deleting every other leaves gaps that later inserts compact away */
+	for (uint32_t key = 0; key < COUNT; key += 2)
+	{
+		assert(bt_cursor_seek(&cursor, &key));
+		assert(bt_cursor_delete(&cursor));
+	}
+	bt_validate(&tree);
+	for (uint32_t key = 0; key < COUNT; key += 2)
+	{
+		sizes[key] = 1 + (key * 13) % 200;
+		uint32_t size = fill_variable_record(key, sizes[key], record);
+		assert(bt_cursor_insert(&cursor, &key, record, size));
+	}
+	bt_validate(&tree);
+
+	uint32_t expected = 0;
+	assert(bt_cursor_first(&cursor));
+	do
+	{
+		assert(*(uint32_t *)bt_cursor_key(&cursor) == expected);
+		check_variable_record(&cursor, expected, sizes[expected]);
+		expected++;
+	} while (bt_cursor_next(&cursor));
+	assert(expected == COUNT);
+
+	/* Everything goes, down to an empty root */
+	for (uint32_t key : keys)
+	{
+		assert(bt_cursor_seek(&cursor, &key));
+		assert(bt_cursor_delete(&cursor));
+	}
+	bt_validate(&tree);
+	assert(!bt_cursor_first(&cursor));
+
+	/* Short records pack many times as many entries into a leaf */
+	btree	  fixed = bt_create(TYPE_U32, 259, true);
+	btree	  packed = bt_create(TYPE_U32, 259, true, true, true);
+	bt_cursor fixed_cursor = {.tree = &fixed};
+	bt_cursor packed_cursor = {.tree = &packed};
+	for (uint32_t key = 0; key < 10000; key++)
+	{
+		memset(record, 0, 259);
+		uint32_t size = 2 + snprintf((char *)record + 2, 64, "name %u", key);
+		assert(bt_cursor_insert(&fixed_cursor, &key, record));
+		assert(bt_cursor_insert(&packed_cursor, &key, record, size));
+	}
+	bt_validate(&packed);
+	assert(count_leaves(&packed) * 4 < count_leaves(&fixed));
+
+	/* Bulk loads stop a leaf when its heap fills */
+	btree		   loaded = bt_create(TYPE_U32, 1000, true, true, true);
+	bt_bulk_loader loader;
+	assert(bt_bulk_begin(&loader, &loaded, 100));
+	for (uint32_t key = 0; key < 3000; key++)
+	{
+		uint32_t size = fill_variable_record(key, 1 + key % loaded.record_size, record);
+		assert(bt_bulk_append(&loader, &key, record, size));
+	}
+	assert(bt_bulk_finish(&loader));
+	bt_validate(&loaded);
+	bt_cursor loaded_cursor = {.tree = &loaded};
+	for (uint32_t key = 0; key < 3000; key += 7)
+	{
+		assert(bt_cursor_seek(&loaded_cursor, &key));
+		check_variable_record(&loaded_cursor, key, 1 + key % loaded.record_size);
+	}
+
+	pager_rollback();
+	pager_close();
+	os_file_delete(TEST_DB);
+}
+
 
 void
 test_btree()
@@ -1028,5 +1892,15 @@ test_btree()
 	test_btree_deep_tree_coverage();
 	test_btree_remaining_coverage();
 	test_btree_u32_u64();
+	test_btree_sequential_scan();
+	test_btree_vacuum();
+	test_btree_bulk_load();
+	test_btree_append_splits();
+	test_btree_key_search();
+	test_btree_separators();
+	test_btree_delete_during_scan();
+	test_btree_scan_match();
+	test_btree_cursor_insert_in_leaf();
+	test_btree_variable_records();
 	printf("btree tests passed\n");
 }
@@ -0,0 +1,304 @@
+#include "catalog.hpp"
+#include "fixture.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "../arena.hpp"
+#include "../blob.hpp"
+#include "../catalog.hpp"
+#include "../os_layer.hpp"
+#include "../pager.hpp"
+#include "../repl.hpp"
+#include "../stats.hpp"
+
+#define TEST_DB "test_catalog.db"
+
+#define MANY_TABLES 200
+
+static void
+make_tables()
+{
+	assert(execute_sql_statements("CREATE TABLE users (id INT, name TEXT, city TEXT, age INT);"));
+	assert(execute_sql_statements("INSERT INTO users VALUES (1, 'ann', 'oslo', 30), (2, 'bob', 'rome', 40), "
+								  "(3, 'cy', 'oslo', 50);"));
+	assert(execute_sql_statements("CREATE INDEX users_city ON users (city, age);"));
+	assert(execute_sql_statements("CREATE TABLE notes (id INT, body VARCHAR(200));"));
+	assert(execute_sql_statements("INSERT INTO notes VALUES (1, 'first'), (2, 'second');"));
+	assert(execute_sql_statements("ANALYZE users;"));
+}
+
+/*
+ * Each kind of change in one transaction, rolled back, leaves the relations
+ * as they were, the ones that didn't change where they were
+ */
+static void
+test_undo_log()
+{
+	relation *users = catalog_get("users");
+	relation  before = *users;
+	uint32_t  version = catalog_version;
+
+	assert(execute_sql_statements("BEGIN;"
+								  "CREATE TABLE extra (id INT, qty INT);"
+								  "INSERT INTO extra VALUES (1, 2);"
+								  "CREATE INDEX users_age ON users (age);"
+								  "DROP INDEX users_city;"
+								  "ANALYZE notes;"
+								  "DROP TABLE notes;"
+								  "CREATE TABLE notes (id INT);"
+								  "ROLLBACK;"));
+
+	assert(catalog_version != version);
+	assert(!catalog.get("extra"));
+	users = catalog.get("users");
+	assert(users->indexes.size() == 1 && strcmp(users->indexes[0].name, "users_city") == 0);
+	assert(users->indexes[0].btree.root_page_index == before.indexes[0].btree.root_page_index);
+	assert(users->stats == before.stats);
+
+	relation *notes = catalog.get("notes");
+	assert(notes && notes->columns.size() == 2 && !notes->stats);
+	assert(select_count("SELECT COUNT(*) FROM notes;") == 2);
+	assert(select_count("SELECT COUNT(*) FROM users WHERE city = 'oslo';") == 2);
+
+	// A statement that fails in a transaction rolls the whole of it back
+	assert(!execute_sql_statements("BEGIN; CREATE TABLE extra (id INT); SELECT * FROM missing;"));
+	assert(!catalog.get("extra"));
+
+	// Committed changes aren't undone by a later rollback
+	assert(execute_sql_statements("CREATE TABLE kept (id INT);"));
+	assert(execute_sql_statements("BEGIN; INSERT INTO kept VALUES (1); ROLLBACK;"));
+	assert(catalog.get("kept"));
+	assert(execute_sql_statements("BEGIN; DROP TABLE kept; ROLLBACK;"));
+	assert(catalog.get("kept"));
+	assert(execute_sql_statements("DROP TABLE kept;"));
+}
+
+/*
+ * Without a snapshot, a reload leaves every table to be parsed when it's
+ * first looked up, except the ones whose stats it read
+ */
+static void
+test_lazy_loading()
+{
+	assert(pager_get_root_slot(PAGER_SLOT_CATALOG_SNAPSHOT) == 0);
+	catalog_reload();
+
+	relation *notes = catalog.get("notes");
+	assert(notes && notes->sql && notes->columns.size() == 0);
+	assert(!catalog.get("users")->sql);
+
+	assert(select_count("SELECT COUNT(*) FROM notes;") == 2);
+	assert(!notes->sql && notes->columns.size() == 2);
+
+	// An index is found by name before its table is loaded
+	assert(execute_sql_statements("CREATE INDEX notes_body ON notes (body);"));
+	catalog_reload();
+	assert(catalog.get("notes")->sql);
+	relation *table;
+	assert(find_index("notes_body", &table) && table == catalog.get("notes"));
+	assert(!table->sql && table->indexes[0].column_count == 1 && table->indexes[0].columns[0] == 1);
+	assert(select_count("SELECT COUNT(*) FROM notes WHERE body = 'second';") == 1);
+
+	// Loading one of many doesn't touch the rest
+	char sql[128];
+	for (uint32_t i = 0; i < MANY_TABLES; i++)
+	{
+		snprintf(sql, sizeof(sql), "CREATE TABLE t%u (id INT, value INT);", i);
+		assert(execute_sql_statements(sql));
+	}
+	catalog_reload();
+	assert(select_count("SELECT COUNT(*) FROM t7;") == 0);
+	uint32_t loaded = 0;
+	for (auto [name, rel] : catalog)
+	{
+		loaded += rel.sql == nullptr;
+	}
+	// master_catalog, master_stats, users and t7
+	assert(loaded == 4);
+
+	catalog_load_all();
+	for (auto [name, rel] : catalog)
+	{
+		assert(!rel.sql);
+	}
+}
+
+/*
+ * The snapshot is read back as the catalog it was saved from, and any
+ * schema change drops it with its transaction
+ */
+static void
+test_snapshot()
+{
+	catalog_reload();
+	assert(catalog_snapshot_save());
+	uint32_t first_page = pager_get_root_slot(PAGER_SLOT_CATALOG_SNAPSHOT);
+	assert(first_page);
+	assert(catalog_snapshot_save());
+	assert(pager_get_root_slot(PAGER_SLOT_CATALOG_SNAPSHOT) == first_page);
+
+	table_stats	 before = *catalog.get("users")->stats;
+	column_stats city = before.columns[2];
+	uint32_t	tables = catalog.size();
+	pager_close();
+	pager_open(TEST_DB);
+	catalog_reload();
+
+	assert(catalog.size() == tables);
+	for (auto [name, rel] : catalog)
+	{
+		assert(!rel.sql);
+	}
+	relation *users = catalog.get("users");
+	assert(users->columns.size() == 4 && users->columns[3].type == TYPE_U32);
+	assert(users->indexes.size() == 1 && users->indexes[0].column_count == 2);
+	assert(users->stats && users->stats->rows == before.rows && users->stats->pages == before.pages);
+	assert(users->stats->column_count == before.column_count);
+	assert(0 == memcmp(&users->stats->columns[2], &city, sizeof(city)));
+	assert(select_count("SELECT COUNT(*) FROM users WHERE city = 'oslo';") == 2);
+	assert(select_count("SELECT COUNT(*) FROM notes WHERE body = 'first';") == 1);
+
+	// A schema change drops the snapshot, until it's rolled back
+	assert(execute_sql_statements("BEGIN; CREATE TABLE later (id INT);"));
+	assert(pager_get_root_slot(PAGER_SLOT_CATALOG_SNAPSHOT) == 0);
+	assert(execute_sql_statements("ROLLBACK;"));
+	assert(pager_get_root_slot(PAGER_SLOT_CATALOG_SNAPSHOT) == first_page);
+
+	// Its master row's id carries on from the snapshot's next key
+	assert(execute_sql_statements("CREATE TABLE later (id INT);"));
+	assert(pager_get_root_slot(PAGER_SLOT_CATALOG_SNAPSHOT) == 0);
+	assert(select_count("SELECT COUNT(*) FROM master_catalog WHERE name = 'later';") == 1);
+	catalog_reload();
+	assert(catalog.get("later") && catalog.get("later")->sql);
+	assert(catalog.size() == tables + 1);
+}
+
+/*
+ * A soft commit is a commit to the undo log, so a statement failing after it
+ * only undoes its own changes, as the pager only goes back to the savepoint
+ */
+static void
+test_group_commit()
+{
+	pager_set_group_commit(60000, 0);
+	assert(execute_sql_statements("CREATE TABLE grouped (id INT, qty INT);"));
+	assert(execute_sql_statements("INSERT INTO grouped VALUES (1, 2);"));
+	assert(!pager_in_transaction());
+	assert(!execute_sql_statements("INSERT INTO users VALUES (1, 'dup', 'oslo', 1);"));
+	assert(catalog_get("grouped"));
+	assert(select_count("SELECT COUNT(*) FROM grouped;") == 1);
+
+	assert(!execute_sql_statements("CREATE TABLE grouped_too (id INT);"
+								   "INSERT INTO users VALUES (1, 'dup', 'oslo', 1);"));
+	assert(catalog_get("grouped_too"));
+
+	// Closing makes the group durable, the tables are there after a reopen
+	pager_close();
+	pager_set_group_commit(0, 0);
+	pager_open(TEST_DB);
+	catalog_reload();
+	assert(catalog_get("grouped") && catalog_get("grouped_too"));
+	assert(select_count("SELECT COUNT(*) FROM grouped;") == 1);
+}
+
+/*
+ * Vacuuming a table created after a bigger one was, then dropped, moves its
+ * roots, which sit at the end of the file, and the master rows follow them
+ */
+static void
+test_vacuum()
+{
+	char sql[4096];
+	assert(execute_sql_statements("CREATE TABLE bulk (id INT, body VARCHAR(200));"));
+	for (uint32_t batch = 0; batch < 20; batch++)
+	{
+		int length = snprintf(sql, sizeof(sql), "INSERT INTO bulk VALUES ");
+		for (uint32_t i = 0; i < 50; i++)
+		{
+			length += snprintf(sql + length, sizeof(sql) - length, "%s(%u, 'padding padding padding padding')",
+							   i ? ", " : "", batch * 50 + i);
+		}
+		snprintf(sql + length, sizeof(sql) - length, ";");
+		assert(execute_sql_statements(sql));
+	}
+	assert(execute_sql_statements("CREATE TABLE tail (id INT, name TEXT);"));
+	assert(execute_sql_statements("INSERT INTO tail VALUES (1, 'ann'), (2, 'bob');"));
+	assert(execute_sql_statements("CREATE INDEX tail_name ON tail (name);"));
+
+	// The blob dedup index moves too, through its root slot
+	char	 document[] = "shared document";
+	uint32_t index_root = catalog_get("tail")->indexes[0].btree.root_page_index;
+	assert(index_root == pager_get_stats().total_pages && "The index's root should be the last page");
+	pager_begin_transaction();
+	btree	 dedup = blob_dedup_open();
+	uint32_t dedup_root = dedup.root_page_index;
+	pager_commit();
+	assert(execute_sql_statements("DROP TABLE bulk;"));
+
+	relation *tail = catalog_get("tail");
+	uint32_t  table_root = tail->storage.btree.root_page_index;
+	assert(dedup_root > index_root);
+
+	// Rolled back, the relation points at the roots it had
+	catalog_lock_exclusive();
+	pager_begin_transaction();
+	assert(catalog_vacuum() > 0);
+	assert(tail->storage.btree.root_page_index < table_root);
+	assert(tail->indexes[0].btree.root_page_index < index_root);
+	assert(pager_get_root_slot(PAGER_SLOT_BLOB_DEDUP) < dedup_root);
+	pager_rollback();
+	catalog_rollback();
+	catalog_unlock_exclusive();
+	assert(tail->storage.btree.root_page_index == table_root);
+	assert(tail->indexes[0].btree.root_page_index == index_root);
+	assert(pager_get_root_slot(PAGER_SLOT_BLOB_DEDUP) == dedup_root);
+	assert(select_count("SELECT COUNT(*) FROM tail WHERE name = 'bob';") == 1);
+
+	catalog_lock_exclusive();
+	pager_begin_transaction();
+	assert(catalog_vacuum() > 0);
+	pager_commit();
+	catalog_unlock_exclusive();
+	table_root = tail->storage.btree.root_page_index;
+	index_root = tail->indexes[0].btree.root_page_index;
+	assert(pager_get_stats().total_pages < index_root + 8 && "The file should end near the moved roots");
+	assert(select_count("SELECT COUNT(*) FROM tail WHERE name = 'bob';") == 1);
+
+	pager_begin_transaction();
+	dedup = blob_dedup_open();
+	assert(dedup.root_page_index < dedup_root);
+	uint32_t shared = blob_create(document, sizeof(document), false, &dedup);
+	assert(blob_create(document, sizeof(document), false, &dedup) == shared && "The moved index should share blobs");
+	blob_delete(shared, &dedup);
+	blob_delete(shared, &dedup);
+	pager_commit();
+
+	// Read back from the master rows
+	catalog_reload();
+	tail = catalog_get("tail");
+	assert(tail->storage.btree.root_page_index == table_root);
+	assert(tail->indexes[0].btree.root_page_index == index_root);
+	assert(select_count("SELECT COUNT(*) FROM tail;") == 2);
+	assert(select_count("SELECT COUNT(*) FROM tail WHERE name = 'ann';") == 1);
+}
+
+void
+test_catalog()
+{
+	test_db_open(TEST_DB);
+	catalog_reload(); // Clears out the tables earlier tests left behind
+
+	make_tables();
+	test_undo_log();
+	test_lazy_loading();
+	test_snapshot();
+	test_group_commit();
+	test_vacuum();
+
+	pager_close();
+	os_file_delete(TEST_DB);
+	printf("catalog tests passed\n");
+}
@@ -0,0 +1,242 @@
+#include "copy.hpp"
+#include "fixture.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "../arena.hpp"
+#include "../btree.hpp"
+#include "../catalog.hpp"
+#include "../copy.hpp"
+#include "../os_layer.hpp"
+#include "../pager.hpp"
+#include "../parser.hpp"
+#include "../repl.hpp"
+#include "../types.hpp"
+
+#define TEST_DB	 "test_copy.db"
+#define TEST_CSV "test_copy.csv"
+
+static void
+write_csv(const char *contents, size_t size = 0)
+{
+	os_file_delete(TEST_CSV);
+	os_file_handle_t file = os_file_open(TEST_CSV, true, true);
+	size = size ? size : strlen(contents);
+	assert(os_file_write(file, contents, size) == size);
+	os_file_close(file);
+}
+
+/*
+ * Rows with ids 1 to count, starting from start + 1 and wrapping around to 1
+ * after count
+ */
+static void
+write_rows(uint32_t count, uint32_t start = 0)
+{
+	size_t line_size = 64;
+	char  *contents = (char *)arena<query_arena>::alloc(count * line_size + 64);
+	size_t size = snprintf(contents, 64, "id,name,qty\n");
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t id = (start + i) % count + 1;
+		size += snprintf(contents + size, line_size, "%u,name %u,%u\n", id, id, id % 7);
+	}
+	write_csv(contents, size);
+}
+
+static void
+test_sorted_bulk_load()
+{
+	// Over several chunks, so lines are split across reads
+	uint32_t count = COPY_CHUNK_SIZE / 8;
+	write_rows(count);
+	assert(execute_sql_statements("CREATE TABLE items (id INT, name TEXT, qty INT);"));
+	assert(execute_sql_statements("COPY items FROM '" TEST_CSV "';"));
+	assert(count_rows("items") == count);
+
+	assert(select_rows("SELECT * FROM items WHERE id = 12345;") == 1);
+	assert(first_value == 12345);
+	assert(strcmp(second_text, "name 12345") == 0);
+
+	relation *items = catalog.get("items");
+	bt_validate(&items->storage.btree);
+	assert(execute_sql_statements("DROP TABLE items;"));
+}
+
+static void
+test_unsorted_bulk_load()
+{
+	// In order for a while, then not, so what's loaded goes back to be sorted
+	uint32_t count = 20000;
+	write_rows(count, count / 2);
+	assert(execute_sql_statements("CREATE TABLE items (id INT, name TEXT, qty INT);"));
+	assert(execute_sql_statements("COPY items FROM '" TEST_CSV "';"));
+	assert(count_rows("items") == count);
+	assert(select_rows("SELECT * FROM items ORDER BY id;") == count);
+	assert(first_value == 1);
+	bt_validate(&catalog.get("items")->storage.btree);
+	assert(execute_sql_statements("DROP TABLE items;"));
+
+	write_csv("id,name,qty\r\n"
+			  "5, \"quoted, with a comma\" ,1\r\n"
+			  "\r\n"
+			  "3,\"say \"\"hi\"\"\",2\r\n"
+			  "4,plain,3");
+	assert(execute_sql_statements("CREATE TABLE items (id INT, name TEXT, qty INT);"));
+	assert(execute_sql_statements("COPY items FROM '" TEST_CSV "';"));
+	assert(count_rows("items") == 3);
+	assert(select_rows("SELECT * FROM items WHERE id = 3;") == 1);
+	assert(strcmp(second_text, "say \"hi\"") == 0);
+	assert(select_rows("SELECT * FROM items WHERE id = 5;") == 1);
+	assert(strcmp(second_text, "quoted, with a comma") == 0);
+	assert(execute_sql_statements("DROP TABLE items;"));
+}
+
+static void
+test_insert_with_indexes()
+{
+	assert(execute_sql_statements("CREATE TABLE items (id INT, name TEXT, qty INT);"));
+	assert(execute_sql_statements("CREATE INDEX items_qty ON items (qty);"));
+	assert(execute_sql_statements("INSERT INTO items VALUES (100000, 'first', 3);"));
+
+	write_rows(5000, 1000);
+	assert(execute_sql_statements("COPY items FROM '" TEST_CSV "';"));
+	assert(count_rows("items") == 5001);
+
+	// Rows with qty 3, through the index
+	uint32_t expected = 1;
+	for (uint32_t i = 0; i < 5000; i++)
+	{
+		expected += (i + 1) % 7 == 3;
+	}
+	assert(select_rows("SELECT id FROM items WHERE qty = 3;") == expected);
+	bt_validate(&catalog.get("items")->indexes[0].btree);
+	assert(execute_sql_statements("DROP TABLE items;"));
+}
+
+static void
+test_failures()
+{
+	assert(execute_sql_statements("CREATE TABLE items (id INT, name TEXT, qty INT);"));
+	assert(execute_sql_statements("INSERT INTO items VALUES (7, 'seven', 7);"));
+
+	assert(!execute_sql_statements("COPY items FROM 'no_such_file.csv';"));
+	assert(!execute_sql_statements("COPY nowhere FROM '" TEST_CSV "';"));
+
+	// Each fails the whole COPY, and it's rolled back
+	const char *bad[] = {
+		"id,name,qty\n1,a,1\n7,b,2\n",					   // 7 is already there
+		"id,name,qty\n1,a,1\n2,b\n",					   // Too few fields
+		"id,name,qty\n1,a,1\n2,b,2,3\n",				   // Too many
+		"id,name,qty\n1,a,x\n",							   // Not a number
+		"id,name,qty\n1,a,4294967296\n",				   // Too big for an INT
+		"id,name,qty\n1,a name well over the thirty two bytes,1\n", // Too long for TEXT
+		"id,name,qty\n1,\"unterminated,1\n",
+	};
+	for (const char *contents : bad)
+	{
+		write_csv(contents);
+		assert(!execute_sql_statements("COPY items FROM '" TEST_CSV "';"));
+		assert(count_rows("items") == 1);
+	}
+
+	// And into an empty table, a key twice once sorted
+	assert(execute_sql_statements("CREATE TABLE others (id INT, name TEXT, qty INT);"));
+	write_csv("id,name,qty\n3,a,1\n1,b,1\n3,c,1\n");
+	assert(!execute_sql_statements("COPY others FROM '" TEST_CSV "';"));
+	assert(count_rows("others") == 0);
+
+	// Still usable afterwards
+	write_csv("id,name,qty\n3,a,1\n1,b,1\n2,c,1\n");
+	assert(execute_sql_statements("COPY others FROM '" TEST_CSV "';"));
+	assert(count_rows("others") == 3);
+
+	assert(execute_sql_statements("DROP TABLE items;"));
+	assert(execute_sql_statements("DROP TABLE others;"));
+}
+
+/* As the server confines its clients' COPYs */
+static void
+test_directory()
+{
+	assert(execute_sql_statements("CREATE TABLE items (id INT, name TEXT, qty INT);"));
+	write_csv("id,name,qty\n1,a,1\n");
+
+	copy_set_directory("");
+	assert(!execute_sql_statements("COPY items FROM '" TEST_CSV "';"));
+
+	copy_set_directory(".");
+	assert(!execute_sql_statements("COPY items FROM '/etc/passwd';"));
+	assert(!execute_sql_statements("COPY items FROM '../" TEST_CSV "';"));
+	assert(!execute_sql_statements("COPY items FROM 'nowhere/../" TEST_CSV "';"));
+	assert(count_rows("items") == 0);
+	assert(execute_sql_statements("COPY items FROM './" TEST_CSV "';"));
+	assert(count_rows("items") == 1);
+
+	copy_set_directory(nullptr);
+	assert(execute_sql_statements("DROP TABLE items;"));
+}
+
+#define TEST_SCRIPT "test_copy.sql"
+
+/*
+ * A dump run a statement at a time, inside its own transaction, resetting
+ * query_arena as it goes so the memory doesn't grow with the script
+ */
+static void
+test_script()
+{
+	// About 2MB of script, twice the stream's buffer
+	uint32_t rows = 50000;
+	FILE	*file = fopen(TEST_SCRIPT, "w");
+	fprintf(file, "CREATE TABLE dumped (id INT, name TEXT, qty INT);\nBEGIN;\n");
+	for (uint32_t id = 1; id <= rows; id++)
+	{
+		fprintf(file, "INSERT INTO dumped VALUES (%u, 'row;%u', %u);\n", id, id, id % 7);
+	}
+	fprintf(file, "COMMIT;\n");
+	fclose(file);
+
+	// Measured from what's committed up front, which another test may have set high
+	uint64_t statements = 0;
+	arena<query_arena>::reset_and_decommit();
+	size_t initial = arena<query_arena>::stats().committed;
+	assert(execute_sql_file(TEST_SCRIPT, nullptr, &statements));
+	assert(statements == rows + 3);
+	assert(arena<query_arena>::stats().committed < initial + SQL_STREAM_BUFFER_SIZE);
+	assert(count_rows("dumped") == rows);
+	assert(select_rows("SELECT * FROM dumped WHERE qty = 3;") == (rows - 3) / 7 + 1);
+
+	// Stops at the first failure, leaving what ran before it
+	file = fopen(TEST_SCRIPT, "w");
+	fprintf(file, "INSERT INTO dumped VALUES (%u, 'x', 1);\nINSERT INTO missing VALUES (1);\n"
+				  "INSERT INTO dumped VALUES (%u, 'y', 1);\n",
+			rows + 1, rows + 2);
+	fclose(file);
+	assert(!execute_sql_file(TEST_SCRIPT, nullptr, &statements));
+	assert(statements == 1 && count_rows("dumped") == rows + 1);
+
+	assert(execute_sql_statements("DROP TABLE dumped;"));
+	os_file_delete(TEST_SCRIPT);
+}
+
+void
+test_copy()
+{
+	test_db_open(TEST_DB);
+
+	test_sorted_bulk_load();
+	test_unsorted_bulk_load();
+	test_insert_with_indexes();
+	test_failures();
+	test_directory();
+	test_script();
+
+	pager_close();
+	os_file_delete(TEST_DB);
+	os_file_delete(TEST_CSV);
+	printf("copy tests passed\n");
+}
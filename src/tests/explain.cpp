@@ -0,0 +1,192 @@
+#include "explain.hpp"
+#include "fixture.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "../arena.hpp"
+#include "../catalog.hpp"
+#include "../compile.hpp"
+#include "../os_layer.hpp"
+#include "../pager.hpp"
+#include "../parser.hpp"
+#include "../repl.hpp"
+#include "../semantic.hpp"
+#include "../vm.hpp"
+
+#define TEST_DB "test_explain.db"
+
+#define ITEMS 2000
+
+static stmt_node *
+compile(const char *sql, array<vm_instruction, query_arena> *program)
+{
+	parser_result parsed = parse_sql(sql);
+	assert(parsed.success && semantic_analyze(parsed.statements[0], false).success);
+	*program = compile_program(parsed.statements[0]);
+	return parsed.statements[0];
+}
+
+static bool
+plan_has(stmt_node *stmt, const char *line)
+{
+	for (const char *note : stmt->plan)
+	{
+		if (strcmp(note, line) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static void
+test_parse()
+{
+	parser_result parsed = parse_sql("EXPLAIN SELECT * FROM items; EXPLAIN ANALYZE SELECT * FROM items; "
+									 "EXPLAIN ANALYZE items; EXPLAIN ANALYZE; SELECT * FROM items;");
+	assert(parsed.success && parsed.statements.size() == 5);
+	assert(parsed.statements[0]->type == STMT_SELECT && parsed.statements[0]->explain == EXPLAIN_PLAN);
+	assert(parsed.statements[1]->type == STMT_SELECT && parsed.statements[1]->explain == EXPLAIN_ANALYZE);
+
+	// ANALYZE without a statement after it is the statement being explained
+	assert(parsed.statements[2]->type == STMT_ANALYZE && parsed.statements[2]->explain == EXPLAIN_PLAN);
+	assert(parsed.statements[2]->analyze_stmt.table_name == "items");
+	assert(parsed.statements[3]->type == STMT_ANALYZE && parsed.statements[3]->explain == EXPLAIN_PLAN);
+	assert(parsed.statements[4]->explain == EXPLAIN_NONE);
+
+	// The statement's text doesn't include the EXPLAIN
+	assert(parsed.statements[0]->sql_stmt.find("EXPLAIN") == string_view::npos);
+
+	assert(!parse_sql("EXPLAIN;").success);
+}
+
+static void
+test_plan()
+{
+	array<vm_instruction, query_arena> program;
+
+	stmt_node *stmt = compile("SELECT * FROM items WHERE id > 5 AND id <= 10;", &program);
+	assert(plan_has(stmt, "SEARCH items USING PRIMARY KEY (id > 5 AND id <= 10)"));
+
+	stmt = compile("SELECT * FROM items WHERE id = 7;", &program);
+	assert(plan_has(stmt, "SEARCH items USING PRIMARY KEY (id = 7)"));
+
+	stmt = compile("SELECT * FROM items WHERE id IN (1, 2, 3);", &program);
+	assert(plan_has(stmt, "SEARCH items USING PRIMARY KEY (id IN 3 keys)"));
+
+	stmt = compile("SELECT * FROM items WHERE qty = ? ORDER BY qty;", &program);
+	assert(plan_has(stmt, "SEARCH items USING INDEX items_qty (qty = ?)"));
+	assert(plan_has(stmt, "SORT FOR ORDER BY"));
+
+	stmt = compile("SELECT * FROM items WHERE name = 'x' AND id > 0 ORDER BY id;", &program);
+	assert(plan_has(stmt, "SEARCH items USING PRIMARY KEY (id > 0)"));
+	assert(plan_has(stmt, "FILTER items ON 1 condition, tested in the leaves"));
+	assert(plan_has(stmt, "ORDER BY FOLLOWS THE PRIMARY KEY, no sort"));
+
+	stmt = compile("SELECT name, COUNT(*) FROM items GROUP BY name;", &program);
+	assert(plan_has(stmt, "SCAN items"));
+	assert(plan_has(stmt, "GROUP IN A HASH TABLE"));
+
+	stmt = compile("SELECT * FROM items JOIN tags ON items.id = tags.item;", &program);
+	assert(plan_has(stmt, "SCAN tags"));
+	assert(plan_has(stmt, "JOIN items USING PRIMARY KEY (id = tags.item)"));
+
+	stmt = compile("DELETE FROM items WHERE id < 3;", &program);
+	assert(plan_has(stmt, "SEARCH items USING PRIMARY KEY (id < 3)"));
+
+	// EXPLAIN only prints, nothing is changed
+	assert(execute_sql_statements("EXPLAIN DELETE FROM items;"));
+	assert(execute_sql_statements("EXPLAIN INSERT INTO items VALUES (99999, 'x', 1);"));
+	assert(execute_sql_statements("EXPLAIN BEGIN;"));
+	assert(!pager_in_transaction());
+	assert(select_count("SELECT COUNT(*) FROM items;") == ITEMS);
+}
+
+static void
+test_profile()
+{
+	array<vm_instruction, query_arena> program;
+	compile("SELECT id FROM items WHERE qty = 3 AND name = 'item';", &program);
+
+	vm_profile profile;
+	row_count = 0;
+	vm_set_result_callback(record_rows);
+	pager_get_stats(true);
+	assert(vm_execute(program.data(), program.size(), &profile) == OK);
+	assert(profile.instruction_count == program.size());
+	assert(profile.rows == row_count && row_count == ITEMS / 100);
+	assert(profile.nanoseconds > 0 && profile.ticks > 0);
+
+	uint64_t page_reads = 0;
+	uint64_t results = 0;
+	for (uint32_t pc = 0; pc < program.size(); pc++)
+	{
+		vm_instruction_profile *entry = &profile.instructions[pc];
+		page_reads += entry->page_hits + entry->page_misses;
+		switch (program[pc].opcode)
+		{
+		case OP_Open:
+		case OP_Halt:
+			assert(entry->executions == 1);
+			break;
+		case OP_Result:
+			assert(entry->rows == entry->executions);
+			results += entry->rows;
+			break;
+		case OP_Seek:
+			// The index is seeked once, and each entry's row looked up
+			assert(entry->executions > 0 && entry->rows > 0);
+			break;
+		default:
+			break;
+		}
+	}
+	assert(results == row_count);
+
+	// Every page the scan touched was charged to an instruction
+	pager_meta stats = pager_get_stats();
+	assert(page_reads > 0);
+	assert(page_reads == stats.io.cache_hits + stats.io.map_hits + stats.io.cache_misses);
+	vm_print_profile(program.data(), program.size(), &profile);
+
+	// EXPLAIN ANALYZE runs the statement, its rows aren't returned
+	row_count = 0;
+	assert(execute_sql_statements("EXPLAIN ANALYZE SELECT * FROM items WHERE qty = 3;", record_rows));
+	assert(row_count == 0);
+	assert(execute_sql_statements("EXPLAIN ANALYZE DELETE FROM items WHERE id <= 10;"));
+	assert(select_count("SELECT COUNT(*) FROM items;") == ITEMS - 10);
+
+	// A profiled run is no different to the next, unprofiled, one
+	row_count = 0;
+	assert(vm_execute(program.data(), program.size()) == OK);
+	assert(row_count == ITEMS / 100 - 1);
+}
+
+void
+test_explain()
+{
+	test_db_open(TEST_DB);
+
+	assert(execute_sql_statements("CREATE TABLE items (id INT, name TEXT, qty INT);"));
+	assert(execute_sql_statements("CREATE TABLE tags (id INT, item INT);"));
+	assert(execute_sql_statements("CREATE INDEX items_qty ON items (qty);"));
+	assert(execute_sql_statements("BEGIN;"));
+	for (uint32_t id = 1; id <= ITEMS; id++)
+	{
+		char sql[128];
+		snprintf(sql, sizeof(sql), "INSERT INTO items VALUES (%u, 'item', %u);", id, id % 100);
+		assert(execute_sql_statements(sql));
+	}
+	assert(execute_sql_statements("COMMIT;"));
+
+	test_parse();
+	test_plan();
+	test_profile();
+
+	pager_close();
+	os_file_delete(TEST_DB);
+	printf("explain tests passed\n");
+}
@@ -0,0 +1,59 @@
+#include "fixture.hpp"
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include "../arena.hpp"
+#include "../catalog.hpp"
+#include "../os_layer.hpp"
+#include "../repl.hpp"
+
+uint32_t row_count;
+uint32_t first_value;
+char	 second_text[64];
+
+void
+test_db_open(const char *path, uint32_t cache_pages, PAGER_JOURNAL_MODE journal_mode)
+{
+	arena<query_arena>::init();
+	arena<catalog_arena>::init();
+	os_file_delete(path);
+	pager_open(path, cache_pages, journal_mode);
+	bootstrap_master(true);
+}
+
+void
+record_rows(typed_value *values, size_t count)
+{
+	if (row_count++ == 0)
+	{
+		first_value = values[0].as_u32();
+		second_text[0] = '\0';
+		if (count > 1 && type_is_string(values[1].type))
+		{
+			strncpy(second_text, values[1].as_char(), sizeof(second_text) - 1);
+		}
+	}
+}
+
+uint32_t
+select_rows(const char *sql)
+{
+	row_count = 0;
+	assert(execute_sql_statements(sql, record_rows));
+	return row_count;
+}
+
+uint32_t
+select_count(const char *sql)
+{
+	select_rows(sql);
+	return first_value;
+}
+
+uint32_t
+count_rows(const char *table)
+{
+	char sql[128];
+	snprintf(sql, sizeof(sql), "SELECT COUNT(*) FROM %s;", table);
+	return select_count(sql);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "../pager.hpp"
+#include "../types.hpp"
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * What the tests that run SQL share: a new database, and a result callback
+ * keeping what they check of the rows
+ */
+
+/*
+ * Opens a new database at path, deleting what an earlier run left there, with
+ * the arenas and the master catalog that statements need
+ */
+void
+test_db_open(const char *path, uint32_t cache_pages = PAGER_DEFAULT_CACHE_PAGES,
+			 PAGER_JOURNAL_MODE journal_mode = PAGER_JOURNAL_ROLLBACK);
+
+/*
+ * Counts the rows in row_count, keeping the first one's first column in
+ * first_value, and its second in second_text if that's a string. Reset
+ * row_count before running a statement through it.
+ */
+extern uint32_t row_count;
+extern uint32_t first_value;
+extern char		second_text[64];
+
+void
+record_rows(typed_value *values, size_t count);
+
+/* Runs sql through record_rows, returning how many rows it output */
+uint32_t
+select_rows(const char *sql);
+
+/* Runs sql through record_rows, returning the first row's first column, a COUNT(*) say */
+uint32_t
+select_count(const char *sql);
+
+uint32_t
+count_rows(const char *table);
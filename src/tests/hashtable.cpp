@@ -0,0 +1,214 @@
+#include "hashtable.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "../arena.hpp"
+#include "../hashtable.hpp"
+#include "../os_layer.hpp"
+#include "../pager.hpp"
+#include "../types.hpp"
+
+#define TEST_DB "test_hash_table.db"
+
+/*
+ * Inserts count rows over distinct keys, then probes every key on every
+ * pass, as a join would. Each row must turn up exactly once, under its key.
+ * Returns the number of passes.
+ */
+static uint32_t
+check_probe(uint32_t count, uint32_t distinct, size_t budget)
+{
+	ht_set_memory_budget(budget);
+	hash_table table = ht_create(TYPE_U32, sizeof(uint32_t));
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t key = (i * 7919) % distinct;
+		assert(ht_insert(&table, &key, &i));
+	}
+
+	uint8_t *seen = (uint8_t *)arena<query_arena>::alloc(count + 1);
+	memset(seen, 0, count + 1);
+
+	uint32_t passes = 0;
+	uint32_t found = 0;
+	for (bool more = ht_rewind(&table); more; more = ht_rewind(&table))
+	{
+		passes++;
+
+		// Going through the pass visits what's loaded
+		uint32_t in_pass = 0;
+		for (bool valid = ht_is_valid(&table); valid; valid = ht_next(&table))
+		{
+			in_pass++;
+		}
+		assert(in_pass == table.row_count);
+
+		for (uint32_t key = 0; key < distinct; key++)
+		{
+			for (bool valid = ht_seek(&table, &key); valid; valid = ht_next(&table))
+			{
+				assert(*(uint32_t *)ht_key(&table) == key);
+				uint32_t row = *(uint32_t *)ht_record(&table);
+				assert(row < count && (row * 7919) % distinct == key);
+				assert(!seen[row]);
+				seen[row] = 1;
+				found++;
+			}
+		}
+
+		// Past the rows of every key
+		uint32_t missing = distinct;
+		assert(!ht_seek(&table, &missing));
+		assert(!ht_is_valid(&table));
+	}
+
+	assert(found == count);
+	assert(passes == (count > 0 ? 1 : 0) || table.spilled);
+	ht_close(&table);
+	return passes;
+}
+
+/*
+ * A string key matches however the bytes past its end are filled
+ */
+static void
+check_text_keys()
+{
+	ht_set_memory_budget(HASH_TABLE_DEFAULT_MEMORY);
+	hash_table table = ht_create(TYPE_CHAR32, sizeof(uint32_t));
+
+	const char *names[] = {"pear", "apple", "fig", "apple", "banana"};
+	for (uint32_t i = 0; i < 5; i++)
+	{
+		char key[32];
+		memset(key, 'x', sizeof(key));
+		strcpy(key, names[i]);
+		assert(ht_insert(&table, key, &i));
+	}
+	assert(ht_rewind(&table));
+
+	char probe[32] = {};
+	strcpy(probe, "apple");
+	uint32_t matches = 0;
+	for (bool valid = ht_seek(&table, probe); valid; valid = ht_next(&table))
+	{
+		uint32_t row = *(uint32_t *)ht_record(&table);
+		assert(row == 1 || row == 3);
+		assert(strcmp((char *)ht_key(&table), "apple") == 0);
+		matches++;
+	}
+	assert(matches == 2);
+
+	strcpy(probe, "app");
+	assert(!ht_seek(&table, probe));
+	ht_close(&table);
+}
+
+static void
+check_rewind()
+{
+	ht_set_memory_budget(HASH_TABLE_DEFAULT_MEMORY);
+
+	hash_table empty = ht_create(TYPE_U32, sizeof(uint32_t));
+	assert(!ht_rewind(&empty));
+	assert(!ht_is_valid(&empty));
+	ht_close(&empty);
+
+	// Held in memory, there's one pass
+	hash_table table = ht_create(TYPE_U32, sizeof(uint32_t));
+	for (uint32_t i = 0; i < 10; i++)
+	{
+		assert(ht_insert(&table, &i, &i));
+	}
+	assert(ht_rewind(&table));
+	assert(!table.spilled);
+	assert(!ht_rewind(&table));
+	ht_close(&table);
+}
+
+/* Records are [count][sum], summed */
+static void
+sum_records(void *context, uint8_t *into, const uint8_t *from)
+{
+	uint32_t *totals = (uint32_t *)into;
+	const uint32_t *values = (const uint32_t *)from;
+	totals[0] += values[0];
+	totals[1] += values[1];
+	(*(uint32_t *)context)++;
+}
+
+/*
+ * With a combine function there's a row per key, whether the rows were
+ * combined as they went in or as their partition was read back
+ */
+static void
+check_combine(uint32_t count, uint32_t distinct, size_t budget)
+{
+	ht_set_memory_budget(budget);
+	uint32_t combines = 0;
+	hash_table table = ht_create(TYPE_U32, 2 * sizeof(uint32_t), sum_records, &combines);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t key = (i * 7919) % distinct;
+		uint32_t record[2] = {1, i};
+		assert(ht_insert(&table, &key, record));
+	}
+
+	uint32_t groups = 0;
+	uint32_t found = 0;
+	uint32_t rows = 0;
+	uint64_t total = 0;
+	for (bool more = ht_rewind(&table); more; more = ht_rewind(&table))
+	{
+		for (bool valid = ht_is_valid(&table); valid; valid = ht_next(&table))
+		{
+			uint32_t *record = (uint32_t *)ht_record(&table);
+			groups++;
+			rows += record[0];
+			total += record[1];
+		}
+
+		for (uint32_t key = 0; key < distinct; key++)
+		{
+			if (ht_seek(&table, &key))
+			{
+				assert(!ht_next(&table));
+				found++;
+			}
+		}
+	}
+
+	assert(groups == distinct && found == distinct);
+	assert(rows == count);
+	assert(total == (uint64_t)count * (count - 1) / 2);
+	assert(combines == count - distinct);
+	ht_close(&table);
+}
+
+void
+test_hash_table()
+{
+	arena<query_arena>::init();
+	os_file_delete(TEST_DB);
+	pager_open(TEST_DB);
+
+	check_rewind();
+	check_text_keys();
+	assert(check_probe(0, 10, HASH_TABLE_DEFAULT_MEMORY) == 0);
+	assert(check_probe(5000, 700, HASH_TABLE_DEFAULT_MEMORY) == 1); // in memory
+	assert(check_probe(20000, 3000, 16 << 10) > 1);					 // partitioned, whole partitions a pass
+	assert(check_probe(20000, 2, 256) > 2); // partitions bigger than a pass, loaded a chunk at a time
+	check_combine(5000, 700, HASH_TABLE_DEFAULT_MEMORY);
+	check_combine(20000, 3000, 16 << 10); // spilled, combined as it's read back
+
+	ht_set_memory_budget(HASH_TABLE_DEFAULT_MEMORY);
+	arena<query_arena>::reset();
+	pager_close();
+	os_file_delete(TEST_DB);
+	printf("hash table tests passed\n");
+}
@@ -0,0 +1,398 @@
+#include "memtree.hpp"
+#include "../memtree.hpp"
+#include "../arena.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#define ASSERT_PRINT(tree_ptr, cond, ...)                                     \
+    do {                                                                       \
+        if (!(cond)) {                                                        \
+            fprintf(stderr, "Assertion failed: %s\n", #cond);                 \
+            fprintf(stderr, "  at %s:%d\n", __FILE__, __LINE__);             \
+            fprintf(stderr, __VA_ARGS__);                                     \
+            fprintf(stderr, "Tree state:\n");                                 \
+            mt_print(tree_ptr);                                               \
+            abort();                                                           \
+        }                                                                      \
+    } while (0)
+
+
+struct simple_rng {
+    uint32_t state;
+
+    simple_rng(uint32_t seed) : state(seed) {}
+
+    uint32_t next() {
+        state = state * 1664525u + 1013904223u;
+        return state;
+    }
+
+    uint32_t next_range(uint32_t max) {
+        return next() % max;
+    }
+};
+
+
+template<typename T>
+static void shuffle_array(T* arr, size_t n, simple_rng& rng) {
+    for (size_t i = n - 1; i > 0; i--) {
+        size_t j = rng.next_range(i + 1);
+        T temp = arr[i];
+        arr[i] = arr[j];
+        arr[j] = temp;
+    }
+}
+
+ void test_memtree_sequential_ops() {
+    arena<query_arena>::init();
+
+    mt_cursor cursor = {.tree = mt_create(TYPE_U32, sizeof(uint32_t), false)};
+    memtree &tree = cursor.tree;
+    const int COUNT = 20000;
+
+    for (int i = 0; i < COUNT; i++) {
+        uint32_t key = i;
+        uint32_t value = i * 100;
+        ASSERT_PRINT(&tree, mt_insert(&tree, &key, &value),
+                    "Failed to insert key %u\n", key);
+    }
+    mt_validate(&tree);
+    ASSERT_PRINT(&tree, !tree.root->is_leaf, "Expected more than one level\n");
+
+    for (int i = 0; i < COUNT; i++) {
+        uint32_t key = i;
+        ASSERT_PRINT(&tree, mt_cursor_seek(&cursor, &key),
+                    "Failed to find key %u after insertion\n", key);
+        uint32_t* val = (uint32_t*)mt_cursor_record(&cursor);
+        ASSERT_PRINT(&tree, *val == i * 100,
+                    "Value mismatch for key %u: expected %u, got %u\n", key, i * 100, *val);
+    }
+
+    for (int i = 0; i < COUNT / 2; i++) {
+        uint32_t key = i;
+        ASSERT_PRINT(&tree, mt_delete(&tree, &key),
+                    "Failed to delete key %u\n", key);
+    }
+    mt_validate(&tree);
+
+    for (int i = 0; i < COUNT; i++) {
+        uint32_t key = i;
+        bool found = mt_cursor_seek(&cursor, &key);
+        ASSERT_PRINT(&tree, found == (i >= COUNT / 2),
+                    "Key %u %s after deletion\n", key, found ? "found" : "missing");
+    }
+
+    // Reverse order, every leaf is split down the middle
+    mt_clear(&tree);
+    for (int i = COUNT - 1; i >= 0; i--) {
+        uint32_t key = i;
+        mt_insert(&tree, &key, &key);
+    }
+    mt_validate(&tree);
+
+    uint32_t expected = 0;
+    for (bool valid = mt_cursor_first(&cursor); valid; valid = mt_cursor_next(&cursor)) {
+        ASSERT_PRINT(&tree, *(uint32_t*)mt_cursor_key(&cursor) == expected,
+                    "Expected key %u\n", expected);
+        expected++;
+    }
+    ASSERT_PRINT(&tree, expected == COUNT, "Iterated %u keys\n", expected);
+
+    arena<query_arena>::reset();
+}
+
+/*
+ * Inserts, seeks and deletes checked against a sorted array
+ */
+ void test_memtree_random_ops() {
+    arena<query_arena>::init();
+
+    mt_cursor cursor = {.tree = mt_create(TYPE_U32, sizeof(uint64_t), false)};
+    memtree &tree = cursor.tree;
+    simple_rng rng(12345);
+
+    const uint32_t COUNT = 5000;
+    uint32_t keys[COUNT];
+    for (uint32_t i = 0; i < COUNT; i++) {
+        keys[i] = i * 2; // Odd keys are missing, for seeks between keys
+    }
+    shuffle_array(keys, COUNT, rng);
+
+    for (uint32_t i = 0; i < COUNT; i++) {
+        uint64_t value = (uint64_t)keys[i] << 32;
+        mt_insert(&tree, &keys[i], &value);
+    }
+    mt_validate(&tree);
+    ASSERT_PRINT(&tree, tree.entry_count == COUNT, "Entry count %u\n", tree.entry_count);
+
+    // Delete a random half, then present[k / 2] holds whether k is still there
+    bool present[COUNT];
+    for (uint32_t i = 0; i < COUNT; i++) {
+        present[i] = true;
+    }
+    for (uint32_t i = 0; i < COUNT / 2; i++) {
+        ASSERT_PRINT(&tree, mt_delete(&tree, &keys[i]), "Failed to delete %u\n", keys[i]);
+        present[keys[i] / 2] = false;
+    }
+    mt_validate(&tree);
+
+    uint32_t missing = 1;
+    ASSERT_PRINT(&tree, !mt_cursor_seek(&cursor, &missing), "Found missing key\n");
+
+    for (uint32_t probe = 0; probe < COUNT * 2 + 2; probe++) {
+        int64_t ge = -1, gt = -1, le = -1, lt = -1;
+        for (uint32_t k = 0; k < COUNT; k++) {
+            uint32_t key = k * 2;
+            if (!present[k]) {
+                continue;
+            }
+            if (key >= probe && ge < 0) ge = key;
+            if (key > probe && gt < 0) gt = key;
+            if (key <= probe) le = key;
+            if (key < probe) lt = key;
+        }
+
+        struct { COMPARISON_OP op; int64_t expected; } cases[] = {
+            {GE, ge}, {GT, gt}, {LE, le}, {LT, lt}};
+        for (auto &c : cases) {
+            bool found = mt_cursor_seek(&cursor, &probe, c.op);
+            ASSERT_PRINT(&tree, found == (c.expected >= 0),
+                        "Seek %u op %d found=%d\n", probe, c.op, found);
+            if (found) {
+                uint32_t key = *(uint32_t*)mt_cursor_key(&cursor);
+                ASSERT_PRINT(&tree, key == c.expected,
+                            "Seek %u op %d gave %u, expected %lld\n", probe, c.op, key,
+                            (long long)c.expected);
+                ASSERT_PRINT(&tree, *(uint64_t*)mt_cursor_record(&cursor) == (uint64_t)key << 32,
+                            "Record mismatch for %u\n", key);
+            }
+        }
+    }
+
+    // Delete the rest through the cursor, it moves on to the next entry
+    uint32_t remaining = tree.entry_count;
+    mt_cursor_first(&cursor);
+    while (mt_cursor_is_valid(&cursor)) {
+        uint32_t key = *(uint32_t*)mt_cursor_key(&cursor);
+        ASSERT_PRINT(&tree, mt_cursor_delete(&cursor), "Cursor delete failed\n");
+        if (mt_cursor_is_valid(&cursor)) {
+            ASSERT_PRINT(&tree, *(uint32_t*)mt_cursor_key(&cursor) > key,
+                        "Cursor didn't move past %u\n", key);
+        }
+        remaining--;
+    }
+    ASSERT_PRINT(&tree, remaining == 0 && tree.entry_count == 0 && !tree.root,
+                "Tree not empty\n");
+    mt_validate(&tree);
+
+    arena<query_arena>::reset();
+}
+
+/*
+ * Runs of equal keys longer than a leaf, each comes out in insertion order
+ */
+ void test_memtree_duplicates() {
+    arena<query_arena>::init();
+
+    mt_cursor cursor = {.tree = mt_create(TYPE_U32, sizeof(uint32_t), true)};
+    memtree &tree = cursor.tree;
+    simple_rng rng(777);
+
+    const uint32_t COUNT = 6000;
+    const uint32_t KEYS = 5;
+    uint32_t counts[KEYS] = {};
+    for (uint32_t i = 0; i < COUNT; i++) {
+        uint32_t key = rng.next_range(KEYS) * 10;
+        counts[key / 10]++;
+        mt_insert(&tree, &key, &i);
+    }
+    mt_validate(&tree);
+    ASSERT_PRINT(&tree, tree.entry_count == COUNT, "Entry count %u\n", tree.entry_count);
+
+    uint32_t previous_key = 0, previous_value = 0, seen = 0;
+    for (bool valid = mt_cursor_first(&cursor); valid; valid = mt_cursor_next(&cursor)) {
+        uint32_t key = *(uint32_t*)mt_cursor_key(&cursor);
+        uint32_t value = *(uint32_t*)mt_cursor_record(&cursor);
+        if (seen > 0) {
+            ASSERT_PRINT(&tree, key > previous_key || (key == previous_key && value > previous_value),
+                        "Order violated at %u:%u after %u:%u\n", key, value, previous_key,
+                        previous_value);
+        }
+        previous_key = key;
+        previous_value = value;
+        seen++;
+    }
+    ASSERT_PRINT(&tree, seen == COUNT, "Iterated %u entries\n", seen);
+
+    for (uint32_t k = 0; k < KEYS; k++) {
+        uint32_t key = k * 10;
+        uint32_t run = 0;
+        ASSERT_PRINT(&tree, mt_cursor_seek(&cursor, &key), "Key %u missing\n", key);
+        ASSERT_PRINT(&tree, !mt_cursor_has_previous(&cursor) ||
+                    (mt_cursor_previous(&cursor) && *(uint32_t*)mt_cursor_key(&cursor) < key &&
+                     mt_cursor_next(&cursor)),
+                    "Seek didn't land on the first %u\n", key);
+        do {
+            run++;
+        } while (mt_cursor_next(&cursor) && *(uint32_t*)mt_cursor_key(&cursor) == key);
+        ASSERT_PRINT(&tree, run == counts[k], "Key %u: %u of %u\n", key, run, counts[k]);
+
+        // The last of the run, and the one before the first
+        ASSERT_PRINT(&tree, mt_cursor_seek(&cursor, &key, LE) &&
+                    *(uint32_t*)mt_cursor_key(&cursor) == key && !(mt_cursor_next(&cursor) &&
+                    *(uint32_t*)mt_cursor_key(&cursor) == key),
+                    "LE didn't land on the last %u\n", key);
+        bool before = mt_cursor_seek(&cursor, &key, LT);
+        ASSERT_PRINT(&tree, before == (k > 0), "LT %u found=%d\n", key, before);
+    }
+
+    // Without duplicates, an equal key replaces the record
+    mt_cursor unique = {.tree = mt_create(TYPE_U32, sizeof(uint32_t), false)};
+    for (uint32_t i = 0; i < COUNT; i++) {
+        uint32_t key = i % 100;
+        mt_insert(&unique.tree, &key, &i);
+    }
+    mt_validate(&unique.tree);
+    ASSERT_PRINT(&unique.tree, unique.tree.entry_count == 100, "Entry count %u\n",
+                unique.tree.entry_count);
+    uint32_t key = 42;
+    ASSERT_PRINT(&unique.tree, mt_cursor_seek(&unique, &key) &&
+                *(uint32_t*)mt_cursor_record(&unique) == COUNT - 100 + 42,
+                "Record not replaced\n");
+
+    arena<query_arena>::reset();
+}
+
+ void test_memtree_cursor_operations() {
+    arena<query_arena>::init();
+
+    mt_cursor cursor = {.tree = mt_create(TYPE_U32, sizeof(uint32_t), false)};
+    memtree &tree = cursor.tree;
+
+    ASSERT_PRINT(&tree, !mt_cursor_first(&cursor) && !mt_cursor_last(&cursor),
+                "Empty tree has entries\n");
+    uint32_t key = 5;
+    ASSERT_PRINT(&tree, !mt_cursor_seek(&cursor, &key, GE), "Seek in empty tree\n");
+    ASSERT_PRINT(&tree, !mt_cursor_delete(&cursor), "Delete in empty tree\n");
+
+    const uint32_t COUNT = 3000;
+    for (uint32_t i = 0; i < COUNT; i++) {
+        key = (i * 7919) % COUNT;
+        uint32_t value = 0;
+        ASSERT_PRINT(&tree, mt_cursor_insert(&cursor, &key, &value), "Insert failed\n");
+        ASSERT_PRINT(&tree, *(uint32_t*)mt_cursor_key(&cursor) == key,
+                    "Cursor not on inserted key %u\n", key);
+        value = key + 1;
+        mt_cursor_update(&cursor, &value);
+    }
+    mt_validate(&tree);
+
+    uint32_t expected = COUNT - 1;
+    for (bool valid = mt_cursor_last(&cursor); valid; valid = mt_cursor_previous(&cursor)) {
+        ASSERT_PRINT(&tree, *(uint32_t*)mt_cursor_key(&cursor) == expected &&
+                    *(uint32_t*)mt_cursor_record(&cursor) == expected + 1,
+                    "Backwards expected %u\n", expected);
+        ASSERT_PRINT(&tree, mt_cursor_has_previous(&cursor) == (expected > 0),
+                    "has_previous wrong at %u\n", expected);
+        ASSERT_PRINT(&tree, mt_cursor_has_next(&cursor) == (expected < COUNT - 1),
+                    "has_next wrong at %u\n", expected);
+        expected--;
+    }
+    ASSERT_PRINT(&tree, expected == UINT32_MAX, "Stopped at %u\n", expected);
+    ASSERT_PRINT(&tree, !mt_cursor_is_valid(&cursor) && !mt_cursor_next(&cursor),
+                "Cursor valid past the start\n");
+
+    // Delete every other key while walking forward
+    mt_cursor_first(&cursor);
+    while (mt_cursor_is_valid(&cursor)) {
+        if (*(uint32_t*)mt_cursor_key(&cursor) % 2 == 0) {
+            mt_cursor_delete(&cursor);
+        } else {
+            mt_cursor_next(&cursor);
+        }
+    }
+    mt_validate(&tree);
+    ASSERT_PRINT(&tree, tree.entry_count == COUNT / 2, "Entry count %u\n", tree.entry_count);
+
+    arena<query_arena>::reset();
+}
+
+/*
+ * Records bigger than a node hold only a few to a leaf
+ */
+ void test_memtree_wide_records() {
+    arena<query_arena>::init();
+
+    const uint32_t RECORD = 3000;
+    mt_cursor cursor = {.tree = mt_create(TYPE_U64, RECORD, true)};
+    memtree &tree = cursor.tree;
+    ASSERT_PRINT(&tree, tree.leaf_max_keys == MT_MIN_NODE_KEYS, "Leaf holds %u\n",
+                tree.leaf_max_keys);
+
+    uint8_t record[RECORD];
+    simple_rng rng(99);
+    for (uint32_t i = 0; i < 500; i++) {
+        uint64_t key = rng.next_range(1000);
+        memset(record, (int)(key & 0xff), RECORD);
+        mt_insert(&tree, &key, record);
+    }
+    mt_validate(&tree);
+
+    uint64_t previous = 0;
+    for (bool valid = mt_cursor_first(&cursor); valid; valid = mt_cursor_next(&cursor)) {
+        uint64_t key = *(uint64_t*)mt_cursor_key(&cursor);
+        uint8_t *rec = (uint8_t*)mt_cursor_record(&cursor);
+        ASSERT_PRINT(&tree, key >= previous && rec[0] == (key & 0xff) &&
+                    rec[RECORD - 1] == (key & 0xff), "Bad entry %llu\n", (unsigned long long)key);
+        previous = key;
+    }
+
+    arena<query_arena>::reset();
+}
+
+ void test_memtree_varchar_keys() {
+    arena<query_arena>::init();
+
+    mt_cursor cursor = {.tree = mt_create(TYPE_CHAR32, sizeof(uint32_t), false)};
+    memtree &tree = cursor.tree;
+
+    const uint32_t COUNT = 2000;
+    for (uint32_t i = 0; i < COUNT; i++) {
+        char key[32] = {0};
+        snprintf(key, sizeof(key), "key_%05u", (i * 7919) % COUNT);
+        mt_insert(&tree, key, &i);
+    }
+    mt_validate(&tree);
+
+    char previous[32] = {0};
+    uint32_t seen = 0;
+    for (bool valid = mt_cursor_first(&cursor); valid; valid = mt_cursor_next(&cursor)) {
+        char *key = (char*)mt_cursor_key(&cursor);
+        ASSERT_PRINT(&tree, seen == 0 || strcmp(previous, key) < 0,
+                    "String ordering violated: '%s' before '%s'\n", previous, key);
+        strncpy(previous, key, 31);
+        seen++;
+    }
+    ASSERT_PRINT(&tree, seen == COUNT, "Iterated %u keys\n", seen);
+
+    char probe[32] = "key_01000";
+    ASSERT_PRINT(&tree, mt_cursor_seek(&cursor, probe), "Missing '%s'\n", probe);
+    char between[32] = "key_01000a";
+    ASSERT_PRINT(&tree, mt_cursor_seek(&cursor, between, GT) &&
+                strcmp((char*)mt_cursor_key(&cursor), "key_01001") == 0,
+                "GT '%s' gave '%s'\n", between, (char*)mt_cursor_key(&cursor));
+
+    arena<query_arena>::reset();
+}
+
+ void test_memtree() {
+    test_memtree_sequential_ops();
+    test_memtree_random_ops();
+    test_memtree_duplicates();
+    test_memtree_cursor_operations();
+    test_memtree_wide_records();
+    test_memtree_varchar_keys();
+
+    printf("memtree tests passed\n");
+}
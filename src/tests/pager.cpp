@@ -6,6 +6,7 @@
 #include <cstdlib>
 #include <ctime>
 #include <cstdio>
+#include <thread>
 
 #define DB "db"
 
@@ -82,11 +83,15 @@ weighted_rand_op()
 }
 
 void
-test_pager_stress()
+test_pager_stress(size_t mmap_bytes = 0)
 {
 	std::srand(42);
 	os_file_delete(DB);
 	pager_open(DB);
+	if (mmap_bytes)
+	{
+		pager_set_mmap_size(mmap_bytes);
+	}
 
 	op_log.clear();
 	array<uint32_t> committed_pages;
@@ -253,8 +258,736 @@ test_pager_stress()
 	printf("Stress test passed\n");
 }
 
+void
+test_pager_pinning()
+{
+	os_file_delete(DB);
+	pager_open(DB, PAGER_MIN_CACHE_PAGES);
+	pager_begin_transaction();
+
+	const uint32_t count = PAGER_MIN_CACHE_PAGES * 4;
+	uint32_t	   pages[count];
+	base_page	  *pinned[count];
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pages[i] = pager_new();
+		pinned[i] = pager_pin(pages[i]);
+		pinned[i]->data[0] = 'a' + (i % 26);
+	}
+
+	pager_meta stats = pager_get_stats();
+	assert(stats.cache_capacity == PAGER_MIN_CACHE_PAGES);
+	assert(stats.cache_frames >= count && "Pool should grow when every frame is pinned");
+	assert(stats.pinned_pages == count);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		assert(pinned[i] == pager_get(pages[i]) && "Pinned page moved");
+		assert(pinned[i]->data[0] == 'a' + (i % 26));
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pager_unpin(pages[i]);
+	}
+
+	/* Unpinned pages are evictable again, new pages reuse frames */
+	uint32_t frames = pager_get_stats().cache_frames;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pager_new();
+	}
+	assert(pager_get_stats().cache_frames == frames);
+
+	pager_commit();
+
+	stats = pager_get_stats();
+	assert(stats.cache_frames == PAGER_MIN_CACHE_PAGES && "Pool should shrink to its watermark on commit");
+	assert(stats.pinned_pages == 0);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		assert(pager_get(pages[i])->data[0] == 'a' + (i % 26));
+	}
+
+	pager_close();
+	os_file_delete(DB);
+
+	printf("Pinning test passed\n");
+}
+
+void
+test_pager_group_commit()
+{
+	os_file_delete(DB);
+	pager_open(DB, PAGER_MIN_CACHE_PAGES);
+	pager_set_group_commit(60000, 0);
+
+	const uint32_t count = PAGER_MIN_CACHE_PAGES * 2;
+	uint32_t	   pages[count];
+
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pages[i] = pager_new();
+		pager_get(pages[i])->data[0] = 'a';
+	}
+	pager_commit_grouped();
+	assert(os_file_exists(DB "-journal") && "Soft commit should leave the journal open");
+
+	/* Rolling back only undoes the transaction since the last soft commit */
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pager_ensure_journaled(pages[i]);
+		pager_get(pages[i])->data[0] = 'b';
+	}
+	uint32_t next = pager_get_next();
+	pager_new();
+	pager_rollback();
+
+	assert(pager_get_next() == next && "Pages allocated after the savepoint should be released");
+	for (uint32_t i = 0; i < count; i++)
+	{
+		assert(pager_get(pages[i])->data[0] == 'a');
+	}
+
+	/* Closing commits the group, minus the unfinished transaction */
+	pager_begin_transaction();
+	pager_ensure_journaled(pages[0]);
+	pager_get(pages[0])->data[0] = 'c';
+	pager_commit_grouped();
+
+	pager_begin_transaction();
+	pager_ensure_journaled(pages[1]);
+	pager_get(pages[1])->data[0] = 'd';
+	pager_close();
+
+	assert(!os_file_exists(DB "-journal"));
+	pager_open(DB, PAGER_MIN_CACHE_PAGES);
+	assert(pager_get(pages[0])->data[0] == 'c');
+	for (uint32_t i = 1; i < count; i++)
+	{
+		assert(pager_get(pages[i])->data[0] == 'a');
+	}
+
+	/* A full journal forces the durable commit */
+	pager_set_group_commit(60000, 2);
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pager_ensure_journaled(pages[i]);
+		pager_get(pages[i])->data[0] = 'e';
+	}
+	pager_commit_grouped();
+	assert(!os_file_exists(DB "-journal"));
+
+	/* Going idle flushes the group without waiting out the window */
+	pager_set_group_commit(60000, 0);
+	assert(pager_group_commit_due() == -1);
+	pager_begin_transaction();
+	pager_ensure_journaled(pages[0]);
+	pager_get(pages[0])->data[0] = 'f';
+	pager_commit_grouped();
+	assert(pager_group_commit_due() > 0);
+
+	pager_begin_transaction();
+	assert(pager_group_commit_due() == -1 && "The running transaction's commit makes the group durable");
+	pager_rollback();
+
+	assert(pager_flush_group());
+	assert(!os_file_exists(DB "-journal"));
+	assert(pager_group_commit_due() == -1);
+	pager_close();
+	pager_open(DB, PAGER_MIN_CACHE_PAGES);
+	assert(pager_get(pages[0])->data[0] == 'f');
+
+	pager_set_group_commit(0, 0);
+	pager_close();
+	os_file_delete(DB);
+
+	printf("Group commit test passed\n");
+}
+
+static void
+copy_file(const char *from, const char *to)
+{
+	os_file_delete(to);
+	os_file_handle_t in = os_file_open(from, false, false);
+	os_file_handle_t out = os_file_open(to, true, true);
+	char			 buffer[PAGE_SIZE];
+	os_file_size_t	 n;
+	while ((n = os_file_read(in, buffer, sizeof(buffer))) > 0)
+	{
+		os_file_write(out, buffer, n);
+	}
+	os_file_close(in);
+	os_file_close(out);
+}
+
+static os_file_offset_t
+file_size(const char *filename)
+{
+	os_file_handle_t handle = os_file_open(filename, false, false);
+	os_file_offset_t size = os_file_size(handle);
+	os_file_close(handle);
+	return size;
+}
+
+void
+test_pager_wal()
+{
+	os_file_delete(DB);
+	os_file_delete(DB "-wal");
+	pager_open(DB, PAGER_MIN_CACHE_PAGES, PAGER_JOURNAL_WAL);
+
+	const uint32_t count = PAGER_MIN_CACHE_PAGES * 2;
+	uint32_t	   pages[count];
+
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pages[i] = pager_new();
+		pager_get(pages[i])->data[0] = 'a';
+	}
+	pager_commit();
+
+	assert(!os_file_exists(DB "-journal"));
+	assert(pager_get_stats().wal_frames >= count + 1);
+	assert(file_size(DB) == PAGE_SIZE && "Commits should only append to the WAL");
+
+	/* Rollback drops the transaction's frames, including evicted pages */
+	uint32_t frames = pager_get_stats().wal_frames;
+	uint32_t next = pager_get_next();
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pager_ensure_journaled(pages[i]);
+		pager_get(pages[i])->data[0] = 'b';
+	}
+	pager_new();
+	pager_rollback();
+
+	assert(pager_get_stats().wal_frames == frames);
+	assert(pager_get_next() == next);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		assert(pager_get(pages[i])->data[0] == 'a');
+	}
+
+	pager_begin_transaction();
+	pager_ensure_journaled(pages[0]);
+	pager_get(pages[0])->data[0] = 'c';
+	pager_commit();
+
+	/* Snapshot the files mid-transaction, as if the process had crashed */
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pager_ensure_journaled(pages[i]);
+		pager_get(pages[i])->data[0] = 'x';
+	}
+	copy_file(DB, DB "_crash");
+	copy_file(DB "-wal", DB "_crash-wal");
+	pager_rollback();
+
+	assert(pager_checkpoint());
+	assert(pager_get_stats().wal_frames == 0);
+	assert(pager_get(pages[0])->data[0] == 'c');
+	pager_close();
+	assert(!os_file_exists(DB "-wal"));
+
+	/* Opening in rollback mode checkpoints the committed frames only */
+	pager_open(DB "_crash", PAGER_MIN_CACHE_PAGES);
+	assert(!os_file_exists(DB "_crash-wal"));
+	assert(pager_get_next() == next);
+	assert(pager_get(pages[0])->data[0] == 'c');
+	for (uint32_t i = 1; i < count; i++)
+	{
+		assert(pager_get(pages[i])->data[0] == 'a');
+	}
+	pager_close();
+
+	os_file_delete(DB);
+	os_file_delete(DB "_crash");
+
+	printf("WAL test passed\n");
+}
+
+void
+test_pager_mmap()
+{
+	os_file_delete(DB);
+	pager_open(DB, PAGER_MIN_CACHE_PAGES);
+
+	const uint32_t count = PAGER_MIN_CACHE_PAGES * 2;
+	uint32_t	   pages[count];
+
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pages[i] = pager_new();
+		pager_get(pages[i])->data[0] = 'a';
+	}
+	pager_commit();
+	pager_close();
+
+	pager_open(DB, PAGER_MIN_CACHE_PAGES);
+	assert(pager_set_mmap_size(1 << 20));
+	assert(pager_get_stats().mapped_pages == count + 1);
+
+	/* Clean pages come straight from the mapping, bypassing the cache */
+	base_page *mapped[count];
+	for (uint32_t i = 0; i < count; i++)
+	{
+		mapped[i] = pager_get(pages[i]);
+		assert(mapped[i]->data[0] == 'a');
+	}
+	assert(pager_get_stats().cached_pages == 0);
+	assert(pager_pin(pages[0]) == mapped[0]);
+	pager_unpin(pages[0]);
+
+	/* Writes go to a private copy, the pointer stays the same */
+	pager_begin_transaction();
+	pager_ensure_journaled(pages[0]);
+	mapped[0]->data[0] = 'b';
+	assert(pager_get(pages[0]) == mapped[0] && pager_get(pages[0])->data[0] == 'b');
+	assert(pager_get_stats().dirty_pages == 1);
+	pager_rollback();
+	assert(mapped[0]->data[0] == 'a' && "Rollback should drop the private copy");
+
+	/* Reclaimed free pages are reused in place, new pages are cached */
+	pager_begin_transaction();
+	pager_ensure_journaled(pages[1]);
+	mapped[1]->data[0] = 'c';
+	pager_delete(pages[2]);
+	assert(pager_new() == pages[2]);
+	assert(pager_get(pages[2]) == mapped[2] && mapped[2]->data[0] == 0);
+	uint32_t extra = pager_new();
+	pager_get(extra)->data[0] = 'd';
+	assert(pager_get_stats().cached_pages == 1);
+	pager_commit();
+
+	assert(pager_get_stats().mapped_pages == count + 2);
+	pager_close();
+
+	pager_open(DB, PAGER_MIN_CACHE_PAGES);
+	assert(pager_get(pages[0])->data[0] == 'a');
+	assert(pager_get(pages[1])->data[0] == 'c');
+	assert(pager_get(pages[2])->data[0] == 0);
+	assert(pager_get(extra)->data[0] == 'd');
+	pager_close();
+	os_file_delete(DB);
+
+	printf("Mmap test passed\n");
+}
+
+/*
+ * Count how many of a small set of hot pages are still cached after a scan.
+ * Residency is probed by overwriting the pages on disk behind the pager's back,
+ * a cached page still reads as it was.
+ */
+static uint32_t
+scan_survivors(PAGER_CACHE_POLICY policy, bool sequential)
+{
+	const uint32_t cache = 16, hot = 4, scan = 100;
+	const uint32_t count = hot + cache + scan;
+	uint32_t	   pages[count];
+
+	os_file_delete(DB);
+	pager_open(DB, cache);
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pages[i] = pager_new();
+		pager_get(pages[i])->data[0] = i < hot ? 'h' : 'c';
+	}
+	pager_commit();
+	pager_close();
+
+	pager_open(DB, cache);
+	pager_set_cache_policy(policy);
+
+	/* Under 2Q a page is promoted when reused after leaving probation */
+	for (uint32_t i = 0; i < hot + cache; i++)
+	{
+		pager_get(pages[i]);
+	}
+	for (uint32_t i = 0; i < hot; i++)
+	{
+		pager_get(pages[i]);
+	}
+
+	for (uint32_t i = hot + cache; i < count; i++)
+	{
+		sequential ? pager_get_sequential(pages[i]) : pager_get(pages[i]);
+	}
+
+	os_file_handle_t handle = os_file_open(DB, true, false);
+	for (uint32_t i = 0; i < hot; i++)
+	{
+		char marker = 'z';
+		os_file_seek(handle, pages[i] * PAGE_SIZE + sizeof(uint32_t));
+		os_file_write(handle, &marker, 1);
+	}
+	os_file_close(handle);
+
+	uint32_t survivors = 0;
+	for (uint32_t i = 0; i < hot; i++)
+	{
+		survivors += pager_get(pages[i])->data[0] == 'h';
+	}
+
+	pager_set_cache_policy(PAGER_CACHE_2Q);
+	pager_close();
+	os_file_delete(DB);
+	return survivors;
+}
+
+void
+test_pager_replacement()
+{
+	/* A scan through a much larger table mustn't push out the working set */
+	assert(scan_survivors(PAGER_CACHE_2Q, false) == 4);
+	assert(scan_survivors(PAGER_CACHE_LRU, false) == 0);
+
+	/* Unless the scan says so, then LRU keeps it too */
+	assert(scan_survivors(PAGER_CACHE_2Q, true) == 4);
+	assert(scan_survivors(PAGER_CACHE_LRU, true) == 4);
+
+	printf("Replacement test passed\n");
+}
+
+void
+test_pager_stats()
+{
+	os_file_delete(DB);
+	pager_open(DB, PAGER_MIN_CACHE_PAGES);
+
+	const uint32_t count = PAGER_MIN_CACHE_PAGES * 4;
+	uint32_t	   pages[count];
+
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pages[i] = pager_new();
+		pager_get(pages[i])->data[0] = 'a';
+	}
+	pager_commit();
+
+	pager_io_stats io = pager_get_stats(true).io;
+	assert(io.dirty_evictions > 0 && "Writing more pages than fit should evict dirty ones");
+	assert(io.pages_written == count + 2 && "Every page once, the root at open and commit");
+	assert(io.journal_pages == 1 && "New pages aren't journaled, only the root");
+	assert(io.syncs == 2 && io.sync_latency.samples == io.syncs);
+	assert(io.transactions == 1 && io.tx_bytes_written == io.bytes_written - PAGE_SIZE);
+
+	io = pager_get_stats().io;
+	assert(io.syncs == 0 && io.transactions == 0 && "Reset on read");
+
+	/* Misses are timed, hits aren't */
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pager_get(pages[i]);
+	}
+	pager_get(pages[count - 1]);
+
+	io = pager_get_stats().io;
+	uint32_t buckets = 0;
+	for (uint32_t i = 0; i < PAGER_HISTOGRAM_BUCKETS; i++)
+	{
+		buckets += io.miss_latency.buckets[i];
+	}
+	assert(io.cache_hits >= 1 && io.cache_misses >= count - PAGER_MIN_CACHE_PAGES);
+	assert(io.miss_latency.samples == io.cache_misses && buckets == io.cache_misses);
+	assert(io.clean_evictions > 0 && io.dirty_evictions == 0);
+	assert(io.bytes_read == io.cache_misses * PAGE_SIZE);
+	assert(io.bytes_written == 0);
+
+	pager_close();
+	os_file_delete(DB);
+
+	printf("Stats test passed\n");
+}
+
+void
+test_pager_free_space()
+{
+	os_file_delete(DB);
+	pager_open(DB);
+
+	const uint32_t count = 40;
+	uint32_t	   pages[count];
+
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pages[i] = pager_new();
+		pager_get(pages[i])->data[0] = 'a' + i % 26;
+	}
+	pager_commit();
+	assert(file_size(DB) == (count + 1) * PAGE_SIZE);
+
+	/* Free a middle extent and the tail, the tail is cut off at commit */
+	pager_begin_transaction();
+	for (uint32_t i = 10; i < 20; i++)
+	{
+		pager_delete(pages[i]);
+	}
+	for (uint32_t i = 30; i < count; i++)
+	{
+		pager_delete(pages[i]);
+	}
+	pager_commit();
+	assert(file_size(DB) == 31 * PAGE_SIZE);
+	assert(pager_get_stats().total_pages == 30 && pager_get_stats().free_pages == 10);
+
+	/* Allocation takes the page after the hint, otherwise the lowest */
+	pager_begin_transaction();
+	assert(pager_new(pages[4]) == pages[10]);
+	assert(pager_new() == pages[11]);
+	assert(pager_new(pages[11]) == pages[12]);
+	assert(pager_new(pages[25]) == pages[13] && "Nothing near, fall back to the lowest");
+	pager_rollback();
+	assert(pager_get_stats().free_pages == 10);
+
+	/* An extent takes a free run long enough, otherwise the end of the file */
+	pager_begin_transaction();
+	assert(pager_new_extent(4, pages[9]) == pages[10]);
+	assert(pager_new_extent(8) == pages[29] + 1 && "The rest of the hole is too short");
+	assert(pager_new_extent(6, pages[25]) == pages[14]);
+	assert(pager_get_stats().free_pages == 0);
+	pager_rollback();
+	assert(pager_get_stats().free_pages == 10);
+
+	/* Relocation moves the highest live page into the lowest hole */
+	pager_begin_transaction();
+	assert(pager_relocate(pages[29]) == pages[10]);
+	assert(pager_relocate(pages[5]) == pages[5] && "No free page below it");
+	pager_commit();
+	assert(file_size(DB) == 30 * PAGE_SIZE);
+	pager_close();
+
+	pager_open(DB);
+	pager_meta stats = pager_get_stats();
+	assert(stats.total_pages == 29 && stats.free_pages == 9);
+	base_page *moved = pager_get(pages[10]);
+	assert(moved->index == pages[10] && moved->data[0] == 'a' + 29 % 26);
+
+	pager_begin_transaction();
+	for (uint32_t i = 11; i < 20; i++)
+	{
+		assert(pager_new(pages[i - 1]) == pages[i]);
+	}
+	pager_commit();
+	assert(pager_get_stats().free_pages == 0);
+	pager_close();
+
+	/* In WAL mode the file shrinks at the checkpoint */
+	pager_open(DB, PAGER_DEFAULT_CACHE_PAGES, PAGER_JOURNAL_WAL);
+	pager_begin_transaction();
+	for (uint32_t i = 20; i < 29; i++)
+	{
+		pager_delete(pages[i]);
+	}
+	pager_commit();
+	assert(file_size(DB) == 30 * PAGE_SIZE);
+	assert(pager_checkpoint());
+	assert(file_size(DB) == 21 * PAGE_SIZE);
+	pager_close();
+
+	os_file_delete(DB);
+
+	printf("Free space test passed\n");
+}
+
+void
+test_pager_memory()
+{
+	assert(!pager_exists(PAGER_MEMORY));
+	assert(pager_open(PAGER_MEMORY, PAGER_MIN_CACHE_PAGES, PAGER_JOURNAL_WAL));
+	assert(!pager_set_mmap_size(1 << 20));
+
+	const uint32_t count = PAGER_MIN_CACHE_PAGES * 4;
+	uint32_t	   pages[count];
+
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pages[i] = pager_new();
+		pager_get(pages[i])->data[0] = 'a';
+	}
+	pager_commit();
+	assert(!os_file_exists(PAGER_MEMORY) && !os_file_exists(PAGER_MEMORY "-journal") &&
+		   !os_file_exists(PAGER_MEMORY "-wal"));
+
+	/* Rollback restores pages evicted dirty meanwhile, and the free list */
+	uint32_t next = pager_get_next();
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pager_ensure_journaled(pages[i]);
+		pager_get(pages[i])->data[0] = 'b';
+	}
+	pager_delete(pages[0]);
+	pager_new();
+	pager_new();
+	pager_rollback();
+
+	assert(pager_get_next() == next);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		assert(pager_get(pages[i])->data[0] == 'a');
+	}
+
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pager_ensure_journaled(pages[i]);
+		pager_get(pages[i])->data[0] = 'c';
+	}
+	pager_commit();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		assert(pager_get(pages[i])->data[0] == 'c');
+	}
+
+	/* A grouped commit is a full one, a rollback after it can't undo it */
+	pager_set_group_commit(60000, 0);
+	pager_begin_transaction();
+	pager_ensure_journaled(pages[0]);
+	pager_get(pages[0])->data[0] = 'd';
+	pager_commit_grouped();
+	pager_begin_transaction();
+	pager_ensure_journaled(pages[1]);
+	pager_get(pages[1])->data[0] = 'e';
+	pager_rollback();
+	assert(pager_get(pages[0])->data[0] == 'd' && pager_get(pages[1])->data[0] == 'c');
+	pager_set_group_commit(0, 0);
+
+	pager_io_stats io = pager_get_stats().io;
+	assert(io.dirty_evictions > 0 && io.pages_written > count);
+	assert(io.syncs == 0 && io.journal_pages == 0 && "Nothing is journaled or synced");
+	assert(io.bytes_read == 0 && io.bytes_written == 0 && "No file is touched");
+
+	/* Each open is a new database */
+	pager_close();
+	assert(pager_open(PAGER_MEMORY));
+	assert(pager_get_stats().total_pages == 0);
+	pager_close();
+
+	/* Past its limit the store is full, and the whole transaction rolls back */
+	const uint32_t limit = PAGER_MIN_CACHE_PAGES * 2;
+	assert(pager_open(PAGER_MEMORY, PAGER_MIN_CACHE_PAGES, PAGER_JOURNAL_ROLLBACK, limit));
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < PAGER_MIN_CACHE_PAGES; i++)
+	{
+		pages[i] = pager_new();
+		pager_get(pages[i])->data[0] = 'a';
+	}
+	assert(pager_commit());
+
+	next = pager_get_next();
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < PAGER_MIN_CACHE_PAGES; i++)
+	{
+		pager_ensure_journaled(pages[i]);
+		pager_get(pages[i])->data[0] = 'b';
+	}
+	for (uint32_t i = 0; i < limit; i++)
+	{
+		pager_get(pager_new())->data[0] = 'c';
+	}
+	assert(!pager_commit() && "A transaction past the limit can't commit");
+	assert(!pager_in_transaction() && pager_get_next() == next);
+	for (uint32_t i = 0; i < PAGER_MIN_CACHE_PAGES; i++)
+	{
+		assert(pager_get(pages[i])->data[0] == 'a');
+	}
+
+	pager_begin_transaction();
+	pager_ensure_journaled(pages[0]);
+	pager_get(pages[0])->data[0] = 'd';
+	assert(pager_commit() && "The store is usable after a failed commit");
+	assert(pager_get(pages[0])->data[0] == 'd');
+	pager_close();
+
+	printf("Memory database test passed\n");
+}
+
+/*
+ * Readers on threads of their own, together reading more pages than fit,
+ * still evict and keep the pool to its capacity and one frame each
+ */
+void
+test_pager_shared_reads()
+{
+	os_file_delete(DB);
+	pager_open(DB, PAGER_MIN_CACHE_PAGES);
+
+	const uint32_t count = PAGER_MIN_CACHE_PAGES * 8;
+	const uint32_t readers = 4;
+	uint32_t	   pages[count];
+
+	pager_begin_transaction();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pages[i] = pager_new();
+		pager_get(pages[i])->data[0] = (char)('a' + i % 26);
+	}
+	pager_commit();
+	pager_get_stats(true);
+
+	bool		ok[readers];
+	std::thread threads[readers];
+	pager_begin_shared_reads();
+	for (uint32_t t = 0; t < readers; t++)
+	{
+		threads[t] = std::thread([&, t] {
+			ok[t] = true;
+			for (uint32_t pass = 0; pass < 3; pass++)
+			{
+				for (uint32_t i = 0; i < count; i++)
+				{
+					uint32_t at = (i + t * count / readers) % count;
+					ok[t] &= pager_get(pages[at])->data[0] == (char)('a' + at % 26);
+				}
+			}
+		});
+	}
+	for (uint32_t t = 0; t < readers; t++)
+	{
+		threads[t].join();
+		assert(ok[t] && "Every reader should see the committed pages");
+	}
+
+	pager_meta stats = pager_get_stats(true);
+	assert(stats.io.clean_evictions > 0 && "Shared reads should still evict");
+	assert(stats.cache_frames <= stats.cache_capacity + readers && "At most a pinned frame per reader past capacity");
+	pager_end_shared_reads();
+
+	assert(pager_get_stats().cache_frames == PAGER_MIN_CACHE_PAGES && "Pool should shrink back when reads end");
+	assert(pager_get(pages[0])->data[0] == 'a');
+
+	pager_close();
+	os_file_delete(DB);
+
+	printf("Shared reads test passed\n");
+}
+
 void
 test_pager()
 {
 	test_pager_stress();
+	test_pager_stress(1 << 20);
+	test_pager_pinning();
+	test_pager_group_commit();
+	test_pager_wal();
+	test_pager_mmap();
+	test_pager_replacement();
+	test_pager_stats();
+	test_pager_free_space();
+	test_pager_memory();
+	test_pager_shared_reads();
 }
@@ -0,0 +1,194 @@
+#include "parallel.hpp"
+#include "fixture.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "../arena.hpp"
+#include "../btree.hpp"
+#include "../catalog.hpp"
+#include "../os_layer.hpp"
+#include "../pager.hpp"
+#include "../parallel.hpp"
+#include "../prepared.hpp"
+#include "../repl.hpp"
+#include "../types.hpp"
+
+#define TEST_DB "test_parallel.db"
+
+#define TEST_ROWS 20000
+
+/*
+ * What a statement output, the rows hashed in order and regardless of it
+ */
+struct result_digest
+{
+	uint32_t rows;
+	uint64_t ordered;
+	uint64_t unordered;
+};
+
+static result_digest digest;
+
+static void
+digest_row(typed_value *values, size_t count)
+{
+	uint64_t row = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t value = 0;
+		if (values[i].data)
+		{
+			// A string's bytes past its end are no part of it
+			size_t size = type_is_string(values[i].type) ? strlen(values[i].as_char())
+														 : type_size(values[i].type);
+			value = hash_bytes(values[i].data, size);
+		}
+		row = row * 1000003 + value;
+	}
+
+	digest.rows++;
+	digest.ordered = digest.ordered * 31 + row;
+	digest.unordered += row;
+}
+
+static result_digest
+run(const char *sql, uint32_t workers)
+{
+	par_set_workers(workers);
+	plan_cache_clear();
+
+	prepared_statement *stmt = sql_prepare(sql);
+	assert(stmt);
+	digest = {};
+	assert(sql_step(stmt, digest_row) == OK);
+	sql_finalize(stmt);
+	return digest;
+}
+
+/*
+ * Every worker count must output what a serial scan does, in the same order
+ * unless nothing orders it
+ */
+static void
+check_query(const char *sql, bool ordered)
+{
+	result_digest serial = run(sql, 1);
+	for (uint32_t workers : {2, 4, 7})
+	{
+		result_digest parallel = run(sql, workers);
+		assert(parallel.rows == serial.rows);
+		assert(parallel.unordered == serial.unordered);
+		assert(!ordered || parallel.ordered == serial.ordered);
+	}
+}
+
+static void
+test_split_points()
+{
+	btree *tree = &catalog.get("nums")->storage.btree;
+	uint32_t keys[64];
+
+	uint32_t count = bt_split_points(tree, 64, (uint8_t *)keys);
+	assert(count > 1 && count <= 64);
+	for (uint32_t i = 1; i < count; i++)
+	{
+		assert(keys[i - 1] < keys[i]);
+	}
+	assert(keys[count - 1] < TEST_ROWS * 3);
+
+	assert(bt_split_points(tree, 0, (uint8_t *)keys) == 0);
+	assert(bt_split_points(&catalog.get("few")->storage.btree, 64, (uint8_t *)keys) == 0);
+}
+
+static void
+test_scans()
+{
+	check_query("SELECT * FROM nums", true);
+	check_query("SELECT * FROM nums WHERE grp = 3", true);
+	check_query("SELECT id, name FROM nums WHERE grp > 90 AND id > 100", true);
+	check_query("SELECT id FROM nums WHERE grp + 1 = 50", true);
+	check_query("SELECT * FROM nums WHERE grp < 10 LIMIT 25 OFFSET 300", true);
+	check_query("SELECT * FROM nums LIMIT 3 OFFSET 19990", true);
+	check_query("SELECT * FROM nums ORDER BY id", true);
+
+	// Equal keys sort in key order both ways
+	check_query("SELECT * FROM nums WHERE grp > 80 ORDER BY grp", true);
+	check_query("SELECT * FROM nums ORDER BY name DESC LIMIT 40", true);
+	check_query("SELECT * FROM words WHERE length < 3 ORDER BY word", true);
+
+	assert(run("SELECT * FROM nums WHERE grp = 500", 4).rows == 0);
+	assert(run("SELECT * FROM nums LIMIT 0", 4).rows == 0);
+	assert(run("SELECT * FROM few", 4).rows == 3);
+}
+
+static void
+test_aggregates()
+{
+	check_query("SELECT COUNT(*), SUM(grp), MIN(name), MAX(id), AVG(grp) FROM nums", true);
+	check_query("SELECT COUNT(*), MIN(grp) FROM nums WHERE grp > 50", true);
+	check_query("SELECT grp, COUNT(*), SUM(id), AVG(id), MAX(name) FROM nums GROUP BY grp", false);
+	check_query("SELECT grp, COUNT(*) FROM nums WHERE id > 600 GROUP BY grp ORDER BY grp DESC", true);
+	check_query("SELECT name, MIN(id) FROM nums GROUP BY name ORDER BY name LIMIT 5", true);
+	check_query("SELECT id, COUNT(*) FROM nums WHERE grp = 7 GROUP BY id", true);
+	check_query("SELECT length, COUNT(*), MIN(word) FROM words GROUP BY length", false);
+
+	// No rows is still a row without a GROUP BY
+	result_digest empty = run("SELECT COUNT(*), MAX(id) FROM nums WHERE grp = 500", 4);
+	assert(empty.rows == 1);
+	assert(run("SELECT grp, COUNT(*) FROM nums WHERE grp = 500 GROUP BY grp", 4).rows == 0);
+}
+
+void
+test_parallel()
+{
+	// A small cache, so the workers miss and the pool grows
+	test_db_open(TEST_DB, 32);
+
+	assert(execute_sql_statements("CREATE TABLE nums (id INT, grp INT, name TEXT);"));
+	assert(execute_sql_statements("CREATE TABLE words (word TEXT, length INT);"));
+	assert(execute_sql_statements("CREATE TABLE few (id INT);"));
+	assert(execute_sql_statements("INSERT INTO few VALUES (1); INSERT INTO few VALUES (2); "
+								  "INSERT INTO few VALUES (3);"));
+
+	prepared_statement *insert_num = sql_prepare("INSERT INTO nums VALUES (?, ?, ?)");
+	prepared_statement *insert_word = sql_prepare("INSERT INTO words VALUES (?, ?)");
+	assert(insert_num && insert_word);
+
+	assert(execute_sql_statements("BEGIN;"));
+	char name[32];
+	for (uint32_t i = 0; i < TEST_ROWS; i++)
+	{
+		uint32_t grp = (i * 7919) % 100;
+		snprintf(name, sizeof(name), "n%u", (i * 104729) % 997);
+		assert(sql_bind_int(insert_num, 0, i * 3));
+		assert(sql_bind_int(insert_num, 1, grp));
+		assert(sql_bind_text(insert_num, 2, name));
+		assert(sql_step(insert_num) == OK);
+		sql_reset(insert_num);
+
+		if (i % 4 == 0)
+		{
+			snprintf(name, sizeof(name), "w%08u", (i * 2654435761u) % 100000000);
+			assert(sql_bind_text(insert_word, 0, name));
+			assert(sql_bind_int(insert_word, 1, grp % 7));
+			sql_step(insert_word); // the odd duplicate word is refused
+			sql_reset(insert_word);
+		}
+	}
+	assert(execute_sql_statements("COMMIT;"));
+	sql_finalize(insert_num);
+	sql_finalize(insert_word);
+
+	test_split_points();
+	test_scans();
+	test_aggregates();
+
+	par_set_workers(PARALLEL_DEFAULT_WORKERS);
+	plan_cache_clear();
+	pager_close();
+	os_file_delete(TEST_DB);
+	printf("parallel tests passed\n");
+}
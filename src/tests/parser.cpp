@@ -1,4 +1,5 @@
 #include "parser.hpp"
+#include "../os_layer.hpp"
 #include <cassert>
 #include <cstring>
 #include <cstdio>
@@ -123,6 +124,113 @@ test_select_order_by()
 	ASSERT_PRINT(select->order_desc == false, stmt);
 }
 
+ void
+test_select_limit()
+{
+	parser_result result = parse_sql("SELECT * FROM users ORDER BY age DESC LIMIT 20");
+	ASSERT_PRINT(result.success == true, nullptr);
+
+	stmt_node	*stmt = result.statements[0];
+	select_stmt *select = &stmt->select_stmt;
+
+	ASSERT_PRINT(select->order_desc == true, stmt);
+	ASSERT_PRINT(select->has_limit == true, stmt);
+	ASSERT_PRINT(select->limit == 20, stmt);
+	ASSERT_PRINT(select->offset == 0, stmt);
+
+	result = parse_sql("SELECT id FROM users WHERE age > 18 LIMIT 10 OFFSET 30");
+	ASSERT_PRINT(result.success == true, nullptr);
+	stmt = result.statements[0];
+	select = &stmt->select_stmt;
+
+	ASSERT_PRINT(select->has_limit == true, stmt);
+	ASSERT_PRINT(select->limit == 10, stmt);
+	ASSERT_PRINT(select->offset == 30, stmt);
+
+	result = parse_sql("SELECT * FROM users");
+	ASSERT_PRINT(result.statements[0]->select_stmt.has_limit == false, nullptr);
+
+	ASSERT_PRINT(parse_sql("SELECT * FROM users LIMIT").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("SELECT * FROM users LIMIT 'ten'").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("SELECT * FROM users LIMIT 10 OFFSET").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("SELECT * FROM users OFFSET 10").success == false, nullptr);
+}
+
+ void
+test_select_join()
+{
+	parser_result result =
+		parse_sql("SELECT users.name, total FROM users JOIN orders ON users.id = orders.user_id WHERE total > 5");
+	ASSERT_PRINT(result.success == true, nullptr);
+
+	stmt_node	*stmt = result.statements[0];
+	select_stmt *select = &stmt->select_stmt;
+
+	ASSERT_PRINT(str_eq(select->table_name, "users"), stmt);
+	ASSERT_PRINT(str_eq(select->join_table, "orders"), stmt);
+	ASSERT_PRINT(str_eq(select->columns[0], "users.name"), stmt);
+	ASSERT_PRINT(str_eq(select->columns[1], "total"), stmt);
+
+	expr_node *on = select->join_condition;
+	ASSERT_PRINT(on && on->op == OP_EQ, stmt);
+	ASSERT_PRINT(str_eq(on->left->column_name, "users.id"), stmt);
+	ASSERT_PRINT(str_eq(on->right->column_name, "orders.user_id"), stmt);
+	ASSERT_PRINT(select->where_clause->op == OP_GT, stmt);
+
+	result = parse_sql("SELECT * FROM a INNER JOIN b ON a.x = b.y AND a.z < 3 ORDER BY b.y LIMIT 2");
+	ASSERT_PRINT(result.success == true, nullptr);
+	stmt = result.statements[0];
+	select = &stmt->select_stmt;
+	ASSERT_PRINT(str_eq(select->join_table, "b"), stmt);
+	ASSERT_PRINT(select->join_condition->op == OP_AND, stmt);
+	ASSERT_PRINT(str_eq(select->order_by_column, "b.y"), stmt);
+	ASSERT_PRINT(select->limit == 2, stmt);
+
+	result = parse_sql("SELECT * FROM users");
+	ASSERT_PRINT(result.statements[0]->select_stmt.join_table.empty(), nullptr);
+
+	ASSERT_PRINT(parse_sql("SELECT * FROM a JOIN b").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("SELECT * FROM a JOIN ON a.x = b.y").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("SELECT * FROM a INNER b ON a.x = b.y").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("SELECT * FROM a JOIN b ON").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("SELECT a. FROM a").success == false, nullptr);
+}
+
+void
+test_select_group_by()
+{
+	parser_result result =
+		parse_sql("SELECT city, COUNT(*), sum(age), Max(name) FROM users WHERE age > 5 GROUP BY city ORDER BY city");
+	ASSERT_PRINT(result.success == true, nullptr);
+
+	stmt_node	*stmt = result.statements[0];
+	select_stmt *select = &stmt->select_stmt;
+
+	ASSERT_PRINT(select->columns.size() == 4 && select->column_aggregates.size() == 4, stmt);
+	ASSERT_PRINT(str_eq(select->columns[0], "city") && select->column_aggregates[0] == AGG_NONE, stmt);
+	ASSERT_PRINT(str_eq(select->columns[1], "*") && select->column_aggregates[1] == AGG_COUNT, stmt);
+	ASSERT_PRINT(str_eq(select->columns[2], "age") && select->column_aggregates[2] == AGG_SUM, stmt);
+	ASSERT_PRINT(str_eq(select->columns[3], "name") && select->column_aggregates[3] == AGG_MAX, stmt);
+	ASSERT_PRINT(str_eq(select->group_by_column, "city"), stmt);
+	ASSERT_PRINT(str_eq(select->order_by_column, "city"), stmt);
+	ASSERT_PRINT(select->where_clause->op == OP_GT, stmt);
+
+	// Not keywords, a column can still be called count
+	result = parse_sql("SELECT count, AVG(t.count) FROM t");
+	ASSERT_PRINT(result.success == true, nullptr);
+	select = &result.statements[0]->select_stmt;
+	ASSERT_PRINT(select->column_aggregates[0] == AGG_NONE, result.statements[0]);
+	ASSERT_PRINT(select->column_aggregates[1] == AGG_AVG, result.statements[0]);
+	ASSERT_PRINT(str_eq(select->columns[1], "t.count"), result.statements[0]);
+	ASSERT_PRINT(select->group_by_column.empty(), result.statements[0]);
+
+	ASSERT_PRINT(parse_sql("SELECT LENGTH(name) FROM t").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("SELECT SUM(*) FROM t").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("SELECT COUNT(x FROM t").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("SELECT x FROM t GROUP x").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("SELECT x FROM t GROUP BY").success == false, nullptr);
+}
+
  void
 test_select_full()
 {
@@ -177,6 +285,29 @@ test_insert_with_columns()
 	ASSERT_PRINT(insert->values.size() == 3, stmt);
 }
 
+ void
+test_insert_multiple_rows()
+{
+	parser_result result = parse_sql("INSERT INTO users (id, name) VALUES (1, 'John'), (2, 'Jane'),(3, ?)");
+	ASSERT_PRINT(result.success == true, nullptr);
+
+	stmt_node	*stmt = result.statements[0];
+	insert_stmt *insert = &stmt->insert_stmt;
+
+	ASSERT_PRINT(insert->row_count == 3, stmt);
+	ASSERT_PRINT(insert->values.size() == 6, stmt);
+	ASSERT_PRINT(insert->values[2]->int_val == 2, stmt);
+	ASSERT_PRINT(str_eq(insert->values[3]->str_val, "Jane"), stmt);
+	ASSERT_PRINT(insert->values[5]->type == EXPR_PARAMETER, stmt);
+
+	result = parse_sql("INSERT INTO users VALUES (1, 'John')");
+	ASSERT_PRINT(result.statements[0]->insert_stmt.row_count == 1, result.statements[0]);
+
+	ASSERT_PRINT(parse_sql("INSERT INTO users VALUES (1, 'John'), (2)").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("INSERT INTO users VALUES (1, 'John'), ").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("INSERT INTO users VALUES (1), 2").success == false, nullptr);
+}
+
  void
 test_update_no_where()
 {
@@ -296,6 +427,73 @@ test_drop_table()
 	ASSERT_PRINT(str_eq(drop->table_name, "users"), stmt);
 }
 
+ void
+test_create_index()
+{
+	parser_result result = parse_sql("CREATE INDEX users_email ON users (email); CREATE INDEX by_age ON users (age, name)");
+	ASSERT_PRINT(result.success == true, nullptr);
+	ASSERT_PRINT(result.statements.size() == 2, nullptr);
+
+	stmt_node		*stmt = result.statements[0];
+	create_index_stmt *create = &stmt->create_index_stmt;
+	ASSERT_PRINT(stmt->type == STMT_CREATE_INDEX, stmt);
+	ASSERT_PRINT(str_eq(create->index_name, "users_email"), stmt);
+	ASSERT_PRINT(str_eq(create->table_name, "users"), stmt);
+	ASSERT_PRINT(create->columns.size() == 1, stmt);
+	ASSERT_PRINT(str_eq(create->columns[0], "email"), stmt);
+
+	stmt = result.statements[1];
+	create = &stmt->create_index_stmt;
+	ASSERT_PRINT(create->columns.size() == 2, stmt);
+	ASSERT_PRINT(str_eq(create->columns[0], "age"), stmt);
+	ASSERT_PRINT(str_eq(create->columns[1], "name"), stmt);
+
+	/* CREATE TABLE still parses as before */
+	result = parse_sql("CREATE TABLE indexes (id INT)");
+	ASSERT_PRINT(result.success == true, nullptr);
+	ASSERT_PRINT(result.statements[0]->type == STMT_CREATE_TABLE, result.statements[0]);
+
+	ASSERT_PRINT(parse_sql("CREATE INDEX ON users (email)").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("CREATE INDEX e users (email)").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("CREATE INDEX e ON users ()").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("CREATE INDEX e ON users (a, b, c)").success == false, nullptr);
+}
+
+ void
+test_drop_index()
+{
+	parser_result result = parse_sql("DROP INDEX users_email");
+	ASSERT_PRINT(result.success == true, nullptr);
+
+	stmt_node	  *stmt = result.statements[0];
+	drop_index_stmt *drop = &stmt->drop_index_stmt;
+	ASSERT_PRINT(stmt->type == STMT_DROP_INDEX, stmt);
+	ASSERT_PRINT(str_eq(drop->index_name, "users_email"), stmt);
+
+	result = parse_sql("DROP TABLE users");
+	ASSERT_PRINT(result.statements[0]->type == STMT_DROP_TABLE, result.statements[0]);
+}
+
+ void
+test_copy_statement()
+{
+	parser_result result = parse_sql("COPY users FROM 'data/users.csv'; copy orders from 'orders.csv'");
+	ASSERT_PRINT(result.success == true, nullptr);
+	ASSERT_PRINT(result.statements.size() == 2, nullptr);
+
+	stmt_node *stmt = result.statements[0];
+	copy_stmt *copy = &stmt->copy_stmt;
+	ASSERT_PRINT(stmt->type == STMT_COPY, stmt);
+	ASSERT_PRINT(str_eq(copy->table_name, "users"), stmt);
+	ASSERT_PRINT(str_eq(copy->file_path, "data/users.csv"), stmt);
+	ASSERT_PRINT(str_eq(result.statements[1]->copy_stmt.table_name, "orders"), result.statements[1]);
+
+	ASSERT_PRINT(parse_sql("COPY users 'users.csv'").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("COPY users FROM users").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("COPY users FROM ''").success == false, nullptr);
+	ASSERT_PRINT(parse_sql("COPY FROM 'users.csv'").success == false, nullptr);
+}
+
  void
 test_transactions()
 {
@@ -334,6 +532,88 @@ test_expressions()
 	ASSERT_PRINT(stmt->select_stmt.where_clause->left->op == OP_OR, stmt);
 }
 
+ void
+test_between_and_in()
+{
+	parser_result result = parse_sql("SELECT * FROM t WHERE id BETWEEN 10 AND 20 AND name = 'x'");
+	ASSERT_PRINT(result.success == true, nullptr);
+	stmt_node *stmt = result.statements[0];
+	expr_node *where = stmt->select_stmt.where_clause;
+	ASSERT_PRINT(where->op == OP_AND, stmt);
+	ASSERT_PRINT(where->left->op == OP_AND, stmt);
+	ASSERT_PRINT(where->left->left->op == OP_GE, stmt);
+	ASSERT_PRINT(where->left->left->right->int_val == 10, stmt);
+	ASSERT_PRINT(where->left->right->op == OP_LE, stmt);
+	ASSERT_PRINT(where->left->right->right->int_val == 20, stmt);
+	ASSERT_PRINT(where->left->left->left != where->left->right->left, stmt);
+	ASSERT_PRINT(where->right->op == OP_EQ, stmt);
+
+	result = parse_sql("SELECT * FROM t WHERE id IN (1, 2, 3)");
+	ASSERT_PRINT(result.success == true, nullptr);
+	stmt = result.statements[0];
+	where = stmt->select_stmt.where_clause;
+	ASSERT_PRINT(where->op == OP_OR, stmt);
+	ASSERT_PRINT(where->left->op == OP_OR, stmt);
+	ASSERT_PRINT(where->left->left->op == OP_EQ, stmt);
+	ASSERT_PRINT(where->left->left->right->int_val == 1, stmt);
+	ASSERT_PRINT(where->right->op == OP_EQ, stmt);
+	ASSERT_PRINT(where->right->right->int_val == 3, stmt);
+
+	result = parse_sql("SELECT * FROM t WHERE name IN ('a')");
+	ASSERT_PRINT(result.success == true, nullptr);
+	stmt = result.statements[0];
+	ASSERT_PRINT(stmt->select_stmt.where_clause->op == OP_EQ, stmt);
+
+	result = parse_sql("SELECT * FROM t WHERE id NOT BETWEEN 1 AND 5 OR id NOT IN (7, 8)");
+	ASSERT_PRINT(result.success == true, nullptr);
+	stmt = result.statements[0];
+	where = stmt->select_stmt.where_clause;
+	ASSERT_PRINT(where->op == OP_OR, stmt);
+	ASSERT_PRINT(where->left->type == EXPR_UNARY_OP && where->left->operand->op == OP_AND, stmt);
+	ASSERT_PRINT(where->right->type == EXPR_UNARY_OP && where->right->operand->op == OP_OR, stmt);
+
+	result = parse_sql("SELECT * FROM t WHERE id BETWEEN 1");
+	ASSERT_PRINT(result.success == false, nullptr);
+
+	result = parse_sql("SELECT * FROM t WHERE id IN ()");
+	ASSERT_PRINT(result.success == false, nullptr);
+
+	result = parse_sql("SELECT * FROM t WHERE id IN (1, 2");
+	ASSERT_PRINT(result.success == false, nullptr);
+}
+
+ void
+test_parameters()
+{
+	parser_result result = parse_sql("SELECT * FROM t WHERE id = ? AND name BETWEEN ? AND 'z'");
+	ASSERT_PRINT(result.success == true, nullptr);
+	stmt_node *stmt = result.statements[0];
+	ASSERT_PRINT(stmt->parameters.size() == 2, stmt);
+	expr_node *where = stmt->select_stmt.where_clause;
+	ASSERT_PRINT(where->left->right->type == EXPR_PARAMETER, stmt);
+	ASSERT_PRINT(where->left->right->parameter->index == 0, stmt);
+	ASSERT_PRINT(where->right->left->right->parameter == stmt->parameters[1], stmt);
+
+	// BETWEEN's copy of its operand shares the slot
+	result = parse_sql("SELECT * FROM t WHERE ? BETWEEN 1 AND 5");
+	ASSERT_PRINT(result.success == true, nullptr);
+	stmt = result.statements[0];
+	where = stmt->select_stmt.where_clause;
+	ASSERT_PRINT(stmt->parameters.size() == 1, stmt);
+	ASSERT_PRINT(where->left->left->parameter == where->right->left->parameter, stmt);
+
+	result = parse_sql("INSERT INTO t VALUES (?, ?); UPDATE t SET name = ? WHERE id = 1");
+	ASSERT_PRINT(result.success == true, nullptr);
+	ASSERT_PRINT(result.statements[0]->parameters.size() == 2, result.statements[0]);
+	ASSERT_PRINT(result.statements[1]->parameters.size() == 1, result.statements[1]);
+	ASSERT_PRINT(result.statements[1]->parameters[0]->index == 0, result.statements[1]);
+	ASSERT_PRINT(result.statements[1]->parameters[0]->type == TYPE_NULL, result.statements[1]);
+
+	result = parse_sql("SELECT * FROM t WHERE id = 1");
+	ASSERT_PRINT(result.success == true, nullptr);
+	ASSERT_PRINT(result.statements[0]->parameters.size() == 0, result.statements[0]);
+}
+
  void
 test_string_literal_size_limits()
 {
@@ -355,32 +635,28 @@ test_string_literal_size_limits()
 		ASSERT_PRINT(insert->values[1]->str_val.size() == 32, result.statements[0]);
 	}
 
+	// Over TEXT's 32 bytes still parses, the limit is the column's, see semantic.cpp
 	{
 		const char *sql = "INSERT INTO users VALUES (1, 'This string is way too long and exceeds the 32 byte limit for "
 						  "TEXT columns')";
 		parser_result result = parse_sql(sql);
-		ASSERT_PRINT(result.success == false, nullptr);
-		ASSERT_PRINT(!result.error.empty(), nullptr);
-	}
-
-	{
-		const char	 *sql = "INSERT INTO users VALUES (1, '123456789012345678901234567890123')";
-		parser_result result = parse_sql(sql);
-		ASSERT_PRINT(result.success == false, nullptr);
-		ASSERT_PRINT(!result.error.empty(), nullptr);
+		ASSERT_PRINT(result.success == true, nullptr);
+		insert_stmt *insert = &result.statements[0]->insert_stmt;
+		ASSERT_PRINT(insert->values[1]->str_val.size() > 32, result.statements[0]);
 	}
 
 	{
 		const char *sql =
-			"SELECT * FROM users WHERE name = 'This extremely long string should not be allowed in a TEXT column'";
+			"UPDATE users SET name = 'Another string that is definitely way too long for the TEXT type limit'";
 		parser_result result = parse_sql(sql);
-		ASSERT_PRINT(result.success == false, nullptr);
-		ASSERT_PRINT(!result.error.empty(), nullptr);
+		ASSERT_PRINT(result.success == true, nullptr);
 	}
 
 	{
-		const char *sql =
-			"UPDATE users SET name = 'Another string that is definitely way too long for the TEXT type limit'";
+		char sql[VARCHAR_MAX_SIZE + 64];
+		int	 prefix = snprintf(sql, sizeof(sql), "SELECT * FROM users WHERE name = '");
+		memset(sql + prefix, 'x', VARCHAR_MAX_SIZE + 1);
+		strcpy(sql + prefix + VARCHAR_MAX_SIZE + 1, "'");
 		parser_result result = parse_sql(sql);
 		ASSERT_PRINT(result.success == false, nullptr);
 		ASSERT_PRINT(!result.error.empty(), nullptr);
@@ -635,6 +911,74 @@ test_error_handling()
 	}
 }
 
+#define TEST_SCRIPT "test_parser.sql"
+
+/*
+ * A buffer smaller than most statements, so they span fills and it grows,
+ * with ';' in strings and comments, a '-' as the last byte of a fill, and
+ * empty and comment-only statements, which are skipped
+ */
+static void
+test_stream()
+{
+	const char *script = "-- a dump; with a comment\n"
+						 "CREATE TABLE t (id INT, name TEXT);\n"
+						 "INSERT INTO t VALUES (1, 'semi;colon');\n"
+						 "INSERT INTO t VALUES (2, 'dash--es');-- trailing; comment\n"
+						 ";;\n"
+						 ";\n"
+						 "-- only a comment\n"
+						 ";/* a block; comment */;\n"
+						 "SELECT * /* with ;\n a block comment */ FROM t WHERE id = 1\n"
+						 "  ;SELECT * FROM t WHERE id BETWEEN 1 AND 2 ORDER BY id DESC LIMIT 1;;\n"
+						 "DELETE FROM t /*/ still a comment; */ WHERE id = 2";
+
+	FILE *file = fopen(TEST_SCRIPT, "w");
+	fputs(script, file);
+	fclose(file);
+
+	STMT_TYPE expected[] = {STMT_CREATE_TABLE, STMT_INSERT, STMT_INSERT, STMT_SELECT, STMT_SELECT, STMT_DELETE};
+	for (uint32_t buffer_size : {8u, 63u, SQL_STREAM_BUFFER_SIZE})
+	{
+		sql_stream stream;
+		ASSERT_PRINT(sql_stream_open(&stream, TEST_SCRIPT, buffer_size), nullptr);
+
+		for (STMT_TYPE type : expected)
+		{
+			parser_result result = sql_stream_next(&stream);
+			ASSERT_PRINT(result.success && result.statements.size() == 1, nullptr);
+			ASSERT_PRINT(result.statements[0]->type == type, result.statements[0]);
+			if (type == STMT_INSERT && result.statements[0]->insert_stmt.values[0]->int_val == 1)
+			{
+				ASSERT_PRINT(str_eq(result.statements[0]->insert_stmt.values[1]->str_val, "semi;colon"),
+							 result.statements[0]);
+			}
+			arena<query_arena>::reset();
+		}
+
+		parser_result result = sql_stream_next(&stream);
+		ASSERT_PRINT(result.success && result.statements.size() == 0, nullptr);
+		sql_stream_close(&stream);
+	}
+
+	// An error is on its line in the file, and the stream carries on after it
+	file = fopen(TEST_SCRIPT, "w");
+	fputs("SELECT * FROM t;\n\nSELECT * FROM\nWHERE id = 1;\nSELECT * FROM t;", file);
+	fclose(file);
+
+	sql_stream stream;
+	ASSERT_PRINT(sql_stream_open(&stream, TEST_SCRIPT, 16), nullptr);
+	ASSERT_PRINT(sql_stream_next(&stream).success, nullptr);
+	parser_result result = sql_stream_next(&stream);
+	ASSERT_PRINT(!result.success && result.error_line == 4, nullptr);
+	result = sql_stream_next(&stream);
+	ASSERT_PRINT(result.success && result.statements.size() == 1, nullptr);
+	sql_stream_close(&stream);
+
+	ASSERT_PRINT(!sql_stream_open(&stream, "no_such_script.sql"), nullptr);
+	os_file_delete(TEST_SCRIPT);
+}
+
  void
 test_parser()
 {
@@ -645,10 +989,14 @@ test_parser()
 	test_select_where();
 	test_select_where_complex();
 	test_select_order_by();
+	test_select_limit();
+	test_select_join();
+	test_select_group_by();
 	test_select_full();
 
 	test_insert_values_only();
 	test_insert_with_columns();
+	test_insert_multiple_rows();
 
 	test_update_no_where();
 	test_update_with_where();
@@ -659,10 +1007,15 @@ test_parser()
 
 	test_create_table();
 	test_drop_table();
+	test_create_index();
+	test_drop_index();
+	test_copy_statement();
 
 	test_transactions();
 
 	test_expressions();
+	test_between_and_in();
+	test_parameters();
 
 	test_multiple_statements();
 	test_statements_without_semicolons();
@@ -670,6 +1023,7 @@ test_parser()
 	test_error_handling();
 	test_string_literal_size_limits();
 	test_integer_literal_limits();
+	test_stream();
 
 	printf("parser tests passed\n");
 }
@@ -0,0 +1,295 @@
+#include "prepared.hpp"
+#include "fixture.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "../arena.hpp"
+#include "../catalog.hpp"
+#include "../os_layer.hpp"
+#include "../pager.hpp"
+#include "../prepared.hpp"
+#include "../repl.hpp"
+#include "../types.hpp"
+
+#define TEST_DB "test_prepared.db"
+
+static uint32_t last_id;
+
+static void
+record_ids(typed_value *values, size_t count)
+{
+	record_rows(values, count);
+	last_id = values[0].as_u32();
+}
+
+static uint32_t
+run(prepared_statement *stmt)
+{
+	row_count = 0;
+	VM_RESULT result = sql_step(stmt, record_ids);
+	assert(result == OK);
+	return row_count;
+}
+
+static void
+test_bind_and_step()
+{
+	prepared_statement *insert = sql_prepare("INSERT INTO items VALUES (?, ?, ?)");
+	assert(insert);
+	assert(sql_parameter_count(insert) == 3);
+
+	assert(!sql_bind_text(insert, 0, "one")); // id is an INT
+	assert(!sql_bind_int(insert, 1, 1));	  // name is TEXT
+	assert(!sql_bind_int(insert, 3, 1));
+	assert(!sql_bind_text(insert, 1, "a name well over the thirty two bytes"));
+	assert(sql_step(insert) == ERR); // nothing bound yet
+
+	for (uint32_t i = 1; i <= 50; i++)
+	{
+		assert(sql_bind_int(insert, 0, i));
+		assert(sql_bind_text(insert, 1, "item"));
+		assert(sql_bind_int(insert, 2, i % 5));
+		assert(sql_step(insert) == OK);
+		sql_reset(insert);
+	}
+	assert(sql_step(insert) == ERR); // reset clears the bindings
+
+	prepared_statement *lookup = sql_prepare("SELECT id FROM items WHERE id = ?");
+	assert(sql_bind_int(lookup, 0, 7));
+	assert(run(lookup) == 1 && last_id == 7);
+	assert(sql_bind_int(lookup, 0, 99));
+	assert(run(lookup) == 0);
+
+	// pushed down into the scan, the values are read when it runs
+	prepared_statement *scan = sql_prepare("SELECT id FROM items WHERE qty = ? AND id > ?");
+	assert(sql_bind_int(scan, 0, 2));
+	assert(sql_bind_int(scan, 1, 10));
+	assert(run(scan) == 8);
+	assert(sql_bind_int(scan, 0, 0));
+	assert(sql_bind_int(scan, 1, 40));
+	assert(run(scan) == 2 && last_id == 50);
+
+	prepared_statement *range = sql_prepare("SELECT id FROM items WHERE id BETWEEN ? AND ?");
+	assert(sql_parameter_count(range) == 2);
+	assert(sql_bind_int(range, 0, 5));
+	assert(sql_bind_int(range, 1, 14));
+	assert(run(range) == 10);
+
+	prepared_statement *update = sql_prepare("UPDATE items SET name = ? WHERE id = ?");
+	assert(sql_bind_text(update, 0, "renamed"));
+	assert(sql_bind_int(update, 1, 3));
+	assert(sql_step(update) == OK);
+
+	prepared_statement *by_name = sql_prepare("SELECT id FROM items WHERE name = ?");
+	assert(sql_bind_text(by_name, 0, "renamed"));
+	assert(run(by_name) == 1 && last_id == 3);
+
+	prepared_statement *remove = sql_prepare("DELETE FROM items WHERE qty = ?");
+	assert(sql_bind_int(remove, 0, 4));
+	assert(sql_step(remove) == OK);
+	assert(sql_bind_int(scan, 0, 4));
+	assert(sql_bind_int(scan, 1, 0));
+	assert(run(scan) == 0);
+
+	sql_finalize(insert);
+	sql_finalize(lookup);
+	sql_finalize(scan);
+	sql_finalize(range);
+	sql_finalize(update);
+	sql_finalize(by_name);
+	sql_finalize(remove);
+}
+
+static void
+test_plan_cache()
+{
+	// Spacing and the trailing ';' don't matter, case does
+	compiled_plan *plan = plan_cache_get("SELECT id FROM items WHERE qty = 1");
+	assert(plan);
+	assert(plan_cache_get("SELECT  id FROM items\tWHERE qty = 1 ;") == plan);
+	assert(plan_cache_get("SELECT id FROM items WHERE qty = 1") == plan);
+	assert(plan_cache_get("select id FROM items WHERE qty = 1") != plan);
+	assert(plan_cache_get("SELECT id FROM items WHERE qty = 2") != plan);
+
+	assert(!plan_cache_get("SELECT id FROM missing"));
+	assert(!plan_cache_get("SELECT id FROM items WHERE ? = ?"));
+	assert(!plan_cache_get("CREATE TABLE other (id INT)"));
+	assert(!plan_cache_get("SELECT id FROM items; SELECT id FROM items"));
+	assert(!sql_prepare("SELECT id FROM items WHERE qty = ? OR ? = 1 AND ? = ?"));
+
+	// A new index drops the cache, old statements recompile and use it
+	prepared_statement *scan = sql_prepare("SELECT id FROM items WHERE qty = ?");
+	assert(sql_bind_int(scan, 0, 1));
+	uint32_t before = run(scan);
+	assert(before > 0);
+
+	assert(execute_sql_statements("CREATE INDEX items_qty ON items (qty);"));
+	assert(run(scan) == before);
+
+	assert(execute_sql_statements("DROP TABLE items;"));
+	assert(sql_step(scan) == ERR);
+	sql_finalize(scan);
+}
+
+/*
+ * Every row of a VALUES list goes in through the one program, or none do
+ */
+static void
+test_multi_row_insert()
+{
+	assert(execute_sql_statements("CREATE TABLE items (id INT, name TEXT, qty INT);"));
+	assert(execute_sql_statements("CREATE INDEX items_name ON items (name);"));
+	assert(execute_sql_statements(
+		"INSERT INTO items VALUES (1001, 'batch', 1), (1003, 'batch', 2), (1002, 'batch', 3);"));
+
+	prepared_statement *batch = sql_prepare("SELECT id FROM items WHERE name = ?");
+	assert(sql_bind_text(batch, 0, "batch"));
+	assert(run(batch) == 3 && last_id == 1003);
+
+	prepared_statement *insert = sql_prepare("INSERT INTO items (id, name, qty) VALUES (?, 'pair', 1), (?, 'pair', 2)");
+	assert(sql_parameter_count(insert) == 2);
+	assert(sql_bind_int(insert, 0, 1004));
+	assert(sql_bind_int(insert, 1, 1005));
+	assert(sql_step(insert) == OK);
+	sql_reset(insert);
+
+	// 1001 is already there, so 1006 isn't added either
+	assert(sql_bind_int(insert, 0, 1006));
+	assert(sql_bind_int(insert, 1, 1001));
+	assert(sql_step(insert) == ERR);
+	sql_reset(insert);
+
+	prepared_statement *pairs = sql_prepare("SELECT id FROM items WHERE id > ?");
+	assert(sql_bind_int(pairs, 0, 1000));
+	assert(run(pairs) == 5 && last_id == 1005);
+
+	assert(!execute_sql_statements("INSERT INTO items VALUES (1010, 'short', 1), (1011, 'short');"));
+	assert(!execute_sql_statements("INSERT INTO items (id, name) VALUES (1012, 'a', 1), (1013, 'b', 2);"));
+	assert(!execute_sql_statements("INSERT INTO items VALUES (1014, 'a', 1), (1014, 'b', 2);"));
+	assert(run(pairs) == 5);
+
+	assert(execute_sql_statements("DROP TABLE items;"));
+	sql_finalize(batch);
+	sql_finalize(insert);
+	sql_finalize(pairs);
+}
+
+static char	  note_body[4096];
+static uint32_t note_count;
+
+static void
+record_note(typed_value *values, size_t count)
+{
+	note_count++;
+	last_id = values[0].as_u32();
+	if (count > 2)
+	{
+		strncpy(note_body, values[2].as_char(), sizeof(note_body) - 1);
+	}
+}
+
+static void
+fill_body(char *body, uint32_t length, uint32_t seed)
+{
+	for (uint32_t i = 0; i < length; i++)
+	{
+		body[i] = 'a' + (seed + i) % 26;
+	}
+	body[length] = '\0';
+}
+
+/*
+ * VARCHAR columns are stored packed, the longest values in blobs
+ */
+static void
+test_varchar_columns()
+{
+	assert(!execute_sql_statements("CREATE TABLE bad (id INT, name VARCHAR(0));"));
+	assert(!execute_sql_statements("CREATE TABLE bad (id INT, name VARCHAR(5000));"));
+	assert(!execute_sql_statements("CREATE TABLE bad (id VARCHAR(300), qty INT);"));
+
+	assert(execute_sql_statements("CREATE TABLE notes (id INT, title VARCHAR(20), body VARCHAR(3000), qty INT);"));
+	assert(!execute_sql_statements("CREATE INDEX notes_body ON notes (body);"));
+	assert(!execute_sql_statements("INSERT INTO notes VALUES (1, 'a title well over twenty', 'body', 1);"));
+
+	prepared_statement *insert = sql_prepare("INSERT INTO notes VALUES (?, ?, ?, ?)");
+	assert(!sql_bind_text(insert, 1, "a title well over twenty"));
+
+	char body[3001];
+	for (uint32_t i = 1; i <= 200; i++)
+	{
+		fill_body(body, i * 14, i);
+		assert(sql_bind_int(insert, 0, i));
+		assert(sql_bind_text(insert, 1, i % 2 ? "odd" : "even"));
+		assert(sql_bind_text(insert, 2, body));
+		assert(sql_bind_int(insert, 3, i % 5));
+		assert(sql_step(insert) == OK);
+		sql_reset(insert);
+	}
+	bt_validate(&catalog.get("notes")->storage.btree);
+
+	prepared_statement *lookup = sql_prepare("SELECT * FROM notes WHERE id = ?");
+	for (uint32_t i : {1u, 50u, 150u, 200u})
+	{
+		assert(sql_bind_int(lookup, 0, i));
+		note_count = 0;
+		assert(sql_step(lookup, record_note) == OK);
+		fill_body(body, i * 14, i);
+		assert(note_count == 1 && strcmp(note_body, body) == 0);
+	}
+
+	// Filtered on the packed records, and through an index built from them
+	note_count = 0;
+	assert(execute_sql_statements("SELECT * FROM notes WHERE title = 'odd' AND qty = 3;", record_note));
+	assert(note_count == 20);
+	assert(execute_sql_statements("CREATE INDEX notes_title ON notes (title);"));
+	note_count = 0;
+	assert(execute_sql_statements("SELECT * FROM notes WHERE title = 'even';", record_note));
+	assert(note_count == 100);
+
+	// Growing and shrinking in place, or moved
+	assert(execute_sql_statements("UPDATE notes SET body = 'short' WHERE qty = 1;"));
+	prepared_statement *update = sql_prepare("UPDATE notes SET body = ? WHERE id = ?");
+	fill_body(body, 2900, 7);
+	assert(sql_bind_text(update, 0, body));
+	assert(sql_bind_int(update, 1, 3));
+	assert(sql_step(update) == OK);
+
+	assert(sql_bind_int(lookup, 0, 3));
+	assert(sql_step(lookup, record_note) == OK);
+	assert(strcmp(note_body, body) == 0);
+	assert(sql_bind_int(lookup, 0, 6));
+	assert(sql_step(lookup, record_note) == OK);
+	assert(strcmp(note_body, "short") == 0);
+
+	assert(execute_sql_statements("DELETE FROM notes WHERE title = 'odd';"));
+	note_count = 0;
+	assert(execute_sql_statements("SELECT * FROM notes;", record_note));
+	assert(note_count == 100 && last_id == 200);
+	bt_validate(&catalog.get("notes")->storage.btree);
+
+	assert(execute_sql_statements("DROP TABLE notes;"));
+	sql_finalize(insert);
+	sql_finalize(lookup);
+	sql_finalize(update);
+}
+
+void
+test_prepared()
+{
+	test_db_open(TEST_DB);
+
+	assert(execute_sql_statements("CREATE TABLE items (id INT, name TEXT, qty INT);"));
+
+	test_bind_and_step();
+	test_plan_cache();
+	test_multi_row_insert();
+	test_varchar_columns();
+
+	pager_close();
+	os_file_delete(TEST_DB);
+	printf("prepared tests passed\n");
+}
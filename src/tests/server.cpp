@@ -0,0 +1,463 @@
+#include "server.hpp"
+#include "fixture.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+#include "../arena.hpp"
+#include "../catalog.hpp"
+#include "../os_layer.hpp"
+#include "../pager.hpp"
+#include "../repl.hpp"
+#include "../server.hpp"
+#include "../types.hpp"
+
+#define TEST_DB		"test_server.db"
+#define TEST_SOCKET "./test_server.sock"
+
+/*
+ * A client's side of the protocol, blocking
+ */
+struct test_client
+{
+	int		 fd;
+	uint8_t	 request[4096];
+	uint32_t request_size;
+
+	/* The last reply read */
+	uint8_t	 kind;
+	uint8_t	 payload[1 << 16];
+	uint32_t payload_size;
+
+	/* The columns of the rows read, and the first column of the last row */
+	uint16_t  column_count;
+	data_type columns[16];
+	uint32_t  first_value;
+	char	  first_text[64];
+};
+
+static test_client *
+client_connect()
+{
+	test_client *client = new test_client();
+	client->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, TEST_SOCKET);
+	assert(connect(client->fd, (sockaddr *)&addr, sizeof(addr)) == 0);
+	return client;
+}
+
+static void
+client_close(test_client *client)
+{
+	close(client->fd);
+	delete client;
+}
+
+/* Frames are queued, then sent together, so they arrive as one pipeline */
+static void
+queue_frame(test_client *client, SERVER_FRAME kind, const void *payload, uint32_t size)
+{
+	uint32_t length = size + 1;
+	memcpy(client->request + client->request_size, &length, sizeof(length));
+	client->request[client->request_size + 4] = kind;
+	memcpy(client->request + client->request_size + SERVER_FRAME_HEADER_SIZE, payload, size);
+	client->request_size += SERVER_FRAME_HEADER_SIZE + size;
+}
+
+static void
+queue_sql(test_client *client, SERVER_FRAME kind, const char *sql)
+{
+	queue_frame(client, kind, sql, strlen(sql));
+}
+
+static void
+queue_execute(test_client *client, uint32_t statement, uint32_t value)
+{
+	uint8_t	 payload[16];
+	uint16_t count = 1;
+	memcpy(payload, &statement, 4);
+	memcpy(payload + 4, &count, 2);
+	payload[6] = SERVER_PARAM_INT;
+	memcpy(payload + 7, &value, 4);
+	queue_frame(client, SERVER_EXECUTE, payload, 11);
+}
+
+static void
+send_queued(test_client *client)
+{
+	assert(send(client->fd, client->request, client->request_size, 0) == client->request_size);
+	client->request_size = 0;
+}
+
+static void
+read_exactly(int fd, void *into, uint32_t size)
+{
+	uint32_t got = 0;
+	while (got < size)
+	{
+		ssize_t received = recv(fd, (uint8_t *)into + got, size - got, 0);
+		assert(received > 0);
+		got += received;
+	}
+}
+
+static void
+decode_row(test_client *client)
+{
+	uint8_t *value = client->payload + (client->column_count + 7) / 8;
+	for (uint32_t i = 0; i < client->column_count; i++)
+	{
+		if (!(client->payload[i / 8] & (1 << (i % 8))))
+		{
+			continue;
+		}
+
+		uint32_t size = type_size(client->columns[i]);
+		if (type_is_string(client->columns[i]))
+		{
+			uint16_t length;
+			memcpy(&length, value, 2);
+			value += 2;
+			if (i == 0)
+			{
+				memcpy(client->first_text, value, length);
+				client->first_text[length] = '\0';
+			}
+			size = length;
+		}
+		else if (i == 0)
+		{
+			client->first_value = 0;
+			memcpy(&client->first_value, value, std::min<uint32_t>(size, 4));
+		}
+		value += size;
+	}
+	assert(value == client->payload + client->payload_size);
+}
+
+static uint8_t
+read_frame(test_client *client)
+{
+	uint32_t length;
+	read_exactly(client->fd, &length, 4);
+	read_exactly(client->fd, &client->kind, 1);
+	client->payload_size = length - 1;
+	read_exactly(client->fd, client->payload, client->payload_size);
+
+	if (client->kind == SERVER_COLUMNS)
+	{
+		memcpy(&client->column_count, client->payload, 2);
+		memcpy(client->columns, client->payload + 2, client->column_count * sizeof(data_type));
+	}
+	else if (client->kind == SERVER_ROW)
+	{
+		decode_row(client);
+	}
+	return client->kind;
+}
+
+/* Reads a request's replies up to its DONE, the rows it had in all */
+static uint32_t
+read_done(test_client *client)
+{
+	uint32_t rows = 0;
+	while (read_frame(client) != SERVER_DONE)
+	{
+		assert(client->kind == SERVER_COLUMNS || client->kind == SERVER_ROW);
+		rows += client->kind == SERVER_ROW;
+	}
+
+	uint32_t done;
+	memcpy(&done, client->payload, 4);
+	assert(done >= rows);
+	return done;
+}
+
+static void
+read_error(test_client *client)
+{
+	assert(read_frame(client) == SERVER_ERROR);
+}
+
+static uint32_t
+query_count(test_client *client, const char *sql)
+{
+	queue_sql(client, SERVER_QUERY, sql);
+	send_queued(client);
+	assert(read_frame(client) == SERVER_COLUMNS);
+	assert(client->column_count == 1);
+	assert(read_frame(client) == SERVER_ROW);
+	assert(read_done(client) == 1);
+	return client->first_value;
+}
+
+static bool
+can_read(test_client *client, int timeout_ms)
+{
+	pollfd readable = {client->fd, POLLIN, 0};
+	return poll(&readable, 1, timeout_ms) == 1;
+}
+
+/*
+ * The clients, each on a thread of its own while the test's thread serves
+ */
+
+static void
+test_pipeline()
+{
+	test_client *client = client_connect();
+
+	queue_sql(client, SERVER_QUERY, "INSERT INTO members VALUES (1, 'ann', 30);");
+	queue_sql(client, SERVER_PREPARE, "INSERT INTO members VALUES (?, 'bob', 40)");
+	queue_execute(client, 1, 2);
+	queue_execute(client, 1, 3);
+	queue_sql(client, SERVER_PREPARE, "SELECT name, id FROM members WHERE id > ?");
+	queue_execute(client, 2, 1);
+	queue_sql(client, SERVER_PREPARE, "SELECT * FROM nowhere");
+	queue_execute(client, 3, 1);
+	queue_execute(client, 9, 1);
+	uint32_t statement = 1;
+	queue_frame(client, SERVER_FINALIZE, &statement, 4);
+	queue_execute(client, 1, 4);
+	queue_frame(client, (SERVER_FRAME)'?', nullptr, 0);
+	queue_sql(client, SERVER_QUERY, "SELECT COUNT(*) FROM members; SELECT * FROM members WHERE id = 3;");
+	send_queued(client);
+
+	assert(read_done(client) == 0);
+
+	assert(read_frame(client) == SERVER_PREPARED);
+	uint32_t id;
+	uint16_t parameters;
+	memcpy(&id, client->payload, 4);
+	memcpy(&parameters, client->payload + 4, 2);
+	assert(id == 1 && parameters == 1);
+	assert(read_done(client) == 0);
+	assert(read_done(client) == 0);
+
+	assert(read_frame(client) == SERVER_PREPARED);
+	assert(read_done(client) == 2);
+	assert(client->column_count == 2);
+	assert(type_is_string(client->columns[0]));
+	assert(strcmp(client->first_text, "bob") == 0);
+
+	read_error(client); // No such table, still numbered 3
+	read_error(client);
+	read_error(client); // Never prepared
+	assert(read_done(client) == 0);
+	read_error(client); // Finalized
+	read_error(client);
+
+	// Both SELECTs' rows, each under its own column types
+	assert(read_frame(client) == SERVER_COLUMNS);
+	assert(read_frame(client) == SERVER_ROW);
+	assert(client->first_value == 3);
+	assert(read_frame(client) == SERVER_COLUMNS);
+	assert(client->column_count == 3);
+	assert(read_frame(client) == SERVER_ROW);
+	assert(client->first_value == 3);
+	assert(read_done(client) == 2);
+
+	client_close(client);
+}
+
+static void
+test_streaming()
+{
+	test_client *client = client_connect();
+
+	queue_sql(client, SERVER_QUERY, "BEGIN;");
+	queue_sql(client, SERVER_PREPARE, "INSERT INTO members VALUES (?, 'a name long enough', ?)");
+	send_queued(client);
+	assert(read_done(client) == 0);
+	assert(read_frame(client) == SERVER_PREPARED);
+
+	for (uint32_t i = 100; i < 5100; i++)
+	{
+		uint8_t	 payload[16];
+		uint32_t statement = 1;
+		uint16_t count = 2;
+		memcpy(payload, &statement, 4);
+		memcpy(payload + 4, &count, 2);
+		payload[6] = SERVER_PARAM_INT;
+		memcpy(payload + 7, &i, 4);
+		payload[11] = SERVER_PARAM_INT;
+		memcpy(payload + 12, &i, 4);
+		queue_frame(client, SERVER_EXECUTE, payload, 16);
+		if (client->request_size > sizeof(client->request) - 64)
+		{
+			send_queued(client);
+		}
+	}
+	queue_sql(client, SERVER_QUERY, "COMMIT;");
+	send_queued(client);
+	for (uint32_t i = 100; i < 5100; i++)
+	{
+		assert(read_done(client) == 0);
+	}
+	assert(read_done(client) == 0);
+
+	// Well past SERVER_FLUSH_SIZE, so it's written out as it's run
+	queue_sql(client, SERVER_QUERY, "SELECT * FROM members;");
+	send_queued(client);
+	assert(read_done(client) == 5003);
+
+	client_close(client);
+}
+
+static void
+test_transactions()
+{
+	test_client *writer = client_connect();
+	test_client *reader = client_connect();
+
+	uint32_t count = query_count(reader, "SELECT COUNT(*) FROM members;");
+
+	queue_sql(writer, SERVER_QUERY, "BEGIN; INSERT INTO members VALUES (9000, 'eve', 1);");
+	send_queued(writer);
+	assert(read_done(writer) == 0);
+
+	// The reader waits for the writer's transaction
+	queue_sql(reader, SERVER_QUERY, "SELECT COUNT(*) FROM members;");
+	send_queued(reader);
+	assert(!can_read(reader, 200));
+
+	queue_sql(writer, SERVER_QUERY, "COMMIT;");
+	send_queued(writer);
+	assert(read_done(writer) == 0);
+
+	assert(read_frame(reader) == SERVER_COLUMNS);
+	assert(read_frame(reader) == SERVER_ROW);
+	assert(reader->first_value == count + 1);
+	assert(read_done(reader) == 1);
+
+	// A transaction spans requests, the INSERT isn't committed on its own
+	queue_sql(writer, SERVER_QUERY, "BEGIN;");
+	queue_sql(writer, SERVER_QUERY, "INSERT INTO members VALUES (9002, 'kim', 1);");
+	queue_sql(writer, SERVER_QUERY, "ROLLBACK;");
+	send_queued(writer);
+	assert(read_done(writer) == 0);
+	assert(read_done(writer) == 0);
+	assert(read_done(writer) == 0);
+	assert(query_count(reader, "SELECT COUNT(*) FROM members;") == count + 1);
+
+	// Hung up on in the middle, it's rolled back
+	queue_sql(writer, SERVER_QUERY, "BEGIN; INSERT INTO members VALUES (9001, 'mal', 1);");
+	send_queued(writer);
+	assert(read_done(writer) == 0);
+	client_close(writer);
+	assert(query_count(reader, "SELECT COUNT(*) FROM members;") == count + 1);
+
+	// A frame longer than the limit closes the connection
+	uint32_t length = SERVER_MAX_FRAME_SIZE + 1;
+	assert(send(reader->fd, &length, 4, 0) == 4);
+	uint8_t byte;
+	assert(recv(reader->fd, &byte, 1, 0) == 0);
+	client_close(reader);
+}
+
+/*
+ * A client that stops reading a big result is cut off, and the others'
+ * requests run meanwhile
+ */
+static void
+test_stalled_reader()
+{
+	test_client *stalled = client_connect();
+	test_client *other = client_connect();
+
+	// One request with far more rows than the socket buffers hold
+	char sql[1024] = {};
+	for (uint32_t i = 0; i < 20; i++)
+	{
+		strcat(sql, "SELECT * FROM members;");
+	}
+	queue_sql(stalled, SERVER_QUERY, sql);
+	send_queued(stalled);
+
+	assert(query_count(other, "SELECT COUNT(*) FROM members;") == 5004);
+
+	uint8_t buffer[4096];
+	while (recv(stalled->fd, buffer, sizeof(buffer), 0) > 0)
+	{
+	}
+	client_close(stalled);
+	client_close(other);
+}
+
+/*
+ * Holding a transaction without sending anything to run, it's cut off and
+ * rolled back, and the others' requests run. And a client can't COPY from the
+ * server's files.
+ */
+static void
+test_idle_transaction()
+{
+	test_client *idle = client_connect();
+	test_client *other = client_connect();
+
+	uint32_t count = query_count(other, "SELECT COUNT(*) FROM members;");
+	queue_sql(idle, SERVER_QUERY, "BEGIN; INSERT INTO members VALUES (9100, 'ida', 1);");
+	send_queued(idle);
+	assert(read_done(idle) == 0);
+
+	assert(query_count(other, "SELECT COUNT(*) FROM members;") == count);
+	uint8_t byte;
+	assert(recv(idle->fd, &byte, 1, 0) == 0);
+	client_close(idle);
+
+	queue_sql(other, SERVER_QUERY, "COPY members FROM '" TEST_DB "';");
+	send_queued(other);
+	read_error(other);
+	client_close(other);
+}
+
+static std::atomic<bool> clients_done;
+
+static void
+run_clients()
+{
+	test_pipeline();
+	test_streaming();
+	test_transactions();
+	test_stalled_reader();
+	test_idle_transaction();
+	clients_done = true;
+}
+
+void
+test_server()
+{
+	test_db_open(TEST_DB);
+	assert(execute_sql_statements("CREATE TABLE members (id INT, name TEXT, age INT);"));
+
+	// Long enough for the other tests' transactions, which wait on nothing
+	server_set_idle_timeout(1000);
+	assert(server_listen(TEST_SOCKET));
+	clients_done = false;
+	std::thread clients(run_clients);
+	while (!clients_done)
+	{
+		server_poll(50);
+	}
+	clients.join();
+
+	// One more round to see the last hang up
+	server_poll(0);
+	server_close();
+	server_set_idle_timeout(SERVER_IDLE_TRANSACTION_MS);
+	assert(!os_file_exists(TEST_SOCKET));
+
+	pager_close();
+	os_file_delete(TEST_DB);
+	printf("server tests passed\n");
+}
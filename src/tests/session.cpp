@@ -0,0 +1,273 @@
+#include "session.hpp"
+#include "fixture.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+#include "../arena.hpp"
+#include "../catalog.hpp"
+#include "../os_layer.hpp"
+#include "../pager.hpp"
+#include "../prepared.hpp"
+#include "../repl.hpp"
+#include "../session.hpp"
+#include "../types.hpp"
+
+#define TEST_DB "test_session.db"
+
+/* What a reader's SELECT COUNT(*), SUM(v) FROM pairs saw */
+static thread_local uint32_t seen_count;
+static thread_local uint32_t seen_sum;
+
+static void
+count_and_sum(typed_value *values, size_t count)
+{
+	seen_count = values[0].as_u32();
+	seen_sum = values[1].as_u32();
+}
+
+/*
+ * Every transaction inserts a pair, v = 1 and v = 3, so a committed state has
+ * a sum of twice its count, and a half done one doesn't
+ */
+static uint32_t next_id = 1;
+
+static void
+insert_pairs(prepared_statement *insert, uint32_t pairs, bool commit)
+{
+	assert(execute_sql_statements("BEGIN;"));
+	for (uint32_t i = 0; i < pairs; i++)
+	{
+		for (uint32_t v : {1, 3})
+		{
+			assert(sql_bind_int(insert, 0, next_id++));
+			assert(sql_bind_int(insert, 1, v));
+			assert(sql_step(insert) == OK);
+			sql_reset(insert);
+		}
+	}
+	assert(execute_sql_statements(commit ? "COMMIT;" : "ROLLBACK;"));
+	if (!commit)
+	{
+		next_id -= pairs * 2;
+	}
+}
+
+static void
+read_pairs(prepared_statement *select)
+{
+	assert(sql_step(select, count_and_sum) == OK);
+	assert(seen_sum == seen_count * 2);
+}
+
+/*
+ * The writer and one reader taking turns, so what the reader can see at each
+ * step is known
+ */
+static std::atomic<uint32_t> turn;
+
+static void
+wait_for(uint32_t step)
+{
+	while (turn.load() != step)
+	{
+		std::this_thread::yield();
+	}
+}
+
+static void
+stepped_reader()
+{
+	assert(session_begin());
+	assert(session_is_reader());
+
+	prepared_statement *select = sql_prepare("SELECT COUNT(*), SUM(v) FROM pairs");
+	assert(select);
+
+	// A read session can't write
+	prepared_statement *insert = sql_prepare("INSERT INTO pairs VALUES (?, ?)");
+	assert(insert);
+	assert(sql_bind_int(insert, 0, 1000000));
+	assert(sql_bind_int(insert, 1, 1));
+	assert(sql_step(insert) == ERR);
+	sql_finalize(insert);
+
+	read_pairs(select);
+	assert(seen_count == 200);
+	turn = 1;
+
+	// The writer is part way through a transaction, past the cache
+	wait_for(2);
+	read_pairs(select);
+	assert(seen_count == 200);
+
+	// One snapshot over both, with a commit in between
+	assert(session_begin_read());
+	read_pairs(select);
+	assert(seen_count == 200);
+	turn = 3;
+	wait_for(4);
+	read_pairs(select);
+	assert(seen_count == 200);
+	turn = 5;
+
+	// The writer's checkpoint waits for the read
+	wait_for(6);
+	session_end_read();
+	read_pairs(select);
+	assert(seen_count == 2200);
+	turn = 7;
+
+	// After the checkpoint, the cache from before it is stale
+	wait_for(8);
+	read_pairs(select);
+	assert(seen_count == 2202);
+
+	sql_finalize(select);
+	session_end();
+	assert(!session_is_reader());
+	turn = 9;
+}
+
+static void
+test_snapshot_isolation(prepared_statement *insert)
+{
+	std::thread reader(stepped_reader);
+
+	wait_for(1);
+	assert(execute_sql_statements("BEGIN;"));
+	for (uint32_t i = 0; i < 2000; i++)
+	{
+		if (i == 1000)
+		{
+			turn = 2;
+			wait_for(3);
+		}
+		assert(sql_bind_int(insert, 0, next_id++));
+		assert(sql_bind_int(insert, 1, i % 2 ? 3 : 1));
+		assert(sql_step(insert) == OK);
+		sql_reset(insert);
+	}
+	assert(execute_sql_statements("COMMIT;"));
+	turn = 4;
+
+	wait_for(5);
+	assert(!pager_checkpoint());
+	assert(pager_get_stats().snapshots == 1);
+	turn = 6;
+
+	wait_for(7);
+	assert(pager_checkpoint());
+	assert(pager_get_stats().wal_frames == 0);
+	insert_pairs(insert, 1, true);
+	turn = 8;
+
+	wait_for(9);
+	reader.join();
+}
+
+static std::atomic<bool> writer_done;
+static std::atomic<uint32_t> readers_started;
+
+static void
+concurrent_reader()
+{
+	assert(session_begin());
+	prepared_statement *select = sql_prepare("SELECT COUNT(*), SUM(v) FROM pairs");
+	prepared_statement *range = sql_prepare("SELECT COUNT(*), SUM(v) FROM pairs WHERE id > ?");
+
+	uint32_t last_count = 0;
+	readers_started++;
+	while (!writer_done.load())
+	{
+		read_pairs(select);
+		assert(seen_count >= last_count);
+		last_count = seen_count;
+
+		// A pair's ids are consecutive, odd then even
+		assert(sql_bind_int(range, 0, 2 * (last_count / 4)));
+		assert(sql_step(range, count_and_sum) == OK);
+		assert(seen_sum == seen_count * 2);
+		std::this_thread::yield();
+	}
+
+	read_pairs(select);
+	assert(seen_count == next_id - 1);
+
+	sql_finalize(select);
+	sql_finalize(range);
+	session_end();
+}
+
+static void
+test_concurrent_readers(prepared_statement *insert)
+{
+	writer_done = false;
+	readers_started = 0;
+	std::thread readers[3];
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		readers[i] = std::thread(concurrent_reader);
+	}
+	while (readers_started.load() < 3)
+	{
+		std::this_thread::yield();
+	}
+
+	// Commits, rollbacks and checkpoints as they read
+	for (uint32_t round = 0; round < 20; round++)
+	{
+		insert_pairs(insert, 1 + round % 5 * 10, round % 5 != 3);
+		if (round % 5 == 4)
+		{
+			pager_checkpoint();
+		}
+	}
+
+	writer_done = true;
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		readers[i].join();
+	}
+}
+
+static void
+test_rollback_mode()
+{
+	test_db_open(TEST_DB);
+
+	bool began = false;
+	std::thread reader([&began] { began = session_begin(); });
+	reader.join();
+	assert(!began);
+
+	assert(!pager_begin_snapshot());
+	pager_close();
+	os_file_delete(TEST_DB);
+}
+
+void
+test_session()
+{
+	// A small cache, so the writer's transactions spill frames to the log
+	test_db_open(TEST_DB, 16, PAGER_JOURNAL_WAL);
+	assert(execute_sql_statements("CREATE TABLE pairs (id INT, v INT);"));
+
+	prepared_statement *insert = sql_prepare("INSERT INTO pairs VALUES (?, ?)");
+	insert_pairs(insert, 100, true);
+	insert_pairs(insert, 100, false);
+
+	turn = 0;
+	test_snapshot_isolation(insert);
+	test_concurrent_readers(insert);
+
+	sql_finalize(insert);
+	pager_close();
+	os_file_delete(TEST_DB);
+
+	test_rollback_mode();
+	printf("session tests passed\n");
+}
@@ -0,0 +1,154 @@
+#include "sorter.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "../arena.hpp"
+#include "../os_layer.hpp"
+#include "../pager.hpp"
+#include "../sorter.hpp"
+#include "../types.hpp"
+
+#define TEST_DB "test_sorter.db"
+
+struct sort_row
+{
+	uint32_t key;
+	uint32_t sequence; // insertion order, to check ties
+};
+
+/*
+ * Sorts count rows with keys cycling through a small range, so there are
+ * plenty of ties, and checks they come back ordered, ties in insertion order
+ */
+static void
+check_sort(uint32_t count, bool descending, size_t budget)
+{
+	sorter_set_memory_budget(budget);
+	sorter sort = sorter_create(TYPE_U32, sizeof(uint32_t), descending);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t key = (i * 7919) % 97;
+		assert(sorter_insert(&sort, &key, &i));
+	}
+
+	uint32_t seen = 0;
+	sort_row previous = {};
+	for (bool valid = sorter_first(&sort); valid; valid = sorter_next(&sort))
+	{
+		sort_row row = {*(uint32_t *)sorter_key(&sort), *(uint32_t *)sorter_record(&sort)};
+		assert(row.key == (row.sequence * 7919) % 97);
+
+		if (seen > 0)
+		{
+			bool ordered = descending ? row.key <= previous.key : row.key >= previous.key;
+			assert(ordered);
+			if (row.key == previous.key)
+			{
+				assert(row.sequence > previous.sequence);
+			}
+		}
+		previous = row;
+		seen++;
+	}
+	assert(seen == count);
+	assert(!sorter_is_valid(&sort));
+
+	// It can be read again
+	assert(sorter_first(&sort) == (count > 0));
+	sorter_close(&sort);
+}
+
+/*
+ * Keeping only the first rows gives what a full sort would start with
+ */
+static void
+check_keep(uint32_t count, uint32_t keep, bool descending)
+{
+	sorter_set_memory_budget(SORTER_DEFAULT_MEMORY);
+	sorter full = sorter_create(TYPE_U32, sizeof(uint32_t), descending);
+	sorter kept = sorter_create(TYPE_U32, sizeof(uint32_t), descending, keep);
+	assert(kept.keep == keep);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t key = (i * 7919) % 97;
+		assert(sorter_insert(&full, &key, &i));
+		assert(sorter_insert(&kept, &key, &i));
+	}
+
+	uint32_t seen = 0;
+	bool	 full_valid = sorter_first(&full);
+	for (bool valid = sorter_first(&kept); valid; valid = sorter_next(&kept))
+	{
+		assert(full_valid);
+		assert(*(uint32_t *)sorter_key(&kept) == *(uint32_t *)sorter_key(&full));
+		assert(*(uint32_t *)sorter_record(&kept) == *(uint32_t *)sorter_record(&full));
+		full_valid = sorter_next(&full);
+		seen++;
+	}
+	assert(seen == (count < keep ? count : keep));
+
+	sorter_close(&full);
+	sorter_close(&kept);
+
+	// More than the budget holds is sorted in full
+	sorter_set_memory_budget(256);
+	sorter too_many = sorter_create(TYPE_U32, sizeof(uint32_t), descending, 1000);
+	assert(too_many.keep == 0);
+	sorter_set_memory_budget(SORTER_DEFAULT_MEMORY);
+}
+
+static void
+check_rows_text()
+{
+	sorter_set_memory_budget(256);
+	sorter sort = sorter_create(TYPE_CHAR32, sizeof(uint32_t), false);
+
+	const char *names[] = {"pear", "apple", "fig", "banana", "cherry", "apple", "date", "elder"};
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		char key[32] = {};
+		strcpy(key, names[i]);
+		assert(sorter_insert(&sort, key, &i));
+	}
+
+	const char *expected[] = {"apple", "apple", "banana", "cherry", "date", "elder", "fig", "pear"};
+	uint32_t	i = 0;
+	for (bool valid = sorter_first(&sort); valid; valid = sorter_next(&sort), i++)
+	{
+		assert(strcmp((char *)sorter_key(&sort), expected[i]) == 0);
+	}
+	assert(i == 8);
+	sorter_close(&sort);
+}
+
+void
+test_sorter()
+{
+	arena<query_arena>::init();
+	os_file_delete(TEST_DB);
+	pager_open(TEST_DB);
+
+	check_sort(0, false, SORTER_DEFAULT_MEMORY);
+	check_sort(1000, false, SORTER_DEFAULT_MEMORY); // in memory
+	check_sort(1000, true, SORTER_DEFAULT_MEMORY);
+	check_sort(5000, false, 4096); // spilled runs, merged at once
+	check_sort(5000, true, 4096);
+	check_sort(20000, false, 256); // enough runs to need merge passes
+	check_sort(20000, true, 256);
+	check_keep(5000, 20, false);
+	check_keep(5000, 20, true);
+	check_keep(10, 20, false);
+	check_keep(300, 1, true);
+	check_rows_text();
+
+	sorter_set_memory_budget(SORTER_DEFAULT_MEMORY);
+	arena<query_arena>::reset();
+	pager_close();
+	os_file_delete(TEST_DB);
+	printf("sorter tests passed\n");
+}
@@ -0,0 +1,202 @@
+#include "stats.hpp"
+#include "fixture.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "../arena.hpp"
+#include "../btree.hpp"
+#include "../catalog.hpp"
+#include "../compile.hpp"
+#include "../os_layer.hpp"
+#include "../pager.hpp"
+#include "../parser.hpp"
+#include "../repl.hpp"
+#include "../semantic.hpp"
+#include "../stats.hpp"
+#include "../vm.hpp"
+
+#define TEST_DB	 "test_stats.db"
+#define TEST_CSV "test_stats.csv"
+
+#define PEOPLE 50000
+
+/*
+ * Whether the statement's program opens a cursor on tree
+ */
+static bool
+reads_tree(const char *sql, btree *tree)
+{
+	parser_result parsed = parse_sql(sql);
+	assert(parsed.success && semantic_analyze(parsed.statements[0], false).success);
+	auto program = compile_program(parsed.statements[0]);
+
+	for (vm_instruction &inst : program)
+	{
+		if (inst.opcode == OP_Open && ((cursor_context *)inst.p4)->storage.tree == tree)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * people: id, city one of 4 and age 0 to 999, with an index on each of the
+ * last two
+ */
+static void
+load_people()
+{
+	size_t line_size = 64;
+	char  *contents = (char *)arena<query_arena>::alloc(PEOPLE * line_size + 64);
+	size_t size = snprintf(contents, 64, "id,city,age\n");
+	const char *cities[] = {"auckland", "berlin", "cairo", "denver"};
+	for (uint32_t id = 1; id <= PEOPLE; id++)
+	{
+		size += snprintf(contents + size, line_size, "%u,%s,%u\n", id, cities[id % 4], id % 1000);
+	}
+
+	os_file_delete(TEST_CSV);
+	os_file_handle_t file = os_file_open(TEST_CSV, true, true);
+	assert(os_file_write(file, contents, size) == size);
+	os_file_close(file);
+
+	assert(execute_sql_statements("CREATE TABLE people (id INT, city TEXT, age INT);"));
+	assert(execute_sql_statements("COPY people FROM '" TEST_CSV "';"));
+	assert(execute_sql_statements("CREATE INDEX people_city ON people (city);"));
+	assert(execute_sql_statements("CREATE INDEX people_age ON people (age);"));
+}
+
+static void
+test_collect_and_reload()
+{
+	assert(!catalog.get(STATS_TABLE));
+	assert(!catalog.get("people")->stats);
+	// Without stats, an index is used whenever it can be
+	assert(reads_tree("SELECT * FROM people WHERE city = 'berlin';", &catalog.get("people")->indexes[0].btree));
+	assert(!execute_sql_statements("ANALYZE nowhere;"));
+
+	assert(execute_sql_statements("ANALYZE people;"));
+	table_stats *stats = catalog.get("people")->stats;
+	assert(stats && stats->column_count == 3);
+	assert(stats->pages > STATS_SAMPLE_LEAVES && stats->height == 2);
+
+	// Not every leaf is read, so these are estimates
+	assert(stats->rows > PEOPLE * 9 / 10 && stats->rows < PEOPLE * 11 / 10);
+	assert(stats->columns[0].distinct == stats->rows);
+	assert(stats->columns[1].distinct == 4);
+	assert(stats->columns[2].distinct > 900 && stats->columns[2].distinct < 1100);
+	assert(stats->columns[2].min == 0 && stats->columns[2].max == 999);
+	assert(stats->columns[0].bounds[STATS_HISTOGRAM_BUCKETS / 2 - 1] > PEOPLE * 4 / 10);
+	assert(stats->columns[0].bounds[STATS_HISTOGRAM_BUCKETS / 2 - 1] < PEOPLE * 6 / 10);
+
+	uint32_t middle = 500;
+	double	 half = stats_range_selectivity(stats, 2, TYPE_U32, nullptr, &middle);
+	assert(half > 0.4 && half < 0.6);
+
+	// A row per column, read back on reload
+	assert(select_count("SELECT COUNT(*) FROM " STATS_TABLE ";") == 3);
+	table_stats before = *stats;
+	column_stats age = stats->columns[2];
+	catalog_reload();
+	stats = catalog.get("people")->stats;
+	assert(stats && stats->rows == before.rows && stats->pages == before.pages);
+	assert(0 == memcmp(&stats->columns[2], &age, sizeof(age)));
+
+	// Analyzing again replaces them
+	assert(execute_sql_statements("ANALYZE;"));
+	assert(select_count("SELECT COUNT(*) FROM " STATS_TABLE ";") == 3);
+
+	// A rolled back ANALYZE leaves no stats behind
+	assert(execute_sql_statements("CREATE TABLE small (id INT, qty INT);"));
+	assert(execute_sql_statements("INSERT INTO small VALUES (1, 1), (2, 2), (3, 3);"));
+	assert(execute_sql_statements("BEGIN; ANALYZE small; ROLLBACK;"));
+	assert(!catalog.get("small")->stats);
+	assert(catalog.get("people")->stats);
+
+	// Small enough to read whole, so exact
+	assert(execute_sql_statements("ANALYZE small;"));
+	assert(catalog.get("small")->stats->rows == 3);
+	assert(catalog.get("small")->stats->height == 1);
+	assert(select_count("SELECT COUNT(*) FROM " STATS_TABLE ";") == 5);
+	assert(execute_sql_statements("DROP TABLE small;"));
+	assert(select_count("SELECT COUNT(*) FROM " STATS_TABLE ";") == 3);
+}
+
+static void
+test_access_paths()
+{
+	relation *people = catalog.get("people");
+	btree	 *city = &people->indexes[0].btree;
+	btree	 *age = &people->indexes[1].btree;
+
+	// A quarter of the table is cheaper to scan than to look up through the index
+	assert(!reads_tree("SELECT * FROM people WHERE city = 'berlin';", city));
+	// But not one in a thousand
+	assert(reads_tree("SELECT * FROM people WHERE age = 7;", age));
+	// The more selective index of two
+	assert(reads_tree("SELECT * FROM people WHERE city = 'cairo' AND age = 7;", age));
+	assert(!reads_tree("SELECT * FROM people WHERE city = 'cairo' AND age = 7;", city));
+	// A range is costed from the histogram
+	assert(reads_tree("SELECT * FROM people WHERE age < 5;", age));
+	assert(!reads_tree("SELECT * FROM people WHERE age < 900;", age));
+	assert(!reads_tree("SELECT * FROM people WHERE age < ?;", age));
+
+	// Whatever the path, the rows are the same
+	assert(select_count("SELECT COUNT(*) FROM people WHERE city = 'berlin';") == PEOPLE / 4);
+	assert(select_count("SELECT COUNT(*) FROM people WHERE age = 7;") == PEOPLE / 1000);
+	assert(select_count("SELECT COUNT(*) FROM people WHERE city = 'auckland' AND age = 8;") == PEOPLE / 1000);
+	assert(select_count("SELECT COUNT(*) FROM people WHERE age < 900;") == PEOPLE * 9 / 10);
+	assert(select_rows("SELECT id FROM people WHERE id >= 100 AND id < 110;") == 10);
+	assert(first_value == 100);
+	assert(select_rows("SELECT id FROM people WHERE id = 5000;") == 1);
+}
+
+static void
+test_joins()
+{
+	assert(execute_sql_statements("CREATE TABLE visits (id INT, person INT, day INT);"));
+	for (uint32_t i = 1; i <= 200; i++)
+	{
+		char sql[128];
+		snprintf(sql, sizeof(sql), "INSERT INTO visits VALUES (%u, %u, %u);", i, i * 37 % PEOPLE + 1, i % 7);
+		assert(execute_sql_statements(sql));
+	}
+
+	const char *join = "SELECT COUNT(*) FROM people JOIN visits ON people.id = visits.person WHERE day = 3;";
+	const char *by_age = "SELECT COUNT(*) FROM visits JOIN people ON visits.day = people.age;";
+	uint32_t	joined = select_count(join);
+	uint32_t	joined_by_age = select_count(by_age);
+	assert(joined == 29);
+	assert(joined_by_age == 200 * PEOPLE / 1000);
+
+	// Looking up each visit's people through the index reads more than
+	// scanning both and hashing the visits, the FROM table
+	btree *age = &catalog.get("people")->indexes[1].btree;
+	assert(reads_tree(by_age, age));
+	assert(execute_sql_statements("ANALYZE visits;"));
+	assert(!reads_tree(by_age, age));
+	assert(select_count(join) == joined);
+	assert(select_count(by_age) == joined_by_age);
+
+	assert(execute_sql_statements("DROP TABLE visits;"));
+}
+
+void
+test_stats()
+{
+	test_db_open(TEST_DB);
+
+	load_people();
+	test_collect_and_reload();
+	test_access_paths();
+	test_joins();
+
+	pager_close();
+	os_file_delete(TEST_DB);
+	os_file_delete(TEST_CSV);
+	printf("stats tests passed\n");
+}
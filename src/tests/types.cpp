@@ -215,6 +215,15 @@ test_typed_value()
 	varchar_tv.set_varchar(varchar_data);
 	assert(varchar_tv.get_type_id() == TYPE_ID_VARCHAR);
 	assert(varchar_tv.get_size() == strlen(varchar_data));
+
+	typed_value inline_tv = typed_value::make(TYPE_U64);
+	uint64_t	inline_val = 1234567890123ULL;
+	inline_tv.data = inline_tv.inline_data;
+	type_copy(TYPE_U64, inline_tv.data, &inline_val);
+	assert(inline_tv.is_inline());
+	assert(inline_tv.as_u64() == inline_val);
+	assert(!tv.is_inline());
+	assert(type_size(TYPE_CHAR16) <= TYPED_VALUE_INLINE_SIZE);
 }
 
 void
@@ -378,6 +387,45 @@ test_hot_path_operations()
 	}
 }
 
+void
+test_type_kernels()
+{
+	COMPARISON_OP ops[] = {EQ, NE, LT, LE, GT, GE};
+
+	int32_t ints[] = {-7, 0, 3, 3, 100};
+	for (COMPARISON_OP op : ops)
+	{
+		type_test_kernel kernel = type_test_kernel_for(op, TYPE_I32);
+		assert(kernel);
+		for (int32_t a : ints)
+		{
+			for (int32_t b : ints)
+			{
+				assert(kernel(&a, &b) == type_compare_op(op, TYPE_I32, &a, &b));
+			}
+		}
+	}
+
+	char apple[32] = "apple", banana[32] = "banana";
+	type_test_kernel lt = type_test_kernel_for(LT, TYPE_CHAR32);
+	assert(lt(apple, banana) && !lt(banana, apple) && !lt(apple, apple));
+
+	double x = 7.5, y = 2.5, result;
+	type_arith_kernel sub = type_arith_kernel_for(ARITH_SUB, TYPE_F64);
+	assert(sub);
+	sub(&result, &x, &y);
+	assert(result == 5.0);
+
+	uint8_t u = 250, v = 10, wrapped;
+	type_arith_kernel add = type_arith_kernel_for(ARITH_ADD, TYPE_U8);
+	add(&wrapped, &u, &v);
+	assert(wrapped == 4);
+
+	// Duals and strings arithmetic have no kernel, they take the generic path
+	assert(!type_test_kernel_for(EQ, make_dual(TYPE_U32, TYPE_U32)));
+	assert(!type_arith_kernel_for(ARITH_ADD, TYPE_CHAR32));
+}
+
 void
 test_types()
 {
@@ -393,5 +441,6 @@ test_types()
 	test_string_operations();
 	test_type_names();
 	test_hot_path_operations();
+	test_type_kernels();
 	printf("types tests passed\n");
 }
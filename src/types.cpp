@@ -297,6 +297,159 @@ DEFINE_ARITHMETIC_OP(sub, -)
 DEFINE_ARITHMETIC_OP(mul, *)
 DEFINE_ARITHMETIC_OP(div, /)
 
+/*
+ * The kernels are instantiated per TYPE_ID and operator from these, each one
+ * doing what the generic function would for its type
+ */
+template <uint8_t ID> struct native_type;
+template <> struct native_type<TYPE_ID_U8>
+{
+	typedef uint8_t type;
+};
+template <> struct native_type<TYPE_ID_U16>
+{
+	typedef uint16_t type;
+};
+template <> struct native_type<TYPE_ID_U32>
+{
+	typedef uint32_t type;
+};
+template <> struct native_type<TYPE_ID_U64>
+{
+	typedef uint64_t type;
+};
+template <> struct native_type<TYPE_ID_I8>
+{
+	typedef int8_t type;
+};
+template <> struct native_type<TYPE_ID_I16>
+{
+	typedef int16_t type;
+};
+template <> struct native_type<TYPE_ID_I32>
+{
+	typedef int32_t type;
+};
+template <> struct native_type<TYPE_ID_I64>
+{
+	typedef int64_t type;
+};
+template <> struct native_type<TYPE_ID_F32>
+{
+	typedef float type;
+};
+template <> struct native_type<TYPE_ID_F64>
+{
+	typedef double type;
+};
+
+#define FOR_EACH_NUMERIC_TYPE_ID(X)                                                                                    \
+	X(TYPE_ID_U8) X(TYPE_ID_U16) X(TYPE_ID_U32) X(TYPE_ID_U64) X(TYPE_ID_I8) X(TYPE_ID_I16) X(TYPE_ID_I32)             \
+		X(TYPE_ID_I64) X(TYPE_ID_F32) X(TYPE_ID_F64)
+
+template <COMPARISON_OP OP>
+static inline bool
+comparison_result_holds(int cmp)
+{
+	if constexpr (OP == EQ)
+		return cmp == 0;
+	else if constexpr (OP == NE)
+		return cmp != 0;
+	else if constexpr (OP == LT)
+		return cmp < 0;
+	else if constexpr (OP == LE)
+		return cmp <= 0;
+	else if constexpr (OP == GT)
+		return cmp > 0;
+	else
+		return cmp >= 0;
+}
+
+template <uint8_t ID, COMPARISON_OP OP>
+static bool
+typed_test(const void *a, const void *b)
+{
+	if constexpr (ID == TYPE_ID_CHAR || ID == TYPE_ID_VARCHAR)
+	{
+		return comparison_result_holds<OP>(strcmp((const char *)a, (const char *)b));
+	}
+	else
+	{
+		typedef typename native_type<ID>::type T;
+		T av = *(const T *)a, bv = *(const T *)b;
+		return comparison_result_holds<OP>((av > bv) - (av < bv));
+	}
+}
+
+template <uint8_t ID, ARITH_OP OP>
+static void
+typed_arith(void *dst, const void *a, const void *b)
+{
+	typedef typename native_type<ID>::type T;
+	T av = *(const T *)a, bv = *(const T *)b;
+
+	if constexpr (OP == ARITH_ADD)
+		*(T *)dst = av + bv;
+	else if constexpr (OP == ARITH_SUB)
+		*(T *)dst = av - bv;
+	else if constexpr (OP == ARITH_MUL)
+		*(T *)dst = av * bv;
+	else
+		*(T *)dst = av / bv;
+}
+
+template <uint8_t ID>
+static type_test_kernel
+test_kernel(COMPARISON_OP op)
+{
+	static const type_test_kernel kernels[] = {typed_test<ID, EQ>, typed_test<ID, NE>, typed_test<ID, LT>,
+											   typed_test<ID, LE>, typed_test<ID, GT>, typed_test<ID, GE>};
+	return op <= GE ? kernels[op] : nullptr;
+}
+
+template <uint8_t ID>
+static type_arith_kernel
+arith_kernel(ARITH_OP op)
+{
+	static const type_arith_kernel kernels[] = {typed_arith<ID, ARITH_ADD>, typed_arith<ID, ARITH_SUB>,
+												typed_arith<ID, ARITH_MUL>, typed_arith<ID, ARITH_DIV>};
+	return op <= ARITH_DIV ? kernels[op] : nullptr;
+}
+
+type_test_kernel
+type_test_kernel_for(COMPARISON_OP op, data_type type)
+{
+#define TEST_KERNEL_CASE(id)                                                                                           \
+	case id:                                                                                                           \
+		return test_kernel<id>(op);
+
+	switch (type_id(type))
+	{
+		FOR_EACH_NUMERIC_TYPE_ID(TEST_KERNEL_CASE)
+		TEST_KERNEL_CASE(TYPE_ID_CHAR)
+		TEST_KERNEL_CASE(TYPE_ID_VARCHAR)
+	default:
+		return nullptr;
+	}
+#undef TEST_KERNEL_CASE
+}
+
+type_arith_kernel
+type_arith_kernel_for(ARITH_OP op, data_type type)
+{
+#define ARITH_KERNEL_CASE(id)                                                                                          \
+	case id:                                                                                                           \
+		return arith_kernel<id>(op);
+
+	switch (type_id(type))
+	{
+		FOR_EACH_NUMERIC_TYPE_ID(ARITH_KERNEL_CASE)
+	default:
+		return nullptr;
+	}
+#undef ARITH_KERNEL_CASE
+}
+
 void
 type_copy(data_type type, void *dst, const void *src)
 {
@@ -450,7 +603,7 @@ type_increment(data_type type, void *dst, const void *src)
 const char *
 type_name(data_type type)
 {
-	static char buf[64];
+	static thread_local char buf[64];
 
 	switch (type_id(type))
 	{
@@ -555,6 +708,12 @@ typed_value::is_null() const
 	return type_is_null(type);
 }
 
+bool
+typed_value::is_inline() const
+{
+	return data == inline_data;
+}
+
 void
 typed_value::set_varchar(const char *str, uint32_t len)
 {
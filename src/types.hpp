@@ -48,7 +48,11 @@
  *               ^^^^^^^^^^^^^^^  ^^^^^^^^ ^^^^^^^^ ^^^^^^^^ ^^^^^^^^ ^^^^^^^^^^
  *               dual marker      first    second   sizes    sizes    total size
  *
- * We heap allocate all values, including those <= 64 bits, but all on the arenas
+ * A typed_value's data always points at its value. Values of up to
+ * TYPED_VALUE_INLINE_SIZE bytes can be kept in the typed_value itself, with
+ * data pointing at inline_data, so VM registers only allocate (on the arenas)
+ * for the larger char and varchar types. A copy of a typed_value keeps
+ * pointing at the original's inline_data.
  */
 
 #pragma once
@@ -115,6 +119,9 @@ enum TYPE_ID : uint8_t
 // VARCHAR with runtime size
 #define TYPE_VARCHAR(len) MAKE_TYPE(TYPE_ID_VARCHAR, (len))
 
+// The longest VARCHAR(n) a column can be declared as, and string literal
+#define VARCHAR_MAX_SIZE 4096
+
 data_type
 make_char(uint32_t size);
 data_type
@@ -196,6 +203,20 @@ DECLARE_ARITHMETIC_OP(sub)
 DECLARE_ARITHMETIC_OP(mul)
 DECLARE_ARITHMETIC_OP(div)
 
+/*
+ * The above decode the type on every call. When the type is known before the
+ * values are, e.g. when a program is compiled, a kernel for that one type and
+ * operator can be looked up instead and called directly. There are none for
+ * duals (nullptr), they only have the generic path.
+ */
+typedef bool (*type_test_kernel)(const void *a, const void *b);
+typedef void (*type_arith_kernel)(void *dst, const void *a, const void *b);
+
+type_test_kernel
+type_test_kernel_for(COMPARISON_OP op, data_type type);
+type_arith_kernel
+type_arith_kernel_for(ARITH_OP op, data_type type);
+
 void
 type_copy(data_type type, void *dst, const void *src);
 void
@@ -213,10 +234,13 @@ pack_dual(void *dest, data_type type1, const void *data1, data_type type2, const
 void
 unpack_dual(data_type dual_type, const void *src, void *data1, void *data2);
 
+#define TYPED_VALUE_INLINE_SIZE 16
+
 struct typed_value
 {
 	void	 *data;
 	data_type type;
+	alignas(8) uint8_t inline_data[TYPED_VALUE_INLINE_SIZE];
 
 	uint8_t
 	get_type_id() const;
@@ -231,6 +255,8 @@ struct typed_value
 	is_string() const;
 	bool
 	is_null() const;
+	bool
+	is_inline() const;
 
 	void
 	set_varchar(const char *str, uint32_t len = 0);
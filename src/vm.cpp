@@ -20,12 +20,23 @@
 #include "catalog.hpp"
 #include "common.hpp"
 #include "ephemeral.hpp"
+#include "hashtable.hpp"
+#include "memtree.hpp"
 #include "pager.hpp"
+#include "parallel.hpp"
+#include "sorter.hpp"
 #include "types.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <mutex>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #define CURSORS 10
 
@@ -35,41 +46,181 @@ bool _debug = false;
  * The vm cursor wraps other cursors to
  * provide a unified api for the vm to do data manipulation
  *
- * Currently there is just two cursor types, btree and ephemeral (red black)
- * but we could have other storage backends with different properties.
+ * Currently there are five cursor types, btree, the two kinds of ephemeral
+ * tree, red black and the in-memory B+tree, the sorter, which only takes
+ * inserts until it's rewound, then reads its rows back in order, and the hash
+ * table, but we could have other storage backends with different properties.
  *
- * If we had hash based storage, while it might be contrived to have a cursor
- * over it (as you'd rarely want to do range queries), you still could, you'd
- * just mainly use direct seeks as opposed to calling next/prev
+ * The hash table has no order to range over, so it's mostly seeked with EQ,
+ * stepping forward then goes through the rows with the same key. Rewinding it
+ * loads the next pass of its rows, when it's spilled them to disk.
+ *
+ * A gather cursor starts a parallel scan when it's opened, then reads the
+ * rows back as the workers output them, see parallel.hpp. Closing it stops
+ * the workers, and fails if one of them did.
  */
 struct vm_cursor {
   STORAGE_TYPE type;
   tuple_format layout;
+  scan_filter *filter; // see OP_Scan
+
+  bool has_pin;
+  uint32_t pinned_page; // see vmcursor_pin_row
+
+  aggregate_spec *aggregates; // HASH, see OP_AggStep
+
+  // BPLUS over packed records, the current record's image, see record_pack
+  uint8_t *image;
+  const uint8_t *image_of; // The packed record it was unpacked from
 
   union {
     bt_cursor btree;
     et_cursor ephemeral;
+    mt_cursor memtree;
+    sorter *sort; // in the query arena, nullptr once closed
+    hash_table *hash; // likewise
+    parallel_rows *gather;
   } cursor;
 };
 
+/*
+ * Folds one group state into another, a row's as OP_AggStep made it or a
+ * partial one spilled by the hash table. A row's state counts 1, so counts
+ * add up like sums.
+ */
+static void aggregate_combine(void *context, uint8_t *into,
+                              const uint8_t *from) {
+  aggregate_spec *spec = (aggregate_spec *)context;
+  for (uint32_t i = 0; i < spec->term_count; i++) {
+    aggregate_term *term = &spec->terms[i];
+    uint8_t *state = into + term->offset;
+    const uint8_t *value = from + term->offset;
+
+    switch (term->op) {
+    case AGGREGATE_COUNT:
+    case AGGREGATE_SUM:
+      type_add(term->type, state, state, value);
+      break;
+    case AGGREGATE_MIN:
+      if (type_less_than(term->type, value, state)) {
+        type_copy(term->type, state, value);
+      }
+      break;
+    case AGGREGATE_MAX:
+      if (type_greater_than(term->type, value, state)) {
+        type_copy(term->type, state, value);
+      }
+      break;
+    }
+  }
+}
+
 void vmcursor_print(vm_cursor *cursor) {
   auto format = cursor->layout.columns;
   switch (cursor->type) {
   case RED_BLACK:
     et_print(&cursor->cursor.ephemeral.tree, &format);
     break;
+  case MEMTREE:
+    mt_print(&cursor->cursor.memtree.tree, &format);
+    break;
   case BPLUS:
     bt_print(cursor->cursor.btree.tree, &format);
+    break;
+  case SORTER:
+    if (cursor->cursor.sort) {
+      printf("Sorter: %u runs written\n", cursor->cursor.sort->runs.size());
+    }
+    break;
+  case HASH:
+    if (cursor->cursor.hash) {
+      printf("Hash table: %u rows in memory%s\n", cursor->cursor.hash->row_count,
+             cursor->cursor.hash->spilled ? ", partitioned to disk" : "");
+    }
+    break;
+  case GATHER:
+    printf("Gather: %u ranges\n", cursor->cursor.gather->range_count);
+    break;
+  }
+}
+
+/*
+ * A register can reference a column where the row is stored instead of
+ * holding a copy, see OP_Column. The pager can hand a btree leaf's frame to
+ * another page whenever it needs one, so the cursor keeps the leaf it last
+ * referenced pinned until it references another one or is closed.
+ *
+ * Red black rows never move, they're allocated on the query arena. Memory
+ * tree entries shift along their node as others are inserted, so they're
+ * only referenced while nothing is inserted into the tree. Hash table rows
+ * stay put until the next pass is loaded over them.
+ */
+static void vmcursor_unpin(vm_cursor *cur) {
+  if (cur->has_pin) {
+    pager_unpin(cur->pinned_page);
+    cur->has_pin = false;
+  }
+}
+
+/*
+ * A sorter's or hash table's rows may be in a scratch file, which goes with
+ * it. False if a gather cursor's workers failed.
+ */
+static bool vmcursor_close(vm_cursor *cur) {
+  vmcursor_unpin(cur);
+  if (cur->type == SORTER && cur->cursor.sort) {
+    sorter_close(cur->cursor.sort);
+    cur->cursor.sort = nullptr;
+  }
+  if (cur->type == HASH && cur->cursor.hash) {
+    ht_close(cur->cursor.hash);
+    cur->cursor.hash = nullptr;
+  }
+  if (cur->type == GATHER && cur->cursor.gather) {
+    bool ok = par_close(cur->cursor.gather);
+    cur->cursor.gather = nullptr;
+    return ok;
+  }
+  return true;
+}
+
+static void vmcursor_pin_row(vm_cursor *cur) {
+  if (cur->type != BPLUS) {
+    return;
   }
+
+  uint32_t leaf = cur->cursor.btree.leaf_page;
+  if (cur->has_pin && cur->pinned_page == leaf) {
+    return;
+  }
+
+  vmcursor_unpin(cur);
+  pager_pin(leaf);
+  cur->has_pin = true;
+  cur->pinned_page = leaf;
 }
 
-void vmcursor_open(vm_cursor *cursor, cursor_context *context) {
+/*
+ * False if the cursor couldn't be opened, when closing the gather cursor it
+ * replaces fails
+ */
+bool vmcursor_open(vm_cursor *cursor, cursor_context *context) {
+  if (!vmcursor_close(cursor)) {
+    return false;
+  }
+  cursor->filter = context->filter;
   switch (context->type) {
   case BPLUS: {
     cursor->type = BPLUS;
     cursor->layout = context->layout;
     cursor->cursor.btree.tree = context->storage.tree;
     cursor->cursor.btree.state = BT_CURSOR_INVALID;
+    cursor->image = nullptr;
+    cursor->image_of = nullptr;
+    if (cursor->layout.packed_size) {
+      cursor->image =
+          (uint8_t *)arena<query_arena>::alloc(cursor->layout.record_size);
+    }
     break;
   }
   case RED_BLACK: {
@@ -82,7 +233,46 @@ void vmcursor_open(vm_cursor *cursor, cursor_context *context) {
     cursor->cursor.ephemeral.state = et_cursor::INVALID;
     break;
   }
+  case MEMTREE: {
+    cursor->type = MEMTREE;
+    cursor->layout = context->layout;
+    cursor->cursor.memtree.tree =
+        mt_create(cursor->layout.columns[0], cursor->layout.record_size,
+                  context->flags);
+    cursor->cursor.memtree.state = mt_cursor::INVALID;
+    break;
   }
+  case SORTER: {
+    cursor->type = SORTER;
+    cursor->layout = context->layout;
+    cursor->cursor.sort =
+        (sorter *)arena<query_arena>::alloc(sizeof(sorter));
+    *cursor->cursor.sort = sorter_create(cursor->layout.columns[0],
+                                         cursor->layout.record_size,
+                                         (bool)context->flags, context->keep);
+    break;
+  }
+  case HASH: {
+    cursor->type = HASH;
+    cursor->layout = context->layout;
+    cursor->aggregates = context->aggregates;
+    cursor->cursor.hash =
+        (hash_table *)arena<query_arena>::alloc(sizeof(hash_table));
+    *cursor->cursor.hash = ht_create(
+        cursor->layout.columns[0], cursor->layout.record_size,
+        context->aggregates ? aggregate_combine : nullptr, context->aggregates);
+    break;
+  }
+  case GATHER: {
+    cursor->type = GATHER;
+    cursor->layout = context->layout;
+    cursor->cursor.gather =
+        (parallel_rows *)arena<query_arena>::alloc(sizeof(parallel_rows));
+    par_open(cursor->cursor.gather, context->storage.plan, cursor->layout);
+    break;
+  }
+  }
+  return true;
 }
 
 bool vmcursor_rewind(vm_cursor *cur, bool to_end) {
@@ -90,9 +280,21 @@ bool vmcursor_rewind(vm_cursor *cur, bool to_end) {
   case RED_BLACK:
     return to_end ? et_cursor_last(&cur->cursor.ephemeral)
                   : et_cursor_first(&cur->cursor.ephemeral);
+  case MEMTREE:
+    return to_end ? mt_cursor_last(&cur->cursor.memtree)
+                  : mt_cursor_first(&cur->cursor.memtree);
   case BPLUS:
     return to_end ? bt_cursor_last(&cur->cursor.btree)
                   : bt_cursor_first(&cur->cursor.btree);
+  case SORTER:
+    assert(!to_end && "A sorter is read in the direction it sorts");
+    return sorter_first(cur->cursor.sort);
+  case HASH:
+    assert(!to_end && "A hash table has no end to rewind to");
+    return ht_rewind(cur->cursor.hash);
+  case GATHER:
+    assert(!to_end && "Gathered rows are read in order");
+    return par_first(cur->cursor.gather);
   default:
     return false;
   }
@@ -103,9 +305,21 @@ bool vmcursor_step(vm_cursor *cur, bool forward) {
   case RED_BLACK:
     return forward ? et_cursor_next(&cur->cursor.ephemeral)
                    : et_cursor_previous(&cur->cursor.ephemeral);
+  case MEMTREE:
+    return forward ? mt_cursor_next(&cur->cursor.memtree)
+                   : mt_cursor_previous(&cur->cursor.memtree);
   case BPLUS:
     return forward ? bt_cursor_next(&cur->cursor.btree)
                    : bt_cursor_previous(&cur->cursor.btree);
+  case SORTER:
+    assert(forward && "A sorter is read in the direction it sorts");
+    return sorter_next(cur->cursor.sort);
+  case HASH:
+    assert(forward && "A hash table is only read forward");
+    return ht_next(cur->cursor.hash);
+  case GATHER:
+    assert(forward && "Gathered rows are read in order");
+    return par_next(cur->cursor.gather);
   default:
     return false;
   }
@@ -120,6 +334,10 @@ void vmcursor_clear(vm_cursor *cursor) {
     et_clear(&cursor->cursor.ephemeral.tree);
     break;
   }
+  case MEMTREE: {
+    mt_clear(&cursor->cursor.memtree.tree);
+    break;
+  }
   }
   }
 }
@@ -128,8 +346,13 @@ bool vmcursor_seek(vm_cursor *cur, COMPARISON_OP op, uint8_t *key) {
   switch (cur->type) {
   case RED_BLACK:
     return et_cursor_seek(&cur->cursor.ephemeral, key, op);
+  case MEMTREE:
+    return mt_cursor_seek(&cur->cursor.memtree, key, op);
   case BPLUS:
     return bt_cursor_seek(&cur->cursor.btree, key, op);
+  case HASH:
+    assert(op == EQ && "A hash table is only seeked for equal keys");
+    return ht_seek(cur->cursor.hash, key);
   default:
     return false;
   }
@@ -139,8 +362,16 @@ bool vmcursor_is_valid(vm_cursor *cur) {
   switch (cur->type) {
   case RED_BLACK:
     return et_cursor_is_valid(&cur->cursor.ephemeral);
+  case MEMTREE:
+    return mt_cursor_is_valid(&cur->cursor.memtree);
   case BPLUS:
     return bt_cursoris_valid(&cur->cursor.btree);
+  case SORTER:
+    return sorter_is_valid(cur->cursor.sort);
+  case HASH:
+    return ht_is_valid(cur->cursor.hash);
+  case GATHER:
+    return par_is_valid(cur->cursor.gather);
   }
   return false;
 }
@@ -149,22 +380,137 @@ uint8_t *vmcursor_get_key(vm_cursor *cur) {
   switch (cur->type) {
   case RED_BLACK:
     return (uint8_t *)et_cursor_key(&cur->cursor.ephemeral);
+  case MEMTREE:
+    return (uint8_t *)mt_cursor_key(&cur->cursor.memtree);
   case BPLUS:
     return (uint8_t *)bt_cursor_key(&cur->cursor.btree);
+  case SORTER:
+    return (uint8_t *)sorter_key(cur->cursor.sort);
+  case HASH:
+    return (uint8_t *)ht_key(cur->cursor.hash);
+  case GATHER:
+    return (uint8_t *)par_key(cur->cursor.gather);
   }
   return nullptr;
 }
 
+/*
+ * The image of a packed record, unpacked once however many of its columns
+ * are read. The cursor's own writes forget it, as the record they leave can
+ * be where the last one was.
+ */
+static uint8_t *vmcursor_image(vm_cursor *cur, const uint8_t *packed) {
+  if (!packed || !cur->image) {
+    return (uint8_t *)packed;
+  }
+  if (cur->image_of != packed) {
+    record_unpack(cur->layout, packed, cur->image);
+    cur->image_of = packed;
+  }
+  return cur->image;
+}
+
 uint8_t *vmcursor_get_record(vm_cursor *cur) {
   switch (cur->type) {
   case RED_BLACK:
     return (uint8_t *)et_cursor_record(&cur->cursor.ephemeral);
+  case MEMTREE:
+    return (uint8_t *)mt_cursor_record(&cur->cursor.memtree);
   case BPLUS:
-    return (uint8_t *)bt_cursor_record(&cur->cursor.btree);
+    return vmcursor_image(
+        cur, (const uint8_t *)bt_cursor_record(&cur->cursor.btree));
+  case SORTER:
+    return (uint8_t *)sorter_record(cur->cursor.sort);
+  case HASH:
+    return (uint8_t *)ht_record(cur->cursor.hash);
+  case GATHER:
+    return (uint8_t *)par_record(cur->cursor.gather);
   }
   return nullptr;
 }
 
+static bool comparison_holds(COMPARISON_OP op, int cmp_result) {
+  switch (op) {
+  case EQ:
+    return cmp_result == 0;
+  case NE:
+    return cmp_result != 0;
+  case LT:
+    return cmp_result < 0;
+  case LE:
+    return cmp_result <= 0;
+  case GT:
+    return cmp_result > 0;
+  case GE:
+    return cmp_result >= 0;
+  }
+  return false;
+}
+
+static bool term_holds(vm_cursor *cur, scan_term *term, const uint8_t *key,
+                       const uint8_t *record) {
+  const uint8_t *column =
+      term->column == 0 ? key : record + cur->layout.offsets[term->column - 1];
+
+  if (term->kernel) {
+    return term->kernel(column, term->value);
+  }
+
+  int cmp_result =
+      type_compare(cur->layout.columns[term->column], column, term->value);
+  return comparison_holds(term->op, cmp_result);
+}
+
+/*
+ * Tests a row against the cursor's filter where the row is stored, the
+ * columns are found the same way as vmcursor_column
+ */
+static BT_MATCH_RESULT scan_filter_match(void *context, const uint8_t *key,
+                                         const uint8_t *record) {
+  vm_cursor *cur = (vm_cursor *)context;
+  scan_filter *filter = cur->filter;
+  if (cur->type == BPLUS) {
+    record = vmcursor_image(cur, record);
+  }
+
+  if (filter->has_stop && !term_holds(cur, &filter->stop, key, record)) {
+    return BT_MATCH_STOP;
+  }
+
+  for (uint32_t i = 0; i < filter->term_count; i++) {
+    if (!term_holds(cur, &filter->terms[i], key, record)) {
+      return BT_MATCH_SKIP;
+    }
+  }
+  return BT_MATCH_FOUND;
+}
+
+/*
+ * Forward to the next row passing the cursor's filter, or the current row if
+ * it passes and from_current is set
+ */
+bool vmcursor_scan(vm_cursor *cur, bool from_current) {
+  if (cur->type == BPLUS && cur->filter) {
+    return bt_cursor_scan(&cur->cursor.btree, scan_filter_match, cur,
+                          from_current);
+  }
+
+  bool valid = from_current ? vmcursor_is_valid(cur) : vmcursor_step(cur, true);
+  while (valid && cur->filter) {
+    switch (scan_filter_match(cur, vmcursor_get_key(cur),
+                              vmcursor_get_record(cur))) {
+    case BT_MATCH_FOUND:
+      return true;
+    case BT_MATCH_STOP:
+      return false;
+    case BT_MATCH_SKIP:
+      valid = vmcursor_step(cur, true);
+      break;
+    }
+  }
+  return valid;
+}
+
 uint8_t *vmcursor_column(vm_cursor *cur, uint32_t col_index) {
 
   /*
@@ -206,8 +552,30 @@ bool vmcursor_insert(vm_cursor *cur, uint8_t *key, uint8_t *record,
   case RED_BLACK:
     return et_cursor_insert(&cur->cursor.ephemeral, (void *)key,
                             (void *)record);
-  case BPLUS:
-    return bt_cursor_insert(&cur->cursor.btree, key, record);
+  case MEMTREE:
+    return mt_cursor_insert(&cur->cursor.memtree, (void *)key, (void *)record);
+  case BPLUS: {
+    if (!cur->image) {
+      return bt_cursor_insert(&cur->cursor.btree, key, record);
+    }
+    btree *tree = cur->cursor.btree.tree;
+    uint8_t packed[tree->record_size];
+    uint32_t packed_size =
+        record_pack(cur->layout, record, packed, tree->record_size);
+    cur->image_of = nullptr;
+    if (!packed_size) {
+      return false;
+    }
+    if (!bt_cursor_insert(&cur->cursor.btree, key, packed, packed_size)) {
+      record_release(cur->layout, packed);
+      return false;
+    }
+    return true;
+  }
+  case SORTER:
+    return sorter_insert(cur->cursor.sort, key, record);
+  case HASH:
+    return ht_insert(cur->cursor.hash, key, record);
   default:
     return false;
   }
@@ -217,8 +585,28 @@ bool vmcursor_update(vm_cursor *cur, uint8_t *record) {
   switch (cur->type) {
   case RED_BLACK:
     return et_cursor_update(&cur->cursor.ephemeral, record);
-  case BPLUS:
-    return bt_cursor_update(&cur->cursor.btree, record);
+  case MEMTREE:
+    return mt_cursor_update(&cur->cursor.memtree, record);
+  case BPLUS: {
+    if (!cur->image) {
+      return bt_cursor_update(&cur->cursor.btree, record);
+    }
+    btree *tree = cur->cursor.btree.tree;
+    uint8_t packed[tree->record_size];
+    uint32_t packed_size =
+        record_pack(cur->layout, record, packed, tree->record_size);
+    const uint8_t *old = (const uint8_t *)bt_cursor_record(&cur->cursor.btree);
+    cur->image_of = nullptr;
+    if (!packed_size) {
+      return false;
+    }
+    if (!old) {
+      record_release(cur->layout, packed);
+      return false;
+    }
+    record_release(cur->layout, old);
+    return bt_cursor_update(&cur->cursor.btree, packed, packed_size);
+  }
   default:
     return false;
   }
@@ -228,8 +616,16 @@ bool vmcursor_remove(vm_cursor *cur) {
   switch (cur->type) {
   case RED_BLACK:
     return et_cursor_delete(&cur->cursor.ephemeral);
-  case BPLUS:
+  case MEMTREE:
+    return mt_cursor_delete(&cur->cursor.memtree);
+  case BPLUS: {
+    const uint8_t *old = (const uint8_t *)bt_cursor_record(&cur->cursor.btree);
+    cur->image_of = nullptr;
+    if (cur->image && old) {
+      record_release(cur->layout, old);
+    }
     return bt_cursor_delete(&cur->cursor.btree);
+  }
   default:
     return false;
   }
@@ -239,8 +635,16 @@ const char *vmcursor_type_name(vm_cursor *cur) {
   switch (cur->type) {
   case RED_BLACK:
     return "RED_BLACK";
+  case MEMTREE:
+    return "MEMTREE";
   case BPLUS:
     return "BPLUS";
+  case SORTER:
+    return "SORTER";
+  case HASH:
+    return "HASH";
+  case GATHER:
+    return "GATHER";
   }
   return "UNKNOWN";
 }
@@ -259,48 +663,85 @@ void vmcursor_print_current(vm_cursor *cur) {
   printf("\n");
 }
 
-static struct {
+/*
+ * Memory for a register's values that don't fit inline
+ */
+struct register_buffer {
+  uint8_t *data;
+  uint32_t size;
+};
+
+/*
+ * A thread has a VM of its own, so the workers of a parallel scan can run
+ * their programs alongside each other, see parallel.hpp
+ */
+static thread_local struct {
   vm_instruction *program;
   int program_size;
   uint32_t pc;
   bool halted;
-  typed_value registers[REGISTERS];
+  typed_value *registers;
+  register_buffer *buffers;
+  uint32_t register_count;
   vm_cursor cursors[CURSORS];
   result_callback emit_row;
+  bool emit_in_place; // see vm_set_result_callback
+
+  // EXPLAIN ANALYZE, the instruction being timed and the counters as it began
+  vm_profile *profile;
+  int32_t profiled_pc;
+  uint64_t profiled_since;
+  uint64_t profiled_hits, profiled_misses, profiled_read;
 } VM = {};
 
 static void set_register(typed_value *dest, uint8_t *src, data_type type) {
   /*
-   * Our registers operate with heap(arena) allocated memory which is reset
-   * every query.
+   * Values of up to TYPED_VALUE_INLINE_SIZE bytes are copied into the
+   * register itself, so a u32 column never allocates.
    *
-   * If we want to set a register, that already has memory set, and that memory
-   * can fit our new data type, just copy that data in and set the registers new
-   * type.
+   * Larger values go in the register's buffer, which is heap(arena) allocated
+   * memory reset every query. If the buffer can already fit our new data
+   * type, just copy that data in and set the registers new type.
    *
    * Reg 1 before
-   * type: u64, 8 bytes
-   * [F,F,F,F,F,F,F,F]
+   * type: char32, buffer of 32 bytes
+   * [F,F,F,...,F]
    *
-   * then set the register as a u32
+   * then set the register as a char20
    *
    * Reg 1 after
-   * type: u32, 4 bytes
-   * [F,F,F,F,F,F,F,F], still has 8 bytes allocated, but we only interpret the 4
-   *
+   * type: char20, still has 32 bytes allocated, but we only interpret the 20
    *
+   * The register's data is never written through otherwise, it may point
+   * at a row, see OP_Column.
    */
-  if (dest->get_size() < type_size(type)) {
-    arena<query_arena>::reclaim(dest->data, type_size(dest->type));
-    dest->data = (uint8_t *)arena<query_arena>::alloc(type_size(type));
-  } else if (nullptr == dest->data) {
-    dest->data = (uint8_t *)arena<query_arena>::alloc(type_size(type));
+  uint32_t size = type_size(type);
+  if (size <= TYPED_VALUE_INLINE_SIZE) {
+    dest->data = dest->inline_data;
+  } else {
+    register_buffer *buffer = &VM.buffers[dest - VM.registers];
+    if (buffer->size < size) {
+      arena<query_arena>::reclaim(buffer->data, buffer->size);
+      buffer->data = (uint8_t *)arena<query_arena>::alloc(size);
+      buffer->size = size;
+    }
+    dest->data = buffer->data;
   }
 
   dest->type = type;
   type_copy(type, dest->data, src);
 }
 
+/*
+ * Point a register at a value without copying it, the value has to stay put
+ * for as long as the register is read
+ */
+static void reference_register(typed_value *dest, uint8_t *src,
+                               data_type type) {
+  dest->data = src;
+  dest->type = type;
+}
+
 static void set_register(typed_value *dest, typed_value *src) {
   set_register(dest, (uint8_t *)src->data, src->type);
 }
@@ -327,20 +768,114 @@ static void build_record(uint8_t *data, int32_t first_reg, int32_t count) {
   }
 }
 
-static void reset() {
+/*
+ * The highest register an instruction reads or writes, plus one. Insert and
+ * Update work on a whole row from their first register, so they're given the
+ * widest layout any cursor in the program opens with.
+ */
+static uint32_t instruction_registers(vm_instruction *inst,
+                                      uint32_t row_width) {
+  auto span = [](int64_t first, int64_t count) {
+    return (uint32_t)(first + count);
+  };
+
+  switch (inst->opcode) {
+  case OP_Rewind:
+  case OP_Step:
+  case OP_Scan:
+    return span(inst->p2, 1);
+  case OP_StepJump:
+    return span(inst->p3, 1);
+  case OP_Seek:
+  case OP_Delete:
+    return std::max(span(inst->p2, 1), span(inst->p3, 1));
+  case OP_Column:
+    return span(inst->p3, 1);
+  case OP_ColumnTest: {
+    column_test *params = (column_test *)inst->p4;
+    return std::max({span(params->column_reg, 1), span(params->right_reg, 1),
+                     span(params->test_reg, 1)});
+  }
+  case OP_Insert:
+  case OP_Update:
+  case OP_AggStep:
+    return span(inst->p2, row_width);
+  case OP_Move:
+    return std::max(span(inst->p1, 1), span(inst->p3, 1));
+  case OP_Load:
+  case OP_JumpIf:
+    return span(inst->p1, 1);
+  case OP_Arithmetic:
+  case OP_Logic:
+  case OP_Test:
+  case OP_Pack:
+  case OP_TypedArithmetic:
+  case OP_TypedTest:
+    return std::max({span(inst->p1, 1), span(inst->p2, 1), span(inst->p3, 1)});
+  case OP_Result:
+    return span(inst->p1, inst->p2);
+  case OP_Function:
+    return std::max(span(inst->p1, 1), span(inst->p2, inst->p3));
+  case OP_Unpack:
+    return std::max(span(inst->p1, 2), span(inst->p2, 1));
+  default:
+    return 0;
+  }
+}
+
+/*
+ * The register file is sized for each program, so there's no fixed limit on
+ * how wide a row can be
+ */
+static uint32_t program_registers(vm_instruction *instructions,
+                                  int instruction_count) {
+  uint32_t row_width = 0;
+  for (int i = 0; i < instruction_count; i++) {
+    if (instructions[i].opcode == OP_Open) {
+      cursor_context *context = (cursor_context *)instructions[i].p4;
+      row_width = std::max(row_width, context->layout.columns.size());
+    }
+  }
+
+  uint32_t count = 0;
+  for (int i = 0; i < instruction_count; i++) {
+    count = std::max(count, instruction_registers(&instructions[i], row_width));
+  }
+  return count;
+}
+
+static void reset(uint32_t register_count) {
   VM.pc = 0;
   VM.halted = false;
-  for (uint32_t i = 0; i < REGISTERS; i++) {
+  VM.register_count = register_count;
+  VM.registers = (typed_value *)arena<query_arena>::alloc(
+      sizeof(typed_value) * register_count);
+  VM.buffers = (register_buffer *)arena<query_arena>::alloc(
+      sizeof(register_buffer) * register_count);
+  for (uint32_t i = 0; i < register_count; i++) {
     VM.registers[i].type = TYPE_NULL;
     VM.registers[i].data = nullptr;
+    VM.buffers[i] = {nullptr, 0};
   }
   VM.program = nullptr;
   VM.program_size = 0;
 }
 
+/*
+ * A program can end without closing its cursors, e.g. on an error. False if
+ * closing one failed.
+ */
+static bool release_cursors() {
+  bool ok = true;
+  for (uint32_t i = 0; i < CURSORS; i++) {
+    ok &= vmcursor_close(&VM.cursors[i]);
+  }
+  return ok;
+}
+
 void vm_debug_print_all_registers() {
   printf("===== REGISTERS =====\n");
-  for (int i = 0; i < REGISTERS; i++) {
+  for (uint32_t i = 0; i < VM.register_count; i++) {
     if (VM.registers[i].type != TYPE_NULL && VM.registers[i].data != nullptr) {
       printf("R[%2d] = ", i);
       type_print(VM.registers[i].type, VM.registers[i].data);
@@ -350,32 +885,206 @@ void vm_debug_print_all_registers() {
   printf("====================\n");
 }
 
-static VM_RESULT step() {
-  vm_instruction *inst = &VM.program[VM.pc];
+/*
+ * The cycle counter where there is one, it's far cheaper to read than
+ * steady_clock, which the run's ticks are scaled against afterwards
+ */
+static inline uint64_t profile_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t ticks;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+  return ticks;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
 
+/*
+ * Whether the instruction just run produced a row: emitted one, stored one,
+ * or moved its cursor onto one
+ */
+static bool produced_row(vm_instruction *inst) {
   switch (inst->opcode) {
-  case OP_Halt: {
-    if (_debug) {
+  case OP_Result:
+  case OP_Insert:
+  case OP_Update:
+  case OP_AggStep:
+    return true;
+  case OP_Rewind:
+    return VM.registers[REWIND_RESULT_REG()].as_u32() != 0;
+  case OP_Step:
+    return VM.registers[STEP_RESULT_REG()].as_u32() != 0;
+  case OP_Scan:
+    return VM.registers[SCAN_RESULT_REG()].as_u32() != 0;
+  case OP_StepJump:
+    return VM.registers[STEPJUMP_RESULT_REG()].as_u32() != 0;
+  case OP_Seek:
+    return VM.registers[SEEK_RESULT_REG()].as_u32() != 0;
+  case OP_Delete:
+    return VM.registers[DELETE_DELETE_OCCURRED_REG()].as_u32() != 0;
+  default:
+    return false;
+  }
+}
+
+/*
+ * Charges the instruction being timed with what's happened since it began
+ */
+static void profile_finish(uint64_t now) {
+  if (VM.profiled_pc < 0) {
+    return;
+  }
+
+  const pager_io_stats *io = pager_io_counters();
+  vm_instruction_profile *entry = &VM.profile->instructions[VM.profiled_pc];
+  entry->ticks += now - VM.profiled_since;
+  entry->page_hits += io->cache_hits + io->map_hits - VM.profiled_hits;
+  entry->page_misses += io->cache_misses - VM.profiled_misses;
+  entry->bytes_read += io->bytes_read - VM.profiled_read;
+  if (produced_row(&VM.program[VM.profiled_pc])) {
+    entry->rows++;
+  }
+  VM.profiled_pc = -1;
+}
+
+static void profile_begin(uint32_t pc) {
+  uint64_t now = profile_ticks();
+  profile_finish(now);
+
+  const pager_io_stats *io = pager_io_counters();
+  VM.profiled_pc = pc;
+  VM.profiled_since = now;
+  VM.profiled_hits = io->cache_hits + io->map_hits;
+  VM.profiled_misses = io->cache_misses;
+  VM.profiled_read = io->bytes_read;
+  VM.profile->instructions[pc].executions++;
+}
+
+/*
+ * The dispatch loop. With computed goto, each handler jumps straight to the
+ * next instruction's handler through a table, instead of going back round a
+ * loop to a switch, which gives every handler its own indirect branch to
+ * predict. Other compilers get the switch.
+ *
+ * Tracing and profiling are separate instantiations, chosen once by
+ * vm_execute, so the normal loop has no checks for them in it.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_COMPUTED_GOTO 1
+#endif
+
+#ifdef VM_COMPUTED_GOTO
+#define VM_OP(op) L_##op:
+#define VM_DEFAULT L_default:
+#define VM_DISPATCH()                                                          \
+  do {                                                                         \
+    if (VM.pc >= (uint32_t)VM.program_size) {                                  \
+      return OK;                                                               \
+    }                                                                          \
+    inst = &VM.program[VM.pc];                                                 \
+    if (PROFILE) {                                                             \
+      profile_begin(VM.pc);                                                    \
+    }                                                                          \
+    goto *dispatch_table[inst->opcode];                                        \
+  } while (0)
+#else
+#define VM_OP(op) case op:
+#define VM_DEFAULT default:
+#define VM_DISPATCH() continue
+#endif
+
+template <bool TRACE, bool PROFILE> static VM_RESULT run() {
+  vm_instruction *inst;
+
+#ifdef VM_COMPUTED_GOTO
+  // Built by whichever thread runs first, the others wait for it
+  static void *dispatch_table[256];
+  static std::atomic<bool> table_built = false;
+  static std::mutex table_latch;
+  std::unique_lock<std::mutex> guard(table_latch, std::defer_lock);
+  if (!table_built.load(std::memory_order_acquire)) {
+    guard.lock();
+  }
+  if (!table_built.load(std::memory_order_relaxed)) {
+    for (uint32_t i = 0; i < 256; i++) {
+      dispatch_table[i] = &&L_default;
+    }
+    dispatch_table[OP_Halt] = &&L_OP_Halt;
+    dispatch_table[OP_Goto] = &&L_OP_Goto;
+    dispatch_table[OP_Load] = &&L_OP_Load;
+    dispatch_table[OP_Move] = &&L_OP_Move;
+    dispatch_table[OP_Test] = &&L_OP_Test;
+    dispatch_table[OP_Function] = &&L_OP_Function;
+    dispatch_table[OP_JumpIf] = &&L_OP_JumpIf;
+    dispatch_table[OP_Logic] = &&L_OP_Logic;
+    dispatch_table[OP_Result] = &&L_OP_Result;
+    dispatch_table[OP_Arithmetic] = &&L_OP_Arithmetic;
+    dispatch_table[OP_Open] = &&L_OP_Open;
+    dispatch_table[OP_Close] = &&L_OP_Close;
+    dispatch_table[OP_Rewind] = &&L_OP_Rewind;
+    dispatch_table[OP_Step] = &&L_OP_Step;
+    dispatch_table[OP_Scan] = &&L_OP_Scan;
+    dispatch_table[OP_Seek] = &&L_OP_Seek;
+    dispatch_table[OP_StepJump] = &&L_OP_StepJump;
+    dispatch_table[OP_ColumnTest] = &&L_OP_ColumnTest;
+    dispatch_table[OP_Column] = &&L_OP_Column;
+    dispatch_table[OP_Delete] = &&L_OP_Delete;
+    dispatch_table[OP_Insert] = &&L_OP_Insert;
+    dispatch_table[OP_Update] = &&L_OP_Update;
+    dispatch_table[OP_AggStep] = &&L_OP_AggStep;
+    dispatch_table[OP_Begin] = &&L_OP_Begin;
+    dispatch_table[OP_Commit] = &&L_OP_Commit;
+    dispatch_table[OP_Rollback] = &&L_OP_Rollback;
+    dispatch_table[OP_Pack] = &&L_OP_Pack;
+    dispatch_table[OP_Unpack] = &&L_OP_Unpack;
+    dispatch_table[OP_TypedArithmetic] = &&L_OP_TypedArithmetic;
+    dispatch_table[OP_TypedTest] = &&L_OP_TypedTest;
+    table_built.store(true, std::memory_order_release);
+  }
+  if (guard.owns_lock()) {
+    guard.unlock();
+  }
+
+  VM_DISPATCH();
+#else
+  for (;;) {
+    if (VM.pc >= (uint32_t)VM.program_size) {
+      return OK;
+    }
+    inst = &VM.program[VM.pc];
+    if (PROFILE) {
+      profile_begin(VM.pc);
+    }
+
+    switch (inst->opcode) {
+#endif
+
+  VM_OP(OP_Halt) {
+    if (TRACE) {
       printf("=> Halting with code %d\n", HALT_EXIT_CODE());
     }
     VM.halted = true;
     return OK;
   }
-  case OP_Goto: {
+  VM_OP(OP_Goto) {
     int32_t target = GOTO_TARGET();
-    if (_debug) {
+    if (TRACE) {
       printf("=> Jumping to PC=%d\n", target);
     }
     VM.pc = target;
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_Load: {
+  VM_OP(OP_Load) {
     int32_t dest_reg = LOAD_DEST_REG();
     uint8_t *data = LOAD_DATA();
     data_type type = LOAD_TYPE();
 
     auto to_load = typed_value::make(type, data);
-    if (_debug) {
+    if (TRACE) {
       printf("=> R[%d] = ", dest_reg);
       type_print(type, data);
       printf(" (%s)\n", type_name(type));
@@ -383,13 +1092,13 @@ static VM_RESULT step() {
 
     set_register(&VM.registers[dest_reg], &to_load);
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_Move: {
+  VM_OP(OP_Move) {
     int32_t dest_reg = MOVE_DEST_REG();
     int32_t src_reg = MOVE_SRC_REG();
     auto *src = &VM.registers[src_reg];
-    if (_debug) {
+    if (TRACE) {
       printf("=> R[%d] = R[%d] = ", dest_reg, src_reg);
       if (src->data) {
         type_print(src->type, src->data);
@@ -400,9 +1109,9 @@ static VM_RESULT step() {
     }
     set_register(&VM.registers[dest_reg], src);
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_Test: {
+  VM_OP(OP_Test) {
     int32_t dest = TEST_DEST_REG();
     int32_t left = TEST_LEFT_REG();
     int32_t right = TEST_RIGHT_REG();
@@ -410,30 +1119,9 @@ static VM_RESULT step() {
     typed_value *a = &VM.registers[left];
     typed_value *b = &VM.registers[right];
     int cmp_result = type_compare(a->type, a->data, b->data);
-    uint32_t test_result = false;
+    uint32_t test_result = comparison_holds(op, cmp_result);
 
-    switch (op) {
-    case EQ:
-      test_result = (cmp_result == 0);
-      break;
-    case NE:
-      test_result = (cmp_result != 0);
-      break;
-    case LT:
-      test_result = (cmp_result < 0);
-      break;
-    case LE:
-      test_result = (cmp_result <= 0);
-      break;
-    case GT:
-      test_result = (cmp_result > 0);
-      break;
-    case GE:
-      test_result = (cmp_result >= 0);
-      break;
-    }
-
-    if (_debug) {
+    if (TRACE) {
       printf("=> R[%d] = (", dest);
       type_print(a->type, a->data);
       printf(" %s ", debug_compare_op_name(op));
@@ -443,15 +1131,15 @@ static VM_RESULT step() {
 
     set_register(&VM.registers[dest], (uint8_t *)&test_result, TYPE_U32);
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_Function: {
+  VM_OP(OP_Function) {
     int32_t dest = FUNCTION_DEST_REG();
     int32_t first_arg = FUNCTION_FIRST_ARG_REG();
     int32_t count = FUNCTION_ARG_COUNT();
     vm_function fn = FUNCTION_FUNCTION();
 
-    if (_debug) {
+    if (TRACE) {
       printf("=> R[%d] = fn(", dest);
       for (int i = 0; i < count; i++) {
         if (i > 0)
@@ -474,9 +1162,9 @@ static VM_RESULT step() {
     }
 
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_JumpIf: {
+  VM_OP(OP_JumpIf) {
     int32_t test_reg = JUMPIF_TEST_REG();
     int32_t target = JUMPIF_JUMP_TARGET();
     bool jump_on_true = JUMPIF_JUMP_ON_TRUE();
@@ -484,7 +1172,7 @@ static VM_RESULT step() {
     bool is_true = (*(uint32_t *)val->data != 0);
     bool will_jump = (is_true && jump_on_true) || (!is_true && !jump_on_true);
 
-    if (_debug) {
+    if (TRACE) {
       printf("=> R[%d]=", test_reg);
       type_print(val->type, val->data);
       printf(" (%s), jump_on_%s => %s to PC=%d\n", is_true ? "TRUE" : "FALSE",
@@ -498,9 +1186,9 @@ static VM_RESULT step() {
     } else {
       VM.pc++;
     }
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_Logic: {
+  VM_OP(OP_Logic) {
     int32_t dest = LOGIC_DEST_REG();
     int32_t left = LOGIC_LEFT_REG();
     int32_t right = LOGIC_RIGHT_REG();
@@ -524,20 +1212,20 @@ static VM_RESULT step() {
 
     *(uint32_t *)result.data = res_val;
 
-    if (_debug) {
+    if (TRACE) {
       printf("=> R[%d] = %d %s %d = %d\n", dest, a, debug_logic_op_name(op), b,
              res_val);
     }
 
     set_register(&VM.registers[dest], &result);
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_Result: {
+  VM_OP(OP_Result) {
     int32_t first_reg = RESULT_FIRST_REG();
     int32_t reg_count = RESULT_REG_COUNT();
 
-    if (_debug) {
+    if (TRACE) {
       printf("=> RESULT: ");
       for (int i = 0; i < reg_count; i++) {
         if (i > 0)
@@ -553,22 +1241,32 @@ static VM_RESULT step() {
       printf("\n");
     }
 
+    if (VM.emit_in_place) {
+      VM.emit_row(&VM.registers[first_reg], reg_count);
+      VM.pc++;
+      VM_DISPATCH();
+    }
+
     typed_value *values = (typed_value *)arena<query_arena>::alloc(
         sizeof(typed_value) * reg_count);
 
     for (int i = 0; i < reg_count; i++) {
       typed_value *val = &VM.registers[first_reg + i];
+      uint32_t size = type_size(val->type);
       values[i].type = val->type;
-      values[i].data =
-          (uint8_t *)arena<query_arena>::alloc(type_size(val->type));
-      memcpy(values[i].data, val->data, type_size(val->type));
+      if (size <= TYPED_VALUE_INLINE_SIZE) {
+        values[i].data = values[i].inline_data;
+      } else {
+        values[i].data = (uint8_t *)arena<query_arena>::alloc(size);
+      }
+      memcpy(values[i].data, val->data, size);
     }
 
     VM.emit_row(values, reg_count);
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_Arithmetic: {
+  VM_OP(OP_Arithmetic) {
     int32_t dest = ARITHMETIC_DEST_REG();
     int32_t left = ARITHMETIC_LEFT_REG();
     int32_t right = ARITHMETIC_RIGHT_REG();
@@ -577,7 +1275,7 @@ static VM_RESULT step() {
     typed_value *b = &VM.registers[right];
 
     typed_value result = {.type = (a->type > b->type) ? a->type : b->type};
-    result.data = (uint8_t *)arena<query_arena>::alloc(type_size(result.type));
+    result.data = result.inline_data;
 
     bool success = true;
 
@@ -596,7 +1294,7 @@ static VM_RESULT step() {
       break;
     }
 
-    if (_debug) {
+    if (TRACE) {
       printf("=> R[%d] = ", dest);
       type_print(a->type, a->data);
       printf(" %s ", debug_arith_op_name(op));
@@ -616,14 +1314,14 @@ static VM_RESULT step() {
 
     set_register(&VM.registers[dest], &result);
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_Open: {
+  VM_OP(OP_Open) {
     int32_t cursor_id = OPEN_CURSOR_ID();
     vm_cursor *cursor = &VM.cursors[cursor_id];
     cursor_context *context = OPEN_LAYOUT();
 
-    if (_debug) {
+    if (TRACE) {
       const char *name;
       switch (context->type) {
       case BPLUS:
@@ -632,28 +1330,46 @@ static VM_RESULT step() {
       case RED_BLACK:
         name = "RED_BLACK";
         break;
+      case MEMTREE:
+        name = "MEMTREE";
+        break;
+      case SORTER:
+        name = "SORTER";
+        break;
+      case HASH:
+        name = "HASH";
+        break;
+      case GATHER:
+        name = "GATHER";
+        break;
       default:
         name = "UNKNOWN";
       }
       printf("=> Opening cursor %d type=%s\n", cursor_id, name);
     }
 
-    vmcursor_open(cursor, context);
+    if (!vmcursor_open(cursor, context)) {
+      return ERR;
+    }
 
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_Close: {
+  VM_OP(OP_Close) {
     int32_t cursor_id = CLOSE_CURSOR_ID();
-    if (_debug) {
+    if (TRACE) {
       vmcursor_print(&VM.cursors[cursor_id]);
       printf("=> Closed cursor %d\n", cursor_id);
     }
 
+    if (!vmcursor_close(&VM.cursors[cursor_id])) {
+      return ERR;
+    }
+
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_Rewind: {
+  VM_OP(OP_Rewind) {
     int32_t cursor_id = REWIND_CURSOR_ID();
     int32_t result_reg = REWIND_RESULT_REG();
     bool to_end = REWIND_TO_END();
@@ -661,32 +1377,72 @@ static VM_RESULT step() {
     bool valid = vmcursor_rewind(cursor, to_end);
     uint32_t result_val = valid ? 1 : 0;
 
-    if (_debug) {
+    if (TRACE) {
       printf("=> Cursor %d rewound to %s, R[%d]=%d\n", cursor_id,
              to_end ? "end" : "start", result_reg, result_val);
     }
 
     set_register(&VM.registers[result_reg], (uint8_t *)&result_val, TYPE_U32);
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_Step: {
+  VM_OP(OP_Step) {
     int32_t cursor_id = STEP_CURSOR_ID();
     int32_t result_reg = STEP_RESULT_REG();
     bool forward = STEP_FORWARD();
     vm_cursor *cursor = &VM.cursors[cursor_id];
     uint32_t has_more = vmcursor_step(cursor, forward) ? 1 : 0;
 
-    if (_debug) {
+    if (TRACE) {
       printf("=> Cursor %d stepped %s, R[%d]=%d\n", cursor_id,
              forward ? "forward" : "backward", result_reg, has_more);
     }
 
     set_register(&VM.registers[result_reg], (uint8_t *)&has_more, TYPE_U32);
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_Seek: {
+  VM_OP(OP_Scan) {
+    int32_t cursor_id = SCAN_CURSOR_ID();
+    int32_t result_reg = SCAN_RESULT_REG();
+    bool from_current = SCAN_FROM_CURRENT();
+    vm_cursor *cursor = &VM.cursors[cursor_id];
+    uint32_t found = vmcursor_scan(cursor, from_current) ? 1 : 0;
+
+    if (TRACE) {
+      printf("=> Cursor %d scanned %s, R[%d]=%d\n", cursor_id,
+             from_current ? "from current" : "forward", result_reg, found);
+    }
+
+    set_register(&VM.registers[result_reg], (uint8_t *)&found, TYPE_U32);
+    VM.pc++;
+    VM_DISPATCH();
+  }
+  VM_OP(OP_StepJump) {
+    int32_t cursor_id = STEPJUMP_CURSOR_ID();
+    int32_t result_reg = STEPJUMP_RESULT_REG();
+    STEP_JUMP_MODE mode = STEPJUMP_MODE();
+    vm_cursor *cursor = &VM.cursors[cursor_id];
+
+    bool has_more = mode == STEP_JUMP_SCAN
+                        ? vmcursor_scan(cursor, false)
+                        : vmcursor_step(cursor, mode == STEP_JUMP_FORWARD);
+    uint32_t result = has_more ? 1 : 0;
+
+    if (TRACE) {
+      printf("=> Cursor %d advanced, R[%d]=%d => %s\n", cursor_id, result_reg,
+             result, has_more ? "LOOPING" : "CONTINUE");
+    }
+
+    set_register(&VM.registers[result_reg], (uint8_t *)&result, TYPE_U32);
+    if (has_more) {
+      VM.pc = STEPJUMP_TARGET();
+    } else {
+      VM.pc++;
+    }
+    VM_DISPATCH();
+  }
+  VM_OP(OP_Seek) {
     int32_t cursor_id = SEEK_CURSOR_ID();
     int32_t key_reg = SEEK_KEY_REG();
     int32_t result_reg = SEEK_RESULT_REG();
@@ -696,7 +1452,7 @@ static VM_RESULT step() {
     bool found = vmcursor_seek(cursor, op, (uint8_t *)key->data);
     uint32_t result_val = found ? 1 : 0;
 
-    if (_debug) {
+    if (TRACE) {
       printf("=> Cursor %d seek %s with key=", cursor_id,
              debug_compare_op_name(op));
       type_print(key->type, key->data);
@@ -705,9 +1461,9 @@ static VM_RESULT step() {
 
     set_register(&VM.registers[result_reg], (uint8_t *)&result_val, TYPE_U32);
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_Column: {
+  VM_OP(OP_Column) {
     int32_t cursor_id = COLUMN_CURSOR_ID();
     int32_t col_index = COLUMN_INDEX();
     int32_t dest_reg = COLUMN_DEST_REG();
@@ -718,7 +1474,10 @@ static VM_RESULT step() {
 
     typed_value src = typed_value::make(column_type, column_value);
 
-    if (_debug) {
+    bool reference = COLUMN_REFERENCE() &&
+                     type_size(column_type) > TYPED_VALUE_INLINE_SIZE;
+
+    if (TRACE) {
       printf("=> R[%d] = cursor[%d].col[%d] = ", dest_reg, cursor_id,
              col_index);
       if (src.data) {
@@ -726,14 +1485,58 @@ static VM_RESULT step() {
       } else {
         printf("NULL");
       }
-      printf(" (%s)\n", type_name(src.type));
+      printf(" (%s)%s\n", type_name(src.type), reference ? " by reference" : "");
     }
 
-    set_register(&VM.registers[dest_reg], &src);
+    if (reference) {
+      vmcursor_pin_row(cursor);
+      reference_register(&VM.registers[dest_reg], column_value, column_type);
+    } else {
+      set_register(&VM.registers[dest_reg], &src);
+    }
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
+  }
+  VM_OP(OP_ColumnTest) {
+    int32_t cursor_id = COLUMNTEST_CURSOR_ID();
+    column_test *params = COLUMNTEST_PARAMS();
+    bool jump_on_true = COLUMNTEST_JUMP_ON_TRUE();
+    vm_cursor *cursor = &VM.cursors[cursor_id];
+
+    data_type column_type = vmcursor_column_type(cursor, params->column);
+    uint8_t *column_value = vmcursor_column(cursor, params->column);
+    set_register(&VM.registers[params->column_reg], column_value, column_type);
+
+    typed_value *right = &VM.registers[params->right_reg];
+    uint32_t test_result =
+        params->kernel
+            ? params->kernel(column_value, right->data)
+            : comparison_holds(params->op, type_compare(column_type,
+                                                        column_value,
+                                                        right->data));
+    set_register(&VM.registers[params->test_reg], (uint8_t *)&test_result,
+                 TYPE_U32);
+
+    bool will_jump = (test_result != 0) == jump_on_true;
+
+    if (TRACE) {
+      printf("=> R[%d] = cursor[%d].col[%d] = ", params->column_reg, cursor_id,
+             params->column);
+      type_print(column_type, column_value);
+      printf(" %s ", debug_compare_op_name(params->op));
+      type_print(right->type, right->data);
+      printf(" = %s => %s\n", test_result ? "TRUE" : "FALSE",
+             will_jump ? "JUMPING" : "CONTINUE");
+    }
+
+    if (will_jump) {
+      VM.pc = COLUMNTEST_TARGET();
+    } else {
+      VM.pc++;
+    }
+    VM_DISPATCH();
   }
-  case OP_Delete: {
+  VM_OP(OP_Delete) {
     int32_t cursor_id = DELETE_CURSOR_ID();
     int32_t delete_occurred = DELETE_DELETE_OCCURRED_REG();
     int32_t cursor_valid = DELETE_CURSOR_VALID_REG();
@@ -749,15 +1552,15 @@ static VM_RESULT step() {
     set_register(&VM.registers[delete_occurred], &src_success);
     set_register(&VM.registers[cursor_valid], &src_valid);
 
-    if (_debug) {
+    if (TRACE) {
       printf("=> Cursor %d delete %s, cursor still valid=%d\n", cursor_id,
              success ? "SUCCESS" : "FAILED", valid);
     }
 
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_Insert: {
+  VM_OP(OP_Insert) {
     int32_t cursor_id = INSERT_CURSOR_ID();
     int32_t key_reg = INSERT_KEY_REG();
 
@@ -766,7 +1569,7 @@ static VM_RESULT step() {
     uint32_t count = cursor->layout.columns.size() - 1;
     bool success;
 
-    if (_debug) {
+    if (TRACE) {
       printf("=> Cursor %d insert key=", cursor_id);
       type_print(first->type, first->data);
       printf(" with %d record values", count);
@@ -780,7 +1583,7 @@ static VM_RESULT step() {
     success = vmcursor_insert(cursor, (uint8_t *)first->data, data,
                               cursor->layout.record_size);
 
-    if (_debug) {
+    if (TRACE) {
       printf(" [");
       for (uint32_t i = 0; i < count; i++) {
         if (i > 0)
@@ -791,7 +1594,7 @@ static VM_RESULT step() {
       printf("]");
     }
 
-    if (_debug) {
+    if (TRACE) {
       printf(", success=%d\n", success);
     }
 
@@ -800,9 +1603,43 @@ static VM_RESULT step() {
     }
 
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
+  }
+  VM_OP(OP_AggStep) {
+    int32_t cursor_id = AGGSTEP_CURSOR_ID();
+    int32_t key_reg = AGGSTEP_KEY_REG();
+    vm_cursor *cursor = &VM.cursors[cursor_id];
+    aggregate_spec *spec = cursor->aggregates;
+    assert(cursor->type == HASH && spec &&
+           "AggStep needs a HASH cursor opened with aggregates");
+
+    uint8_t state[cursor->layout.record_size];
+    uint32_t one = 1;
+    for (uint32_t i = 0; i < spec->term_count; i++) {
+      aggregate_term *term = &spec->terms[i];
+      const void *value = term->op == AGGREGATE_COUNT
+                              ? &one
+                              : VM.registers[key_reg + 1 + term->arg].data;
+      type_copy(term->type, state + term->offset, value);
+    }
+
+    typed_value *key = &VM.registers[key_reg];
+    bool success = ht_insert(cursor->cursor.hash, key->data, state);
+
+    if (TRACE) {
+      printf("=> Cursor %d aggregate key=", cursor_id);
+      type_print(key->type, key->data);
+      printf(", success=%d\n", success);
+    }
+
+    if (!success) {
+      return ERR;
+    }
+
+    VM.pc++;
+    VM_DISPATCH();
   }
-  case OP_Update: {
+  VM_OP(OP_Update) {
     int32_t cursor_id = UPDATE_CURSOR_ID();
     int32_t record_reg = UPDATE_RECORD_REG();
     vm_cursor *cursor = &VM.cursors[cursor_id];
@@ -814,7 +1651,7 @@ static VM_RESULT step() {
     build_record(data, record_reg + 1, record_count);
     bool success = vmcursor_update(cursor, data);
 
-    if (_debug) {
+    if (TRACE) {
       printf("=> Cursor %d update with [", cursor_id);
       for (uint32_t i = 0; i < record_count; i++) {
         if (i > 0)
@@ -826,33 +1663,36 @@ static VM_RESULT step() {
     }
 
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
 
-  case OP_Begin: {
-    if (_debug) {
+  VM_OP(OP_Begin) {
+    if (TRACE) {
       printf("=> Beginning transaction\n");
     }
     pager_begin_transaction();
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_Commit: {
-    if (_debug) {
+  VM_OP(OP_Commit) {
+    if (TRACE) {
       printf("=> Committing transaction\n");
     }
-    pager_commit();
+    // A failed commit has been rolled back
+    if (!pager_commit()) {
+      return ERR;
+    }
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
-  case OP_Rollback: {
-    if (_debug) {
+  VM_OP(OP_Rollback) {
+    if (TRACE) {
       printf("=> Rolling back transaction\n");
     }
     pager_rollback();
     return ABORT;
   }
-  case OP_Pack: {
+  VM_OP(OP_Pack) {
 
     /*
      * Packing and unpacking two datatypes to make composite keys
@@ -876,7 +1716,7 @@ static VM_RESULT step() {
 
     pack_dual(packed, a->type, a->data, b->type, b->data);
 
-    if (_debug) {
+    if (TRACE) {
       printf("=> R[%d] = pack(", dest);
       type_print(a->type, a->data);
       printf(", ");
@@ -888,10 +1728,10 @@ static VM_RESULT step() {
 
     set_register(&VM.registers[dest], packed, dual_type);
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
 
-  case OP_Unpack: {
+  VM_OP(OP_Unpack) {
     int32_t first_dest = UNPACK2_FIRST_DEST_REG();
     int32_t src = UNPACK2_SRC_REG();
 
@@ -908,7 +1748,7 @@ static VM_RESULT step() {
 
     unpack_dual(dual_val->type, dual_val->data, data1, data2);
 
-    if (_debug) {
+    if (TRACE) {
       printf("=> unpack(");
       type_print(dual_val->type, dual_val->data);
       printf(") -> R[%d]=", first_dest);
@@ -922,18 +1762,66 @@ static VM_RESULT step() {
     set_register(&VM.registers[first_dest + 1], data2, type2);
 
     VM.pc++;
-    return OK;
+    VM_DISPATCH();
   }
 
-  default:
+  VM_OP(OP_TypedArithmetic) {
+    int32_t dest = TYPED_ARITHMETIC_DEST_REG();
+    typed_value *a = &VM.registers[TYPED_ARITHMETIC_LEFT_REG()];
+    typed_value *b = &VM.registers[TYPED_ARITHMETIC_RIGHT_REG()];
+
+    uint8_t result[TYPED_VALUE_INLINE_SIZE];
+    TYPED_ARITHMETIC_KERNEL()(result, a->data, b->data);
+
+    if (TRACE) {
+      printf("=> R[%d] = ", dest);
+      type_print(a->type, a->data);
+      printf(" %s ", debug_arith_op_name(TYPED_ARITHMETIC_OP()));
+      type_print(b->type, b->data);
+      printf(" = ");
+      type_print(a->type, result);
+      printf("\n");
+    }
+
+    set_register(&VM.registers[dest], result, a->type);
+    VM.pc++;
+    VM_DISPATCH();
+  }
+
+  VM_OP(OP_TypedTest) {
+    int32_t dest = TYPED_TEST_DEST_REG();
+    typed_value *a = &VM.registers[TYPED_TEST_LEFT_REG()];
+    typed_value *b = &VM.registers[TYPED_TEST_RIGHT_REG()];
+    uint32_t test_result = TYPED_TEST_KERNEL()(a->data, b->data);
+
+    if (TRACE) {
+      printf("=> R[%d] = (", dest);
+      type_print(a->type, a->data);
+      printf(" %s ", debug_compare_op_name(TYPED_TEST_OP()));
+      type_print(b->type, b->data);
+      printf(") = %s\n", test_result ? "TRUE" : "FALSE");
+    }
+
+    set_register(&VM.registers[dest], (uint8_t *)&test_result, TYPE_U32);
+    VM.pc++;
+    VM_DISPATCH();
+  }
+
+  VM_DEFAULT {
     printf("Unknown opcode: %d\n", inst->opcode);
     return ERR;
   }
+
+#ifndef VM_COMPUTED_GOTO
+    }
+  }
+#endif
 }
 
 VM_RESULT
-vm_execute(vm_instruction *instructions, int instruction_count) {
-  reset();
+vm_execute(vm_instruction *instructions, int instruction_count,
+           vm_profile *profile) {
+  reset(program_registers(instructions, instruction_count));
   VM.program = instructions;
   VM.program_size = instruction_count;
 
@@ -942,11 +1830,42 @@ vm_execute(vm_instruction *instructions, int instruction_count) {
     printf("\n===== EXECUTION TRACE =====\n");
   }
 
-  while (!VM.halted && VM.pc < VM.program_size) {
-    VM_RESULT result = step();
-    if (result != OK) {
-      return result;
+  VM_RESULT result;
+  if (profile) {
+    *profile = {};
+    profile->instruction_count = instruction_count;
+    profile->instructions =
+        (vm_instruction_profile *)arena<query_arena>::alloc(
+            sizeof(vm_instruction_profile) * instruction_count);
+    memset(profile->instructions, 0,
+           sizeof(vm_instruction_profile) * instruction_count);
+    VM.profile = profile;
+    VM.profiled_pc = -1;
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t first_tick = profile_ticks();
+    result = _debug ? run<true, true>() : run<false, true>();
+    uint64_t last_tick = profile_ticks();
+    profile_finish(last_tick);
+    profile->ticks = last_tick - first_tick;
+    profile->nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    for (int pc = 0; pc < instruction_count; pc++) {
+      if (instructions[pc].opcode == OP_Result) {
+        profile->rows += profile->instructions[pc].executions;
+      }
     }
+    VM.profile = nullptr;
+  } else {
+    result = _debug ? run<true, false>() : run<false, false>();
+  }
+
+  if (!release_cursors() && result == OK) {
+    result = ERR;
+  }
+  if (result != OK) {
+    return result;
   }
 
   if (_debug) {
@@ -957,6 +1876,120 @@ vm_execute(vm_instruction *instructions, int instruction_count) {
   return OK;
 }
 
-void vm_set_result_callback(result_callback callback) {
+/*
+ * The cursor an instruction works on, -1 for none
+ */
+static int32_t instruction_cursor(const vm_instruction *inst) {
+  switch (inst->opcode) {
+  case OP_Open:
+  case OP_Close:
+  case OP_Rewind:
+  case OP_Step:
+  case OP_Scan:
+  case OP_StepJump:
+  case OP_Seek:
+  case OP_Column:
+  case OP_ColumnTest:
+  case OP_Insert:
+  case OP_Delete:
+  case OP_Update:
+  case OP_AggStep:
+    return inst->p1;
+  default:
+    return -1;
+  }
+}
+
+/*
+ * What a cursor reads, for the profile's summary. A btree is named for the
+ * table or index it belongs to.
+ */
+static void print_cursor_source(cursor_context *context) {
+  static const char *names[] = {"BPLUS",  "RED_BLACK", "BLOB",  "SORTER",
+                                "MEMTREE", "HASH",     "GATHER"};
+  printf("%s", names[context->type]);
+  if (context->type != BPLUS) {
+    return;
+  }
+
+  for (auto [name, table] : catalog) {
+    if (&table.storage.btree == context->storage.tree) {
+      printf(" %.*s", (int)name.length(), name.c_str());
+      return;
+    }
+    for (auto &index : table.indexes) {
+      if (&index.btree == context->storage.tree) {
+        printf(" %.*s (index %s)", (int)name.length(), name.c_str(),
+               index.name);
+        return;
+      }
+    }
+  }
+}
+
+void vm_print_profile(vm_instruction *instructions, int instruction_count,
+                      vm_profile *profile) {
+  double ns_per_tick =
+      profile->ticks ? (double)profile->nanoseconds / profile->ticks : 0;
+
+  printf("%10s %10s %10s %8s %8s %10s\n", "count", "time_us", "rows",
+         "hits", "misses", "read_kb");
+  for (int pc = 0; pc < instruction_count; pc++) {
+    vm_instruction_profile *entry = &profile->instructions[pc];
+    printf("%10llu %10.1f %10llu %8llu %8llu %10llu  ",
+           (unsigned long long)entry->executions,
+           entry->ticks * ns_per_tick / 1000.0,
+           (unsigned long long)entry->rows,
+           (unsigned long long)entry->page_hits,
+           (unsigned long long)entry->page_misses,
+           (unsigned long long)(entry->bytes_read / 1024));
+    vm_debug_print_instruction(&instructions[pc], pc);
+  }
+
+  printf("\n%10s %10s %10s %8s %8s %10s\n", "cursor", "time_us", "rows",
+         "hits", "misses", "read_kb");
+  for (int pc = 0; pc < instruction_count; pc++) {
+    if (instructions[pc].opcode != OP_Open) {
+      continue;
+    }
+
+    // A cursor id can be reopened later in the program, its instructions
+    // until then are its own
+    int32_t cursor_id = instructions[pc].p1;
+    vm_instruction_profile total = {};
+    for (int i = pc; i < instruction_count; i++) {
+      if (i > pc && instructions[i].opcode == OP_Open &&
+          instructions[i].p1 == cursor_id) {
+        break;
+      }
+      if (instruction_cursor(&instructions[i]) != cursor_id) {
+        continue;
+      }
+      vm_instruction_profile *entry = &profile->instructions[i];
+      total.ticks += entry->ticks;
+      total.page_hits += entry->page_hits;
+      total.page_misses += entry->page_misses;
+      total.bytes_read += entry->bytes_read;
+      if (instructions[i].opcode != OP_Column &&
+          instructions[i].opcode != OP_ColumnTest) {
+        total.rows += entry->rows;
+      }
+    }
+
+    printf("%10d %10.1f %10llu %8llu %8llu %10llu  ", cursor_id,
+           total.ticks * ns_per_tick / 1000.0, (unsigned long long)total.rows,
+           (unsigned long long)total.page_hits,
+           (unsigned long long)total.page_misses,
+           (unsigned long long)(total.bytes_read / 1024));
+    print_cursor_source((cursor_context *)instructions[pc].p4);
+    printf("\n");
+  }
+
+  printf("\n%llu rows returned in %.3f ms\n", (unsigned long long)profile->rows,
+         profile->nanoseconds / 1e6);
+}
+
+void vm_set_result_callback(result_callback callback, bool in_place) {
   VM.emit_row = callback;
+  VM.emit_in_place = in_place;
 }
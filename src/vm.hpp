@@ -12,8 +12,6 @@
 #include <cstdint>
 #include <cstring>
 
-#define REGISTERS 20
-
 /*
  * OP_Function callback
  * for implementing some specific operations that would be contrived
@@ -31,7 +29,62 @@ enum STORAGE_TYPE : uint8_t
 {
 	BPLUS,
 	RED_BLACK,
-	BLOB
+	BLOB,
+	SORTER,
+	MEMTREE,
+	HASH,
+	GATHER /* Rows of a parallel scan, see parallel.hpp */
+};
+
+struct parallel_plan;
+
+/*
+ * 'column op constant' conditions, AND'ed together, that OP_Scan tests
+ * against the stored row itself. Rows that fail are skipped inside the
+ * storage scan without any of their columns being loaded into registers.
+ */
+#define SCAN_FILTER_MAX_TERMS 8
+
+struct scan_term
+{
+	uint32_t	  column;
+	COMPARISON_OP op;
+	uint8_t		 *value;  // in the column's type
+	type_test_kernel kernel; // for the column's type and op, nullptr tests generically
+};
+
+struct scan_filter
+{
+	uint32_t  term_count;
+	scan_term terms[SCAN_FILTER_MAX_TERMS];
+	bool	  has_stop;
+	scan_term stop; // on the key, the scan ends at the first row failing it
+};
+
+/*
+ * How OP_AggStep folds a row into its group's state in a HASH cursor, a column
+ * of the state per term. AVG is compiled as a SUM and a COUNT.
+ */
+enum AGGREGATE_OP : uint8_t
+{
+	AGGREGATE_COUNT,
+	AGGREGATE_SUM,
+	AGGREGATE_MIN,
+	AGGREGATE_MAX
+};
+
+struct aggregate_term
+{
+	AGGREGATE_OP op;
+	data_type	 type;	 // of the state column
+	int32_t		 arg;	 // register, after the key's, of the row's value, -1 for COUNT
+	uint32_t	 offset; // of the state column in the record
+};
+
+struct aggregate_spec
+{
+	uint32_t		term_count;
+	aggregate_term *terms;
 };
 
 struct cursor_context
@@ -39,10 +92,37 @@ struct cursor_context
 	STORAGE_TYPE type;
 	tuple_format layout; // ephemeral tree or btree row format
 	union {
-		btree *tree;
+		btree		  *tree;
+		parallel_plan *plan; // GATHER
 		// potentially add more storage backends
 	} storage;
-	uint8_t flags;
+	uint8_t		 flags; // RED_BLACK, MEMTREE: allow duplicates, SORTER: descending
+	scan_filter *filter; // for OP_Scan, nullptr passes every row
+	uint32_t	 keep;	 // SORTER: only the first this many rows are read, 0 for all
+	aggregate_spec *aggregates; // HASH: one row per key, combined with OP_AggStep, nullptr for a row per insert
+};
+
+/*
+ * What an OP_StepJump advances with
+ */
+enum STEP_JUMP_MODE : uint8_t
+{
+	STEP_JUMP_BACKWARD = 0, /* OP_Step backward */
+	STEP_JUMP_FORWARD = 1,	/* OP_Step forward */
+	STEP_JUMP_SCAN = 2,		/* OP_Scan */
+};
+
+/*
+ * The operands of an OP_ColumnTest, too many for the instruction itself
+ */
+struct column_test
+{
+	int32_t		  column;
+	int32_t		  column_reg; // receives the column, as OP_Column would
+	int32_t		  right_reg;
+	int32_t		  test_reg; // receives the comparison, as OP_Test would
+	COMPARISON_OP op;
+	type_test_kernel kernel; // from an OP_TypedTest, nullptr tests generically
 };
 
 /* The output callback: value array which comprises row + number of columns*/
@@ -97,6 +177,29 @@ enum OPCODE : uint8_t
 #define STEP_DEBUG_PRINT()                                                                                             \
 	printf("STEP cursor=%d %s -> R[%d]", STEP_CURSOR_ID(), STEP_FORWARD() ? "forward" : "backward", STEP_RESULT_REG())
 
+	OP_Scan = 15,
+#define SCAN_MAKE(cursor_id, result_reg, from_current) {OP_Scan, cursor_id, result_reg, 0, nullptr, (uint8_t)from_current}
+#define SCAN_CURSOR_ID()							   (inst->p1)
+#define SCAN_RESULT_REG()							   (inst->p2)
+#define SCAN_FROM_CURRENT()							   (inst->p5 != 0)
+#define SCAN_DEBUG_PRINT()                                                                                             \
+	printf("SCAN cursor=%d %s -> R[%d]", SCAN_CURSOR_ID(), SCAN_FROM_CURRENT() ? "from current" : "forward",           \
+		   SCAN_RESULT_REG())
+
+	/* Superinstructions, fused by program_builder from the sequences they replace */
+
+	OP_StepJump = 16, // Step or Scan, then JumpIf back into the loop
+#define STEPJUMP_MAKE(cursor_id, result_reg, jump_pc, mode)                                                           \
+	{OP_StepJump, cursor_id, jump_pc, result_reg, nullptr, (uint8_t)mode}
+#define STEPJUMP_CURSOR_ID()  (inst->p1)
+#define STEPJUMP_TARGET()	  (inst->p2)
+#define STEPJUMP_RESULT_REG() (inst->p3)
+#define STEPJUMP_MODE()		  ((STEP_JUMP_MODE)(inst->p5))
+#define STEPJUMP_DEBUG_PRINT()                                                                                         \
+	printf("STEPJUMP cursor=%d %s -> R[%d], PC=%d if more", STEPJUMP_CURSOR_ID(),                                      \
+		   STEPJUMP_MODE() == STEP_JUMP_SCAN ? "scan" : (STEPJUMP_MODE() == STEP_JUMP_FORWARD ? "forward" : "backward"), \
+		   STEPJUMP_RESULT_REG(), (int)STEPJUMP_TARGET())
+
 	OP_Seek = 20,
 #define SEEK_MAKE(cursor_id, key_reg, result_reg, op) {OP_Seek, cursor_id, key_reg, result_reg, nullptr, (uint8_t)op}
 #define SEEK_CURSOR_ID()							  (inst->p1)
@@ -109,11 +212,29 @@ enum OPCODE : uint8_t
 
 	OP_Column = 30,
 #define COLUMN_MAKE(cursor_id, column_index, dest_reg) {OP_Column, cursor_id, column_index, dest_reg, nullptr, 0}
-#define COLUMN_CURSOR_ID()							   (inst->p1)
-#define COLUMN_INDEX()								   (inst->p2)
-#define COLUMN_DEST_REG()							   (inst->p3)
+// The register points at the stored row instead of holding a copy, only for values too large to inline, and only
+// where the row isn't modified before the register is last read
+#define COLUMN_REFERENCE_MAKE(cursor_id, column_index, dest_reg) {OP_Column, cursor_id, column_index, dest_reg, nullptr, 1}
+#define COLUMN_CURSOR_ID()										 (inst->p1)
+#define COLUMN_INDEX()											 (inst->p2)
+#define COLUMN_DEST_REG()										 (inst->p3)
+#define COLUMN_REFERENCE()										 (inst->p5 != 0)
 #define COLUMN_DEBUG_PRINT()                                                                                           \
-	printf("COLUMN cursor=%d col=%d -> R[%d]", COLUMN_CURSOR_ID(), COLUMN_INDEX(), COLUMN_DEST_REG())
+	printf("COLUMN cursor=%d col=%d -> R[%d]%s", COLUMN_CURSOR_ID(), COLUMN_INDEX(), COLUMN_DEST_REG(),               \
+		   COLUMN_REFERENCE() ? " (ref)" : "")
+
+	OP_ColumnTest = 31, // Column, Test against a register, then JumpIf on the result
+#define COLUMNTEST_MAKE(cursor_id, jump_pc, params, jump_on_true)                                                      \
+	{OP_ColumnTest, cursor_id, jump_pc, 0, params, (uint8_t)jump_on_true}
+#define COLUMNTEST_CURSOR_ID()	  (inst->p1)
+#define COLUMNTEST_TARGET()		  (inst->p2)
+#define COLUMNTEST_PARAMS()		  ((column_test *)(inst->p4))
+#define COLUMNTEST_JUMP_ON_TRUE() (inst->p5 != 0)
+#define COLUMNTEST_DEBUG_PRINT()                                                                                       \
+	printf("COLUMNTEST R[%d] <- cursor=%d col=%d, R[%d] <- R[%d] %s R[%d], %s -> PC=%d",                               \
+		   COLUMNTEST_PARAMS()->column_reg, COLUMNTEST_CURSOR_ID(), COLUMNTEST_PARAMS()->column,                       \
+		   COLUMNTEST_PARAMS()->test_reg, COLUMNTEST_PARAMS()->column_reg, debug_compare_op_name(COLUMNTEST_PARAMS()->op), \
+		   COLUMNTEST_PARAMS()->right_reg, COLUMNTEST_JUMP_ON_TRUE() ? "TRUE" : "FALSE", (int)COLUMNTEST_TARGET())
 
 	OP_Insert = 34,
 #define INSERT_MAKE(cursor_id, start_reg, reg_count) {OP_Insert, cursor_id, start_reg, reg_count, nullptr, 0}
@@ -139,6 +260,17 @@ enum OPCODE : uint8_t
 #define UPDATE_RECORD_REG()				   (inst->p2)
 #define UPDATE_DEBUG_PRINT()			   printf("UPDATE cursor=%d record=R[%d]", UPDATE_CURSOR_ID(), UPDATE_RECORD_REG())
 
+	/*
+	 * The row's group key in R[key_reg] and its values after it, folded into
+	 * the group's state, the record of the row with that key, in place. The
+	 * cursor is a HASH one opened with aggregates, that describe the state.
+	 */
+	OP_AggStep = 37,
+#define AGGSTEP_MAKE(cursor_id, key_reg) {OP_AggStep, cursor_id, key_reg, 0, nullptr, 0}
+#define AGGSTEP_CURSOR_ID()				 (inst->p1)
+#define AGGSTEP_KEY_REG()				 (inst->p2)
+#define AGGSTEP_DEBUG_PRINT()			 printf("AGGSTEP cursor=%d key=R[%d]", AGGSTEP_CURSOR_ID(), AGGSTEP_KEY_REG())
+
 	OP_Move = 40,
 #define MOVE_MOVE_MAKE(dest_reg, src_reg) {OP_Move, dest_reg, 0, src_reg, nullptr, 0}
 #define MOVE_DEST_REG()					  (inst->p1)
@@ -245,6 +377,36 @@ enum OPCODE : uint8_t
 #define UNPACK2_DEBUG_PRINT()                                                                                          \
 	printf("UNPACK2 R[%d],R[%d] <- unpack(R[%d])", UNPACK2_FIRST_DEST_REG(), UNPACK2_FIRST_DEST_REG() + 1,             \
 		   UNPACK2_SRC_REG())
+
+	/*
+	 * Typed variants, emitted when the compiler knows the operand type: the
+	 * kernel for that type and op (see type_test_kernel_for) is called
+	 * directly, rather than the type being decoded for every row. The op is
+	 * only kept for printing.
+	 */
+	OP_TypedArithmetic = 70,
+#define TYPED_ARITHMETIC_MAKE(dest_reg, left_reg, right_reg, op, kernel)                                               \
+	{OP_TypedArithmetic, dest_reg, left_reg, right_reg, (void *)kernel, (uint8_t)op}
+#define TYPED_ARITHMETIC_DEST_REG()	 (inst->p1)
+#define TYPED_ARITHMETIC_LEFT_REG()	 (inst->p2)
+#define TYPED_ARITHMETIC_RIGHT_REG() (inst->p3)
+#define TYPED_ARITHMETIC_KERNEL()	 ((type_arith_kernel)(inst->p4))
+#define TYPED_ARITHMETIC_OP()		 ((ARITH_OP)(inst->p5))
+#define TYPED_ARITHMETIC_DEBUG_PRINT()                                                                                 \
+	printf("TYPED_ARITHMETIC R[%d] <- R[%d] %s R[%d]", TYPED_ARITHMETIC_DEST_REG(), TYPED_ARITHMETIC_LEFT_REG(),       \
+		   debug_arith_op_name(TYPED_ARITHMETIC_OP()), TYPED_ARITHMETIC_RIGHT_REG())
+
+	OP_TypedTest = 71,
+#define TYPED_TEST_MAKE(dest_reg, left_reg, right_reg, op, kernel)                                                     \
+	{OP_TypedTest, dest_reg, left_reg, right_reg, (void *)kernel, (uint8_t)op}
+#define TYPED_TEST_DEST_REG()  (inst->p1)
+#define TYPED_TEST_LEFT_REG()  (inst->p2)
+#define TYPED_TEST_RIGHT_REG() (inst->p3)
+#define TYPED_TEST_KERNEL()	   ((type_test_kernel)(inst->p4))
+#define TYPED_TEST_OP()		   ((COMPARISON_OP)(inst->p5))
+#define TYPED_TEST_DEBUG_PRINT()                                                                                       \
+	printf("TYPED_TEST R[%d] <- R[%d] %s R[%d]", TYPED_TEST_DEST_REG(), TYPED_TEST_LEFT_REG(),                         \
+		   debug_compare_op_name(TYPED_TEST_OP()), TYPED_TEST_RIGHT_REG())
 };
 
 /* A loose interpretation of sqlite's opcode structure */
@@ -273,11 +435,53 @@ enum VM_RESULT : uint8_t
 	ERR
 };
 
+/*
+ * EXPLAIN ANALYZE, what each instruction did while the program ran. Runs
+ * with profiling are a separate instantiation of the dispatch loop, like
+ * tracing, so other runs pay nothing for it.
+ *
+ * Time is in ticks of the cheapest clock there is, the cycle counter on x86
+ * and arm64, scaled to nanoseconds by how many passed over the whole run.
+ * The pager's counters are global, so a page another session reads while
+ * an instruction runs is counted against it too.
+ */
+struct vm_instruction_profile
+{
+	uint64_t executions;
+	uint64_t ticks;
+	uint64_t rows; // Results emitted, rows inserted, or cursor moves onto a row
+	uint64_t page_hits, page_misses, bytes_read;
+};
+
+struct vm_profile
+{
+	uint32_t				instruction_count;
+	vm_instruction_profile *instructions; // By PC, in the query arena
+	uint64_t				ticks;		  // Over the whole run
+	uint64_t				nanoseconds;
+	uint64_t				rows; // Results emitted
+};
+
+/*
+ * With profile, its counters are filled in as the program runs, see
+ * vm_print_profile
+ */
 VM_RESULT
-vm_execute(vm_instruction *instructions, int instruction_count);
+vm_execute(vm_instruction *instructions, int instruction_count, vm_profile *profile = nullptr);
 
+/*
+ * Each instruction with what it did, then what each cursor did in total
+ */
+void
+vm_print_profile(vm_instruction *instructions, int instruction_count, vm_profile *profile);
+
+/*
+ * Rows are normally copied before they're handed to the callback, and stay
+ * valid until the query arena is reset. In place, the callback is given the
+ * registers themselves, which are only valid for the call.
+ */
 void
-vm_set_result_callback(result_callback callback);
+vm_set_result_callback(result_callback callback, bool in_place = false);
 
 
 
@@ -306,6 +510,15 @@ vm_debug_print_instruction(const vm_instruction *inst, int pc)
 	case OP_Step:
 		STEP_DEBUG_PRINT();
 		break;
+	case OP_Scan:
+		SCAN_DEBUG_PRINT();
+		break;
+	case OP_StepJump:
+		STEPJUMP_DEBUG_PRINT();
+		break;
+	case OP_ColumnTest:
+		COLUMNTEST_DEBUG_PRINT();
+		break;
 	case OP_Seek:
 		SEEK_DEBUG_PRINT();
 		break;
@@ -321,6 +534,9 @@ vm_debug_print_instruction(const vm_instruction *inst, int pc)
 	case OP_Update:
 		UPDATE_DEBUG_PRINT();
 		break;
+	case OP_AggStep:
+		AGGSTEP_DEBUG_PRINT();
+		break;
 	case OP_Move:
 		MOVE_DEBUG_PRINT();
 		break;
@@ -360,6 +576,12 @@ vm_debug_print_instruction(const vm_instruction *inst, int pc)
 	case OP_Unpack:
 		UNPACK2_DEBUG_PRINT();
 		break;
+	case OP_TypedArithmetic:
+		TYPED_ARITHMETIC_DEBUG_PRINT();
+		break;
+	case OP_TypedTest:
+		TYPED_TEST_DEBUG_PRINT();
+		break;
 	default:
 		printf("UNKNOWN opcode=%d", inst->opcode);
 		break;